@@ -205,6 +205,8 @@ void App::CloseOrHideWindow()
 void App::OnLaunched(LaunchActivatedEventArgs const&)
 {
     PersistAppComMarker(0xAC0C1000);
+    // 同期が設定されていれば、最初の保存までに同期サーバーへの接続と token を用意しておく (バックグラウンド)。
+    PluginRegistrationManager::getInstance().StartSyncPrewarm();
     std::wstring argsString{ m_args };
     if (argsString.find(L"-PluginActivated") != std::wstring::npos)
     {
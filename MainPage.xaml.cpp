@@ -2342,17 +2342,30 @@ namespace winrt::PasskeyManager::implementation
         std::wstring requestId = BuildRequestId(operation);
         std::wstring syncBaseUrl = NormalizeSyncBaseUrl(ReadSyncSettingValue(kSyncBaseUrlEnv));
         std::wstring parsedHostValue = ResolveSyncHostValueOrUnparsed(syncBaseUrl);
+        auto cancellation = std::make_shared<tsupasswd::SyncCancellationSource>();
+        m_manualSyncCancellation = cancellation;
         manualSyncButton().IsEnabled(false);
+        cancelManualSyncButton().IsEnabled(true);
         LogInProgress(winrt::hstring{ L"summary state=running operation=" + operation + L" request_id=" + requestId });
 
         co_await winrt::resume_background();
-        HRESULT hr = PluginRegistrationManager::getInstance().ManualResyncSelfHostedVault(requestId);
+        HRESULT hr = PluginRegistrationManager::getInstance().ManualResyncSelfHostedVault(requestId, nullptr, nullptr, cancellation->Token());
 
         co_await wil::resume_foreground(DispatcherQueue());
         if (auto self = weakThis.get())
         {
+            if (self->m_manualSyncCancellation == cancellation)
+            {
+                self->m_manualSyncCancellation.reset();
+            }
             self->manualSyncButton().IsEnabled(true);
-            if (SUCCEEDED(hr))
+            self->cancelManualSyncButton().IsEnabled(false);
+            if (hr == HRESULT_FROM_WIN32(ERROR_CANCELLED))
+            {
+                self->syncStatusTextBlock().Text(winrt::hstring{ L"INFO: summary result=cancelled operation=" + operation + L" request_id=" + requestId + L"ℹ" });
+                self->LogInfo(winrt::hstring{ L"summary result=cancelled operation=" + operation + L" request_id=" + requestId });
+            }
+            else if (SUCCEEDED(hr))
             {
                 self->syncStatusTextBlock().Text(winrt::hstring{ L"SUCCESS: summary result=success operation=" + operation + L" request_id=" + requestId + L"✅" });
                 self->LogSuccess(winrt::hstring{ L"summary result=success operation=" + operation + L" request_id=" + requestId });
@@ -2379,6 +2392,16 @@ namespace winrt::PasskeyManager::implementation
         co_return;
     }
 
+    void MainPage::cancelManualSyncButton_Click(IInspectable const&, Microsoft::UI::Xaml::RoutedEventArgs const&)
+    {
+        if (m_manualSyncCancellation)
+        {
+            // 通信中の要求は transport がソケットを閉じて即座に戻る。結果の表示は manualSyncButton_Click 側で行う。
+            cancelManualSyncButton().IsEnabled(false);
+            m_manualSyncCancellation->Cancel();
+        }
+    }
+
     winrt::IAsyncAction MainPage::saveVaultLoginItemButton_Click(IInspectable const&, Microsoft::UI::Xaml::RoutedEventArgs const&)
     {
         bool isEditing = !m_editingVaultLoginItemId.empty();
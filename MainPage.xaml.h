@@ -5,6 +5,7 @@
 #include <winrt/Microsoft.UI.Xaml.Controls.h>
 #include <winrt/Microsoft.UI.Xaml.Documents.h>
 #include "CredentialListViewModel.h"
+#include "src/SyncCancellation.h"
 #include "src/SyncSnapshotStore.h"
 #include <winrt/Windows.Foundation.h>
 #include "Converter/BitwiseFlagToVisibilityConverter.h"
@@ -14,6 +15,7 @@
 #include <ctime>
 #include <cwctype>
 #include <cwchar>
+#include <memory>
 #include <vector>
 
 namespace winrt {
@@ -68,6 +70,7 @@ namespace winrt::PasskeyManager::implementation
         winrt::IAsyncAction runVaultSchemaSelfTestButton_Click(IInspectable const& sender, Microsoft::UI::Xaml::RoutedEventArgs const& args);
         winrt::IAsyncAction clearLocalVaultButton_Click(IInspectable const& sender, Microsoft::UI::Xaml::RoutedEventArgs const& args);
         winrt::IAsyncAction manualSyncButton_Click(IInspectable const& sender, Microsoft::UI::Xaml::RoutedEventArgs const& args);
+        void cancelManualSyncButton_Click(IInspectable const& sender, Microsoft::UI::Xaml::RoutedEventArgs const& args);
         winrt::IAsyncAction saveVaultLoginItemButton_Click(IInspectable const& sender, Microsoft::UI::Xaml::RoutedEventArgs const& args);
         winrt::IAsyncAction editSelectedVaultLoginItemButton_Click(IInspectable const& sender, Microsoft::UI::Xaml::RoutedEventArgs const& args);
         winrt::IAsyncAction cancelVaultLoginEditButton_Click(IInspectable const& sender, Microsoft::UI::Xaml::RoutedEventArgs const& args);
@@ -416,6 +419,8 @@ namespace winrt::PasskeyManager::implementation
         std::optional<ULONGLONG> m_lastObservedMakeCredentialSequence{};
         std::vector<tsupasswd::SyncSnapshotRecord> m_syncSnapshotCandidates{};
         std::wstring m_editingVaultLoginItemId{};
+        // 実行中の「今すぐ同期する」の取消。UI スレッドからだけ触る。
+        std::shared_ptr<tsupasswd::SyncCancellationSource> m_manualSyncCancellation{};
         void UpdateVaultUnlockControlText(bool isLocked);
         void SetVaultLockSwitchState(bool isOn);
         void ResetVaultLoginEditor();
@@ -2654,7 +2654,8 @@ namespace winrt::PasskeyManager::implementation
         std::wstring const& url,
         std::wstring const& notes,
         std::wstring const& requestId,
-        bool resync) try
+        bool resync,
+        std::shared_future<HRESULT>* outSync) try
     {
         UNREFERENCED_PARAMETER(hwnd);
         std::wstring localRequestId = requestId;
@@ -2827,7 +2828,12 @@ namespace winrt::PasskeyManager::implementation
         RETURN_IF_FAILED(PluginRegistrationManager::getInstance().WriteEncryptedVaultData(std::vector<BYTE>(cipherBytes.begin(), cipherBytes.end())));
         if (resync)
         {
-            RETURN_IF_FAILED(PluginRegistrationManager::getInstance().ManualResyncSelfHostedVault(localRequestId + L"-sync"));
+            // 同期はバックグラウンドでまとめて行い、保存はローカルの書き込みだけで戻る。
+            std::shared_future<HRESULT> queuedSync = PluginRegistrationManager::getInstance().QueueVaultSync(localRequestId + L"-sync");
+            if (outSync)
+            {
+                *outSync = std::move(queuedSync);
+            }
         }
         AppendPersistentSyncDiagnosticLog(
             L"SUCCESS: sync result=success operation=save_login_item step=completed request_id=" + localRequestId + L"\n");
@@ -2901,7 +2907,8 @@ namespace winrt::PasskeyManager::implementation
         std::wstring const& url,
         std::wstring const& notes,
         std::wstring const& requestId,
-        bool resync) try
+        bool resync,
+        std::shared_future<HRESULT>* outSync) try
     {
         RETURN_HR_IF(E_INVALIDARG, itemId.empty());
 
@@ -3002,7 +3009,12 @@ namespace winrt::PasskeyManager::implementation
         RETURN_IF_FAILED(PluginRegistrationManager::getInstance().WriteEncryptedVaultData(std::vector<BYTE>(cipherBytes.begin(), cipherBytes.end())));
         if (resync)
         {
-            RETURN_IF_FAILED(PluginRegistrationManager::getInstance().ManualResyncSelfHostedVault(localRequestId + L"-sync"));
+            // 同期はバックグラウンドでまとめて行い、保存はローカルの書き込みだけで戻る。
+            std::shared_future<HRESULT> queuedSync = PluginRegistrationManager::getInstance().QueueVaultSync(localRequestId + L"-sync");
+            if (outSync)
+            {
+                *outSync = std::move(queuedSync);
+            }
         }
         return S_OK;
     }
@@ -3011,7 +3023,8 @@ namespace winrt::PasskeyManager::implementation
     HRESULT PluginCredentialManager::DeleteVaultLoginItemById(
         std::wstring const& itemId,
         std::wstring const& requestId,
-        bool resync) try
+        bool resync,
+        std::shared_future<HRESULT>* outSync) try
     {
         if (itemId.empty())
         {
@@ -3098,7 +3111,12 @@ namespace winrt::PasskeyManager::implementation
         RETURN_IF_FAILED(PluginRegistrationManager::getInstance().WriteEncryptedVaultData(std::vector<BYTE>(cipherBytes.begin(), cipherBytes.end())));
         if (resync)
         {
-            RETURN_IF_FAILED(PluginRegistrationManager::getInstance().ManualResyncSelfHostedVault(localRequestId + L"-sync"));
+            // 同期はバックグラウンドでまとめて行い、保存はローカルの書き込みだけで戻る。
+            std::shared_future<HRESULT> queuedSync = PluginRegistrationManager::getInstance().QueueVaultSync(localRequestId + L"-sync");
+            if (outSync)
+            {
+                *outSync = std::move(queuedSync);
+            }
         }
         return S_OK;
     }
@@ -3,6 +3,7 @@
 #include <string>
 #include <map>
 #include <fstream>
+#include <future>
 #include <optional>
 #include <windows.h>
 #include <winrt/Microsoft.UI.Xaml.h>
@@ -174,6 +175,8 @@ namespace winrt::PasskeyManager::implementation
         VaultUnlockMethod GetVaultUnlockMethod();
         HRESULT UnlockCredentialVaultWithPasskey(HWND hwnd);
         HRESULT ExportDecryptedVaultJsonWithPasskey(HWND hwnd, std::wstring& outJson, std::wstring const& requestId = L"");
+        // Save/Update/Delete の resync は PluginRegistrationManager::QueueVaultSync で同期を予約するだけで待たない。
+        // outSync を渡すとその同期の結果を待てる。
         HRESULT SaveLoginItemToVaultWithPasskey(
             HWND hwnd,
             std::wstring const& title,
@@ -182,7 +185,8 @@ namespace winrt::PasskeyManager::implementation
             std::wstring const& url,
             std::wstring const& notes,
             std::wstring const& requestId = L"",
-            bool resync = true);
+            bool resync = true,
+            std::shared_future<HRESULT>* outSync = nullptr);
         HRESULT GetVaultLoginItemById(
             std::wstring const& itemId,
             tsupasswd::VaultItemV1& outItem,
@@ -195,11 +199,13 @@ namespace winrt::PasskeyManager::implementation
             std::wstring const& url,
             std::wstring const& notes,
             std::wstring const& requestId = L"",
-            bool resync = true);
+            bool resync = true,
+            std::shared_future<HRESULT>* outSync = nullptr);
         HRESULT DeleteVaultLoginItemById(
             std::wstring const& itemId,
             std::wstring const& requestId = L"",
-            bool resync = true);
+            bool resync = true,
+            std::shared_future<HRESULT>* outSync = nullptr);
     private:
         PluginCredentialManager();
         ~PluginCredentialManager();
@@ -1,14 +1,21 @@
 #include "pch.h"
 #include "MainPage.xaml.h"
 #include "PluginRegistrationManager.h"
+#include "src/NativeHostMetrics.h"
 #include "src/RequestId.h"
 #include "src/SyncClient.h"
+#include "src/SyncResync.h"
+#include "src/SyncRetryPolicy.h"
 #include "src/SyncSnapshotStore.h"
+#include "src/SyncTokenCache.h"
 #include "src/VaultCrypto.h"
+#include "src/VaultMerge.h"
 #include "src/VaultSerialization.h"
 #include <CorError.h>
 #include <wil/safecast.h>
+#include <filesystem>
 #include <functional>
+#include <random>
 #include <thread>
 
 #pragma comment(lib, "Crypt32.lib")
@@ -27,6 +34,8 @@ namespace
     constexpr wchar_t kSyncOpaqueSessionWrapEnv[] = L"TSUPASSWD_SYNC_OPAQUE_SESSION_WRAP";
     constexpr wchar_t kSyncDisableDevLoginEnv[] = L"TSUPASSWD_SYNC_DISABLE_DEV_LOGIN";
     constexpr wchar_t kSyncVerboseDebugEnv[] = L"TSUPASSWD_SYNC_VERBOSE_DEBUG";
+    constexpr wchar_t kSyncBinaryVaultEnv[] = L"TSUPASSWD_SYNC_BINARY_VAULT";
+    constexpr wchar_t kSyncDeltaEnv[] = L"TSUPASSWD_SYNC_DELTA";
     constexpr wchar_t kVaultSchemaSelfTestEnv[] = L"TSUPASSWD_VAULT_SCHEMA_SELF_TEST";
     constexpr wchar_t kVaultRecoveryCodeEnv[] = L"TSUPASSWD_VAULT_RECOVERY_CODE";
     constexpr wchar_t kDefaultSyncUserId[] = L"self";
@@ -289,6 +298,20 @@ namespace
         return IsTruthySetting(GetEnvironmentVariableValue(kSyncOpaqueSessionWrapEnv));
     }
 
+    // vault を base64+JSON ではなく application/octet-stream で送受信する。
+    tsupasswd::SyncVaultEncoding GetSyncVaultEncoding()
+    {
+        return IsTruthySetting(GetEnvironmentVariableValue(kSyncBinaryVaultEnv)) ?
+            tsupasswd::SyncVaultEncoding::OctetStream :
+            tsupasswd::SyncVaultEncoding::Base64Json;
+    }
+
+    // manual_resync を vault 全体ではなく item 単位の差分で同期する。
+    bool IsSyncDeltaEnabled()
+    {
+        return IsTruthySetting(GetEnvironmentVariableValue(kSyncDeltaEnv));
+    }
+
     bool IsVerboseSyncDebugEnabled()
     {
         return IsTruthySetting(GetEnvironmentVariableValue(kSyncVerboseDebugEnv));
@@ -339,6 +362,49 @@ namespace
         CloseHandle(handle);
     }
 
+    // SyncSnapshotStore と同じ %LOCALAPPDATA%\PasskeyManager に置く。取れなければ空 (outbox・同期の状態への書き込みは失敗を返す)。
+    std::filesystem::path ResolveSyncDataPath(wchar_t const* fileName)
+    {
+        wil::unique_cotaskmem_string localAppData;
+        if (FAILED(SHGetKnownFolderPath(FOLDERID_LocalAppData, KF_FLAG_DEFAULT, nullptr, &localAppData)))
+        {
+            return {};
+        }
+        std::filesystem::path directory = std::filesystem::path(localAppData.get()) / L"PasskeyManager";
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        return directory / fileName;
+    }
+
+    // ManualResyncSelfHostedVault と同じ順 (ユーザー環境変数、プロセス) で同期の user を決める。outbox の key。
+    std::wstring ResolveVaultSyncUserId()
+    {
+        std::wstring syncUserId = GetUserEnvironmentRegistryValue(kSyncUserIdEnv);
+        if (syncUserId.empty())
+        {
+            syncUserId = GetProcessEnvironmentVariableValue(kSyncUserIdEnv);
+        }
+        return syncUserId;
+    }
+
+    // 設定や資格情報の誤り、取消はやり直しても変わらないので、outbox に残して次の起動か次の保存で送る。
+    bool IsRetryableVaultSyncFailure(HRESULT hr)
+    {
+        return hr != HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED) &&
+            hr != HRESULT_FROM_WIN32(ERROR_INVALID_PARAMETER) &&
+            hr != HRESULT_FROM_WIN32(ERROR_ACCESS_DISABLED_BY_POLICY) &&
+            hr != HRESULT_FROM_WIN32(ERROR_INVALID_DATA) &&
+            hr != HRESULT_FROM_WIN32(ERROR_CANCELLED);
+    }
+
+    uint32_t NextSyncRetryJitter()
+    {
+        static std::mutex mutex;
+        static std::mt19937 engine{ std::random_device{}() };
+        std::lock_guard lock(mutex);
+        return static_cast<uint32_t>(engine());
+    }
+
     std::wstring GetNowIsoLikeTimestamp()
     {
         SYSTEMTIME st{};
@@ -363,6 +429,22 @@ namespace
         return status.RequestId.empty() ? fallbackRequestId : status.RequestId;
     }
 
+    // 遅い同期の報告から、サーバー (ttfb_ms) と回線 (dns/connect/tls/send/transfer) のどちらが遅いかを読めるようにする。
+    std::wstring BuildSyncTimingDetail(tsupasswd::SyncRequestTiming const& timing)
+    {
+        return
+            L"round_trips=" + std::to_wstring(timing.RoundTrips) +
+            L" new_connections=" + std::to_wstring(timing.NewConnections) +
+            L" dns_ms=" + std::to_wstring(timing.DnsMs) +
+            L" connect_ms=" + std::to_wstring(timing.ConnectMs) +
+            L" tls_ms=" + std::to_wstring(timing.TlsMs) +
+            L" send_ms=" + std::to_wstring(timing.SendMs) +
+            L" ttfb_ms=" + std::to_wstring(timing.TimeToFirstByteMs) +
+            L" transfer_ms=" + std::to_wstring(timing.TransferMs) +
+            L" bytes_sent=" + std::to_wstring(timing.BytesSent) +
+            L" bytes_received=" + std::to_wstring(timing.BytesReceived);
+    }
+
     std::wstring BuildSyncFailureStatusMessage(HRESULT hr, tsupasswd::SyncHttpStatus const& status, std::wstring const&)
     {
         std::wstring detail =
@@ -375,6 +457,10 @@ namespace
             detail += L" code=" + status.ErrorCode;
             detail += L" message_code=" + status.ErrorCode;
         }
+        if (status.Timing.RoundTrips > 0)
+        {
+            detail += L" " + BuildSyncTimingDetail(status.Timing);
+        }
         if (!status.ErrorMessage.empty())
         {
             detail += L" message=" + status.ErrorMessage;
@@ -458,27 +544,51 @@ namespace
         return true;
     }
 
-    std::wstring MaxUpdatedAt(std::wstring const& left, std::wstring const& right)
+    // 差分同期の item 1 件を、その item だけを持つ vault 文書として暗号化する。tombstone には中身を残さない。
+    bool TrySealVaultItem(
+        tsupasswd::VaultItemV1 const& item,
+        std::wstring const& vaultId,
+        std::vector<uint8_t> const& recoveryBytes,
+        std::vector<uint8_t>& outSealed)
     {
-        return left >= right ? left : right;
+        outSealed.clear();
+        tsupasswd::VaultDocumentV1 doc{};
+        doc.VaultId = vaultId;
+        tsupasswd::VaultItemV1& sealedItem = doc.Items.emplace_back(item);
+        if (sealedItem.Deleted)
+        {
+            sealedItem.Title.clear();
+            sealedItem.Notes.clear();
+            sealedItem.Login = {};
+        }
+
+        std::vector<BYTE> cipherBytes;
+        if (!TryEncryptVaultDocument(doc, recoveryBytes, cipherBytes))
+        {
+            return false;
+        }
+        outSealed.assign(cipherBytes.begin(), cipherBytes.end());
+        return true;
     }
 
-    std::wstring NormalizeVaultIdentityPart(std::wstring value)
+    bool TryUnsealVaultItem(
+        std::vector<uint8_t> const& sealed,
+        std::wstring const& itemId,
+        std::vector<uint8_t> const& recoveryBytes,
+        tsupasswd::VaultItemV1& outItem)
     {
-        auto first = value.find_first_not_of(L" \t\r\n");
-        if (first == std::wstring::npos)
+        tsupasswd::VaultDocumentV1 doc{};
+        if (!TryDecryptVaultDocument(std::vector<BYTE>(sealed.begin(), sealed.end()), recoveryBytes, doc) ||
+            doc.Items.size() != 1 ||
+            doc.Items[0].ItemId != itemId)
         {
-            return {};
+            return false;
         }
-        auto last = value.find_last_not_of(L" \t\r\n");
-        value = value.substr(first, last - first + 1);
-        std::transform(value.begin(), value.end(), value.begin(), [](wchar_t ch)
-        {
-            return static_cast<wchar_t>(towlower(ch));
-        });
-        return value;
+        outItem = std::move(doc.Items[0]);
+        return true;
     }
 
+    // WinRT の Uri で host を取る。Uri が解釈できなければ tsupasswd::ExtractVaultRpIdFromUrl。
     std::wstring ExtractRpIdFromUrl(std::wstring const& url)
     {
         std::wstring trimmed = url;
@@ -493,56 +603,21 @@ namespace
         try
         {
             winrt::Windows::Foundation::Uri uri{ winrt::hstring{ trimmed } };
-            std::wstring host = uri.Host().c_str();
-            return NormalizeVaultIdentityPart(std::move(host));
+            return tsupasswd::NormalizeVaultIdentityPart(uri.Host());
         }
         catch (...)
         {
         }
-
-        std::wstring candidate = trimmed;
-        auto scheme = candidate.find(L"://");
-        if (scheme != std::wstring::npos)
-        {
-            candidate = candidate.substr(scheme + 3);
-        }
-        auto slash = candidate.find_first_of(L"/\t\r\n");
-        if (slash != std::wstring::npos)
-        {
-            candidate = candidate.substr(0, slash);
-        }
-        auto at = candidate.rfind(L"@");
-        if (at != std::wstring::npos)
-        {
-            candidate = candidate.substr(at + 1);
-        }
-        auto colon = candidate.rfind(L":");
-        if (colon != std::wstring::npos)
-        {
-            candidate = candidate.substr(0, colon);
-        }
-        return NormalizeVaultIdentityPart(std::move(candidate));
+        return tsupasswd::ExtractVaultRpIdFromUrl(trimmed);
     }
 
-    std::wstring BuildVaultLoginIdentity(tsupasswd::VaultItemV1 const& item)
+    void DebugLogVaultItem(std::wstring const& stage, tsupasswd::VaultItemV1 const& item)
     {
-        if (item.ItemType != tsupasswd::VaultItemType::Login)
-        {
-            return {};
-        }
-
-        std::wstring rpId = ExtractRpIdFromUrl(item.Login.Url);
-        if (rpId.empty())
+        if (!IsVerboseSyncDebugEnabled())
         {
-            rpId = NormalizeVaultIdentityPart(item.Login.Url);
+            return;
         }
-        return rpId +
-            L"\n" + NormalizeVaultIdentityPart(item.Login.Username);
-    }
-
-    void DebugLogVaultItem(std::wstring const& stage, tsupasswd::VaultItemV1 const& item)
-    {
-        std::wstring identity = BuildVaultLoginIdentity(item);
+        std::wstring identity = tsupasswd::BuildVaultLoginIdentity(item, ExtractRpIdFromUrl);
         DebugLogIfVerbose(
             L"DEBUG: vault_item stage=" + stage +
             L" item_id=" + item.ItemId +
@@ -555,6 +630,10 @@ namespace
 
     void DebugLogVaultDocument(std::wstring const& stage, tsupasswd::VaultDocumentV1 const& doc)
     {
+        if (!IsVerboseSyncDebugEnabled())
+        {
+            return;
+        }
         DebugLogIfVerbose(
             L"DEBUG: vault_doc stage=" + stage +
             L" vault_id='" + doc.VaultId + L"'" +
@@ -567,127 +646,75 @@ namespace
         }
     }
 
-    struct VaultMergeStats
-    {
-        size_t AddedFromServer = 0;
-        size_t UpdatedFromServer = 0;
-        size_t TombstonesApplied = 0;
-        size_t DuplicatesCollapsed = 0;
-    };
-
-    struct VaultMergeResult
+    // rp id は WinRT の Uri で取る。詳細ログが有効なときだけ item ごとの判断を記録する
+    // (無効ならマージの中で identity を item ごとに 1 回作るだけ)。
+    tsupasswd::VaultMergeOptions BuildVaultMergeOptionsForSync(bool verbose)
     {
-        tsupasswd::VaultDocumentV1 Document{};
-        VaultMergeStats Stats{};
-    };
+        tsupasswd::VaultMergeOptions options{};
+        options.ExtractRpId = ExtractRpIdFromUrl;
+        if (verbose)
+        {
+            options.Trace = [](wchar_t const* stage, tsupasswd::VaultItemV1 const& item)
+            {
+                DebugLogVaultItem(stage, item);
+            };
+        }
+        return options;
+    }
 
-    VaultMergeResult MergeVaultDocuments(
+    // 詳細ログが有効なときは入力と出力も記録する。
+    template <typename TServer>
+    tsupasswd::VaultMergeResult MergeVaultDocumentsForSync(
         tsupasswd::VaultDocumentV1 localDoc,
-        tsupasswd::VaultDocumentV1 const& serverDoc,
+        TServer server,
         std::wstring const& fallbackVaultId)
     {
-        VaultMergeResult result{};
-        if (localDoc.SchemaVersion <= 0)
+        bool verbose = IsVerboseSyncDebugEnabled();
+        if (verbose)
         {
-            localDoc.SchemaVersion = 1;
+            DebugLogVaultDocument(L"merge_local_input", localDoc);
         }
-        if (localDoc.VaultId.empty())
+        tsupasswd::VaultMergeResult result = tsupasswd::MergeVaultDocuments(std::move(localDoc), std::move(server), fallbackVaultId, BuildVaultMergeOptionsForSync(verbose));
+        if (verbose)
         {
-            localDoc.VaultId = !serverDoc.VaultId.empty() ? serverDoc.VaultId : fallbackVaultId;
+            DebugLogVaultDocument(L"merge_output", result.Document);
         }
+        return result;
+    }
 
-        DebugLogVaultDocument(L"merge_local_input", localDoc);
-        DebugLogVaultDocument(L"merge_server_input", serverDoc);
-
-        std::map<std::wstring, size_t> localIndexById;
-        for (size_t index = 0; index < localDoc.Items.size(); ++index)
+    tsupasswd::VaultMergeResult MergeVaultDocumentsThreeWayForSync(
+        tsupasswd::VaultDocumentV1 const& baseDoc,
+        tsupasswd::VaultDocumentV1 localDoc,
+        tsupasswd::VaultDocumentV1 serverDoc,
+        std::wstring const& fallbackVaultId)
+    {
+        bool verbose = IsVerboseSyncDebugEnabled();
+        if (verbose)
         {
-            if (!localDoc.Items[index].ItemId.empty())
-            {
-                localIndexById.emplace(localDoc.Items[index].ItemId, index);
-            }
+            DebugLogVaultDocument(L"merge_base_input", baseDoc);
+            DebugLogVaultDocument(L"merge_local_input", localDoc);
         }
-
-        for (auto const& serverItem : serverDoc.Items)
+        tsupasswd::VaultMergeResult result = tsupasswd::MergeVaultDocumentsThreeWay(baseDoc, std::move(localDoc), std::move(serverDoc), fallbackVaultId, BuildVaultMergeOptionsForSync(verbose));
+        if (verbose)
         {
-            if (serverItem.ItemId.empty())
-            {
-                continue;
-            }
-
-            auto found = localIndexById.find(serverItem.ItemId);
-            if (found == localIndexById.end())
-            {
-                localIndexById.emplace(serverItem.ItemId, localDoc.Items.size());
-                localDoc.Items.push_back(serverItem);
-                result.Stats.AddedFromServer += 1;
-                if (serverItem.Deleted)
-                {
-                    result.Stats.TombstonesApplied += 1;
-                }
-                continue;
-            }
-
-            auto& localItem = localDoc.Items[found->second];
-            DebugLogVaultItem(L"merge_by_id_local_before", localItem);
-            DebugLogVaultItem(L"merge_by_id_server_candidate", serverItem);
-            if (serverItem.UpdatedAt > localItem.UpdatedAt)
-            {
-                if (serverItem.Deleted && !localItem.Deleted)
-                {
-                    result.Stats.TombstonesApplied += 1;
-                }
-                localItem = serverItem;
-                result.Stats.UpdatedFromServer += 1;
-                DebugLogVaultItem(L"merge_by_id_local_after_replace", localItem);
-            }
+            DebugLogVaultDocument(L"merge_output", result.Document);
         }
+        return result;
+    }
 
-        std::map<std::wstring, size_t> canonicalIndexByIdentity;
-        std::vector<tsupasswd::VaultItemV1> dedupedItems;
-        dedupedItems.reserve(localDoc.Items.size());
-        for (auto const& item : localDoc.Items)
+    // 三方向マージの基準 (前回サーバーと揃えた vault の暗号文) を snapshot の履歴から探す。最後に push した "synced" を使う。
+    bool TryLoadSyncedVaultSnapshot(std::wstring const& syncUserId, std::vector<BYTE>& outCipher)
+    {
+        auto records = tsupasswd::SyncSnapshotStore::Load();
+        for (auto it = records.rbegin(); it != records.rend(); ++it)
         {
-            std::wstring identity = BuildVaultLoginIdentity(item);
-            if (identity.empty())
-            {
-                dedupedItems.push_back(item);
-                continue;
-            }
-
-            auto foundIdentity = canonicalIndexByIdentity.find(identity);
-            if (foundIdentity == canonicalIndexByIdentity.end())
-            {
-                canonicalIndexByIdentity.emplace(identity, dedupedItems.size());
-                dedupedItems.push_back(item);
-                continue;
-            }
-
-            auto& canonicalItem = dedupedItems[foundIdentity->second];
-            DebugLogVaultItem(L"dedupe_canonical_before", canonicalItem);
-            DebugLogVaultItem(L"dedupe_incoming", item);
-            bool preferIncoming = item.UpdatedAt >= canonicalItem.UpdatedAt;
-            if (preferIncoming)
-            {
-                canonicalItem = item;
-            }
-            canonicalItem.CreatedAt = canonicalItem.CreatedAt.empty() ? item.CreatedAt : canonicalItem.CreatedAt;
-            canonicalItem.UpdatedAt = MaxUpdatedAt(canonicalItem.UpdatedAt, item.UpdatedAt);
-            if (canonicalItem.Deleted || item.Deleted)
+            if (it->Source == L"synced" && it->UserId == syncUserId && !it->CipherBytes.empty())
             {
-                canonicalItem.Deleted = canonicalItem.Deleted || item.Deleted;
-                canonicalItem.DeletedAt = MaxUpdatedAt(canonicalItem.DeletedAt, item.DeletedAt);
+                outCipher = std::move(it->CipherBytes);
+                return true;
             }
-            DebugLogVaultItem(L"dedupe_canonical_after", canonicalItem);
-            result.Stats.DuplicatesCollapsed += 1;
         }
-
-        localDoc.Items = std::move(dedupedItems);
-        DebugLogVaultDocument(L"merge_output", localDoc);
-
-        localDoc.Revision = (std::max)(localDoc.Revision, serverDoc.Revision);
-        result.Document = std::move(localDoc);
-        return result;
+        return false;
     }
 
     bool TryIssueDevLoginToken(
@@ -713,10 +740,12 @@ namespace
 
         tsupasswd::SyncHttpStatus loginStatus{};
         std::wstring issuedToken;
-        HRESULT hrLogin = syncClient.DevLogin(syncUserId, issuedToken, &loginStatus);
+        int64_t expiresInSeconds = 0;
+        HRESULT hrLogin = syncClient.DevLogin(syncUserId, issuedToken, &loginStatus, &expiresInSeconds);
         if (SUCCEEDED(hrLogin) && !issuedToken.empty())
         {
             syncClient.SetBearerToken(issuedToken);
+            tsupasswd::SyncTokenCache::getInstance().Store(syncBaseUrl, syncUserId, tsupasswd::SyncCachedToken{ issuedToken }, expiresInSeconds);
             ClearProcessEnvironmentVariableValue(kSyncBearerTokenEnv);
             ClearUserEnvironmentRegistryValue(kSyncBearerTokenEnv);
             statusSink(winrt::hstring{ L"INFO: sync state=observed operation=" + operation + L" step=dev_login_token_issued request_id=" + ResolveRequestId(localRequestId, loginStatus) + L"ℹ" });
@@ -727,6 +756,75 @@ namespace
         return false;
     }
 
+    // 前回の login で得た token が期限内なら syncClient に設定する。起動時の prewarm が login 中ならその token を待つ。
+    bool TryUseCachedSyncToken(
+        tsupasswd::SyncClient& syncClient,
+        std::wstring const& syncUserId,
+        std::wstring const& operation,
+        std::wstring const& localRequestId,
+        std::wstring const& syncBaseUrl,
+        std::function<void(winrt::hstring const&)> const& statusSink,
+        std::vector<uint8_t>* sessionKeyBytes = nullptr)
+    {
+        // prewarm の login は待たない。終わっていなければ呼び出し元が自分で login する。
+        tsupasswd::SyncCachedToken cached{};
+        if (!tsupasswd::SyncTokenCache::getInstance().TryGet(syncBaseUrl, syncUserId, cached))
+        {
+            return false;
+        }
+        syncClient.SetBearerToken(cached.BearerToken);
+        if (sessionKeyBytes)
+        {
+            *sessionKeyBytes = std::move(cached.SessionKey);
+        }
+        statusSink(winrt::hstring{ L"INFO: sync state=observed operation=" + operation + L" step=cached_token_reused request_id=" + localRequestId + L"ℹ" });
+        return true;
+    }
+
+    // OPAQUE login。失敗したら register してからもう一度 login する。
+    // 発行された token は syncClient に設定し、期限まで SyncTokenCache に置く。
+    HRESULT OpaqueLoginWithRegisterFallback(
+        tsupasswd::SyncClient& syncClient,
+        std::wstring const& syncUserId,
+        std::wstring const& recoveryCode,
+        std::wstring const& localRequestId,
+        std::wstring const& syncBaseUrl,
+        std::vector<uint8_t>* sessionKeyBytes,
+        tsupasswd::SyncHttpStatus& loginStatus)
+    {
+        loginStatus = {};
+        std::wstring issuedToken;
+        int64_t expiresInSeconds = 0;
+        HRESULT hrLogin = syncClient.OpaqueLogin(syncUserId, recoveryCode, issuedToken, sessionKeyBytes, &loginStatus, &expiresInSeconds);
+        if (FAILED(hrLogin) || issuedToken.empty())
+        {
+            tsupasswd::SyncHttpStatus regStatus{};
+            std::vector<uint8_t> regExportKey;
+            (void)syncClient.OpaqueRegister(syncUserId, recoveryCode, &regExportKey, &regStatus);
+            if (!regExportKey.empty())
+            {
+                (void)winrt::PasskeyManager::implementation::PluginRegistrationManager::getInstance().SetOpaqueExportKey(
+                    std::vector<BYTE>(regExportKey.begin(), regExportKey.end()), localRequestId);
+            }
+            loginStatus = {};
+            issuedToken.clear();
+            hrLogin = syncClient.OpaqueLogin(syncUserId, recoveryCode, issuedToken, sessionKeyBytes, &loginStatus, &expiresInSeconds);
+        }
+        if (FAILED(hrLogin) || issuedToken.empty())
+        {
+            return FAILED(hrLogin) ? hrLogin : E_FAIL;
+        }
+
+        syncClient.SetBearerToken(issuedToken);
+        tsupasswd::SyncCachedToken cached{ issuedToken };
+        if (sessionKeyBytes)
+        {
+            cached.SessionKey = *sessionKeyBytes;
+        }
+        tsupasswd::SyncTokenCache::getInstance().Store(syncBaseUrl, syncUserId, cached, expiresInSeconds);
+        return S_OK;
+    }
+
     std::wstring Base64StdEncode(uint8_t const* bytes, size_t len)
     {
         if (!bytes || len == 0)
@@ -1018,18 +1116,22 @@ namespace
 }
 
 namespace winrt::PasskeyManager::implementation {
-    HRESULT PluginRegistrationManager::SyncEncryptedVaultWithRetry(
-        std::vector<BYTE> const& encryptedVaultData,
-        std::wstring const& syncUserId,
-        std::function<void(winrt::hstring const&)> const& statusSink)
-    {
+    tsupasswd::SyncTask<HRESULT> PluginRegistrationManager::SyncEncryptedVaultWithRetryAsync(
+        std::vector<BYTE> encryptedVaultData,
+        std::wstring syncUserId,
+        std::function<void(winrt::hstring const&)> statusSink,
+        tsupasswd::SyncCancellationToken cancellation,
+        tsupasswd::VaultValidator* outServer,
+        VaultConflictMerge conflictMerge)
+    {
+        tsupasswd::ScopedNativeHostPhaseTimer metricsTimer(tsupasswd::NativeHostPhaseMetric::Sync);
         std::wstring operation = L"put_vault";
         std::wstring localRequestId = tsupasswd::BuildRequestId(operation);
         std::wstring syncBaseUrl = NormalizeSyncBaseUrl(GetEnvironmentVariableValue(kSyncBaseUrlEnv));
         HRESULT hrValidation = ValidateSyncRuntimeInputs(operation, localRequestId, syncBaseUrl, syncUserId, statusSink);
         if (FAILED(hrValidation))
         {
-            return hrValidation;
+            co_return hrValidation;
         }
 
         DebugLogIfVerbose(
@@ -1039,22 +1141,17 @@ namespace winrt::PasskeyManager::implementation {
 
         tsupasswd::SyncClient syncClient(syncBaseUrl);
         syncClient.SetApiKind(tsupasswd::SyncApiKind::Axum);
+        syncClient.SetVaultEncoding(GetSyncVaultEncoding());
         syncClient.SetAllowInsecureHttp(IsAllowInsecureHttpEnabled());
+        syncClient.SetCallOptions(tsupasswd::SyncCallOptions{ cancellation });
         std::wstring bearerToken = GetEnvironmentVariableValue(kSyncBearerTokenEnv);
         std::vector<uint8_t> sessionKeyBytes;
+        // 環境変数の token か期限内の token があれば login しない。期限切れは PutVault の 401/403 で login し直す。
         if (!bearerToken.empty())
         {
             syncClient.SetBearerToken(bearerToken);
-
-            std::wstring recoveryCode = GetEnvironmentVariableValue(kVaultRecoveryCodeEnv);
-            if (!recoveryCode.empty())
-            {
-                tsupasswd::SyncHttpStatus loginStatus{};
-                std::wstring issuedToken;
-                (void)syncClient.OpaqueLogin(syncUserId, recoveryCode, issuedToken, &sessionKeyBytes, &loginStatus);
-            }
         }
-        else
+        else if (!TryUseCachedSyncToken(syncClient, syncUserId, operation, localRequestId, syncBaseUrl, statusSink, &sessionKeyBytes))
         {
             bool issuedDevLoginToken = TryIssueDevLoginToken(syncClient, syncUserId, operation, localRequestId, syncBaseUrl, statusSink, &sessionKeyBytes);
             if (!issuedDevLoginToken)
@@ -1063,46 +1160,36 @@ namespace winrt::PasskeyManager::implementation {
                 if (recoveryCode.empty())
                 {
                     statusSink(winrt::hstring{ L"WARNING: sync result=rejected operation=" + operation + L" reason=recovery_code_missing recovery=set_TSUPASSWD_VAULT_RECOVERY_CODE request_id=" + localRequestId + L"⚠" });
-                    return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
+                    co_return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
                 }
 
                 tsupasswd::SyncHttpStatus loginStatus{};
-                std::wstring issuedToken;
-                HRESULT hrLogin = syncClient.OpaqueLogin(syncUserId, recoveryCode, issuedToken, &sessionKeyBytes, &loginStatus);
-                if (FAILED(hrLogin) || issuedToken.empty())
-                {
-                    tsupasswd::SyncHttpStatus regStatus{};
-                    std::vector<uint8_t> regExportKey;
-                    (void)syncClient.OpaqueRegister(syncUserId, recoveryCode, &regExportKey, &regStatus);
-                    if (!regExportKey.empty())
-                    {
-                        (void)PluginRegistrationManager::getInstance().SetOpaqueExportKey(
-                            std::vector<BYTE>(regExportKey.begin(), regExportKey.end()), localRequestId);
-                    }
-                    loginStatus = {};
-                    issuedToken.clear();
-                    hrLogin = syncClient.OpaqueLogin(syncUserId, recoveryCode, issuedToken, &sessionKeyBytes, &loginStatus);
-                }
-
-                if (SUCCEEDED(hrLogin) && !issuedToken.empty())
+                HRESULT hrLogin = OpaqueLoginWithRegisterFallback(syncClient, syncUserId, recoveryCode, localRequestId, syncBaseUrl, &sessionKeyBytes, loginStatus);
+                if (SUCCEEDED(hrLogin))
                 {
-                    syncClient.SetBearerToken(issuedToken);
                     statusSink(winrt::hstring{ L"INFO: sync state=observed operation=" + operation + L" step=opaque_login_token_issued request_id=" + ResolveRequestId(localRequestId, loginStatus) + L"ℹ" });
                 }
                 else
                 {
                     statusSink(winrt::hstring{ L"WARNING: sync result=rejected operation=" + operation + L" step=opaque_login_failed hr=" + std::to_wstring(static_cast<int>(hrLogin)) + L" detail=" + BuildSyncFailureStatusMessage(hrLogin, loginStatus, syncBaseUrl) + L" request_id=" + ResolveRequestId(localRequestId, loginStatus) + L"⚠" });
-                    return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
+                    co_return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
                 }
             }
         }
 
+        // 前回見たサーバーの版から始める。なければ 0 から始め、違っていれば 409 の server_version で合わせる。
+        tsupasswd::SyncStateRecord syncState{};
+        bool hasSyncState = m_syncStateStore.TryGet(syncBaseUrl, syncUserId, syncState);
         tsupasswd::PutVaultRequest putRequest{};
-        putRequest.ExpectedVersion = 0;
-        putRequest.NewVersion = 1;
+        putRequest.ExpectedVersion = hasSyncState ? syncState.ServerVersion : 0;
+        putRequest.NewVersion = putRequest.ExpectedVersion + 1;
+        DebugLogIfVerbose(
+            L"DEBUG: sync put_vault expected_version=" + std::to_wstring(putRequest.ExpectedVersion) +
+            L" source=" + (hasSyncState ? L"sync_state" : L"default") + L"\n");
         putRequest.DeviceId = L"tsupasswd_core_windows";
         std::vector<uint8_t> cipherPlain(encryptedVaultData.begin(), encryptedVaultData.end());
-        auto buildCipherForSyncBase64 = [&]() -> std::wstring
+        tsupasswd::SyncVaultEncoding vaultEncoding = GetSyncVaultEncoding();
+        auto buildCipherForSync = [&]() -> std::vector<uint8_t>
         {
             std::vector<uint8_t> cipherForSync = cipherPlain;
             PluginRegistrationManager::getInstance().ReloadRegistryValues(localRequestId);
@@ -1124,23 +1211,42 @@ namespace winrt::PasskeyManager::implementation {
                     statusSink(winrt::hstring{ L"WARNING: sync result=warning operation=" + operation + L" reason=sync_wrap_failed code=" + wrapError.Code + L" detail=" + wrapError.Detail + L" fallback=plaintext_cipher fail_mode=fail_open request_id=" + localRequestId + L"⚠" });
                 }
             }
-            return Base64StdEncode(cipherForSync.data(), wil::safe_cast<DWORD>(cipherForSync.size()));
+            return cipherForSync;
+        };
+        auto assignCipherForSync = [&]()
+        {
+            std::vector<uint8_t> cipherForSync = buildCipherForSync();
+            if (vaultEncoding == tsupasswd::SyncVaultEncoding::OctetStream)
+            {
+                putRequest.Blob.Ciphertext = std::move(cipherForSync);
+                putRequest.Blob.CiphertextBase64.clear();
+            }
+            else
+            {
+                putRequest.Blob.CiphertextBase64 = Base64StdEncode(cipherForSync.data(), wil::safe_cast<DWORD>(cipherForSync.size()));
+                putRequest.Blob.Ciphertext.clear();
+            }
         };
 
-        putRequest.Blob.CiphertextBase64 = buildCipherForSyncBase64();
+        assignCipherForSync();
         putRequest.Blob.NonceBase64 = L"";
         putRequest.Blob.AadBase64 = L"";
         putRequest.Meta.CreatedAt = GetNowIsoLikeTimestamp();
         putRequest.Meta.UpdatedAt = putRequest.Meta.CreatedAt;
         putRequest.Meta.LastWriterDeviceId = putRequest.DeviceId;
 
-        constexpr int kMaxAttempts = 3;
-        DWORD backoffMs = 500;
-        HRESULT hrSync = E_FAIL;
+        // 待ち時間・予算・circuit breaker は SyncRetryPolicy が同期サーバーごとに決める。待つ間はスレッドを使わない。
+        tsupasswd::SyncRetryPolicy& retryPolicy = tsupasswd::SyncRetryPolicy::getInstance();
+        uint32_t const maxAttempts = retryPolicy.Options().MaxAttempts;
         tsupasswd::PutVaultResponse putResponse{};
         tsupasswd::SyncHttpStatus syncStatus{};
         auto syncStartTime = std::chrono::steady_clock::now();
-        int attemptsUsed = 0;
+        bool reauthenticated = false;
+        auto elapsedSinceStart = [&]()
+        {
+            return std::to_wstring(std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - syncStartTime).count());
+        };
 
         auto reauthIfUnauthorized = [&](tsupasswd::SyncHttpStatus const& status) -> HRESULT
         {
@@ -1149,6 +1255,8 @@ namespace winrt::PasskeyManager::implementation {
                 return S_FALSE;
             }
 
+            // 拒まれた token は期限内でも使わない。
+            tsupasswd::SyncTokenCache::getInstance().Invalidate(syncBaseUrl, syncUserId);
             std::wstring recoveryCode = GetEnvironmentVariableValue(kVaultRecoveryCodeEnv);
             if (recoveryCode.empty())
             {
@@ -1156,29 +1264,12 @@ namespace winrt::PasskeyManager::implementation {
             }
 
             tsupasswd::SyncHttpStatus loginStatus{};
-            std::wstring issuedToken;
-            HRESULT hrLogin = syncClient.OpaqueLogin(syncUserId, recoveryCode, issuedToken, &sessionKeyBytes, &loginStatus);
-            if (FAILED(hrLogin) || issuedToken.empty())
-            {
-                tsupasswd::SyncHttpStatus regStatus{};
-                std::vector<uint8_t> regExportKey;
-                (void)syncClient.OpaqueRegister(syncUserId, recoveryCode, &regExportKey, &regStatus);
-                if (!regExportKey.empty())
-                {
-                    (void)PluginRegistrationManager::getInstance().SetOpaqueExportKey(
-                        std::vector<BYTE>(regExportKey.begin(), regExportKey.end()), localRequestId);
-                }
-                loginStatus = {};
-                issuedToken.clear();
-                hrLogin = syncClient.OpaqueLogin(syncUserId, recoveryCode, issuedToken, &sessionKeyBytes, &loginStatus);
-            }
-
-            if (SUCCEEDED(hrLogin) && !issuedToken.empty())
+            HRESULT hrLogin = OpaqueLoginWithRegisterFallback(syncClient, syncUserId, recoveryCode, localRequestId, syncBaseUrl, &sessionKeyBytes, loginStatus);
+            if (SUCCEEDED(hrLogin))
             {
-                syncClient.SetBearerToken(issuedToken);
                 ClearProcessEnvironmentVariableValue(kSyncBearerTokenEnv);
                 ClearUserEnvironmentRegistryValue(kSyncBearerTokenEnv);
-                putRequest.Blob.CiphertextBase64 = buildCipherForSyncBase64();
+                assignCipherForSync();
                 statusSink(winrt::hstring{ L"INFO: sync state=observed operation=" + operation + L" step=opaque_reauth_token_issued request_id=" + ResolveRequestId(localRequestId, loginStatus) + L"ℹ" });
                 return S_OK;
             }
@@ -1187,92 +1278,140 @@ namespace winrt::PasskeyManager::implementation {
             return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
         };
 
-        for (int attempt = 1; attempt <= kMaxAttempts; ++attempt)
+        // 409 の本文で受け取ったサーバーの vault を merge し、putRequest の暗号文を差し替える (GET を挟まない)。
+        uint32_t conflictMerges = 0;
+        auto mergeServerVault = [&](tsupasswd::VaultRecord& serverVault) -> HRESULT
+        {
+            std::vector<BYTE> serverCipher;
+            RETURN_IF_FAILED(DecodeServerVaultCipher(serverVault, operation, localRequestId, serverCipher));
+            std::vector<BYTE> mergedCipher;
+            RETURN_IF_FAILED(conflictMerge(serverCipher, mergedCipher));
+            cipherPlain.assign(mergedCipher.begin(), mergedCipher.end());
+            assignCipherForSync();
+            conflictMerges += 1;
+            statusSink(winrt::hstring{ L"INFO: sync state=observed operation=" + operation + L" step=conflict_merged server_version=" + std::to_wstring(serverVault.VaultVersion) + L" request_id=" + localRequestId + L"ℹ" });
+            return S_OK;
+        };
+        // 1 回分の PUT。SyncClient の非同期 API で I/O スレッドから送る。401/403 は 1 度だけ login し直して同じ回のうちに送り直す。
+        // 409 に vault が付いていれば merge し、付いていなければ server_version を次の回の ExpectedVersion にする (policy が待たずに送り直す)。
+        // conflictMerge があるのに 409 に vault が付かなければ (vault を付けないサーバー)、古い版のまま上書きしないよう送り直さない。
+        auto putOnce = [&](uint32_t) -> tsupasswd::SyncTask<tsupasswd::SyncRetryAttemptResult>
         {
-            attemptsUsed = attempt;
-            syncStatus = {};
-            hrSync = syncClient.PutVault(syncUserId, putRequest, putResponse, &syncStatus);
-
-            if (hrSync == HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED) && attempt == 1)
+            putRequest.AcceptConflictVault = static_cast<bool>(conflictMerge);
+            tsupasswd::SyncResult<tsupasswd::PutVaultResponse> sent = co_await syncClient.PutVaultAsync(syncUserId, putRequest);
+            if (sent.Hr == HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED) && !reauthenticated)
             {
-                HRESULT hrReauth = reauthIfUnauthorized(syncStatus);
-                if (hrReauth == S_OK)
+                reauthenticated = true;
+                if (reauthIfUnauthorized(sent.Status) == S_OK)
                 {
-                    continue;
+                    sent = co_await syncClient.PutVaultAsync(syncUserId, putRequest);
                 }
             }
-
-            if (hrSync == HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) && syncStatus.ServerVersion >= 0)
+            HRESULT hr = sent.Hr;
+            syncStatus = std::move(sent.Status);
+            putResponse = std::move(sent.Value);
+            if (hr == HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) && syncStatus.ServerVersion >= 0)
             {
-                auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    std::chrono::steady_clock::now() - syncStartTime).count();
+                RecordSyncServerVersion(syncBaseUrl, syncUserId, syncStatus.ServerVersion, L"", localRequestId);
+                if (conflictMerge)
+                {
+                    tsupasswd::SyncHttpStatus conflictStatus = syncStatus;
+                    conflictStatus.ServerVersion = -1;
+                    if (!putResponse.ConflictVault)
+                    {
+                        co_return tsupasswd::SyncRetryAttemptResult{ hr, conflictStatus };
+                    }
+                    tsupasswd::VaultRecord serverVault = std::move(*putResponse.ConflictVault);
+                    putResponse.ConflictVault.reset();
+                    HRESULT hrMerge = mergeServerVault(serverVault);
+                    if (FAILED(hrMerge))
+                    {
+                        co_return tsupasswd::SyncRetryAttemptResult{ hrMerge, conflictStatus };
+                    }
+                    putRequest.ExpectedVersion = serverVault.VaultVersion;
+                    putRequest.NewVersion = serverVault.VaultVersion + 1;
+                    co_return tsupasswd::SyncRetryAttemptResult{ hr, syncStatus };
+                }
                 putRequest.ExpectedVersion = syncStatus.ServerVersion;
                 putRequest.NewVersion = syncStatus.ServerVersion + 1;
+            }
+            co_return tsupasswd::SyncRetryAttemptResult{ hr, syncStatus };
+        };
+
+        auto logRetry = [&](uint32_t nextAttempt, tsupasswd::SyncRetryDecision const& decision)
+        {
+            if (decision.Delay.count() == 0)
+            {
                 statusSink(
                     winrt::hstring{
                         L"INFO: sync result=retry_conflict operation=" + operation + L" attempt=" +
-                        std::to_wstring(attempt) +
+                        std::to_wstring(nextAttempt - 1) +
                         L"/" +
-                        std::to_wstring(kMaxAttempts) +
-                        L" elapsed_ms=" +
-                        std::to_wstring(elapsedMs) +
+                        std::to_wstring(maxAttempts) +
+                        L" elapsed_ms=" + elapsedSinceStart() +
                         L" server_version=" +
                         std::to_wstring(syncStatus.ServerVersion) +
+                        L" " + BuildSyncTimingDetail(syncStatus.Timing) +
                         L" request_id=" +
                         ResolveRequestId(localRequestId, syncStatus) +
                         L"ℹ" });
-                continue;
-            }
-
-            if (SUCCEEDED(hrSync))
-            {
-                auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    std::chrono::steady_clock::now() - syncStartTime).count();
-                statusSink(winrt::hstring{ L"SUCCESS: sync result=success operation=" + operation + L" attempts=" + std::to_wstring(attempt) + L"/" + std::to_wstring(kMaxAttempts) + L" elapsed_ms=" + std::to_wstring(elapsedMs) + L" hr=0 request_id=" + ResolveRequestId(localRequestId, syncStatus) + L"✅" });
-                return S_OK;
-            }
-
-            bool shouldRetry =
-                attempt < kMaxAttempts &&
-                syncStatus.StatusCode != 401 &&
-                syncStatus.StatusCode != 403 &&
-                syncStatus.StatusCode != 404 &&
-                syncStatus.StatusCode != 409;
-
-            if (!shouldRetry)
-            {
-                break;
+                return;
             }
 
             statusSink(
                 winrt::hstring{
                     L"INFO: sync result=retry_backoff operation=" + operation + L" attempt=" +
-                    std::to_wstring(attempt + 1) +
+                    std::to_wstring(nextAttempt) +
                     L"/" +
-                    std::to_wstring(kMaxAttempts) +
+                    std::to_wstring(maxAttempts) +
                     L" backoff_ms=" +
-                    std::to_wstring(backoffMs) +
-                    L" elapsed_ms=" +
-                    std::to_wstring(std::chrono::duration_cast<std::chrono::milliseconds>(
-                        std::chrono::steady_clock::now() - syncStartTime).count()) +
+                    std::to_wstring(decision.Delay.count()) +
+                    L" reason=" + decision.Reason +
+                    L" retry_after_ms=" + std::to_wstring(syncStatus.RetryAfterMs) +
+                    L" elapsed_ms=" + elapsedSinceStart() +
+                    L" " + BuildSyncTimingDetail(syncStatus.Timing) +
                     L" request_id=" +
                     ResolveRequestId(localRequestId, syncStatus) +
                     L"ℹ" });
+        };
+
+        // 送り直すまでの待ちは reactor のタイマーで行い、どのスレッドも止めない。ここから先は I/O スレッドで続く。
+        tsupasswd::SyncRetryOutcome outcome = co_await tsupasswd::RunWithRetryAsync(retryPolicy, syncBaseUrl, putOnce, logRetry, cancellation);
+        HRESULT hrSync = outcome.Hr;
+        syncStatus = outcome.Status;
+        uint32_t attemptsUsed = outcome.Attempts;
+
+        if (SUCCEEDED(hrSync))
+        {
+            RecordSyncServerVersion(syncBaseUrl, syncUserId, putResponse.VaultVersion, putResponse.BlobSha256Base64, localRequestId);
+            statusSink(winrt::hstring{ L"SUCCESS: sync result=success operation=" + operation + L" attempts=" + std::to_wstring(attemptsUsed) + L"/" + std::to_wstring(maxAttempts) + L" elapsed_ms=" + elapsedSinceStart() + L" sync_state=" + (hasSyncState ? L"hit" : L"miss") + L" conflict_merges=" + std::to_wstring(conflictMerges) + L" " + BuildSyncTimingDetail(syncStatus.Timing) + L" hr=0 request_id=" + ResolveRequestId(localRequestId, syncStatus) + L"✅" });
+            if (outServer)
+            {
+                outServer->VaultVersion = putResponse.VaultVersion;
+                outServer->BlobSha256Base64 = putResponse.BlobSha256Base64;
+            }
+            co_return S_OK;
+        }
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(backoffMs));
-            backoffMs *= 2;
+        if (hrSync == HRESULT_FROM_WIN32(ERROR_CANCELLED))
+        {
+            statusSink(winrt::hstring{ L"INFO: sync result=cancelled operation=" + operation + L" attempts=" + std::to_wstring(attemptsUsed) + L"/" + std::to_wstring(maxAttempts) + L" request_id=" + ResolveRequestId(localRequestId, syncStatus) + L"ℹ" });
+            co_return hrSync;
         }
 
         std::wstring syncWarning =
             L"WARNING: sync result=failed operation=" + operation + L" attempts=" +
             std::to_wstring(attemptsUsed) +
             L"/" +
-            std::to_wstring(kMaxAttempts) +
-            L" elapsed_ms=" +
-            std::to_wstring(std::chrono::duration_cast<std::chrono::milliseconds>(
-                std::chrono::steady_clock::now() - syncStartTime).count()) +
+            std::to_wstring(maxAttempts) +
+            L" elapsed_ms=" + elapsedSinceStart() +
             L" hr=" + std::to_wstring(static_cast<int>(hrSync)) +
+            L" retry_decision=" + outcome.LastDecision.Reason +
             L" detail=" + BuildSyncFailureStatusMessage(hrSync, syncStatus, syncBaseUrl);
+        if (hrSync == HRESULT_FROM_WIN32(ERROR_RETRY))
+        {
+            syncWarning += L" retry_in_ms=" + std::to_wstring(outcome.LastDecision.Delay.count());
+        }
         if (syncStatus.StatusCode == 409)
         {
             syncWarning += L" recovery=manual_resync_now";
@@ -1282,37 +1421,313 @@ namespace winrt::PasskeyManager::implementation {
             syncWarning += L" request_id=" + localRequestId;
         }
         statusSink(winrt::hstring{ syncWarning });
-        return hrSync;
+        co_return hrSync;
     }
 
-    PluginRegistrationManager::PluginRegistrationManager() :
-        m_pluginRegistered(false),
-        m_initialized(false),
-        // AUTHENTICATOR_STATE: Enum representing the state of a plugin authenticator in the Windows
-        // third-party passkey plugin system. This state indicates whether the plugin is enabled or disabled.
-        m_pluginState(AUTHENTICATOR_STATE::AuthenticatorState_Disabled)
+    void PluginRegistrationManager::StartSyncPrewarm()
     {
-        Initialize();
+        std::call_once(m_syncPrewarmOnce, [this]()
+        {
+            // prewarm の token と送り直す outbox の世代が同じ user のものになるよう、user は 1 度だけ決める。
+            std::wstring syncBaseUrl = NormalizeSyncBaseUrl(GetEnvironmentVariableValue(kSyncBaseUrlEnv));
+            std::wstring syncUserId = ResolveVaultSyncUserId();
+            if (syncBaseUrl.empty() || syncUserId.empty())
+            {
+                return;
+            }
+
+            // 送り直しの同期 (RunQueuedVaultSync) が WaitForSyncPrewarm で prewarm の login を待つよう、キューに積む前に始めた印を立てる。
+            m_syncPrewarmStarted = true;
+            std::thread([this, syncBaseUrl, syncUserId]()
+            {
+                m_syncPrewarmThreadId = GetCurrentThreadId();
+                auto signalDone = wil::scope_exit([this]() { m_syncPrewarmDone.SetEvent(); });
+                try
+                {
+                    PrewarmSync(syncBaseUrl, syncUserId);
+                }
+                CATCH_LOG();
+            }).detach();
+
+            // 前回送れなかった世代は、prewarm の login を待って (RunQueuedVaultSync) すぐ送り直す。
+            // 送り終えた記録があれば (送った後 outbox を片付ける前に終わった)、送り直さず片付ける。
+            tsupasswd::SyncOutboxEntry pending{};
+            tsupasswd::SyncStateRecord syncState{};
+            if (m_syncOutbox.TryGetPending(syncUserId, pending) &&
+                m_syncStateStore.TryGet(syncBaseUrl, syncUserId, syncState) &&
+                syncState.SyncedGeneration >= pending.Generation)
+            {
+                (void)m_syncOutbox.Complete(syncUserId, pending.Generation);
+                AppendPersistentSyncDiagnosticLog(
+                    L"INFO: sync state=observed operation=background_sync step=outbox_already_synced generation=" + std::to_wstring(pending.Generation) +
+                    L" request_id=" + pending.LastRequestId + L"\n");
+            }
+            if (m_syncOutbox.TryGetPending(syncUserId, pending))
+            {
+                AppendPersistentSyncDiagnosticLog(
+                    L"INFO: sync state=queued operation=background_sync trigger=outbox_replay pending_generations=" + std::to_wstring(pending.PendingGenerations) +
+                    L" attempts=" + std::to_wstring(pending.Attempts) +
+                    L" request_id=" + pending.LastRequestId + L"\n");
+                m_vaultSyncQueue.RetryAfter(std::chrono::milliseconds(0));
+            }
+        });
     }
 
-    PluginRegistrationManager::~PluginRegistrationManager()
+    void PluginRegistrationManager::WaitForSyncPrewarm()
+    {
+        if (m_syncPrewarmStarted && m_syncPrewarmThreadId != GetCurrentThreadId())
+        {
+            (void)m_syncPrewarmDone.wait(kSyncPrewarmWaitMs);
+        }
+    }
+
+    std::shared_future<HRESULT> PluginRegistrationManager::QueueVaultSync(std::wstring const& requestId)
     {
+        // 書き込んだ世代を先に outbox に残す。送る前に終了しても次の起動で送る。
+        std::wstring syncUserId = ResolveVaultSyncUserId();
+        uint64_t generation = 0;
+        HRESULT hrOutbox = syncUserId.empty() ? S_FALSE : m_syncOutbox.Enqueue(syncUserId, requestId, generation);
+        if (FAILED(hrOutbox))
+        {
+            AppendPersistentSyncDiagnosticLog(
+                L"WARNING: sync result=warning operation=background_sync reason=outbox_write_failed hr=" + std::to_wstring(static_cast<int>(hrOutbox)) +
+                L" request_id=" + requestId + L"\n");
+        }
+        AppendPersistentSyncDiagnosticLog(
+            L"INFO: sync state=queued operation=background_sync debounce_ms=" + std::to_wstring(kVaultSyncDebounce.count()) +
+            L" outbox_generation=" + std::to_wstring(generation) +
+            L" request_id=" + requestId + L"\n");
+        return m_vaultSyncQueue.Request();
     }
 
-    HRESULT PluginRegistrationManager::Initialize()
+    bool PluginRegistrationManager::FlushVaultSync(DWORD timeoutMs)
     {
-        HRESULT hr = RefreshPluginState();
-        RETURN_HR_IF_EXPECTED(S_OK, hr == NTE_NOT_FOUND);
-        ReloadRegistryValues();
-        RETURN_HR(hr);
+        m_vaultSyncQueue.Flush();
+        return m_vaultSyncQueue.WaitIdle(std::chrono::milliseconds(timeoutMs));
     }
 
-    HRESULT PluginRegistrationManager::RegisterPlugin()
+    // 同期キューのワーカースレッドで呼ばれる。ManualResyncSelfHostedVault がローカルの最新の vault を読むので、
+    // まとめた予約の分の書き込みはすべて 1 回の PUT に入る。
+    // coalescedRequests が 0 なら outbox の再送 (RetryAfter) で、送る世代が残っていなければ何もしない。
+    HRESULT PluginRegistrationManager::RunQueuedVaultSync(uint32_t coalescedRequests)
     {
-        // If the plugin is already registered, avoid calling Add again.
-        // In that case, perform an update instead.
+        std::wstring requestId = tsupasswd::BuildRequestId(L"background_sync");
+        std::wstring syncUserId = ResolveVaultSyncUserId();
+        // ManualResyncSelfHostedVault がローカルの vault を読む前に世代を取る。読んだ後に積まれた世代は成功しても残る。
+        tsupasswd::SyncOutboxEntry pending{};
+        bool hasPending = !syncUserId.empty() && m_syncOutbox.TryGetPending(syncUserId, pending);
+        if (coalescedRequests == 0 && !hasPending)
         {
-            HRESULT hrState = RefreshPluginState();
+            return S_FALSE;
+        }
+        std::wstring trigger = coalescedRequests == 0 ? L"outbox_replay" : L"local_write";
+        AppendPersistentSyncDiagnosticLog(
+            L"INFO: sync state=start operation=background_sync trigger=" + trigger +
+            L" coalesced=" + std::to_wstring(coalescedRequests) +
+            L" pending_generations=" + std::to_wstring(pending.PendingGenerations) +
+            L" attempts=" + std::to_wstring(pending.Attempts) +
+            L" request_id=" + requestId + L"\n");
+        // バックグラウンドの同期だけは prewarm の login を待ち、同じ token を 2 回 login しない。
+        // 利用者が始めた同期は待たずに自分で login する (サーバーに届かないとき prewarm の時間切れまで止まらない)。
+        WaitForSyncPrewarm();
+        HRESULT hr = E_FAIL;
+        try
+        {
+            hr = ManualResyncSelfHostedVault(requestId);
+        }
+        CATCH_LOG();
+        AppendPersistentSyncDiagnosticLog(
+            std::wstring(SUCCEEDED(hr) ? L"SUCCESS: sync result=success" : L"WARNING: sync result=failed") +
+            L" operation=background_sync trigger=" + trigger +
+            L" coalesced=" + std::to_wstring(coalescedRequests) +
+            L" hr=" + std::to_wstring(static_cast<int>(hr)) +
+            L" request_id=" + requestId + L"\n");
+        if (!hasPending)
+        {
+            return hr;
+        }
+        if (SUCCEEDED(hr))
+        {
+            CompleteSyncedOutboxGeneration(syncUserId, pending.Generation, requestId);
+        }
+        else
+        {
+            ScheduleVaultSyncRetry(syncUserId, hr, requestId);
+        }
+        return hr;
+    }
+
+    void PluginRegistrationManager::CompleteSyncedOutboxGeneration(std::wstring const& syncUserId, uint64_t generation, std::wstring const& requestId)
+    {
+        // 先に送り終えた世代を残す。Complete の前に終わっても次の起動で送り直さない。
+        std::wstring syncBaseUrl = NormalizeSyncBaseUrl(GetEnvironmentVariableValue(kSyncBaseUrlEnv));
+        HRESULT hrState = syncBaseUrl.empty() ? S_FALSE : m_syncStateStore.RecordSyncedGeneration(syncBaseUrl, syncUserId, generation);
+        if (FAILED(hrState))
+        {
+            AppendPersistentSyncDiagnosticLog(
+                L"WARNING: sync result=warning operation=background_sync reason=sync_state_write_failed hr=" + std::to_wstring(static_cast<int>(hrState)) +
+                L" request_id=" + requestId + L"\n");
+        }
+        (void)m_syncOutbox.Complete(syncUserId, generation);
+    }
+
+    winrt::fire_and_forget PluginRegistrationManager::CompleteInitialVaultSync(
+        tsupasswd::SyncTask<HRESULT> sync,
+        std::wstring syncUserId,
+        uint64_t outboxGeneration,
+        std::wstring requestId)
+    {
+        HRESULT hr = E_FAIL;
+        try
+        {
+            hr = co_await sync;
+        }
+        CATCH_LOG();
+        if (outboxGeneration == 0)
+        {
+            co_return;
+        }
+        if (SUCCEEDED(hr))
+        {
+            CompleteSyncedOutboxGeneration(syncUserId, outboxGeneration, requestId);
+        }
+        else
+        {
+            ScheduleVaultSyncRetry(syncUserId, hr, requestId);
+        }
+    }
+
+    void PluginRegistrationManager::RecordSyncServerVersion(
+        std::wstring const& syncBaseUrl,
+        std::wstring const& syncUserId,
+        int64_t serverVersion,
+        std::wstring const& blobSha256Base64,
+        std::wstring const& requestId)
+    {
+        HRESULT hrState = m_syncStateStore.RecordServerVersion(syncBaseUrl, syncUserId, serverVersion, blobSha256Base64);
+        if (FAILED(hrState))
+        {
+            AppendPersistentSyncDiagnosticLog(
+                L"WARNING: sync result=warning operation=sync_state reason=sync_state_write_failed hr=" + std::to_wstring(static_cast<int>(hrState)) +
+                L" server_version=" + std::to_wstring(serverVersion) +
+                L" request_id=" + requestId + L"\n");
+        }
+    }
+
+    void PluginRegistrationManager::ScheduleVaultSyncRetry(std::wstring const& syncUserId, HRESULT hrSync, std::wstring const& requestId)
+    {
+        std::chrono::milliseconds delay{};
+        HRESULT hrOutbox = m_syncOutbox.RecordFailure(syncUserId, hrSync, NextSyncRetryJitter(), delay);
+        if (FAILED(hrOutbox))
+        {
+            AppendPersistentSyncDiagnosticLog(
+                L"WARNING: sync result=warning operation=background_sync reason=outbox_write_failed hr=" + std::to_wstring(static_cast<int>(hrOutbox)) +
+                L" request_id=" + requestId + L"\n");
+        }
+        if (!IsRetryableVaultSyncFailure(hrSync))
+        {
+            AppendPersistentSyncDiagnosticLog(
+                L"INFO: sync state=deferred operation=background_sync hr=" + std::to_wstring(static_cast<int>(hrSync)) +
+                L" recovery=next_write_or_startup request_id=" + requestId + L"\n");
+            return;
+        }
+        AppendPersistentSyncDiagnosticLog(
+            L"INFO: sync state=deferred operation=background_sync hr=" + std::to_wstring(static_cast<int>(hrSync)) +
+            L" retry_in_ms=" + std::to_wstring(delay.count()) +
+            L" request_id=" + requestId + L"\n");
+        m_vaultSyncQueue.RetryAfter(delay);
+    }
+
+    // 接続を開き、期限内の token がなければ login して SyncTokenCache に置く。
+    // OPAQUE の register はしない (未登録なら最初の保存の OpaqueLoginWithRegisterFallback に任せる)。
+    void PluginRegistrationManager::PrewarmSync(std::wstring const& syncBaseUrl, std::wstring const& syncUserId)
+    {
+        std::wstring operation = L"prewarm";
+        std::wstring localRequestId = tsupasswd::BuildRequestId(operation);
+        auto statusSink = [](winrt::hstring const& message)
+        {
+            DebugLogIfVerbose(std::wstring{ message } + L"\n");
+        };
+        if (FAILED(ValidateSyncRuntimeInputs(operation, localRequestId, syncBaseUrl, syncUserId, statusSink)))
+        {
+            return;
+        }
+
+        tsupasswd::SyncClient syncClient(syncBaseUrl);
+        syncClient.SetApiKind(tsupasswd::SyncApiKind::Axum);
+        syncClient.SetVaultEncoding(GetSyncVaultEncoding());
+        syncClient.SetAllowInsecureHttp(IsAllowInsecureHttpEnabled());
+
+        auto startTime = std::chrono::steady_clock::now();
+        tsupasswd::SyncHttpStatus prewarmStatus{};
+        HRESULT hrPrewarm = syncClient.Prewarm(&prewarmStatus);
+        std::wstring elapsedMs = std::to_wstring(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count());
+        if (FAILED(hrPrewarm))
+        {
+            statusSink(winrt::hstring{ L"WARNING: sync result=warning operation=" + operation + L" step=connect_failed hr=" + std::to_wstring(static_cast<int>(hrPrewarm)) + L" elapsed_ms=" + elapsedMs + L" detail=" + BuildSyncFailureStatusMessage(hrPrewarm, prewarmStatus, syncBaseUrl) + L" request_id=" + ResolveRequestId(localRequestId, prewarmStatus) + L"⚠" });
+            return;
+        }
+        statusSink(winrt::hstring{ L"INFO: sync state=observed operation=" + operation + L" step=connection_opened elapsed_ms=" + elapsedMs + L" " + BuildSyncTimingDetail(prewarmStatus.Timing) + L" request_id=" + ResolveRequestId(localRequestId, prewarmStatus) + L"ℹ" });
+
+        tsupasswd::SyncCachedToken cached{};
+        if (!GetEnvironmentVariableValue(kSyncBearerTokenEnv).empty() ||
+            tsupasswd::SyncTokenCache::getInstance().TryGet(syncBaseUrl, syncUserId, cached) ||
+            TryIssueDevLoginToken(syncClient, syncUserId, operation, localRequestId, syncBaseUrl, statusSink))
+        {
+            return;
+        }
+
+        std::wstring recoveryCode = GetEnvironmentVariableValue(kVaultRecoveryCodeEnv);
+        if (recoveryCode.empty())
+        {
+            return;
+        }
+        std::wstring issuedToken;
+        std::vector<uint8_t> sessionKeyBytes;
+        int64_t expiresInSeconds = 0;
+        tsupasswd::SyncHttpStatus loginStatus{};
+        HRESULT hrLogin = syncClient.OpaqueLogin(syncUserId, recoveryCode, issuedToken, &sessionKeyBytes, &loginStatus, &expiresInSeconds);
+        if (FAILED(hrLogin) || issuedToken.empty())
+        {
+            statusSink(winrt::hstring{ L"INFO: sync state=observed operation=" + operation + L" step=opaque_login_deferred hr=" + std::to_wstring(static_cast<int>(hrLogin)) + L" request_id=" + ResolveRequestId(localRequestId, loginStatus) + L"ℹ" });
+            return;
+        }
+        tsupasswd::SyncTokenCache::getInstance().Store(syncBaseUrl, syncUserId, tsupasswd::SyncCachedToken{ issuedToken, std::move(sessionKeyBytes) }, expiresInSeconds);
+        statusSink(winrt::hstring{ L"INFO: sync state=observed operation=" + operation + L" step=opaque_login_token_issued request_id=" + ResolveRequestId(localRequestId, loginStatus) + L"ℹ" });
+    }
+
+    PluginRegistrationManager::PluginRegistrationManager() :
+        m_pluginRegistered(false),
+        m_initialized(false),
+        // AUTHENTICATOR_STATE: Enum representing the state of a plugin authenticator in the Windows
+        // third-party passkey plugin system. This state indicates whether the plugin is enabled or disabled.
+        m_pluginState(AUTHENTICATOR_STATE::AuthenticatorState_Disabled),
+        m_syncOutbox(ResolveSyncDataPath(L"sync_outbox.log")),
+        m_syncStateStore(ResolveSyncDataPath(L"sync_state.log")),
+        m_syncDeltaStateStore(ResolveSyncDataPath(L"sync_delta_state.log")),
+        m_vaultSyncQueue([this](uint32_t coalescedRequests) { return RunQueuedVaultSync(coalescedRequests); }, kVaultSyncDebounce, kVaultSyncMaxDelay)
+    {
+        Initialize();
+    }
+
+    PluginRegistrationManager::~PluginRegistrationManager()
+    {
+    }
+
+    HRESULT PluginRegistrationManager::Initialize()
+    {
+        HRESULT hr = RefreshPluginState();
+        RETURN_HR_IF_EXPECTED(S_OK, hr == NTE_NOT_FOUND);
+        ReloadRegistryValues();
+        RETURN_HR(hr);
+    }
+
+    HRESULT PluginRegistrationManager::RegisterPlugin()
+    {
+        // If the plugin is already registered, avoid calling Add again.
+        // In that case, perform an update instead.
+        {
+            HRESULT hrState = RefreshPluginState();
             if (SUCCEEDED(hrState))
             {
                 RETURN_HR(UpdatePlugin());
@@ -2000,13 +2415,39 @@ namespace winrt::PasskeyManager::implementation {
             }
 
             // Best-effort self-hosted sync. Local success must not be blocked by remote sync failure.
-            SyncEncryptedVaultWithRetry(
-                std::vector<BYTE>(encryptedVaultData.begin(), encryptedVaultData.end()),
-                syncUserId,
-                [this](winrt::hstring const& status)
+            // 結果は待たない。送る前に世代を outbox に残し、届く前に終了しても次の起動で送り直す。
+            // 再送は ManualResyncSelfHostedVault が行うので、それが送る user (既定の user) のときだけ outbox に残す。
+            uint64_t outboxGeneration = 0;
+            if (syncUserId != ResolveVaultSyncUserId() || FAILED(m_syncOutbox.Enqueue(syncUserId, localRequestId, outboxGeneration)))
+            {
+                outboxGeneration = 0;
+            }
+            // 差分同期では vault 全体を PUT しない (item と食い違うため)。outbox に残した世代を同期キューが item で送る。
+            if (IsSyncDeltaEnabled())
+            {
+                if (outboxGeneration != 0)
                 {
-                    UpdatePasskeyOperationStatusText(status);
-                });
+                    (void)m_vaultSyncQueue.Request();
+                }
+                else
+                {
+                    UpdatePasskeyOperationStatusText(winrt::hstring{ L"INFO: sync state=skipped operation=" + operation + L" reason=delta_sync_default_user_only user_id=" + syncUserId + L" request_id=" + localRequestId + L"ℹ" });
+                }
+            }
+            else
+            {
+                CompleteInitialVaultSync(
+                    SyncEncryptedVaultWithRetryAsync(
+                        std::vector<BYTE>(encryptedVaultData.begin(), encryptedVaultData.end()),
+                        syncUserId,
+                        [this](winrt::hstring const& status)
+                        {
+                            UpdatePasskeyOperationStatusText(status);
+                        }),
+                    syncUserId,
+                    outboxGeneration,
+                    localRequestId);
+            }
         }
 
         std::wstring finalResult = L"INFO: summary state=done operation=" + operation + L" step=create_vault_passkey_final hr=" + std::to_wstring(static_cast<int>(hr)) + L" request_id=" + localRequestId + L"ℹ";
@@ -2272,7 +2713,11 @@ namespace winrt::PasskeyManager::implementation {
         std::lock_guard<std::mutex> lock(m_pluginOperationConfigMutex);
         cipherText.clear();
 
-        auto opt = wil::reg::try_get_value_binary(HKEY_CURRENT_USER, c_pluginRegistryPath, c_pluginEncryptedVaultData, REG_BINARY);
+        std::optional<std::vector<BYTE>> opt;
+        {
+            tsupasswd::ScopedNativeHostPhaseTimer metricsTimer(tsupasswd::NativeHostPhaseMetric::RegistryRead);
+            opt = wil::reg::try_get_value_binary(HKEY_CURRENT_USER, c_pluginRegistryPath, c_pluginEncryptedVaultData, REG_BINARY);
+        }
         if (!opt)
         {
             AppendPersistentSyncDiagnosticLog(
@@ -2363,20 +2808,231 @@ namespace winrt::PasskeyManager::implementation {
         return S_OK;
     }
 
-    HRESULT PluginRegistrationManager::ManualResyncSelfHostedVault(std::wstring const& requestId)
+    HRESULT PluginRegistrationManager::SyncVaultItemsDelta(
+        tsupasswd::VaultDocumentV1& localDoc,
+        DeltaSyncState& state,
+        std::vector<uint8_t> const& recoveryBytes,
+        std::wstring const& localRequestId,
+        tsupasswd::VaultMergeStats* outMergeStats,
+        std::function<void(wchar_t const*)> const& reportProgress,
+        tsupasswd::SyncCancellationToken const& cancellation)
+    {
+        std::wstring operation = L"delta_sync";
+        std::wstring syncBaseUrl = NormalizeSyncBaseUrl(GetEnvironmentVariableValue(kSyncBaseUrlEnv));
+        auto statusSink = [this](winrt::hstring const& status)
+        {
+            UpdatePasskeyOperationStatusText(status);
+        };
+
+        tsupasswd::SyncClient syncClient(syncBaseUrl);
+        syncClient.SetApiKind(tsupasswd::SyncApiKind::Axum);
+        syncClient.SetAllowInsecureHttp(IsAllowInsecureHttpEnabled());
+        syncClient.SetCallOptions(tsupasswd::SyncCallOptions{ cancellation });
+        std::wstring bearerToken = GetEnvironmentVariableValue(kSyncBearerTokenEnv);
+        if (!bearerToken.empty())
+        {
+            syncClient.SetBearerToken(bearerToken);
+        }
+        else if (!TryUseCachedSyncToken(syncClient, state.UserId, operation, localRequestId, syncBaseUrl, statusSink) &&
+            !TryIssueDevLoginToken(syncClient, state.UserId, operation, localRequestId, syncBaseUrl, statusSink))
+        {
+            std::wstring recoveryCode = GetEnvironmentVariableValue(kVaultRecoveryCodeEnv);
+            tsupasswd::SyncHttpStatus loginStatus{};
+            HRESULT hrLogin = OpaqueLoginWithRegisterFallback(syncClient, state.UserId, recoveryCode, localRequestId, syncBaseUrl, nullptr, loginStatus);
+            if (FAILED(hrLogin))
+            {
+                statusSink(winrt::hstring{ L"WARNING: sync result=rejected operation=" + operation + L" step=opaque_login_failed hr=" + std::to_wstring(static_cast<int>(hrLogin)) + L" detail=" + BuildSyncFailureStatusMessage(hrLogin, loginStatus, syncBaseUrl) + L" request_id=" + ResolveRequestId(localRequestId, loginStatus) + L"⚠" });
+                return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
+            }
+        }
+
+        bool changed = false;
+        auto reportFailure = [&](wchar_t const* step, HRESULT hr, tsupasswd::SyncHttpStatus const& status)
+        {
+            statusSink(winrt::hstring{ L"WARNING: sync result=failed operation=" + operation + L" step=" + step + L" hr=" + std::to_wstring(static_cast<int>(hr)) + L" detail=" + BuildSyncFailureStatusMessage(hr, status, syncBaseUrl) + L" request_id=" + ResolveRequestId(localRequestId, status) + L"⚠" });
+        };
+
+        // state.Cursor より後のサーバーの変更を読み、そのまま merge する。
+        auto pullChanges = [&]() -> HRESULT
+        {
+            std::vector<tsupasswd::VaultItemV1> serverItems;
+            tsupasswd::VaultChanges changes{};
+            do
+            {
+                tsupasswd::SyncHttpStatus status{};
+                HRESULT hr = syncClient.GetVaultChanges(state.UserId, state.Cursor, changes, &status);
+                if (FAILED(hr))
+                {
+                    reportFailure(L"get_changes", hr, status);
+                    return hr;
+                }
+                for (auto const& change : changes.Items)
+                {
+                    tsupasswd::VaultItemV1 item{};
+                    if (!TryUnsealVaultItem(change.SealedItem, change.ItemId, recoveryBytes, item))
+                    {
+                        reportFailure(L"unseal_item", HRESULT_FROM_WIN32(ERROR_INVALID_DATA), status);
+                        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+                    }
+                    state.Items[change.ItemId] = SyncedItemState{ change.ItemVersion, item.UpdatedAt, item.Deleted };
+                    serverItems.push_back(std::move(item));
+                }
+                state.Cursor = changes.Cursor;
+            } while (changes.HasMore);
+
+            if (serverItems.empty())
+            {
+                return S_OK;
+            }
+            reportProgress(L"merge");
+            auto mergeResult = MergeVaultDocumentsForSync(std::move(localDoc), std::move(serverItems), localRequestId);
+            localDoc = std::move(mergeResult.Document);
+            changed = true;
+            if (outMergeStats)
+            {
+                outMergeStats->AddedFromServer += mergeResult.Stats.AddedFromServer;
+                outMergeStats->UpdatedFromServer += mergeResult.Stats.UpdatedFromServer;
+                outMergeStats->TombstonesApplied += mergeResult.Stats.TombstonesApplied;
+                outMergeStats->DuplicatesCollapsed += mergeResult.Stats.DuplicatesCollapsed;
+            }
+            return S_OK;
+        };
+
+        // 前回の同期から UpdatedAt か削除状態が変わった item だけを封をして送る。
+        auto pushChanges = [&]() -> HRESULT
+        {
+            constexpr size_t kMaxItemsPerPut = 500;
+            tsupasswd::PutVaultDeltaRequest putRequest{};
+            putRequest.DeviceId = L"tsupasswd_core_windows";
+            auto flush = [&]() -> HRESULT
+            {
+                if (putRequest.Items.empty())
+                {
+                    return S_OK;
+                }
+                reportProgress(L"push");
+                tsupasswd::PutVaultDeltaResponse putResponse{};
+                tsupasswd::SyncHttpStatus status{};
+                HRESULT hr = syncClient.PutVaultDelta(state.UserId, putRequest, putResponse, &status);
+                if (FAILED(hr))
+                {
+                    if (hr != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH))
+                    {
+                        reportFailure(L"put_items", hr, status);
+                    }
+                    return hr;
+                }
+                for (size_t i = 0; i < putRequest.Items.size() && i < putResponse.Items.size(); ++i)
+                {
+                    auto const& sent = putRequest.Items[i];
+                    state.Items[sent.ItemId] = SyncedItemState{ putResponse.Items[i].ItemVersion, sent.UpdatedAt, sent.Deleted };
+                }
+                // 間に他の端末の書き込みがなければ、自分の変更を読み直さずに済む。
+                if (putResponse.BaseCursor == state.Cursor)
+                {
+                    state.Cursor = putResponse.Cursor;
+                }
+                changed = true;
+                putRequest.Items.clear();
+                return S_OK;
+            };
+
+            for (auto const& item : localDoc.Items)
+            {
+                if (item.ItemId.empty())
+                {
+                    continue;
+                }
+                auto synced = state.Items.find(item.ItemId);
+                if (synced != state.Items.end() && synced->second.UpdatedAt == item.UpdatedAt && synced->second.Deleted == item.Deleted)
+                {
+                    continue;
+                }
+
+                tsupasswd::VaultItemRecord& record = putRequest.Items.emplace_back();
+                record.ItemId = item.ItemId;
+                record.ItemVersion = synced != state.Items.end() ? synced->second.ItemVersion : 0;
+                record.Deleted = item.Deleted;
+                record.UpdatedAt = item.UpdatedAt;
+                if (!TrySealVaultItem(item, localDoc.VaultId, recoveryBytes, record.SealedItem))
+                {
+                    return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+                }
+                if (putRequest.Items.size() == kMaxItemsPerPut)
+                {
+                    RETURN_IF_FAILED(flush());
+                }
+            }
+            return flush();
+        };
+
+        // 409 は他の端末が同じ item を先に書いたもの。その変更を読んで merge してから送り直す。
+        constexpr int kMaxAttempts = 3;
+        HRESULT hr = S_OK;
+        for (int attempt = 1; attempt <= kMaxAttempts; ++attempt)
+        {
+            hr = pullChanges();
+            if (SUCCEEDED(hr))
+            {
+                hr = pushChanges();
+            }
+            if (hr != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH))
+            {
+                break;
+            }
+            statusSink(winrt::hstring{ L"INFO: sync result=retry_conflict operation=" + operation + L" attempt=" + std::to_wstring(attempt) + L"/" + std::to_wstring(kMaxAttempts) + L" cursor=" + std::to_wstring(state.Cursor) + L" request_id=" + localRequestId + L"ℹ" });
+        }
+        if (hr == HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED))
+        {
+            // 401/403 を受けた token は次の同期で使わず、login し直す。
+            tsupasswd::SyncTokenCache::getInstance().Invalidate(syncBaseUrl, state.UserId);
+        }
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        return changed ? S_OK : S_FALSE;
+    }
+
+    HRESULT PluginRegistrationManager::ManualResyncSelfHostedVault(
+        std::wstring const& requestId,
+        tsupasswd::VaultMergeStats* outMergeStats,
+        std::function<void(std::wstring const&)> const& progressSink,
+        tsupasswd::SyncCancellationToken const& cancellation)
     {
+        tsupasswd::ScopedNativeHostPhaseTimer metricsTimer(tsupasswd::NativeHostPhaseMetric::Resync);
         std::wstring operation = L"manual_resync";
         std::wstring localRequestId = requestId;
         if (localRequestId.empty())
         {
             localRequestId = tsupasswd::BuildRequestId(operation);
         }
-
-        std::wstring syncUserId = GetUserEnvironmentRegistryValue(kSyncUserIdEnv);
-        if (syncUserId.empty())
+        if (outMergeStats)
         {
-            syncUserId = GetProcessEnvironmentVariableValue(kSyncUserIdEnv);
+            *outMergeStats = {};
         }
+        auto reportProgress = [&](wchar_t const* stage)
+        {
+            if (progressSink)
+            {
+                progressSink(stage);
+            }
+        };
+        // 段階の境目で取消を確かめる。通信中の取消は SyncClient が ERROR_CANCELLED で返す。
+        auto cancelledAt = [&](wchar_t const* stage) -> bool
+        {
+            if (!cancellation.IsCancellationRequested())
+            {
+                return false;
+            }
+            UpdatePasskeyOperationStatusText(winrt::hstring{ L"INFO: sync result=cancelled operation=" + operation + L" stage=" + stage + L" request_id=" + localRequestId + L"ℹ" });
+            return true;
+        };
+
+        // native host の非同期 resync と UI/保存経路の同期 resync が同時に read-merge-write しないよう直列化する。
+        std::lock_guard<std::mutex> resyncLock(m_manualResyncMutex);
+
+        std::wstring syncUserId = ResolveVaultSyncUserId();
         std::wstring syncBaseUrl = NormalizeSyncBaseUrl(GetEnvironmentVariableValue(kSyncBaseUrlEnv));
         HRESULT hrValidation = ValidateSyncRuntimeInputs(
             operation,
@@ -2399,6 +3055,7 @@ namespace winrt::PasskeyManager::implementation {
             return HRESULT_FROM_WIN32(ERROR_NOT_READY);
         }
 
+        reportProgress(L"read_local");
         std::vector<BYTE> encryptedVaultData;
         HRESULT hrReadVault = ReadEncryptedVaultData(encryptedVaultData, localRequestId);
         if (FAILED(hrReadVault))
@@ -2417,7 +3074,7 @@ namespace winrt::PasskeyManager::implementation {
                         localRequestId +
                         L"ℹ" });
 
-                HRESULT hrRestore = RestoreSelfHostedVaultSnapshot(localRequestId);
+                HRESULT hrRestore = RestoreSelfHostedVaultSnapshot(localRequestId, cancellation);
                 if (SUCCEEDED(hrRestore))
                 {
                     encryptedVaultData.clear();
@@ -2428,25 +3085,260 @@ namespace winrt::PasskeyManager::implementation {
 
         tsupasswd::VaultDocumentV1 localDoc{};
         bool hasLocalVault = SUCCEEDED(hrReadVault);
-        if (hasLocalVault)
+        auto loadLocalDoc = [&]() -> bool
+        {
+            if (hasLocalVault)
+            {
+                if (!TryDecryptVaultDocument(encryptedVaultData, recoveryBytes, localDoc))
+                {
+                    return false;
+                }
+                DebugLogVaultDocument(L"manual_resync_local_loaded", localDoc);
+            }
+            else
+            {
+                localDoc.SchemaVersion = 1;
+                localDoc.VaultId = localRequestId;
+                localDoc.Revision = 0;
+                DebugLogVaultDocument(L"manual_resync_local_initialized", localDoc);
+            }
+            return true;
+        };
+
+        if (IsSyncDeltaEnabled())
         {
-            if (!TryDecryptVaultDocument(encryptedVaultData, recoveryBytes, localDoc))
+            if (!loadLocalDoc())
             {
                 return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
             }
-            DebugLogVaultDocument(L"manual_resync_local_loaded", localDoc);
+            if (cancelledAt(L"pull_server"))
+            {
+                return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+            }
+            reportProgress(L"pull_server");
+
+            // 前回の起動で残した cursor から読む。手元の vault がないときは cursor 0 から全件を引き直す。
+            DeltaSyncState deltaState{ syncUserId };
+            if (hasLocalVault)
+            {
+                m_syncDeltaStateStore.TryGet(syncBaseUrl, syncUserId, deltaState);
+            }
+
+            // cursor 0 から始めるときは、vault 全体で同期していた頃のサーバーの vault も merge してから item を送る。
+            // item を書いた後のサーバーは vault 全体の GET を 409 ITEM_SYNC_ACTIVE で断るので、そのときは item だけを読む。
+            if (deltaState.Cursor == 0)
+            {
+                std::wstring restoreRequestId = localRequestId + L"-pull";
+                HRESULT hrRestore = RestoreSelfHostedVaultSnapshot(restoreRequestId, cancellation);
+                if (hrRestore == S_OK)
+                {
+                    // 手元の vault はサーバーの vault に置き換わっているので、merge した vault をすぐに書き戻す。
+                    std::vector<BYTE> restoredCipher;
+                    tsupasswd::VaultDocumentV1 serverDoc{};
+                    if (SUCCEEDED(ReadEncryptedVaultData(restoredCipher, restoreRequestId)) && TryDecryptVaultDocument(restoredCipher, recoveryBytes, serverDoc))
+                    {
+                        auto mergeResult = MergeVaultDocumentsForSync(std::move(localDoc), std::move(serverDoc), localRequestId);
+                        localDoc = std::move(mergeResult.Document);
+                    }
+                    localDoc.Revision += 1;
+                    std::vector<BYTE> mergedCipher;
+                    if (!TryEncryptVaultDocument(localDoc, recoveryBytes, mergedCipher))
+                    {
+                        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+                    }
+                    RETURN_IF_FAILED(WriteEncryptedVaultData(mergedCipher));
+                }
+                else if (FAILED(hrRestore) && hrRestore != HRESULT_FROM_WIN32(ERROR_NOT_FOUND) && hrRestore != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH))
+                {
+                    return hrRestore;
+                }
+            }
+
+            HRESULT hrDelta = SyncVaultItemsDelta(localDoc, deltaState, recoveryBytes, localRequestId, outMergeStats, reportProgress, cancellation);
+            if (FAILED(hrDelta))
+            {
+                return hrDelta;
+            }
+            if (hrDelta == S_OK)
+            {
+                localDoc.Revision += 1;
+                std::vector<BYTE> mergedCipher;
+                if (!TryEncryptVaultDocument(localDoc, recoveryBytes, mergedCipher))
+                {
+                    return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+                }
+                RETURN_IF_FAILED(WriteEncryptedVaultData(mergedCipher));
+                m_lastSyncedVault.reset();
+            }
+            HRESULT hrState = m_syncDeltaStateStore.Record(syncBaseUrl, deltaState);
+            if (FAILED(hrState))
+            {
+                AppendPersistentSyncDiagnosticLog(
+                    L"WARNING: sync result=warning operation=sync_state reason=delta_state_write_failed hr=" + std::to_wstring(static_cast<int>(hrState)) +
+                    L" cursor=" + std::to_wstring(deltaState.Cursor) +
+                    L" request_id=" + localRequestId + L"\n");
+            }
+            UpdatePasskeyOperationStatusText(winrt::hstring{ L"SUCCESS: sync result=success operation=" + operation + L" step=" + std::wstring(hrDelta == S_OK ? L"delta_sync" : L"not_modified") + L" cursor=" + std::to_wstring(deltaState.Cursor) + L" request_id=" + localRequestId + L"✅" });
+            return S_OK;
         }
-        else
+
+        // 前回の同期から手元もサーバーも変わっていなければ、復号・merge・push は不要。
+        tsupasswd::VaultValidator knownServer{};
+        bool localUnchanged = false;
+        // 手元の vault がないときは条件を付けない (304 のまま空の vault を push しないため)。
+        if (hasLocalVault && m_lastSyncedVault && m_lastSyncedVault->UserId == syncUserId)
+        {
+            knownServer = m_lastSyncedVault->Server;
+            localUnchanged = m_lastSyncedVault->LocalCipher == encryptedVaultData;
+        }
+        // 前回サーバーと揃えた vault を三方向マージの基準にする。再起動後は snapshot の履歴から探す。
+        std::vector<BYTE> baseCipher;
+        if (hasLocalVault && m_lastSyncedVault && m_lastSyncedVault->UserId == syncUserId)
+        {
+            baseCipher = m_lastSyncedVault->LocalCipher;
+        }
+        m_lastSyncedVault.reset();
+
+        // 復号できない手元の vault をサーバーの内容で上書きしないよう、変わっている場合は pull の前に復号する。
+        if (!localUnchanged && !loadLocalDoc())
         {
-            localDoc.SchemaVersion = 1;
-            localDoc.VaultId = localRequestId;
-            localDoc.Revision = 0;
-            DebugLogVaultDocument(L"manual_resync_local_initialized", localDoc);
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
         }
 
+        auto reportMerge = [&](tsupasswd::VaultMergeResult const& mergeResult, wchar_t const* mergeKind)
+        {
+            if (outMergeStats)
+            {
+                *outMergeStats = mergeResult.Stats;
+            }
+            UpdatePasskeyOperationStatusText(
+                winrt::hstring{
+                    L"INFO: sync state=observed operation=" + operation +
+                    L" step=merge_vault_docs merge=" + std::wstring(mergeKind) +
+                    L" added_from_server=" + std::to_wstring(mergeResult.Stats.AddedFromServer) +
+                    L" updated_from_server=" + std::to_wstring(mergeResult.Stats.UpdatedFromServer) +
+                    L" tombstones_applied=" + std::to_wstring(mergeResult.Stats.TombstonesApplied) +
+                    L" duplicates_collapsed=" + std::to_wstring(mergeResult.Stats.DuplicatesCollapsed) +
+                    L" server_changes=" + std::to_wstring(mergeResult.ServerChanges) +
+                    L" local_changes=" + std::to_wstring(mergeResult.LocalChanges) +
+                    L" conflicts=" + std::to_wstring(mergeResult.Conflicts) +
+                    L" dedupe_scanned=" + std::wstring(mergeResult.DedupeScanned ? L"true" : L"false") +
+                    L" request_id=" + localRequestId +
+                    L"ℹ" });
+        };
+
+        // push の 409 の本文で受け取ったサーバーの vault を、conflictBaseCipher (手元が最後に揃えたサーバーの vault) を
+        // 基準に三方向で merge する。merge した vault はローカルにも書き、次の 409 の基準はそのサーバーの vault にする。
+        std::vector<BYTE> conflictBaseCipher;
+        std::vector<BYTE> mergedCipher;
+        auto mergeConflict = [&](std::vector<BYTE> const& serverCipher, std::vector<BYTE>& outMergedCipher) -> HRESULT
+        {
+            tsupasswd::VaultDocumentV1 baseDoc{};
+            tsupasswd::VaultDocumentV1 serverDoc{};
+            if (!TryDecryptVaultDocument(conflictBaseCipher, recoveryBytes, baseDoc) || !TryDecryptVaultDocument(serverCipher, recoveryBytes, serverDoc))
+            {
+                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+            auto mergeResult = MergeVaultDocumentsThreeWayForSync(baseDoc, std::move(localDoc), std::move(serverDoc), localRequestId);
+            localDoc = std::move(mergeResult.Document);
+            reportMerge(mergeResult, L"conflict_three_way");
+            localDoc.Revision += 1;
+            if (!TryEncryptVaultDocument(localDoc, recoveryBytes, outMergedCipher))
+            {
+                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+            RETURN_IF_FAILED(WriteEncryptedVaultData(outMergedCipher));
+            mergedCipher = outMergedCipher;
+            conflictBaseCipher = serverCipher;
+            return S_OK;
+        };
+
+        auto pushLocalDoc = [&](bool mergeConflicts) -> HRESULT
+        {
+            localDoc.Revision += 1;
+            mergedCipher.clear();
+            if (!TryEncryptVaultDocument(localDoc, recoveryBytes, mergedCipher))
+            {
+                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+
+            DebugLogVaultDocument(L"manual_resync_before_push", localDoc);
+
+            // pull で手元はサーバーの vault に置き換わっているので、取消でも merge した vault を書いてから止める。
+            tsupasswd::VaultValidator pushedServer{};
+            auto hrSync = tsupasswd::PersistMergedVaultThenPush(
+                [&]() { return WriteEncryptedVaultData(mergedCipher); },
+                [&]() { return cancelledAt(L"push"); },
+                [&]() -> HRESULT
+                {
+                    reportProgress(L"push");
+                    UpdatePasskeyOperationStatusText(winrt::hstring{ L"INFO: sync state=start operation=" + operation + L" request_id=" + localRequestId + L"ℹ" });
+                    // resync は m_manualResyncMutex を持ったまま読み・merge・書きを続けるので、このスレッド (同期キューや resync のワーカー) で結果を待つ。
+                    return SyncEncryptedVaultWithRetryAsync(
+                        mergedCipher,
+                        syncUserId,
+                        [this](winrt::hstring const& status)
+                        {
+                            UpdatePasskeyOperationStatusText(status);
+                        },
+                        cancellation,
+                        &pushedServer,
+                        mergeConflicts ? VaultConflictMerge(mergeConflict) : VaultConflictMerge{}).Get();
+                });
+            if (SUCCEEDED(hrSync) && pushedServer.VaultVersion > 0)
+            {
+                // 次の同期の三方向マージの基準として、サーバーと揃った vault を履歴に残す。
+                tsupasswd::SyncSnapshotRecord snapshot{};
+                snapshot.SnapshotId = GetNowIsoLikeTimestamp() + L"-synced";
+                snapshot.CapturedAt = GetNowIsoLikeTimestamp();
+                snapshot.UserId = syncUserId;
+                snapshot.ServerVersion = pushedServer.VaultVersion;
+                snapshot.Source = L"synced";
+                snapshot.CipherBytes = mergedCipher;
+                auto hrSnapshot = tsupasswd::SyncSnapshotStore::Append(snapshot);
+                if (FAILED(hrSnapshot))
+                {
+                    std::wstring snapshotOperation = L"manual_resync_snapshot_history_append";
+                    UpdatePasskeyOperationStatusText(winrt::hstring{ L"INFO: sync result=warning operation=" + snapshotOperation + L" hr=" + std::to_wstring(static_cast<int>(hrSnapshot)) + L" request_id=" + localRequestId + L"ℹ" });
+                }
+                m_lastSyncedVault = SyncedVaultState{ syncUserId, std::move(pushedServer), std::move(mergedCipher) };
+            }
+            return hrSync;
+        };
+
+        // 手元だけが変わり、前回揃えたサーバーの版と vault が分かっていれば GET を省いて送る。
+        // サーバーも変わっていれば 409 の本文の vault と merge して送り直すので、競合しても PUT 2 回で済む。
+        // 409 に vault を付けないサーバーでは、これまでどおり GET して merge してから送る。
+        if (!localUnchanged && hasLocalVault && knownServer.VaultVersion > 0 && !baseCipher.empty())
+        {
+            conflictBaseCipher = baseCipher;
+            HRESULT hrOptimistic = pushLocalDoc(true);
+            if (hrOptimistic != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH))
+            {
+                return hrOptimistic;
+            }
+            UpdatePasskeyOperationStatusText(winrt::hstring{ L"INFO: sync state=observed operation=" + operation + L" step=optimistic_push_conflict fallback=pull_server request_id=" + localRequestId + L"ℹ" });
+        }
+
+        if (cancelledAt(L"pull_server"))
+        {
+            return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+        }
+        reportProgress(L"pull_server");
         std::wstring restoreRequestId = localRequestId + L"-pull";
-        HRESULT hrRestore = RestoreSelfHostedVaultSnapshot(restoreRequestId);
-        if (SUCCEEDED(hrRestore))
+        HRESULT hrRestore = RestoreSelfHostedVaultSnapshot(restoreRequestId, cancellation, knownServer);
+        if (hrRestore == S_FALSE && localUnchanged)
+        {
+            m_lastSyncedVault = SyncedVaultState{ syncUserId, knownServer, std::move(encryptedVaultData) };
+            UpdatePasskeyOperationStatusText(winrt::hstring{ L"SUCCESS: sync result=success operation=" + operation + L" step=not_modified server_version=" + std::to_wstring(knownServer.VaultVersion) + L" request_id=" + localRequestId + L"✅" });
+            return S_OK;
+        }
+        if (localUnchanged && !loadLocalDoc())
+        {
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+
+        if (hrRestore == S_OK)
         {
             std::vector<BYTE> restoredCipher;
             HRESULT hrReadRestored = ReadEncryptedVaultData(restoredCipher, restoreRequestId);
@@ -2456,49 +3348,118 @@ namespace winrt::PasskeyManager::implementation {
                 if (TryDecryptVaultDocument(restoredCipher, recoveryBytes, serverDoc))
                 {
                     DebugLogVaultDocument(L"manual_resync_server_loaded", serverDoc);
-                    auto mergeResult = MergeVaultDocuments(std::move(localDoc), serverDoc, localRequestId);
+                    reportProgress(L"merge");
+                    // 基準が見つからないか復号できなければ二方向 (UpdatedAt が新しい方) のマージにする。
+                    tsupasswd::VaultDocumentV1 baseDoc{};
+                    bool threeWay = hasLocalVault &&
+                        (!baseCipher.empty() || TryLoadSyncedVaultSnapshot(syncUserId, baseCipher)) &&
+                        TryDecryptVaultDocument(baseCipher, recoveryBytes, baseDoc);
+                    auto mergeResult = threeWay ?
+                        MergeVaultDocumentsThreeWayForSync(baseDoc, std::move(localDoc), std::move(serverDoc), localRequestId) :
+                        MergeVaultDocumentsForSync(std::move(localDoc), std::move(serverDoc), localRequestId);
                     localDoc = std::move(mergeResult.Document);
-                    UpdatePasskeyOperationStatusText(
-                        winrt::hstring{
-                            L"INFO: sync state=observed operation=" + operation +
-                            L" step=merge_vault_docs added_from_server=" + std::to_wstring(mergeResult.Stats.AddedFromServer) +
-                            L" updated_from_server=" + std::to_wstring(mergeResult.Stats.UpdatedFromServer) +
-                            L" tombstones_applied=" + std::to_wstring(mergeResult.Stats.TombstonesApplied) +
-                            L" duplicates_collapsed=" + std::to_wstring(mergeResult.Stats.DuplicatesCollapsed) +
-                            L" request_id=" + localRequestId +
-                            L"ℹ" });
+                    reportMerge(mergeResult, threeWay ? L"three_way" : L"two_way");
+                    // 取ってから送るまでに別の端末が書けば、取ったサーバーの vault を基準に 409 の本文と merge する。
+                    conflictBaseCipher = std::move(restoredCipher);
                 }
             }
         }
-        else if (hrRestore != HRESULT_FROM_WIN32(ERROR_NOT_FOUND))
+        else if (FAILED(hrRestore) && hrRestore != HRESULT_FROM_WIN32(ERROR_NOT_FOUND))
         {
             return hrRestore;
         }
 
-        localDoc.Revision += 1;
-        std::vector<BYTE> mergedCipher;
-        if (!TryEncryptVaultDocument(localDoc, recoveryBytes, mergedCipher))
+        return pushLocalDoc(!conflictBaseCipher.empty());
+    }
+
+    // GetVault や 409 の本文で受け取った vault の暗号文を取り出す (base64 を戻し、同期用の包みを外す。record の暗号文は移す)。
+    // 取り出せなければ理由を状態表示に出して ERROR_INVALID_DATA を返す。
+    HRESULT PluginRegistrationManager::DecodeServerVaultCipher(
+        tsupasswd::VaultRecord& record,
+        std::wstring const& operation,
+        std::wstring const& requestId,
+        std::vector<BYTE>& outCipher)
+    {
+        outCipher.clear();
+        if (record.Blob.CiphertextBase64.empty() && record.Blob.Ciphertext.empty())
         {
+            DebugLogIfVerbose(
+                L"DEBUG: " + operation + L" empty_ciphertext server_version=" +
+                std::to_wstring(record.VaultVersion) +
+                L" updated_at='" + record.Meta.UpdatedAt + L"'\n");
+            UpdatePasskeyOperationStatusText(
+                winrt::hstring{
+                    L"WARNING: sync result=failed operation=" + operation +
+                    L" reason=empty_ciphertext hr=-2147024883 failure_kind=client_error request_id=" +
+                    requestId +
+                    L"⚠" });
             return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
         }
 
-        DebugLogVaultDocument(L"manual_resync_before_push", localDoc);
+        if (!record.Blob.Ciphertext.empty())
+        {
+            outCipher = std::move(record.Blob.Ciphertext);
+        }
+        else if (!Base64StdDecode(record.Blob.CiphertextBase64, outCipher))
+        {
+            // 互換性: 既存のMVPサーバや過去データがURL-safe Base64を返す場合がある
+            if (!Base64UrlDecode(record.Blob.CiphertextBase64, outCipher))
+            {
+                std::wstring preview = record.Blob.CiphertextBase64;
+                if (preview.size() > 24)
+                {
+                    preview = preview.substr(0, 24) + L"...";
+                }
+                DebugLogIfVerbose(
+                    L"DEBUG: " + operation + L" invalid_ciphertext base64_len=" +
+                    std::to_wstring(record.Blob.CiphertextBase64.size()) +
+                    L" base64_prefix='" + preview + L"'\n");
 
-        RETURN_IF_FAILED(WriteEncryptedVaultData(mergedCipher));
+                UpdatePasskeyOperationStatusText(
+                    winrt::hstring{
+                        L"WARNING: sync result=failed operation=" + operation + L" reason=invalid_ciphertext hr=-2147024883 failure_kind=client_error request_id=" +
+                        requestId +
+                        L"⚠" });
+                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+        }
 
-        UpdatePasskeyOperationStatusText(winrt::hstring{ L"INFO: sync state=start operation=" + operation + L" request_id=" + localRequestId + L"ℹ" });
-        auto hrSync = SyncEncryptedVaultWithRetry(
-            mergedCipher,
-            syncUserId,
-            [this](winrt::hstring const& status)
+        winrt::PasskeyManager::implementation::PluginRegistrationManager::getInstance().ReloadRegistryValues(requestId);
+        auto exportKey = winrt::PasskeyManager::implementation::PluginRegistrationManager::getInstance().GetOpaqueExportKey();
+        if (IsOpaqueSessionWrapEnabled() && !exportKey.empty())
+        {
+            tsupasswd::VaultCryptoError unwrapError{};
+            std::vector<uint8_t> unwrapped;
+            if (tsupasswd::UnwrapVaultCipherForSyncV1(
+                std::vector<uint8_t>(outCipher.begin(), outCipher.end()),
+                std::vector<uint8_t>(exportKey.begin(), exportKey.end()),
+                unwrapped,
+                unwrapError))
             {
-                UpdatePasskeyOperationStatusText(status);
-            });
-
-        return hrSync;
+                outCipher.assign(unwrapped.begin(), unwrapped.end());
+            }
+            else if (unwrapError.Code != L"not_wrapped")
+            {
+                UpdatePasskeyOperationStatusText(
+                    winrt::hstring{
+                        L"WARNING: sync result=failed operation=" + operation +
+                        L" reason=sync_unwrap_failed code=" + unwrapError.Code +
+                        L" detail=" + unwrapError.Detail +
+                        L" legacy_hint=wrapped_with_old_session_key_or_mismatched_export_key" +
+                        L" recovery=disable_TSUPASSWD_SYNC_OPAQUE_SESSION_WRAP_then_manual_resync_to_overwrite_server" +
+                        L" request_id=" + requestId +
+                        L"⚠" });
+                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+        }
+        return S_OK;
     }
 
-    HRESULT PluginRegistrationManager::RestoreSelfHostedVaultSnapshot(std::wstring const& requestId)
+    HRESULT PluginRegistrationManager::RestoreSelfHostedVaultSnapshot(
+        std::wstring const& requestId,
+        tsupasswd::SyncCancellationToken const& cancellation,
+        tsupasswd::VaultValidator const& known,
+        tsupasswd::VaultValidator* outServer)
     {
         std::wstring operation = L"restore_snapshot";
         std::wstring localRequestId = requestId;
@@ -2528,21 +3489,20 @@ namespace winrt::PasskeyManager::implementation {
 
         tsupasswd::SyncClient syncClient(syncBaseUrl);
         syncClient.SetApiKind(tsupasswd::SyncApiKind::Axum);
+        syncClient.SetVaultEncoding(GetSyncVaultEncoding());
         syncClient.SetAllowInsecureHttp(IsAllowInsecureHttpEnabled());
+        syncClient.SetCallOptions(tsupasswd::SyncCallOptions{ cancellation });
         std::wstring bearerToken = GetEnvironmentVariableValue(kSyncBearerTokenEnv);
         std::vector<uint8_t> sessionKeyBytes;
+        auto statusSink = [&](winrt::hstring const& text)
+        {
+            UpdatePasskeyOperationStatusText(text);
+        };
         if (!bearerToken.empty())
         {
             syncClient.SetBearerToken(bearerToken);
-
-            if (!recoveryCode.empty())
-            {
-                tsupasswd::SyncHttpStatus loginStatus{};
-                std::wstring issuedToken;
-                (void)syncClient.OpaqueLogin(syncUserId, recoveryCode, issuedToken, &sessionKeyBytes, &loginStatus);
-            }
         }
-        else
+        else if (!TryUseCachedSyncToken(syncClient, syncUserId, operation, localRequestId, syncBaseUrl, statusSink, &sessionKeyBytes))
         {
             bool issuedDevLoginToken = TryIssueDevLoginToken(
                 syncClient,
@@ -2550,10 +3510,7 @@ namespace winrt::PasskeyManager::implementation {
                 operation,
                 localRequestId,
                 syncBaseUrl,
-                [&](winrt::hstring const& text)
-                {
-                    UpdatePasskeyOperationStatusText(text);
-                },
+                statusSink,
                 &sessionKeyBytes);
             if (!issuedDevLoginToken)
             {
@@ -2564,25 +3521,9 @@ namespace winrt::PasskeyManager::implementation {
                 }
 
                 tsupasswd::SyncHttpStatus loginStatus{};
-                std::wstring issuedToken;
-                HRESULT hrLogin = syncClient.OpaqueLogin(syncUserId, recoveryCode, issuedToken, &sessionKeyBytes, &loginStatus);
-                if (FAILED(hrLogin) || issuedToken.empty())
+                HRESULT hrLogin = OpaqueLoginWithRegisterFallback(syncClient, syncUserId, recoveryCode, localRequestId, syncBaseUrl, &sessionKeyBytes, loginStatus);
+                if (SUCCEEDED(hrLogin))
                 {
-                    tsupasswd::SyncHttpStatus regStatus{};
-                    std::vector<uint8_t> regExportKey;
-                    (void)syncClient.OpaqueRegister(syncUserId, recoveryCode, &regExportKey, &regStatus);
-                    if (!regExportKey.empty())
-                    {
-                        (void)SetOpaqueExportKey(std::vector<BYTE>(regExportKey.begin(), regExportKey.end()), localRequestId);
-                    }
-                    loginStatus = {};
-                    issuedToken.clear();
-                    hrLogin = syncClient.OpaqueLogin(syncUserId, recoveryCode, issuedToken, &sessionKeyBytes, &loginStatus);
-                }
-
-                if (SUCCEEDED(hrLogin) && !issuedToken.empty())
-                {
-                    syncClient.SetBearerToken(issuedToken);
                     UpdatePasskeyOperationStatusText(winrt::hstring{ L"INFO: sync state=observed operation=" + operation + L" step=opaque_login_token_issued request_id=" + ResolveRequestId(localRequestId, loginStatus) + L"ℹ" });
                 }
                 else
@@ -2595,43 +3536,57 @@ namespace winrt::PasskeyManager::implementation {
 
         tsupasswd::VaultRecord record{};
         tsupasswd::SyncHttpStatus status{};
-        HRESULT hr = syncClient.GetVault(syncUserId, record, &status);
+        HRESULT hr = syncClient.GetVault(syncUserId, known, record, &status);
         if (hr == HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED) && (status.StatusCode == 401 || status.StatusCode == 403))
         {
+            tsupasswd::SyncTokenCache::getInstance().Invalidate(syncBaseUrl, syncUserId);
             if (!recoveryCode.empty())
             {
                 tsupasswd::SyncHttpStatus loginStatus{};
-                std::wstring issuedToken;
-                HRESULT hrLogin = syncClient.OpaqueLogin(syncUserId, recoveryCode, issuedToken, &sessionKeyBytes, &loginStatus);
-                if (FAILED(hrLogin) || issuedToken.empty())
-                {
-                    tsupasswd::SyncHttpStatus regStatus{};
-                    std::vector<uint8_t> regExportKey;
-                    (void)syncClient.OpaqueRegister(syncUserId, recoveryCode, &regExportKey, &regStatus);
-                    if (!regExportKey.empty())
-                    {
-                        (void)SetOpaqueExportKey(std::vector<BYTE>(regExportKey.begin(), regExportKey.end()), localRequestId);
-                    }
-                    loginStatus = {};
-                    issuedToken.clear();
-                    hrLogin = syncClient.OpaqueLogin(syncUserId, recoveryCode, issuedToken, &sessionKeyBytes, &loginStatus);
-                }
-
-                if (SUCCEEDED(hrLogin) && !issuedToken.empty())
+                HRESULT hrLogin = OpaqueLoginWithRegisterFallback(syncClient, syncUserId, recoveryCode, localRequestId, syncBaseUrl, &sessionKeyBytes, loginStatus);
+                if (SUCCEEDED(hrLogin))
                 {
-                    syncClient.SetBearerToken(issuedToken);
                     ClearProcessEnvironmentVariableValue(kSyncBearerTokenEnv);
                     ClearUserEnvironmentRegistryValue(kSyncBearerTokenEnv);
                     UpdatePasskeyOperationStatusText(winrt::hstring{ L"INFO: sync state=observed operation=" + operation + L" step=opaque_reauth_token_issued request_id=" + ResolveRequestId(localRequestId, loginStatus) + L"ℹ" });
                     status = {};
                     record = {};
-                    hr = syncClient.GetVault(syncUserId, record, &status);
+                    hr = syncClient.GetVault(syncUserId, known, record, &status);
                 }
             }
         }
 
+        // GetVault で見た版を残す。404 はサーバーに vault がない (次の PutVault は 0 から)。
+        if (hr == S_OK)
+        {
+            RecordSyncServerVersion(syncBaseUrl, syncUserId, record.VaultVersion, record.Meta.BlobSha256Base64, localRequestId);
+        }
+        else if (hr == S_FALSE)
+        {
+            RecordSyncServerVersion(syncBaseUrl, syncUserId, known.VaultVersion, known.BlobSha256Base64, localRequestId);
+        }
+        else if (status.StatusCode == 404)
+        {
+            RecordSyncServerVersion(syncBaseUrl, syncUserId, 0, L"", localRequestId);
+        }
+
+        if (hr == S_FALSE)
+        {
+            if (outServer)
+            {
+                *outServer = known;
+            }
+            UpdatePasskeyOperationStatusText(winrt::hstring{ L"INFO: sync result=not_modified operation=" + operation + L" status=304 server_version=" + std::to_wstring(known.VaultVersion) + L" request_id=" + ResolveRequestId(localRequestId, status) + L"ℹ" });
+            return S_FALSE;
+        }
+
         if (FAILED(hr))
         {
+            if (hr == HRESULT_FROM_WIN32(ERROR_CANCELLED))
+            {
+                UpdatePasskeyOperationStatusText(winrt::hstring{ L"INFO: sync result=cancelled operation=" + operation + L" request_id=" + localRequestId + L"ℹ" });
+                return hr;
+            }
             if (hr == HRESULT_FROM_WIN32(ERROR_NOT_FOUND) || status.StatusCode == 404)
             {
                 std::wstring warning = L"WARNING: sync result=failed operation=" + operation + L" hr=-2147023728 status=404 reason=snapshot_not_found failure_kind=not_found";
@@ -2660,73 +3615,11 @@ namespace winrt::PasskeyManager::implementation {
             return hr;
         }
 
-        if (record.Blob.CiphertextBase64.empty())
-        {
-            DebugLogIfVerbose(
-                L"DEBUG: restore_snapshot empty_ciphertext server_version=" +
-                std::to_wstring(record.VaultVersion) +
-                L" updated_at='" + record.Meta.UpdatedAt + L"'\n");
-            UpdatePasskeyOperationStatusText(
-                winrt::hstring{
-                    L"WARNING: sync result=failed operation=" + operation +
-                    L" reason=empty_ciphertext hr=-2147024883 failure_kind=client_error request_id=" +
-                    ResolveRequestId(localRequestId, status) +
-                    L"⚠" });
-            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
-        }
-
         std::vector<BYTE> cipherBytes;
-        if (!Base64StdDecode(record.Blob.CiphertextBase64, cipherBytes))
+        HRESULT hrDecode = DecodeServerVaultCipher(record, operation, ResolveRequestId(localRequestId, status), cipherBytes);
+        if (FAILED(hrDecode))
         {
-            // 互換性: 既存のMVPサーバや過去データがURL-safe Base64を返す場合がある
-            if (!Base64UrlDecode(record.Blob.CiphertextBase64, cipherBytes))
-            {
-                std::wstring preview = record.Blob.CiphertextBase64;
-                if (preview.size() > 24)
-                {
-                    preview = preview.substr(0, 24) + L"...";
-                }
-                DebugLogIfVerbose(
-                    L"DEBUG: restore_snapshot invalid_ciphertext base64_len=" +
-                    std::to_wstring(record.Blob.CiphertextBase64.size()) +
-                    L" base64_prefix='" + preview + L"'\n");
-
-                UpdatePasskeyOperationStatusText(
-                    winrt::hstring{
-                        L"WARNING: sync result=failed operation=" + operation + L" reason=invalid_ciphertext hr=-2147024883 failure_kind=client_error request_id=" +
-                        ResolveRequestId(localRequestId, status) +
-                        L"⚠" });
-                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
-            }
-        }
-
-        winrt::PasskeyManager::implementation::PluginRegistrationManager::getInstance().ReloadRegistryValues(localRequestId);
-        auto exportKey = winrt::PasskeyManager::implementation::PluginRegistrationManager::getInstance().GetOpaqueExportKey();
-        if (IsOpaqueSessionWrapEnabled() && !exportKey.empty())
-        {
-            tsupasswd::VaultCryptoError unwrapError{};
-            std::vector<uint8_t> unwrapped;
-            if (tsupasswd::UnwrapVaultCipherForSyncV1(
-                std::vector<uint8_t>(cipherBytes.begin(), cipherBytes.end()),
-                std::vector<uint8_t>(exportKey.begin(), exportKey.end()),
-                unwrapped,
-                unwrapError))
-            {
-                cipherBytes.assign(unwrapped.begin(), unwrapped.end());
-            }
-            else if (unwrapError.Code != L"not_wrapped")
-            {
-                UpdatePasskeyOperationStatusText(
-                    winrt::hstring{
-                        L"WARNING: sync result=failed operation=" + operation +
-                        L" reason=sync_unwrap_failed code=" + unwrapError.Code +
-                        L" detail=" + unwrapError.Detail +
-                        L" legacy_hint=wrapped_with_old_session_key_or_mismatched_export_key" +
-                        L" recovery=disable_TSUPASSWD_SYNC_OPAQUE_SESSION_WRAP_then_manual_resync_to_overwrite_server" +
-                        L" request_id=" + ResolveRequestId(localRequestId, status) +
-                        L"⚠" });
-                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
-            }
+            return hrDecode;
         }
 
         RETURN_IF_FAILED(WriteEncryptedVaultData(cipherBytes));
@@ -2745,6 +3638,12 @@ namespace winrt::PasskeyManager::implementation {
             UpdatePasskeyOperationStatusText(winrt::hstring{ L"INFO: sync result=warning operation=" + snapshotOperation + L" hr=" + std::to_wstring(static_cast<int>(hrSnapshot)) + L" request_id=" + localRequestId + L"ℹ" });
         }
 
+        if (outServer)
+        {
+            outServer->VaultVersion = record.VaultVersion;
+            outServer->BlobSha256Base64 = record.Meta.BlobSha256Base64;
+        }
+
         std::wstring success =
             L"SUCCESS: sync result=success operation=" + operation + L" hr=0 bytes=" +
             std::to_wstring(cipherBytes.size()) +
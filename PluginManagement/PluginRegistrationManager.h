@@ -4,6 +4,19 @@
 #include <MainWindow.xaml.h>
 #include <MainPage.xaml.h>
 #include <PluginAuthenticator/PluginAuthenticatorImpl.h>
+#include "src/SyncCancellation.h"
+#include "src/SyncClient.h"
+#include "src/SyncCoalescingQueue.h"
+#include "src/SyncDeltaStateStore.h"
+#include "src/SyncOutbox.h"
+#include "src/SyncStateStore.h"
+#include "src/VaultModel.h"
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <map>
+#include <mutex>
+#include <optional>
 
 constexpr wchar_t c_pluginName[] = L"HappyFactory";
 constexpr wchar_t c_pluginRpId[] = L"happyfactory.dev";
@@ -90,23 +103,128 @@ namespace winrt::PasskeyManager::implementation
         HRESULT WriteEncryptedVaultData(std::vector<BYTE> cipherText);
         HRESULT ReadEncryptedVaultData(std::vector<BYTE>& cipherText, std::wstring const& requestId = L"");
         HRESULT ClearLocalEncryptedVaultData(std::wstring const& requestId = L"");
-        HRESULT ManualResyncSelfHostedVault(std::wstring const& requestId = L"");
-        HRESULT RestoreSelfHostedVaultSnapshot(std::wstring const& requestId = L"");
+        // progressSink には manual_resync の段階名 (read_local / pull_server / merge / push) が順に通知される。
+        // cancellation を取消すと通信中の要求を打ち切り、HRESULT_FROM_WIN32(ERROR_CANCELLED) を返す。
+        HRESULT ManualResyncSelfHostedVault(
+            std::wstring const& requestId = L"",
+            tsupasswd::VaultMergeStats* outMergeStats = nullptr,
+            std::function<void(std::wstring const&)> const& progressSink = nullptr,
+            tsupasswd::SyncCancellationToken const& cancellation = {});
+        // known があればサーバーが変わっていないとき S_FALSE を返し、ローカルの vault は書き換えない。
+        // outServer には取得したサーバーの版を返す。
+        HRESULT RestoreSelfHostedVaultSnapshot(
+            std::wstring const& requestId = L"",
+            tsupasswd::SyncCancellationToken const& cancellation = {},
+            tsupasswd::VaultValidator const& known = {},
+            tsupasswd::VaultValidator* outServer = nullptr);
         void ReloadRegistryValues(std::wstring const& requestId = L"");
+        // 同期が設定されていれば、バックグラウンドで同期サーバーへの接続を開き token を用意する
+        // (起動後最初の保存が名前解決・TLS・login を待たず、PUT の 1 往復だけで済むようにする)。
+        // 前回送れないまま終わった世代が outbox にあれば、その再送も予約する。2 回目以降は何もしない。
+        void StartSyncPrewarm();
+        // ローカルの vault 書き込みの後の同期 (ManualResyncSelfHostedVault) を予約する。kVaultSyncDebounce の間に続いた
+        // 予約は、その時点の最新の vault を送る 1 回の同期にまとまる。戻り値はその同期の結果で、待たなくてよい。
+        // 書き込んだ世代は m_syncOutbox に残し、同期サーバーに届かなければ送れるまでバックグラウンドでやり直す。
+        std::shared_future<HRESULT> QueueVaultSync(std::wstring const& requestId);
+        // 予約済みの同期をすぐ始め、終わるまで最大 timeoutMs 待つ (native host の終了前など)。間に合わなければ false。
+        bool FlushVaultSync(DWORD timeoutMs);
+        // StartSyncPrewarm の login が終わるまで (最大 kSyncPrewarmWaitMs) 待つ。同じ token を 2 回 login しないため。
+        // バックグラウンドの同期キュー (outbox の再送を含む) だけが待つ。利用者が始めた同期は待たない。
+        void WaitForSyncPrewarm();
 
     private:
-        HRESULT SyncEncryptedVaultWithRetry(
-            std::vector<BYTE> const& encryptedVaultData,
+        static constexpr DWORD kSyncPrewarmWaitMs = 10000;
+        // 続けて編集したときにまとめる間隔と、まとめ続けても同期を始めるまでの上限。
+        static constexpr std::chrono::milliseconds kVaultSyncDebounce{ 1500 };
+        static constexpr std::chrono::milliseconds kVaultSyncMaxDelay{ 10000 };
+
+        HRESULT RunQueuedVaultSync(uint32_t coalescedRequests);
+        // 送れなかった世代の失敗を m_syncOutbox に記録し、やり直せる失敗なら待ち時間の後の再送を予約する。
+        void ScheduleVaultSyncRetry(std::wstring const& syncUserId, HRESULT hrSync, std::wstring const& requestId);
+        // サーバーで見た vault の版を m_syncStateStore に残す。書けなければ診断ログに残すだけ。
+        void RecordSyncServerVersion(
+            std::wstring const& syncBaseUrl,
             std::wstring const& syncUserId,
-            std::function<void(winrt::hstring const&)> const& statusSink);
+            int64_t serverVersion,
+            std::wstring const& blobSha256Base64,
+            std::wstring const& requestId);
+
+        void PrewarmSync(std::wstring const& syncBaseUrl, std::wstring const& syncUserId);
+
+        // 409 の本文で受け取ったサーバーの vault (ローカルと同じ形の暗号文) を手元と merge し、送り直す暗号文を返す。
+        using VaultConflictMerge = std::function<HRESULT(std::vector<BYTE> const& serverCipher, std::vector<BYTE>& outMergedCipher)>;
+
+        // conflictMerge があれば 409 にサーバーの vault を求め、merge して同じ呼び出しのうちに送り直す。
+        // サーバーが vault を付けなければ、古い版のまま上書きしないよう 409 (ERROR_REVISION_MISMATCH) を返す。
+        // PUT は SyncClient の非同期 API で送り、送り直しは RunWithRetryAsync が reactor のタイマーで待つ。
+        // 最初の PUT までの login は呼び出したスレッドで行う。outServer は task が終わるまで残しておくこと。
+        tsupasswd::SyncTask<HRESULT> SyncEncryptedVaultWithRetryAsync(
+            std::vector<BYTE> encryptedVaultData,
+            std::wstring syncUserId,
+            std::function<void(winrt::hstring const&)> statusSink,
+            tsupasswd::SyncCancellationToken cancellation = {},
+            tsupasswd::VaultValidator* outServer = nullptr,
+            VaultConflictMerge conflictMerge = nullptr);
+        // passkey 作成時の初回同期の結果を待たずに受け取り、outbox の世代を片付けるか再送を予約する。
+        // outboxGeneration が 0 なら outbox を使わない (既定の同期 user でない)。
+        winrt::fire_and_forget CompleteInitialVaultSync(
+            tsupasswd::SyncTask<HRESULT> sync,
+            std::wstring syncUserId,
+            uint64_t outboxGeneration,
+            std::wstring requestId);
+        // 送り終えた世代を m_syncStateStore に残してから outbox から外す。
+        void CompleteSyncedOutboxGeneration(std::wstring const& syncUserId, uint64_t generation, std::wstring const& requestId);
+        HRESULT DecodeServerVaultCipher(
+            tsupasswd::VaultRecord& record,
+            std::wstring const& operation,
+            std::wstring const& requestId,
+            std::vector<BYTE>& outCipher);
+
+        using SyncedItemState = tsupasswd::SyncDeltaItemState;
+        using DeltaSyncState = tsupasswd::SyncDeltaState;
+
+        // TSUPASSWD_SYNC_DELTA のときの manual_resync。state.Cursor 以降のサーバーの変更を localDoc に merge し、
+        // 変わった item だけを送る。state は成功時だけ進めたものを呼び出し側が保存する。何も変わらなければ S_FALSE。
+        HRESULT SyncVaultItemsDelta(
+            tsupasswd::VaultDocumentV1& localDoc,
+            DeltaSyncState& state,
+            std::vector<uint8_t> const& recoveryBytes,
+            std::wstring const& localRequestId,
+            tsupasswd::VaultMergeStats* outMergeStats,
+            std::function<void(wchar_t const*)> const& reportProgress,
+            tsupasswd::SyncCancellationToken const& cancellation);
+
+        // manual_resync が最後にサーバーと一致させた状態。
+        // サーバーが 304 を返し、ローカルの暗号文も同じなら pull/decrypt/merge/push をすべて省く。
+        struct SyncedVaultState
+        {
+            std::wstring UserId{};
+            tsupasswd::VaultValidator Server{};
+            std::vector<BYTE> LocalCipher{};
+        };
 
         AUTHENTICATOR_STATE m_pluginState;
         bool m_initialized = false;
         bool m_pluginRegistered = false;
 
         std::mutex m_pluginOperationConfigMutex;
+        std::mutex m_manualResyncMutex;
         _Guarded_by_(m_pluginOperationConfigMutex) std::vector<BYTE> m_hmacSecret = {};
         _Guarded_by_(m_pluginOperationConfigMutex) std::vector<BYTE> m_opaqueExportKey = {};
+        _Guarded_by_(m_manualResyncMutex) std::optional<SyncedVaultState> m_lastSyncedVault;
+
+        std::once_flag m_syncPrewarmOnce;
+        std::atomic<bool> m_syncPrewarmStarted{ false };
+        std::atomic<DWORD> m_syncPrewarmThreadId{ 0 };
+        wil::slim_event_manual_reset m_syncPrewarmDone;
+        // 同期サーバーにまだ送っていない世代 (%LOCALAPPDATA%\PasskeyManager\sync_outbox.log)。
+        tsupasswd::SyncOutbox m_syncOutbox;
+        // 同期サーバーと user ごとの最後に見た版と送り終えた世代 (%LOCALAPPDATA%\PasskeyManager\sync_state.log)。
+        tsupasswd::SyncStateStore m_syncStateStore;
+        // 差分同期の cursor と item の版 (%LOCALAPPDATA%\PasskeyManager\sync_delta_state.log)。
+        tsupasswd::SyncDeltaStateStore m_syncDeltaStateStore;
+        // 止めるときに予約済みの同期を行うので、ほかのメンバーより先に破棄されるよう最後に置く。
+        tsupasswd::SyncCoalescingQueue m_vaultSyncQueue;
 
         PluginRegistrationManager();
         ~PluginRegistrationManager();
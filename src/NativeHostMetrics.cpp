@@ -0,0 +1,202 @@
+#include "NativeHostMetrics.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace tsupasswd
+{
+    size_t LatencyHistogram::BucketIndex(uint64_t micros) noexcept
+    {
+        if (micros < kSubBucketCount)
+        {
+            return static_cast<size_t>(micros);
+        }
+
+        uint32_t exponent = static_cast<uint32_t>(std::bit_width(micros)) - 1;
+        if (exponent >= kMaxExponent)
+        {
+            return kBucketCount - 1;
+        }
+        uint32_t shift = exponent - kSubBucketBits;
+        size_t subBucket = static_cast<size_t>((micros >> shift) & (kSubBucketCount - 1));
+        return kSubBucketCount + static_cast<size_t>(shift) * kSubBucketCount + subBucket;
+    }
+
+    uint64_t LatencyHistogram::BucketUpperBound(size_t index) noexcept
+    {
+        if (index < kSubBucketCount)
+        {
+            return index;
+        }
+
+        size_t shift = (index - kSubBucketCount) / kSubBucketCount;
+        uint64_t subBucket = (index - kSubBucketCount) % kSubBucketCount;
+        uint64_t lower = (kSubBucketCount + subBucket) << shift;
+        return lower + (uint64_t{ 1 } << shift) - 1;
+    }
+
+    void LatencyHistogram::Record(uint64_t micros) noexcept
+    {
+        m_buckets[BucketIndex(micros)].fetch_add(1, std::memory_order_relaxed);
+        m_sumMicros.fetch_add(micros, std::memory_order_relaxed);
+
+        uint64_t currentMax = m_maxMicros.load(std::memory_order_relaxed);
+        while (micros > currentMax && !m_maxMicros.compare_exchange_weak(currentMax, micros, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    LatencyHistogram::Snapshot LatencyHistogram::Read(bool reset) noexcept
+    {
+        Snapshot snapshot{};
+        snapshot.Buckets.resize(kBucketCount);
+        for (size_t i = 0; i < kBucketCount; ++i)
+        {
+            uint64_t count = reset ? m_buckets[i].exchange(0, std::memory_order_relaxed) : m_buckets[i].load(std::memory_order_relaxed);
+            snapshot.Buckets[i] = count;
+            snapshot.Count += count;
+        }
+        snapshot.SumMicros = reset ? m_sumMicros.exchange(0, std::memory_order_relaxed) : m_sumMicros.load(std::memory_order_relaxed);
+        snapshot.MaxMicros = reset ? m_maxMicros.exchange(0, std::memory_order_relaxed) : m_maxMicros.load(std::memory_order_relaxed);
+        return snapshot;
+    }
+
+    uint64_t LatencyHistogram::Snapshot::ValueAtPercentile(double percentile) const
+    {
+        if (Count == 0)
+        {
+            return 0;
+        }
+
+        double clamped = std::clamp(percentile, 0.0, 100.0);
+        uint64_t rank = static_cast<uint64_t>(clamped / 100.0 * static_cast<double>(Count) + 0.999999);
+        rank = std::clamp<uint64_t>(rank, 1, Count);
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < Buckets.size(); ++i)
+        {
+            seen += Buckets[i];
+            if (seen >= rank)
+            {
+                // 並行記録中に読んだ場合、max が bucket より小さく見えることがある。
+                return MaxMicros == 0 ? BucketUpperBound(i) : std::min(BucketUpperBound(i), MaxMicros);
+            }
+        }
+        return MaxMicros;
+    }
+
+    NativeHostMetrics::NativeHostMetrics() :
+        m_started(std::chrono::steady_clock::now())
+    {
+    }
+
+    NativeHostMetrics& NativeHostMetrics::getInstance()
+    {
+        static NativeHostMetrics instance;
+        return instance;
+    }
+
+    void NativeHostMetrics::RecordCommand(NativeHostCommandMetric command, uint64_t micros, bool ok) noexcept
+    {
+        auto index = static_cast<size_t>(command);
+        if (index >= m_commands.size())
+        {
+            index = static_cast<size_t>(NativeHostCommandMetric::Other);
+        }
+        m_commands[index].Latency.Record(micros);
+        if (!ok)
+        {
+            m_commands[index].Errors.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void NativeHostMetrics::RecordPhase(NativeHostPhaseMetric phase, uint64_t micros) noexcept
+    {
+        auto index = static_cast<size_t>(phase);
+        if (index < m_phases.size())
+        {
+            m_phases[index].Record(micros);
+        }
+    }
+
+    NativeHostMetricsSnapshot NativeHostMetrics::Read(bool reset)
+    {
+        NativeHostMetricsSnapshot snapshot{};
+        int64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_started).count();
+        snapshot.UptimeMs = nowMs;
+        int64_t windowStartMs = reset ? m_windowStartMs.exchange(nowMs, std::memory_order_relaxed) : m_windowStartMs.load(std::memory_order_relaxed);
+        snapshot.WindowMs = nowMs - windowStartMs;
+
+        for (size_t i = 0; i < m_commands.size(); ++i)
+        {
+            snapshot.Commands[i].Latency = m_commands[i].Latency.Read(reset);
+            snapshot.Commands[i].Errors = reset ?
+                m_commands[i].Errors.exchange(0, std::memory_order_relaxed) :
+                m_commands[i].Errors.load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < m_phases.size(); ++i)
+        {
+            snapshot.Phases[i] = m_phases[i].Read(reset);
+        }
+        return snapshot;
+    }
+
+    NativeHostCommandMetric NativeHostMetrics::CommandFromName(std::string_view command) noexcept
+    {
+        for (size_t i = 0; i < static_cast<size_t>(NativeHostCommandMetric::Other); ++i)
+        {
+            auto metric = static_cast<NativeHostCommandMetric>(i);
+            if (CommandName(metric) == command)
+            {
+                return metric;
+            }
+        }
+        return NativeHostCommandMetric::Other;
+    }
+
+    std::string_view NativeHostMetrics::CommandName(NativeHostCommandMetric command) noexcept
+    {
+        switch (command)
+        {
+        case NativeHostCommandMetric::StatusGet:
+            return "vault.status.get";
+        case NativeHostCommandMetric::LoginList:
+            return "vault.login.list";
+        case NativeHostCommandMetric::LoginGet:
+            return "vault.login.get";
+        case NativeHostCommandMetric::LoginSave:
+            return "vault.login.save";
+        case NativeHostCommandMetric::LoginUpdate:
+            return "vault.login.update";
+        case NativeHostCommandMetric::LoginDelete:
+            return "vault.login.delete";
+        case NativeHostCommandMetric::SyncResync:
+            return "vault.sync.resync";
+        case NativeHostCommandMetric::HostMetrics:
+            return "vault.host.metrics";
+        default:
+            return "other";
+        }
+    }
+
+    std::string_view NativeHostMetrics::PhaseName(NativeHostPhaseMetric phase) noexcept
+    {
+        switch (phase)
+        {
+        case NativeHostPhaseMetric::RequestParse:
+            return "request_parse";
+        case NativeHostPhaseMetric::RegistryRead:
+            return "registry_read";
+        case NativeHostPhaseMetric::Decrypt:
+            return "decrypt";
+        case NativeHostPhaseMetric::VaultJsonParse:
+            return "vault_json_parse";
+        case NativeHostPhaseMetric::Sync:
+            return "sync";
+        case NativeHostPhaseMetric::Resync:
+            return "resync";
+        default:
+            return "unknown";
+        }
+    }
+}
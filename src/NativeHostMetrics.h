@@ -0,0 +1,146 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace tsupasswd
+{
+    // HdrHistogram と同じ log-linear の bucket 配置 (2 の冪ごとに 16 分割、相対誤差 1/16 以下) で
+    // マイクロ秒を数える。Record は atomic の加算だけで lock を取らない。
+    class LatencyHistogram final
+    {
+    public:
+        static constexpr uint32_t kSubBucketBits = 4;
+        static constexpr uint32_t kSubBucketCount = 1u << kSubBucketBits;
+        static constexpr uint32_t kMaxExponent = 40;
+        static constexpr size_t kBucketCount = kSubBucketCount + (kMaxExponent - kSubBucketBits) * kSubBucketCount;
+
+        struct Snapshot
+        {
+            uint64_t Count{ 0 };
+            uint64_t SumMicros{ 0 };
+            uint64_t MaxMicros{ 0 };
+            std::vector<uint64_t> Buckets;
+
+            // nearest-rank。bucket 内の最大値を返す (max を超えない)。
+            uint64_t ValueAtPercentile(double percentile) const;
+        };
+
+        void Record(uint64_t micros) noexcept;
+        // 読み出しと同時に 0 に戻す。並行して記録された値は今回か次回のどちらかに必ず入る。
+        Snapshot Read(bool reset) noexcept;
+
+        static size_t BucketIndex(uint64_t micros) noexcept;
+        static uint64_t BucketUpperBound(size_t index) noexcept;
+
+    private:
+        std::array<std::atomic<uint64_t>, kBucketCount> m_buckets{};
+        std::atomic<uint64_t> m_sumMicros{ 0 };
+        std::atomic<uint64_t> m_maxMicros{ 0 };
+    };
+
+    enum class NativeHostCommandMetric : uint8_t
+    {
+        StatusGet = 0,
+        LoginList,
+        LoginGet,
+        LoginSave,
+        LoginUpdate,
+        LoginDelete,
+        SyncResync,
+        HostMetrics,
+        // 未知の command、request の parse 失敗。
+        Other,
+        Count,
+    };
+
+    enum class NativeHostPhaseMetric : uint8_t
+    {
+        // Native Messaging の request JSON。
+        RequestParse = 0,
+        // registry からの EncryptedVaultData 読み出し。
+        RegistryRead,
+        // DecryptVaultV3。
+        Decrypt,
+        // 復号後の vault JSON の deserialize。
+        VaultJsonParse,
+        // サーバーへの put_vault (リトライ込み)。
+        Sync,
+        // 手動再同期全体 (pull + merge + push)。
+        Resync,
+        Count,
+    };
+
+    struct NativeHostCommandMetricSnapshot
+    {
+        uint64_t Errors{ 0 };
+        LatencyHistogram::Snapshot Latency;
+    };
+
+    struct NativeHostMetricsSnapshot
+    {
+        int64_t UptimeMs{ 0 };
+        // 前回のリセット (なければ起動) からの経過時間。
+        int64_t WindowMs{ 0 };
+        std::array<NativeHostCommandMetricSnapshot, static_cast<size_t>(NativeHostCommandMetric::Count)> Commands{};
+        std::array<LatencyHistogram::Snapshot, static_cast<size_t>(NativeHostPhaseMetric::Count)> Phases{};
+    };
+
+    // プロセス全体で 1 つ。host core と vault/同期の各処理から直接記録する。
+    class NativeHostMetrics final
+    {
+    public:
+        static NativeHostMetrics& getInstance();
+
+        void RecordCommand(NativeHostCommandMetric command, uint64_t micros, bool ok) noexcept;
+        void RecordPhase(NativeHostPhaseMetric phase, uint64_t micros) noexcept;
+        NativeHostMetricsSnapshot Read(bool reset);
+
+        static NativeHostCommandMetric CommandFromName(std::string_view command) noexcept;
+        static std::string_view CommandName(NativeHostCommandMetric command) noexcept;
+        static std::string_view PhaseName(NativeHostPhaseMetric phase) noexcept;
+
+    private:
+        NativeHostMetrics();
+
+        struct CommandSlot
+        {
+            LatencyHistogram Latency;
+            std::atomic<uint64_t> Errors{ 0 };
+        };
+
+        std::array<CommandSlot, static_cast<size_t>(NativeHostCommandMetric::Count)> m_commands{};
+        std::array<LatencyHistogram, static_cast<size_t>(NativeHostPhaseMetric::Count)> m_phases{};
+        std::chrono::steady_clock::time_point m_started;
+        std::atomic<int64_t> m_windowStartMs{ 0 };
+    };
+
+    // スコープの所要時間を phase に記録する。
+    class ScopedNativeHostPhaseTimer final
+    {
+    public:
+        explicit ScopedNativeHostPhaseTimer(NativeHostPhaseMetric phase) noexcept :
+            m_phase(phase),
+            m_start(std::chrono::steady_clock::now())
+        {
+        }
+
+        ~ScopedNativeHostPhaseTimer()
+        {
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count();
+            NativeHostMetrics::getInstance().RecordPhase(m_phase, static_cast<uint64_t>(elapsed));
+        }
+
+        ScopedNativeHostPhaseTimer(ScopedNativeHostPhaseTimer const&) = delete;
+        ScopedNativeHostPhaseTimer& operator=(ScopedNativeHostPhaseTimer const&) = delete;
+
+    private:
+        NativeHostPhaseMetric m_phase;
+        std::chrono::steady_clock::time_point m_start;
+    };
+}
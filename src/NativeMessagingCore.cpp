@@ -0,0 +1,975 @@
+#include "NativeMessagingCore.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#include "RequestId.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace tsupasswd
+{
+    namespace
+    {
+        wchar_t const* ErrorCodeToString(NativeHostErrorCode code)
+        {
+            switch (code)
+            {
+            case NativeHostErrorCode::None:
+                return L"ok";
+            case NativeHostErrorCode::InvalidRequest:
+                return L"invalid_request";
+            case NativeHostErrorCode::NotFound:
+                return L"not_found";
+            case NativeHostErrorCode::RecoveryCodeMissing:
+                return L"recovery_code_missing";
+            case NativeHostErrorCode::VaultLocked:
+                return L"vault_locked";
+            case NativeHostErrorCode::SyncNotConfigured:
+                return L"sync_not_configured";
+            default:
+                return L"internal_error";
+            }
+        }
+
+        wchar_t const* ErrorCodeToMessage(NativeHostErrorCode code)
+        {
+            switch (code)
+            {
+            case NativeHostErrorCode::InvalidRequest:
+                return L"Invalid request payload";
+            case NativeHostErrorCode::NotFound:
+                return L"Requested item was not found";
+            case NativeHostErrorCode::RecoveryCodeMissing:
+                return L"Recovery code is not configured";
+            case NativeHostErrorCode::VaultLocked:
+                return L"Vault access was denied";
+            case NativeHostErrorCode::SyncNotConfigured:
+                return L"Sync is not configured or blocked by policy";
+            default:
+                return L"Internal error";
+            }
+        }
+
+        NativeHostResult InvalidRequest()
+        {
+            return NativeHostResult::Failure(NativeHostErrorCode::InvalidRequest, kNativeHostDetailInvalidArgument);
+        }
+
+        // 単位はすべてマイクロ秒。buckets は [上限値, 件数] の組 (件数 0 は省略)。
+        void WriteHistogramProperties(Utf8JsonWriter& writer, LatencyHistogram::Snapshot const& histogram, bool includeBuckets)
+        {
+            writer.Property("count", histogram.Count);
+            writer.Property("sumUs", histogram.SumMicros);
+            writer.Property("maxUs", histogram.MaxMicros);
+            writer.Property("p50Us", histogram.ValueAtPercentile(50.0));
+            writer.Property("p90Us", histogram.ValueAtPercentile(90.0));
+            writer.Property("p99Us", histogram.ValueAtPercentile(99.0));
+            writer.Property("p999Us", histogram.ValueAtPercentile(99.9));
+            if (!includeBuckets)
+            {
+                return;
+            }
+
+            writer.Key("buckets");
+            writer.BeginArray();
+            for (size_t i = 0; i < histogram.Buckets.size(); ++i)
+            {
+                if (histogram.Buckets[i] == 0)
+                {
+                    continue;
+                }
+                writer.BeginArray();
+                writer.UInt64(LatencyHistogram::BucketUpperBound(i));
+                writer.UInt64(histogram.Buckets[i]);
+                writer.EndArray();
+            }
+            writer.EndArray();
+        }
+
+        void WriteVaultItemJson(Utf8JsonWriter& writer, VaultItemV1 const& item, bool includeSecret)
+        {
+            writer.BeginObject();
+            writer.Property("itemId", item.ItemId);
+            writer.Property("title", item.Title);
+            writer.Property("username", item.Login.Username);
+            writer.Property("url", item.Login.Url);
+            writer.Property("notes", item.Notes);
+            writer.Property("createdAt", item.CreatedAt);
+            writer.Property("updatedAt", item.UpdatedAt);
+            writer.Property("deleted", item.Deleted);
+            if (includeSecret)
+            {
+                writer.Property("password", item.Login.Password);
+            }
+            writer.EndObject();
+        }
+
+        void WriteMergeStatsJson(Utf8JsonWriter& writer, VaultMergeStats const& stats)
+        {
+            writer.BeginObject();
+            writer.Property("addedFromServer", static_cast<uint64_t>(stats.AddedFromServer));
+            writer.Property("updatedFromServer", static_cast<uint64_t>(stats.UpdatedFromServer));
+            writer.Property("tombstonesApplied", static_cast<uint64_t>(stats.TombstonesApplied));
+            writer.Property("duplicatesCollapsed", static_cast<uint64_t>(stats.DuplicatesCollapsed));
+            writer.EndObject();
+        }
+
+        // vault.changed の差分検出用。平文を保持しないよう item の内容を 64bit (FNV-1a) にまとめる。
+        uint64_t FingerprintVaultItem(VaultItemV1 const& item)
+        {
+            uint64_t hash = 14695981039346656037ull;
+            auto mix = [&](std::wstring const& value)
+            {
+                for (wchar_t ch : value)
+                {
+                    hash ^= static_cast<uint64_t>(ch);
+                    hash *= 1099511628211ull;
+                }
+                // フィールド境界。"ab"+"c" と "a"+"bc" を区別する。
+                hash ^= 0xFFu;
+                hash *= 1099511628211ull;
+            };
+            mix(item.Title);
+            mix(item.Notes);
+            mix(item.UpdatedAt);
+            mix(item.DeletedAt);
+            mix(item.Login.Username);
+            mix(item.Login.Password);
+            mix(item.Login.Url);
+            mix(item.Login.TotpSecret);
+            hash ^= item.Deleted ? 1u : 0u;
+            hash *= 1099511628211ull;
+            return hash;
+        }
+
+        void BeginEventMessage(Utf8JsonWriter& writer, char const* eventName)
+        {
+            writer.Reset();
+            writer.BeginObject();
+            writer.Property("version", int64_t{ 1 });
+            writer.Key("event");
+            writer.StringUtf8(eventName);
+            writer.Key("payload");
+            writer.BeginObject();
+        }
+
+        void EndEventMessage(Utf8JsonWriter& writer)
+        {
+            writer.EndObject();
+            writer.EndObject();
+        }
+
+        // id を持たない request (parse 失敗を含む) には host 側で採番した id を返す。
+        void WriteErrorResponse(Utf8JsonWriter& writer, std::wstring const& id, NativeHostResult const& result)
+        {
+            writer.Reset();
+            writer.BeginObject();
+            writer.Property("id", id);
+            writer.Property("version", int64_t{ 1 });
+            writer.Property("ok", false);
+            writer.NullProperty("result");
+            writer.Key("error");
+            WriteNativeHostErrorObject(writer, result);
+            writer.EndObject();
+        }
+    }
+
+    void WriteNativeHostErrorObject(Utf8JsonWriter& writer, NativeHostResult const& result)
+    {
+        writer.BeginObject();
+        writer.Property("code", ErrorCodeToString(result.Code));
+        writer.Property("message", ErrorCodeToMessage(result.Code));
+        writer.Property("retryable", false);
+        writer.Key("details");
+        writer.BeginObject();
+        writer.Property("hresult", static_cast<int64_t>(result.Detail));
+        writer.EndObject();
+        writer.EndObject();
+    }
+
+    // vault.sync.resync を 1 本のバックグラウンドワーカーで実行する。
+    // 実行中または待機中のジョブがある間の再要求は新規ジョブを作らず、そのジョブに合流させる。
+    class NativeMessagingHostCore::ResyncJobExecutor
+    {
+    public:
+        explicit ResyncJobExecutor(NativeMessagingHostCore& owner) :
+            m_owner(owner)
+        {
+        }
+
+        ~ResyncJobExecutor()
+        {
+            Shutdown();
+        }
+
+        ResyncJobExecutor(ResyncJobExecutor const&) = delete;
+        ResyncJobExecutor& operator=(ResyncJobExecutor const&) = delete;
+
+        ResyncJobTicket Submit(std::wstring const& requestId)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_jobId.empty())
+            {
+                return ResyncJobTicket{ m_jobId, true, m_running };
+            }
+
+            m_jobId = BuildRequestId(L"resync_job_" + std::to_wstring(++m_jobSequence));
+            m_jobRequestId = requestId;
+            if (!m_worker.joinable())
+            {
+                m_stopping = false;
+                m_worker = std::thread([this]()
+                {
+                    WorkerLoop();
+                });
+            }
+            m_cv.notify_one();
+            return ResyncJobTicket{ m_jobId, false, false };
+        }
+
+        // transport が閉じられた後も実行中の resync は最後まで走らせ、completed を送ってから終了する。
+        void Shutdown()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_cv.notify_one();
+            if (m_worker.joinable())
+            {
+                m_worker.join();
+            }
+        }
+
+    private:
+        void WorkerLoop()
+        {
+            INativeHostVault& vault = m_owner.m_vault;
+            vault.OnWorkerThreadStarted();
+            while (true)
+            {
+                std::wstring jobId;
+                std::wstring requestId;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_cv.wait(lock, [this]()
+                    {
+                        return m_stopping || !m_jobId.empty();
+                    });
+                    if (m_jobId.empty())
+                    {
+                        break;
+                    }
+                    m_running = true;
+                    jobId = m_jobId;
+                    requestId = m_jobRequestId;
+                }
+
+                RunJob(jobId, requestId);
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_running = false;
+                m_jobId.clear();
+                m_jobRequestId.clear();
+            }
+            vault.OnWorkerThreadStopping();
+        }
+
+        void RunJob(std::wstring const& jobId, std::wstring const& requestId)
+        {
+            INativeHostVault& vault = m_owner.m_vault;
+            PushProgress(jobId, requestId, L"started");
+            VaultMergeStats stats{};
+            NativeHostResult result{};
+            try
+            {
+                result = vault.Resync(
+                    requestId,
+                    stats,
+                    [&](std::wstring const& stage)
+                    {
+                        PushProgress(jobId, requestId, stage);
+                    });
+            }
+            catch (...)
+            {
+                result = NativeHostResult::Failure(NativeHostErrorCode::Internal, kNativeHostDetailFailure);
+            }
+
+            vault.AppendDiagnosticLog(
+                std::wstring(result.Ok() ? L"SUCCESS: sync result=success" : L"WARNING: sync result=failed") +
+                L" operation=native_host_resync_job job_id=" + jobId +
+                L" hr=" + std::to_wstring(result.Detail) +
+                L" added_from_server=" + std::to_wstring(stats.AddedFromServer) +
+                L" updated_from_server=" + std::to_wstring(stats.UpdatedFromServer) +
+                L" tombstones_applied=" + std::to_wstring(stats.TombstonesApplied) +
+                L" duplicates_collapsed=" + std::to_wstring(stats.DuplicatesCollapsed) +
+                L" request_id=" + requestId + L"\n");
+
+            BeginEventMessage(m_eventWriter, "vault.sync.completed");
+            m_eventWriter.Property("jobId", jobId);
+            m_eventWriter.Property("requestId", requestId);
+            m_eventWriter.Property("ok", result.Ok());
+            m_eventWriter.Property("synced", result.Ok());
+            m_eventWriter.Key("merge");
+            WriteMergeStatsJson(m_eventWriter, stats);
+            m_eventWriter.Key("error");
+            if (result.Ok())
+            {
+                m_eventWriter.Null();
+            }
+            else
+            {
+                WriteNativeHostErrorObject(m_eventWriter, result);
+            }
+            EndEventMessage(m_eventWriter);
+            (void)m_owner.WriteFrame(m_eventWriter.View());
+        }
+
+        void PushProgress(std::wstring const& jobId, std::wstring const& requestId, std::wstring const& stage)
+        {
+            BeginEventMessage(m_eventWriter, "vault.sync.progress");
+            m_eventWriter.Property("jobId", jobId);
+            m_eventWriter.Property("requestId", requestId);
+            m_eventWriter.Property("stage", stage);
+            EndEventMessage(m_eventWriter);
+            (void)m_owner.WriteFrame(m_eventWriter.View());
+        }
+
+        NativeMessagingHostCore& m_owner;
+        // ワーカースレッド専用。
+        Utf8JsonWriter m_eventWriter;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::thread m_worker;
+        std::wstring m_jobId;
+        std::wstring m_jobRequestId;
+        uint64_t m_jobSequence{ 0 };
+        bool m_running{ false };
+        bool m_stopping{ false };
+    };
+
+    // vault の変更通知を受けて直前のスナップショットと比較し、vault.changed を送る。
+    // 拡張側は changedItemIds/deletedItemIds の item だけを取り直せばよく、list をポーリングしなくて済む。
+    class NativeMessagingHostCore::VaultChangeNotifier
+    {
+    public:
+        explicit VaultChangeNotifier(NativeMessagingHostCore& owner) :
+            m_owner(owner)
+        {
+        }
+
+        ~VaultChangeNotifier()
+        {
+            Stop();
+        }
+
+        VaultChangeNotifier(VaultChangeNotifier const&) = delete;
+        VaultChangeNotifier& operator=(VaultChangeNotifier const&) = delete;
+
+        void Start()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_worker.joinable())
+            {
+                return;
+            }
+            m_stopping = false;
+            m_worker = std::thread([this]()
+            {
+                WorkerLoop();
+            });
+        }
+
+        void Stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_cv.notify_one();
+            if (m_worker.joinable())
+            {
+                m_worker.join();
+            }
+        }
+
+    private:
+        void WorkerLoop()
+        {
+            INativeHostVault& vault = m_owner.m_vault;
+            vault.OnWorkerThreadStarted();
+
+            // 監視を先に始めてから基準を読む。間に入った変更は dirty として次の比較で拾う。
+            uint64_t watchId = vault.StartChangeWatch([this]()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_dirty = true;
+                }
+                m_cv.notify_one();
+            });
+            if (watchId != 0)
+            {
+                VaultDocumentV1 doc{};
+                if (vault.LoadVaultDocument(BuildRequestId(L"native_host_change_baseline"), doc).Ok())
+                {
+                    ReplaceBaseline(doc);
+                }
+
+                while (true)
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_cv.wait(lock, [this]()
+                    {
+                        return m_stopping || m_dirty;
+                    });
+                    if (m_stopping)
+                    {
+                        break;
+                    }
+                    // 1 回の保存で registry の値が複数書かれるため、少し待ってからまとめて比較する。
+                    if (m_cv.wait_for(lock, m_owner.m_options.ChangeDebounce, [this]()
+                    {
+                        return m_stopping;
+                    }))
+                    {
+                        break;
+                    }
+                    m_dirty = false;
+                    lock.unlock();
+
+                    PublishChanges();
+                }
+                vault.StopChangeWatch(watchId);
+            }
+
+            vault.OnWorkerThreadStopping();
+        }
+
+        void ReplaceBaseline(VaultDocumentV1 const& doc)
+        {
+            m_baseline.clear();
+            for (auto const& item : doc.Items)
+            {
+                m_baseline[item.ItemId] = FingerprintVaultItem(item);
+            }
+            m_baselineRevision = doc.Revision;
+            m_haveBaseline = true;
+        }
+
+        void PublishChanges()
+        {
+            INativeHostVault& vault = m_owner.m_vault;
+            std::wstring requestId = BuildRequestId(L"native_host_vault_changed");
+            VaultDocumentV1 doc{};
+            if (!vault.LoadVaultDocument(requestId, doc).Ok())
+            {
+                // ロック中などで読めない間は基準を保ったまま、次の通知で比較し直す。
+                return;
+            }
+
+            m_changed.clear();
+            m_deleted.clear();
+            std::unordered_map<std::wstring, uint64_t> remaining;
+            remaining.swap(m_baseline);
+            for (auto const& item : doc.Items)
+            {
+                uint64_t fingerprint = FingerprintVaultItem(item);
+                auto it = remaining.find(item.ItemId);
+                bool changed = !m_haveBaseline || it == remaining.end() || it->second != fingerprint;
+                if (it != remaining.end())
+                {
+                    remaining.erase(it);
+                }
+                if (changed)
+                {
+                    (item.Deleted ? m_deleted : m_changed).push_back(item.ItemId);
+                }
+            }
+            // vault から消えた item (ローカル vault の初期化など) も削除として通知する。
+            for (auto const& [itemId, fingerprint] : remaining)
+            {
+                m_deleted.push_back(itemId);
+            }
+
+            bool revisionChanged = m_haveBaseline && doc.Revision != m_baselineRevision;
+            ReplaceBaseline(doc);
+            if (m_changed.empty() && m_deleted.empty() && !revisionChanged)
+            {
+                return;
+            }
+
+            BeginEventMessage(m_eventWriter, "vault.changed");
+            m_eventWriter.Property("revision", doc.Revision);
+            m_eventWriter.Key("changedItemIds");
+            m_eventWriter.BeginArray();
+            for (auto const& itemId : m_changed)
+            {
+                m_eventWriter.String(itemId);
+            }
+            m_eventWriter.EndArray();
+            m_eventWriter.Key("deletedItemIds");
+            m_eventWriter.BeginArray();
+            for (auto const& itemId : m_deleted)
+            {
+                m_eventWriter.String(itemId);
+            }
+            m_eventWriter.EndArray();
+            EndEventMessage(m_eventWriter);
+            (void)m_owner.WriteFrame(m_eventWriter.View());
+
+            vault.AppendDiagnosticLog(
+                L"INFO: sync state=changed operation=native_host_vault_changed revision=" + std::to_wstring(doc.Revision) +
+                L" changed=" + std::to_wstring(m_changed.size()) +
+                L" deleted=" + std::to_wstring(m_deleted.size()) +
+                L" request_id=" + requestId + L"\n");
+        }
+
+        NativeMessagingHostCore& m_owner;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::thread m_worker;
+        bool m_stopping{ false };
+        bool m_dirty{ false };
+
+        // 以下はワーカースレッド専用。
+        Utf8JsonWriter m_eventWriter;
+        std::unordered_map<std::wstring, uint64_t> m_baseline;
+        int64_t m_baselineRevision{ 0 };
+        bool m_haveBaseline{ false };
+        std::vector<std::wstring> m_changed;
+        std::vector<std::wstring> m_deleted;
+    };
+
+    NativeMessagingHostCore::NativeMessagingHostCore(INativeHostVault& vault, INativeMessageTransport& transport, NativeMessagingHostOptions options) :
+        m_vault(vault),
+        m_transport(transport),
+        m_options(std::move(options))
+    {
+        m_resyncExecutor = std::make_unique<ResyncJobExecutor>(*this);
+        m_changeNotifier = std::make_unique<VaultChangeNotifier>(*this);
+        m_receive.reserve(m_options.InitialBufferBytes);
+        m_response.Reserve(m_options.InitialBufferBytes);
+
+        if (!m_options.SessionRecordPath.empty())
+        {
+            m_recordStream.open(std::filesystem::path(m_options.SessionRecordPath), std::ios::binary | std::ios::app);
+            m_recordStart = std::chrono::steady_clock::now();
+        }
+    }
+
+    NativeMessagingHostCore::~NativeMessagingHostCore()
+    {
+        // ワーカーが m_transport / m_vault を使い終わるまで待つ。
+        m_changeNotifier.reset();
+        m_resyncExecutor.reset();
+    }
+
+    bool NativeMessagingHostCore::WriteFrame(std::string_view message)
+    {
+        // 応答は Run のスレッド、イベントは resync ワーカーから書き込まれるため直列化する。
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        return WriteNativeMessageFrame(m_transport, message);
+    }
+
+    int NativeMessagingHostCore::Run()
+    {
+        int exitCode = NativeHostExitOk;
+        m_changeNotifier->Start();
+        while (true)
+        {
+            NativeFrameReadResult readResult = ReadNativeMessageFrame(m_transport, m_receive, m_options.MaxMessageBytes);
+            if (readResult == NativeFrameReadResult::EndOfStream)
+            {
+                break;
+            }
+            if (readResult == NativeFrameReadResult::InvalidLength)
+            {
+                exitCode = NativeHostExitInvalidLength;
+                break;
+            }
+            if (readResult == NativeFrameReadResult::Truncated)
+            {
+                exitCode = NativeHostExitTruncated;
+                break;
+            }
+
+            ProcessReceivedMessage();
+            if (!WriteFrame(m_response.View()))
+            {
+                exitCode = NativeHostExitWriteFailed;
+                break;
+            }
+        }
+
+        m_changeNotifier->Stop();
+        m_resyncExecutor->Shutdown();
+        return exitCode;
+    }
+
+    std::string_view NativeMessagingHostCore::HandleMessage(std::string_view requestUtf8)
+    {
+        m_receive.resize(requestUtf8.size());
+        memcpy(m_receive.data(), requestUtf8.data(), requestUtf8.size());
+        ProcessReceivedMessage();
+        return m_response.View();
+    }
+
+    void NativeMessagingHostCore::ProcessReceivedMessage()
+    {
+        auto started = std::chrono::steady_clock::now();
+        m_commandMetric = NativeHostCommandMetric::Other;
+        bool ok = BuildResponse();
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+        NativeHostMetrics::getInstance().RecordCommand(m_commandMetric, static_cast<uint64_t>(elapsed), ok);
+    }
+
+    bool NativeMessagingHostCore::BuildResponse()
+    {
+        try
+        {
+            bool parsed = false;
+            {
+                ScopedNativeHostPhaseTimer parseTimer(NativeHostPhaseMetric::RequestParse);
+                parsed = m_reader.Parse(m_receive);
+            }
+            if (!parsed)
+            {
+                WriteErrorResponse(m_response, BuildRequestId(L"native_host_parse"), InvalidRequest());
+                return false;
+            }
+
+            if (m_recordStream.is_open())
+            {
+                RecordRequest();
+            }
+
+            size_t idIndex = m_reader.FindMember(Utf8JsonReader::Root, "id");
+            bool hasId = idIndex != Utf8JsonReader::npos &&
+                m_reader.Token(idIndex).Type == Utf8JsonTokenType::String &&
+                m_reader.DecodeString(idIndex, m_requestId);
+            if (!hasId)
+            {
+                m_requestId = BuildRequestId(L"native_host");
+            }
+
+            m_response.Reset();
+            m_response.BeginObject();
+            m_response.Key("id");
+            if (hasId)
+            {
+                m_response.RawEscapedString(m_reader.RawSpan(idIndex));
+            }
+            else
+            {
+                m_response.String(m_requestId);
+            }
+            m_response.Property("version", int64_t{ 1 });
+            Utf8JsonWriter::Mark resultMark = m_response.GetMark();
+            m_response.Property("ok", true);
+            m_response.Key("result");
+
+            NativeHostResult result = InvalidRequest();
+            if (m_reader.TryGetStringUtf8(Utf8JsonReader::Root, "command", m_command) && !m_command.empty())
+            {
+                size_t payload = Utf8JsonReader::npos;
+                (void)m_reader.TryGetObject(Utf8JsonReader::Root, "payload", payload);
+                result = Dispatch(m_command, payload);
+            }
+
+            if (result.Ok())
+            {
+                m_response.NullProperty("error");
+            }
+            else
+            {
+                // handler が書きかけた result を捨てて error envelope にする。
+                m_response.Rewind(resultMark);
+                m_response.Property("ok", false);
+                m_response.NullProperty("result");
+                m_response.Key("error");
+                WriteNativeHostErrorObject(m_response, result);
+            }
+            m_response.EndObject();
+            return result.Ok();
+        }
+        catch (...)
+        {
+            WriteErrorResponse(m_response, BuildRequestId(L"native_host_parse"), InvalidRequest());
+            return false;
+        }
+    }
+
+    NativeHostResult NativeMessagingHostCore::Dispatch(std::string_view command, size_t payload)
+    {
+        m_commandMetric = NativeHostMetrics::CommandFromName(command);
+        switch (m_commandMetric)
+        {
+        case NativeHostCommandMetric::StatusGet:
+            return HandleStatus();
+        case NativeHostCommandMetric::LoginList:
+            return HandleList(payload);
+        case NativeHostCommandMetric::LoginGet:
+            return HandleGet(payload);
+        case NativeHostCommandMetric::LoginSave:
+            return HandleSave(payload);
+        case NativeHostCommandMetric::LoginUpdate:
+            return HandleUpdate(payload);
+        case NativeHostCommandMetric::LoginDelete:
+            return HandleDelete(payload);
+        case NativeHostCommandMetric::SyncResync:
+            return HandleResync();
+        case NativeHostCommandMetric::HostMetrics:
+            return HandleMetrics(payload);
+        default:
+            return NativeHostResult::Failure(NativeHostErrorCode::Internal, kNativeHostDetailNotSupported);
+        }
+    }
+
+    NativeHostResult NativeMessagingHostCore::HandleStatus()
+    {
+        NativeHostVaultStatus status{};
+        NativeHostResult result = m_vault.GetStatus(status);
+        if (!result.Ok())
+        {
+            return result;
+        }
+
+        m_response.BeginObject();
+        m_response.Property("vaultLocked", status.VaultLocked);
+        m_response.Property("silentOperation", status.SilentOperation);
+        m_response.Property("recoveryCodeAvailable", status.RecoveryCodeAvailable);
+        m_response.Property("syncConfigured", status.SyncConfigured);
+        m_response.Property("uiRequired", status.VaultLocked);
+        m_response.EndObject();
+        return result;
+    }
+
+    NativeHostResult NativeMessagingHostCore::HandleList(size_t payload)
+    {
+        bool includeDeleted = false;
+        (void)m_reader.TryGetBool(payload, "includeDeleted", includeDeleted);
+
+        VaultDocumentV1 vaultDoc{};
+        NativeHostResult result = m_vault.LoadVaultDocument(m_requestId, vaultDoc);
+        if (!result.Ok())
+        {
+            return result;
+        }
+
+        m_response.BeginObject();
+        m_response.Key("items");
+        m_response.BeginArray();
+        for (auto const& item : vaultDoc.Items)
+        {
+            if (item.ItemType != VaultItemType::Login)
+            {
+                continue;
+            }
+            if (!includeDeleted && item.Deleted)
+            {
+                continue;
+            }
+            WriteVaultItemJson(m_response, item, false);
+        }
+        m_response.EndArray();
+        m_response.EndObject();
+        return result;
+    }
+
+    NativeHostResult NativeMessagingHostCore::HandleGet(size_t payload)
+    {
+        std::wstring itemId;
+        if (!m_reader.TryGetString(payload, "itemId", itemId) || itemId.empty())
+        {
+            return InvalidRequest();
+        }
+        bool includeSecret = false;
+        (void)m_reader.TryGetBool(payload, "includeSecret", includeSecret);
+
+        VaultItemV1 item{};
+        NativeHostResult result = m_vault.GetLoginItem(itemId, m_requestId, item);
+        if (!result.Ok())
+        {
+            return result;
+        }
+
+        m_response.BeginObject();
+        m_response.Key("item");
+        WriteVaultItemJson(m_response, item, includeSecret);
+        m_response.EndObject();
+        return result;
+    }
+
+    bool NativeMessagingHostCore::ReadLoginFields(size_t payload, NativeHostLoginFields& outFields) const
+    {
+        if (!m_reader.TryGetString(payload, "title", outFields.Title) ||
+            !m_reader.TryGetString(payload, "username", outFields.Username) ||
+            !m_reader.TryGetString(payload, "password", outFields.Password))
+        {
+            return false;
+        }
+        (void)m_reader.TryGetString(payload, "url", outFields.Url);
+        (void)m_reader.TryGetString(payload, "notes", outFields.Notes);
+        return true;
+    }
+
+    // save/update/delete はローカルに書いた時点で応答する。resync の同期は予約しただけなので "sync": "queued" と返し、
+    // 送れたかは sync-diagnostic.log の operation=background_sync で分かる。
+    NativeHostResult NativeMessagingHostCore::HandleSave(size_t payload)
+    {
+        NativeHostLoginFields fields{};
+        bool resync = true;
+        if (!ReadLoginFields(payload, fields))
+        {
+            return InvalidRequest();
+        }
+        (void)m_reader.TryGetBool(payload, "resync", resync);
+
+        std::wstring savedItemId;
+        NativeHostResult result = m_vault.SaveLoginItem(fields, resync, m_requestId, savedItemId);
+        if (!result.Ok())
+        {
+            return result;
+        }
+
+        m_response.BeginObject();
+        m_response.Property("itemId", savedItemId);
+        m_response.Property("saved", true);
+        m_response.Property("sync", resync ? L"queued" : L"none");
+        m_response.EndObject();
+        return result;
+    }
+
+    NativeHostResult NativeMessagingHostCore::HandleUpdate(size_t payload)
+    {
+        std::wstring itemId;
+        NativeHostLoginFields fields{};
+        bool resync = true;
+        if (!m_reader.TryGetString(payload, "itemId", itemId) || itemId.empty() || !ReadLoginFields(payload, fields))
+        {
+            return InvalidRequest();
+        }
+        (void)m_reader.TryGetBool(payload, "resync", resync);
+
+        NativeHostResult result = m_vault.UpdateLoginItem(itemId, fields, resync, m_requestId);
+        if (!result.Ok())
+        {
+            return result;
+        }
+
+        m_response.BeginObject();
+        m_response.Property("itemId", itemId);
+        m_response.Property("updated", true);
+        m_response.Property("sync", resync ? L"queued" : L"none");
+        m_response.EndObject();
+        return result;
+    }
+
+    NativeHostResult NativeMessagingHostCore::HandleDelete(size_t payload)
+    {
+        std::wstring itemId;
+        bool resync = true;
+        if (!m_reader.TryGetString(payload, "itemId", itemId) || itemId.empty())
+        {
+            return InvalidRequest();
+        }
+        (void)m_reader.TryGetBool(payload, "resync", resync);
+
+        NativeHostResult result = m_vault.DeleteLoginItem(itemId, resync, m_requestId);
+        if (!result.Ok())
+        {
+            return result;
+        }
+
+        m_response.BeginObject();
+        m_response.Property("itemId", itemId);
+        m_response.Property("deleted", true);
+        m_response.Property("sync", resync ? L"queued" : L"none");
+        m_response.EndObject();
+        return result;
+    }
+
+    NativeHostResult NativeMessagingHostCore::HandleResync()
+    {
+        ResyncJobTicket ticket = m_resyncExecutor->Submit(m_requestId);
+
+        m_response.BeginObject();
+        m_response.Property("jobId", ticket.JobId);
+        m_response.Property("accepted", true);
+        m_response.Property("coalesced", ticket.Coalesced);
+        m_response.Property("state", ticket.Running ? L"running" : L"queued");
+        m_response.EndObject();
+        return NativeHostResult::Success();
+    }
+
+    NativeHostResult NativeMessagingHostCore::HandleMetrics(size_t payload)
+    {
+        bool reset = false;
+        bool includeBuckets = false;
+        (void)m_reader.TryGetBool(payload, "reset", reset);
+        (void)m_reader.TryGetBool(payload, "includeBuckets", includeBuckets);
+
+        NativeHostMetricsSnapshot snapshot = NativeHostMetrics::getInstance().Read(reset);
+
+        m_response.BeginObject();
+        m_response.Property("uptimeMs", snapshot.UptimeMs);
+        m_response.Property("windowMs", snapshot.WindowMs);
+        m_response.Property("reset", reset);
+        m_response.Key("commands");
+        m_response.BeginObject();
+        for (size_t i = 0; i < snapshot.Commands.size(); ++i)
+        {
+            auto const& command = snapshot.Commands[i];
+            m_response.Key(NativeHostMetrics::CommandName(static_cast<NativeHostCommandMetric>(i)));
+            m_response.BeginObject();
+            m_response.Property("errors", command.Errors);
+            WriteHistogramProperties(m_response, command.Latency, includeBuckets);
+            m_response.EndObject();
+        }
+        m_response.EndObject();
+        m_response.Key("phases");
+        m_response.BeginObject();
+        for (size_t i = 0; i < snapshot.Phases.size(); ++i)
+        {
+            m_response.Key(NativeHostMetrics::PhaseName(static_cast<NativeHostPhaseMetric>(i)));
+            m_response.BeginObject();
+            WriteHistogramProperties(m_response, snapshot.Phases[i], includeBuckets);
+            m_response.EndObject();
+        }
+        m_response.EndObject();
+        m_response.EndObject();
+        return NativeHostResult::Success();
+    }
+
+    void NativeMessagingHostCore::RecordRequest()
+    {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_recordStart).count();
+        m_recordWriter.Reset();
+        m_recordWriter.BeginObject();
+        m_recordWriter.Property("atMs", static_cast<int64_t>(elapsed));
+        m_recordWriter.Key("request");
+        CopyJsonValue(m_reader, Utf8JsonReader::Root, m_recordWriter, "password");
+        m_recordWriter.EndObject();
+
+        std::string_view line = m_recordWriter.View();
+        m_recordStream.write(line.data(), static_cast<std::streamsize>(line.size()));
+        m_recordStream.put('\n');
+        m_recordStream.flush();
+    }
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "NativeHostMetrics.h"
+#include "NativeMessagingJson.h"
+#include "NativeMessagingTransport.h"
+#include "VaultModel.h"
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace tsupasswd
+{
+    // error.code に対応する。HRESULT に依存しないよう独自に持つ。
+    enum class NativeHostErrorCode : uint8_t
+    {
+        None = 0,
+        InvalidRequest,
+        NotFound,
+        RecoveryCodeMissing,
+        VaultLocked,
+        SyncNotConfigured,
+        Internal,
+    };
+
+    // error.details.hresult に載せる値。プロトコル互換のため Windows の HRESULT 値をそのまま使う。
+    constexpr int32_t kNativeHostDetailInvalidArgument = static_cast<int32_t>(0x80070057);
+    constexpr int32_t kNativeHostDetailNotSupported = static_cast<int32_t>(0x80070032);
+    constexpr int32_t kNativeHostDetailFailure = static_cast<int32_t>(0x80004005);
+
+    struct NativeHostResult
+    {
+        NativeHostErrorCode Code{ NativeHostErrorCode::None };
+        int32_t Detail{ 0 };
+
+        bool Ok() const { return Code == NativeHostErrorCode::None; }
+
+        static NativeHostResult Success() { return {}; }
+        static NativeHostResult Failure(NativeHostErrorCode code, int32_t detail) { return NativeHostResult{ code, detail }; }
+    };
+
+    struct NativeHostVaultStatus
+    {
+        bool VaultLocked{ false };
+        bool SilentOperation{ false };
+        bool RecoveryCodeAvailable{ false };
+        bool SyncConfigured{ false };
+    };
+
+    struct NativeHostLoginFields
+    {
+        std::wstring Title;
+        std::wstring Username;
+        std::wstring Password;
+        std::wstring Url;
+        std::wstring Notes;
+    };
+
+    // Native Messaging host から見た vault。本番は PluginCredentialManager/PluginRegistrationManager への
+    // アダプタ、負荷試験ではインメモリのスタブを使う。
+    class INativeHostVault
+    {
+    public:
+        virtual ~INativeHostVault() = default;
+
+        virtual NativeHostResult GetStatus(NativeHostVaultStatus& outStatus) = 0;
+        virtual NativeHostResult LoadVaultDocument(std::wstring const& requestId, VaultDocumentV1& outDoc) = 0;
+        virtual NativeHostResult GetLoginItem(std::wstring const& itemId, std::wstring const& requestId, VaultItemV1& outItem) = 0;
+        virtual NativeHostResult SaveLoginItem(NativeHostLoginFields const& fields, bool resync, std::wstring const& requestId, std::wstring& outItemId) = 0;
+        virtual NativeHostResult UpdateLoginItem(std::wstring const& itemId, NativeHostLoginFields const& fields, bool resync, std::wstring const& requestId) = 0;
+        virtual NativeHostResult DeleteLoginItem(std::wstring const& itemId, bool resync, std::wstring const& requestId) = 0;
+        // progress には段階名が順に渡される。resync ワーカースレッドから呼ばれる。
+        virtual NativeHostResult Resync(
+            std::wstring const& requestId,
+            VaultMergeStats& outStats,
+            std::function<void(std::wstring const&)> const& progress) = 0;
+
+        // resync ワーカースレッドの開始/終了時に呼ばれる (COM apartment の初期化など)。
+        virtual void OnWorkerThreadStarted() {}
+        virtual void OnWorkerThreadStopping() {}
+        virtual void AppendDiagnosticLog(std::wstring const&) {}
+
+        // vault の変更監視。onChanged は任意のスレッドから呼ばれ、1 回の変更で複数回呼ばれてもよい。
+        // 戻り値は StopChangeWatch に渡す登録番号。監視できない vault は 0 を返す (vault.changed は送られない)。
+        virtual uint64_t StartChangeWatch(std::function<void()> onChanged)
+        {
+            (void)onChanged;
+            return 0;
+        }
+        virtual void StopChangeWatch(uint64_t watchId) { (void)watchId; }
+    };
+
+    struct NativeMessagingHostOptions
+    {
+        uint32_t MaxMessageBytes{ 16u * 1024u * 1024u };
+        size_t InitialBufferBytes{ 64u * 1024u };
+        // 空でなければ受信した request を JSONL で追記する (password は伏せる)。負荷試験のリプレイ入力になる。
+        std::wstring SessionRecordPath;
+        // 変更通知を受けてから vault を読み直すまでの待ち時間。連続した書き込みを 1 回の vault.changed にまとめる。
+        std::chrono::milliseconds ChangeDebounce{ 50 };
+    };
+
+    // Run の終了コード。RunNativeMessagingHost の戻り値としてそのまま使う。
+    enum NativeMessagingHostExitCode : int
+    {
+        NativeHostExitOk = 0,
+        NativeHostExitNoTransport = 1,
+        NativeHostExitInvalidLength = 2,
+        NativeHostExitTruncated = 3,
+        NativeHostExitWriteFailed = 4,
+    };
+
+    // フレーミングとコマンド振り分けを OS の transport から切り離したプロトコルエンジン。
+    class NativeMessagingHostCore final
+    {
+    public:
+        NativeMessagingHostCore(INativeHostVault& vault, INativeMessageTransport& transport, NativeMessagingHostOptions options = {});
+        ~NativeMessagingHostCore();
+
+        NativeMessagingHostCore(NativeMessagingHostCore const&) = delete;
+        NativeMessagingHostCore& operator=(NativeMessagingHostCore const&) = delete;
+
+        // transport が EOF になるまで request を処理する。実行中の resync は完了を待ってから戻る。
+        int Run();
+
+        // 1 メッセージを処理して response を返す。戻り値は次の呼び出しまで有効。
+        std::string_view HandleMessage(std::string_view requestUtf8);
+
+    private:
+        class ResyncJobExecutor;
+        class VaultChangeNotifier;
+        struct ResyncJobTicket
+        {
+            std::wstring JobId{};
+            bool Coalesced{ false };
+            bool Running{ false };
+        };
+
+        void ProcessReceivedMessage();
+        bool BuildResponse();
+        NativeHostResult Dispatch(std::string_view command, size_t payload);
+        NativeHostResult HandleStatus();
+        NativeHostResult HandleList(size_t payload);
+        NativeHostResult HandleGet(size_t payload);
+        NativeHostResult HandleSave(size_t payload);
+        NativeHostResult HandleUpdate(size_t payload);
+        NativeHostResult HandleDelete(size_t payload);
+        NativeHostResult HandleResync();
+        NativeHostResult HandleMetrics(size_t payload);
+        bool ReadLoginFields(size_t payload, NativeHostLoginFields& outFields) const;
+        void RecordRequest();
+        bool WriteFrame(std::string_view message);
+
+        INativeHostVault& m_vault;
+        INativeMessageTransport& m_transport;
+        NativeMessagingHostOptions m_options;
+        std::mutex m_writeMutex;
+        std::unique_ptr<ResyncJobExecutor> m_resyncExecutor;
+        std::unique_ptr<VaultChangeNotifier> m_changeNotifier;
+
+        // メッセージ間で使い回すバッファ一式。定常状態では容量が足りているため再確保されない。
+        std::string m_receive;
+        Utf8JsonReader m_reader;
+        Utf8JsonWriter m_response;
+        std::string m_command;
+        NativeHostCommandMetric m_commandMetric{ NativeHostCommandMetric::Other };
+        std::wstring m_requestId;
+
+        std::ofstream m_recordStream;
+        Utf8JsonWriter m_recordWriter;
+        std::chrono::steady_clock::time_point m_recordStart{};
+    };
+
+    void WriteNativeHostErrorObject(Utf8JsonWriter& writer, NativeHostResult const& result);
+}
@@ -3,17 +3,26 @@
 
 #include "PluginManagement/PluginCredentialManager.h"
 #include "PluginManagement/PluginRegistrationManager.h"
+#include "src/NativeMessagingCore.h"
+#include "src/NativeMessagingJson.h"
+#include "src/NativeMessagingTransport.h"
 #include "src/RequestId.h"
 #include "src/VaultCrypto.h"
 #include "src/VaultSerialization.h"
 #include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 #include <winrt/Windows.Data.Json.h>
 
 namespace
 {
-    using namespace winrt::Windows::Data::Json;
     using winrt::PasskeyManager::implementation::PluginCredentialManager;
     using winrt::PasskeyManager::implementation::PluginRegistrationManager;
 
@@ -21,17 +30,11 @@ namespace
     constexpr wchar_t kSyncBaseUrlEnv[] = L"TSUPASSWD_SYNC_BASE_URL";
     constexpr wchar_t kSyncUserIdEnv[] = L"TSUPASSWD_SYNC_USER_ID";
     constexpr wchar_t kNativeHostFlag[] = L"--native-messaging-host";
-
-    bool IsPipeHandle(HANDLE handle)
-    {
-        if (handle == nullptr || handle == INVALID_HANDLE_VALUE)
-        {
-            return false;
-        }
-
-        DWORD type = GetFileType(handle);
-        return type == FILE_TYPE_PIPE;
-    }
+    constexpr wchar_t kNativeHostCodecBenchmarkEnv[] = L"TSUPASSWD_NATIVE_HOST_CODEC_BENCHMARK";
+    constexpr wchar_t kNativeHostRecordSessionEnv[] = L"TSUPASSWD_NATIVE_HOST_RECORD_SESSION";
+    constexpr uint32_t kNativeHostCodecBenchmarkIterations = 20000;
+    // 終了前に予約済みの同期を待つ上限。
+    constexpr DWORD kNativeHostSyncFlushTimeoutMs = 15000;
 
     std::wstring GetEnvironmentVariableValue(wchar_t const* name)
     {
@@ -122,110 +125,39 @@ namespace
         CloseHandle(handle);
     }
 
-    bool TryGetString(JsonObject const& obj, wchar_t const* key, std::wstring& out)
+    bool IsTruthySetting(std::wstring value)
     {
-        if (!obj.HasKey(key))
+        std::transform(value.begin(), value.end(), value.begin(), [](wchar_t ch)
         {
-            return false;
-        }
-        auto value = obj.GetNamedValue(key, nullptr);
-        if (!value || value.ValueType() != JsonValueType::String)
-        {
-            return false;
-        }
-        out = value.GetString().c_str();
-        return true;
+            return static_cast<wchar_t>(towlower(ch));
+        });
+        return value == L"1" || value == L"true" || value == L"yes" || value == L"on";
     }
 
-    bool TryGetBool(JsonObject const& obj, wchar_t const* key, bool& out)
+    tsupasswd::NativeHostResult FromHResult(HRESULT hr)
     {
-        if (!obj.HasKey(key))
-        {
-            return false;
-        }
-        auto value = obj.GetNamedValue(key, nullptr);
-        if (!value || value.ValueType() != JsonValueType::Boolean)
-        {
-            return false;
-        }
-        out = value.GetBoolean();
-        return true;
-    }
+        using tsupasswd::NativeHostErrorCode;
+        using tsupasswd::NativeHostResult;
 
-    std::wstring HResultToErrorCode(HRESULT hr)
-    {
         switch (hr)
         {
         case S_OK:
-            return L"ok";
+            return NativeHostResult::Success();
         case E_INVALIDARG:
-            return L"invalid_request";
+            return NativeHostResult::Failure(NativeHostErrorCode::InvalidRequest, hr);
         case HRESULT_FROM_WIN32(ERROR_NOT_FOUND):
-            return L"not_found";
+            return NativeHostResult::Failure(NativeHostErrorCode::NotFound, hr);
         case HRESULT_FROM_WIN32(ERROR_NOT_READY):
-            return L"recovery_code_missing";
+            return NativeHostResult::Failure(NativeHostErrorCode::RecoveryCodeMissing, hr);
         case HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED):
-            return L"vault_locked";
+            return NativeHostResult::Failure(NativeHostErrorCode::VaultLocked, hr);
         case HRESULT_FROM_WIN32(ERROR_ACCESS_DISABLED_BY_POLICY):
-            return L"sync_not_configured";
+            return NativeHostResult::Failure(NativeHostErrorCode::SyncNotConfigured, hr);
         default:
-            return L"internal_error";
+            return SUCCEEDED(hr) ? NativeHostResult::Success() : NativeHostResult::Failure(NativeHostErrorCode::Internal, hr);
         }
     }
 
-    std::wstring HResultToMessage(HRESULT hr)
-    {
-        switch (hr)
-        {
-        case E_INVALIDARG:
-            return L"Invalid request payload";
-        case HRESULT_FROM_WIN32(ERROR_NOT_FOUND):
-            return L"Requested item was not found";
-        case HRESULT_FROM_WIN32(ERROR_NOT_READY):
-            return L"Recovery code is not configured";
-        case HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED):
-            return L"Vault access was denied";
-        case HRESULT_FROM_WIN32(ERROR_ACCESS_DISABLED_BY_POLICY):
-            return L"Sync is not configured or blocked by policy";
-        default:
-            return L"Internal error";
-        }
-    }
-
-    JsonObject BuildErrorObject(HRESULT hr)
-    {
-        JsonObject error;
-        error.SetNamedValue(L"code", JsonValue::CreateStringValue(HResultToErrorCode(hr)));
-        error.SetNamedValue(L"message", JsonValue::CreateStringValue(HResultToMessage(hr)));
-        error.SetNamedValue(L"retryable", JsonValue::CreateBooleanValue(false));
-        JsonObject details;
-        details.SetNamedValue(L"hresult", JsonValue::CreateNumberValue(static_cast<double>(hr)));
-        error.SetNamedValue(L"details", details);
-        return error;
-    }
-
-    JsonObject BuildSuccessResponse(std::wstring const& id, JsonObject const& result)
-    {
-        JsonObject response;
-        response.SetNamedValue(L"id", JsonValue::CreateStringValue(id));
-        response.SetNamedValue(L"version", JsonValue::CreateNumberValue(1));
-        response.SetNamedValue(L"ok", JsonValue::CreateBooleanValue(true));
-        response.SetNamedValue(L"result", result);
-        response.SetNamedValue(L"error", JsonValue::CreateNullValue());
-        return response;
-    }
-
-    JsonObject BuildErrorResponse(std::wstring const& id, HRESULT hr)
-    {
-        JsonObject response;
-        response.SetNamedValue(L"id", JsonValue::CreateStringValue(id));
-        response.SetNamedValue(L"version", JsonValue::CreateNumberValue(1));
-        response.SetNamedValue(L"ok", JsonValue::CreateBooleanValue(false));
-        response.SetNamedValue(L"result", JsonValue::CreateNullValue());
-        response.SetNamedValue(L"error", BuildErrorObject(hr));
-        return response;
-    }
-
     HRESULT TryLoadVaultDocument(tsupasswd::VaultDocumentV1& outDoc, std::wstring const& requestId)
     {
         outDoc = {};
@@ -256,9 +188,8 @@ namespace
             return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
         }
 
-        std::wstring decryptedJson = winrt::to_hstring(std::string(reinterpret_cast<char const*>(plainBytes.data()), plainBytes.size())).c_str();
         std::wstring parseError;
-        if (!tsupasswd::DeserializeVaultDocumentV1(decryptedJson, outDoc, parseError))
+        if (!tsupasswd::DeserializeVaultDocumentV1FromUtf8Bytes(plainBytes.data(), plainBytes.size(), outDoc, parseError))
         {
             return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
         }
@@ -266,323 +197,299 @@ namespace
         return S_OK;
     }
 
-    JsonObject BuildVaultItemJson(tsupasswd::VaultItemV1 const& item, bool includeSecret)
+    // NativeMessagingHostCore から見た本番の vault。PluginCredentialManager/PluginRegistrationManager に委譲する。
+    class PluginNativeHostVault final : public tsupasswd::INativeHostVault
     {
-        JsonObject json;
-        json.SetNamedValue(L"itemId", JsonValue::CreateStringValue(item.ItemId));
-        json.SetNamedValue(L"title", JsonValue::CreateStringValue(item.Title));
-        json.SetNamedValue(L"username", JsonValue::CreateStringValue(item.Login.Username));
-        json.SetNamedValue(L"url", JsonValue::CreateStringValue(item.Login.Url));
-        json.SetNamedValue(L"notes", JsonValue::CreateStringValue(item.Notes));
-        json.SetNamedValue(L"createdAt", JsonValue::CreateStringValue(item.CreatedAt));
-        json.SetNamedValue(L"updatedAt", JsonValue::CreateStringValue(item.UpdatedAt));
-        json.SetNamedValue(L"deleted", JsonValue::CreateBooleanValue(item.Deleted));
-        if (includeSecret)
+    public:
+        tsupasswd::NativeHostResult GetStatus(tsupasswd::NativeHostVaultStatus& outStatus) override
         {
-            json.SetNamedValue(L"password", JsonValue::CreateStringValue(item.Login.Password));
+            auto& credMgr = PluginCredentialManager::getInstance();
+            outStatus.VaultLocked = credMgr.GetVaultLock();
+            outStatus.SilentOperation = credMgr.GetSilentOperation();
+            outStatus.RecoveryCodeAvailable = !GetEnvironmentVariableValue(kVaultRecoveryCodeEnv).empty();
+            outStatus.SyncConfigured = !GetEnvironmentVariableValue(kSyncBaseUrlEnv).empty() && !GetEnvironmentVariableValue(kSyncUserIdEnv).empty();
+            return tsupasswd::NativeHostResult::Success();
         }
-        return json;
-    }
 
-    HRESULT HandleStatus(JsonObject const&, std::wstring const&, JsonObject& outResult)
-    {
-        auto& credMgr = PluginCredentialManager::getInstance();
-        JsonObject result;
-        result.SetNamedValue(L"vaultLocked", JsonValue::CreateBooleanValue(credMgr.GetVaultLock()));
-        result.SetNamedValue(L"silentOperation", JsonValue::CreateBooleanValue(credMgr.GetSilentOperation()));
-        result.SetNamedValue(L"recoveryCodeAvailable", JsonValue::CreateBooleanValue(!GetEnvironmentVariableValue(kVaultRecoveryCodeEnv).empty()));
-        bool syncConfigured = !GetEnvironmentVariableValue(kSyncBaseUrlEnv).empty() && !GetEnvironmentVariableValue(kSyncUserIdEnv).empty();
-        result.SetNamedValue(L"syncConfigured", JsonValue::CreateBooleanValue(syncConfigured));
-        result.SetNamedValue(L"uiRequired", JsonValue::CreateBooleanValue(credMgr.GetVaultLock()));
-        outResult = result;
-        return S_OK;
-    }
-
-    HRESULT HandleList(JsonObject const& payload, std::wstring const& requestId, JsonObject& outResult)
-    {
-        bool includeDeleted = false;
-        (void)TryGetBool(payload, L"includeDeleted", includeDeleted);
+        tsupasswd::NativeHostResult LoadVaultDocument(std::wstring const& requestId, tsupasswd::VaultDocumentV1& outDoc) override
+        {
+            return FromHResult(TryLoadVaultDocument(outDoc, requestId));
+        }
 
-        tsupasswd::VaultDocumentV1 vaultDoc{};
-        HRESULT hr = TryLoadVaultDocument(vaultDoc, requestId);
-        if (FAILED(hr))
+        tsupasswd::NativeHostResult GetLoginItem(std::wstring const& itemId, std::wstring const& requestId, tsupasswd::VaultItemV1& outItem) override
         {
-            return hr;
+            return FromHResult(PluginCredentialManager::getInstance().GetVaultLoginItemById(itemId, outItem, requestId));
         }
 
-        JsonArray items;
-        for (auto const& item : vaultDoc.Items)
+        tsupasswd::NativeHostResult SaveLoginItem(
+            tsupasswd::NativeHostLoginFields const& fields,
+            bool resync,
+            std::wstring const& requestId,
+            std::wstring& outItemId) override
         {
-            if (item.ItemType != tsupasswd::VaultItemType::Login)
+            AppendPersistentSyncDiagnosticLog(
+                L"INFO: sync state=running operation=native_host_save step=before_plugin_save resync=" + std::wstring(resync ? L"true" : L"false") +
+                L" request_id=" + requestId + L"\n");
+            HRESULT hr = PluginCredentialManager::getInstance().SaveLoginItemToVaultWithPasskey(
+                nullptr, fields.Title, fields.Username, fields.Password, fields.Url, fields.Notes, requestId, resync);
+            if (FAILED(hr))
             {
-                continue;
+                AppendPersistentSyncDiagnosticLog(
+                    L"WARNING: sync result=failed operation=native_host_save step=plugin_save_failed hr=" + std::to_wstring(static_cast<int>(hr)) +
+                    L" request_id=" + requestId + L"\n");
+                return FromHResult(hr);
             }
-            if (!includeDeleted && item.Deleted)
+
+            AppendPersistentSyncDiagnosticLog(
+                L"SUCCESS: sync result=success operation=native_host_save step=plugin_save_completed request_id=" + requestId + L"\n");
+
+            tsupasswd::VaultDocumentV1 vaultDoc{};
+            hr = TryLoadVaultDocument(vaultDoc, requestId + L"-after-save");
+            if (FAILED(hr))
             {
-                continue;
+                AppendPersistentSyncDiagnosticLog(
+                    L"WARNING: sync result=failed operation=native_host_save step=load_after_save_failed hr=" + std::to_wstring(static_cast<int>(hr)) +
+                    L" request_id=" + requestId + L"\n");
+                return FromHResult(hr);
             }
-            items.Append(BuildVaultItemJson(item, false));
-        }
-
-        JsonObject result;
-        result.SetNamedValue(L"items", items);
-        outResult = result;
-        return S_OK;
-    }
 
-    HRESULT HandleGet(JsonObject const& payload, std::wstring const& requestId, JsonObject& outResult)
-    {
-        std::wstring itemId;
-        RETURN_HR_IF(E_INVALIDARG, !TryGetString(payload, L"itemId", itemId) || itemId.empty());
-        bool includeSecret = false;
-        (void)TryGetBool(payload, L"includeSecret", includeSecret);
+            outItemId.clear();
+            for (auto it = vaultDoc.Items.rbegin(); it != vaultDoc.Items.rend(); ++it)
+            {
+                if (it->ItemType == tsupasswd::VaultItemType::Login && !it->Deleted)
+                {
+                    if (it->Title == fields.Title && it->Login.Username == fields.Username && it->Login.Url == fields.Url)
+                    {
+                        outItemId = it->ItemId;
+                        break;
+                    }
+                }
+            }
 
-        tsupasswd::VaultItemV1 item{};
-        HRESULT hr = PluginCredentialManager::getInstance().GetVaultLoginItemById(itemId, item, requestId);
-        if (FAILED(hr))
-        {
-            return hr;
+            AppendPersistentSyncDiagnosticLog(
+                L"SUCCESS: sync result=success operation=native_host_save step=completed request_id=" + requestId + L"\n");
+            return tsupasswd::NativeHostResult::Success();
         }
 
-        JsonObject result;
-        result.SetNamedValue(L"item", BuildVaultItemJson(item, includeSecret));
-        outResult = result;
-        return S_OK;
-    }
-
-    HRESULT HandleSave(JsonObject const& payload, std::wstring const& requestId, JsonObject& outResult)
-    {
-        AppendPersistentSyncDiagnosticLog(
-            L"INFO: sync state=running operation=native_host_save step=enter request_id=" + requestId + L"\n");
-        std::wstring title;
-        std::wstring username;
-        std::wstring password;
-        std::wstring url;
-        std::wstring notes;
-        bool resync = true;
-        RETURN_HR_IF(E_INVALIDARG, !TryGetString(payload, L"title", title));
-        RETURN_HR_IF(E_INVALIDARG, !TryGetString(payload, L"username", username));
-        RETURN_HR_IF(E_INVALIDARG, !TryGetString(payload, L"password", password));
-        (void)TryGetString(payload, L"url", url);
-        (void)TryGetString(payload, L"notes", notes);
-        (void)TryGetBool(payload, L"resync", resync);
-
-        AppendPersistentSyncDiagnosticLog(
-            L"INFO: sync state=running operation=native_host_save step=before_plugin_save resync=" + std::wstring(resync ? L"true" : L"false") +
-            L" request_id=" + requestId + L"\n");
-        HRESULT hr = PluginCredentialManager::getInstance().SaveLoginItemToVaultWithPasskey(nullptr, title, username, password, url, notes, requestId, resync);
-        if (FAILED(hr))
+        tsupasswd::NativeHostResult UpdateLoginItem(
+            std::wstring const& itemId,
+            tsupasswd::NativeHostLoginFields const& fields,
+            bool resync,
+            std::wstring const& requestId) override
         {
             AppendPersistentSyncDiagnosticLog(
-                L"WARNING: sync result=failed operation=native_host_save step=plugin_save_failed hr=" + std::to_wstring(static_cast<int>(hr)) +
-                L" request_id=" + requestId + L"\n");
-            return hr;
+                L"INFO: sync state=running operation=native_host_update step=enter request_id=" + requestId + L"\n");
+            return FromHResult(PluginCredentialManager::getInstance().UpdateVaultLoginItemById(
+                itemId, fields.Title, fields.Username, fields.Password, fields.Url, fields.Notes, requestId, resync));
         }
 
-        AppendPersistentSyncDiagnosticLog(
-            L"SUCCESS: sync result=success operation=native_host_save step=plugin_save_completed request_id=" + requestId + L"\n");
-
-        tsupasswd::VaultDocumentV1 vaultDoc{};
-        hr = TryLoadVaultDocument(vaultDoc, requestId + L"-after-save");
-        if (FAILED(hr))
+        tsupasswd::NativeHostResult DeleteLoginItem(std::wstring const& itemId, bool resync, std::wstring const& requestId) override
         {
-            AppendPersistentSyncDiagnosticLog(
-                L"WARNING: sync result=failed operation=native_host_save step=load_after_save_failed hr=" + std::to_wstring(static_cast<int>(hr)) +
-                L" request_id=" + requestId + L"\n");
-            return hr;
+            return FromHResult(PluginCredentialManager::getInstance().DeleteVaultLoginItemById(itemId, requestId, resync));
         }
 
-        std::wstring savedItemId;
-        for (auto it = vaultDoc.Items.rbegin(); it != vaultDoc.Items.rend(); ++it)
+        tsupasswd::NativeHostResult Resync(
+            std::wstring const& requestId,
+            tsupasswd::VaultMergeStats& outStats,
+            std::function<void(std::wstring const&)> const& progress) override
         {
-            if (it->ItemType == tsupasswd::VaultItemType::Login && !it->Deleted)
+            HRESULT hr = E_FAIL;
+            try
             {
-                if (it->Title == title && it->Login.Username == username && it->Login.Url == url)
-                {
-                    savedItemId = it->ItemId;
-                    break;
-                }
+                hr = PluginRegistrationManager::getInstance().ManualResyncSelfHostedVault(requestId, &outStats, progress);
+            }
+            catch (...)
+            {
+                hr = wil::ResultFromCaughtException();
             }
+            return FromHResult(hr);
         }
 
-        JsonObject result;
-        result.SetNamedValue(L"itemId", JsonValue::CreateStringValue(savedItemId));
-        result.SetNamedValue(L"saved", JsonValue::CreateBooleanValue(true));
-        result.SetNamedValue(L"synced", JsonValue::CreateBooleanValue(resync));
-        outResult = result;
-        AppendPersistentSyncDiagnosticLog(
-            L"SUCCESS: sync result=success operation=native_host_save step=completed request_id=" + requestId + L"\n");
-        return S_OK;
-    }
-
-    HRESULT HandleUpdate(JsonObject const& payload, std::wstring const& requestId, JsonObject& outResult)
-    {
-        AppendPersistentSyncDiagnosticLog(
-            L"INFO: sync state=running operation=native_host_update step=enter request_id=" + requestId + L"\n");
-        std::wstring itemId;
-        std::wstring title;
-        std::wstring username;
-        std::wstring password;
-        std::wstring url;
-        std::wstring notes;
-        bool resync = true;
-        RETURN_HR_IF(E_INVALIDARG, !TryGetString(payload, L"itemId", itemId) || itemId.empty());
-        RETURN_HR_IF(E_INVALIDARG, !TryGetString(payload, L"title", title));
-        RETURN_HR_IF(E_INVALIDARG, !TryGetString(payload, L"username", username));
-        RETURN_HR_IF(E_INVALIDARG, !TryGetString(payload, L"password", password));
-        (void)TryGetString(payload, L"url", url);
-        (void)TryGetString(payload, L"notes", notes);
-        (void)TryGetBool(payload, L"resync", resync);
-
-        HRESULT hr = PluginCredentialManager::getInstance().UpdateVaultLoginItemById(itemId, title, username, password, url, notes, requestId, resync);
-        if (FAILED(hr))
-        {
-            return hr;
+        void OnWorkerThreadStarted() override
+        {
+            winrt::init_apartment(winrt::apartment_type::multi_threaded);
         }
 
-        JsonObject result;
-        result.SetNamedValue(L"itemId", JsonValue::CreateStringValue(itemId));
-        result.SetNamedValue(L"updated", JsonValue::CreateBooleanValue(true));
-        result.SetNamedValue(L"synced", JsonValue::CreateBooleanValue(resync));
-        outResult = result;
-        return S_OK;
-    }
-
-    HRESULT HandleDelete(JsonObject const& payload, std::wstring const& requestId, JsonObject& outResult)
-    {
-        std::wstring itemId;
-        bool resync = true;
-        RETURN_HR_IF(E_INVALIDARG, !TryGetString(payload, L"itemId", itemId) || itemId.empty());
-        (void)TryGetBool(payload, L"resync", resync);
-
-        HRESULT hr = PluginCredentialManager::getInstance().DeleteVaultLoginItemById(itemId, requestId, resync);
-        if (FAILED(hr))
+        void OnWorkerThreadStopping() override
         {
-            return hr;
+            winrt::uninit_apartment();
         }
 
-        JsonObject result;
-        result.SetNamedValue(L"itemId", JsonValue::CreateStringValue(itemId));
-        result.SetNamedValue(L"deleted", JsonValue::CreateBooleanValue(true));
-        result.SetNamedValue(L"synced", JsonValue::CreateBooleanValue(resync));
-        outResult = result;
-        return S_OK;
-    }
-
-    HRESULT HandleResync(JsonObject const&, std::wstring const& requestId, JsonObject& outResult)
-    {
-        HRESULT hr = PluginRegistrationManager::getInstance().ManualResyncSelfHostedVault(requestId);
-        if (FAILED(hr))
+        void AppendDiagnosticLog(std::wstring const& message) override
         {
-            return hr;
+            AppendPersistentSyncDiagnosticLog(message);
         }
 
-        JsonObject merge;
-        merge.SetNamedValue(L"addedFromServer", JsonValue::CreateNumberValue(0));
-        merge.SetNamedValue(L"updatedFromServer", JsonValue::CreateNumberValue(0));
-        merge.SetNamedValue(L"tombstonesApplied", JsonValue::CreateNumberValue(0));
-        merge.SetNamedValue(L"duplicatesCollapsed", JsonValue::CreateNumberValue(0));
-
-        JsonObject result;
-        result.SetNamedValue(L"synced", JsonValue::CreateBooleanValue(true));
-        result.SetNamedValue(L"merge", merge);
-        outResult = result;
-        return S_OK;
-    }
+        // UI (MainPage) や別の host プロセスによる保存も EncryptedVaultData の書き換えとして現れるので、
+        // アプリの registry キーの値変更を監視する。
+        uint64_t StartChangeWatch(std::function<void()> onChanged) override
+        {
+            wil::unique_hkey key;
+            if (RegOpenKeyExW(HKEY_CURRENT_USER, c_pluginRegistryPath, 0, KEY_NOTIFY, &key) != ERROR_SUCCESS)
+            {
+                AppendPersistentSyncDiagnosticLog(
+                    L"WARNING: sync result=failed operation=native_host_change_watch reason=registry_open_failed request_id=" +
+                    tsupasswd::BuildRequestId(L"native_host_change_watch") + L"\n");
+                return 0;
+            }
 
-    HRESULT DispatchCommand(JsonObject const& request, JsonObject& response)
-    {
-        std::wstring id = tsupasswd::BuildRequestId(L"native_host");
-        (void)TryGetString(request, L"id", id);
+            auto watch = std::make_unique<RegistryChangeWatch>();
+            watch->Key = std::move(key);
+            watch->Changed.create(wil::EventOptions::None);
+            watch->Stop.create(wil::EventOptions::ManualReset);
+            RegistryChangeWatch* raw = watch.get();
+            watch->Worker = std::thread([raw, onChanged = std::move(onChanged)]()
+            {
+                HANDLE handles[] = { raw->Stop.get(), raw->Changed.get() };
+                while (true)
+                {
+                    // 通知は 1 回きりなので、待つたびに登録し直す。
+                    if (RegNotifyChangeKeyValue(raw->Key.get(), FALSE, REG_NOTIFY_CHANGE_LAST_SET, raw->Changed.get(), TRUE) != ERROR_SUCCESS)
+                    {
+                        break;
+                    }
+                    DWORD waitResult = WaitForMultipleObjects(ARRAYSIZE(handles), handles, FALSE, INFINITE);
+                    if (waitResult != WAIT_OBJECT_0 + 1)
+                    {
+                        break;
+                    }
+                    onChanged();
+                }
+            });
 
-        std::wstring command;
-        if (!TryGetString(request, L"command", command) || command.empty())
-        {
-            response = BuildErrorResponse(id, E_INVALIDARG);
-            return E_INVALIDARG;
+            std::lock_guard<std::mutex> lock(m_watchMutex);
+            uint64_t watchId = m_nextWatchId++;
+            m_watches.emplace(watchId, std::move(watch));
+            return watchId;
         }
 
-        JsonObject payload;
-        auto payloadValue = request.GetNamedValue(L"payload", nullptr);
-        if (payloadValue && payloadValue.ValueType() == JsonValueType::Object)
+        void StopChangeWatch(uint64_t watchId) override
         {
-            payload = payloadValue.GetObjectW();
+            std::unique_ptr<RegistryChangeWatch> watch;
+            {
+                std::lock_guard<std::mutex> lock(m_watchMutex);
+                auto it = m_watches.find(watchId);
+                if (it == m_watches.end())
+                {
+                    return;
+                }
+                watch = std::move(it->second);
+                m_watches.erase(it);
+            }
+            watch->Stop.SetEvent();
+            if (watch->Worker.joinable())
+            {
+                watch->Worker.join();
+            }
         }
 
-        JsonObject result;
-        HRESULT hr = E_NOTIMPL;
-        if (command == L"vault.status.get")
+    private:
+        struct RegistryChangeWatch
         {
-            hr = HandleStatus(payload, id, result);
-        }
-        else if (command == L"vault.login.list")
-        {
-            hr = HandleList(payload, id, result);
-        }
-        else if (command == L"vault.login.get")
+            wil::unique_hkey Key;
+            wil::unique_event Changed;
+            wil::unique_event Stop;
+            std::thread Worker;
+        };
+
+        std::mutex m_watchMutex;
+        std::map<uint64_t, std::unique_ptr<RegistryChangeWatch>> m_watches;
+        uint64_t m_nextWatchId{ 1 };
+    };
+
+    // ベンチマーク用。vault.login.get に固定の item を返すだけで I/O はしない。
+    class BenchmarkNativeHostVault final : public tsupasswd::INativeHostVault
+    {
+    public:
+        explicit BenchmarkNativeHostVault(tsupasswd::VaultItemV1 const& item) :
+            m_item(item)
         {
-            hr = HandleGet(payload, id, result);
         }
-        else if (command == L"vault.login.save")
+
+        tsupasswd::NativeHostResult GetStatus(tsupasswd::NativeHostVaultStatus&) override
         {
-            hr = HandleSave(payload, id, result);
+            return tsupasswd::NativeHostResult::Success();
         }
-        else if (command == L"vault.login.update")
+
+        tsupasswd::NativeHostResult LoadVaultDocument(std::wstring const&, tsupasswd::VaultDocumentV1& outDoc) override
         {
-            hr = HandleUpdate(payload, id, result);
+            outDoc = {};
+            outDoc.Items.push_back(m_item);
+            return tsupasswd::NativeHostResult::Success();
         }
-        else if (command == L"vault.login.delete")
+
+        tsupasswd::NativeHostResult GetLoginItem(std::wstring const& itemId, std::wstring const&, tsupasswd::VaultItemV1& outItem) override
         {
-            hr = HandleDelete(payload, id, result);
+            if (itemId != m_item.ItemId)
+            {
+                return FromHResult(HRESULT_FROM_WIN32(ERROR_NOT_FOUND));
+            }
+            outItem = m_item;
+            return tsupasswd::NativeHostResult::Success();
         }
-        else if (command == L"vault.sync.resync")
+
+        tsupasswd::NativeHostResult SaveLoginItem(tsupasswd::NativeHostLoginFields const&, bool, std::wstring const&, std::wstring&) override
         {
-            hr = HandleResync(payload, id, result);
+            return FromHResult(E_NOTIMPL);
         }
 
-        if (SUCCEEDED(hr))
+        tsupasswd::NativeHostResult UpdateLoginItem(std::wstring const&, tsupasswd::NativeHostLoginFields const&, bool, std::wstring const&) override
         {
-            response = BuildSuccessResponse(id, result);
+            return FromHResult(E_NOTIMPL);
         }
-        else
+
+        tsupasswd::NativeHostResult DeleteLoginItem(std::wstring const&, bool, std::wstring const&) override
         {
-            response = BuildErrorResponse(id, hr == E_NOTIMPL ? HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED) : hr);
+            return FromHResult(E_NOTIMPL);
         }
-        return hr;
-    }
 
-    bool ReadExact(HANDLE handle, void* buffer, DWORD size)
-    {
-        BYTE* cursor = static_cast<BYTE*>(buffer);
-        DWORD remaining = size;
-        while (remaining > 0)
+        tsupasswd::NativeHostResult Resync(std::wstring const&, tsupasswd::VaultMergeStats&, std::function<void(std::wstring const&)> const&) override
         {
-            DWORD read = 0;
-            if (!ReadFile(handle, cursor, remaining, &read, nullptr) || read == 0)
-            {
-                return false;
-            }
-            cursor += read;
-            remaining -= read;
+            return FromHResult(E_NOTIMPL);
         }
-        return true;
-    }
 
-    bool WriteExact(HANDLE handle, void const* buffer, DWORD size)
+    private:
+        tsupasswd::VaultItemV1 m_item;
+    };
+
+    // 旧実装 (std::string -> hstring -> JsonObject -> Stringify -> std::string) の 1 往復。ベンチマークの比較対象。
+    size_t RunLegacyCodecRoundTrip(std::string const& requestUtf8, tsupasswd::VaultItemV1 const& item)
     {
-        BYTE const* cursor = static_cast<BYTE const*>(buffer);
-        DWORD remaining = size;
-        while (remaining > 0)
+        using namespace winrt::Windows::Data::Json;
+
+        std::string received(requestUtf8.data(), requestUtf8.size());
+        std::wstring requestWide = winrt::to_hstring(received).c_str();
+        JsonObject request = JsonObject::Parse(requestWide);
+        std::wstring id = request.GetNamedString(L"id", L"").c_str();
+        std::wstring command = request.GetNamedString(L"command", L"").c_str();
+        JsonObject payload = request.GetNamedObject(L"payload", nullptr);
+        std::wstring itemId = payload.GetNamedString(L"itemId", L"").c_str();
+        bool includeSecret = payload.GetNamedBoolean(L"includeSecret", false);
+
+        JsonObject itemJson;
+        itemJson.SetNamedValue(L"itemId", JsonValue::CreateStringValue(item.ItemId));
+        itemJson.SetNamedValue(L"title", JsonValue::CreateStringValue(item.Title));
+        itemJson.SetNamedValue(L"username", JsonValue::CreateStringValue(item.Login.Username));
+        itemJson.SetNamedValue(L"url", JsonValue::CreateStringValue(item.Login.Url));
+        itemJson.SetNamedValue(L"notes", JsonValue::CreateStringValue(item.Notes));
+        itemJson.SetNamedValue(L"createdAt", JsonValue::CreateStringValue(item.CreatedAt));
+        itemJson.SetNamedValue(L"updatedAt", JsonValue::CreateStringValue(item.UpdatedAt));
+        itemJson.SetNamedValue(L"deleted", JsonValue::CreateBooleanValue(item.Deleted));
+        if (includeSecret)
         {
-            DWORD written = 0;
-            if (!WriteFile(handle, cursor, remaining, &written, nullptr) || written == 0)
-            {
-                return false;
-            }
-            cursor += written;
-            remaining -= written;
+            itemJson.SetNamedValue(L"password", JsonValue::CreateStringValue(item.Login.Password));
         }
-        return true;
+        JsonObject result;
+        result.SetNamedValue(L"item", itemJson);
+
+        JsonObject response;
+        response.SetNamedValue(L"id", JsonValue::CreateStringValue(id));
+        response.SetNamedValue(L"version", JsonValue::CreateNumberValue(1));
+        response.SetNamedValue(L"ok", JsonValue::CreateBooleanValue(!command.empty() && itemId == item.ItemId));
+        response.SetNamedValue(L"result", result);
+        response.SetNamedValue(L"error", JsonValue::CreateNullValue());
+        std::string responseUtf8 = winrt::to_string(response.Stringify());
+        return responseUtf8.size();
     }
 }
 
@@ -595,62 +502,125 @@ namespace tsupasswd
             return true;
         }
 
-        HANDLE stdinHandle = GetStdHandle(STD_INPUT_HANDLE);
-        HANDLE stdoutHandle = GetStdHandle(STD_OUTPUT_HANDLE);
-        return IsPipeHandle(stdinHandle) && IsPipeHandle(stdoutHandle);
+        return AreStandardStreamsPipes();
     }
 
-    int RunNativeMessagingHost(std::wstring const&)
+    bool RunNativeMessagingCodecBenchmark(uint32_t iterations, std::wstring& outReport)
     {
-        PluginCredentialManager::getInstance();
-        PluginRegistrationManager::getInstance();
+        outReport.clear();
 
-        HANDLE stdinHandle = GetStdHandle(STD_INPUT_HANDLE);
-        HANDLE stdoutHandle = GetStdHandle(STD_OUTPUT_HANDLE);
-        if (stdinHandle == INVALID_HANDLE_VALUE || stdoutHandle == INVALID_HANDLE_VALUE)
+        std::wstring selfTestError;
+        if (!RunNativeMessagingJsonRegressionTests(selfTestError))
         {
-            return 1;
+            outReport = L"step=codec_regression_test_failed detail=" + selfTestError;
+            return false;
         }
 
-        while (true)
+        VaultItemV1 item{};
+        item.ItemId = L"3f9a6c1e-benchmark-item";
+        item.ItemType = VaultItemType::Login;
+        item.Title = L"GitHub (benchmark)";
+        item.Notes = L"line1\nline2 \"quoted\"";
+        item.CreatedAt = L"2026-01-01T00:00:00Z";
+        item.UpdatedAt = L"2026-01-02T00:00:00Z";
+        item.Login.Username = L"alice@example.com";
+        item.Login.Password = L"correct horse battery staple";
+        item.Login.Url = L"https://github.com/login";
+
+        std::string requestUtf8 =
+            "{\"id\":\"bench-1\",\"version\":1,\"command\":\"vault.login.get\","
+            "\"payload\":{\"itemId\":\"3f9a6c1e-benchmark-item\",\"includeSecret\":true}}";
+
+        auto measure = [&](auto&& roundTrip, size_t& outBytes)
         {
-            uint32_t messageSize = 0;
-            if (!ReadExact(stdinHandle, &messageSize, sizeof(messageSize)))
-            {
-                break;
-            }
-            if (messageSize == 0 || messageSize > (16u * 1024u * 1024u))
+            // 1 回目はバッファ容量を確保するためのウォームアップとして計測から外す。
+            outBytes = roundTrip();
+            auto start = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < iterations; ++i)
             {
-                return 2;
+                outBytes = roundTrip();
             }
+            auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return elapsed > 0 ? static_cast<double>(iterations) / elapsed : 0.0;
+        };
 
-            std::string requestUtf8(messageSize, '\0');
-            if (!ReadExact(stdinHandle, requestUtf8.data(), messageSize))
+        size_t legacyBytes = 0;
+        double legacyPerSecond = 0;
+        try
+        {
+            legacyPerSecond = measure([&]()
             {
-                return 3;
-            }
+                return RunLegacyCodecRoundTrip(requestUtf8, item);
+            }, legacyBytes);
+        }
+        catch (...)
+        {
+            outReport = L"step=legacy_codec_failed hr=" + std::to_wstring(static_cast<int>(wil::ResultFromCaughtException()));
+            return false;
+        }
 
-            JsonObject response;
-            try
-            {
-                std::wstring requestWide = winrt::to_hstring(requestUtf8).c_str();
-                auto request = JsonObject::Parse(requestWide);
-                (void)DispatchCommand(request, response);
-            }
-            catch (...)
-            {
-                response = BuildErrorResponse(tsupasswd::BuildRequestId(L"native_host_parse"), E_INVALIDARG);
-            }
+        // 新経路はプロトコルエンジンそのものを通す (transport は使わない)。
+        BenchmarkNativeHostVault vault(item);
+        auto transports = CreateInMemoryTransportPair();
+        NativeMessagingHostCore core(vault, *transports.first);
+        size_t utf8Bytes = 0;
+        bool utf8Ok = true;
+        double utf8PerSecond = measure([&]()
+        {
+            std::string_view response = core.HandleMessage(requestUtf8);
+            utf8Ok = utf8Ok && response.find("\"ok\":true") != std::string_view::npos;
+            return response.size();
+        }, utf8Bytes);
+        if (!utf8Ok)
+        {
+            outReport = L"step=utf8_codec_failed";
+            return false;
+        }
 
-            std::string responseUtf8 = winrt::to_string(response.Stringify());
-            uint32_t responseSize = static_cast<uint32_t>(responseUtf8.size());
-            if (!WriteExact(stdoutHandle, &responseSize, sizeof(responseSize)) ||
-                !WriteExact(stdoutHandle, responseUtf8.data(), responseSize))
-            {
-                return 4;
-            }
+        wchar_t ratio[32]{};
+        swprintf_s(ratio, L"%.2f", legacyPerSecond > 0 ? utf8PerSecond / legacyPerSecond : 0.0);
+        outReport =
+            L"step=codec_benchmark_completed iterations=" + std::to_wstring(iterations) +
+            L" legacy_msgs_per_sec=" + std::to_wstring(static_cast<uint64_t>(legacyPerSecond)) +
+            L" utf8_msgs_per_sec=" + std::to_wstring(static_cast<uint64_t>(utf8PerSecond)) +
+            L" speedup=" + ratio +
+            L" legacy_response_bytes=" + std::to_wstring(legacyBytes) +
+            L" utf8_response_bytes=" + std::to_wstring(utf8Bytes);
+        return true;
+    }
+
+    int RunNativeMessagingHost(std::wstring const&)
+    {
+        PluginCredentialManager::getInstance();
+        // 拡張からの最初の保存が接続と login を待たないよう、標準入力を読み始める前に同期サーバーへの接続を開いておく。
+        PluginRegistrationManager::getInstance().StartSyncPrewarm();
+
+        if (IsTruthySetting(GetEnvironmentVariableValue(kNativeHostCodecBenchmarkEnv)))
+        {
+            std::wstring report;
+            bool passed = RunNativeMessagingCodecBenchmark(kNativeHostCodecBenchmarkIterations, report);
+            AppendPersistentSyncDiagnosticLog(
+                std::wstring(passed ? L"INFO: native_host state=observed operation=native_host_codec_benchmark " : L"WARNING: native_host result=warning operation=native_host_codec_benchmark ") +
+                report + L"\n");
         }
 
-        return 0;
+        std::unique_ptr<INativeMessageTransport> transport = CreateStandardStreamTransport();
+        if (!transport)
+        {
+            return NativeHostExitNoTransport;
+        }
+
+        NativeMessagingHostOptions options{};
+        options.SessionRecordPath = GetEnvironmentVariableValue(kNativeHostRecordSessionEnv);
+
+        PluginNativeHostVault vault;
+        NativeMessagingHostCore core(vault, *transport, std::move(options));
+        int exitCode = core.Run();
+        // 拡張が切断した直後に保存した分も、プロセスを終える前に同期しておく。
+        if (!PluginRegistrationManager::getInstance().FlushVaultSync(kNativeHostSyncFlushTimeoutMs))
+        {
+            AppendPersistentSyncDiagnosticLog(L"WARNING: sync result=warning operation=background_sync reason=flush_timeout_on_exit request_id=" + tsupasswd::BuildRequestId(L"background_sync") + L"\n");
+        }
+        return exitCode;
     }
 }
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 namespace tsupasswd
 {
     bool IsNativeMessagingHostMode(std::wstring const& args);
     int RunNativeMessagingHost(std::wstring const& args);
+
+    // 旧 WinRT JSON 経路と UTF-8 経路で vault.login.get 相当の 1 往復を繰り返し、msgs/sec を比較する。
+    bool RunNativeMessagingCodecBenchmark(uint32_t iterations, std::wstring& outReport);
 }
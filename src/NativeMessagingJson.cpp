@@ -0,0 +1,1096 @@
+#include "NativeMessagingJson.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace tsupasswd
+{
+    namespace
+    {
+        constexpr uint32_t kMaxParseDepth = 64;
+        constexpr char32_t kReplacementCharacter = 0xFFFD;
+
+        bool IsJsonWhitespace(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+        }
+
+        int HexValue(char c)
+        {
+            if (c >= '0' && c <= '9')
+            {
+                return c - '0';
+            }
+            if (c >= 'a' && c <= 'f')
+            {
+                return c - 'a' + 10;
+            }
+            if (c >= 'A' && c <= 'F')
+            {
+                return c - 'A' + 10;
+            }
+            return -1;
+        }
+
+        bool ReadHex4(std::string_view text, size_t offset, char32_t& out)
+        {
+            if (offset + 4 > text.size())
+            {
+                return false;
+            }
+            char32_t value = 0;
+            for (size_t i = 0; i < 4; ++i)
+            {
+                int nibble = HexValue(text[offset + i]);
+                if (nibble < 0)
+                {
+                    return false;
+                }
+                value = (value << 4) | static_cast<char32_t>(nibble);
+            }
+            out = value;
+            return true;
+        }
+
+        // 1 コードポイント分の UTF-8 をデコードする。不正なシーケンスは false。
+        bool DecodeUtf8CodePoint(std::string_view text, size_t& cursor, char32_t& out)
+        {
+            unsigned char lead = static_cast<unsigned char>(text[cursor]);
+            if (lead < 0x80)
+            {
+                out = lead;
+                ++cursor;
+                return true;
+            }
+
+            size_t length = 0;
+            char32_t codePoint = 0;
+            char32_t minimum = 0;
+            if ((lead & 0xE0) == 0xC0)
+            {
+                length = 2;
+                codePoint = lead & 0x1F;
+                minimum = 0x80;
+            }
+            else if ((lead & 0xF0) == 0xE0)
+            {
+                length = 3;
+                codePoint = lead & 0x0F;
+                minimum = 0x800;
+            }
+            else if ((lead & 0xF8) == 0xF0)
+            {
+                length = 4;
+                codePoint = lead & 0x07;
+                minimum = 0x10000;
+            }
+            else
+            {
+                return false;
+            }
+
+            if (cursor + length > text.size())
+            {
+                return false;
+            }
+            for (size_t i = 1; i < length; ++i)
+            {
+                unsigned char continuation = static_cast<unsigned char>(text[cursor + i]);
+                if ((continuation & 0xC0) != 0x80)
+                {
+                    return false;
+                }
+                codePoint = (codePoint << 6) | (continuation & 0x3F);
+            }
+
+            if (codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+            {
+                return false;
+            }
+
+            out = codePoint;
+            cursor += length;
+            return true;
+        }
+
+        void AppendCodePointUtf8(char32_t codePoint, std::string& out)
+        {
+            if (codePoint < 0x80)
+            {
+                out.push_back(static_cast<char>(codePoint));
+            }
+            else if (codePoint < 0x800)
+            {
+                out.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+                out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+            }
+            else if (codePoint < 0x10000)
+            {
+                out.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+                out.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+            }
+            else
+            {
+                out.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+                out.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+            }
+        }
+
+        void AppendCodePointWide(char32_t codePoint, std::wstring& out)
+        {
+            if constexpr (sizeof(wchar_t) == 2)
+            {
+                if (codePoint >= 0x10000)
+                {
+                    char32_t reduced = codePoint - 0x10000;
+                    out.push_back(static_cast<wchar_t>(0xD800 + (reduced >> 10)));
+                    out.push_back(static_cast<wchar_t>(0xDC00 + (reduced & 0x3FF)));
+                    return;
+                }
+            }
+            out.push_back(static_cast<wchar_t>(codePoint));
+        }
+
+        // wchar_t 列をコードポイント単位で sink に渡す。孤立サロゲートは U+FFFD に置き換える。
+        template <typename Sink>
+        void ForEachWideCodePoint(std::wstring_view wide, Sink&& sink)
+        {
+            for (size_t i = 0; i < wide.size(); ++i)
+            {
+                char32_t codePoint = static_cast<char32_t>(wide[i]);
+                if constexpr (sizeof(wchar_t) == 2)
+                {
+                    codePoint &= 0xFFFF;
+                    if (codePoint >= 0xD800 && codePoint <= 0xDBFF)
+                    {
+                        char32_t low = (i + 1 < wide.size()) ? (static_cast<char32_t>(wide[i + 1]) & 0xFFFF) : 0;
+                        if (low >= 0xDC00 && low <= 0xDFFF)
+                        {
+                            codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                            ++i;
+                        }
+                        else
+                        {
+                            codePoint = kReplacementCharacter;
+                        }
+                    }
+                    else if (codePoint >= 0xDC00 && codePoint <= 0xDFFF)
+                    {
+                        codePoint = kReplacementCharacter;
+                    }
+                }
+                else if (codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+                {
+                    codePoint = kReplacementCharacter;
+                }
+                sink(codePoint);
+            }
+        }
+
+        // JSON 文字列本体 (引用符なし) のエスケープを解きながらコードポイント単位で sink に渡す。
+        template <typename Sink>
+        bool DecodeJsonStringBody(std::string_view body, Sink&& sink)
+        {
+            size_t cursor = 0;
+            while (cursor < body.size())
+            {
+                char c = body[cursor];
+                if (c != '\\')
+                {
+                    char32_t codePoint = 0;
+                    if (!DecodeUtf8CodePoint(body, cursor, codePoint))
+                    {
+                        return false;
+                    }
+                    sink(codePoint);
+                    continue;
+                }
+
+                if (cursor + 1 >= body.size())
+                {
+                    return false;
+                }
+                char escape = body[cursor + 1];
+                cursor += 2;
+                switch (escape)
+                {
+                case '"': sink(U'"'); break;
+                case '\\': sink(U'\\'); break;
+                case '/': sink(U'/'); break;
+                case 'b': sink(U'\b'); break;
+                case 'f': sink(U'\f'); break;
+                case 'n': sink(U'\n'); break;
+                case 'r': sink(U'\r'); break;
+                case 't': sink(U'\t'); break;
+                case 'u':
+                {
+                    char32_t unit = 0;
+                    if (!ReadHex4(body, cursor, unit))
+                    {
+                        return false;
+                    }
+                    cursor += 4;
+                    if (unit >= 0xD800 && unit <= 0xDBFF)
+                    {
+                        char32_t low = 0;
+                        if (cursor + 6 <= body.size() && body[cursor] == '\\' && body[cursor + 1] == 'u' &&
+                            ReadHex4(body, cursor + 2, low) && low >= 0xDC00 && low <= 0xDFFF)
+                        {
+                            cursor += 6;
+                            sink(0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00));
+                        }
+                        else
+                        {
+                            sink(kReplacementCharacter);
+                        }
+                    }
+                    else if (unit >= 0xDC00 && unit <= 0xDFFF)
+                    {
+                        sink(kReplacementCharacter);
+                    }
+                    else
+                    {
+                        sink(unit);
+                    }
+                    break;
+                }
+                default:
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    bool AppendUtf8ToWide(std::string_view utf8, std::wstring& out)
+    {
+        size_t cursor = 0;
+        while (cursor < utf8.size())
+        {
+            char32_t codePoint = 0;
+            if (!DecodeUtf8CodePoint(utf8, cursor, codePoint))
+            {
+                return false;
+            }
+            AppendCodePointWide(codePoint, out);
+        }
+        return true;
+    }
+
+    void AppendWideToUtf8(std::wstring_view wide, std::string& out)
+    {
+        ForEachWideCodePoint(wide, [&](char32_t codePoint)
+        {
+            AppendCodePointUtf8(codePoint, out);
+        });
+    }
+
+    bool Utf8JsonReader::Parse(std::string_view json)
+    {
+        m_tokens.clear();
+        m_json = {};
+        if (json.size() > std::numeric_limits<uint32_t>::max())
+        {
+            return false;
+        }
+
+        m_json = json;
+        size_t cursor = 0;
+        SkipWhitespace(cursor);
+        if (!ParseValue(cursor, 0))
+        {
+            m_tokens.clear();
+            return false;
+        }
+        SkipWhitespace(cursor);
+        if (cursor != m_json.size())
+        {
+            m_tokens.clear();
+            return false;
+        }
+        return true;
+    }
+
+    std::string_view Utf8JsonReader::RawSpan(size_t index) const
+    {
+        Utf8JsonToken const& token = m_tokens[index];
+        return m_json.substr(token.Begin, token.End - token.Begin);
+    }
+
+    void Utf8JsonReader::SkipWhitespace(size_t& cursor) const
+    {
+        while (cursor < m_json.size() && IsJsonWhitespace(m_json[cursor]))
+        {
+            ++cursor;
+        }
+    }
+
+    bool Utf8JsonReader::ParseLiteral(size_t& cursor, std::string_view literal) const
+    {
+        if (m_json.compare(cursor, literal.size(), literal) != 0)
+        {
+            return false;
+        }
+        cursor += literal.size();
+        return true;
+    }
+
+    bool Utf8JsonReader::ParseString(size_t& cursor, Utf8JsonToken& token) const
+    {
+        // cursor は開き引用符を指している。
+        ++cursor;
+        token.Type = Utf8JsonTokenType::String;
+        token.Begin = static_cast<uint32_t>(cursor);
+        while (cursor < m_json.size())
+        {
+            unsigned char c = static_cast<unsigned char>(m_json[cursor]);
+            if (c == '"')
+            {
+                token.End = static_cast<uint32_t>(cursor);
+                ++cursor;
+                return true;
+            }
+            if (c < 0x20)
+            {
+                return false;
+            }
+            if (c == '\\')
+            {
+                token.HasEscapes = true;
+                cursor += 2;
+                continue;
+            }
+            ++cursor;
+        }
+        return false;
+    }
+
+    bool Utf8JsonReader::ParseNumber(size_t& cursor) const
+    {
+        size_t start = cursor;
+        if (cursor < m_json.size() && m_json[cursor] == '-')
+        {
+            ++cursor;
+        }
+        if (cursor >= m_json.size())
+        {
+            return false;
+        }
+        if (m_json[cursor] == '0')
+        {
+            ++cursor;
+        }
+        else if (m_json[cursor] >= '1' && m_json[cursor] <= '9')
+        {
+            while (cursor < m_json.size() && m_json[cursor] >= '0' && m_json[cursor] <= '9')
+            {
+                ++cursor;
+            }
+        }
+        else
+        {
+            return false;
+        }
+
+        if (cursor < m_json.size() && m_json[cursor] == '.')
+        {
+            ++cursor;
+            size_t fractionStart = cursor;
+            while (cursor < m_json.size() && m_json[cursor] >= '0' && m_json[cursor] <= '9')
+            {
+                ++cursor;
+            }
+            if (cursor == fractionStart)
+            {
+                return false;
+            }
+        }
+
+        if (cursor < m_json.size() && (m_json[cursor] == 'e' || m_json[cursor] == 'E'))
+        {
+            ++cursor;
+            if (cursor < m_json.size() && (m_json[cursor] == '+' || m_json[cursor] == '-'))
+            {
+                ++cursor;
+            }
+            size_t exponentStart = cursor;
+            while (cursor < m_json.size() && m_json[cursor] >= '0' && m_json[cursor] <= '9')
+            {
+                ++cursor;
+            }
+            if (cursor == exponentStart)
+            {
+                return false;
+            }
+        }
+
+        return cursor > start;
+    }
+
+    bool Utf8JsonReader::ParseValue(size_t& cursor, uint32_t depth)
+    {
+        if (depth > kMaxParseDepth || cursor >= m_json.size())
+        {
+            return false;
+        }
+
+        size_t tokenIndex = m_tokens.size();
+        m_tokens.emplace_back();
+        Utf8JsonToken token{};
+        token.Begin = static_cast<uint32_t>(cursor);
+
+        char c = m_json[cursor];
+        if (c == '"')
+        {
+            if (!ParseString(cursor, token))
+            {
+                return false;
+            }
+        }
+        else if (c == '{' || c == '[')
+        {
+            bool isObject = c == '{';
+            token.Type = isObject ? Utf8JsonTokenType::Object : Utf8JsonTokenType::Array;
+            char closing = isObject ? '}' : ']';
+            ++cursor;
+            SkipWhitespace(cursor);
+            if (cursor < m_json.size() && m_json[cursor] == closing)
+            {
+                ++cursor;
+            }
+            else
+            {
+                while (true)
+                {
+                    if (isObject)
+                    {
+                        if (cursor >= m_json.size() || m_json[cursor] != '"')
+                        {
+                            return false;
+                        }
+                        Utf8JsonToken keyToken{};
+                        if (!ParseString(cursor, keyToken))
+                        {
+                            return false;
+                        }
+                        keyToken.Next = static_cast<uint32_t>(m_tokens.size() + 1);
+                        m_tokens.push_back(keyToken);
+                        SkipWhitespace(cursor);
+                        if (cursor >= m_json.size() || m_json[cursor] != ':')
+                        {
+                            return false;
+                        }
+                        ++cursor;
+                        SkipWhitespace(cursor);
+                    }
+
+                    if (!ParseValue(cursor, depth + 1))
+                    {
+                        return false;
+                    }
+                    SkipWhitespace(cursor);
+                    if (cursor >= m_json.size())
+                    {
+                        return false;
+                    }
+                    if (m_json[cursor] == ',')
+                    {
+                        ++cursor;
+                        SkipWhitespace(cursor);
+                        continue;
+                    }
+                    if (m_json[cursor] == closing)
+                    {
+                        ++cursor;
+                        break;
+                    }
+                    return false;
+                }
+            }
+            token.End = static_cast<uint32_t>(cursor);
+        }
+        else if (c == 't' || c == 'f')
+        {
+            token.Type = Utf8JsonTokenType::Bool;
+            token.BoolValue = c == 't';
+            if (!ParseLiteral(cursor, token.BoolValue ? std::string_view{ "true" } : std::string_view{ "false" }))
+            {
+                return false;
+            }
+            token.End = static_cast<uint32_t>(cursor);
+        }
+        else if (c == 'n')
+        {
+            token.Type = Utf8JsonTokenType::Null;
+            if (!ParseLiteral(cursor, "null"))
+            {
+                return false;
+            }
+            token.End = static_cast<uint32_t>(cursor);
+        }
+        else
+        {
+            token.Type = Utf8JsonTokenType::Number;
+            if (!ParseNumber(cursor))
+            {
+                return false;
+            }
+            token.End = static_cast<uint32_t>(cursor);
+        }
+
+        token.Next = static_cast<uint32_t>(m_tokens.size());
+        m_tokens[tokenIndex] = token;
+        return true;
+    }
+
+    size_t Utf8JsonReader::FirstChild(size_t containerIndex) const
+    {
+        if (containerIndex >= m_tokens.size())
+        {
+            return npos;
+        }
+        Utf8JsonToken const& container = m_tokens[containerIndex];
+        if (container.Type != Utf8JsonTokenType::Object && container.Type != Utf8JsonTokenType::Array)
+        {
+            return npos;
+        }
+        size_t child = containerIndex + 1;
+        return child < container.Next ? child : npos;
+    }
+
+    size_t Utf8JsonReader::NextSibling(size_t containerIndex, size_t childIndex) const
+    {
+        Utf8JsonToken const& container = m_tokens[containerIndex];
+        size_t valueIndex = container.Type == Utf8JsonTokenType::Object ? childIndex + 1 : childIndex;
+        size_t next = m_tokens[valueIndex].Next;
+        return next < container.Next ? next : npos;
+    }
+
+    bool Utf8JsonReader::KeyEquals(size_t keyIndex, std::string_view key) const
+    {
+        Utf8JsonToken const& token = m_tokens[keyIndex];
+        if (!token.HasEscapes)
+        {
+            return RawSpan(keyIndex) == key;
+        }
+        m_keyScratch.clear();
+        return DecodeStringUtf8(keyIndex, m_keyScratch) && m_keyScratch == key;
+    }
+
+    size_t Utf8JsonReader::FindMember(size_t objectIndex, std::string_view key) const
+    {
+        if (objectIndex >= m_tokens.size() || m_tokens[objectIndex].Type != Utf8JsonTokenType::Object)
+        {
+            return npos;
+        }
+        // 重複キーは最後の値を採用する (Windows.Data.Json と同じ挙動)。
+        size_t found = npos;
+        for (size_t child = FirstChild(objectIndex); child != npos; child = NextSibling(objectIndex, child))
+        {
+            if (KeyEquals(child, key))
+            {
+                found = child + 1;
+            }
+        }
+        return found;
+    }
+
+    bool Utf8JsonReader::DecodeString(size_t stringIndex, std::wstring& out) const
+    {
+        out.clear();
+        if (m_tokens[stringIndex].Type != Utf8JsonTokenType::String)
+        {
+            return false;
+        }
+        std::string_view body = RawSpan(stringIndex);
+        if (!m_tokens[stringIndex].HasEscapes)
+        {
+            return AppendUtf8ToWide(body, out);
+        }
+        return DecodeJsonStringBody(body, [&](char32_t codePoint)
+        {
+            AppendCodePointWide(codePoint, out);
+        });
+    }
+
+    bool Utf8JsonReader::DecodeStringUtf8(size_t stringIndex, std::string& out) const
+    {
+        out.clear();
+        if (m_tokens[stringIndex].Type != Utf8JsonTokenType::String)
+        {
+            return false;
+        }
+        return DecodeJsonStringBody(RawSpan(stringIndex), [&](char32_t codePoint)
+        {
+            AppendCodePointUtf8(codePoint, out);
+        });
+    }
+
+    bool Utf8JsonReader::TryGetString(size_t objectIndex, std::string_view key, std::wstring& out) const
+    {
+        size_t value = FindMember(objectIndex, key);
+        if (value == npos || m_tokens[value].Type != Utf8JsonTokenType::String)
+        {
+            return false;
+        }
+        return DecodeString(value, out);
+    }
+
+    bool Utf8JsonReader::TryGetStringUtf8(size_t objectIndex, std::string_view key, std::string& out) const
+    {
+        size_t value = FindMember(objectIndex, key);
+        if (value == npos || m_tokens[value].Type != Utf8JsonTokenType::String)
+        {
+            return false;
+        }
+        return DecodeStringUtf8(value, out);
+    }
+
+    bool Utf8JsonReader::TryGetBool(size_t objectIndex, std::string_view key, bool& out) const
+    {
+        size_t value = FindMember(objectIndex, key);
+        if (value == npos || m_tokens[value].Type != Utf8JsonTokenType::Bool)
+        {
+            return false;
+        }
+        out = m_tokens[value].BoolValue;
+        return true;
+    }
+
+    bool Utf8JsonReader::TryGetInt64(size_t objectIndex, std::string_view key, int64_t& out) const
+    {
+        size_t value = FindMember(objectIndex, key);
+        if (value == npos || m_tokens[value].Type != Utf8JsonTokenType::Number)
+        {
+            return false;
+        }
+        std::string_view raw = RawSpan(value);
+        int64_t parsed = 0;
+        auto [end, ec] = std::from_chars(raw.data(), raw.data() + raw.size(), parsed);
+        if (ec != std::errc{} || end != raw.data() + raw.size())
+        {
+            return false;
+        }
+        out = parsed;
+        return true;
+    }
+
+    bool Utf8JsonReader::TryGetObject(size_t objectIndex, std::string_view key, size_t& outObjectIndex) const
+    {
+        size_t value = FindMember(objectIndex, key);
+        if (value == npos || m_tokens[value].Type != Utf8JsonTokenType::Object)
+        {
+            return false;
+        }
+        outObjectIndex = value;
+        return true;
+    }
+
+    bool Utf8JsonReader::TryGetArray(size_t objectIndex, std::string_view key, size_t& outArrayIndex) const
+    {
+        size_t value = FindMember(objectIndex, key);
+        if (value == npos || m_tokens[value].Type != Utf8JsonTokenType::Array)
+        {
+            return false;
+        }
+        outArrayIndex = value;
+        return true;
+    }
+
+    void Utf8JsonWriter::Reset()
+    {
+        m_buffer.clear();
+        m_depth = 0;
+        m_needsComma = 0;
+        m_afterKey = false;
+    }
+
+    Utf8JsonWriter::Mark Utf8JsonWriter::GetMark() const
+    {
+        return Mark{ m_buffer.size(), m_depth, m_needsComma, m_afterKey };
+    }
+
+    void Utf8JsonWriter::Rewind(Mark const& mark)
+    {
+        m_buffer.resize(mark.Size);
+        m_depth = mark.Depth;
+        m_needsComma = mark.NeedsComma;
+        m_afterKey = mark.AfterKey;
+    }
+
+    void Utf8JsonWriter::BeforeValue()
+    {
+        if (m_afterKey)
+        {
+            m_afterKey = false;
+            return;
+        }
+        uint64_t bit = uint64_t{ 1 } << (m_depth % kMaxDepth);
+        if (m_needsComma & bit)
+        {
+            m_buffer.push_back(',');
+        }
+        m_needsComma |= bit;
+    }
+
+    void Utf8JsonWriter::BeginObject()
+    {
+        BeforeValue();
+        m_buffer.push_back('{');
+        ++m_depth;
+        m_needsComma &= ~(uint64_t{ 1 } << (m_depth % kMaxDepth));
+    }
+
+    void Utf8JsonWriter::EndObject()
+    {
+        m_buffer.push_back('}');
+        --m_depth;
+    }
+
+    void Utf8JsonWriter::BeginArray()
+    {
+        BeforeValue();
+        m_buffer.push_back('[');
+        ++m_depth;
+        m_needsComma &= ~(uint64_t{ 1 } << (m_depth % kMaxDepth));
+    }
+
+    void Utf8JsonWriter::EndArray()
+    {
+        m_buffer.push_back(']');
+        --m_depth;
+    }
+
+    void Utf8JsonWriter::Key(std::string_view asciiKey)
+    {
+        BeforeValue();
+        m_buffer.push_back('"');
+        AppendEscapedUtf8(asciiKey);
+        m_buffer.push_back('"');
+        m_buffer.push_back(':');
+        m_afterKey = true;
+    }
+
+    void Utf8JsonWriter::AppendEscapedCodePoint(char32_t codePoint)
+    {
+        static constexpr char kHex[] = "0123456789abcdef";
+        if (codePoint >= 0x20 && codePoint != U'"' && codePoint != U'\\')
+        {
+            AppendCodePointUtf8(codePoint, m_buffer);
+            return;
+        }
+
+        m_buffer.push_back('\\');
+        switch (codePoint)
+        {
+        case U'"': m_buffer.push_back('"'); break;
+        case U'\\': m_buffer.push_back('\\'); break;
+        case U'\b': m_buffer.push_back('b'); break;
+        case U'\f': m_buffer.push_back('f'); break;
+        case U'\n': m_buffer.push_back('n'); break;
+        case U'\r': m_buffer.push_back('r'); break;
+        case U'\t': m_buffer.push_back('t'); break;
+        default:
+            m_buffer.append("u00", 3);
+            m_buffer.push_back(kHex[(codePoint >> 4) & 0x0F]);
+            m_buffer.push_back(kHex[codePoint & 0x0F]);
+            break;
+        }
+    }
+
+    void Utf8JsonWriter::AppendEscapedUtf8(std::string_view value)
+    {
+        size_t runStart = 0;
+        for (size_t i = 0; i < value.size(); ++i)
+        {
+            unsigned char c = static_cast<unsigned char>(value[i]);
+            if (c >= 0x20 && c != '"' && c != '\\')
+            {
+                continue;
+            }
+            m_buffer.append(value.data() + runStart, i - runStart);
+            runStart = i + 1;
+            AppendEscapedCodePoint(c);
+        }
+        m_buffer.append(value.data() + runStart, value.size() - runStart);
+    }
+
+    void Utf8JsonWriter::String(std::wstring_view value)
+    {
+        BeforeValue();
+        m_buffer.push_back('"');
+        ForEachWideCodePoint(value, [&](char32_t codePoint)
+        {
+            AppendEscapedCodePoint(codePoint);
+        });
+        m_buffer.push_back('"');
+    }
+
+    void Utf8JsonWriter::StringUtf8(std::string_view value)
+    {
+        BeforeValue();
+        m_buffer.push_back('"');
+        AppendEscapedUtf8(value);
+        m_buffer.push_back('"');
+    }
+
+    void Utf8JsonWriter::RawEscapedString(std::string_view escaped)
+    {
+        BeforeValue();
+        m_buffer.push_back('"');
+        m_buffer.append(escaped.data(), escaped.size());
+        m_buffer.push_back('"');
+    }
+
+    void Utf8JsonWriter::RawEscapedKey(std::string_view escaped)
+    {
+        BeforeValue();
+        m_buffer.push_back('"');
+        m_buffer.append(escaped.data(), escaped.size());
+        m_buffer.push_back('"');
+        m_buffer.push_back(':');
+        m_afterKey = true;
+    }
+
+    void Utf8JsonWriter::RawNumber(std::string_view number)
+    {
+        BeforeValue();
+        m_buffer.append(number.data(), number.size());
+    }
+
+    void Utf8JsonWriter::Bool(bool value)
+    {
+        BeforeValue();
+        if (value)
+        {
+            m_buffer.append("true", 4);
+        }
+        else
+        {
+            m_buffer.append("false", 5);
+        }
+    }
+
+    void Utf8JsonWriter::Int64(int64_t value)
+    {
+        BeforeValue();
+        char digits[24]{};
+        auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+        m_buffer.append(digits, static_cast<size_t>(end - digits));
+    }
+
+    void Utf8JsonWriter::UInt64(uint64_t value)
+    {
+        BeforeValue();
+        char digits[24]{};
+        auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+        m_buffer.append(digits, static_cast<size_t>(end - digits));
+    }
+
+    void Utf8JsonWriter::Double(double value)
+    {
+        BeforeValue();
+        if (!std::isfinite(value))
+        {
+            m_buffer.append("null", 4);
+            return;
+        }
+        char digits[32]{};
+        auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+        m_buffer.append(digits, static_cast<size_t>(end - digits));
+    }
+
+    void Utf8JsonWriter::Null()
+    {
+        BeforeValue();
+        m_buffer.append("null", 4);
+    }
+
+    void CopyJsonValue(
+        Utf8JsonReader const& reader,
+        size_t valueIndex,
+        Utf8JsonWriter& writer,
+        std::string_view redactedKey)
+    {
+        Utf8JsonToken const& token = reader.Token(valueIndex);
+        switch (token.Type)
+        {
+        case Utf8JsonTokenType::Null:
+            writer.Null();
+            break;
+        case Utf8JsonTokenType::Bool:
+            writer.Bool(token.BoolValue);
+            break;
+        case Utf8JsonTokenType::Number:
+            writer.RawNumber(reader.RawSpan(valueIndex));
+            break;
+        case Utf8JsonTokenType::String:
+            writer.RawEscapedString(reader.RawSpan(valueIndex));
+            break;
+        case Utf8JsonTokenType::Array:
+            writer.BeginArray();
+            for (size_t child = reader.FirstChild(valueIndex); child != Utf8JsonReader::npos; child = reader.NextSibling(valueIndex, child))
+            {
+                CopyJsonValue(reader, child, writer, redactedKey);
+            }
+            writer.EndArray();
+            break;
+        case Utf8JsonTokenType::Object:
+            writer.BeginObject();
+            for (size_t child = reader.FirstChild(valueIndex); child != Utf8JsonReader::npos; child = reader.NextSibling(valueIndex, child))
+            {
+                std::string_view key = reader.RawSpan(child);
+                writer.RawEscapedKey(key);
+                if (!redactedKey.empty() && key == redactedKey)
+                {
+                    writer.StringUtf8("<redacted>");
+                }
+                else
+                {
+                    CopyJsonValue(reader, child + 1, writer, redactedKey);
+                }
+            }
+            writer.EndObject();
+            break;
+        }
+    }
+
+    bool RunNativeMessagingJsonRegressionTests(std::wstring& outError)
+    {
+        outError.clear();
+
+        Utf8JsonReader reader;
+        std::string_view request =
+            "{\"id\":\"req-\\\"1\\\"\",\"version\":1,\"command\":\"vault.login.get\","
+            "\"payload\":{\"itemId\":\"\\u30c6\\u30b9\\u30c8\",\"includeSecret\":true,\"nested\":[1,2.5e3,null,{\"a\":false}]}}";
+        if (!reader.Parse(request))
+        {
+            outError = L"envelope_parse_failed";
+            return false;
+        }
+
+        std::wstring command;
+        if (!reader.TryGetString(Utf8JsonReader::Root, "command", command) || command != L"vault.login.get")
+        {
+            outError = L"command_mismatch";
+            return false;
+        }
+
+        size_t idIndex = reader.FindMember(Utf8JsonReader::Root, "id");
+        if (idIndex == Utf8JsonReader::npos || reader.RawSpan(idIndex) != "req-\\\"1\\\"")
+        {
+            outError = L"raw_id_mismatch";
+            return false;
+        }
+
+        size_t payload = 0;
+        std::wstring itemId;
+        bool includeSecret = false;
+        int64_t version = 0;
+        if (!reader.TryGetObject(Utf8JsonReader::Root, "payload", payload) ||
+            !reader.TryGetString(payload, "itemId", itemId) ||
+            itemId != L"テスト" ||
+            !reader.TryGetBool(payload, "includeSecret", includeSecret) ||
+            !includeSecret ||
+            !reader.TryGetInt64(Utf8JsonReader::Root, "version", version) ||
+            version != 1)
+        {
+            outError = L"payload_value_mismatch";
+            return false;
+        }
+
+        std::string_view malformed[] = {
+            "",
+            "{",
+            "{\"a\":}",
+            "{\"a\":1,}",
+            "[1 2]",
+            "{\"a\":\"\x01\"}",
+            "{\"a\":01}",
+            "{\"a\":tru}",
+            "{} x",
+        };
+        for (auto const& input : malformed)
+        {
+            if (reader.Parse(input))
+            {
+                outError = L"malformed_input_accepted";
+                return false;
+            }
+        }
+
+        Utf8JsonWriter writer;
+        writer.BeginObject();
+        writer.Key("id");
+        writer.RawEscapedString("req-\\\"1\\\"");
+        writer.Property("ok", true);
+        writer.Key("result");
+        Utf8JsonWriter::Mark mark = writer.GetMark();
+        writer.BeginObject();
+        writer.Property("discarded", true);
+        writer.Rewind(mark);
+        writer.BeginObject();
+        writer.Property("title", L"a\"b\\c\n\U0001F511");
+        writer.Property("count", int64_t{ -42 });
+        writer.Key("items");
+        writer.BeginArray();
+        writer.Null();
+        writer.Bool(false);
+        writer.EndArray();
+        writer.EndObject();
+        writer.NullProperty("error");
+        writer.EndObject();
+
+        std::string_view expected =
+            "{\"id\":\"req-\\\"1\\\"\",\"ok\":true,\"result\":{\"title\":\"a\\\"b\\\\c\\n\xF0\x9F\x94\x91\","
+            "\"count\":-42,\"items\":[null,false]},\"error\":null}";
+        if (writer.View() != expected)
+        {
+            outError = L"writer_output_mismatch";
+            return false;
+        }
+
+        if (!reader.Parse(writer.View()))
+        {
+            outError = L"writer_output_not_parseable";
+            return false;
+        }
+        size_t result = 0;
+        std::wstring title;
+        if (!reader.TryGetObject(Utf8JsonReader::Root, "result", result) ||
+            !reader.TryGetString(result, "title", title) ||
+            title != L"a\"b\\c\n\U0001F511")
+        {
+            outError = L"writer_roundtrip_mismatch";
+            return false;
+        }
+
+        std::string_view nested = "{\"a\":[1,-2.5e3,true,null],\"password\":\"x\",\"o\":{\"password\":\"y\",\"k\":\"v\\n\"}}";
+        if (!reader.Parse(nested))
+        {
+            outError = L"copy_source_parse_failed";
+            return false;
+        }
+        writer.Reset();
+        CopyJsonValue(reader, Utf8JsonReader::Root, writer, "password");
+        if (writer.View() != "{\"a\":[1,-2.5e3,true,null],\"password\":\"<redacted>\",\"o\":{\"password\":\"<redacted>\",\"k\":\"v\\n\"}}")
+        {
+            outError = L"copy_redaction_mismatch";
+            return false;
+        }
+
+        std::wstring wide;
+        if (AppendUtf8ToWide("\xC0\xAF", wide) || AppendUtf8ToWide("\xED\xA0\x80", wide))
+        {
+            outError = L"invalid_utf8_accepted";
+            return false;
+        }
+
+        return true;
+    }
+}
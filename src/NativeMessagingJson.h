@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tsupasswd
+{
+    // UTF-8 <-> wchar_t 変換。wchar_t が 16bit (Windows) なら UTF-16、32bit なら UTF-32 として扱う。
+    // 出力先は append のみ行うため、呼び出し側が clear() して再利用すれば定常状態ではヒープ確保が発生しない。
+    bool AppendUtf8ToWide(std::string_view utf8, std::wstring& out);
+    void AppendWideToUtf8(std::wstring_view wide, std::string& out);
+
+    enum class Utf8JsonTokenType : uint8_t
+    {
+        Null = 0,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object,
+    };
+
+    struct Utf8JsonToken
+    {
+        Utf8JsonTokenType Type{ Utf8JsonTokenType::Null };
+        bool HasEscapes{ false };
+        bool BoolValue{ false };
+        // String は引用符を除いた生の範囲、それ以外は値全体の範囲。
+        uint32_t Begin{ 0 };
+        uint32_t End{ 0 };
+        // この値 (子要素を含む) の次のトークン位置。
+        uint32_t Next{ 0 };
+    };
+
+    // Native Messaging の request envelope 用の UTF-8 JSON リーダー。
+    // 入力バッファを指したままトークン列だけを作るため、Parse を繰り返しても token 配列の容量が使い回される。
+    // 入力バッファは Parse 後の参照中に変更してはならない。
+    class Utf8JsonReader final
+    {
+    public:
+        static constexpr size_t npos = static_cast<size_t>(-1);
+        static constexpr size_t Root = 0;
+
+        bool Parse(std::string_view json);
+
+        Utf8JsonToken const& Token(size_t index) const { return m_tokens[index]; }
+        size_t TokenCount() const { return m_tokens.size(); }
+        std::string_view RawSpan(size_t index) const;
+
+        size_t FindMember(size_t objectIndex, std::string_view key) const;
+
+        bool TryGetString(size_t objectIndex, std::string_view key, std::wstring& out) const;
+        bool TryGetStringUtf8(size_t objectIndex, std::string_view key, std::string& out) const;
+        bool TryGetBool(size_t objectIndex, std::string_view key, bool& out) const;
+        bool TryGetInt64(size_t objectIndex, std::string_view key, int64_t& out) const;
+        bool TryGetObject(size_t objectIndex, std::string_view key, size_t& outObjectIndex) const;
+        bool TryGetArray(size_t objectIndex, std::string_view key, size_t& outArrayIndex) const;
+
+        // 配列/オブジェクトの子要素を走査する。オブジェクトの場合は key トークンを返す (値は +1)。
+        size_t FirstChild(size_t containerIndex) const;
+        size_t NextSibling(size_t containerIndex, size_t childIndex) const;
+
+        bool DecodeString(size_t stringIndex, std::wstring& out) const;
+        bool DecodeStringUtf8(size_t stringIndex, std::string& out) const;
+
+    private:
+        bool ParseValue(size_t& cursor, uint32_t depth);
+        bool ParseString(size_t& cursor, Utf8JsonToken& token) const;
+        bool ParseNumber(size_t& cursor) const;
+        bool ParseLiteral(size_t& cursor, std::string_view literal) const;
+        void SkipWhitespace(size_t& cursor) const;
+        bool KeyEquals(size_t keyIndex, std::string_view key) const;
+
+        std::string_view m_json{};
+        std::vector<Utf8JsonToken> m_tokens;
+        mutable std::string m_keyScratch;
+    };
+
+    // Native Messaging の response/event 用の UTF-8 JSON ライター。
+    // Reset() は容量を保持したまま内容だけを捨てるので、同じインスタンスを毎メッセージ使い回す。
+    class Utf8JsonWriter final
+    {
+    public:
+        struct Mark
+        {
+            size_t Size{ 0 };
+            uint32_t Depth{ 0 };
+            uint64_t NeedsComma{ 0 };
+            bool AfterKey{ false };
+        };
+
+        static constexpr uint32_t kMaxDepth = 64;
+
+        void Reset();
+        void Reserve(size_t bytes) { m_buffer.reserve(bytes); }
+        std::string_view View() const { return m_buffer; }
+        size_t Size() const { return m_buffer.size(); }
+
+        // handler が途中まで result を書いた後に失敗した場合に巻き戻すための位置。
+        Mark GetMark() const;
+        void Rewind(Mark const& mark);
+
+        void BeginObject();
+        void EndObject();
+        void BeginArray();
+        void EndArray();
+        void Key(std::string_view asciiKey);
+
+        void String(std::wstring_view value);
+        void StringUtf8(std::string_view value);
+        // 既に JSON エスケープ済みの文字列本体 (引用符なし) をそのまま書き込む。request の id のエコーに使う。
+        void RawEscapedString(std::string_view escaped);
+        void RawEscapedKey(std::string_view escaped);
+        // 検証済みの JSON 数値リテラルをそのまま書き込む。
+        void RawNumber(std::string_view number);
+        void Bool(bool value);
+        void Int64(int64_t value);
+        void UInt64(uint64_t value);
+        void Double(double value);
+        void Null();
+
+        void Property(std::string_view key, std::wstring_view value) { Key(key); String(value); }
+        void Property(std::string_view key, wchar_t const* value) { Key(key); String(value); }
+        void Property(std::string_view key, bool value) { Key(key); Bool(value); }
+        void Property(std::string_view key, int64_t value) { Key(key); Int64(value); }
+        void Property(std::string_view key, uint64_t value) { Key(key); UInt64(value); }
+        void NullProperty(std::string_view key) { Key(key); Null(); }
+
+    private:
+        void BeforeValue();
+        void AppendEscapedUtf8(std::string_view value);
+        void AppendEscapedCodePoint(char32_t codePoint);
+
+        std::string m_buffer;
+        uint32_t m_depth{ 0 };
+        uint64_t m_needsComma{ 0 };
+        bool m_afterKey{ false };
+    };
+
+    // reader の値 (子要素を含む) を writer にそのまま書き写す。redactedKey に一致するメンバーの値は
+    // "<redacted>" に置き換える (セッション記録で password を残さないため)。
+    void CopyJsonValue(
+        Utf8JsonReader const& reader,
+        size_t valueIndex,
+        Utf8JsonWriter& writer,
+        std::string_view redactedKey = {});
+
+    bool RunNativeMessagingJsonRegressionTests(std::wstring& outError);
+}
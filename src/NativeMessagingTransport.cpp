@@ -0,0 +1,283 @@
+#include "NativeMessagingTransport.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace tsupasswd
+{
+    NativeFrameReadResult ReadNativeMessageFrame(
+        INativeMessageTransport& transport,
+        std::string& buffer,
+        uint32_t maxMessageBytes)
+    {
+        uint32_t messageSize = 0;
+        if (!transport.ReadExact(&messageSize, sizeof(messageSize)))
+        {
+            return NativeFrameReadResult::EndOfStream;
+        }
+        if (messageSize == 0 || messageSize > maxMessageBytes)
+        {
+            return NativeFrameReadResult::InvalidLength;
+        }
+
+        buffer.resize(messageSize);
+        if (!transport.ReadExact(buffer.data(), messageSize))
+        {
+            return NativeFrameReadResult::Truncated;
+        }
+        return NativeFrameReadResult::Ok;
+    }
+
+    bool WriteNativeMessageFrame(INativeMessageTransport& transport, std::string_view message)
+    {
+        if (message.size() > std::numeric_limits<uint32_t>::max())
+        {
+            return false;
+        }
+        uint32_t size = static_cast<uint32_t>(message.size());
+        return transport.WriteExact(&size, sizeof(size)) &&
+            transport.WriteExact(message.data(), message.size());
+    }
+
+#ifdef _WIN32
+    namespace
+    {
+        bool IsPipeHandle(HANDLE handle)
+        {
+            if (handle == nullptr || handle == INVALID_HANDLE_VALUE)
+            {
+                return false;
+            }
+
+            DWORD type = GetFileType(handle);
+            return type == FILE_TYPE_PIPE;
+        }
+    }
+
+    bool AreStandardStreamsPipes()
+    {
+        return IsPipeHandle(GetStdHandle(STD_INPUT_HANDLE)) && IsPipeHandle(GetStdHandle(STD_OUTPUT_HANDLE));
+    }
+
+    std::unique_ptr<INativeMessageTransport> CreateStandardStreamTransport()
+    {
+        HANDLE stdinHandle = GetStdHandle(STD_INPUT_HANDLE);
+        HANDLE stdoutHandle = GetStdHandle(STD_OUTPUT_HANDLE);
+        if (stdinHandle == INVALID_HANDLE_VALUE || stdoutHandle == INVALID_HANDLE_VALUE)
+        {
+            return nullptr;
+        }
+        return std::make_unique<Win32HandleTransport>(stdinHandle, stdoutHandle);
+    }
+
+    Win32HandleTransport::Win32HandleTransport(void* readHandle, void* writeHandle) :
+        m_readHandle(readHandle),
+        m_writeHandle(writeHandle)
+    {
+    }
+
+    bool Win32HandleTransport::ReadExact(void* buffer, size_t size)
+    {
+        BYTE* cursor = static_cast<BYTE*>(buffer);
+        size_t remaining = size;
+        while (remaining > 0)
+        {
+            DWORD chunk = static_cast<DWORD>(std::min<size_t>(remaining, MAXDWORD));
+            DWORD read = 0;
+            if (!ReadFile(static_cast<HANDLE>(m_readHandle), cursor, chunk, &read, nullptr) || read == 0)
+            {
+                return false;
+            }
+            cursor += read;
+            remaining -= read;
+        }
+        return true;
+    }
+
+    bool Win32HandleTransport::WriteExact(void const* buffer, size_t size)
+    {
+        BYTE const* cursor = static_cast<BYTE const*>(buffer);
+        size_t remaining = size;
+        while (remaining > 0)
+        {
+            DWORD chunk = static_cast<DWORD>(std::min<size_t>(remaining, MAXDWORD));
+            DWORD written = 0;
+            if (!WriteFile(static_cast<HANDLE>(m_writeHandle), cursor, chunk, &written, nullptr) || written == 0)
+            {
+                return false;
+            }
+            cursor += written;
+            remaining -= written;
+        }
+        return true;
+    }
+#else
+    namespace
+    {
+        bool IsPipeFd(int fd)
+        {
+            struct stat info{};
+            if (fstat(fd, &info) != 0)
+            {
+                return false;
+            }
+            return S_ISFIFO(info.st_mode) || S_ISSOCK(info.st_mode);
+        }
+    }
+
+    bool AreStandardStreamsPipes()
+    {
+        return IsPipeFd(STDIN_FILENO) && IsPipeFd(STDOUT_FILENO);
+    }
+
+    std::unique_ptr<INativeMessageTransport> CreateStandardStreamTransport()
+    {
+        return std::make_unique<PosixFdTransport>(STDIN_FILENO, STDOUT_FILENO);
+    }
+
+    PosixFdTransport::PosixFdTransport(int readFd, int writeFd) :
+        m_readFd(readFd),
+        m_writeFd(writeFd)
+    {
+    }
+
+    bool PosixFdTransport::ReadExact(void* buffer, size_t size)
+    {
+        auto* cursor = static_cast<unsigned char*>(buffer);
+        size_t remaining = size;
+        while (remaining > 0)
+        {
+            ssize_t read = ::read(m_readFd, cursor, remaining);
+            if (read < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (read <= 0)
+            {
+                return false;
+            }
+            cursor += read;
+            remaining -= static_cast<size_t>(read);
+        }
+        return true;
+    }
+
+    bool PosixFdTransport::WriteExact(void const* buffer, size_t size)
+    {
+        auto const* cursor = static_cast<unsigned char const*>(buffer);
+        size_t remaining = size;
+        while (remaining > 0)
+        {
+            ssize_t written = ::write(m_writeFd, cursor, remaining);
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                return false;
+            }
+            cursor += written;
+            remaining -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+#endif
+
+    bool InMemoryByteChannel::Read(void* buffer, size_t size)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [&]()
+        {
+            return m_closed || m_data.size() - m_readOffset >= size;
+        });
+        if (m_data.size() - m_readOffset < size)
+        {
+            return false;
+        }
+
+        memcpy(buffer, m_data.data() + m_readOffset, size);
+        m_readOffset += size;
+        // 読み切ったら先頭に詰め直す。容量はそのまま残る。
+        if (m_readOffset == m_data.size())
+        {
+            m_data.clear();
+            m_readOffset = 0;
+        }
+        return true;
+    }
+
+    bool InMemoryByteChannel::Write(void const* buffer, size_t size)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_closed)
+            {
+                return false;
+            }
+            m_data.append(static_cast<char const*>(buffer), size);
+        }
+        m_cv.notify_all();
+        return true;
+    }
+
+    void InMemoryByteChannel::Close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_cv.notify_all();
+    }
+
+    InMemoryTransport::InMemoryTransport(std::shared_ptr<InMemoryByteChannel> inbound, std::shared_ptr<InMemoryByteChannel> outbound) :
+        m_inbound(std::move(inbound)),
+        m_outbound(std::move(outbound))
+    {
+    }
+
+    InMemoryTransport::~InMemoryTransport()
+    {
+        CloseWrite();
+    }
+
+    bool InMemoryTransport::ReadExact(void* buffer, size_t size)
+    {
+        return m_inbound->Read(buffer, size);
+    }
+
+    bool InMemoryTransport::WriteExact(void const* buffer, size_t size)
+    {
+        return m_outbound->Write(buffer, size);
+    }
+
+    void InMemoryTransport::CloseWrite()
+    {
+        m_outbound->Close();
+    }
+
+    std::pair<std::unique_ptr<InMemoryTransport>, std::unique_ptr<InMemoryTransport>> CreateInMemoryTransportPair()
+    {
+        auto firstToSecond = std::make_shared<InMemoryByteChannel>();
+        auto secondToFirst = std::make_shared<InMemoryByteChannel>();
+        return {
+            std::make_unique<InMemoryTransport>(secondToFirst, firstToSecond),
+            std::make_unique<InMemoryTransport>(firstToSecond, secondToFirst),
+        };
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace tsupasswd
+{
+    // Native Messaging のバイトストリーム。フレーミング (4byte 長 + UTF-8 本文) はこの上で行う。
+    class INativeMessageTransport
+    {
+    public:
+        virtual ~INativeMessageTransport() = default;
+
+        // size バイトちょうどを読む。EOF またはエラーで false。
+        virtual bool ReadExact(void* buffer, size_t size) = 0;
+        // size バイトちょうどを書く。エラーで false。
+        virtual bool WriteExact(void const* buffer, size_t size) = 0;
+    };
+
+    enum class NativeFrameReadResult
+    {
+        Ok = 0,
+        EndOfStream,
+        InvalidLength,
+        Truncated,
+    };
+
+    // 受信バッファは resize するだけなので、容量が足りていれば再確保しない。
+    NativeFrameReadResult ReadNativeMessageFrame(
+        INativeMessageTransport& transport,
+        std::string& buffer,
+        uint32_t maxMessageBytes);
+
+    bool WriteNativeMessageFrame(INativeMessageTransport& transport, std::string_view message);
+
+    // 標準入出力が両方とも pipe (POSIX では FIFO/socket も含む) かどうか。
+    // ブラウザから起動されたかどうかの判定に使う。
+    bool AreStandardStreamsPipes();
+
+    // 標準入出力を使う既定の transport。Windows は HANDLE、それ以外は fd 0/1。
+    std::unique_ptr<INativeMessageTransport> CreateStandardStreamTransport();
+
+#ifdef _WIN32
+    class Win32HandleTransport final : public INativeMessageTransport
+    {
+    public:
+        Win32HandleTransport(void* readHandle, void* writeHandle);
+
+        bool ReadExact(void* buffer, size_t size) override;
+        bool WriteExact(void const* buffer, size_t size) override;
+
+    private:
+        void* m_readHandle{ nullptr };
+        void* m_writeHandle{ nullptr };
+    };
+#else
+    class PosixFdTransport final : public INativeMessageTransport
+    {
+    public:
+        PosixFdTransport(int readFd, int writeFd);
+
+        bool ReadExact(void* buffer, size_t size) override;
+        bool WriteExact(void const* buffer, size_t size) override;
+
+    private:
+        int m_readFd{ -1 };
+        int m_writeFd{ -1 };
+    };
+#endif
+
+    // 片方向のインメモリバイト列。書き込み側が Close すると、読み切った後の ReadExact は false を返す。
+    class InMemoryByteChannel final
+    {
+    public:
+        bool Read(void* buffer, size_t size);
+        bool Write(void const* buffer, size_t size);
+        void Close();
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::string m_data;
+        size_t m_readOffset{ 0 };
+        bool m_closed{ false };
+    };
+
+    class InMemoryTransport final : public INativeMessageTransport
+    {
+    public:
+        InMemoryTransport(std::shared_ptr<InMemoryByteChannel> inbound, std::shared_ptr<InMemoryByteChannel> outbound);
+        ~InMemoryTransport() override;
+
+        bool ReadExact(void* buffer, size_t size) override;
+        bool WriteExact(void const* buffer, size_t size) override;
+
+        // 相手側に EOF を通知する。
+        void CloseWrite();
+
+    private:
+        std::shared_ptr<InMemoryByteChannel> m_inbound;
+        std::shared_ptr<InMemoryByteChannel> m_outbound;
+    };
+
+    // first 側の書き込みは second 側で読め、その逆も同様。
+    std::pair<std::unique_ptr<InMemoryTransport>, std::unique_ptr<InMemoryTransport>> CreateInMemoryTransportPair();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+// Windows 以外 (tools/ の負荷試験ツール) でもビルドする同期コード用の HRESULT と Win32 エラー値。
+// Windows では SDK の定義をそのまま使い、値は SDK と一致させる。
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <winhttp.h>
+#else
+#include <cstdint>
+
+using HRESULT = int32_t;
+
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_NOTIMPL ((HRESULT)0x80004001L)
+#define E_ABORT ((HRESULT)0x80004004L)
+#define E_FAIL ((HRESULT)0x80004005L)
+#define E_UNEXPECTED ((HRESULT)0x8000FFFFL)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000EL)
+#define E_INVALIDARG ((HRESULT)0x80070057L)
+
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+
+constexpr HRESULT HRESULT_FROM_WIN32(unsigned long error) noexcept
+{
+    return static_cast<HRESULT>(error) <= 0
+        ? static_cast<HRESULT>(error)
+        : static_cast<HRESULT>((error & 0x0000FFFFul) | (7ul << 16) | 0x80000000ul);
+}
+
+#define ERROR_ACCESS_DENIED 5L
+#define ERROR_INVALID_DATA 13L
+#define ERROR_NOT_SUPPORTED 50L
+#define ERROR_INVALID_PARAMETER 87L
+#define ERROR_NOT_FOUND 1168L
+#define ERROR_CANCELLED 1223L
+#define ERROR_RETRY 1237L
+#define ERROR_ACCESS_DISABLED_BY_POLICY 1260L
+#define ERROR_REVISION_MISMATCH 1306L
+#define ERROR_TIMEOUT 1460L
+
+#define ERROR_WINHTTP_TIMEOUT 12002L
+#define ERROR_WINHTTP_INVALID_URL 12005L
+#define ERROR_WINHTTP_NAME_NOT_RESOLVED 12007L
+#define ERROR_WINHTTP_CANNOT_CONNECT 12029L
+#define ERROR_WINHTTP_CONNECTION_ERROR 12030L
+#define ERROR_WINHTTP_INVALID_SERVER_RESPONSE 12152L
+#define ERROR_WINHTTP_SECURE_FAILURE 12175L
+#endif
@@ -0,0 +1,1066 @@
+#include "PosixSyncTransport.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <new>
+#include <optional>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef TSUPASSWD_SYNC_TRANSPORT_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif
+
+namespace tsupasswd
+{
+    namespace
+    {
+        // WinHTTP の WINHTTP_OPTION_MAX_CONNS_PER_SERVER と揃える。
+        constexpr size_t kMaxIdleConnectionsPerOrigin = 8;
+        constexpr size_t kMaxHeaderBytes = 64 * 1024;
+        constexpr size_t kReadChunkBytes = 16 * 1024;
+        // これより小さい body はヘッダーと 1 回の write にまとめる。
+        constexpr size_t kCoalesceBodyBytes = 64 * 1024;
+
+        constexpr HRESULT kHrTimeout = HRESULT_FROM_WIN32(ERROR_WINHTTP_TIMEOUT);
+        constexpr HRESULT kHrNameNotResolved = HRESULT_FROM_WIN32(ERROR_WINHTTP_NAME_NOT_RESOLVED);
+        constexpr HRESULT kHrCannotConnect = HRESULT_FROM_WIN32(ERROR_WINHTTP_CANNOT_CONNECT);
+        constexpr HRESULT kHrConnectionError = HRESULT_FROM_WIN32(ERROR_WINHTTP_CONNECTION_ERROR);
+        constexpr HRESULT kHrInvalidResponse = HRESULT_FROM_WIN32(ERROR_WINHTTP_INVALID_SERVER_RESPONSE);
+        constexpr HRESULT kHrSecureFailure = HRESULT_FROM_WIN32(ERROR_WINHTTP_SECURE_FAILURE);
+        constexpr HRESULT kHrCancelled = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+
+        char ToLowerAscii(char c) noexcept
+        {
+            return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+        }
+
+        bool ContainsTokenIgnoreCase(std::string_view value, std::string_view token) noexcept
+        {
+            if (token.size() > value.size())
+            {
+                return false;
+            }
+            for (size_t i = 0; i + token.size() <= value.size(); ++i)
+            {
+                size_t j = 0;
+                while (j < token.size() && ToLowerAscii(value[i + j]) == token[j])
+                {
+                    ++j;
+                }
+                if (j == token.size())
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::string_view TrimHttpWhitespace(std::string_view value) noexcept
+        {
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            {
+                value.remove_prefix(1);
+            }
+            while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+            {
+                value.remove_suffix(1);
+            }
+            return value;
+        }
+
+        int32_t ElapsedMs(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) noexcept
+        {
+            return static_cast<int32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+        }
+
+        // 送受信を待つ 1 回の Send の条件。CancelFd は取消時に読めるようになる pipe (取消できない要求では -1)。
+        struct WaitContext
+        {
+            int32_t TimeoutMs{ 15000 };
+            std::chrono::steady_clock::time_point Deadline{ std::chrono::steady_clock::time_point::max() };
+            int CancelFd{ -1 };
+        };
+
+        // 1 回の待ちは TimeoutMs まで。Deadline を過ぎていれば待たずに timeout。
+        HRESULT WaitSocket(int socket, short events, WaitContext const& wait) noexcept
+        {
+            pollfd fds[2]{};
+            fds[0].fd = socket;
+            fds[0].events = events;
+            fds[1].fd = wait.CancelFd;
+            fds[1].events = POLLIN;
+            nfds_t count = wait.CancelFd >= 0 ? 2 : 1;
+            for (;;)
+            {
+                int32_t timeoutMs = wait.TimeoutMs;
+                if (wait.Deadline != std::chrono::steady_clock::time_point::max())
+                {
+                    auto remaining = std::chrono::ceil<std::chrono::milliseconds>(wait.Deadline - std::chrono::steady_clock::now()).count();
+                    if (remaining <= 0)
+                    {
+                        return kHrTimeout;
+                    }
+                    if (timeoutMs < 0 || remaining < timeoutMs)
+                    {
+                        timeoutMs = static_cast<int32_t>(remaining);
+                    }
+                }
+                int rc = ::poll(fds, count, timeoutMs);
+                if (rc > 0)
+                {
+                    if (count == 2 && fds[1].revents != 0)
+                    {
+                        return kHrCancelled;
+                    }
+                    return S_OK;
+                }
+                if (rc == 0)
+                {
+                    return kHrTimeout;
+                }
+                if (errno != EINTR)
+                {
+                    return kHrConnectionError;
+                }
+            }
+        }
+
+        // 取消 callback から書き込んで poll を起こす pipe。取消できる要求のときだけ作る。
+        struct CancelPipe
+        {
+            int ReadFd{ -1 };
+            int WriteFd{ -1 };
+
+            CancelPipe() = default;
+            CancelPipe(CancelPipe const&) = delete;
+            CancelPipe& operator=(CancelPipe const&) = delete;
+
+            ~CancelPipe()
+            {
+                if (ReadFd >= 0)
+                {
+                    ::close(ReadFd);
+                }
+                if (WriteFd >= 0)
+                {
+                    ::close(WriteFd);
+                }
+            }
+
+            bool Open() noexcept
+            {
+                int fds[2]{ -1, -1 };
+                if (::pipe(fds) != 0)
+                {
+                    return false;
+                }
+                ReadFd = fds[0];
+                WriteFd = fds[1];
+                for (int fd : fds)
+                {
+                    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+                    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+                }
+                return true;
+            }
+
+            void Signal() noexcept
+            {
+                char byte = 1;
+                (void)::write(WriteFd, &byte, 1);
+            }
+        };
+    }
+
+    struct PosixSyncTransport::Connection
+    {
+        int Socket{ -1 };
+#ifdef TSUPASSWD_SYNC_TRANSPORT_OPENSSL
+        SSL* Tls{ nullptr };
+#endif
+        // 受信済みでまだ応答の解析に使っていないバイト列。
+        std::string Pending;
+        // この接続で送受信した HTTP のバイト数 (SyncRequestTiming の送受信量に使う)。
+        uint64_t BytesWritten{ 0 };
+        uint64_t BytesRead{ 0 };
+
+        Connection() = default;
+        Connection(Connection const&) = delete;
+        Connection& operator=(Connection const&) = delete;
+
+        ~Connection()
+        {
+#ifdef TSUPASSWD_SYNC_TRANSPORT_OPENSSL
+            if (Tls)
+            {
+                SSL_free(Tls);
+            }
+#endif
+            if (Socket >= 0)
+            {
+                ::close(Socket);
+            }
+        }
+
+        HRESULT WriteAll(std::string_view data, WaitContext const& wait) noexcept
+        {
+            while (!data.empty())
+            {
+#ifdef TSUPASSWD_SYNC_TRANSPORT_OPENSSL
+                if (Tls)
+                {
+                    int written = SSL_write(Tls, data.data(), static_cast<int>(std::min<size_t>(data.size(), INT_MAX)));
+                    if (written > 0)
+                    {
+                        BytesWritten += static_cast<uint64_t>(written);
+                        data.remove_prefix(static_cast<size_t>(written));
+                        continue;
+                    }
+                    HRESULT hr = WaitTls(written, wait);
+                    if (FAILED(hr))
+                    {
+                        return hr;
+                    }
+                    continue;
+                }
+#endif
+                ssize_t written = ::send(Socket, data.data(), data.size(), MSG_NOSIGNAL);
+                if (written > 0)
+                {
+                    BytesWritten += static_cast<uint64_t>(written);
+                    data.remove_prefix(static_cast<size_t>(written));
+                    continue;
+                }
+                if (written < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    HRESULT hr = WaitSocket(Socket, POLLOUT, wait);
+                    if (FAILED(hr))
+                    {
+                        return hr;
+                    }
+                    continue;
+                }
+                return kHrConnectionError;
+            }
+            return S_OK;
+        }
+
+        // outRead が 0 なら相手が接続を閉じた。
+        HRESULT ReadSome(char* buffer, size_t capacity, WaitContext const& wait, size_t& outRead) noexcept
+        {
+            outRead = 0;
+            for (;;)
+            {
+#ifdef TSUPASSWD_SYNC_TRANSPORT_OPENSSL
+                if (Tls)
+                {
+                    int read = SSL_read(Tls, buffer, static_cast<int>(std::min<size_t>(capacity, INT_MAX)));
+                    if (read > 0)
+                    {
+                        outRead = static_cast<size_t>(read);
+                        BytesRead += outRead;
+                        return S_OK;
+                    }
+                    if (SSL_get_error(Tls, read) == SSL_ERROR_ZERO_RETURN)
+                    {
+                        return S_OK;
+                    }
+                    HRESULT hr = WaitTls(read, wait);
+                    if (FAILED(hr))
+                    {
+                        return hr;
+                    }
+                    continue;
+                }
+#endif
+                ssize_t read = ::recv(Socket, buffer, capacity, 0);
+                if (read >= 0)
+                {
+                    outRead = static_cast<size_t>(read);
+                    BytesRead += outRead;
+                    return S_OK;
+                }
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    HRESULT hr = WaitSocket(Socket, POLLIN, wait);
+                    if (FAILED(hr))
+                    {
+                        return hr;
+                    }
+                    continue;
+                }
+                return kHrConnectionError;
+            }
+        }
+
+        // Pending に 1 回分読み足す。outClosed は相手が閉じていたことを示す。
+        HRESULT Fill(WaitContext const& wait, bool& outClosed)
+        {
+            size_t oldSize = Pending.size();
+            Pending.resize(oldSize + kReadChunkBytes);
+            size_t read = 0;
+            HRESULT hr = ReadSome(Pending.data() + oldSize, kReadChunkBytes, wait, read);
+            Pending.resize(oldSize + read);
+            outClosed = SUCCEEDED(hr) && read == 0;
+            return hr;
+        }
+
+#ifdef TSUPASSWD_SYNC_TRANSPORT_OPENSSL
+        HRESULT WaitTls(int result, WaitContext const& wait) noexcept
+        {
+            switch (SSL_get_error(Tls, result))
+            {
+            case SSL_ERROR_WANT_READ:
+                return WaitSocket(Socket, POLLIN, wait);
+            case SSL_ERROR_WANT_WRITE:
+                return WaitSocket(Socket, POLLOUT, wait);
+            default:
+                return kHrConnectionError;
+            }
+        }
+#endif
+    };
+
+    namespace
+    {
+        using Connection = PosixSyncTransport::Connection;
+
+        std::string BuildRequestHead(SyncTransportRequest const& request)
+        {
+            std::string head;
+            head.reserve(256 + request.Path.size());
+            head.append(request.Method);
+            head.push_back(' ');
+            head.append(request.Path.empty() ? std::string_view("/") : std::string_view(request.Path));
+            head.append(" HTTP/1.1\r\nHost: ");
+            bool ipv6Literal = request.Host.find(':') != std::string::npos;
+            if (ipv6Literal)
+            {
+                head.push_back('[');
+            }
+            head.append(request.Host);
+            if (ipv6Literal)
+            {
+                head.push_back(']');
+            }
+            if (request.Port != (request.Secure ? 443 : 80))
+            {
+                head.push_back(':');
+                head.append(std::to_string(request.Port));
+            }
+            head.append("\r\n");
+
+            if (!request.Body.empty() || request.Method != "GET")
+            {
+                head.append("Content-Length: ");
+                head.append(std::to_string(request.Body.size()));
+                head.append("\r\n");
+            }
+            for (auto const& header : request.Headers)
+            {
+                head.append(header.Name);
+                head.append(": ");
+                head.append(header.Value);
+                head.append("\r\n");
+            }
+            head.append("\r\n");
+            return head;
+        }
+
+        HRESULT WriteRequest(Connection& connection, std::string& head, std::string_view body, WaitContext const& wait)
+        {
+            if (body.size() <= kCoalesceBodyBytes)
+            {
+                head.append(body);
+                return connection.WriteAll(head, wait);
+            }
+
+            HRESULT hr = connection.WriteAll(head, wait);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+            return connection.WriteAll(body, wait);
+        }
+
+        struct ResponseFraming
+        {
+            bool Chunked{ false };
+            bool HasContentLength{ false };
+            uint64_t ContentLength{ 0 };
+            bool NoBody{ false };
+            bool KeepAlive{ true };
+        };
+
+        // Pending の先頭から 1 行 (CRLF なし) を取り出す。
+        HRESULT ReadLine(Connection& connection, size_t& consumed, WaitContext const& wait, std::string_view& outLine)
+        {
+            size_t lineEnd;
+            while ((lineEnd = connection.Pending.find("\r\n", consumed)) == std::string::npos)
+            {
+                if (connection.Pending.size() - consumed > kMaxHeaderBytes)
+                {
+                    return kHrInvalidResponse;
+                }
+                bool closed = false;
+                HRESULT hr = connection.Fill(wait, closed);
+                if (FAILED(hr))
+                {
+                    return hr;
+                }
+                if (closed)
+                {
+                    return kHrConnectionError;
+                }
+            }
+            outLine = std::string_view(connection.Pending).substr(consumed, lineEnd - consumed);
+            consumed = lineEnd + 2;
+            return S_OK;
+        }
+
+        // 最初のバイトまでは firstByteWait、その後は wait で待つ。ヘッダーを読んだら sendStart からの時間を FirstByteMs に入れる。
+        HRESULT ReadResponseHead(
+            Connection& connection,
+            std::string_view method,
+            std::chrono::steady_clock::time_point sendStart,
+            WaitContext const& firstByteWait,
+            WaitContext const& wait,
+            size_t& consumed,
+            SyncTransportResponse& outResponse,
+            ResponseFraming& outFraming,
+            bool& outReceivedAny)
+        {
+            for (;;)
+            {
+                size_t headerEnd;
+                while ((headerEnd = connection.Pending.find("\r\n\r\n", consumed)) == std::string::npos)
+                {
+                    if (connection.Pending.size() - consumed > kMaxHeaderBytes)
+                    {
+                        return kHrInvalidResponse;
+                    }
+                    bool closed = false;
+                    HRESULT hr = connection.Fill(outReceivedAny ? wait : firstByteWait, closed);
+                    if (FAILED(hr))
+                    {
+                        return hr;
+                    }
+                    if (closed)
+                    {
+                        return kHrConnectionError;
+                    }
+                    outReceivedAny = true;
+                }
+                outReceivedAny = true;
+                if (outResponse.FirstByteMs < 0)
+                {
+                    outResponse.FirstByteMs = static_cast<int32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - sendStart).count());
+                }
+
+                std::string_view head = std::string_view(connection.Pending).substr(consumed, headerEnd - consumed);
+                consumed = headerEnd + 4;
+
+                size_t statusEnd = head.find("\r\n");
+                std::string_view statusLine = head.substr(0, statusEnd);
+                // "HTTP/1.1 200 OK"
+                if (statusLine.size() < 12 || statusLine.substr(0, 7) != "HTTP/1." || statusLine[8] != ' ')
+                {
+                    return kHrInvalidResponse;
+                }
+                int32_t statusCode = 0;
+                auto [statusPtr, statusEc] = std::from_chars(statusLine.data() + 9, statusLine.data() + 12, statusCode);
+                if (statusEc != std::errc{} || statusPtr != statusLine.data() + 12)
+                {
+                    return kHrInvalidResponse;
+                }
+                bool http10 = statusLine[7] == '0';
+
+                outResponse.StatusCode = statusCode;
+                outResponse.Headers.clear();
+                std::string_view rest = statusEnd == std::string_view::npos ? std::string_view{} : head.substr(statusEnd + 2);
+                while (!rest.empty())
+                {
+                    size_t lineEnd = rest.find("\r\n");
+                    std::string_view line = rest.substr(0, lineEnd);
+                    rest = lineEnd == std::string_view::npos ? std::string_view{} : rest.substr(lineEnd + 2);
+                    size_t colon = line.find(':');
+                    if (colon == std::string_view::npos || colon == 0)
+                    {
+                        continue;
+                    }
+                    outResponse.Headers.push_back(SyncHttpHeader{
+                        std::string(line.substr(0, colon)),
+                        std::string(TrimHttpWhitespace(line.substr(colon + 1))) });
+                }
+
+                // 100 Continue などの中間応答は読み捨てる。
+                if (statusCode >= 100 && statusCode < 200 && statusCode != 101)
+                {
+                    continue;
+                }
+
+                outFraming = {};
+                std::string const* connectionHeader = outResponse.FindHeader("Connection");
+                outFraming.KeepAlive = http10
+                    ? (connectionHeader && ContainsTokenIgnoreCase(*connectionHeader, "keep-alive"))
+                    : !(connectionHeader && ContainsTokenIgnoreCase(*connectionHeader, "close"));
+                outFraming.NoBody = method == "HEAD" || statusCode == 204 || statusCode == 304 || statusCode < 200;
+
+                std::string const* transferEncoding = outResponse.FindHeader("Transfer-Encoding");
+                std::string const* contentLength = outResponse.FindHeader("Content-Length");
+                if (transferEncoding && ContainsTokenIgnoreCase(*transferEncoding, "chunked"))
+                {
+                    outFraming.Chunked = true;
+                }
+                else if (contentLength)
+                {
+                    std::string_view value = *contentLength;
+                    auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), outFraming.ContentLength);
+                    if (ec != std::errc{} || ptr != value.data() + value.size())
+                    {
+                        return kHrInvalidResponse;
+                    }
+                    outFraming.HasContentLength = true;
+                }
+                return S_OK;
+            }
+        }
+
+        // 本文の書き込み先。sink があれば固定の作業領域を経由してそこへ流し、なければ Body に直接読み込む。
+        class BodyTarget
+        {
+        public:
+            BodyTarget(std::string& body, ISyncResponseBodySink* sink) :
+                m_body(body),
+                m_sink(sink)
+            {
+            }
+
+            uint64_t Written() const noexcept { return m_written; }
+
+            bool CanAppend(uint64_t size) const noexcept
+            {
+                return m_sink || size <= static_cast<uint64_t>(m_body.max_size() - m_body.size());
+            }
+
+            void Reserve(size_t total)
+            {
+                if (!m_sink)
+                {
+                    m_body.reserve(total);
+                }
+            }
+
+            HRESULT Append(std::string_view data)
+            {
+                m_written += data.size();
+                if (m_sink)
+                {
+                    return data.empty() ? S_OK : m_sink->WriteBody(data);
+                }
+                m_body.append(data);
+                return S_OK;
+            }
+
+            // 接続から最大 want バイトを読む。
+            HRESULT ReadFrom(Connection& connection, size_t want, WaitContext const& wait, size_t& outRead)
+            {
+                outRead = 0;
+                if (m_sink)
+                {
+                    m_scratch.resize(kReadChunkBytes * 4);
+                    HRESULT hr = connection.ReadSome(m_scratch.data(), std::min(want, m_scratch.size()), wait, outRead);
+                    if (FAILED(hr))
+                    {
+                        return hr;
+                    }
+                    return Append(std::string_view(m_scratch.data(), outRead));
+                }
+
+                size_t oldSize = m_body.size();
+                m_body.resize(oldSize + want);
+                HRESULT hr = connection.ReadSome(m_body.data() + oldSize, want, wait, outRead);
+                m_body.resize(oldSize + outRead);
+                m_written += outRead;
+                return hr;
+            }
+
+        private:
+            std::string& m_body;
+            ISyncResponseBodySink* m_sink;
+            std::string m_scratch;
+            uint64_t m_written{ 0 };
+        };
+
+        HRESULT ReadContentLengthBody(Connection& connection, size_t& consumed, uint64_t length, WaitContext const& wait, BodyTarget& target)
+        {
+            if (!target.CanAppend(length) || length > static_cast<uint64_t>(SIZE_MAX))
+            {
+                return kHrInvalidResponse;
+            }
+            size_t total = static_cast<size_t>(length);
+            target.Reserve(total);
+
+            size_t buffered = std::min(connection.Pending.size() - consumed, total);
+            HRESULT hr = target.Append(std::string_view(connection.Pending).substr(consumed, buffered));
+            consumed += buffered;
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+
+            // 残りは body に直接読み込む。
+            while (target.Written() < total)
+            {
+                size_t want = std::min(total - static_cast<size_t>(target.Written()), kReadChunkBytes * 4);
+                size_t read = 0;
+                hr = target.ReadFrom(connection, want, wait, read);
+                if (FAILED(hr))
+                {
+                    return hr;
+                }
+                if (read == 0)
+                {
+                    return kHrConnectionError;
+                }
+            }
+            return S_OK;
+        }
+
+        HRESULT ReadChunkedBody(Connection& connection, size_t& consumed, WaitContext const& wait, BodyTarget& target)
+        {
+            for (;;)
+            {
+                std::string_view sizeLine;
+                HRESULT hr = ReadLine(connection, consumed, wait, sizeLine);
+                if (FAILED(hr))
+                {
+                    return hr;
+                }
+                sizeLine = TrimHttpWhitespace(sizeLine.substr(0, sizeLine.find(';')));
+                uint64_t chunkSize = 0;
+                auto [ptr, ec] = std::from_chars(sizeLine.data(), sizeLine.data() + sizeLine.size(), chunkSize, 16);
+                if (sizeLine.empty() || ec != std::errc{} || ptr != sizeLine.data() + sizeLine.size() || !target.CanAppend(chunkSize))
+                {
+                    return kHrInvalidResponse;
+                }
+
+                if (chunkSize == 0)
+                {
+                    // trailer は読み捨てる。
+                    for (;;)
+                    {
+                        std::string_view trailer;
+                        hr = ReadLine(connection, consumed, wait, trailer);
+                        if (FAILED(hr))
+                        {
+                            return hr;
+                        }
+                        if (trailer.empty())
+                        {
+                            return S_OK;
+                        }
+                    }
+                }
+
+                size_t size = static_cast<size_t>(chunkSize);
+                while (connection.Pending.size() - consumed < size + 2)
+                {
+                    bool closed = false;
+                    hr = connection.Fill(wait, closed);
+                    if (FAILED(hr))
+                    {
+                        return hr;
+                    }
+                    if (closed)
+                    {
+                        return kHrConnectionError;
+                    }
+                }
+                if (connection.Pending.compare(consumed + size, 2, "\r\n") != 0)
+                {
+                    return kHrInvalidResponse;
+                }
+                hr = target.Append(std::string_view(connection.Pending).substr(consumed, size));
+                consumed += size + 2;
+                if (FAILED(hr))
+                {
+                    return hr;
+                }
+
+                // 読み終えた分を捨てて Pending が body 全体の大きさまで伸びないようにする。
+                if (consumed >= kReadChunkBytes)
+                {
+                    connection.Pending.erase(0, consumed);
+                    consumed = 0;
+                }
+            }
+        }
+
+        HRESULT ReadUntilClose(Connection& connection, size_t& consumed, WaitContext const& wait, BodyTarget& target)
+        {
+            HRESULT hr = target.Append(std::string_view(connection.Pending).substr(consumed));
+            consumed = connection.Pending.size();
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+            for (;;)
+            {
+                size_t read = 0;
+                hr = target.ReadFrom(connection, kReadChunkBytes, wait, read);
+                if (FAILED(hr) || read == 0)
+                {
+                    return hr;
+                }
+            }
+        }
+
+        HRESULT ReadResponse(
+            Connection& connection,
+            std::string_view method,
+            ISyncResponseBodySink* sink,
+            std::chrono::steady_clock::time_point sendStart,
+            std::chrono::steady_clock::time_point sendEnd,
+            WaitContext const& firstByteWait,
+            WaitContext const& wait,
+            SyncTransportResponse& outResponse,
+            bool& outReusable,
+            bool& outReceivedAny)
+        {
+            outReusable = false;
+            size_t consumed = 0;
+            ResponseFraming framing{};
+            HRESULT hr = ReadResponseHead(connection, method, sendStart, firstByteWait, wait, consumed, outResponse, framing, outReceivedAny);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+            auto headersReceived = std::chrono::steady_clock::now();
+            outResponse.Timing.TimeToFirstByteMs = ElapsedMs(sendEnd, headersReceived);
+
+            bool reusable = framing.KeepAlive;
+            if (!framing.NoBody && sink && !sink->BeginBody(outResponse, framing.HasContentLength && !framing.Chunked ? static_cast<int64_t>(framing.ContentLength) : -1))
+            {
+                sink = nullptr;
+            }
+            BodyTarget target(outResponse.Body, sink);
+            if (framing.NoBody)
+            {
+            }
+            else if (framing.Chunked)
+            {
+                hr = ReadChunkedBody(connection, consumed, wait, target);
+            }
+            else if (framing.HasContentLength)
+            {
+                hr = ReadContentLengthBody(connection, consumed, framing.ContentLength, wait, target);
+            }
+            else
+            {
+                hr = ReadUntilClose(connection, consumed, wait, target);
+                reusable = false;
+            }
+            outResponse.Timing.TransferMs = ElapsedMs(headersReceived, std::chrono::steady_clock::now());
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+
+            connection.Pending.erase(0, consumed);
+            outReusable = reusable;
+            return S_OK;
+        }
+    }
+
+    std::shared_ptr<ISyncTransport> CreateDefaultSyncTransport()
+    {
+        static std::shared_ptr<ISyncTransport> shared = std::make_shared<PosixSyncTransport>();
+        return shared;
+    }
+
+    PosixSyncTransport::PosixSyncTransport()
+    {
+#ifdef TSUPASSWD_SYNC_TRANSPORT_OPENSSL
+        SSL_CTX* context = SSL_CTX_new(TLS_client_method());
+        if (context)
+        {
+            SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+            SSL_CTX_set_default_verify_paths(context);
+            SSL_CTX_set_verify(context, SSL_VERIFY_PEER, nullptr);
+            m_tlsContext = std::shared_ptr<void>(context, [](void* handle)
+            {
+                SSL_CTX_free(static_cast<SSL_CTX*>(handle));
+            });
+        }
+#endif
+    }
+
+    PosixSyncTransport::~PosixSyncTransport() = default;
+
+    size_t PosixSyncTransport::IdleConnectionCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t count = 0;
+        for (auto const& [key, connections] : m_idleConnections)
+        {
+            count += connections.size();
+        }
+        return count;
+    }
+
+    std::unique_ptr<PosixSyncTransport::Connection> PosixSyncTransport::TakeIdleConnection(OriginKey const& key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_idleConnections.find(key);
+        if (found == m_idleConnections.end() || found->second.empty())
+        {
+            return nullptr;
+        }
+        auto connection = std::move(found->second.back());
+        found->second.pop_back();
+        return connection;
+    }
+
+    void PosixSyncTransport::ReturnIdleConnection(OriginKey const& key, std::unique_ptr<Connection> connection)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& connections = m_idleConnections[key];
+        if (connections.size() < kMaxIdleConnectionsPerOrigin)
+        {
+            connections.push_back(std::move(connection));
+        }
+    }
+
+    HRESULT PosixSyncTransport::Connect(SyncTransportRequest const& request, int cancelFd, std::unique_ptr<Connection>& outConnection, SyncRequestTiming& outTiming) noexcept try
+    {
+        outConnection.reset();
+        WaitContext wait{ request.ConnectTimeoutMs, request.Deadline, cancelFd };
+
+#ifndef TSUPASSWD_SYNC_TRANSPORT_OPENSSL
+        if (request.Secure)
+        {
+            return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        }
+#else
+        if (request.Secure && !m_tlsContext)
+        {
+            return kHrSecureFailure;
+        }
+#endif
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_NUMERICSERV;
+        addrinfo* addresses = nullptr;
+        std::string port = std::to_string(request.Port);
+        auto resolveStart = std::chrono::steady_clock::now();
+        int resolveResult = ::getaddrinfo(request.Host.c_str(), port.c_str(), &hints, &addresses);
+        auto connectStart = std::chrono::steady_clock::now();
+        outTiming.DnsMs = ElapsedMs(resolveStart, connectStart);
+        if (resolveResult != 0 || !addresses)
+        {
+            return kHrNameNotResolved;
+        }
+        std::unique_ptr<addrinfo, decltype(&::freeaddrinfo)> addressesOwner(addresses, &::freeaddrinfo);
+        // getaddrinfo は取消できないので、戻ってきたところで確認する。
+        if (request.Cancellation.IsCancellationRequested())
+        {
+            return kHrCancelled;
+        }
+
+        HRESULT lastError = kHrCannotConnect;
+        for (addrinfo* address = addresses; address; address = address->ai_next)
+        {
+            auto connection = std::make_unique<Connection>();
+            connection->Socket = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+            if (connection->Socket < 0)
+            {
+                continue;
+            }
+            int flags = ::fcntl(connection->Socket, F_GETFL, 0);
+            ::fcntl(connection->Socket, F_SETFL, flags | O_NONBLOCK);
+            int noDelay = 1;
+            ::setsockopt(connection->Socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+            if (::connect(connection->Socket, address->ai_addr, address->ai_addrlen) != 0)
+            {
+                if (errno != EINPROGRESS)
+                {
+                    lastError = kHrCannotConnect;
+                    continue;
+                }
+                HRESULT hr = WaitSocket(connection->Socket, POLLOUT, wait);
+                if (FAILED(hr))
+                {
+                    if (hr == kHrCancelled)
+                    {
+                        return hr;
+                    }
+                    lastError = hr == kHrTimeout ? hr : kHrCannotConnect;
+                    continue;
+                }
+                int socketError = 0;
+                socklen_t length = sizeof(socketError);
+                if (::getsockopt(connection->Socket, SOL_SOCKET, SO_ERROR, &socketError, &length) != 0 || socketError != 0)
+                {
+                    lastError = kHrCannotConnect;
+                    continue;
+                }
+            }
+            // 前の address で失敗した時間も接続の時間に入れる。
+            auto tlsStart = std::chrono::steady_clock::now();
+            outTiming.ConnectMs = ElapsedMs(connectStart, tlsStart);
+
+#ifdef TSUPASSWD_SYNC_TRANSPORT_OPENSSL
+            if (request.Secure)
+            {
+                connection->Tls = SSL_new(static_cast<SSL_CTX*>(m_tlsContext.get()));
+                if (!connection->Tls ||
+                    !SSL_set_fd(connection->Tls, connection->Socket) ||
+                    !SSL_set_tlsext_host_name(connection->Tls, request.Host.c_str()) ||
+                    !SSL_set1_host(connection->Tls, request.Host.c_str()))
+                {
+                    return kHrSecureFailure;
+                }
+                for (;;)
+                {
+                    int result = SSL_connect(connection->Tls);
+                    if (result == 1)
+                    {
+                        break;
+                    }
+                    int error = SSL_get_error(connection->Tls, result);
+                    if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+                    {
+                        return kHrSecureFailure;
+                    }
+                    HRESULT hr = connection->WaitTls(result, wait);
+                    if (FAILED(hr))
+                    {
+                        outTiming.TlsMs = ElapsedMs(tlsStart, std::chrono::steady_clock::now());
+                        return hr;
+                    }
+                }
+                outTiming.TlsMs = ElapsedMs(tlsStart, std::chrono::steady_clock::now());
+            }
+#endif
+
+            m_connectCount.fetch_add(1, std::memory_order_relaxed);
+            outConnection = std::move(connection);
+            return S_OK;
+        }
+        outTiming.ConnectMs = ElapsedMs(connectStart, std::chrono::steady_clock::now());
+        return lastError;
+    }
+    catch (std::bad_alloc const&)
+    {
+        return E_OUTOFMEMORY;
+    }
+    catch (...)
+    {
+        return E_FAIL;
+    }
+
+    // keep-alive で再利用した接続がサーバー側で閉じられていた場合は、新しい接続で 1 回だけ送り直す (WinHTTP と同じ)。
+    // 取消は pipe で poll を起こし、使いかけの接続を閉じて ERROR_CANCELLED を返す。
+    HRESULT PosixSyncTransport::Send(SyncTransportRequest const& request, SyncTransportResponse& outResponse) noexcept try
+    {
+        outResponse = {};
+        OriginKey key{ request.Secure, request.Host, request.Port };
+
+        CancelPipe cancelPipe;
+        std::optional<SyncCancellationRegistration> cancelRegistration;
+        if (request.Cancellation.CanBeCancelled())
+        {
+            if (!cancelPipe.Open())
+            {
+                return kHrConnectionError;
+            }
+            cancelRegistration.emplace(request.Cancellation, [&cancelPipe]() { cancelPipe.Signal(); });
+        }
+        if (request.Cancellation.IsCancellationRequested())
+        {
+            return kHrCancelled;
+        }
+        WaitContext firstByteWait{ request.FirstByteTimeoutMs, request.Deadline, cancelPipe.ReadFd };
+        WaitContext wait{ request.TransferTimeoutMs, request.Deadline, cancelPipe.ReadFd };
+
+        for (int attempt = 0;; ++attempt)
+        {
+            auto attemptStart = std::chrono::steady_clock::now();
+            outResponse.Timing.RoundTrips = 1;
+            std::unique_ptr<Connection> connection = TakeIdleConnection(key);
+            bool reused = connection != nullptr;
+            if (!connection)
+            {
+                outResponse.Timing.NewConnections = 1;
+                HRESULT hr = Connect(request, cancelPipe.ReadFd, connection, outResponse.Timing);
+                if (FAILED(hr))
+                {
+                    return hr;
+                }
+            }
+
+            std::string head = BuildRequestHead(request);
+            bool reusable = false;
+            bool receivedAny = false;
+            uint64_t writtenBefore = connection->BytesWritten;
+            uint64_t readBefore = connection->BytesRead;
+            auto sendStart = std::chrono::steady_clock::now();
+            HRESULT hr = WriteRequest(*connection, head, request.Body, wait);
+            auto sendEnd = std::chrono::steady_clock::now();
+            outResponse.Timing.SendMs = ElapsedMs(sendStart, sendEnd);
+            if (SUCCEEDED(hr))
+            {
+                hr = ReadResponse(*connection, request.Method, request.BodySink, attemptStart, sendEnd, firstByteWait, wait, outResponse, reusable, receivedAny);
+            }
+            outResponse.Timing.BytesSent = static_cast<int64_t>(connection->BytesWritten - writtenBefore);
+            outResponse.Timing.BytesReceived = static_cast<int64_t>(connection->BytesRead - readBefore);
+            if (FAILED(hr))
+            {
+                if (reused && !receivedAny && attempt == 0 && hr != kHrTimeout && hr != kHrCancelled)
+                {
+                    outResponse = {};
+                    continue;
+                }
+                return hr;
+            }
+
+            if (reusable)
+            {
+                ReturnIdleConnection(key, std::move(connection));
+            }
+            return S_OK;
+        }
+    }
+    catch (std::bad_alloc const&)
+    {
+        return E_OUTOFMEMORY;
+    }
+    catch (...)
+    {
+        return E_FAIL;
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "SyncTransport.h"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace tsupasswd
+{
+    // POSIX ソケットによる ISyncTransport。Windows 以外のビルド (tools/ の負荷試験ツール) で使う。
+    // HTTP/1.1 の keep-alive 接続を origin ごとに保持して使い回す。
+    // https は TSUPASSWD_SYNC_TRANSPORT_OPENSSL を定義して OpenSSL とリンクした場合のみ使える。
+    class PosixSyncTransport final : public ISyncTransport
+    {
+    public:
+        PosixSyncTransport();
+        ~PosixSyncTransport() override;
+
+        PosixSyncTransport(PosixSyncTransport const&) = delete;
+        PosixSyncTransport& operator=(PosixSyncTransport const&) = delete;
+
+        HRESULT Send(SyncTransportRequest const& request, SyncTransportResponse& outResponse) noexcept override;
+
+        // 新しく張った TCP 接続の累計。接続の再利用率の確認に使う。
+        uint64_t ConnectCount() const noexcept { return m_connectCount.load(std::memory_order_relaxed); }
+        size_t IdleConnectionCount() const;
+
+        // 1 本の TCP (TLS) 接続。定義は cpp。
+        struct Connection;
+
+    private:
+        using OriginKey = std::tuple<bool, std::string, uint16_t>;
+
+        // cancelFd は取消で読めるようになる fd (取消できない要求では -1)。名前解決・接続・TLS の時間を outTiming に入れる。
+        HRESULT Connect(SyncTransportRequest const& request, int cancelFd, std::unique_ptr<Connection>& outConnection, SyncRequestTiming& outTiming) noexcept;
+        std::unique_ptr<Connection> TakeIdleConnection(OriginKey const& key);
+        void ReturnIdleConnection(OriginKey const& key, std::unique_ptr<Connection> connection);
+
+        mutable std::mutex m_mutex;
+        std::map<OriginKey, std::vector<std::unique_ptr<Connection>>> m_idleConnections;
+        std::atomic<uint64_t> m_connectCount{ 0 };
+        // SSL_CTX。TLS なしのビルドでは常に空。
+        std::shared_ptr<void> m_tlsContext;
+    };
+}
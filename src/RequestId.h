@@ -1,11 +1,18 @@
 #pragma once
 
+#include <cwchar>
 #include <string>
 
+#ifndef _WIN32
+#include <chrono>
+#include <ctime>
+#endif
+
 namespace tsupasswd
 {
     inline std::wstring BuildRequestId(std::wstring const& operation)
     {
+#ifdef _WIN32
         SYSTEMTIME st{};
         GetSystemTime(&st);
 
@@ -20,6 +27,27 @@ namespace tsupasswd
             st.wMinute,
             st.wSecond,
             st.wMilliseconds);
+#else
+        // Native Messaging のコア部分はテスト用ツールから Windows 以外でも使うため、同じ書式を標準ライブラリで作る。
+        auto now = std::chrono::system_clock::now();
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+        std::time_t seconds = std::chrono::system_clock::to_time_t(now);
+        std::tm utc{};
+        gmtime_r(&seconds, &utc);
+
+        wchar_t timestamp[40]{};
+        swprintf(
+            timestamp,
+            sizeof(timestamp) / sizeof(timestamp[0]),
+            L"%04d%02d%02dT%02d%02d%02d%03dZ",
+            utc.tm_year + 1900,
+            utc.tm_mon + 1,
+            utc.tm_mday,
+            utc.tm_hour,
+            utc.tm_min,
+            utc.tm_sec,
+            static_cast<int>(millis));
+#endif
 
         return std::wstring{ timestamp } + L"-" + operation;
     }
@@ -0,0 +1,162 @@
+#include "SyncAsync.h"
+
+namespace tsupasswd
+{
+    namespace
+    {
+        constexpr uint32_t kDefaultIoThreadCount = 4;
+
+        thread_local bool t_isReactorThread = false;
+    }
+
+    namespace detail
+    {
+        bool IsSyncReactorThread() noexcept
+        {
+            return t_isReactorThread;
+        }
+    }
+
+    SyncReactor& SyncReactor::getInstance()
+    {
+        // 終了時に I/O スレッドの join で待たないよう、プロセス終了まで破棄しない。
+        static SyncReactor* instance = new SyncReactor(kDefaultIoThreadCount);
+        return *instance;
+    }
+
+    SyncReactor::SyncReactor(uint32_t ioThreadCount)
+    {
+        if (ioThreadCount == 0)
+        {
+            ioThreadCount = 1;
+        }
+        m_ioThreads.reserve(ioThreadCount);
+        for (uint32_t i = 0; i < ioThreadCount; ++i)
+        {
+            m_ioThreads.emplace_back([this]() { IoLoop(); });
+        }
+        m_timerThread = std::thread([this]() { TimerLoop(); });
+    }
+
+    SyncReactor::~SyncReactor()
+    {
+        {
+            std::lock_guard workLock(m_workMutex);
+            std::lock_guard timerLock(m_timerMutex);
+            m_stopping = true;
+        }
+        m_workReady.notify_all();
+        m_timerChanged.notify_all();
+        for (auto& thread : m_ioThreads)
+        {
+            thread.join();
+        }
+        m_timerThread.join();
+    }
+
+    void SyncReactor::Post(std::function<void()> work)
+    {
+        {
+            std::lock_guard lock(m_workMutex);
+            m_work.push_back(std::move(work));
+        }
+        m_workReady.notify_one();
+    }
+
+    void SyncReactor::IoLoop()
+    {
+        t_isReactorThread = true;
+        for (;;)
+        {
+            std::function<void()> work;
+            {
+                std::unique_lock lock(m_workMutex);
+                m_workReady.wait(lock, [&]() { return m_stopping || !m_work.empty(); });
+                if (m_work.empty())
+                {
+                    return;
+                }
+                work = std::move(m_work.front());
+                m_work.pop_front();
+            }
+            work();
+        }
+    }
+
+    void SyncReactor::TimerLoop()
+    {
+        t_isReactorThread = true;
+        std::unique_lock lock(m_timerMutex);
+        while (!m_stopping)
+        {
+            if (m_timers.empty())
+            {
+                m_timerChanged.wait(lock);
+                continue;
+            }
+
+            auto first = m_timers.begin();
+            if (first->first > Clock::now())
+            {
+                m_timerChanged.wait_until(lock, first->first);
+                continue;
+            }
+
+            std::shared_ptr<TimerEntry> entry = std::move(first->second);
+            m_timers.erase(first);
+            lock.unlock();
+            FireTimer(entry, false);
+            lock.lock();
+        }
+    }
+
+    void SyncReactor::AddTimer(Clock::time_point due, std::shared_ptr<TimerEntry> entry)
+    {
+        bool earliest = false;
+        {
+            std::lock_guard lock(m_timerMutex);
+            auto inserted = m_timers.emplace(due, std::move(entry));
+            earliest = inserted == m_timers.begin();
+        }
+        if (earliest)
+        {
+            m_timerChanged.notify_one();
+        }
+    }
+
+    void SyncReactor::FireTimer(std::shared_ptr<TimerEntry> const& entry, bool cancelled)
+    {
+        // 期限と取消のどちらか先に来た方だけが再開させる。
+        if (entry->Fired.exchange(true))
+        {
+            return;
+        }
+        entry->Cancelled = cancelled;
+        ReleaseTimer(entry);
+    }
+
+    void SyncReactor::ReleaseTimer(std::shared_ptr<TimerEntry> const& entry)
+    {
+        if (entry->PendingReleases.fetch_sub(1) == 1)
+        {
+            std::coroutine_handle<> handle = entry->Handle;
+            Post([handle]() { handle.resume(); });
+        }
+    }
+
+    void SyncReactor::DelayAwaiter::await_suspend(std::coroutine_handle<> handle)
+    {
+        // 取消の登録を先に済ませ、this に触るのはタイマーを仕掛けるまで。最後の ReleaseTimer の後は
+        // 別スレッドで再開して frame ごと破棄されうるので、ローカルの entry と reactor だけを使う。
+        std::shared_ptr<TimerEntry> entry = std::make_shared<TimerEntry>();
+        entry->Handle = handle;
+        m_entry = entry;
+        SyncReactor* reactor = &m_reactor;
+        if (m_token.CanBeCancelled())
+        {
+            m_registration.emplace(m_token, [reactor, entry]() { reactor->FireTimer(entry, true); });
+        }
+        reactor->AddTimer(Clock::now() + m_delay, entry);
+        reactor->ReleaseTimer(entry);
+    }
+}
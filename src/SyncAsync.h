@@ -0,0 +1,235 @@
+#pragma once
+
+#include "SyncCancellation.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tsupasswd
+{
+    namespace detail
+    {
+        // SyncReactor の I/O スレッドかタイマースレッドなら true。
+        bool IsSyncReactorThread() noexcept;
+
+        template <typename T>
+        struct SyncTaskState
+        {
+            std::mutex Mutex;
+            std::condition_variable Done;
+            bool Completed{ false };
+            std::optional<T> Value;
+            std::exception_ptr Exception;
+            std::coroutine_handle<> Continuation;
+
+            void Complete() noexcept
+            {
+                std::coroutine_handle<> continuation;
+                {
+                    std::lock_guard lock(Mutex);
+                    Completed = true;
+                    continuation = std::exchange(Continuation, {});
+                }
+                Done.notify_all();
+                if (continuation)
+                {
+                    continuation.resume();
+                }
+            }
+        };
+    }
+
+    // SyncClient の非同期 API が返す coroutine。呼び出した時点で走り出し (winrt::IAsyncOperation と同じ)、
+    // co_await するか Get() で待つ。結果を受け取れるのは 1 回だけ。
+    // co_await した側は完了させたスレッド (通常は SyncReactor の I/O スレッド) で再開する。
+    template <typename T>
+    class [[nodiscard]] SyncTask final
+    {
+    public:
+        struct promise_type
+        {
+            std::shared_ptr<detail::SyncTaskState<T>> State{ std::make_shared<detail::SyncTaskState<T>>() };
+
+            SyncTask get_return_object() { return SyncTask(State); }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+
+            auto final_suspend() noexcept
+            {
+                struct FinalAwaiter
+                {
+                    bool await_ready() noexcept { return false; }
+                    void await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                    {
+                        std::shared_ptr<detail::SyncTaskState<T>> state = handle.promise().State;
+                        handle.destroy();
+                        state->Complete();
+                    }
+                    void await_resume() noexcept {}
+                };
+                return FinalAwaiter{};
+            }
+
+            void return_value(T value) { State->Value.emplace(std::move(value)); }
+            void unhandled_exception() noexcept { State->Exception = std::current_exception(); }
+        };
+
+        bool await_ready() const noexcept
+        {
+            std::lock_guard lock(m_state->Mutex);
+            return m_state->Completed;
+        }
+
+        bool await_suspend(std::coroutine_handle<> continuation)
+        {
+            std::lock_guard lock(m_state->Mutex);
+            if (m_state->Completed)
+            {
+                return false;
+            }
+            m_state->Continuation = continuation;
+            return true;
+        }
+
+        T await_resume()
+        {
+            if (m_state->Exception)
+            {
+                std::rethrow_exception(m_state->Exception);
+            }
+            return std::move(*m_state->Value);
+        }
+
+        // coroutine 以外 (native host のワーカーや試験) から完了まで待つ。
+        // reactor のスレッドで待つと、完了させるはずのスレッドを自分で塞いで止まることがあるので呼ばない。
+        T Get()
+        {
+            assert(!detail::IsSyncReactorThread() && "SyncTask::Get() must not block a SyncReactor thread");
+            {
+                std::unique_lock lock(m_state->Mutex);
+                m_state->Done.wait(lock, [&]() { return m_state->Completed; });
+            }
+            return await_resume();
+        }
+
+        bool IsCompleted() const noexcept { return await_ready(); }
+
+    private:
+        explicit SyncTask(std::shared_ptr<detail::SyncTaskState<T>> state) noexcept :
+            m_state(std::move(state))
+        {
+        }
+
+        std::shared_ptr<detail::SyncTaskState<T>> m_state;
+    };
+
+    // 同期 API 用の小さな reactor。I/O スレッド群で transport の送受信を行い、タイマースレッドで backoff を待つ。
+    // WinHTTP の同期 API と POSIX transport はどちらもブロッキングなので、1 要求が 1 本の I/O スレッドを使う。
+    // 並列に走れる要求数は I/O スレッド数まで。取消は transport 側がソケット/要求ハンドルを閉じて即座に戻す。
+    class SyncReactor final
+    {
+    public:
+        static SyncReactor& getInstance();
+
+        explicit SyncReactor(uint32_t ioThreadCount);
+        ~SyncReactor();
+
+        SyncReactor(SyncReactor const&) = delete;
+        SyncReactor& operator=(SyncReactor const&) = delete;
+
+        void Post(std::function<void()> work);
+
+        // co_await で I/O スレッドに移る。
+        auto Schedule() noexcept
+        {
+            struct ScheduleAwaiter
+            {
+                SyncReactor& Reactor;
+
+                bool await_ready() const noexcept { return false; }
+                void await_suspend(std::coroutine_handle<> handle)
+                {
+                    Reactor.Post([handle]() { handle.resume(); });
+                }
+                void await_resume() const noexcept {}
+            };
+            return ScheduleAwaiter{ *this };
+        }
+
+        struct TimerEntry
+        {
+            std::atomic<bool> Fired{ false };
+            // 発火と await_suspend の終わりの両方で 1 ずつ減らし、0 にした側が再開させる。
+            // 取消済みの token で callback がその場で呼ばれても、awaiter (coroutine frame) への書き込みが済むまで再開しない。
+            std::atomic<int> PendingReleases{ 2 };
+            bool Cancelled{ false };
+            std::coroutine_handle<> Handle;
+        };
+
+        class DelayAwaiter
+        {
+        public:
+            DelayAwaiter(SyncReactor& reactor, std::chrono::milliseconds delay, SyncCancellationToken token) :
+                m_reactor(reactor),
+                m_delay(delay),
+                m_token(std::move(token))
+            {
+            }
+
+            bool await_ready() const noexcept { return m_delay.count() <= 0 && !m_token.IsCancellationRequested(); }
+            void await_suspend(std::coroutine_handle<> handle);
+            // 取消で起きた場合は false。
+            bool await_resume() const noexcept { return !(m_entry && m_entry->Cancelled); }
+
+        private:
+            SyncReactor& m_reactor;
+            std::chrono::milliseconds m_delay;
+            SyncCancellationToken m_token;
+            std::shared_ptr<TimerEntry> m_entry;
+            std::optional<SyncCancellationRegistration> m_registration;
+        };
+
+        // co_await で delay 後、または token の取消時に I/O スレッドで再開する。
+        // std::this_thread::sleep_for による backoff と違い、待っている間はスレッドを使わない。
+        DelayAwaiter Delay(std::chrono::milliseconds delay, SyncCancellationToken token = {})
+        {
+            return DelayAwaiter(*this, delay, std::move(token));
+        }
+
+        uint32_t IoThreadCount() const noexcept { return static_cast<uint32_t>(m_ioThreads.size()); }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        void IoLoop();
+        void TimerLoop();
+        void AddTimer(Clock::time_point due, std::shared_ptr<TimerEntry> entry);
+        void FireTimer(std::shared_ptr<TimerEntry> const& entry, bool cancelled);
+        void ReleaseTimer(std::shared_ptr<TimerEntry> const& entry);
+
+        std::mutex m_workMutex;
+        std::condition_variable m_workReady;
+        std::deque<std::function<void()>> m_work;
+
+        std::mutex m_timerMutex;
+        std::condition_variable m_timerChanged;
+        std::multimap<Clock::time_point, std::shared_ptr<TimerEntry>> m_timers;
+
+        std::atomic<bool> m_stopping{ false };
+        std::vector<std::thread> m_ioThreads;
+        std::thread m_timerThread;
+    };
+}
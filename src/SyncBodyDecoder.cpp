@@ -0,0 +1,507 @@
+#include "SyncBodyDecoder.h"
+
+#include <charconv>
+
+namespace tsupasswd
+{
+    namespace
+    {
+        // ためる値 (キーとストリームしないメンバー) の上限。暗号文以外はどれも短い。
+        constexpr size_t kMaxBufferedValueBytes = 64 * 1024;
+
+        int Base64Value(char c) noexcept
+        {
+            if (c >= 'A' && c <= 'Z')
+            {
+                return c - 'A';
+            }
+            if (c >= 'a' && c <= 'z')
+            {
+                return c - 'a' + 26;
+            }
+            if (c >= '0' && c <= '9')
+            {
+                return c - '0' + 52;
+            }
+            if (c == '+' || c == '-')
+            {
+                return 62;
+            }
+            if (c == '/' || c == '_')
+            {
+                return 63;
+            }
+            return -1;
+        }
+
+        bool IsJsonWhitespace(char c) noexcept
+        {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        }
+
+        int HexValue(char c) noexcept
+        {
+            if (c >= '0' && c <= '9')
+            {
+                return c - '0';
+            }
+            if (c >= 'a' && c <= 'f')
+            {
+                return c - 'a' + 10;
+            }
+            if (c >= 'A' && c <= 'F')
+            {
+                return c - 'A' + 10;
+            }
+            return -1;
+        }
+    }
+
+    bool Base64StreamDecoder::Feed(std::string_view chunk, std::vector<uint8_t>& out)
+    {
+        if (m_failed)
+        {
+            return false;
+        }
+        for (char c : chunk)
+        {
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+            {
+                continue;
+            }
+            if (c == '=')
+            {
+                ++m_padding;
+                continue;
+            }
+            int value = Base64Value(c);
+            if (value < 0 || m_padding > 0)
+            {
+                m_failed = true;
+                return false;
+            }
+            m_accumulator = (m_accumulator << 6) | static_cast<uint32_t>(value);
+            m_bits += 6;
+            if (m_bits >= 8)
+            {
+                m_bits -= 8;
+                out.push_back(static_cast<uint8_t>((m_accumulator >> m_bits) & 0xFF));
+            }
+        }
+        return true;
+    }
+
+    bool Base64StreamDecoder::Finish() const noexcept
+    {
+        return !m_failed && m_padding <= 2 && m_bits < 6;
+    }
+
+    JsonObjectStreamReader::JsonObjectStreamReader(std::string streamKey, ChunkHandler onChunk) :
+        m_streamKey(std::move(streamKey)),
+        m_onChunk(std::move(onChunk))
+    {
+    }
+
+    bool JsonObjectStreamReader::Finish() const noexcept
+    {
+        return m_state == State::Done;
+    }
+
+    std::string const* JsonObjectStreamReader::Find(std::string_view key) const noexcept
+    {
+        for (auto const& [name, value] : m_values)
+        {
+            if (name == key)
+            {
+                return &value;
+            }
+        }
+        return nullptr;
+    }
+
+    bool JsonObjectStreamReader::TryGetInt64(std::string_view key, int64_t& outValue) const noexcept
+    {
+        std::string const* value = Find(key);
+        if (!value || value->empty())
+        {
+            return false;
+        }
+        int64_t parsed = 0;
+        auto [ptr, ec] = std::from_chars(value->data(), value->data() + value->size(), parsed);
+        if (ec != std::errc{} || ptr != value->data() + value->size())
+        {
+            return false;
+        }
+        outValue = parsed;
+        return true;
+    }
+
+    bool JsonObjectStreamReader::AppendStringBytes(std::string_view bytes)
+    {
+        if (bytes.empty())
+        {
+            return true;
+        }
+        if (m_state == State::StringValue && m_streaming)
+        {
+            return m_onChunk(bytes);
+        }
+        std::string& target = m_state == State::Key ? m_key : m_value;
+        if (target.size() + bytes.size() > kMaxBufferedValueBytes)
+        {
+            return false;
+        }
+        target.append(bytes);
+        return true;
+    }
+
+    bool JsonObjectStreamReader::AppendCodePoint(uint32_t codePoint)
+    {
+        char utf8[4]{};
+        size_t length = 0;
+        if (codePoint < 0x80)
+        {
+            utf8[length++] = static_cast<char>(codePoint);
+        }
+        else if (codePoint < 0x800)
+        {
+            utf8[length++] = static_cast<char>(0xC0 | (codePoint >> 6));
+            utf8[length++] = static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        else if (codePoint < 0x10000)
+        {
+            utf8[length++] = static_cast<char>(0xE0 | (codePoint >> 12));
+            utf8[length++] = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            utf8[length++] = static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        else
+        {
+            utf8[length++] = static_cast<char>(0xF0 | (codePoint >> 18));
+            utf8[length++] = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+            utf8[length++] = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            utf8[length++] = static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        return AppendStringBytes(std::string_view(utf8, length));
+    }
+
+    // キーまたは文字列値の続きを読む。閉じ引用符を読んだら状態を進める。
+    bool JsonObjectStreamReader::FeedString(std::string_view chunk, size_t& index)
+    {
+        while (index < chunk.size())
+        {
+            if (m_unicodeDigits >= 0)
+            {
+                int digit = HexValue(chunk[index++]);
+                if (digit < 0)
+                {
+                    return false;
+                }
+                m_unicodeValue = (m_unicodeValue << 4) | static_cast<uint32_t>(digit);
+                if (++m_unicodeDigits < 4)
+                {
+                    continue;
+                }
+                m_unicodeDigits = -1;
+                uint32_t unit = m_unicodeValue;
+                if (unit >= 0xD800 && unit <= 0xDBFF)
+                {
+                    if (m_highSurrogate != 0)
+                    {
+                        return false;
+                    }
+                    m_highSurrogate = unit;
+                    continue;
+                }
+                if (unit >= 0xDC00 && unit <= 0xDFFF)
+                {
+                    if (m_highSurrogate == 0)
+                    {
+                        return false;
+                    }
+                    unit = 0x10000 + ((m_highSurrogate - 0xD800) << 10) + (unit - 0xDC00);
+                    m_highSurrogate = 0;
+                }
+                else if (m_highSurrogate != 0)
+                {
+                    return false;
+                }
+                if (!AppendCodePoint(unit))
+                {
+                    return false;
+                }
+                continue;
+            }
+
+            if (m_escape)
+            {
+                m_escape = false;
+                char c = chunk[index++];
+                if (c == 'u')
+                {
+                    m_unicodeDigits = 0;
+                    m_unicodeValue = 0;
+                    continue;
+                }
+                if (m_highSurrogate != 0)
+                {
+                    return false;
+                }
+                char unescaped = 0;
+                switch (c)
+                {
+                case '"': unescaped = '"'; break;
+                case '\\': unescaped = '\\'; break;
+                case '/': unescaped = '/'; break;
+                case 'b': unescaped = '\b'; break;
+                case 'f': unescaped = '\f'; break;
+                case 'n': unescaped = '\n'; break;
+                case 'r': unescaped = '\r'; break;
+                case 't': unescaped = '\t'; break;
+                default: return false;
+                }
+                if (!AppendStringBytes(std::string_view(&unescaped, 1)))
+                {
+                    return false;
+                }
+                continue;
+            }
+
+            // エスケープのない部分はまとめて渡す。
+            size_t end = chunk.find_first_of("\"\\", index);
+            size_t runEnd = end == std::string_view::npos ? chunk.size() : end;
+            if (runEnd > index)
+            {
+                if (m_highSurrogate != 0)
+                {
+                    return false;
+                }
+                std::string_view run = chunk.substr(index, runEnd - index);
+                for (char c : run)
+                {
+                    if (static_cast<unsigned char>(c) < 0x20)
+                    {
+                        return false;
+                    }
+                }
+                if (!AppendStringBytes(run))
+                {
+                    return false;
+                }
+                index = runEnd;
+            }
+            if (end == std::string_view::npos)
+            {
+                return true;
+            }
+
+            ++index;
+            if (chunk[end] == '\\')
+            {
+                m_escape = true;
+                continue;
+            }
+
+            if (m_highSurrogate != 0)
+            {
+                return false;
+            }
+            if (m_state == State::Key)
+            {
+                m_state = State::AfterKey;
+                return true;
+            }
+            return EndValue();
+        }
+        return true;
+    }
+
+    bool JsonObjectStreamReader::EndValue()
+    {
+        if (m_streaming)
+        {
+            m_streaming = false;
+            m_streamedValueSeen = true;
+        }
+        else
+        {
+            bool replaced = false;
+            for (auto& [name, value] : m_values)
+            {
+                if (name == m_key)
+                {
+                    value = std::move(m_value);
+                    replaced = true;
+                }
+            }
+            if (!replaced)
+            {
+                m_values.emplace_back(std::move(m_key), std::move(m_value));
+            }
+        }
+        m_key.clear();
+        m_value.clear();
+        m_state = State::AfterValue;
+        return true;
+    }
+
+    bool JsonObjectStreamReader::Feed(std::string_view chunk)
+    {
+        size_t index = 0;
+        while (index < chunk.size() && m_state != State::Failed)
+        {
+            bool ok = true;
+            char c = chunk[index];
+            switch (m_state)
+            {
+            case State::BeforeObject:
+                ++index;
+                if (c == '{')
+                {
+                    m_state = State::BeforeKey;
+                    m_afterComma = false;
+                }
+                else
+                {
+                    ok = IsJsonWhitespace(c);
+                }
+                break;
+
+            case State::BeforeKey:
+                ++index;
+                if (c == '"')
+                {
+                    m_state = State::Key;
+                }
+                else if (c == '}' && !m_afterComma)
+                {
+                    m_state = State::Done;
+                }
+                else
+                {
+                    ok = IsJsonWhitespace(c);
+                }
+                break;
+
+            case State::Key:
+            case State::StringValue:
+                ok = FeedString(chunk, index);
+                break;
+
+            case State::AfterKey:
+                ++index;
+                if (c == ':')
+                {
+                    m_state = State::BeforeValue;
+                }
+                else
+                {
+                    ok = IsJsonWhitespace(c);
+                }
+                break;
+
+            case State::BeforeValue:
+                if (IsJsonWhitespace(c))
+                {
+                    ++index;
+                }
+                else if (c == '"')
+                {
+                    ++index;
+                    m_streaming = m_key == m_streamKey;
+                    m_state = State::StringValue;
+                }
+                else if (c == '{' || c == '[')
+                {
+                    ++index;
+                    m_nestedDepth = 1;
+                    m_nestedInString = false;
+                    m_nestedEscape = false;
+                    m_state = State::NestedValue;
+                }
+                else
+                {
+                    m_state = State::LiteralValue;
+                }
+                break;
+
+            case State::LiteralValue:
+                if (c == ',' || c == '}' || IsJsonWhitespace(c))
+                {
+                    ok = !m_value.empty() && EndValue();
+                }
+                else
+                {
+                    ++index;
+                    ok = (c == '-' || c == '+' || c == '.' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) &&
+                        m_value.size() < 64;
+                    m_value.push_back(c);
+                }
+                break;
+
+            case State::NestedValue:
+                ++index;
+                if (m_nestedInString)
+                {
+                    if (m_nestedEscape)
+                    {
+                        m_nestedEscape = false;
+                    }
+                    else if (c == '\\')
+                    {
+                        m_nestedEscape = true;
+                    }
+                    else if (c == '"')
+                    {
+                        m_nestedInString = false;
+                    }
+                }
+                else if (c == '"')
+                {
+                    m_nestedInString = true;
+                }
+                else if (c == '{' || c == '[')
+                {
+                    ++m_nestedDepth;
+                }
+                else if ((c == '}' || c == ']') && --m_nestedDepth == 0)
+                {
+                    // 入れ子の値は保持しない。
+                    m_key.clear();
+                    m_state = State::AfterValue;
+                }
+                break;
+
+            case State::AfterValue:
+                ++index;
+                if (c == ',')
+                {
+                    m_state = State::BeforeKey;
+                    m_afterComma = true;
+                }
+                else if (c == '}')
+                {
+                    m_state = State::Done;
+                }
+                else
+                {
+                    ok = IsJsonWhitespace(c);
+                }
+                break;
+
+            case State::Done:
+                ++index;
+                ok = IsJsonWhitespace(c);
+                break;
+
+            case State::Failed:
+                break;
+            }
+
+            if (!ok)
+            {
+                m_state = State::Failed;
+            }
+        }
+        return m_state != State::Failed;
+    }
+}
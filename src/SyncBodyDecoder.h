@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace tsupasswd
+{
+    // base64 を少しずつ復号する。標準と URL-safe の両方の文字を受け付け、空白と改行は読み飛ばす。
+    class Base64StreamDecoder final
+    {
+    public:
+        // 復号したバイトを out の末尾に足す。不正な文字があれば false (以降も false)。
+        bool Feed(std::string_view chunk, std::vector<uint8_t>& out);
+        // 末尾の端数が正しいか確かめる。
+        bool Finish() const noexcept;
+
+    private:
+        uint32_t m_accumulator{ 0 };
+        int m_bits{ 0 };
+        size_t m_padding{ 0 };
+        bool m_failed{ false };
+    };
+
+    // 1 段の JSON オブジェクトを少しずつ読む。
+    // streamKey の文字列値だけはためずに、エスケープを解いたものを onChunk へ流す。
+    // それ以外のメンバーは、文字列なら中身を、数値・真偽値・null なら表記をそのまま Find で引ける。入れ子の値は読み飛ばす。
+    class JsonObjectStreamReader final
+    {
+    public:
+        // false を返すと読み取りを打ち切る。
+        using ChunkHandler = std::function<bool(std::string_view chunk)>;
+
+        JsonObjectStreamReader(std::string streamKey, ChunkHandler onChunk);
+
+        // 不正な JSON または onChunk が false を返したら false (以降も false)。
+        bool Feed(std::string_view chunk);
+        // オブジェクトが閉じていれば true。
+        bool Finish() const noexcept;
+        // streamKey の文字列値を読んだか。
+        bool StreamedValueSeen() const noexcept { return m_streamedValueSeen; }
+
+        std::string const* Find(std::string_view key) const noexcept;
+        bool TryGetInt64(std::string_view key, int64_t& outValue) const noexcept;
+
+    private:
+        enum class State
+        {
+            BeforeObject,
+            BeforeKey,
+            Key,
+            AfterKey,
+            BeforeValue,
+            StringValue,
+            LiteralValue,
+            NestedValue,
+            AfterValue,
+            Done,
+            Failed,
+        };
+
+        bool FeedString(std::string_view chunk, size_t& index);
+        bool AppendStringBytes(std::string_view bytes);
+        bool AppendCodePoint(uint32_t codePoint);
+        bool EndValue();
+
+        std::string m_streamKey;
+        ChunkHandler m_onChunk;
+        State m_state{ State::BeforeObject };
+        bool m_afterComma{ false };
+        bool m_streaming{ false };
+        bool m_streamedValueSeen{ false };
+
+        // 文字列のエスケープ。
+        bool m_escape{ false };
+        int m_unicodeDigits{ -1 };
+        uint32_t m_unicodeValue{ 0 };
+        uint32_t m_highSurrogate{ 0 };
+
+        // 入れ子の値を読み飛ばす間の状態。
+        uint32_t m_nestedDepth{ 0 };
+        bool m_nestedInString{ false };
+        bool m_nestedEscape{ false };
+
+        std::string m_key;
+        std::string m_value;
+        std::vector<std::pair<std::string, std::string>> m_values;
+    };
+}
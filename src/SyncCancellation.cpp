@@ -0,0 +1,143 @@
+#include "SyncCancellation.h"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tsupasswd
+{
+    namespace detail
+    {
+        struct SyncCancellationState
+        {
+            std::mutex Mutex;
+            std::condition_variable Changed;
+            bool Cancelled{ false };
+            bool RunningCallbacks{ false };
+            std::thread::id CancellingThread{};
+            uint64_t NextId{ 1 };
+            std::map<uint64_t, std::function<void()>> Callbacks;
+        };
+    }
+
+    SyncCancellationToken::SyncCancellationToken(std::shared_ptr<detail::SyncCancellationState> state) noexcept :
+        m_state(std::move(state))
+    {
+    }
+
+    bool SyncCancellationToken::IsCancellationRequested() const noexcept
+    {
+        if (!m_state)
+        {
+            return false;
+        }
+        std::lock_guard lock(m_state->Mutex);
+        return m_state->Cancelled;
+    }
+
+    bool SyncCancellationToken::WaitFor(std::chrono::milliseconds timeout) const
+    {
+        if (!m_state)
+        {
+            std::this_thread::sleep_for(timeout);
+            return true;
+        }
+        std::unique_lock lock(m_state->Mutex);
+        return !m_state->Changed.wait_for(lock, timeout, [&]() { return m_state->Cancelled; });
+    }
+
+    SyncCancellationSource::SyncCancellationSource() :
+        m_state(std::make_shared<detail::SyncCancellationState>())
+    {
+    }
+
+    SyncCancellationToken SyncCancellationSource::Token() const noexcept
+    {
+        return SyncCancellationToken(m_state);
+    }
+
+    void SyncCancellationSource::Cancel() noexcept
+    {
+        std::map<uint64_t, std::function<void()>> callbacks;
+        {
+            std::lock_guard lock(m_state->Mutex);
+            if (m_state->Cancelled)
+            {
+                return;
+            }
+            m_state->Cancelled = true;
+            m_state->RunningCallbacks = true;
+            m_state->CancellingThread = std::this_thread::get_id();
+            callbacks.swap(m_state->Callbacks);
+        }
+        m_state->Changed.notify_all();
+
+        for (auto& [id, callback] : callbacks)
+        {
+            try
+            {
+                callback();
+            }
+            catch (...)
+            {
+            }
+        }
+
+        {
+            std::lock_guard lock(m_state->Mutex);
+            m_state->RunningCallbacks = false;
+        }
+        m_state->Changed.notify_all();
+    }
+
+    bool SyncCancellationSource::IsCancellationRequested() const noexcept
+    {
+        std::lock_guard lock(m_state->Mutex);
+        return m_state->Cancelled;
+    }
+
+    SyncCancellationRegistration::SyncCancellationRegistration(SyncCancellationToken const& token, std::function<void()> callback)
+    {
+        if (!token.m_state || !callback)
+        {
+            return;
+        }
+        {
+            std::lock_guard lock(token.m_state->Mutex);
+            if (!token.m_state->Cancelled)
+            {
+                m_state = token.m_state;
+                m_id = m_state->NextId++;
+                m_state->Callbacks.emplace(m_id, std::move(callback));
+                return;
+            }
+        }
+        callback();
+    }
+
+    SyncCancellationRegistration::~SyncCancellationRegistration()
+    {
+        Reset();
+    }
+
+    void SyncCancellationRegistration::Reset() noexcept
+    {
+        if (!m_state)
+        {
+            return;
+        }
+
+        std::unique_lock lock(m_state->Mutex);
+        if (m_state->Callbacks.erase(m_id) == 0 && m_state->CancellingThread != std::this_thread::get_id())
+        {
+            // Cancel() が取り出した callback を実行中かもしれないので終わるまで待つ。
+            m_state->Changed.wait(lock, [&]() { return !m_state->RunningCallbacks; });
+        }
+        lock.unlock();
+        m_state.reset();
+        m_id = 0;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace tsupasswd
+{
+    namespace detail
+    {
+        struct SyncCancellationState;
+    }
+
+    // 同期処理の取消通知を受け取る側。既定構築のものは取消されない。コピーは同じ状態を共有する。
+    class SyncCancellationToken final
+    {
+    public:
+        SyncCancellationToken() noexcept = default;
+
+        bool CanBeCancelled() const noexcept { return m_state != nullptr; }
+        bool IsCancellationRequested() const noexcept;
+
+        // timeout まで待つ。途中で取消されたら false (sleep_for の代わりに backoff で使う)。
+        bool WaitFor(std::chrono::milliseconds timeout) const;
+
+    private:
+        friend class SyncCancellationSource;
+        friend class SyncCancellationRegistration;
+
+        explicit SyncCancellationToken(std::shared_ptr<detail::SyncCancellationState> state) noexcept;
+
+        std::shared_ptr<detail::SyncCancellationState> m_state;
+    };
+
+    // 取消を要求する側。UI の「中止」ボタンなど、操作ごとに 1 つ作る。
+    class SyncCancellationSource final
+    {
+    public:
+        SyncCancellationSource();
+
+        SyncCancellationToken Token() const noexcept;
+        // 登録済みの callback をこのスレッドで呼ぶ。2 回目以降は何もしない。
+        void Cancel() noexcept;
+        bool IsCancellationRequested() const noexcept;
+
+    private:
+        std::shared_ptr<detail::SyncCancellationState> m_state;
+    };
+
+    // 取消時に callback を呼ぶ登録。既に取消済みなら構築中にその場で呼ぶ。
+    // 破棄時に callback が別スレッドで実行中なら終わるまで待つので、callback が参照する資源より先に破棄すること。
+    class SyncCancellationRegistration final
+    {
+    public:
+        SyncCancellationRegistration() noexcept = default;
+        SyncCancellationRegistration(SyncCancellationToken const& token, std::function<void()> callback);
+        ~SyncCancellationRegistration();
+
+        SyncCancellationRegistration(SyncCancellationRegistration const&) = delete;
+        SyncCancellationRegistration& operator=(SyncCancellationRegistration const&) = delete;
+
+        void Reset() noexcept;
+
+    private:
+        std::shared_ptr<detail::SyncCancellationState> m_state;
+        uint64_t m_id{ 0 };
+    };
+}
@@ -1,100 +1,85 @@
-#include "pch.h"
 #include "SyncClient.h"
-
-#include <wincrypt.h>
-#include <winhttp.h>
-#include <winrt/Windows.Data.Json.h>
+#include "NativeMessagingJson.h"
+#include "SyncBodyDecoder.h"
+#include "SyncTransport.h"
+#include "SyncAsync.h"
+#include "SyncLatencyTracker.h"
+#include "SyncTokenCache.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <new>
+#include <utility>
 
 #include "tsupasswd_opaque_raii.hpp"
 
-#pragma comment(lib, "Winhttp.lib")
-
-#pragma comment(lib, "Crypt32.lib")
-
 namespace tsupasswd
 {
     namespace
     {
-        class WinHttpHandle
-        {
-        public:
-            WinHttpHandle() noexcept = default;
-            explicit WinHttpHandle(HINTERNET handle) noexcept :
-                m_handle(handle)
-            {
-            }
+        constexpr char kBase64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-            ~WinHttpHandle() noexcept
+        std::string Base64StdEncode(uint8_t const* bytes, size_t len)
+        {
+            std::string out;
+            if (!bytes || len == 0)
             {
-                reset();
+                return out;
             }
 
-            WinHttpHandle(WinHttpHandle const&) = delete;
-            WinHttpHandle& operator=(WinHttpHandle const&) = delete;
-
-            WinHttpHandle(WinHttpHandle&& other) noexcept :
-                m_handle(other.m_handle)
+            out.reserve(((len + 2) / 3) * 4);
+            size_t i = 0;
+            for (; i + 3 <= len; i += 3)
             {
-                other.m_handle = nullptr;
+                uint32_t triple = (static_cast<uint32_t>(bytes[i]) << 16) | (static_cast<uint32_t>(bytes[i + 1]) << 8) | bytes[i + 2];
+                out.push_back(kBase64Alphabet[(triple >> 18) & 0x3F]);
+                out.push_back(kBase64Alphabet[(triple >> 12) & 0x3F]);
+                out.push_back(kBase64Alphabet[(triple >> 6) & 0x3F]);
+                out.push_back(kBase64Alphabet[triple & 0x3F]);
             }
-
-            WinHttpHandle& operator=(WinHttpHandle&& other) noexcept
+            if (i < len)
             {
-                if (this != &other)
+                uint32_t triple = static_cast<uint32_t>(bytes[i]) << 16;
+                if (i + 1 < len)
                 {
-                    reset();
-                    m_handle = other.m_handle;
-                    other.m_handle = nullptr;
+                    triple |= static_cast<uint32_t>(bytes[i + 1]) << 8;
                 }
-                return *this;
-            }
-
-            HINTERNET get() const noexcept
-            {
-                return m_handle;
+                out.push_back(kBase64Alphabet[(triple >> 18) & 0x3F]);
+                out.push_back(kBase64Alphabet[(triple >> 12) & 0x3F]);
+                out.push_back(i + 1 < len ? kBase64Alphabet[(triple >> 6) & 0x3F] : '=');
+                out.push_back('=');
             }
+            return out;
+        }
 
-            void reset(HINTERNET handle = nullptr) noexcept
+        int Base64Value(char c) noexcept
+        {
+            if (c >= 'A' && c <= 'Z')
             {
-                if (m_handle)
-                {
-                    WinHttpCloseHandle(m_handle);
-                }
-                m_handle = handle;
+                return c - 'A';
             }
-
-        private:
-            HINTERNET m_handle{ nullptr };
-        };
-
-        std::wstring Base64StdEncode(uint8_t const* bytes, size_t len)
-        {
-            if (!bytes || len == 0)
+            if (c >= 'a' && c <= 'z')
             {
-                return L"";
+                return c - 'a' + 26;
             }
-
-            DWORD outChars = 0;
-            if (!CryptBinaryToStringW(bytes, static_cast<DWORD>(len), CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, nullptr, &outChars))
+            if (c >= '0' && c <= '9')
             {
-                return L"";
+                return c - '0' + 52;
             }
-
-            std::wstring out;
-            out.resize(outChars);
-            if (!CryptBinaryToStringW(bytes, static_cast<DWORD>(len), CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, out.data(), &outChars))
+            if (c == '+')
             {
-                return L"";
+                return 62;
             }
-
-            while (!out.empty() && out.back() == L'\0')
+            if (c == '/')
             {
-                out.pop_back();
+                return 63;
             }
-            return out;
+            return -1;
         }
 
-        bool Base64StdDecode(std::wstring const& b64, std::vector<uint8_t>& out)
+        // CryptStringToBinaryW(CRYPT_STRING_BASE64) と同じく空白と改行は読み飛ばす。
+        bool Base64StdDecode(std::string_view b64, std::vector<uint8_t>& out)
         {
             out.clear();
             if (b64.empty())
@@ -102,257 +87,238 @@ namespace tsupasswd
                 return false;
             }
 
-            DWORD outBytes = 0;
-            if (!CryptStringToBinaryW(b64.c_str(), static_cast<DWORD>(b64.size()), CRYPT_STRING_BASE64, nullptr, &outBytes, nullptr, nullptr))
+            out.reserve((b64.size() / 4) * 3);
+            uint32_t accumulator = 0;
+            int bits = 0;
+            size_t padding = 0;
+            for (char c : b64)
             {
-                return false;
+                if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+                {
+                    continue;
+                }
+                if (c == '=')
+                {
+                    ++padding;
+                    continue;
+                }
+                int value = Base64Value(c);
+                if (value < 0 || padding > 0)
+                {
+                    out.clear();
+                    return false;
+                }
+                accumulator = (accumulator << 6) | static_cast<uint32_t>(value);
+                bits += 6;
+                if (bits >= 8)
+                {
+                    bits -= 8;
+                    out.push_back(static_cast<uint8_t>((accumulator >> bits) & 0xFF));
+                }
             }
-
-            out.resize(outBytes);
-            if (!CryptStringToBinaryW(b64.c_str(), static_cast<DWORD>(b64.size()), CRYPT_STRING_BASE64, out.data(), &outBytes, nullptr, nullptr))
+            if (padding > 2 || bits >= 6)
             {
                 out.clear();
                 return false;
             }
-            out.resize(outBytes);
             return true;
         }
 
-        std::wstring GetNamedStringOrEmpty(winrt::Windows::Data::Json::JsonObject const& obj, wchar_t const* name)
+        std::wstring Utf8ToWide(std::string_view utf8)
         {
-            if (!obj.HasKey(name))
-            {
-                return L"";
-            }
-            auto value = obj.GetNamedValue(name, nullptr);
-            if (!value || value.ValueType() != winrt::Windows::Data::Json::JsonValueType::String)
-            {
-                return L"";
-            }
-            return std::wstring(value.GetString().c_str());
+            std::wstring wide;
+            AppendUtf8ToWide(utf8, wide);
+            return wide;
+        }
+
+        std::string WideToUtf8(std::wstring_view wide)
+        {
+            std::string utf8;
+            AppendWideToUtf8(wide, utf8);
+            return utf8;
         }
 
         struct ParsedBaseUrl
         {
-            std::wstring Host{};
-            std::wstring BasePath{ L"/" };
-            INTERNET_PORT Port{ INTERNET_DEFAULT_HTTPS_PORT };
+            std::string Host{};
+            std::string BasePath{ "/" };
+            uint16_t Port{ 443 };
             bool Secure{ true };
         };
 
-        std::wstring Utf8ToWide(std::string const& utf8)
+        bool TryParseBaseUrl(std::wstring const& baseUrl, ParsedBaseUrl& out)
         {
-            if (utf8.empty())
-            {
-                return L"";
-            }
-            int cch = MultiByteToWideChar(CP_UTF8, 0, utf8.data(), static_cast<int>(utf8.size()), nullptr, 0);
-            if (cch <= 0)
+            out = {};
+            std::string url = WideToUtf8(baseUrl);
+            size_t schemeEnd = url.find("://");
+            if (schemeEnd == std::string::npos)
             {
-                return L"";
+                return false;
             }
 
-            std::wstring wide;
-            wide.resize(static_cast<size_t>(cch));
-            MultiByteToWideChar(CP_UTF8, 0, utf8.data(), static_cast<int>(utf8.size()), wide.data(), cch);
-            return wide;
-        }
-
-        std::string WideToUtf8(std::wstring const& wide)
-        {
-            if (wide.empty())
+            std::string scheme = url.substr(0, schemeEnd);
+            for (char& c : scheme)
             {
-                return {};
+                if (c >= 'A' && c <= 'Z')
+                {
+                    c = static_cast<char>(c - 'A' + 'a');
+                }
             }
-
-            int cb = WideCharToMultiByte(CP_UTF8, 0, wide.data(), static_cast<int>(wide.size()), nullptr, 0, nullptr, nullptr);
-            if (cb <= 0)
+            if (scheme == "https")
             {
-                return {};
+                out.Secure = true;
+                out.Port = 443;
             }
-
-            std::string utf8;
-            utf8.resize(static_cast<size_t>(cb));
-            WideCharToMultiByte(CP_UTF8, 0, wide.data(), static_cast<int>(wide.size()), utf8.data(), cb, nullptr, nullptr);
-            return utf8;
-        }
-
-        ParsedBaseUrl ParseBaseUrl(std::wstring const& baseUrl)
-        {
-            URL_COMPONENTS uc{};
-            uc.dwStructSize = sizeof(uc);
-
-            wchar_t host[256]{};
-            wchar_t path[1024]{};
-            uc.lpszHostName = host;
-            uc.dwHostNameLength = ARRAYSIZE(host);
-            uc.lpszUrlPath = path;
-            uc.dwUrlPathLength = ARRAYSIZE(path);
-
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpCrackUrl(baseUrl.c_str(), 0, 0, &uc));
-
-            ParsedBaseUrl out{};
-            out.Host.assign(uc.lpszHostName, uc.dwHostNameLength);
-            out.Port = uc.nPort;
-            out.Secure = uc.nScheme == INTERNET_SCHEME_HTTPS;
-
-            if (uc.dwUrlPathLength > 0)
+            else if (scheme == "http")
             {
-                out.BasePath.assign(uc.lpszUrlPath, uc.dwUrlPathLength);
+                out.Secure = false;
+                out.Port = 80;
             }
-            if (out.BasePath.empty())
+            else
             {
-                out.BasePath = L"/";
+                return false;
             }
-            while (out.BasePath.size() > 1 && out.BasePath.back() == L'/')
+
+            size_t authorityStart = schemeEnd + 3;
+            size_t authorityEnd = url.find_first_of("/?#", authorityStart);
+            std::string_view authority = std::string_view(url).substr(
+                authorityStart,
+                authorityEnd == std::string::npos ? std::string_view::npos : authorityEnd - authorityStart);
+            size_t userInfoEnd = authority.rfind('@');
+            if (userInfoEnd != std::string_view::npos)
             {
-                out.BasePath.pop_back();
+                authority.remove_prefix(userInfoEnd + 1);
             }
 
-            return out;
-        }
-
-        std::wstring BuildRequestPath(std::wstring const& basePath, std::wstring const& suffix)
-        {
-            std::wstring path = basePath;
-            if (path.empty())
+            std::string_view host = authority;
+            std::string_view port{};
+            if (!authority.empty() && authority.front() == '[')
             {
-                path = L"/";
+                size_t close = authority.find(']');
+                if (close == std::string_view::npos)
+                {
+                    return false;
+                }
+                host = authority.substr(1, close - 1);
+                std::string_view rest = authority.substr(close + 1);
+                if (!rest.empty())
+                {
+                    if (rest.front() != ':')
+                    {
+                        return false;
+                    }
+                    port = rest.substr(1);
+                }
             }
-            if (path.back() != L'/')
+            else
             {
-                path.push_back(L'/');
+                size_t colon = authority.rfind(':');
+                if (colon != std::string_view::npos)
+                {
+                    host = authority.substr(0, colon);
+                    port = authority.substr(colon + 1);
+                }
             }
-
-            if (!suffix.empty() && suffix.front() == L'/')
+            if (host.empty())
             {
-                path += suffix.substr(1);
+                return false;
             }
-            else
+            if (!port.empty())
             {
-                path += suffix;
+                uint32_t value = 0;
+                auto [ptr, ec] = std::from_chars(port.data(), port.data() + port.size(), value);
+                if (ec != std::errc{} || ptr != port.data() + port.size() || value == 0 || value > 65535)
+                {
+                    return false;
+                }
+                out.Port = static_cast<uint16_t>(value);
             }
-            return path;
-        }
+            out.Host.assign(host);
 
-        std::string ReadResponseBody(HINTERNET hRequest)
-        {
-            std::string body;
-            DWORD size = 0;
-            while (WinHttpQueryDataAvailable(hRequest, &size) && size > 0)
+            if (authorityEnd != std::string::npos)
+            {
+                out.BasePath = url.substr(authorityEnd);
+                if (out.BasePath.front() != '/')
+                {
+                    out.BasePath.insert(out.BasePath.begin(), '/');
+                }
+            }
+            while (out.BasePath.size() > 1 && out.BasePath.back() == '/')
             {
-                std::string chunk;
-                chunk.resize(size);
-                DWORD read = 0;
-                THROW_IF_WIN32_BOOL_FALSE(WinHttpReadData(hRequest, chunk.data(), size, &read));
-                chunk.resize(read);
-                body += chunk;
-                size = 0;
+                out.BasePath.pop_back();
             }
-            return body;
-        }
-
-        int32_t QueryStatusCode(HINTERNET hRequest)
-        {
-            DWORD statusCode = 0;
-            DWORD size = sizeof(statusCode);
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpQueryHeaders(
-                hRequest,
-                WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
-                WINHTTP_HEADER_NAME_BY_INDEX,
-                &statusCode,
-                &size,
-                WINHTTP_NO_HEADER_INDEX));
-            return static_cast<int32_t>(statusCode);
+            return true;
         }
 
-        std::wstring QueryHeaderString(HINTERNET hRequest, wchar_t const* headerName)
+        std::string BuildRequestPath(std::string const& basePath, std::string_view suffix)
         {
-            DWORD size = 0;
-            if (!WinHttpQueryHeaders(
-                hRequest,
-                WINHTTP_QUERY_CUSTOM,
-                headerName,
-                WINHTTP_NO_OUTPUT_BUFFER,
-                &size,
-                WINHTTP_NO_HEADER_INDEX))
+            std::string path = basePath;
+            if (path.empty())
             {
-                if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
-                {
-                    return L"";
-                }
+                path = "/";
             }
-
-            if (size == 0)
+            if (path.back() != '/')
             {
-                return L"";
+                path.push_back('/');
             }
 
-            std::wstring value;
-            value.resize(size / sizeof(wchar_t));
-            if (!WinHttpQueryHeaders(
-                hRequest,
-                WINHTTP_QUERY_CUSTOM,
-                headerName,
-                value.data(),
-                &size,
-                WINHTTP_NO_HEADER_INDEX))
+            if (!suffix.empty() && suffix.front() == '/')
             {
-                return L"";
+                suffix.remove_prefix(1);
             }
+            path += suffix;
+            return path;
+        }
 
-            while (!value.empty() && value.back() == L'\0')
-            {
-                value.pop_back();
-            }
-            return value;
+        std::string BuildVaultPath(std::string const& basePath, std::wstring const& userId)
+        {
+            return BuildRequestPath(basePath, "v1/vaults/" + WideToUtf8(userId));
         }
 
-        std::wstring QueryRequestId(HINTERNET hRequest)
+        std::wstring JsonString(Utf8JsonReader const& reader, size_t objectIndex, std::string_view name)
         {
-            std::wstring requestId = QueryHeaderString(hRequest, L"x-request-id");
-            if (!requestId.empty())
-            {
-                return requestId;
-            }
-            requestId = QueryHeaderString(hRequest, L"request-id");
-            if (!requestId.empty())
+            std::wstring value;
+            if (!reader.TryGetString(objectIndex, name, value))
             {
-                return requestId;
+                value.clear();
             }
-            return QueryHeaderString(hRequest, L"x-ms-request-id");
+            return value;
         }
 
-        std::wstring TryGetJsonString(winrt::Windows::Data::Json::JsonObject const& obj, wchar_t const* name)
+        int64_t JsonInt64(Utf8JsonReader const& reader, size_t objectIndex, std::string_view name, int64_t fallback = 0)
         {
-            if (!obj.HasKey(name))
-            {
-                return L"";
-            }
+            int64_t value = 0;
+            return reader.TryGetInt64(objectIndex, name, value) ? value : fallback;
+        }
 
-            auto value = obj.GetNamedValue(name, nullptr);
-            if (!value || value.ValueType() != winrt::Windows::Data::Json::JsonValueType::String)
+        void SetClientError(SyncHttpStatus* outStatus, wchar_t const* errorCode, std::wstring message)
+        {
+            if (outStatus)
             {
-                return L"";
+                outStatus->ErrorCode = errorCode;
+                outStatus->ErrorMessage = std::move(message);
             }
+        }
 
-            return std::wstring(value.GetString().c_str());
+        std::wstring FailedBeforeResponseMessage(wchar_t const* operation)
+        {
+            return std::wstring(L"SyncClient::") + operation + L" failed before receiving valid response.";
         }
 
-        int64_t TryGetJsonInt64(winrt::Windows::Data::Json::JsonObject const& obj, wchar_t const* name, int64_t fallback = 0)
+        HRESULT HResultFromCaughtException() noexcept
         {
-            if (!obj.HasKey(name))
+            try
             {
-                return fallback;
+                throw;
             }
-
-            auto value = obj.GetNamedValue(name, nullptr);
-            if (!value || value.ValueType() != winrt::Windows::Data::Json::JsonValueType::Number)
+            catch (std::bad_alloc const&)
             {
-                return fallback;
+                return E_OUTOFMEMORY;
+            }
+            catch (...)
+            {
+                return E_FAIL;
             }
-
-            return static_cast<int64_t>(value.GetNumber());
         }
 
         void ParseErrorBody(std::string const& bodyUtf8, SyncHttpStatus* outStatus)
@@ -362,41 +328,20 @@ namespace tsupasswd
                 return;
             }
 
-            try
-            {
-                auto root = winrt::Windows::Data::Json::JsonObject::Parse(Utf8ToWide(bodyUtf8));
-                outStatus->ErrorCode = TryGetJsonString(root, L"code");
-                outStatus->ErrorMessage = TryGetJsonString(root, L"message");
-                outStatus->ServerVersion = TryGetJsonInt64(root, L"server_version", -1);
-                if (outStatus->RequestId.empty())
-                {
-                    outStatus->RequestId = TryGetJsonString(root, L"request_id");
-                }
-            }
-            catch (...)
+            Utf8JsonReader reader;
+            if (!reader.Parse(bodyUtf8) || reader.Token(Utf8JsonReader::Root).Type != Utf8JsonTokenType::Object)
             {
                 outStatus->ErrorMessage = Utf8ToWide(bodyUtf8);
+                return;
             }
-        }
-
-        void FillVaultRecordFromJsonAxum(
-            winrt::Windows::Data::Json::JsonObject const& root,
-            std::wstring const& userId,
-            VaultRecord& outRecord)
-        {
-            outRecord = {};
-            outRecord.UserId = userId;
-            outRecord.VaultVersion = TryGetJsonInt64(root, L"server_version", 0);
-            outRecord.DeviceClock = L"";
-
-            outRecord.Blob.CiphertextBase64 = TryGetJsonString(root, L"cipher_blob_base64");
-            outRecord.Blob.NonceBase64 = L"";
-            outRecord.Blob.AadBase64 = L"";
 
-            outRecord.Meta.CreatedAt = L"";
-            outRecord.Meta.UpdatedAt = TryGetJsonString(root, L"updated_at");
-            outRecord.Meta.LastWriterDeviceId = L"";
-            outRecord.Meta.BlobSha256Base64 = L"";
+            outStatus->ErrorCode = JsonString(reader, Utf8JsonReader::Root, "code");
+            outStatus->ErrorMessage = JsonString(reader, Utf8JsonReader::Root, "message");
+            outStatus->ServerVersion = JsonInt64(reader, Utf8JsonReader::Root, "server_version", -1);
+            if (outStatus->RequestId.empty())
+            {
+                outStatus->RequestId = JsonString(reader, Utf8JsonReader::Root, "request_id");
+            }
         }
 
         HRESULT MapHttpStatusToHr(int32_t statusCode)
@@ -405,6 +350,10 @@ namespace tsupasswd
             {
                 return S_OK;
             }
+            if (statusCode == 304)
+            {
+                return S_FALSE;
+            }
             if (statusCode == 404)
             {
                 return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
@@ -420,233 +369,724 @@ namespace tsupasswd
             return E_FAIL;
         }
 
-        HRESULT EnsureTransportPolicy(
-            ParsedBaseUrl const& parsed,
+        HRESULT ResolveBaseUrl(
+            std::wstring const& baseUrl,
             bool allowInsecureHttp,
             SyncHttpStatus* outStatus,
-            wchar_t const* operation)
+            wchar_t const* operation,
+            ParsedBaseUrl& outParsed)
         {
-            if (parsed.Secure || allowInsecureHttp)
+            if (!TryParseBaseUrl(baseUrl, outParsed))
             {
-                return S_OK;
+                SetClientError(outStatus, L"CLIENT_ERROR", FailedBeforeResponseMessage(operation));
+                return HRESULT_FROM_WIN32(ERROR_WINHTTP_INVALID_URL);
             }
-
-            if (outStatus)
+            if (outParsed.Secure || allowInsecureHttp)
             {
-                outStatus->ErrorCode = L"INSECURE_HTTP_BLOCKED";
-                outStatus->ErrorMessage = std::wstring(L"SyncClient::") + operation + L" blocked insecure HTTP URL. Set TSUPASSWD_SYNC_ALLOW_INSECURE_HTTP=1 only for development.";
+                return S_OK;
             }
+
+            SetClientError(
+                outStatus,
+                L"INSECURE_HTTP_BLOCKED",
+                std::wstring(L"SyncClient::") + operation + L" blocked insecure HTTP URL. Set TSUPASSWD_SYNC_ALLOW_INSECURE_HTTP=1 only for development.");
             return HRESULT_FROM_WIN32(ERROR_ACCESS_DISABLED_BY_POLICY);
         }
 
-        void FillVaultRecordFromJson(winrt::Windows::Data::Json::JsonObject const& root, VaultRecord& outRecord)
+        std::wstring ResponseRequestId(SyncTransportResponse const& response)
         {
-            outRecord = {};
-            outRecord.UserId = TryGetJsonString(root, L"user_id");
-            outRecord.VaultVersion = TryGetJsonInt64(root, L"vault_version", 0);
-            outRecord.DeviceClock = TryGetJsonString(root, L"device_clock");
-
-            auto vaultBlob = root.GetNamedObject(L"vault_blob", nullptr);
-            if (vaultBlob)
+            for (std::string_view name : { std::string_view("x-request-id"), std::string_view("request-id"), std::string_view("x-ms-request-id") })
             {
-                outRecord.Blob.CiphertextBase64 = TryGetJsonString(vaultBlob, L"ciphertext_b64");
-                outRecord.Blob.NonceBase64 = TryGetJsonString(vaultBlob, L"nonce_b64");
-                outRecord.Blob.AadBase64 = TryGetJsonString(vaultBlob, L"aad_b64");
-                auto alg = TryGetJsonString(vaultBlob, L"alg");
-                if (!alg.empty())
+                std::string const* value = response.FindHeader(name);
+                if (value && !value->empty())
                 {
-                    outRecord.Blob.Algorithm = alg;
+                    return Utf8ToWide(*value);
                 }
             }
+            return L"";
+        }
 
-            auto keyEnvelope = root.GetNamedObject(L"key_envelope", nullptr);
-            if (keyEnvelope)
+        // Retry-After の delta-seconds。HTTP-date の形と解釈できない値は -1 (呼び出し側の backoff に任せる)。
+        int32_t ResponseRetryAfterMs(SyncTransportResponse const& response)
+        {
+            std::string const* value = response.FindHeader("retry-after");
+            if (!value)
             {
-                auto kekScheme = TryGetJsonString(keyEnvelope, L"kek_scheme");
-                if (!kekScheme.empty())
-                {
-                    outRecord.Envelope.KekScheme = kekScheme;
-                }
-                outRecord.Envelope.WrappedDekBase64 = TryGetJsonString(keyEnvelope, L"wrapped_dek_b64");
-                outRecord.Envelope.WrapNonceBase64 = TryGetJsonString(keyEnvelope, L"wrap_nonce_b64");
-                outRecord.Envelope.KdfSaltBase64 = TryGetJsonString(keyEnvelope, L"kdf_salt_b64");
-                auto kdfInfo = TryGetJsonString(keyEnvelope, L"kdf_info");
-                if (!kdfInfo.empty())
+                return -1;
+            }
+            std::string_view text = *value;
+            while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+            {
+                text.remove_prefix(1);
+            }
+            while (!text.empty() && (text.back() == ' ' || text.back() == '\t'))
+            {
+                text.remove_suffix(1);
+            }
+            if (text.empty())
+            {
+                return -1;
+            }
+            int64_t seconds = 0;
+            for (char ch : text)
+            {
+                if (ch < '0' || ch > '9')
                 {
-                    outRecord.Envelope.KdfInfo = kdfInfo;
+                    return -1;
                 }
+                seconds = (std::min<int64_t>)(seconds * 10 + (ch - '0'), INT32_MAX / 1000);
             }
+            return static_cast<int32_t>(seconds * 1000);
+        }
 
-            auto meta = root.GetNamedObject(L"meta", nullptr);
-            if (meta)
+        // 取消済みなら ERROR_CANCELLED、期限切れなら ERROR_TIMEOUT を outStatus に入れて返す。
+        HRESULT CheckCallOptions(SyncCallOptions const& options, wchar_t const* operation, SyncHttpStatus* outStatus)
+        {
+            if (options.Cancellation.IsCancellationRequested())
             {
-                outRecord.Meta.CreatedAt = TryGetJsonString(meta, L"created_at");
-                outRecord.Meta.UpdatedAt = TryGetJsonString(meta, L"updated_at");
-                outRecord.Meta.LastWriterDeviceId = TryGetJsonString(meta, L"last_writer_device_id");
-                outRecord.Meta.BlobSha256Base64 = TryGetJsonString(meta, L"blob_sha256_b64");
+                SetClientError(outStatus, L"CANCELLED", std::wstring(L"SyncClient::") + operation + L" was cancelled.");
+                return HRESULT_FROM_WIN32(ERROR_CANCELLED);
             }
+            if (options.Deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= options.Deadline)
+            {
+                SetClientError(outStatus, L"DEADLINE_EXCEEDED", std::wstring(L"SyncClient::") + operation + L" exceeded its deadline.");
+                return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+            }
+            return S_OK;
         }
 
-        std::wstring BuildPutVaultJson(PutVaultRequest const& request)
+        // 1 回の操作 (複数往復を含む) の間、共通に使う timeout と期限。
+        struct SyncOperationContext
         {
-            using namespace winrt::Windows::Data::Json;
-
-            JsonObject root;
-            root.SetNamedValue(L"expected_version", JsonValue::CreateNumberValue(static_cast<double>(request.ExpectedVersion)));
-            root.SetNamedValue(L"new_version", JsonValue::CreateNumberValue(static_cast<double>(request.NewVersion)));
-            root.SetNamedValue(L"device_id", JsonValue::CreateStringValue(request.DeviceId));
-
-            JsonObject blob;
-            blob.SetNamedValue(L"ciphertext_b64", JsonValue::CreateStringValue(request.Blob.CiphertextBase64));
-            blob.SetNamedValue(L"nonce_b64", JsonValue::CreateStringValue(request.Blob.NonceBase64));
-            blob.SetNamedValue(L"aad_b64", JsonValue::CreateStringValue(request.Blob.AadBase64));
-            blob.SetNamedValue(L"alg", JsonValue::CreateStringValue(request.Blob.Algorithm));
-            root.SetNamedValue(L"vault_blob", blob);
-
-            JsonObject envelope;
-            envelope.SetNamedValue(L"kek_scheme", JsonValue::CreateStringValue(request.Envelope.KekScheme));
-            envelope.SetNamedValue(L"wrapped_dek_b64", JsonValue::CreateStringValue(request.Envelope.WrappedDekBase64));
-            envelope.SetNamedValue(L"wrap_nonce_b64", JsonValue::CreateStringValue(request.Envelope.WrapNonceBase64));
-            envelope.SetNamedValue(L"kdf_salt_b64", JsonValue::CreateStringValue(request.Envelope.KdfSaltBase64));
-            envelope.SetNamedValue(L"kdf_info", JsonValue::CreateStringValue(request.Envelope.KdfInfo));
-            root.SetNamedValue(L"key_envelope", envelope);
+            SyncTimeouts Timeouts{};
+            // Deadline は呼び出し側の期限と OperationTimeoutMs の早い方。
+            SyncCallOptions Options{};
+            SyncLatencyTracker* Tracker{ nullptr };
+        };
 
-            JsonObject meta;
-            meta.SetNamedValue(L"created_at", JsonValue::CreateStringValue(request.Meta.CreatedAt));
-            meta.SetNamedValue(L"updated_at", JsonValue::CreateStringValue(request.Meta.UpdatedAt));
-            meta.SetNamedValue(L"last_writer_device_id", JsonValue::CreateStringValue(request.Meta.LastWriterDeviceId));
-            meta.SetNamedValue(L"blob_sha256_b64", JsonValue::CreateStringValue(request.Meta.BlobSha256Base64));
-            root.SetNamedValue(L"meta", meta);
+        SyncOperationContext BeginOperation(SyncTimeouts const& timeouts, SyncCallOptions const& callOptions, SyncLatencyTracker& tracker)
+        {
+            SyncOperationContext context{ timeouts, callOptions, &tracker };
+            if (timeouts.OperationTimeoutMs > 0)
+            {
+                auto operationDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeouts.OperationTimeoutMs);
+                context.Options.Deadline = (std::min)(context.Options.Deadline, operationDeadline);
+            }
+            return context;
+        }
 
-            return std::wstring(root.Stringify().c_str());
+        // 往復時間は経路の性質なので、port や scheme ではなく host ごとに覚える。
+        std::string LatencyKey(ParsedBaseUrl const& parsed)
+        {
+            return parsed.Host;
         }
 
-        std::wstring BuildPutVaultJsonAxum(PutVaultRequest const& request)
+        // 1 往復して outStatus に StatusCode と RequestId を入れる。HTTP エラーは MapHttpStatusToHr の値を返す。
+        HRESULT SendSyncRequest(
+            ISyncTransport& transport,
+            ParsedBaseUrl const& parsed,
+            std::string_view method,
+            std::string path,
+            std::string_view bodyUtf8,
+            std::wstring const& bearerToken,
+            SyncOperationContext const& context,
+            wchar_t const* operation,
+            SyncTransportResponse& outResponse,
+            SyncHttpStatus* outStatus,
+            std::vector<SyncHttpHeader> extraHeaders = {},
+            ISyncResponseBodySink* bodySink = nullptr)
         {
-            using namespace winrt::Windows::Data::Json;
+            SyncCallOptions const& options = context.Options;
+            HRESULT hrOptions = CheckCallOptions(options, operation, outStatus);
+            if (FAILED(hrOptions))
+            {
+                return hrOptions;
+            }
 
-            JsonObject root;
-            root.SetNamedValue(L"expected_server_version", JsonValue::CreateNumberValue(static_cast<double>(request.ExpectedVersion)));
-            root.SetNamedValue(L"cipher_blob_base64", JsonValue::CreateStringValue(request.Blob.CiphertextBase64));
-            return std::wstring(root.Stringify().c_str());
-        }
-    }
+            std::string origin = LatencyKey(parsed);
+            SyncTransportRequest request{};
+            request.Method = method;
+            request.Host = parsed.Host;
+            request.Port = parsed.Port;
+            request.Secure = parsed.Secure;
+            request.Path = std::move(path);
+            request.Body = bodyUtf8;
+            request.ConnectTimeoutMs = context.Timeouts.AdaptiveConnectTimeout ?
+                context.Tracker->AdaptiveConnectTimeoutMs(origin, context.Timeouts.ConnectTimeoutMs) :
+                context.Timeouts.ConnectTimeoutMs;
+            request.FirstByteTimeoutMs = context.Timeouts.FirstByteTimeoutMs;
+            request.TransferTimeoutMs = context.Timeouts.TransferTimeoutMs;
+            request.Cancellation = options.Cancellation;
+            request.Deadline = options.Deadline;
+            request.BodySink = bodySink;
+            request.Headers = std::move(extraHeaders);
+            bool hasContentType = std::any_of(request.Headers.begin(), request.Headers.end(), [](SyncHttpHeader const& header)
+            {
+                return header.Name == "Content-Type";
+            });
+            if (!bodyUtf8.empty() && !hasContentType)
+            {
+                request.Headers.push_back(SyncHttpHeader{ "Content-Type", "application/json; charset=utf-8" });
+            }
+            if (!bearerToken.empty())
+            {
+                request.Headers.push_back(SyncHttpHeader{ "Authorization", "Bearer " + WideToUtf8(bearerToken) });
+            }
 
-    SyncClient::SyncClient(std::wstring baseUrl) :
-        m_baseUrl(std::move(baseUrl))
-    {
-    }
+            HRESULT hr = transport.Send(request, outResponse);
+            if (outStatus)
+            {
+                outStatus->Timing.Add(outResponse.Timing);
+            }
+            if (FAILED(hr))
+            {
+                // transport の取消/期限切れは呼び出し側が区別できるように CANCELLED / DEADLINE_EXCEEDED にする。
+                hrOptions = CheckCallOptions(options, operation, outStatus);
+                if (FAILED(hrOptions))
+                {
+                    return hrOptions;
+                }
+                if (hr == HRESULT_FROM_WIN32(ERROR_WINHTTP_TIMEOUT))
+                {
+                    context.Tracker->Reset(origin);
+                }
+                SetClientError(outStatus, L"CLIENT_ERROR", FailedBeforeResponseMessage(operation));
+                return hr;
+            }
+            context.Tracker->Record(origin, outResponse.FirstByteMs);
 
-    void SyncClient::SetApiKind(SyncApiKind kind)
-    {
-        m_apiKind = kind;
-    }
+            if (outStatus)
+            {
+                outStatus->StatusCode = outResponse.StatusCode;
+                outStatus->RequestId = ResponseRequestId(outResponse);
+                outStatus->RetryAfterMs = ResponseRetryAfterMs(outResponse);
+            }
 
-    void SyncClient::SetBearerToken(std::wstring bearerToken)
-    {
-        m_bearerToken = std::move(bearerToken);
-    }
+            HRESULT hrStatus = MapHttpStatusToHr(outResponse.StatusCode);
+            if (FAILED(hrStatus))
+            {
+                ParseErrorBody(outResponse.Body, outStatus);
+            }
+            return hrStatus;
+        }
 
-    void SyncClient::SetTimeoutMs(int32_t timeoutMs)
-    {
-        if (timeoutMs > 0)
+        HRESULT ParseResponseObject(
+            std::string const& body,
+            wchar_t const* operation,
+            Utf8JsonReader& reader,
+            SyncHttpStatus* outStatus)
         {
-            m_timeoutMs = timeoutMs;
+            if (!reader.Parse(body) || reader.Token(Utf8JsonReader::Root).Type != Utf8JsonTokenType::Object)
+            {
+                SetClientError(outStatus, L"CLIENT_ERROR", FailedBeforeResponseMessage(operation));
+                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+            return S_OK;
         }
-    }
 
-    void SyncClient::SetAllowInsecureHttp(bool allowInsecureHttp)
-    {
-        m_allowInsecureHttp = allowInsecureHttp;
-    }
+        constexpr std::string_view kOctetStream = "application/octet-stream";
 
-    HRESULT SyncClient::DevLogin(
-        std::wstring const& userId,
-        std::wstring& outBearerToken,
-        SyncHttpStatus* outStatus) const noexcept
-    {
-        outBearerToken.clear();
-        if (outStatus)
+        bool IsOctetStreamResponse(SyncTransportResponse const& response)
         {
-            *outStatus = {};
+            std::string const* contentType = response.FindHeader("content-type");
+            return contentType && std::string_view(*contentType).substr(0, kOctetStream.size()) == kOctetStream;
         }
 
-        try
+        int64_t HeaderInt64(SyncTransportResponse const& response, std::string_view name, int64_t fallback)
         {
-            auto parsed = ParseBaseUrl(m_baseUrl);
-            RETURN_IF_FAILED(EnsureTransportPolicy(parsed, m_allowInsecureHttp, outStatus, L"DevLogin"));
+            std::string const* value = response.FindHeader(name);
+            int64_t parsed = 0;
+            if (!value || std::from_chars(value->data(), value->data() + value->size(), parsed).ec != std::errc{})
+            {
+                return fallback;
+            }
+            return parsed;
+        }
 
-            std::wstring path = BuildRequestPath(parsed.BasePath, L"v1/auth/dev/login");
+        std::wstring HeaderString(SyncTransportResponse const& response, std::string_view name)
+        {
+            std::string const* value = response.FindHeader(name);
+            return value ? Utf8ToWide(*value) : std::wstring{};
+        }
 
-            winrt::Windows::Data::Json::JsonObject root;
-            root.SetNamedValue(L"email", winrt::Windows::Data::Json::JsonValue::CreateStringValue(userId));
-            std::wstring requestJson = std::wstring(root.Stringify().c_str());
-            std::string requestUtf8 = WideToUtf8(requestJson);
+        // Axum の GET v1/vaults の 200 応答を受信しながら VaultRecord に入れる。
+        // octet-stream は本文をそのまま Ciphertext に足す。JSON は cipher_blob_base64 を増分で読み、
+        // decodeToBytes なら復号して Ciphertext に、そうでなければ CiphertextBase64 に入れる。
+        // どちらも本文全体の UTF-8 文字列や base64 の中間コピーを作らない。
+        class AxumVaultBodySink final : public ISyncResponseBodySink
+        {
+        public:
+            AxumVaultBodySink(VaultRecord& record, bool decodeToBytes) :
+                m_record(record),
+                m_decodeToBytes(decodeToBytes),
+                m_reader("cipher_blob_base64", [this](std::string_view chunk) { return OnCipherChunk(chunk); })
+            {
+            }
 
-            WinHttpHandle hSession(WinHttpOpen(L"tsupasswd_core/1.0", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0));
-            THROW_LAST_ERROR_IF_NULL(hSession.get());
+            bool BeginBody(SyncTransportResponse const& response, int64_t contentLength) override
+            {
+                if (response.StatusCode < 200 || response.StatusCode >= 300)
+                {
+                    return false;
+                }
+                m_began = true;
+                m_octetStream = IsOctetStreamResponse(response);
+                if (contentLength > 0)
+                {
+                    size_t length = static_cast<size_t>(contentLength);
+                    if (m_octetStream)
+                    {
+                        m_record.Blob.Ciphertext.reserve(length);
+                    }
+                    else if (m_decodeToBytes)
+                    {
+                        m_record.Blob.Ciphertext.reserve(length / 4 * 3);
+                    }
+                    else
+                    {
+                        m_record.Blob.CiphertextBase64.reserve(length);
+                    }
+                }
+                return true;
+            }
 
-            WinHttpSetTimeouts(hSession.get(), m_timeoutMs, m_timeoutMs, m_timeoutMs, m_timeoutMs);
+            HRESULT WriteBody(std::string_view chunk) noexcept override
+            {
+                try
+                {
+                    if (m_octetStream)
+                    {
+                        m_record.Blob.Ciphertext.insert(m_record.Blob.Ciphertext.end(), chunk.begin(), chunk.end());
+                        return S_OK;
+                    }
+                    return m_reader.Feed(chunk) ? S_OK : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+                }
+                catch (...)
+                {
+                    return HResultFromCaughtException();
+                }
+            }
 
-            WinHttpHandle hConnect(WinHttpConnect(hSession.get(), parsed.Host.c_str(), parsed.Port, 0));
-            THROW_LAST_ERROR_IF_NULL(hConnect.get());
+            bool Began() const noexcept { return m_began; }
 
-            DWORD openFlags = parsed.Secure ? WINHTTP_FLAG_SECURE : 0;
-            WinHttpHandle requestHandle(WinHttpOpenRequest(hConnect.get(), L"POST", path.c_str(), nullptr, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, openFlags));
-            THROW_LAST_ERROR_IF_NULL(requestHandle.get());
+            // 本文を読み終えた後に残りの項目を埋める。JSON や base64 が途中で終わっていれば false。
+            bool Finish(SyncTransportResponse const& response, std::wstring const& userId)
+            {
+                m_record.UserId = userId;
+                if (m_octetStream)
+                {
+                    m_record.VaultVersion = HeaderInt64(response, "x-server-version", 0);
+                    m_record.Meta.UpdatedAt = HeaderString(response, "x-updated-at");
+                    m_record.Meta.BlobSha256Base64 = HeaderString(response, "x-blob-sha256-base64");
+                    return true;
+                }
 
-            std::wstring headers = L"Content-Type: application/json; charset=utf-8";
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpAddRequestHeaders(requestHandle.get(), headers.c_str(), static_cast<DWORD>(headers.size()), WINHTTP_ADDREQ_FLAG_ADD));
+                if (!m_reader.Finish() || (m_decodeToBytes && !m_base64.Finish()))
+                {
+                    return false;
+                }
+                int64_t serverVersion = 0;
+                m_record.VaultVersion = m_reader.TryGetInt64("server_version", serverVersion) ? serverVersion : 0;
+                m_record.Meta.UpdatedAt = ReaderString("updated_at");
+                m_record.Meta.BlobSha256Base64 = ReaderString("blob_sha256_base64");
+                return true;
+            }
 
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpSendRequest(
-                requestHandle.get(),
-                WINHTTP_NO_ADDITIONAL_HEADERS,
-                0,
-                requestUtf8.empty() ? WINHTTP_NO_REQUEST_DATA : reinterpret_cast<LPVOID>(requestUtf8.data()),
-                static_cast<DWORD>(requestUtf8.size()),
-                static_cast<DWORD>(requestUtf8.size()),
-                0));
+        private:
+            bool OnCipherChunk(std::string_view chunk)
+            {
+                if (m_decodeToBytes)
+                {
+                    return m_base64.Feed(chunk, m_record.Blob.Ciphertext);
+                }
+                for (char c : chunk)
+                {
+                    if (static_cast<unsigned char>(c) >= 0x80)
+                    {
+                        return false;
+                    }
+                }
+                m_record.Blob.CiphertextBase64.append(chunk.begin(), chunk.end());
+                return true;
+            }
 
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpReceiveResponse(requestHandle.get(), nullptr));
+            std::wstring ReaderString(std::string_view key) const
+            {
+                std::string const* value = m_reader.Find(key);
+                return value ? Utf8ToWide(*value) : std::wstring{};
+            }
 
-            int32_t statusCode = QueryStatusCode(requestHandle.get());
-            std::string body = ReadResponseBody(requestHandle.get());
-            if (outStatus)
+            VaultRecord& m_record;
+            bool m_decodeToBytes;
+            bool m_began{ false };
+            bool m_octetStream{ false };
+            JsonObjectStreamReader m_reader;
+            Base64StreamDecoder m_base64;
+        };
+
+        // sync-axum-api の ETag と同じ形式 ("<server_version>-<blob_sha256_base64>")。
+        std::string BuildVaultEntityTag(VaultValidator const& known)
+        {
+            return "\"" + std::to_string(known.VaultVersion) + "-" + WideToUtf8(known.BlobSha256Base64) + "\"";
+        }
+
+        void FillVaultRecordFromJson(Utf8JsonReader const& reader, VaultRecord& outRecord)
+        {
+            size_t root = Utf8JsonReader::Root;
+            outRecord = {};
+            outRecord.UserId = JsonString(reader, root, "user_id");
+            outRecord.VaultVersion = JsonInt64(reader, root, "vault_version", 0);
+            outRecord.DeviceClock = JsonString(reader, root, "device_clock");
+
+            size_t vaultBlob = 0;
+            if (reader.TryGetObject(root, "vault_blob", vaultBlob))
             {
-                outStatus->StatusCode = statusCode;
-                outStatus->RequestId = QueryRequestId(requestHandle.get());
+                outRecord.Blob.CiphertextBase64 = JsonString(reader, vaultBlob, "ciphertext_b64");
+                outRecord.Blob.NonceBase64 = JsonString(reader, vaultBlob, "nonce_b64");
+                outRecord.Blob.AadBase64 = JsonString(reader, vaultBlob, "aad_b64");
+                auto alg = JsonString(reader, vaultBlob, "alg");
+                if (!alg.empty())
+                {
+                    outRecord.Blob.Algorithm = alg;
+                }
             }
 
-            HRESULT hrStatus = MapHttpStatusToHr(statusCode);
-            if (FAILED(hrStatus))
+            size_t keyEnvelope = 0;
+            if (reader.TryGetObject(root, "key_envelope", keyEnvelope))
+            {
+                auto kekScheme = JsonString(reader, keyEnvelope, "kek_scheme");
+                if (!kekScheme.empty())
+                {
+                    outRecord.Envelope.KekScheme = kekScheme;
+                }
+                outRecord.Envelope.WrappedDekBase64 = JsonString(reader, keyEnvelope, "wrapped_dek_b64");
+                outRecord.Envelope.WrapNonceBase64 = JsonString(reader, keyEnvelope, "wrap_nonce_b64");
+                outRecord.Envelope.KdfSaltBase64 = JsonString(reader, keyEnvelope, "kdf_salt_b64");
+                auto kdfInfo = JsonString(reader, keyEnvelope, "kdf_info");
+                if (!kdfInfo.empty())
+                {
+                    outRecord.Envelope.KdfInfo = kdfInfo;
+                }
+            }
+
+            size_t meta = 0;
+            if (reader.TryGetObject(root, "meta", meta))
             {
-                ParseErrorBody(body, outStatus);
-                return hrStatus;
+                outRecord.Meta.CreatedAt = JsonString(reader, meta, "created_at");
+                outRecord.Meta.UpdatedAt = JsonString(reader, meta, "updated_at");
+                outRecord.Meta.LastWriterDeviceId = JsonString(reader, meta, "last_writer_device_id");
+                outRecord.Meta.BlobSha256Base64 = JsonString(reader, meta, "blob_sha256_b64");
             }
+        }
 
-            auto tokenRoot = winrt::Windows::Data::Json::JsonObject::Parse(Utf8ToWide(body));
-            std::wstring accessToken = TryGetJsonString(tokenRoot, L"access_token");
-            if (accessToken.empty())
+        // AcceptConflictVault の 409。Preference-Applied が return=representation で、本文に vault があるときだけ読む。
+        bool TryParseConflictVault(SyncTransportResponse const& response, std::wstring const& userId, VaultRecord& outRecord)
+        {
+            std::string const* applied = response.FindHeader("preference-applied");
+            if (!applied || applied->find("return=representation") == std::string::npos)
             {
-                if (outStatus)
+                return false;
+            }
+            Utf8JsonReader reader;
+            int64_t serverVersion = 0;
+            std::string cipherBlob;
+            if (!reader.Parse(response.Body) || reader.Token(Utf8JsonReader::Root).Type != Utf8JsonTokenType::Object ||
+                !reader.TryGetInt64(Utf8JsonReader::Root, "server_version", serverVersion) ||
+                !reader.TryGetStringUtf8(Utf8JsonReader::Root, "cipher_blob_base64", cipherBlob))
+            {
+                return false;
+            }
+            outRecord = {};
+            outRecord.UserId = userId;
+            outRecord.VaultVersion = serverVersion;
+            outRecord.Blob.CiphertextBase64 = Utf8ToWide(cipherBlob);
+            outRecord.Meta.UpdatedAt = JsonString(reader, Utf8JsonReader::Root, "updated_at");
+            outRecord.Meta.BlobSha256Base64 = JsonString(reader, Utf8JsonReader::Root, "blob_sha256_base64");
+            return true;
+        }
+
+        void BuildPutVaultJson(PutVaultRequest const& request, Utf8JsonWriter& writer)
+        {
+            writer.BeginObject();
+            writer.Property("expected_version", request.ExpectedVersion);
+            writer.Property("new_version", request.NewVersion);
+            writer.Property("device_id", request.DeviceId);
+
+            writer.Key("vault_blob");
+            writer.BeginObject();
+            writer.Property("ciphertext_b64", request.Blob.CiphertextBase64);
+            writer.Property("nonce_b64", request.Blob.NonceBase64);
+            writer.Property("aad_b64", request.Blob.AadBase64);
+            writer.Property("alg", request.Blob.Algorithm);
+            writer.EndObject();
+
+            writer.Key("key_envelope");
+            writer.BeginObject();
+            writer.Property("kek_scheme", request.Envelope.KekScheme);
+            writer.Property("wrapped_dek_b64", request.Envelope.WrappedDekBase64);
+            writer.Property("wrap_nonce_b64", request.Envelope.WrapNonceBase64);
+            writer.Property("kdf_salt_b64", request.Envelope.KdfSaltBase64);
+            writer.Property("kdf_info", request.Envelope.KdfInfo);
+            writer.EndObject();
+
+            writer.Key("meta");
+            writer.BeginObject();
+            writer.Property("created_at", request.Meta.CreatedAt);
+            writer.Property("updated_at", request.Meta.UpdatedAt);
+            writer.Property("last_writer_device_id", request.Meta.LastWriterDeviceId);
+            writer.Property("blob_sha256_b64", request.Meta.BlobSha256Base64);
+            writer.EndObject();
+            writer.EndObject();
+        }
+
+        void BuildPutVaultJsonAxum(PutVaultRequest const& request, Utf8JsonWriter& writer)
+        {
+            writer.BeginObject();
+            writer.Property("expected_server_version", request.ExpectedVersion);
+            if (request.Blob.CiphertextBase64.empty() && !request.Blob.Ciphertext.empty())
+            {
+                writer.Key("cipher_blob_base64");
+                writer.StringUtf8(Base64StdEncode(request.Blob.Ciphertext.data(), request.Blob.Ciphertext.size()));
+            }
+            else
+            {
+                writer.Property("cipher_blob_base64", request.Blob.CiphertextBase64);
+            }
+            writer.EndObject();
+        }
+
+        void BuildPutVaultDeltaJson(PutVaultDeltaRequest const& request, Utf8JsonWriter& writer)
+        {
+            writer.BeginObject();
+            writer.Property("device_id", request.DeviceId);
+            writer.Key("items");
+            writer.BeginArray();
+            for (auto const& item : request.Items)
+            {
+                writer.BeginObject();
+                writer.Property("item_id", item.ItemId);
+                writer.Property("base_item_version", item.ItemVersion);
+                writer.Property("deleted", item.Deleted);
+                writer.Key("sealed_item_base64");
+                writer.StringUtf8(Base64StdEncode(item.SealedItem.data(), item.SealedItem.size()));
+                writer.Property("updated_at", item.UpdatedAt);
+                writer.EndObject();
+            }
+            writer.EndArray();
+            writer.EndObject();
+        }
+
+        // [{"item_id", "item_version", "deleted"?, "sealed_item_base64"?, "updated_at"?}, ...] を読む。
+        bool ReadVaultItemRecords(Utf8JsonReader const& reader, std::string_view key, std::vector<VaultItemRecord>& outItems)
+        {
+            outItems.clear();
+            size_t items = 0;
+            if (!reader.TryGetArray(Utf8JsonReader::Root, key, items))
+            {
+                return false;
+            }
+
+            std::string sealedBase64;
+            for (size_t child = reader.FirstChild(items); child != Utf8JsonReader::npos; child = reader.NextSibling(items, child))
+            {
+                if (reader.Token(child).Type != Utf8JsonTokenType::Object)
                 {
-                    outStatus->ErrorCode = L"CLIENT_ERROR";
-                    outStatus->ErrorMessage = L"DevLogin succeeded but response did not include access_token.";
+                    return false;
                 }
-                return E_FAIL;
+                VaultItemRecord& item = outItems.emplace_back();
+                item.ItemId = JsonString(reader, child, "item_id");
+                if (item.ItemId.empty() || !reader.TryGetInt64(child, "item_version", item.ItemVersion))
+                {
+                    return false;
+                }
+                (void)reader.TryGetBool(child, "deleted", item.Deleted);
+                item.UpdatedAt = JsonString(reader, child, "updated_at");
+                if (reader.TryGetStringUtf8(child, "sealed_item_base64", sealedBase64) && !Base64StdDecode(sealedBase64, item.SealedItem))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // {"email": userId} に、必要なら base64 のフィールドを 1 つ加える。
+        std::string BuildEmailBody(std::wstring const& userId, std::string_view extraKey = {}, std::string_view extraValue = {})
+        {
+            Utf8JsonWriter writer;
+            writer.BeginObject();
+            writer.Property("email", userId);
+            if (!extraKey.empty())
+            {
+                writer.Key(extraKey);
+                writer.StringUtf8(extraValue);
             }
+            writer.EndObject();
+            return std::string(writer.View());
+        }
+    }
 
-            outBearerToken = accessToken;
-            return S_OK;
+    SyncClient::SyncClient(std::wstring baseUrl) :
+        m_baseUrl(std::move(baseUrl)),
+        m_transport(CreateDefaultSyncTransport())
+    {
+    }
+
+    void SyncClient::SetTransport(std::shared_ptr<ISyncTransport> transport)
+    {
+        if (transport)
+        {
+            m_transport = std::move(transport);
+        }
+    }
+
+    void SyncClient::SetApiKind(SyncApiKind kind)
+    {
+        m_apiKind = kind;
+    }
+
+    void SyncClient::SetBearerToken(std::wstring bearerToken)
+    {
+        m_bearerToken = std::move(bearerToken);
+    }
+
+    void SyncClient::SetTimeoutMs(int32_t timeoutMs)
+    {
+        if (timeoutMs > 0)
+        {
+            m_timeouts.ConnectTimeoutMs = timeoutMs;
+            m_timeouts.FirstByteTimeoutMs = timeoutMs;
+            m_timeouts.TransferTimeoutMs = timeoutMs;
+        }
+    }
+
+    void SyncClient::SetTimeouts(SyncTimeouts timeouts)
+    {
+        m_timeouts = timeouts;
+    }
+
+    void SyncClient::SetLatencyTracker(std::shared_ptr<SyncLatencyTracker> tracker)
+    {
+        m_latencyTracker = std::move(tracker);
+    }
+
+    SyncLatencyTracker& SyncClient::LatencyTracker() const
+    {
+        return m_latencyTracker ? *m_latencyTracker : SyncLatencyTracker::getInstance();
+    }
+
+    int32_t SyncClient::EffectiveConnectTimeoutMs() const
+    {
+        ParsedBaseUrl parsed{};
+        if (!m_timeouts.AdaptiveConnectTimeout || !TryParseBaseUrl(m_baseUrl, parsed))
+        {
+            return m_timeouts.ConnectTimeoutMs;
+        }
+        return LatencyTracker().AdaptiveConnectTimeoutMs(LatencyKey(parsed), m_timeouts.ConnectTimeoutMs);
+    }
+
+    void SyncClient::SetAllowInsecureHttp(bool allowInsecureHttp)
+    {
+        m_allowInsecureHttp = allowInsecureHttp;
+    }
+
+    void SyncClient::SetVaultEncoding(SyncVaultEncoding encoding)
+    {
+        m_vaultEncoding = encoding;
+    }
+
+    void SyncClient::SetCallOptions(SyncCallOptions options)
+    {
+        m_callOptions = std::move(options);
+    }
+
+    HRESULT SyncClient::Prewarm(SyncHttpStatus* outStatus) const noexcept
+    {
+        if (outStatus)
+        {
+            *outStatus = {};
+        }
+
+        try
+        {
+            ParsedBaseUrl parsed{};
+            SyncOperationContext context = BeginOperation(m_timeouts, m_callOptions, LatencyTracker());
+            HRESULT hr = ResolveBaseUrl(m_baseUrl, m_allowInsecureHttp, outStatus, L"Prewarm", parsed);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+
+            SyncTransportResponse response{};
+            hr = SendSyncRequest(*m_transport, parsed, "GET", BuildRequestPath(parsed.BasePath, "healthz"), std::string_view{}, std::wstring{}, context, L"Prewarm", response, outStatus);
+            // healthz がない/DB が落ちているサーバーでも、応答が返れば接続は開いている。
+            return response.StatusCode != 0 ? S_OK : hr;
         }
         catch (...)
         {
-            if (outStatus)
+            SetClientError(outStatus, L"CLIENT_ERROR", FailedBeforeResponseMessage(L"Prewarm"));
+            return HResultFromCaughtException();
+        }
+    }
+
+    HRESULT SyncClient::DevLogin(
+        std::wstring const& userId,
+        std::wstring& outBearerToken,
+        SyncHttpStatus* outStatus,
+        int64_t* outExpiresInSeconds) const noexcept
+    {
+        outBearerToken.clear();
+        if (outExpiresInSeconds)
+        {
+            *outExpiresInSeconds = 0;
+        }
+        if (outStatus)
+        {
+            *outStatus = {};
+        }
+
+        try
+        {
+            ParsedBaseUrl parsed{};
+            SyncOperationContext context = BeginOperation(m_timeouts, m_callOptions, LatencyTracker());
+            HRESULT hr = ResolveBaseUrl(m_baseUrl, m_allowInsecureHttp, outStatus, L"DevLogin", parsed);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+
+            std::string requestUtf8 = BuildEmailBody(userId);
+            SyncTransportResponse response{};
+            hr = SendSyncRequest(*m_transport, parsed, "POST", BuildRequestPath(parsed.BasePath, "v1/auth/dev/login"), requestUtf8, std::wstring{}, context, L"DevLogin", response, outStatus);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+
+            Utf8JsonReader reader;
+            hr = ParseResponseObject(response.Body, L"DevLogin", reader, outStatus);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+
+            std::wstring accessToken = JsonString(reader, Utf8JsonReader::Root, "access_token");
+            if (accessToken.empty())
+            {
+                SetClientError(outStatus, L"CLIENT_ERROR", L"DevLogin succeeded but response did not include access_token.");
+                return E_FAIL;
+            }
+
+            outBearerToken = std::move(accessToken);
+            if (outExpiresInSeconds)
             {
-                outStatus->ErrorCode = L"CLIENT_ERROR";
-                outStatus->ErrorMessage = L"SyncClient::DevLogin failed before receiving valid response.";
+                *outExpiresInSeconds = JsonInt64(reader, Utf8JsonReader::Root, "expires_in", 0);
             }
-            return wil::ResultFromCaughtException();
+            return S_OK;
+        }
+        catch (...)
+        {
+            SetClientError(outStatus, L"CLIENT_ERROR", FailedBeforeResponseMessage(L"DevLogin"));
+            return HResultFromCaughtException();
         }
     }
 
@@ -667,17 +1107,18 @@ namespace tsupasswd
 
         try
         {
-            auto parsed = ParseBaseUrl(m_baseUrl);
-            RETURN_IF_FAILED(EnsureTransportPolicy(parsed, m_allowInsecureHttp, outStatus, L"OpaqueRegister"));
+            ParsedBaseUrl parsed{};
+            SyncOperationContext context = BeginOperation(m_timeouts, m_callOptions, LatencyTracker());
+            HRESULT hr = ResolveBaseUrl(m_baseUrl, m_allowInsecureHttp, outStatus, L"OpaqueRegister", parsed);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
 
             std::string passwordUtf8 = WideToUtf8(password);
             if (passwordUtf8.empty())
             {
-                if (outStatus)
-                {
-                    outStatus->ErrorCode = L"CLIENT_ERROR";
-                    outStatus->ErrorMessage = L"OpaqueRegister requires non-empty password.";
-                }
+                SetClientError(outStatus, L"CLIENT_ERROR", L"OpaqueRegister requires non-empty password.");
                 return E_INVALIDARG;
             }
 
@@ -690,80 +1131,37 @@ namespace tsupasswd
                     regClientState.out_ptr(),
                     regRequest.out_ptr()))
             {
-                if (outStatus)
-                {
-                    outStatus->ErrorCode = L"OPAQUE_CLIENT_ERROR";
-                    outStatus->ErrorMessage = Utf8ToWide(tsupasswd::opaque::TakeLastErrorString());
-                }
+                SetClientError(outStatus, L"OPAQUE_CLIENT_ERROR", Utf8ToWide(tsupasswd::opaque::TakeLastErrorString()));
                 return E_FAIL;
             }
 
-            DWORD openFlags = parsed.Secure ? WINHTTP_FLAG_SECURE : 0;
-            std::wstring headers = L"Content-Type: application/json; charset=utf-8";
-
-            WinHttpHandle hSession(WinHttpOpen(L"tsupasswd_core/1.0", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0));
-            THROW_LAST_ERROR_IF_NULL(hSession.get());
-            WinHttpSetTimeouts(hSession.get(), m_timeoutMs, m_timeoutMs, m_timeoutMs, m_timeoutMs);
-            WinHttpHandle hConnect(WinHttpConnect(hSession.get(), parsed.Host.c_str(), parsed.Port, 0));
-            THROW_LAST_ERROR_IF_NULL(hConnect.get());
-
             // POST /v1/auth/register/start
-            winrt::Windows::Data::Json::JsonObject startBody;
-            startBody.SetNamedValue(L"email", winrt::Windows::Data::Json::JsonValue::CreateStringValue(userId));
-            startBody.SetNamedValue(
-                L"registration_request_base64",
-                winrt::Windows::Data::Json::JsonValue::CreateStringValue(Base64StdEncode(regRequest.data(), regRequest.size())));
-            std::string startUtf8 = WideToUtf8(std::wstring(startBody.Stringify().c_str()));
-
-            std::wstring startPath = BuildRequestPath(parsed.BasePath, L"v1/auth/register/start");
-            WinHttpHandle hReq1(WinHttpOpenRequest(hConnect.get(), L"POST", startPath.c_str(), nullptr, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, openFlags));
-            THROW_LAST_ERROR_IF_NULL(hReq1.get());
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpAddRequestHeaders(hReq1.get(), headers.c_str(), static_cast<DWORD>(headers.size()), WINHTTP_ADDREQ_FLAG_ADD));
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpSendRequest(
-                hReq1.get(),
-                WINHTTP_NO_ADDITIONAL_HEADERS,
-                0,
-                startUtf8.empty() ? WINHTTP_NO_REQUEST_DATA : reinterpret_cast<LPVOID>(startUtf8.data()),
-                static_cast<DWORD>(startUtf8.size()),
-                static_cast<DWORD>(startUtf8.size()),
-                0));
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpReceiveResponse(hReq1.get(), nullptr));
-
-            int32_t statusCode1 = QueryStatusCode(hReq1.get());
-            std::string body1 = ReadResponseBody(hReq1.get());
-            if (outStatus)
+            std::string startUtf8 = BuildEmailBody(userId, "registration_request_base64", Base64StdEncode(regRequest.data(), regRequest.size()));
+            SyncTransportResponse startResponse{};
+            hr = SendSyncRequest(*m_transport, parsed, "POST", BuildRequestPath(parsed.BasePath, "v1/auth/register/start"), startUtf8, std::wstring{}, context, L"OpaqueRegister", startResponse, outStatus);
+            if (FAILED(hr))
             {
-                outStatus->StatusCode = statusCode1;
-                outStatus->RequestId = QueryRequestId(hReq1.get());
+                return hr;
             }
 
-            HRESULT hrStatus1 = MapHttpStatusToHr(statusCode1);
-            if (FAILED(hrStatus1))
+            Utf8JsonReader reader;
+            hr = ParseResponseObject(startResponse.Body, L"OpaqueRegister", reader, outStatus);
+            if (FAILED(hr))
             {
-                ParseErrorBody(body1, outStatus);
-                return hrStatus1;
+                return hr;
             }
 
-            auto startRespJson = winrt::Windows::Data::Json::JsonObject::Parse(Utf8ToWide(body1));
-            std::wstring regRespB64 = GetNamedStringOrEmpty(startRespJson, L"registration_response_base64");
-            if (regRespB64.empty())
+            std::string regRespB64;
+            if (!reader.TryGetStringUtf8(Utf8JsonReader::Root, "registration_response_base64", regRespB64) || regRespB64.empty())
             {
-                if (outStatus)
-                {
-                    outStatus->ErrorCode = L"CLIENT_ERROR";
-                    outStatus->ErrorMessage = L"OpaqueRegister: missing registration_response_base64.";
-                }
+                SetClientError(outStatus, L"CLIENT_ERROR", L"OpaqueRegister: missing registration_response_base64.");
                 return E_FAIL;
             }
 
             std::vector<uint8_t> regRespBytes;
             if (!Base64StdDecode(regRespB64, regRespBytes))
             {
-                if (outStatus)
-                {
-                    outStatus->ErrorCode = L"CLIENT_ERROR";
-                    outStatus->ErrorMessage = L"OpaqueRegister: invalid registration_response_base64.";
-                }
+                SetClientError(outStatus, L"CLIENT_ERROR", L"OpaqueRegister: invalid registration_response_base64.");
                 return E_FAIL;
             }
 
@@ -778,11 +1176,7 @@ namespace tsupasswd
                     regUpload.out_ptr(),
                     regSessionKey.out_ptr()))
             {
-                if (outStatus)
-                {
-                    outStatus->ErrorCode = L"OPAQUE_CLIENT_ERROR";
-                    outStatus->ErrorMessage = Utf8ToWide(tsupasswd::opaque::TakeLastErrorString());
-                }
+                SetClientError(outStatus, L"OPAQUE_CLIENT_ERROR", Utf8ToWide(tsupasswd::opaque::TakeLastErrorString()));
                 return E_FAIL;
             }
 
@@ -793,45 +1187,22 @@ namespace tsupasswd
             }
 
             // POST /v1/auth/register/finish
-            winrt::Windows::Data::Json::JsonObject finishBody;
-            finishBody.SetNamedValue(L"email", winrt::Windows::Data::Json::JsonValue::CreateStringValue(userId));
-            finishBody.SetNamedValue(
-                L"registration_upload_base64",
-                winrt::Windows::Data::Json::JsonValue::CreateStringValue(Base64StdEncode(regUpload.data(), regUpload.size())));
-            std::string finishUtf8 = WideToUtf8(std::wstring(finishBody.Stringify().c_str()));
-
-            std::wstring finishPath = BuildRequestPath(parsed.BasePath, L"v1/auth/register/finish");
-            WinHttpHandle hReq2(WinHttpOpenRequest(hConnect.get(), L"POST", finishPath.c_str(), nullptr, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, openFlags));
-            THROW_LAST_ERROR_IF_NULL(hReq2.get());
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpAddRequestHeaders(hReq2.get(), headers.c_str(), static_cast<DWORD>(headers.size()), WINHTTP_ADDREQ_FLAG_ADD));
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpSendRequest(
-                hReq2.get(),
-                WINHTTP_NO_ADDITIONAL_HEADERS,
-                0,
-                finishUtf8.empty() ? WINHTTP_NO_REQUEST_DATA : reinterpret_cast<LPVOID>(finishUtf8.data()),
-                static_cast<DWORD>(finishUtf8.size()),
-                static_cast<DWORD>(finishUtf8.size()),
-                0));
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpReceiveResponse(hReq2.get(), nullptr));
-
-            int32_t statusCode2 = QueryStatusCode(hReq2.get());
-            std::string body2 = ReadResponseBody(hReq2.get());
-            if (outStatus)
+            std::string finishUtf8 = BuildEmailBody(userId, "registration_upload_base64", Base64StdEncode(regUpload.data(), regUpload.size()));
+            SyncTransportResponse finishResponse{};
+            hr = SendSyncRequest(*m_transport, parsed, "POST", BuildRequestPath(parsed.BasePath, "v1/auth/register/finish"), finishUtf8, std::wstring{}, context, L"OpaqueRegister", finishResponse, outStatus);
+            if (FAILED(hr))
             {
-                outStatus->StatusCode = statusCode2;
-                outStatus->RequestId = QueryRequestId(hReq2.get());
+                return hr;
             }
 
-            HRESULT hrStatus2 = MapHttpStatusToHr(statusCode2);
-            if (FAILED(hrStatus2))
+            hr = ParseResponseObject(finishResponse.Body, L"OpaqueRegister", reader, outStatus);
+            if (FAILED(hr))
             {
-                ParseErrorBody(body2, outStatus);
-                return hrStatus2;
+                return hr;
             }
 
-            auto finishRespJson = winrt::Windows::Data::Json::JsonObject::Parse(Utf8ToWide(body2));
-            bool ok = finishRespJson.GetNamedBoolean(L"ok", false);
-            if (!ok)
+            bool ok = false;
+            if (!reader.TryGetBool(Utf8JsonReader::Root, "ok", ok) || !ok)
             {
                 return E_FAIL;
             }
@@ -844,12 +1215,8 @@ namespace tsupasswd
         }
         catch (...)
         {
-            if (outStatus)
-            {
-                outStatus->ErrorCode = L"CLIENT_ERROR";
-                outStatus->ErrorMessage = L"SyncClient::OpaqueRegister failed before receiving valid response.";
-            }
-            return wil::ResultFromCaughtException();
+            SetClientError(outStatus, L"CLIENT_ERROR", FailedBeforeResponseMessage(L"OpaqueRegister"));
+            return HResultFromCaughtException();
         }
     }
 
@@ -858,13 +1225,18 @@ namespace tsupasswd
         std::wstring const& password,
         std::wstring& outBearerToken,
         std::vector<uint8_t>* outSessionKeyBytes,
-        SyncHttpStatus* outStatus) const noexcept
+        SyncHttpStatus* outStatus,
+        int64_t* outExpiresInSeconds) const noexcept
     {
         outBearerToken.clear();
         if (outSessionKeyBytes)
         {
             outSessionKeyBytes->clear();
         }
+        if (outExpiresInSeconds)
+        {
+            *outExpiresInSeconds = 0;
+        }
         if (outStatus)
         {
             *outStatus = {};
@@ -872,17 +1244,18 @@ namespace tsupasswd
 
         try
         {
-            auto parsed = ParseBaseUrl(m_baseUrl);
-            RETURN_IF_FAILED(EnsureTransportPolicy(parsed, m_allowInsecureHttp, outStatus, L"OpaqueLogin"));
+            ParsedBaseUrl parsed{};
+            SyncOperationContext context = BeginOperation(m_timeouts, m_callOptions, LatencyTracker());
+            HRESULT hr = ResolveBaseUrl(m_baseUrl, m_allowInsecureHttp, outStatus, L"OpaqueLogin", parsed);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
 
             std::string passwordUtf8 = WideToUtf8(password);
             if (passwordUtf8.empty())
             {
-                if (outStatus)
-                {
-                    outStatus->ErrorCode = L"CLIENT_ERROR";
-                    outStatus->ErrorMessage = L"OpaqueLogin requires non-empty password.";
-                }
+                SetClientError(outStatus, L"CLIENT_ERROR", L"OpaqueLogin requires non-empty password.");
                 return E_INVALIDARG;
             }
 
@@ -895,70 +1268,34 @@ namespace tsupasswd
                     loginClientState.out_ptr(),
                     credRequest.out_ptr()))
             {
-                if (outStatus)
-                {
-                    outStatus->ErrorCode = L"OPAQUE_CLIENT_ERROR";
-                    outStatus->ErrorMessage = Utf8ToWide(tsupasswd::opaque::TakeLastErrorString());
-                }
+                SetClientError(outStatus, L"OPAQUE_CLIENT_ERROR", Utf8ToWide(tsupasswd::opaque::TakeLastErrorString()));
                 return E_FAIL;
             }
 
-            DWORD openFlags = parsed.Secure ? WINHTTP_FLAG_SECURE : 0;
-            std::wstring headers = L"Content-Type: application/json; charset=utf-8";
-
-            WinHttpHandle hSession(WinHttpOpen(L"tsupasswd_core/1.0", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0));
-            THROW_LAST_ERROR_IF_NULL(hSession.get());
-            WinHttpSetTimeouts(hSession.get(), m_timeoutMs, m_timeoutMs, m_timeoutMs, m_timeoutMs);
-            WinHttpHandle hConnect(WinHttpConnect(hSession.get(), parsed.Host.c_str(), parsed.Port, 0));
-            THROW_LAST_ERROR_IF_NULL(hConnect.get());
-
             // POST /v1/auth/login/start
-            winrt::Windows::Data::Json::JsonObject startBody;
-            startBody.SetNamedValue(L"email", winrt::Windows::Data::Json::JsonValue::CreateStringValue(userId));
-            startBody.SetNamedValue(
-                L"credential_request_base64",
-                winrt::Windows::Data::Json::JsonValue::CreateStringValue(Base64StdEncode(credRequest.data(), credRequest.size())));
-            std::string startUtf8 = WideToUtf8(std::wstring(startBody.Stringify().c_str()));
-
-            std::wstring startPath = BuildRequestPath(parsed.BasePath, L"v1/auth/login/start");
-            WinHttpHandle hReq1(WinHttpOpenRequest(hConnect.get(), L"POST", startPath.c_str(), nullptr, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, openFlags));
-            THROW_LAST_ERROR_IF_NULL(hReq1.get());
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpAddRequestHeaders(hReq1.get(), headers.c_str(), static_cast<DWORD>(headers.size()), WINHTTP_ADDREQ_FLAG_ADD));
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpSendRequest(
-                hReq1.get(),
-                WINHTTP_NO_ADDITIONAL_HEADERS,
-                0,
-                startUtf8.empty() ? WINHTTP_NO_REQUEST_DATA : reinterpret_cast<LPVOID>(startUtf8.data()),
-                static_cast<DWORD>(startUtf8.size()),
-                static_cast<DWORD>(startUtf8.size()),
-                0));
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpReceiveResponse(hReq1.get(), nullptr));
-
-            int32_t statusCode1 = QueryStatusCode(hReq1.get());
-            std::string body1 = ReadResponseBody(hReq1.get());
-            if (outStatus)
+            std::string startUtf8 = BuildEmailBody(userId, "credential_request_base64", Base64StdEncode(credRequest.data(), credRequest.size()));
+            SyncTransportResponse startResponse{};
+            hr = SendSyncRequest(*m_transport, parsed, "POST", BuildRequestPath(parsed.BasePath, "v1/auth/login/start"), startUtf8, std::wstring{}, context, L"OpaqueLogin", startResponse, outStatus);
+            if (FAILED(hr))
             {
-                outStatus->StatusCode = statusCode1;
-                outStatus->RequestId = QueryRequestId(hReq1.get());
+                return hr;
             }
 
-            HRESULT hrStatus1 = MapHttpStatusToHr(statusCode1);
-            if (FAILED(hrStatus1))
+            Utf8JsonReader reader;
+            hr = ParseResponseObject(startResponse.Body, L"OpaqueLogin", reader, outStatus);
+            if (FAILED(hr))
             {
-                ParseErrorBody(body1, outStatus);
-                return hrStatus1;
+                return hr;
             }
 
-            auto startRespJson = winrt::Windows::Data::Json::JsonObject::Parse(Utf8ToWide(body1));
-            std::wstring serverStateB64 = GetNamedStringOrEmpty(startRespJson, L"server_state_base64");
-            std::wstring credRespB64 = GetNamedStringOrEmpty(startRespJson, L"credential_response_base64");
-            if (serverStateB64.empty() || credRespB64.empty())
+            std::string serverStateB64;
+            std::string credRespB64;
+            if (!reader.TryGetStringUtf8(Utf8JsonReader::Root, "server_state_base64", serverStateB64) ||
+                !reader.TryGetStringUtf8(Utf8JsonReader::Root, "credential_response_base64", credRespB64) ||
+                serverStateB64.empty() ||
+                credRespB64.empty())
             {
-                if (outStatus)
-                {
-                    outStatus->ErrorCode = L"CLIENT_ERROR";
-                    outStatus->ErrorMessage = L"OpaqueLogin: missing server_state_base64 or credential_response_base64.";
-                }
+                SetClientError(outStatus, L"CLIENT_ERROR", L"OpaqueLogin: missing server_state_base64 or credential_response_base64.");
                 return E_FAIL;
             }
 
@@ -966,15 +1303,10 @@ namespace tsupasswd
             std::vector<uint8_t> credRespBytes;
             if (!Base64StdDecode(serverStateB64, serverStateBytes) || !Base64StdDecode(credRespB64, credRespBytes))
             {
-                if (outStatus)
-                {
-                    outStatus->ErrorCode = L"CLIENT_ERROR";
-                    outStatus->ErrorMessage = L"OpaqueLogin: invalid base64 in login/start response.";
-                }
+                SetClientError(outStatus, L"CLIENT_ERROR", L"OpaqueLogin: invalid base64 in login/start response.");
                 return E_FAIL;
             }
 
-            ByteBuffer serverState{ serverStateBytes.data(), serverStateBytes.size() };
             ByteBuffer credResp{ credRespBytes.data(), credRespBytes.size() };
 
             ByteBufferOwner credFinalization;
@@ -987,69 +1319,45 @@ namespace tsupasswd
                     credFinalization.out_ptr(),
                     sessionKey.out_ptr()))
             {
-                if (outStatus)
-                {
-                    outStatus->ErrorCode = L"OPAQUE_CLIENT_ERROR";
-                    outStatus->ErrorMessage = Utf8ToWide(tsupasswd::opaque::TakeLastErrorString());
-                }
+                SetClientError(outStatus, L"OPAQUE_CLIENT_ERROR", Utf8ToWide(tsupasswd::opaque::TakeLastErrorString()));
                 return E_FAIL;
             }
 
             // POST /v1/auth/login/finish
-            winrt::Windows::Data::Json::JsonObject finishBody;
-            finishBody.SetNamedValue(
-                L"email",
-                winrt::Windows::Data::Json::JsonValue::CreateStringValue(winrt::hstring{ userId }));
-            finishBody.SetNamedValue(
-                L"server_state_base64",
-                winrt::Windows::Data::Json::JsonValue::CreateStringValue(winrt::hstring{ Base64StdEncode(serverState.ptr, serverState.len) }));
-            finishBody.SetNamedValue(
-                L"credential_finalization_base64",
-                winrt::Windows::Data::Json::JsonValue::CreateStringValue(winrt::hstring{ Base64StdEncode(credFinalization.data(), credFinalization.size()) }));
-            std::string finishUtf8 = WideToUtf8(std::wstring(finishBody.Stringify().c_str()));
-
-            std::wstring finishPath = BuildRequestPath(parsed.BasePath, L"v1/auth/login/finish");
-            WinHttpHandle hReq2(WinHttpOpenRequest(hConnect.get(), L"POST", finishPath.c_str(), nullptr, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, openFlags));
-            THROW_LAST_ERROR_IF_NULL(hReq2.get());
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpAddRequestHeaders(hReq2.get(), headers.c_str(), static_cast<DWORD>(headers.size()), WINHTTP_ADDREQ_FLAG_ADD));
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpSendRequest(
-                hReq2.get(),
-                WINHTTP_NO_ADDITIONAL_HEADERS,
-                0,
-                finishUtf8.empty() ? WINHTTP_NO_REQUEST_DATA : reinterpret_cast<LPVOID>(finishUtf8.data()),
-                static_cast<DWORD>(finishUtf8.size()),
-                static_cast<DWORD>(finishUtf8.size()),
-                0));
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpReceiveResponse(hReq2.get(), nullptr));
-
-            int32_t statusCode2 = QueryStatusCode(hReq2.get());
-            std::string body2 = ReadResponseBody(hReq2.get());
-            if (outStatus)
+            Utf8JsonWriter finishBody;
+            finishBody.BeginObject();
+            finishBody.Property("email", userId);
+            finishBody.Key("server_state_base64");
+            finishBody.StringUtf8(Base64StdEncode(serverStateBytes.data(), serverStateBytes.size()));
+            finishBody.Key("credential_finalization_base64");
+            finishBody.StringUtf8(Base64StdEncode(credFinalization.data(), credFinalization.size()));
+            finishBody.EndObject();
+
+            SyncTransportResponse finishResponse{};
+            hr = SendSyncRequest(*m_transport, parsed, "POST", BuildRequestPath(parsed.BasePath, "v1/auth/login/finish"), finishBody.View(), std::wstring{}, context, L"OpaqueLogin", finishResponse, outStatus);
+            if (FAILED(hr))
             {
-                outStatus->StatusCode = statusCode2;
-                outStatus->RequestId = QueryRequestId(hReq2.get());
+                return hr;
             }
 
-            HRESULT hrStatus2 = MapHttpStatusToHr(statusCode2);
-            if (FAILED(hrStatus2))
+            hr = ParseResponseObject(finishResponse.Body, L"OpaqueLogin", reader, outStatus);
+            if (FAILED(hr))
             {
-                ParseErrorBody(body2, outStatus);
-                return hrStatus2;
+                return hr;
             }
 
-            auto tokenJson = winrt::Windows::Data::Json::JsonObject::Parse(Utf8ToWide(body2));
-            std::wstring accessToken = GetNamedStringOrEmpty(tokenJson, L"access_token");
+            std::wstring accessToken = JsonString(reader, Utf8JsonReader::Root, "access_token");
             if (accessToken.empty())
             {
-                if (outStatus)
-                {
-                    outStatus->ErrorCode = L"CLIENT_ERROR";
-                    outStatus->ErrorMessage = L"OpaqueLogin succeeded but response did not include access_token.";
-                }
+                SetClientError(outStatus, L"CLIENT_ERROR", L"OpaqueLogin succeeded but response did not include access_token.");
                 return E_FAIL;
             }
 
-            outBearerToken = accessToken;
+            outBearerToken = std::move(accessToken);
+            if (outExpiresInSeconds)
+            {
+                *outExpiresInSeconds = JsonInt64(reader, Utf8JsonReader::Root, "expires_in", 0);
+            }
 
             if (outSessionKeyBytes)
             {
@@ -1059,12 +1367,8 @@ namespace tsupasswd
         }
         catch (...)
         {
-            if (outStatus)
-            {
-                outStatus->ErrorCode = L"CLIENT_ERROR";
-                outStatus->ErrorMessage = L"SyncClient::OpaqueLogin failed before receiving valid response.";
-            }
-            return wil::ResultFromCaughtException();
+            SetClientError(outStatus, L"CLIENT_ERROR", FailedBeforeResponseMessage(L"OpaqueLogin"));
+            return HResultFromCaughtException();
         }
     }
 
@@ -1072,6 +1376,15 @@ namespace tsupasswd
         std::wstring const& userId,
         VaultRecord& outRecord,
         SyncHttpStatus* outStatus) const noexcept
+    {
+        return GetVault(userId, VaultValidator{}, outRecord, outStatus);
+    }
+
+    HRESULT SyncClient::GetVault(
+        std::wstring const& userId,
+        VaultValidator const& known,
+        VaultRecord& outRecord,
+        SyncHttpStatus* outStatus) const noexcept
     {
         outRecord = {};
         if (outStatus)
@@ -1081,72 +1394,236 @@ namespace tsupasswd
 
         try
         {
-            auto parsed = ParseBaseUrl(m_baseUrl);
-            RETURN_IF_FAILED(EnsureTransportPolicy(parsed, m_allowInsecureHttp, outStatus, L"GetVault"));
-            std::wstring path = BuildRequestPath(parsed.BasePath, L"v1/vaults/" + userId);
+            ParsedBaseUrl parsed{};
+            SyncOperationContext context = BeginOperation(m_timeouts, m_callOptions, LatencyTracker());
+            HRESULT hr = ResolveBaseUrl(m_baseUrl, m_allowInsecureHttp, outStatus, L"GetVault", parsed);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
 
-            WinHttpHandle hSession(WinHttpOpen(L"tsupasswd_core/1.0", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0));
-            THROW_LAST_ERROR_IF_NULL(hSession.get());
+            // If-Version はサーバーが blob を読まずに版だけで 304 を返せる。If-None-Match は中身まで一致を確かめる。
+            std::vector<SyncHttpHeader> conditionalHeaders;
+            if (known.VaultVersion > 0)
+            {
+                conditionalHeaders.push_back(SyncHttpHeader{ "If-Version", std::to_string(known.VaultVersion) });
+                if (!known.BlobSha256Base64.empty())
+                {
+                    conditionalHeaders.push_back(SyncHttpHeader{ "If-None-Match", BuildVaultEntityTag(known) });
+                }
+            }
 
-            WinHttpSetTimeouts(hSession.get(), m_timeoutMs, m_timeoutMs, m_timeoutMs, m_timeoutMs);
+            // 古いサーバーは Accept を見ずに JSON を返すので、応答の Content-Type で読み分ける。
+            if (m_apiKind == SyncApiKind::Axum && m_vaultEncoding == SyncVaultEncoding::OctetStream)
+            {
+                conditionalHeaders.push_back(SyncHttpHeader{ "Accept", std::string(kOctetStream) });
+            }
 
-            WinHttpHandle hConnect(WinHttpConnect(hSession.get(), parsed.Host.c_str(), parsed.Port, 0));
-            THROW_LAST_ERROR_IF_NULL(hConnect.get());
+            // Axum の応答は 1 段の JSON か octet-stream なので、本文をためずに受信しながら読む。
+            AxumVaultBodySink bodySink(outRecord, m_vaultEncoding == SyncVaultEncoding::OctetStream);
+            SyncTransportResponse response{};
+            hr = SendSyncRequest(*m_transport, parsed, "GET", BuildVaultPath(parsed.BasePath, userId), {}, m_bearerToken, context, L"GetVault", response, outStatus, std::move(conditionalHeaders), m_apiKind == SyncApiKind::Axum ? &bodySink : nullptr);
+            if (FAILED(hr) || hr == S_FALSE)
+            {
+                outRecord = {};
+                return hr;
+            }
 
-            DWORD openFlags = parsed.Secure ? WINHTTP_FLAG_SECURE : 0;
-            WinHttpHandle requestHandle(WinHttpOpenRequest(hConnect.get(), L"GET", path.c_str(), nullptr, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, openFlags));
-            THROW_LAST_ERROR_IF_NULL(requestHandle.get());
+            if (bodySink.Began())
+            {
+                if (!bodySink.Finish(response, userId))
+                {
+                    outRecord = {};
+                    SetClientError(outStatus, L"CLIENT_ERROR", FailedBeforeResponseMessage(L"GetVault"));
+                    return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+                }
+                return S_OK;
+            }
 
-            if (!m_bearerToken.empty())
+            Utf8JsonReader reader;
+            hr = ParseResponseObject(response.Body, L"GetVault", reader, outStatus);
+            if (FAILED(hr))
             {
-                std::wstring authHeader = L"Authorization: Bearer " + m_bearerToken;
-                THROW_IF_WIN32_BOOL_FALSE(WinHttpAddRequestHeaders(requestHandle.get(), authHeader.c_str(), static_cast<DWORD>(authHeader.size()), WINHTTP_ADDREQ_FLAG_ADD));
+                return hr;
             }
 
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpSendRequest(requestHandle.get(), WINHTTP_NO_ADDITIONAL_HEADERS, 0, WINHTTP_NO_REQUEST_DATA, 0, 0, 0));
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpReceiveResponse(requestHandle.get(), nullptr));
+            FillVaultRecordFromJson(reader, outRecord);
+            return S_OK;
+        }
+        catch (...)
+        {
+            SetClientError(outStatus, L"CLIENT_ERROR", FailedBeforeResponseMessage(L"GetVault"));
+            return HResultFromCaughtException();
+        }
+    }
 
-            int32_t statusCode = QueryStatusCode(requestHandle.get());
-            std::string body = ReadResponseBody(requestHandle.get());
-            if (outStatus)
+    HRESULT SyncClient::PutVault(
+        std::wstring const& userId,
+        PutVaultRequest const& request,
+        PutVaultResponse& outResponse,
+        SyncHttpStatus* outStatus) const noexcept
+    {
+        outResponse = {};
+        if (outStatus)
+        {
+            *outStatus = {};
+        }
+
+        try
+        {
+            ParsedBaseUrl parsed{};
+            SyncOperationContext context = BeginOperation(m_timeouts, m_callOptions, LatencyTracker());
+            HRESULT hr = ResolveBaseUrl(m_baseUrl, m_allowInsecureHttp, outStatus, L"PutVault", parsed);
+            if (FAILED(hr))
             {
-                outStatus->StatusCode = statusCode;
-                outStatus->RequestId = QueryRequestId(requestHandle.get());
+                return hr;
             }
 
-            HRESULT hrStatus = MapHttpStatusToHr(statusCode);
-            if (FAILED(hrStatus))
+            // 409 のときに GET し直さずに merge できるよう、サーバーの vault を本文に求める。
+            bool acceptConflictVault = request.AcceptConflictVault && m_apiKind == SyncApiKind::Axum;
+            auto preferHeaders = [&](std::vector<SyncHttpHeader> headers)
+            {
+                if (acceptConflictVault)
+                {
+                    headers.push_back(SyncHttpHeader{ "Prefer", "return=representation" });
+                }
+                return headers;
+            };
+
+            SyncTransportResponse response{};
+            bool sent = false;
+            if (m_apiKind == SyncApiKind::Axum && m_vaultEncoding == SyncVaultEncoding::OctetStream)
             {
-                ParseErrorBody(body, outStatus);
-                return hrStatus;
+                std::vector<uint8_t> decodedCiphertext;
+                std::vector<uint8_t> const* ciphertext = &request.Blob.Ciphertext;
+                if (ciphertext->empty() && !Base64StdDecode(WideToUtf8(request.Blob.CiphertextBase64), decodedCiphertext))
+                {
+                    SetClientError(outStatus, L"CLIENT_ERROR", L"PutVault: invalid CiphertextBase64.");
+                    return E_INVALIDARG;
+                }
+                if (ciphertext->empty())
+                {
+                    ciphertext = &decodedCiphertext;
+                }
+
+                std::vector<SyncHttpHeader> binaryHeaders{
+                    SyncHttpHeader{ "Content-Type", std::string(kOctetStream) },
+                    SyncHttpHeader{ "X-Expected-Server-Version", std::to_string(request.ExpectedVersion) },
+                };
+                std::string_view body(reinterpret_cast<char const*>(ciphertext->data()), ciphertext->size());
+                hr = SendSyncRequest(*m_transport, parsed, "PUT", BuildVaultPath(parsed.BasePath, userId), body, m_bearerToken, context, L"PutVault", response, outStatus, preferHeaders(std::move(binaryHeaders)));
+                // 415 は octet-stream を受け付けないサーバー。JSON で送り直す。
+                sent = response.StatusCode != 415;
             }
 
-            auto root = winrt::Windows::Data::Json::JsonObject::Parse(Utf8ToWide(body));
+            if (!sent)
+            {
+                Utf8JsonWriter requestJson;
+                if (m_apiKind == SyncApiKind::Axum)
+                {
+                    BuildPutVaultJsonAxum(request, requestJson);
+                }
+                else
+                {
+                    BuildPutVaultJson(request, requestJson);
+                }
+
+                if (outStatus)
+                {
+                    SyncRequestTiming timing = outStatus->Timing;
+                    *outStatus = {};
+                    outStatus->Timing = timing;
+                }
+                response = {};
+                hr = SendSyncRequest(*m_transport, parsed, "PUT", BuildVaultPath(parsed.BasePath, userId), requestJson.View(), m_bearerToken, context, L"PutVault", response, outStatus, preferHeaders({}));
+            }
+            if (FAILED(hr))
+            {
+                VaultRecord conflictVault{};
+                if (hr == HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) && acceptConflictVault && TryParseConflictVault(response, userId, conflictVault))
+                {
+                    outResponse.ConflictVault = std::move(conflictVault);
+                }
+                return hr;
+            }
+
+            Utf8JsonReader reader;
+            hr = ParseResponseObject(response.Body, L"PutVault", reader, outStatus);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+
+            bool ok = false;
+            outResponse.Ok = reader.TryGetBool(Utf8JsonReader::Root, "ok", ok) && ok;
             if (m_apiKind == SyncApiKind::Axum)
             {
-                FillVaultRecordFromJsonAxum(root, userId, outRecord);
+                outResponse.VaultVersion = JsonInt64(reader, Utf8JsonReader::Root, "server_version", request.NewVersion);
             }
             else
             {
-                FillVaultRecordFromJson(root, outRecord);
+                outResponse.VaultVersion = JsonInt64(reader, Utf8JsonReader::Root, "vault_version", request.NewVersion);
             }
+            outResponse.UpdatedAt = JsonString(reader, Utf8JsonReader::Root, "updated_at");
+            outResponse.BlobSha256Base64 = JsonString(reader, Utf8JsonReader::Root, "blob_sha256_base64");
             return S_OK;
         }
         catch (...)
         {
-            if (outStatus)
-            {
-                outStatus->ErrorCode = L"CLIENT_ERROR";
-                outStatus->ErrorMessage = L"SyncClient::GetVault failed before receiving valid response.";
-            }
-            return wil::ResultFromCaughtException();
+            SetClientError(outStatus, L"CLIENT_ERROR", FailedBeforeResponseMessage(L"PutVault"));
+            return HResultFromCaughtException();
         }
     }
 
-    HRESULT SyncClient::PutVault(
+    HRESULT SyncClient::PutVaultWithConflictMerge(
         std::wstring const& userId,
-        PutVaultRequest const& request,
+        PutVaultRequest& inOutRequest,
+        SyncConflictMerge const& merge,
         PutVaultResponse& outResponse,
+        SyncHttpStatus* outStatus,
+        uint32_t maxMerges) const noexcept
+    {
+        SyncHttpStatus localStatus{};
+        SyncHttpStatus& status = outStatus ? *outStatus : localStatus;
+        try
+        {
+            inOutRequest.AcceptConflictVault = true;
+            SyncRequestTiming timing{};
+            uint32_t merges = 0;
+            for (;;)
+            {
+                HRESULT hr = PutVault(userId, inOutRequest, outResponse, &status);
+                timing.Add(status.Timing);
+                status.Timing = timing;
+                outResponse.ConflictMerges = merges;
+                if (hr != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) || !outResponse.ConflictVault || !merge || merges >= maxMerges)
+                {
+                    return hr;
+                }
+
+                VaultRecord serverVault = std::move(*outResponse.ConflictVault);
+                outResponse.ConflictVault.reset();
+                HRESULT hrMerge = merge(serverVault, inOutRequest);
+                if (FAILED(hrMerge))
+                {
+                    return hrMerge;
+                }
+                inOutRequest.ExpectedVersion = serverVault.VaultVersion;
+                inOutRequest.NewVersion = serverVault.VaultVersion + 1;
+                merges += 1;
+            }
+        }
+        catch (...)
+        {
+            SetClientError(&status, L"CLIENT_ERROR", FailedBeforeResponseMessage(L"PutVault"));
+            return HResultFromCaughtException();
+        }
+    }
+
+    HRESULT SyncClient::PutVaultDelta(
+        std::wstring const& userId,
+        PutVaultDeltaRequest const& request,
+        PutVaultDeltaResponse& outResponse,
         SyncHttpStatus* outStatus) const noexcept
     {
         outResponse = {};
@@ -1157,82 +1634,709 @@ namespace tsupasswd
 
         try
         {
-            auto parsed = ParseBaseUrl(m_baseUrl);
-            RETURN_IF_FAILED(EnsureTransportPolicy(parsed, m_allowInsecureHttp, outStatus, L"PutVault"));
-            std::wstring path = BuildRequestPath(parsed.BasePath, L"v1/vaults/" + userId);
-            std::wstring requestJson = (m_apiKind == SyncApiKind::Axum)
-                ? BuildPutVaultJsonAxum(request)
-                : BuildPutVaultJson(request);
-            std::string requestUtf8 = WideToUtf8(requestJson);
+            if (m_apiKind != SyncApiKind::Axum)
+            {
+                SetClientError(outStatus, L"CLIENT_ERROR", L"PutVaultDelta requires the Axum API.");
+                return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+            }
 
-            WinHttpHandle hSession(WinHttpOpen(L"tsupasswd_core/1.0", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0));
-            THROW_LAST_ERROR_IF_NULL(hSession.get());
+            ParsedBaseUrl parsed{};
+            SyncOperationContext context = BeginOperation(m_timeouts, m_callOptions, LatencyTracker());
+            HRESULT hr = ResolveBaseUrl(m_baseUrl, m_allowInsecureHttp, outStatus, L"PutVaultDelta", parsed);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
 
-            WinHttpSetTimeouts(hSession.get(), m_timeoutMs, m_timeoutMs, m_timeoutMs, m_timeoutMs);
+            Utf8JsonWriter requestJson;
+            BuildPutVaultDeltaJson(request, requestJson);
+            SyncTransportResponse response{};
+            hr = SendSyncRequest(*m_transport, parsed, "PUT", BuildVaultPath(parsed.BasePath, userId) + "/items", requestJson.View(), m_bearerToken, context, L"PutVaultDelta", response, outStatus);
+            if (FAILED(hr) && hr != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH))
+            {
+                return hr;
+            }
 
-            WinHttpHandle hConnect(WinHttpConnect(hSession.get(), parsed.Host.c_str(), parsed.Port, 0));
-            THROW_LAST_ERROR_IF_NULL(hConnect.get());
+            // 409 の本文にも cursor と合わなかった item の版が入る。
+            Utf8JsonReader reader;
+            HRESULT hrParse = ParseResponseObject(response.Body, L"PutVaultDelta", reader, outStatus);
+            if (FAILED(hrParse))
+            {
+                return hrParse;
+            }
+            outResponse.BaseCursor = JsonInt64(reader, Utf8JsonReader::Root, "base_cursor", 0);
+            outResponse.Cursor = JsonInt64(reader, Utf8JsonReader::Root, "cursor", 0);
+            if (!ReadVaultItemRecords(reader, SUCCEEDED(hr) ? "items" : "conflicts", outResponse.Items))
+            {
+                outResponse = {};
+                SetClientError(outStatus, L"CLIENT_ERROR", FailedBeforeResponseMessage(L"PutVaultDelta"));
+                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+            return hr;
+        }
+        catch (...)
+        {
+            SetClientError(outStatus, L"CLIENT_ERROR", FailedBeforeResponseMessage(L"PutVaultDelta"));
+            return HResultFromCaughtException();
+        }
+    }
 
-            DWORD openFlags = parsed.Secure ? WINHTTP_FLAG_SECURE : 0;
-            WinHttpHandle requestHandle(WinHttpOpenRequest(hConnect.get(), L"PUT", path.c_str(), nullptr, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, openFlags));
-            THROW_LAST_ERROR_IF_NULL(requestHandle.get());
+    HRESULT SyncClient::GetVaultChanges(
+        std::wstring const& userId,
+        int64_t sinceCursor,
+        VaultChanges& outChanges,
+        SyncHttpStatus* outStatus,
+        uint32_t limit) const noexcept
+    {
+        outChanges = {};
+        if (outStatus)
+        {
+            *outStatus = {};
+        }
 
-            std::wstring headers = L"Content-Type: application/json; charset=utf-8";
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpAddRequestHeaders(requestHandle.get(), headers.c_str(), static_cast<DWORD>(headers.size()), WINHTTP_ADDREQ_FLAG_ADD));
+        try
+        {
+            if (m_apiKind != SyncApiKind::Axum)
+            {
+                SetClientError(outStatus, L"CLIENT_ERROR", L"GetVaultChanges requires the Axum API.");
+                return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+            }
 
-            if (!m_bearerToken.empty())
+            ParsedBaseUrl parsed{};
+            SyncOperationContext context = BeginOperation(m_timeouts, m_callOptions, LatencyTracker());
+            HRESULT hr = ResolveBaseUrl(m_baseUrl, m_allowInsecureHttp, outStatus, L"GetVaultChanges", parsed);
+            if (FAILED(hr))
             {
-                std::wstring authHeader = L"Authorization: Bearer " + m_bearerToken;
-                THROW_IF_WIN32_BOOL_FALSE(WinHttpAddRequestHeaders(requestHandle.get(), authHeader.c_str(), static_cast<DWORD>(authHeader.size()), WINHTTP_ADDREQ_FLAG_ADD));
+                return hr;
             }
 
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpSendRequest(
-                requestHandle.get(),
-                WINHTTP_NO_ADDITIONAL_HEADERS,
-                0,
-                requestUtf8.empty() ? WINHTTP_NO_REQUEST_DATA : reinterpret_cast<LPVOID>(requestUtf8.data()),
-                static_cast<DWORD>(requestUtf8.size()),
-                static_cast<DWORD>(requestUtf8.size()),
-                0));
+            std::string path = BuildVaultPath(parsed.BasePath, userId) + "/changes?since=" + std::to_string(sinceCursor);
+            if (limit > 0)
+            {
+                path += "&limit=" + std::to_string(limit);
+            }
+            SyncTransportResponse response{};
+            hr = SendSyncRequest(*m_transport, parsed, "GET", std::move(path), {}, m_bearerToken, context, L"GetVaultChanges", response, outStatus);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
 
-            THROW_IF_WIN32_BOOL_FALSE(WinHttpReceiveResponse(requestHandle.get(), nullptr));
+            Utf8JsonReader reader;
+            hr = ParseResponseObject(response.Body, L"GetVaultChanges", reader, outStatus);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+            if (!reader.TryGetInt64(Utf8JsonReader::Root, "cursor", outChanges.Cursor) ||
+                !ReadVaultItemRecords(reader, "items", outChanges.Items))
+            {
+                outChanges = {};
+                SetClientError(outStatus, L"CLIENT_ERROR", FailedBeforeResponseMessage(L"GetVaultChanges"));
+                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+            (void)reader.TryGetBool(Utf8JsonReader::Root, "has_more", outChanges.HasMore);
+            return S_OK;
+        }
+        catch (...)
+        {
+            SetClientError(outStatus, L"CLIENT_ERROR", FailedBeforeResponseMessage(L"GetVaultChanges"));
+            return HResultFromCaughtException();
+        }
+    }
 
-            int32_t statusCode = QueryStatusCode(requestHandle.get());
-            std::string body = ReadResponseBody(requestHandle.get());
-            if (outStatus)
+    HRESULT SyncClient::MergeCallOptions(SyncCallOptions const& options, wchar_t const* operation, SyncHttpStatus& outStatus)
+    {
+        if (options.Cancellation.CanBeCancelled())
+        {
+            m_callOptions.Cancellation = options.Cancellation;
+        }
+        m_callOptions.Deadline = (std::min)(m_callOptions.Deadline, options.Deadline);
+        return CheckCallOptions(m_callOptions, operation, &outStatus);
+    }
+
+    // 引数は値で受けて coroutine フレームに持たせる。最初の co_await までに this から必要なものを複製する。
+    SyncTask<SyncResult<VaultRecord>> SyncClient::GetVaultAsync(std::wstring userId, SyncCallOptions options) const
+    {
+        SyncResult<VaultRecord> result{};
+        SyncClient client = *this;
+        result.Hr = client.MergeCallOptions(options, L"GetVault", result.Status);
+        if (SUCCEEDED(result.Hr))
+        {
+            co_await SyncReactor::getInstance().Schedule();
+            result.Hr = client.GetVault(userId, result.Value, &result.Status);
+        }
+        co_return result;
+    }
+
+    SyncTask<SyncResult<PutVaultResponse>> SyncClient::PutVaultAsync(std::wstring userId, PutVaultRequest request, SyncCallOptions options) const
+    {
+        SyncResult<PutVaultResponse> result{};
+        SyncClient client = *this;
+        result.Hr = client.MergeCallOptions(options, L"PutVault", result.Status);
+        if (SUCCEEDED(result.Hr))
+        {
+            co_await SyncReactor::getInstance().Schedule();
+            result.Hr = client.PutVault(userId, request, result.Value, &result.Status);
+        }
+        co_return result;
+    }
+
+    SyncTask<SyncResult<OpaqueLoginResult>> SyncClient::OpaqueLoginAsync(std::wstring userId, std::wstring password, SyncCallOptions options) const
+    {
+        SyncResult<OpaqueLoginResult> result{};
+        SyncClient client = *this;
+        result.Hr = client.MergeCallOptions(options, L"OpaqueLogin", result.Status);
+        if (SUCCEEDED(result.Hr))
+        {
+            co_await SyncReactor::getInstance().Schedule();
+            result.Hr = client.OpaqueLogin(userId, password, result.Value.BearerToken, &result.Value.SessionKey, &result.Status, &result.Value.ExpiresInSeconds);
+        }
+        co_return result;
+    }
+
+    bool RunSyncClientRegressionTests(std::wstring& outError)
+    {
+        outError.clear();
+
+        ParsedBaseUrl parsed{};
+        if (!TryParseBaseUrl(L"http://127.0.0.1:8080/api/", parsed) ||
+            parsed.Host != "127.0.0.1" || parsed.Port != 8080 || parsed.Secure || parsed.BasePath != "/api" ||
+            BuildRequestPath(parsed.BasePath, "v1/vaults/u") != "/api/v1/vaults/u")
+        {
+            outError = L"base_url_http";
+            return false;
+        }
+        if (!TryParseBaseUrl(L"https://[::1]", parsed) || parsed.Host != "::1" || parsed.Port != 443 || parsed.BasePath != "/" ||
+            TryParseBaseUrl(L"ftp://example.com", parsed) || TryParseBaseUrl(L"https://example.com:0/", parsed))
+        {
+            outError = L"base_url_edge_cases";
+            return false;
+        }
+
+        std::vector<uint8_t> decoded;
+        uint8_t const sample[] = { 0xFB, 0xFF, 0x00, 0x41 };
+        if (Base64StdEncode(sample, sizeof(sample)) != "+/8AQQ==" ||
+            !Base64StdDecode("+/8A\r\nQQ==", decoded) || decoded != std::vector<uint8_t>(sample, sample + sizeof(sample)) ||
+            Base64StdDecode("+/8A*", decoded) || Base64StdDecode("QQ=A", decoded))
+        {
+            outError = L"base64_roundtrip";
+            return false;
+        }
+
+        // 増分デコーダーは 1 バイトずつ渡しても、エスケープと入れ子を含む JSON を読める。
+        std::string streamedJson = "{\"server_version\":7,\"nested\":{\"a\":[1,\"}\"]},\"cipher_blob_base64\":\"+\\/8AQQ==\",\"updated_at\":\"caf\\u00e9\"}";
+        std::vector<uint8_t> streamedCipher;
+        Base64StreamDecoder streamedBase64;
+        JsonObjectStreamReader streamedReader("cipher_blob_base64", [&](std::string_view chunk)
+        {
+            return streamedBase64.Feed(chunk, streamedCipher);
+        });
+        bool streamedOk = true;
+        for (char c : streamedJson)
+        {
+            streamedOk = streamedOk && streamedReader.Feed(std::string_view(&c, 1));
+        }
+        int64_t streamedVersion = 0;
+        std::string const* streamedUpdatedAt = streamedReader.Find("updated_at");
+        if (!streamedOk || !streamedReader.Finish() || !streamedBase64.Finish() || !streamedReader.StreamedValueSeen() ||
+            streamedCipher != std::vector<uint8_t>(sample, sample + sizeof(sample)) ||
+            !streamedReader.TryGetInt64("server_version", streamedVersion) || streamedVersion != 7 ||
+            !streamedUpdatedAt || *streamedUpdatedAt != "caf\xC3\xA9" || streamedReader.Find("nested") ||
+            JsonObjectStreamReader("k", {}).Feed("{\"a\":1,}"))
+        {
+            outError = L"streaming_json_decoder";
+            return false;
+        }
+
+        // サーバーの代わりに要求を検査して Axum 形式の応答を返す。
+        int64_t serverVersion = 3;
+        std::string lastAuthorization;
+        std::string binaryBlob;
+        auto transport = std::make_shared<InMemorySyncTransport>([&](SyncTransportRequest const& request, SyncTransportResponse& response)
+        {
+            lastAuthorization.clear();
+            std::string contentType;
+            std::string accept;
+            std::string expectedHeader;
+            for (auto const& header : request.Headers)
             {
-                outStatus->StatusCode = statusCode;
-                outStatus->RequestId = QueryRequestId(requestHandle.get());
+                if (header.Name == "Authorization")
+                {
+                    lastAuthorization = header.Value;
+                }
+                else if (header.Name == "Content-Type")
+                {
+                    contentType = header.Value;
+                }
+                else if (header.Name == "Accept")
+                {
+                    accept = header.Value;
+                }
+                else if (header.Name == "X-Expected-Server-Version")
+                {
+                    expectedHeader = header.Value;
+                }
             }
 
-            HRESULT hrStatus = MapHttpStatusToHr(statusCode);
-            if (FAILED(hrStatus))
+            if (request.Method == "POST" && request.Path == "/v1/auth/dev/login")
+            {
+                response.StatusCode = 200;
+                response.Body = "{\"access_token\":\"dev-token\",\"token_type\":\"Bearer\",\"expires_in\":1800}";
+                return;
+            }
+            if (request.Method == "PUT" && contentType == "application/octet-stream")
+            {
+                if (request.Path != "/v1/vaults/alice@example.com")
+                {
+                    response.StatusCode = 415;
+                    return;
+                }
+                if (expectedHeader != std::to_string(serverVersion))
+                {
+                    response.StatusCode = 409;
+                    response.Body = "{\"code\":\"VERSION_CONFLICT\",\"server_version\":" + std::to_string(serverVersion) + "}";
+                    return;
+                }
+                binaryBlob.assign(request.Body);
+                ++serverVersion;
+                response.StatusCode = 200;
+                response.Body = "{\"ok\":true,\"server_version\":" + std::to_string(serverVersion) + ",\"blob_sha256_base64\":\"bin\"}";
+                return;
+            }
+            if (request.Method == "GET" && accept == "application/octet-stream" && request.Path == "/v1/vaults/alice@example.com")
+            {
+                response.StatusCode = 200;
+                response.Headers.push_back(SyncHttpHeader{ "Content-Type", "application/octet-stream" });
+                response.Headers.push_back(SyncHttpHeader{ "X-Server-Version", std::to_string(serverVersion) });
+                response.Headers.push_back(SyncHttpHeader{ "X-Blob-Sha256-Base64", "bin" });
+                response.Body = binaryBlob;
+                return;
+            }
+            if (request.Method == "PUT" && request.Path == "/v1/vaults/alice@example.com/items")
+            {
+                Utf8JsonReader body;
+                size_t items = 0;
+                int64_t baseVersion = -1;
+                std::string sealed;
+                bool valid = body.Parse(request.Body) && body.TryGetArray(Utf8JsonReader::Root, "items", items) &&
+                    body.FirstChild(items) != Utf8JsonReader::npos &&
+                    body.TryGetInt64(body.FirstChild(items), "base_item_version", baseVersion) &&
+                    body.TryGetStringUtf8(body.FirstChild(items), "sealed_item_base64", sealed) && sealed == "+/8AQQ==";
+                if (!valid)
+                {
+                    response.StatusCode = 400;
+                    return;
+                }
+                response.StatusCode = baseVersion == 2 ? 200 : 409;
+                response.Body = baseVersion == 2 ?
+                    "{\"ok\":true,\"base_cursor\":5,\"cursor\":6,\"items\":[{\"item_id\":\"i1\",\"item_version\":3}]}" :
+                    "{\"code\":\"ITEM_VERSION_CONFLICT\",\"base_cursor\":5,\"cursor\":5,\"conflicts\":[{\"item_id\":\"i1\",\"item_version\":2}]}";
+                return;
+            }
+            if (request.Method == "GET" && request.Path == "/v1/vaults/alice@example.com/changes?since=5&limit=1")
+            {
+                response.StatusCode = 200;
+                response.Body = "{\"cursor\":6,\"has_more\":true,\"items\":[{\"item_id\":\"i1\",\"item_version\":3,\"deleted\":true,\"sealed_item_base64\":\"QUJD\",\"updated_at\":\"t\"}]}";
+                return;
+            }
+            if (request.Method == "GET" && request.Path == "/v1/vaults/large@example.com")
+            {
+                // InMemorySyncTransport の kBodySinkChunkBytes をまたぐ大きさ。
+                response.StatusCode = 200;
+                response.Body = "{\"server_version\":9,\"cipher_blob_base64\":\"";
+                for (int i = 0; i < 5000; ++i)
+                {
+                    response.Body += "QUJD";
+                }
+                response.Body += "\",\"updated_at\":\"t\"}";
+                return;
+            }
+            if (request.Method == "GET" && request.Path == "/v1/vaults/truncated@example.com")
+            {
+                response.StatusCode = 200;
+                response.Body = "{\"server_version\":9,\"cipher_blob_base64\":\"QUJD";
+                return;
+            }
+            if (request.Method == "PUT" && request.Path == "/v1/vaults/legacy@example.com")
             {
-                ParseErrorBody(body, outStatus);
-                return hrStatus;
+                Utf8JsonReader body;
+                std::string cipher;
+                bool valid = body.Parse(request.Body) && body.TryGetStringUtf8(Utf8JsonReader::Root, "cipher_blob_base64", cipher) && cipher == "AP8A";
+                response.StatusCode = valid ? 200 : 400;
+                response.Body = "{\"ok\":true,\"server_version\":1}";
+                return;
             }
 
-            auto root = winrt::Windows::Data::Json::JsonObject::Parse(Utf8ToWide(body));
-            outResponse.Ok = root.GetNamedBoolean(L"ok", false);
-            if (m_apiKind == SyncApiKind::Axum)
+            if (request.Method == "PUT" && request.Path == "/v1/vaults/alice@example.com")
             {
-                outResponse.VaultVersion = TryGetJsonInt64(root, L"server_version", request.NewVersion);
+                Utf8JsonReader body;
+                int64_t expected = -1;
+                if (!body.Parse(request.Body) || !body.TryGetInt64(Utf8JsonReader::Root, "expected_server_version", expected))
+                {
+                    response.StatusCode = 400;
+                    return;
+                }
+                if (expected != serverVersion)
+                {
+                    response.StatusCode = 409;
+                    response.Headers.push_back(SyncHttpHeader{ "X-Request-Id", "req-409" });
+                    response.Body = "{\"code\":\"VERSION_CONFLICT\",\"message\":\"stale\",\"server_version\":" + std::to_string(serverVersion) + "}";
+                    return;
+                }
+                ++serverVersion;
+                response.StatusCode = 200;
+                response.Body = "{\"ok\":true,\"server_version\":" + std::to_string(serverVersion) + ",\"updated_at\":\"2026-01-01T00:00:00Z\"}";
+                return;
             }
-            else
+            if (request.Method == "GET" && request.Path == "/v1/vaults/alice@example.com")
             {
-                outResponse.VaultVersion = TryGetJsonInt64(root, L"vault_version", request.NewVersion);
+                for (auto const& header : request.Headers)
+                {
+                    if (header.Name == "If-Version" && header.Value == std::to_string(serverVersion))
+                    {
+                        response.StatusCode = 304;
+                        return;
+                    }
+                }
+                response.StatusCode = 200;
+                response.Body = "{\"server_version\":" + std::to_string(serverVersion) + ",\"cipher_blob_base64\":\"QUJD\",\"updated_at\":\"t\"}";
+                return;
             }
-            outResponse.UpdatedAt = TryGetJsonString(root, L"updated_at");
-            return S_OK;
+            response.StatusCode = 404;
+            response.Body = "not json";
+        });
+
+        SyncClient client(L"http://sync.test");
+        client.SetTransport(transport);
+        client.SetApiKind(SyncApiKind::Axum);
+        client.SetAllowInsecureHttp(true);
+        client.SetBearerToken(L"token-1");
+
+        PutVaultRequest put{};
+        put.ExpectedVersion = 0;
+        put.Blob.CiphertextBase64 = L"QUJD";
+        PutVaultResponse putResponse{};
+        SyncHttpStatus status{};
+        HRESULT hr = client.PutVault(L"alice@example.com", put, putResponse, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) || status.StatusCode != 409 || status.ServerVersion != 3 ||
+            status.ErrorCode != L"VERSION_CONFLICT" || status.RequestId != L"req-409" || lastAuthorization != "Bearer token-1")
+        {
+            outError = L"put_conflict_mapping";
+            return false;
         }
-        catch (...)
+
+        put.ExpectedVersion = status.ServerVersion;
+        hr = client.PutVault(L"alice@example.com", put, putResponse, &status);
+        if (FAILED(hr) || !putResponse.Ok || putResponse.VaultVersion != 4 || putResponse.UpdatedAt != L"2026-01-01T00:00:00Z")
         {
-            if (outStatus)
+            outError = L"put_success";
+            return false;
+        }
+        if (status.Timing.RoundTrips != 1 || status.Timing.BytesSent <= 0 || status.Timing.BytesReceived <= 0)
+        {
+            outError = L"put_timing";
+            return false;
+        }
+
+        VaultRecord record{};
+        hr = client.GetVault(L"alice@example.com", record, &status);
+        if (FAILED(hr) || record.VaultVersion != 4 || record.Blob.CiphertextBase64 != L"QUJD" || record.UserId != L"alice@example.com")
+        {
+            outError = L"get_vault";
+            return false;
+        }
+
+        VaultValidator known{};
+        known.VaultVersion = record.VaultVersion;
+        known.BlobSha256Base64 = L"c2hh";
+        hr = client.GetVault(L"alice@example.com", known, record, &status);
+        if (hr != S_FALSE || status.StatusCode != 304 || record.VaultVersion != 0 || !record.Blob.CiphertextBase64.empty())
+        {
+            outError = L"get_vault_not_modified";
+            return false;
+        }
+
+        known.VaultVersion = 3;
+        hr = client.GetVault(L"alice@example.com", known, record, &status);
+        if (hr != S_OK || record.VaultVersion != 4)
+        {
+            outError = L"get_vault_modified";
+            return false;
+        }
+
+        // octet-stream: 0x00 を含む暗号文がそのまま往復し、415 を返すサーバーには JSON で送り直す。
+        client.SetVaultEncoding(SyncVaultEncoding::OctetStream);
+        put.ExpectedVersion = 4;
+        put.Blob.CiphertextBase64.clear();
+        put.Blob.Ciphertext = { 0x00, 0xFF, 0x00 };
+        hr = client.PutVault(L"alice@example.com", put, putResponse, &status);
+        if (FAILED(hr) || putResponse.VaultVersion != 5 || binaryBlob != std::string("\0\xFF\0", 3))
+        {
+            outError = L"put_vault_octet_stream";
+            return false;
+        }
+        hr = client.GetVault(L"alice@example.com", record, &status);
+        if (FAILED(hr) || record.VaultVersion != 5 || record.Blob.Ciphertext != put.Blob.Ciphertext ||
+            !record.Blob.CiphertextBase64.empty() || record.Meta.BlobSha256Base64 != L"bin")
+        {
+            outError = L"get_vault_octet_stream";
+            return false;
+        }
+        put.ExpectedVersion = 0;
+        hr = client.PutVault(L"legacy@example.com", put, putResponse, &status);
+        // 415 で送り直した往復も Timing に残る。
+        if (FAILED(hr) || status.StatusCode != 200 || putResponse.VaultVersion != 1 || status.Timing.RoundTrips != 2)
+        {
+            outError = L"put_vault_octet_stream_fallback";
+            return false;
+        }
+        client.SetVaultEncoding(SyncVaultEncoding::Base64Json);
+
+        // 差分同期: 版が合わない item は 409 で返り、合えば新しい版と cursor が返る。
+        PutVaultDeltaRequest delta{};
+        delta.DeviceId = L"device-1";
+        delta.Items.push_back(VaultItemRecord{ L"i1", 1, false, std::vector<uint8_t>(sample, sample + sizeof(sample)), L"t" });
+        PutVaultDeltaResponse deltaResponse{};
+        hr = client.PutVaultDelta(L"alice@example.com", delta, deltaResponse, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) || status.StatusCode != 409 || deltaResponse.Items.size() != 1 ||
+            deltaResponse.Items[0].ItemId != L"i1" || deltaResponse.Items[0].ItemVersion != 2 || deltaResponse.Cursor != 5)
+        {
+            outError = L"put_vault_delta_conflict";
+            return false;
+        }
+        delta.Items[0].ItemVersion = 2;
+        hr = client.PutVaultDelta(L"alice@example.com", delta, deltaResponse, &status);
+        if (FAILED(hr) || deltaResponse.BaseCursor != 5 || deltaResponse.Cursor != 6 || deltaResponse.Items.size() != 1 ||
+            deltaResponse.Items[0].ItemVersion != 3)
+        {
+            outError = L"put_vault_delta";
+            return false;
+        }
+        VaultChanges changes{};
+        hr = client.GetVaultChanges(L"alice@example.com", 5, changes, &status, 1);
+        if (FAILED(hr) || changes.Cursor != 6 || !changes.HasMore || changes.Items.size() != 1 || !changes.Items[0].Deleted ||
+            changes.Items[0].SealedItem != std::vector<uint8_t>{ 'A', 'B', 'C' } || changes.Items[0].UpdatedAt != L"t")
+        {
+            outError = L"get_vault_changes";
+            return false;
+        }
+
+        // 大きな JSON 応答は受信しながら読む。Base64Json では base64 のまま、OctetStream では復号して返す。
+        hr = client.GetVault(L"large@example.com", record, &status);
+        if (FAILED(hr) || record.VaultVersion != 9 || record.Blob.CiphertextBase64.size() != 20000 ||
+            record.Blob.CiphertextBase64.compare(0, 8, L"QUJDQUJD") != 0 || !record.Blob.Ciphertext.empty())
+        {
+            outError = L"get_vault_streamed_base64";
+            return false;
+        }
+        client.SetVaultEncoding(SyncVaultEncoding::OctetStream);
+        hr = client.GetVault(L"large@example.com", record, &status);
+        client.SetVaultEncoding(SyncVaultEncoding::Base64Json);
+        if (FAILED(hr) || record.VaultVersion != 9 || record.Blob.Ciphertext.size() != 15000 || !record.Blob.CiphertextBase64.empty() ||
+            record.Blob.Ciphertext[14999] != 'C' || record.Meta.UpdatedAt != L"t")
+        {
+            outError = L"get_vault_streamed_bytes";
+            return false;
+        }
+
+        hr = client.GetVault(L"truncated@example.com", record, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_INVALID_DATA) || record.VaultVersion != 0 || !record.Blob.CiphertextBase64.empty())
+        {
+            outError = L"get_vault_streamed_truncated";
+            return false;
+        }
+
+        hr = client.GetVault(L"bob@example.com", record, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_NOT_FOUND) || status.StatusCode != 404 || status.ErrorMessage != L"not json")
+        {
+            outError = L"not_found_plain_body";
+            return false;
+        }
+
+        transport->FailNextSends(1, HRESULT_FROM_WIN32(ERROR_WINHTTP_CANNOT_CONNECT));
+        hr = client.GetVault(L"alice@example.com", record, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_WINHTTP_CANNOT_CONNECT) || status.StatusCode != 0 || status.ErrorCode != L"CLIENT_ERROR")
+        {
+            outError = L"transport_failure";
+            return false;
+        }
+
+        SyncClient insecure(L"http://sync.test");
+        insecure.SetTransport(transport);
+        uint64_t sendsBefore = transport->SendCount();
+        hr = insecure.GetVault(L"alice@example.com", record, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_ACCESS_DISABLED_BY_POLICY) || status.ErrorCode != L"INSECURE_HTTP_BLOCKED" || transport->SendCount() != sendsBefore)
+        {
+            outError = L"insecure_http_policy";
+            return false;
+        }
+
+        SyncCancellationSource cancelled;
+        cancelled.Cancel();
+        SyncCallOptions cancelledOptions{};
+        cancelledOptions.Cancellation = cancelled.Token();
+        client.SetCallOptions(cancelledOptions);
+        sendsBefore = transport->SendCount();
+        hr = client.GetVault(L"alice@example.com", record, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_CANCELLED) || status.ErrorCode != L"CANCELLED" || transport->SendCount() != sendsBefore)
+        {
+            outError = L"cancelled_before_send";
+            return false;
+        }
+
+        SyncCallOptions expiredOptions{};
+        expiredOptions.Deadline = std::chrono::steady_clock::now() - std::chrono::milliseconds(1);
+        client.SetCallOptions(expiredOptions);
+        hr = client.GetVault(L"alice@example.com", record, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_TIMEOUT) || status.ErrorCode != L"DEADLINE_EXCEEDED" || transport->SendCount() != sendsBefore)
+        {
+            outError = L"deadline_before_send";
+            return false;
+        }
+        client.SetCallOptions({});
+
+        SyncResult<VaultRecord> asyncGet = client.GetVaultAsync(L"alice@example.com").Get();
+        if (FAILED(asyncGet.Hr) || asyncGet.Value.VaultVersion != 5 || asyncGet.Status.StatusCode != 200)
+        {
+            outError = L"get_vault_async";
+            return false;
+        }
+
+        SyncResult<VaultRecord> asyncCancelled = client.GetVaultAsync(L"alice@example.com", cancelledOptions).Get();
+        if (asyncCancelled.Hr != HRESULT_FROM_WIN32(ERROR_CANCELLED) || asyncCancelled.Status.ErrorCode != L"CANCELLED")
+        {
+            outError = L"get_vault_async_cancelled";
+            return false;
+        }
+
+        SyncCancellationSource delayCancel;
+        auto delayed = [&delayCancel]() -> SyncTask<bool>
+        {
+            co_return co_await SyncReactor::getInstance().Delay(std::chrono::milliseconds(60000), delayCancel.Token());
+        }();
+        delayCancel.Cancel();
+        if (delayed.Get())
+        {
+            outError = L"delay_cancel";
+            return false;
+        }
+
+        // 取消済みの token と短い delay は await_suspend の途中で再開の条件がそろう。何度繰り返しても壊れないこと。
+        SyncCancellationSource alreadyCancelled;
+        alreadyCancelled.Cancel();
+        for (int i = 0; i < 200; ++i)
+        {
+            auto raced = [](SyncCancellationToken cancelled, std::chrono::milliseconds shortDelay) -> SyncTask<bool>
             {
-                outStatus->ErrorCode = L"CLIENT_ERROR";
-                outStatus->ErrorMessage = L"SyncClient::PutVault failed before receiving valid response.";
+                bool cancelledWait = co_await SyncReactor::getInstance().Delay(std::chrono::milliseconds(60000), cancelled);
+                bool shortWait = co_await SyncReactor::getInstance().Delay(shortDelay);
+                co_return !cancelledWait && shortWait;
+            }(alreadyCancelled.Token(), std::chrono::milliseconds(i % 2));
+            if (!raced.Get())
+            {
+                outError = L"delay_cancel_race";
+                return false;
             }
-            return wil::ResultFromCaughtException();
         }
+
+        // Prewarm は healthz の応答があれば状態コードにかかわらず成功し、接続できなければ失敗する。
+        uint64_t sendsBeforePrewarm = transport->SendCount();
+        hr = client.Prewarm(&status);
+        if (FAILED(hr) || transport->SendCount() != sendsBeforePrewarm + 1 || status.StatusCode != 404)
+        {
+            outError = L"prewarm";
+            return false;
+        }
+        transport->FailNextSends(1, HRESULT_FROM_WIN32(ERROR_WINHTTP_CANNOT_CONNECT));
+        if (client.Prewarm(&status) != HRESULT_FROM_WIN32(ERROR_WINHTTP_CANNOT_CONNECT) || status.ErrorCode != L"CLIENT_ERROR")
+        {
+            outError = L"prewarm_unreachable";
+            return false;
+        }
+
+        std::wstring devToken;
+        int64_t expiresIn = 0;
+        hr = client.DevLogin(L"alice@example.com", devToken, &status, &expiresIn);
+        if (FAILED(hr) || devToken != L"dev-token" || expiresIn != 1800)
+        {
+            outError = L"dev_login_expires_in";
+            return false;
+        }
+
+        // 期限の kExpirySkew 前で切れ、401 で捨てた token は返さない。
+        SyncTokenCache tokenCache;
+        auto issuedAt = SyncTokenCache::Clock::now();
+        SyncCachedToken cached{ L"token-a", { 1, 2, 3 } };
+        tokenCache.Store(L"http://sync", L"alice@example.com", cached, 600, issuedAt);
+        SyncCachedToken found{};
+        if (!tokenCache.TryGet(L"http://sync", L"alice@example.com", found, issuedAt + std::chrono::seconds(500)) ||
+            found.BearerToken != L"token-a" || found.SessionKey != std::vector<uint8_t>{ 1, 2, 3 } ||
+            tokenCache.TryGet(L"http://sync", L"bob@example.com", found, issuedAt) ||
+            tokenCache.TryGet(L"http://other", L"alice@example.com", found, issuedAt) ||
+            tokenCache.TryGet(L"http://sync", L"alice@example.com", found, issuedAt + std::chrono::seconds(540)))
+        {
+            outError = L"token_cache_expiry";
+            return false;
+        }
+        tokenCache.Store(L"http://sync", L"alice@example.com", SyncCachedToken{ L"token-b" }, 0, issuedAt);
+        bool defaultLifetime = tokenCache.TryGet(L"http://sync", L"alice@example.com", found, issuedAt + std::chrono::seconds(60)) && found.BearerToken == L"token-b" && found.SessionKey.empty();
+        tokenCache.Invalidate(L"http://sync", L"alice@example.com");
+        tokenCache.Store(L"http://sync", L"bob@example.com", SyncCachedToken{ L"token-c" }, 30, issuedAt);
+        if (!defaultLifetime ||
+            tokenCache.TryGet(L"http://sync", L"alice@example.com", found, issuedAt) ||
+            tokenCache.TryGet(L"http://sync", L"bob@example.com", found, issuedAt))
+        {
+            outError = L"token_cache_invalidate";
+            return false;
+        }
+
+        // 接続 timeout は観測した往復時間 (p95 × 4) まで縮み、timeout を受けると設定値に戻る。操作全体の期限は Deadline になる。
+        int32_t seenConnectTimeoutMs = 0;
+        auto seenDeadline = std::chrono::steady_clock::time_point::max();
+        auto timedTransport = std::make_shared<InMemorySyncTransport>([&](SyncTransportRequest const& request, SyncTransportResponse& response)
+        {
+            seenConnectTimeoutMs = request.ConnectTimeoutMs;
+            seenDeadline = request.Deadline;
+            response.StatusCode = 200;
+            response.FirstByteMs = 400;
+            response.Body = "{\"access_token\":\"dev-token\",\"token_type\":\"Bearer\"}";
+        });
+        SyncClient timedClient(L"http://127.0.0.1:8080/");
+        timedClient.SetTransport(timedTransport);
+        timedClient.SetLatencyTracker(std::make_shared<SyncLatencyTracker>());
+        timedClient.SetApiKind(SyncApiKind::Axum);
+        timedClient.SetAllowInsecureHttp(true);
+        SyncTimeouts timeouts{};
+        timeouts.OperationTimeoutMs = 0;
+        timedClient.SetTimeouts(timeouts);
+        for (size_t i = 0; i < SyncLatencyTracker::kMinSamples; ++i)
+        {
+            hr = timedClient.DevLogin(L"alice@example.com", devToken, &status);
+        }
+        if (FAILED(hr) || seenConnectTimeoutMs != 5000 || seenDeadline != std::chrono::steady_clock::time_point::max() ||
+            timedClient.EffectiveConnectTimeoutMs() != 1600)
+        {
+            outError = L"adaptive_connect_timeout";
+            return false;
+        }
+        timeouts.OperationTimeoutMs = 30000;
+        timedClient.SetTimeouts(timeouts);
+        auto beforeCall = std::chrono::steady_clock::now();
+        hr = timedClient.DevLogin(L"alice@example.com", devToken, &status);
+        if (FAILED(hr) || seenConnectTimeoutMs != 1600 ||
+            seenDeadline < beforeCall + std::chrono::milliseconds(30000) || seenDeadline > std::chrono::steady_clock::now() + std::chrono::milliseconds(30000))
+        {
+            outError = L"operation_timeout_deadline";
+            return false;
+        }
+        timedTransport->FailNextSends(1, HRESULT_FROM_WIN32(ERROR_WINHTTP_TIMEOUT));
+        hr = timedClient.DevLogin(L"alice@example.com", devToken, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_WINHTTP_TIMEOUT) || timedClient.EffectiveConnectTimeoutMs() != 5000)
+        {
+            outError = L"adaptive_connect_reset";
+            return false;
+        }
+        return true;
     }
 }
@@ -1,6 +1,15 @@
 #pragma once
 
+#include "PortableHResult.h"
+#include "SyncAsync.h"
+#include "SyncCancellation.h"
+#include "SyncTransport.h"
+
+#include <chrono>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -12,9 +21,20 @@ namespace tsupasswd
         Axum = 1,
     };
 
+    // vault 本体の送り方。OctetStream は Axum API のみで、暗号文をそのまま本文にし、版などはヘッダーで送る
+    // (base64 と JSON のエスケープを省くので、大きな vault ほど送受信量と変換が減る)。
+    enum class SyncVaultEncoding
+    {
+        Base64Json = 0,
+        OctetStream = 1,
+    };
+
     struct VaultBlob
     {
         std::wstring CiphertextBase64{};
+        // OctetStream で送受信する暗号文。PutVault は空でなければ CiphertextBase64 より優先し、
+        // GetVault はサーバーが octet-stream で返したときにこちらを埋める (CiphertextBase64 は空)。
+        std::vector<uint8_t> Ciphertext{};
         std::wstring NonceBase64{};
         std::wstring AadBase64{};
         std::wstring Algorithm{ L"AES-256-GCM" };
@@ -55,6 +75,8 @@ namespace tsupasswd
         VaultBlob Blob{};
         KeyEnvelope Envelope{};
         VaultMeta Meta{};
+        // 409 の本文にサーバーの vault を求める (Axum API のみ。Prefer: return=representation)。
+        bool AcceptConflictVault{ false };
     };
 
     struct PutVaultResponse
@@ -62,6 +84,60 @@ namespace tsupasswd
         bool Ok{ false };
         int64_t VaultVersion{ 0 };
         std::wstring UpdatedAt{};
+        // 書き込んだ blob の SHA-256。次回の条件付き GetVault に使う。返さないサーバーでは空。
+        std::wstring BlobSha256Base64{};
+        // AcceptConflictVault の 409 にサーバーが付けた vault (Preference-Applied を返さないサーバーでは空)。
+        std::optional<VaultRecord> ConflictVault{};
+        // PutVaultWithConflictMerge が merge して送り直した回数。
+        uint32_t ConflictMerges{ 0 };
+    };
+
+    // 409 で受け取ったサーバーの vault を手元と merge し、inOutRequest の Blob (と Meta) を書き換える。
+    // serverVault の暗号文は移してよい。失敗を返すと送り直さずにその HRESULT で終わる。
+    using SyncConflictMerge = std::function<HRESULT(VaultRecord& serverVault, PutVaultRequest& inOutRequest)>;
+
+    // 条件付き GetVault に使う、手元が最後に見たサーバーの版。
+    // VaultVersion が 0 より大きいときだけ If-Version を、BlobSha256Base64 もあれば If-None-Match を付ける。
+    struct VaultValidator
+    {
+        int64_t VaultVersion{ 0 };
+        std::wstring BlobSha256Base64{};
+    };
+
+    // item 単位の差分同期 (Axum API のみ)。SealedItem は item 1 件を手元で暗号化したもので、サーバーは中身を見ない。
+    struct VaultItemRecord
+    {
+        std::wstring ItemId{};
+        // PutVaultDelta では手元が最後に見たサーバーの版 (新規は 0)。それ以外はサーバーの現在の版。
+        int64_t ItemVersion{ 0 };
+        // tombstone。削除も 1 件の変更として送り、他の端末に伝える。
+        bool Deleted{ false };
+        std::vector<uint8_t> SealedItem{};
+        std::wstring UpdatedAt{};
+    };
+
+    struct PutVaultDeltaRequest
+    {
+        std::wstring DeviceId{};
+        std::vector<VaultItemRecord> Items{};
+    };
+
+    struct PutVaultDeltaResponse
+    {
+        // 書き込む前と後のサーバーの cursor。BaseCursor が手元の cursor と同じなら、
+        // 間に他の端末の変更はないので Cursor まで進めてよい。
+        int64_t BaseCursor{ 0 };
+        int64_t Cursor{ 0 };
+        // 書き込んだ item の新しい版 (SealedItem は空)。409 のときは版が合わなかった item のサーバーの版。
+        std::vector<VaultItemRecord> Items{};
+    };
+
+    struct VaultChanges
+    {
+        // 次の GetVaultChanges に渡す cursor。
+        int64_t Cursor{ 0 };
+        bool HasMore{ false };
+        std::vector<VaultItemRecord> Items{};
     };
 
     struct SyncHttpStatus
@@ -71,10 +147,56 @@ namespace tsupasswd
         std::wstring ErrorCode{};
         std::wstring ErrorMessage{};
         std::wstring RequestId{};
+        // 応答の Retry-After (秒数の形だけ解釈する)。なければ -1。
+        int32_t RetryAfterMs{ -1 };
+        // その操作で送った全往復の段階ごとの時間と送受信量の合計 (応答を受け取れずに失敗した往復も含む)。
+        SyncRequestTiming Timing{};
     };
 
-    // 自前同期 API クライアントの最小雛形。
-    // NOTE: 現時点ではHTTP実装は未接続。E_NOTIMPL を返す。
+    // 通信の段階ごとの上限。SetTimeoutMs は接続・最初のバイト・転送を同じ値にする。
+    struct SyncTimeouts
+    {
+        // 名前解決・TCP 接続・TLS。AdaptiveConnectTimeout なら最近の往復時間から短くする (SyncLatencyTracker)。
+        int32_t ConnectTimeoutMs{ 5000 };
+        // 要求を送ってから応答の最初のバイトまで。
+        int32_t FirstByteTimeoutMs{ 15000 };
+        // 送信中と本文の受信中の 1 回の待ち。
+        int32_t TransferTimeoutMs{ 15000 };
+        // 1 回の操作 (OpaqueLogin の 2 往復なども含む) 全体の上限。0 以下なら SyncCallOptions の期限だけ。
+        int32_t OperationTimeoutMs{ 30000 };
+        bool AdaptiveConnectTimeout{ true };
+    };
+
+    // 呼び出しごとの取消と期限。期限は SyncTimeouts (段階ごとの上限) と別に、要求全体にかかる。
+    struct SyncCallOptions
+    {
+        SyncCancellationToken Cancellation{};
+        std::chrono::steady_clock::time_point Deadline{ std::chrono::steady_clock::time_point::max() };
+    };
+
+    // 非同期 API の結果。Hr は同期 API の戻り値と同じ。
+    // 取消は HRESULT_FROM_WIN32(ERROR_CANCELLED) (ErrorCode=CANCELLED)、
+    // 期限切れは HRESULT_FROM_WIN32(ERROR_TIMEOUT) (ErrorCode=DEADLINE_EXCEEDED)。
+    template <typename T>
+    struct SyncResult
+    {
+        HRESULT Hr{ E_FAIL };
+        T Value{};
+        SyncHttpStatus Status{};
+    };
+
+    struct OpaqueLoginResult
+    {
+        std::wstring BearerToken{};
+        std::vector<uint8_t> SessionKey{};
+        // 応答の expires_in。返さないサーバーでは 0。
+        int64_t ExpiresInSeconds{ 0 };
+    };
+
+    class SyncLatencyTracker;
+
+    // 自前同期 API クライアント。
+    // HTTP の送受信は ISyncTransport に任せる。既定の transport は接続をプロセス内で共有し、呼び出しごとに作り直さない。
     class SyncClient final
     {
     public:
@@ -83,19 +205,38 @@ namespace tsupasswd
         void SetApiKind(SyncApiKind kind);
         void SetBearerToken(std::wstring bearerToken);
         void SetTimeoutMs(int32_t timeoutMs);
+        void SetTimeouts(SyncTimeouts timeouts);
+        SyncTimeouts const& Timeouts() const noexcept { return m_timeouts; }
+        // 既定はプロセス共有の SyncLatencyTracker::getInstance()。試験で差し替える。
+        void SetLatencyTracker(std::shared_ptr<SyncLatencyTracker> tracker);
+        // 次の要求で使う接続 timeout (適応後の値)。
+        int32_t EffectiveConnectTimeoutMs() const;
         void SetAllowInsecureHttp(bool allowInsecureHttp);
+        // 既定は Base64Json。OctetStream に対応しないサーバーには PutVault が 415 を受けて JSON で送り直す。
+        void SetVaultEncoding(SyncVaultEncoding encoding);
+        // 既定は CreateDefaultSyncTransport()。負荷試験や単体試験で差し替える。
+        void SetTransport(std::shared_ptr<ISyncTransport> transport);
+        // 以降の同期 API 呼び出しに取消と期限を適用する。
+        void SetCallOptions(SyncCallOptions options);
 
+        // 同期サーバーへの接続 (名前解決・TCP・TLS) を先に開いておく。GET healthz を 1 回送り、
+        // 応答があれば状態コードにかかわらず S_OK (接続は transport の keep-alive に残り、往復時間は SyncLatencyTracker に入る)。
+        HRESULT Prewarm(SyncHttpStatus* outStatus = nullptr) const noexcept;
+
+        // outExpiresInSeconds には token の寿命 (応答の expires_in、なければ 0) を入れる。
         HRESULT DevLogin(
             std::wstring const& userId,
             std::wstring& outBearerToken,
-            SyncHttpStatus* outStatus = nullptr) const noexcept;
+            SyncHttpStatus* outStatus = nullptr,
+            int64_t* outExpiresInSeconds = nullptr) const noexcept;
 
         HRESULT OpaqueLogin(
             std::wstring const& userId,
             std::wstring const& password,
             std::wstring& outBearerToken,
             std::vector<uint8_t>* outSessionKeyBytes = nullptr,
-            SyncHttpStatus* outStatus = nullptr) const noexcept;
+            SyncHttpStatus* outStatus = nullptr,
+            int64_t* outExpiresInSeconds = nullptr) const noexcept;
 
         HRESULT OpaqueRegister(
             std::wstring const& userId,
@@ -108,17 +249,79 @@ namespace tsupasswd
             VaultRecord& outRecord,
             SyncHttpStatus* outStatus = nullptr) const noexcept;
 
+        // サーバーの vault が known から変わっていなければ S_FALSE (304 Not Modified) を返し、outRecord は空のまま。
+        HRESULT GetVault(
+            std::wstring const& userId,
+            VaultValidator const& known,
+            VaultRecord& outRecord,
+            SyncHttpStatus* outStatus = nullptr) const noexcept;
+
         HRESULT PutVault(
             std::wstring const& userId,
             PutVaultRequest const& request,
             PutVaultResponse& outResponse,
             SyncHttpStatus* outStatus = nullptr) const noexcept;
 
+        // 409 の本文でサーバーの vault を受け取り、merge して同じ呼び出しのうちに送り直す (GET の往復を省く)。
+        // 競合した同期は PUT 2 回で済む。ExpectedVersion/NewVersion は受け取った版に合わせて inOutRequest に残る。
+        // サーバーが vault を付けなければ (古いサーバー) 409 のまま返す。merge が maxMerges 回を超えても 409 を返す。
+        HRESULT PutVaultWithConflictMerge(
+            std::wstring const& userId,
+            PutVaultRequest& inOutRequest,
+            SyncConflictMerge const& merge,
+            PutVaultResponse& outResponse,
+            SyncHttpStatus* outStatus = nullptr,
+            uint32_t maxMerges = 2) const noexcept;
+
+        // 変わった item だけを送る。1 件でも ItemVersion がサーバーと合わなければ何も書かずに
+        // HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) (409) を返し、outResponse.Items に合わなかった item の版を入れる。
+        HRESULT PutVaultDelta(
+            std::wstring const& userId,
+            PutVaultDeltaRequest const& request,
+            PutVaultDeltaResponse& outResponse,
+            SyncHttpStatus* outStatus = nullptr) const noexcept;
+
+        // sinceCursor より後に変わった item (tombstone を含む) を変更順に返す。limit が 0 ならサーバーの既定件数。
+        // HasMore なら outChanges.Cursor から続きを読む。
+        HRESULT GetVaultChanges(
+            std::wstring const& userId,
+            int64_t sinceCursor,
+            VaultChanges& outChanges,
+            SyncHttpStatus* outStatus = nullptr,
+            uint32_t limit = 0) const noexcept;
+
+        // 非同期版。クライアントの設定を複製して SyncReactor の I/O スレッドで実行するので、
+        // 呼び出し後に this を破棄・変更してよい。options は SetCallOptions の値より優先する
+        // (取消は options 側が取消可能なとき、期限は早い方)。互いに独立な要求は同時に走る。
+        SyncTask<SyncResult<VaultRecord>> GetVaultAsync(
+            std::wstring userId,
+            SyncCallOptions options = {}) const;
+
+        SyncTask<SyncResult<PutVaultResponse>> PutVaultAsync(
+            std::wstring userId,
+            PutVaultRequest request,
+            SyncCallOptions options = {}) const;
+
+        SyncTask<SyncResult<OpaqueLoginResult>> OpaqueLoginAsync(
+            std::wstring userId,
+            std::wstring password,
+            SyncCallOptions options = {}) const;
+
     private:
+        // options を m_callOptions に重ねる。取消済みまたは期限切れなら outStatus を埋めて失敗を返す。
+        HRESULT MergeCallOptions(SyncCallOptions const& options, wchar_t const* operation, SyncHttpStatus& outStatus);
+        SyncLatencyTracker& LatencyTracker() const;
+
         std::wstring m_baseUrl;
         std::wstring m_bearerToken;
-        int32_t m_timeoutMs{ 15000 };
+        SyncTimeouts m_timeouts{};
+        std::shared_ptr<SyncLatencyTracker> m_latencyTracker;
         bool m_allowInsecureHttp{ false };
         SyncApiKind m_apiKind{ SyncApiKind::Mvp };
+        SyncVaultEncoding m_vaultEncoding{ SyncVaultEncoding::Base64Json };
+        std::shared_ptr<ISyncTransport> m_transport;
+        SyncCallOptions m_callOptions{};
     };
+
+    bool RunSyncClientRegressionTests(std::wstring& outError);
 }
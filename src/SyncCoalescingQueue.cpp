@@ -0,0 +1,140 @@
+#include "SyncCoalescingQueue.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace tsupasswd
+{
+    SyncCoalescingQueue::SyncCoalescingQueue(SyncFunction sync, Clock::duration debounce, Clock::duration maxDelay) :
+        m_sync(std::move(sync)),
+        m_debounce(debounce),
+        m_maxDelay(std::max(maxDelay, debounce))
+    {
+    }
+
+    SyncCoalescingQueue::~SyncCoalescingQueue()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        if (m_worker.joinable())
+        {
+            m_worker.join();
+        }
+    }
+
+    std::shared_future<HRESULT> SyncCoalescingQueue::Request()
+    {
+        std::lock_guard lock(m_mutex);
+        Clock::time_point now = Clock::now();
+        if (!m_pending)
+        {
+            m_pending.emplace();
+            m_pending->Future = m_pending->Promise.get_future().share();
+            m_pending->FirstRequestedAt = now;
+        }
+        ++m_pending->Requests;
+        m_pending->Due = std::min(now + m_debounce, m_pending->FirstRequestedAt + m_maxDelay);
+        m_requestCount.fetch_add(1, std::memory_order_relaxed);
+        if (!m_worker.joinable())
+        {
+            m_worker = std::thread([this]() { WorkerLoop(); });
+        }
+        m_wake.notify_all();
+        return m_pending->Future;
+    }
+
+    void SyncCoalescingQueue::Flush()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            if (!m_pending)
+            {
+                return;
+            }
+            m_pending->Due = Clock::now();
+        }
+        m_wake.notify_all();
+    }
+
+    void SyncCoalescingQueue::RetryAfter(Clock::duration delay)
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            if (m_stopping)
+            {
+                return;
+            }
+            m_retryAt = Clock::now() + delay;
+            if (!m_worker.joinable())
+            {
+                m_worker = std::thread([this]() { WorkerLoop(); });
+            }
+        }
+        m_wake.notify_all();
+    }
+
+    bool SyncCoalescingQueue::WaitIdle(Clock::duration timeout)
+    {
+        std::unique_lock lock(m_mutex);
+        return m_idle.wait_for(lock, timeout, [this]() { return !m_pending && !m_running; });
+    }
+
+    void SyncCoalescingQueue::WorkerLoop()
+    {
+        std::unique_lock lock(m_mutex);
+        for (;;)
+        {
+            if (!m_pending)
+            {
+                if (m_stopping)
+                {
+                    return;
+                }
+                if (!m_retryAt)
+                {
+                    m_wake.wait(lock);
+                    continue;
+                }
+                if (Clock::now() < *m_retryAt)
+                {
+                    m_wake.wait_until(lock, *m_retryAt);
+                    continue;
+                }
+                m_pending.emplace();
+                m_pending->Future = m_pending->Promise.get_future().share();
+                m_pending->FirstRequestedAt = Clock::now();
+                m_pending->Due = m_pending->FirstRequestedAt;
+            }
+            // Due は Request のたびに延びるので、起きるたびに見直す。
+            if (!m_stopping && Clock::now() < m_pending->Due)
+            {
+                m_wake.wait_until(lock, m_pending->Due);
+                continue;
+            }
+
+            Batch batch = std::move(*m_pending);
+            m_pending.reset();
+            m_retryAt.reset();
+            m_running = true;
+            lock.unlock();
+
+            HRESULT hr = E_FAIL;
+            try
+            {
+                hr = m_sync(batch.Requests);
+            }
+            catch (...)
+            {
+            }
+            batch.Promise.set_value(hr);
+
+            lock.lock();
+            m_running = false;
+            m_runCount.fetch_add(1, std::memory_order_relaxed);
+            m_idle.notify_all();
+        }
+    }
+}
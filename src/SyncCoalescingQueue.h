@@ -0,0 +1,76 @@
+#pragma once
+
+#include "PortableHResult.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace tsupasswd
+{
+    // ローカルの vault 書き込みの後の同期を 1 本のワーカースレッドでまとめて行う。
+    // Request から Debounce の間に続いた要求は 1 回の同期にまとまり、その時点の最新の vault を送る
+    // (最初の要求から MaxDelay を過ぎたら続いていても始める)。同期中に来た要求は、その同期が読み込んだ後の
+    // 書き込みを取りこぼさないよう、終わった後にもう 1 回まとめて行う。
+    class SyncCoalescingQueue final
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+        // coalescedRequests はこの 1 回にまとめた Request の数。
+        using SyncFunction = std::function<HRESULT(uint32_t coalescedRequests)>;
+
+        SyncCoalescingQueue(SyncFunction sync, Clock::duration debounce, Clock::duration maxDelay);
+        // 予約済みの同期があれば debounce を待たずに行ってから止める。
+        ~SyncCoalescingQueue();
+
+        SyncCoalescingQueue(SyncCoalescingQueue const&) = delete;
+        SyncCoalescingQueue& operator=(SyncCoalescingQueue const&) = delete;
+
+        // 同期を予約する。戻り値はこの要求を含む 1 回の同期の結果で、待たなくてよい。ワーカーは最初の要求で作る。
+        std::shared_future<HRESULT> Request();
+        // 予約済みの同期を debounce を待たずに始める。予約がなければ何もしない。
+        void Flush();
+        // 予約済みと実行中の同期が終わるまで待つ。timeout までに終わらなければ false。
+        bool WaitIdle(Clock::duration timeout);
+        // 失敗した同期を delay 後にやり直す (coalescedRequests は 0)。先に Request が来ればその同期がやり直しを兼ねる。
+        // 続けて呼ぶと後の delay に置き換える。止めるときや WaitIdle ではやり直しを待たない
+        // (やり直す分は呼び出し側が永続化し、次の起動で予約し直す)。
+        void RetryAfter(Clock::duration delay);
+
+        uint64_t RequestCount() const noexcept { return m_requestCount.load(std::memory_order_relaxed); }
+        uint64_t RunCount() const noexcept { return m_runCount.load(std::memory_order_relaxed); }
+
+    private:
+        struct Batch
+        {
+            std::promise<HRESULT> Promise;
+            std::shared_future<HRESULT> Future;
+            Clock::time_point FirstRequestedAt{};
+            Clock::time_point Due{};
+            uint32_t Requests{ 0 };
+        };
+
+        void WorkerLoop();
+
+        SyncFunction m_sync;
+        Clock::duration m_debounce;
+        Clock::duration m_maxDelay;
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_idle;
+        std::optional<Batch> m_pending;
+        std::optional<Clock::time_point> m_retryAt;
+        bool m_running{ false };
+        bool m_stopping{ false };
+        std::thread m_worker;
+        std::atomic<uint64_t> m_requestCount{ 0 };
+        std::atomic<uint64_t> m_runCount{ 0 };
+    };
+}
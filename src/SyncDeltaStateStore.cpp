@@ -0,0 +1,188 @@
+#include "SyncDeltaStateStore.h"
+
+#include "NativeMessagingJson.h"
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <set>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace
+{
+    constexpr std::string_view kHeader = "# tsupasswd delta sync state v1";
+
+    std::string SanitizeField(std::wstring const& value)
+    {
+        std::string utf8;
+        tsupasswd::AppendWideToUtf8(value, utf8);
+        std::replace(utf8.begin(), utf8.end(), '\t', ' ');
+        std::replace(utf8.begin(), utf8.end(), '\r', ' ');
+        std::replace(utf8.begin(), utf8.end(), '\n', ' ');
+        return utf8;
+    }
+
+    std::vector<std::string_view> SplitFields(std::string_view line)
+    {
+        std::vector<std::string_view> fields;
+        size_t start = 0;
+        for (;;)
+        {
+            size_t end = line.find('\t', start);
+            if (end == std::string_view::npos)
+            {
+                fields.push_back(line.substr(start));
+                return fields;
+            }
+            fields.push_back(line.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+
+    template <typename T>
+    bool ParseNumber(std::string_view text, T& outValue)
+    {
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), outValue);
+        return error == std::errc{} && end == text.data() + text.size();
+    }
+
+    bool ParseKey(std::string_view serverUrl, std::string_view userId, std::wstring& outServerUrl, std::wstring& outUserId)
+    {
+        return tsupasswd::AppendUtf8ToWide(serverUrl, outServerUrl) && !outServerUrl.empty() &&
+            tsupasswd::AppendUtf8ToWide(userId, outUserId) && !outUserId.empty();
+    }
+}
+
+namespace tsupasswd
+{
+    SyncDeltaStateStore::SyncDeltaStateStore(std::filesystem::path path) :
+        m_path(std::move(path))
+    {
+    }
+
+    bool SyncDeltaStateStore::TryGet(std::wstring const& serverUrl, std::wstring const& userId, SyncDeltaState& outState)
+    {
+        std::lock_guard lock(m_mutex);
+        EnsureLoadedLocked();
+        auto it = m_states.find(Key{ serverUrl, userId });
+        if (it == m_states.end())
+        {
+            return false;
+        }
+        outState = it->second;
+        return true;
+    }
+
+    HRESULT SyncDeltaStateStore::Record(std::wstring const& serverUrl, SyncDeltaState const& state)
+    {
+        if (serverUrl.empty() || state.UserId.empty() || state.Cursor < 0)
+        {
+            return E_INVALIDARG;
+        }
+        try
+        {
+            std::lock_guard lock(m_mutex);
+            EnsureLoadedLocked();
+            m_states[Key{ serverUrl, state.UserId }] = state;
+            return SaveLocked();
+        }
+        catch (std::bad_alloc const&)
+        {
+            return E_OUTOFMEMORY;
+        }
+    }
+
+    // 読めない行は捨てる。cursor の行がない組は、item の版があっても cursor 0 から読み直すよう捨てる。
+    void SyncDeltaStateStore::EnsureLoadedLocked()
+    {
+        if (m_loaded)
+        {
+            return;
+        }
+        std::set<Key> withCursor;
+        std::ifstream input(m_path, std::ios::binary);
+        if (input)
+        {
+            std::string line;
+            while (std::getline(input, line))
+            {
+                if (!line.empty() && line.back() == '\r')
+                {
+                    line.pop_back();
+                }
+                std::vector<std::string_view> fields = SplitFields(line);
+                Key key;
+                if (fields.size() == 4 && fields[0] == "cursor")
+                {
+                    int64_t cursor = 0;
+                    if (!ParseKey(fields[1], fields[2], key.first, key.second) || !ParseNumber(fields[3], cursor) || cursor < 0)
+                    {
+                        continue;
+                    }
+                    SyncDeltaState& state = m_states[key];
+                    state.UserId = key.second;
+                    state.Cursor = cursor;
+                    withCursor.insert(std::move(key));
+                    continue;
+                }
+                if (fields.size() == 7 && fields[0] == "item")
+                {
+                    std::wstring itemId;
+                    SyncDeltaItemState item{};
+                    if (!ParseKey(fields[1], fields[2], key.first, key.second) ||
+                        !AppendUtf8ToWide(fields[3], itemId) || itemId.empty() ||
+                        !ParseNumber(fields[4], item.ItemVersion) || item.ItemVersion < 0 ||
+                        !AppendUtf8ToWide(fields[5], item.UpdatedAt) ||
+                        (fields[6] != "0" && fields[6] != "1"))
+                    {
+                        continue;
+                    }
+                    item.Deleted = fields[6] == "1";
+                    SyncDeltaState& state = m_states[key];
+                    state.UserId = key.second;
+                    state.Items[std::move(itemId)] = std::move(item);
+                }
+            }
+        }
+        for (auto it = m_states.begin(); it != m_states.end();)
+        {
+            it = withCursor.count(it->first) ? std::next(it) : m_states.erase(it);
+        }
+        m_loaded = true;
+    }
+
+    HRESULT SyncDeltaStateStore::SaveLocked() const
+    {
+        std::filesystem::path tempPath = m_path;
+        tempPath += ".tmp";
+        {
+            std::ofstream output(tempPath, std::ios::binary | std::ios::trunc);
+            if (!output)
+            {
+                return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
+            }
+            output << kHeader << '\n';
+            for (auto const& [key, state] : m_states)
+            {
+                std::string serverUrl = SanitizeField(key.first);
+                std::string userId = SanitizeField(key.second);
+                output << "cursor\t" << serverUrl << '\t' << userId << '\t' << state.Cursor << '\n';
+                for (auto const& [itemId, item] : state.Items)
+                {
+                    output << "item\t" << serverUrl << '\t' << userId << '\t' << SanitizeField(itemId) << '\t'
+                        << item.ItemVersion << '\t' << SanitizeField(item.UpdatedAt) << '\t' << (item.Deleted ? '1' : '0') << '\n';
+                }
+            }
+            output.flush();
+            if (!output)
+            {
+                return E_FAIL;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(tempPath, m_path, error);
+        return error ? E_FAIL : S_OK;
+    }
+}
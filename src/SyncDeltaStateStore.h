@@ -0,0 +1,55 @@
+#pragma once
+
+#include "PortableHResult.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace tsupasswd
+{
+    // 差分同期で最後にサーバーと一致させた item。UpdatedAt/Deleted が手元と違う item だけを送る。
+    struct SyncDeltaItemState
+    {
+        int64_t ItemVersion{ 0 };
+        std::wstring UpdatedAt{};
+        bool Deleted{ false };
+    };
+
+    // user ごとの差分同期の位置。Cursor より後のサーバーの変更だけを読む。
+    struct SyncDeltaState
+    {
+        std::wstring UserId{};
+        int64_t Cursor{ 0 };
+        std::map<std::wstring, SyncDeltaItemState> Items{};
+    };
+
+    // 差分同期の cursor と item の版を同期サーバーと user の組ごとに残し、起動のたびに cursor 0 から読み直さないようにする。
+    // 書き込みは SyncStateStore と同じく一時ファイルへ書いてから置き換える。
+    class SyncDeltaStateStore final
+    {
+    public:
+        explicit SyncDeltaStateStore(std::filesystem::path path);
+
+        SyncDeltaStateStore(SyncDeltaStateStore const&) = delete;
+        SyncDeltaStateStore& operator=(SyncDeltaStateStore const&) = delete;
+
+        bool TryGet(std::wstring const& serverUrl, std::wstring const& userId, SyncDeltaState& outState);
+        // 組の状態を丸ごと置き換える。
+        HRESULT Record(std::wstring const& serverUrl, SyncDeltaState const& state);
+
+    private:
+        using Key = std::pair<std::wstring, std::wstring>;
+
+        void EnsureLoadedLocked();
+        HRESULT SaveLocked() const;
+
+        std::mutex m_mutex;
+        std::filesystem::path m_path;
+        bool m_loaded{ false };
+        std::map<Key, SyncDeltaState> m_states;
+    };
+}
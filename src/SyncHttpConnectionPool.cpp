@@ -0,0 +1,78 @@
+#include "pch.h"
+#include "SyncHttpConnectionPool.h"
+
+#pragma comment(lib, "Winhttp.lib")
+
+namespace tsupasswd
+{
+    namespace
+    {
+        constexpr wchar_t kSyncUserAgent[] = L"tsupasswd_core/1.0";
+        // 同一ホストへの同時接続数。複数 vault の並列同期でも接続を使い回せる程度に広げる。
+        constexpr DWORD kMaxConnectionsPerServer = 8;
+    }
+
+    std::shared_ptr<SyncHttpConnectionPool> SyncHttpConnectionPool::Shared()
+    {
+        static std::shared_ptr<SyncHttpConnectionPool> shared = std::make_shared<SyncHttpConnectionPool>();
+        return shared;
+    }
+
+    HRESULT SyncHttpConnectionPool::EnsureSessionLocked() noexcept
+    {
+        if (m_session)
+        {
+            return S_OK;
+        }
+
+        HINTERNET session = WinHttpOpen(kSyncUserAgent, WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
+        RETURN_LAST_ERROR_IF_NULL(session);
+
+        DWORD maxConnections = kMaxConnectionsPerServer;
+        (void)WinHttpSetOption(session, WINHTTP_OPTION_MAX_CONNS_PER_SERVER, &maxConnections, sizeof(maxConnections));
+        // HTTP/2 が使えるサーバーでは 1 本の接続に多重化する。古い OS では失敗するので無視する。
+        DWORD protocols = WINHTTP_PROTOCOL_FLAG_HTTP2;
+        (void)WinHttpSetOption(session, WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL, &protocols, sizeof(protocols));
+
+        try
+        {
+            m_session = std::shared_ptr<void>(session, [](void* handle)
+            {
+                WinHttpCloseHandle(static_cast<HINTERNET>(handle));
+            });
+        }
+        catch (...)
+        {
+            WinHttpCloseHandle(session);
+            return E_OUTOFMEMORY;
+        }
+        return S_OK;
+    }
+
+    HRESULT SyncHttpConnectionPool::AcquireConnection(
+        std::wstring const& host,
+        INTERNET_PORT port,
+        bool secure,
+        std::shared_ptr<SyncHttpConnection>& outConnection) noexcept try
+    {
+        outConnection.reset();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        RETURN_IF_FAILED(EnsureSessionLocked());
+
+        ConnectionKey key{ secure, host, port };
+        auto found = m_connections.find(key);
+        if (found != m_connections.end())
+        {
+            outConnection = found->second;
+            return S_OK;
+        }
+
+        HINTERNET handle = WinHttpConnect(static_cast<HINTERNET>(m_session.get()), host.c_str(), port, 0);
+        RETURN_LAST_ERROR_IF_NULL(handle);
+        auto connection = std::make_shared<SyncHttpConnection>(m_session, handle);
+        m_connections.emplace(std::move(key), connection);
+        outConnection = std::move(connection);
+        return S_OK;
+    }
+    CATCH_RETURN()
+}
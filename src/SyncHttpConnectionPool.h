@@ -0,0 +1,71 @@
+#pragma once
+
+#include <winhttp.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+namespace tsupasswd
+{
+    // WinHttpConnect のハンドル。最後の参照が外れたときに閉じる。
+    class SyncHttpConnection final
+    {
+    public:
+        SyncHttpConnection(std::shared_ptr<void> session, HINTERNET handle) noexcept :
+            m_session(std::move(session)),
+            m_handle(handle)
+        {
+        }
+
+        ~SyncHttpConnection()
+        {
+            if (m_handle)
+            {
+                WinHttpCloseHandle(m_handle);
+            }
+        }
+
+        SyncHttpConnection(SyncHttpConnection const&) = delete;
+        SyncHttpConnection& operator=(SyncHttpConnection const&) = delete;
+
+        HINTERNET get() const noexcept { return m_handle; }
+
+    private:
+        // 接続ハンドルより先にセッションが閉じられないよう参照を持つ。
+        std::shared_ptr<void> m_session;
+        HINTERNET m_handle{ nullptr };
+    };
+
+    // SyncClient が共有する WinHTTP セッションと接続ハンドル。
+    // 1 つのセッションを使い回すことで、同じサーバーへの TCP/TLS 接続が keep-alive で再利用される。
+    // 呼び出しはスレッドセーフ。
+    class SyncHttpConnectionPool final
+    {
+    public:
+        SyncHttpConnectionPool() = default;
+
+        SyncHttpConnectionPool(SyncHttpConnectionPool const&) = delete;
+        SyncHttpConnectionPool& operator=(SyncHttpConnectionPool const&) = delete;
+
+        // プロセス全体で共有する既定のプール。
+        static std::shared_ptr<SyncHttpConnectionPool> Shared();
+
+        HRESULT AcquireConnection(
+            std::wstring const& host,
+            INTERNET_PORT port,
+            bool secure,
+            std::shared_ptr<SyncHttpConnection>& outConnection) noexcept;
+
+    private:
+        using ConnectionKey = std::tuple<bool, std::wstring, INTERNET_PORT>;
+
+        HRESULT EnsureSessionLocked() noexcept;
+
+        mutable std::mutex m_mutex;
+        std::shared_ptr<void> m_session;
+        std::map<ConnectionKey, std::shared_ptr<SyncHttpConnection>> m_connections;
+    };
+}
@@ -0,0 +1,63 @@
+#include "SyncLatencyTracker.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace tsupasswd
+{
+    SyncLatencyTracker& SyncLatencyTracker::getInstance()
+    {
+        static SyncLatencyTracker instance;
+        return instance;
+    }
+
+    void SyncLatencyTracker::Record(std::string const& origin, int32_t roundTripMs)
+    {
+        if (roundTripMs < 0)
+        {
+            return;
+        }
+        std::lock_guard lock(m_mutex);
+        auto& samples = m_samples[origin];
+        samples.push_back(roundTripMs);
+        if (samples.size() > kWindow)
+        {
+            samples.pop_front();
+        }
+    }
+
+    void SyncLatencyTracker::Reset(std::string const& origin)
+    {
+        std::lock_guard lock(m_mutex);
+        m_samples.erase(origin);
+    }
+
+    bool SyncLatencyTracker::TryGetPercentile(std::string const& origin, uint32_t percentile, int32_t& outMs) const
+    {
+        std::vector<int32_t> sorted;
+        {
+            std::lock_guard lock(m_mutex);
+            auto it = m_samples.find(origin);
+            if (it == m_samples.end() || it->second.size() < kMinSamples)
+            {
+                return false;
+            }
+            sorted.assign(it->second.begin(), it->second.end());
+        }
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = (sorted.size() * std::min<uint32_t>(percentile, 100) + 99) / 100;
+        outMs = sorted[rank == 0 ? 0 : rank - 1];
+        return true;
+    }
+
+    int32_t SyncLatencyTracker::AdaptiveConnectTimeoutMs(std::string const& origin, int32_t configuredMs) const
+    {
+        int32_t p95 = 0;
+        if (!TryGetPercentile(origin, 95, p95))
+        {
+            return configuredMs;
+        }
+        int64_t adaptive = std::max<int64_t>(static_cast<int64_t>(p95) * kConnectTimeoutMultiplier, kMinConnectTimeoutMs);
+        return static_cast<int32_t>(std::min<int64_t>(adaptive, configuredMs));
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace tsupasswd
+{
+    // 同期サーバーごとに最近の往復時間 (SyncTransportResponse::FirstByteMs) を覚え、接続 timeout を決める。
+    // 届かないサーバーに既定の timeout いっぱいまで待たず、普段の往復時間から見て十分長い時間で諦めるためのもの。
+    class SyncLatencyTracker final
+    {
+    public:
+        // 覚えておく観測数。
+        static constexpr size_t kWindow = 64;
+        // これより少ない観測では適応しない。
+        static constexpr size_t kMinSamples = 8;
+        // 接続 timeout は p95 のこの倍数。
+        static constexpr int32_t kConnectTimeoutMultiplier = 4;
+        // 適応した接続 timeout の下限。
+        static constexpr int32_t kMinConnectTimeoutMs = 1000;
+
+        static SyncLatencyTracker& getInstance();
+
+        void Record(std::string const& origin, int32_t roundTripMs);
+        // timeout で失敗したら観測を捨て、次の要求は設定どおりの timeout で待つ
+        // (回線が遅くなったときに短すぎる timeout のまま失敗し続けないため)。
+        void Reset(std::string const& origin);
+
+        // percentile は 0-100。観測が kMinSamples 未満なら false。
+        bool TryGetPercentile(std::string const& origin, uint32_t percentile, int32_t& outMs) const;
+        // p95 × kConnectTimeoutMultiplier (kMinConnectTimeoutMs 以上、configuredMs 以下)。観測が足りなければ configuredMs。
+        int32_t AdaptiveConnectTimeoutMs(std::string const& origin, int32_t configuredMs) const;
+
+    private:
+        mutable std::mutex m_mutex;
+        std::map<std::string, std::deque<int32_t>> m_samples;
+    };
+}
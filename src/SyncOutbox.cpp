@@ -0,0 +1,282 @@
+#include "SyncOutbox.h"
+
+#include "NativeMessagingJson.h"
+
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+#include <fstream>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+namespace
+{
+    constexpr std::string_view kHeader = "# tsupasswd sync outbox v1";
+
+    std::string SanitizeField(std::wstring const& value)
+    {
+        std::string utf8;
+        tsupasswd::AppendWideToUtf8(value, utf8);
+        std::replace(utf8.begin(), utf8.end(), '\t', ' ');
+        std::replace(utf8.begin(), utf8.end(), '\r', ' ');
+        std::replace(utf8.begin(), utf8.end(), '\n', ' ');
+        return utf8;
+    }
+
+    std::vector<std::string_view> SplitFields(std::string_view line)
+    {
+        std::vector<std::string_view> fields;
+        size_t start = 0;
+        for (;;)
+        {
+            size_t end = line.find('\t', start);
+            if (end == std::string_view::npos)
+            {
+                fields.push_back(line.substr(start));
+                return fields;
+            }
+            fields.push_back(line.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+
+    template <typename T>
+    bool ParseNumber(std::string_view text, T& outValue)
+    {
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), outValue);
+        return error == std::errc{} && end == text.data() + text.size();
+    }
+
+    bool ParseEntry(std::vector<std::string_view> const& fields, tsupasswd::SyncOutboxEntry& outEntry)
+    {
+        if (fields.size() != 9)
+        {
+            return false;
+        }
+        tsupasswd::SyncOutboxEntry entry{};
+        int64_t lastHr = 0;
+        if (!tsupasswd::AppendUtf8ToWide(fields[1], entry.UserId) || entry.UserId.empty() ||
+            !ParseNumber(fields[2], entry.Generation) ||
+            !ParseNumber(fields[3], entry.PendingGenerations) ||
+            !tsupasswd::AppendUtf8ToWide(fields[4], entry.FirstRequestId) ||
+            !tsupasswd::AppendUtf8ToWide(fields[5], entry.LastRequestId) ||
+            !ParseNumber(fields[6], entry.FirstQueuedAtUnixMs) ||
+            !ParseNumber(fields[7], entry.Attempts) ||
+            !ParseNumber(fields[8], lastHr))
+        {
+            return false;
+        }
+        entry.LastHr = static_cast<HRESULT>(lastHr);
+        outEntry = std::move(entry);
+        return true;
+    }
+
+    int64_t NowUnixMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+}
+
+namespace tsupasswd
+{
+    SyncOutbox::SyncOutbox(std::filesystem::path path) :
+        m_path(std::move(path))
+    {
+    }
+
+    HRESULT SyncOutbox::Enqueue(std::wstring const& userId, std::wstring const& requestId, uint64_t& outGeneration)
+    {
+        outGeneration = 0;
+        if (userId.empty())
+        {
+            return E_INVALIDARG;
+        }
+        try
+        {
+            std::lock_guard lock(m_mutex);
+            EnsureLoadedLocked();
+            SyncOutboxEntry* entry = FindLocked(userId);
+            if (!entry)
+            {
+                entry = &m_entries.emplace_back();
+                entry->UserId = userId;
+                entry->FirstRequestId = requestId;
+                entry->FirstQueuedAtUnixMs = NowUnixMs();
+            }
+            entry->Generation = ++m_lastGeneration;
+            ++entry->PendingGenerations;
+            entry->LastRequestId = requestId;
+            outGeneration = entry->Generation;
+            return SaveLocked();
+        }
+        catch (std::bad_alloc const&)
+        {
+            return E_OUTOFMEMORY;
+        }
+    }
+
+    bool SyncOutbox::TryGetPending(std::wstring const& userId, SyncOutboxEntry& outEntry)
+    {
+        std::lock_guard lock(m_mutex);
+        EnsureLoadedLocked();
+        SyncOutboxEntry* entry = FindLocked(userId);
+        if (!entry)
+        {
+            return false;
+        }
+        outEntry = *entry;
+        return true;
+    }
+
+    HRESULT SyncOutbox::Complete(std::wstring const& userId, uint64_t generation)
+    {
+        try
+        {
+            std::lock_guard lock(m_mutex);
+            EnsureLoadedLocked();
+            SyncOutboxEntry* entry = FindLocked(userId);
+            if (!entry)
+            {
+                return S_FALSE;
+            }
+            if (entry->Generation > generation)
+            {
+                // 送った後に積まれた世代は残す。失敗の回数は送れたので数え直す。
+                entry->Attempts = 0;
+                entry->LastHr = S_OK;
+                HRESULT hr = SaveLocked();
+                return FAILED(hr) ? hr : S_FALSE;
+            }
+            m_entries.erase(m_entries.begin() + (entry - m_entries.data()));
+            return SaveLocked();
+        }
+        catch (std::bad_alloc const&)
+        {
+            return E_OUTOFMEMORY;
+        }
+    }
+
+    HRESULT SyncOutbox::RecordFailure(std::wstring const& userId, HRESULT hr, uint32_t jitter, std::chrono::milliseconds& outDelay)
+    {
+        outDelay = kInitialBackoff;
+        try
+        {
+            std::lock_guard lock(m_mutex);
+            EnsureLoadedLocked();
+            SyncOutboxEntry* entry = FindLocked(userId);
+            if (!entry)
+            {
+                return S_FALSE;
+            }
+            if (entry->Attempts < UINT32_MAX)
+            {
+                ++entry->Attempts;
+            }
+            entry->LastHr = hr;
+            outDelay = BackoffDelay(entry->Attempts, jitter);
+            return SaveLocked();
+        }
+        catch (std::bad_alloc const&)
+        {
+            return E_OUTOFMEMORY;
+        }
+    }
+
+    std::vector<SyncOutboxEntry> SyncOutbox::Entries()
+    {
+        std::lock_guard lock(m_mutex);
+        EnsureLoadedLocked();
+        return m_entries;
+    }
+
+    std::chrono::milliseconds SyncOutbox::BackoffDelay(uint32_t attempts, uint32_t jitter) noexcept
+    {
+        int64_t delayMs = kInitialBackoff.count();
+        for (uint32_t i = 1; i < attempts && delayMs < kMaxBackoff.count(); ++i)
+        {
+            delayMs *= 2;
+        }
+        delayMs = std::min<int64_t>(delayMs, kMaxBackoff.count());
+        int64_t half = delayMs / 2;
+        return std::chrono::milliseconds(half + static_cast<int64_t>(jitter % static_cast<uint64_t>(delayMs - half + 1)));
+    }
+
+    // 読めない行は捨てる (ほかの user の世代まで失わないため)。ファイルがなければ空。
+    void SyncOutbox::EnsureLoadedLocked()
+    {
+        if (m_loaded)
+        {
+            return;
+        }
+        std::ifstream input(m_path, std::ios::binary);
+        if (input)
+        {
+            std::string line;
+            while (std::getline(input, line))
+            {
+                if (!line.empty() && line.back() == '\r')
+                {
+                    line.pop_back();
+                }
+                auto fields = SplitFields(line);
+                uint64_t generation = 0;
+                if (fields.size() == 2 && fields[0] == "generation" && ParseNumber(fields[1], generation))
+                {
+                    m_lastGeneration = std::max(m_lastGeneration, generation);
+                    continue;
+                }
+                SyncOutboxEntry entry{};
+                if (fields[0] != "entry" || !ParseEntry(fields, entry))
+                {
+                    continue;
+                }
+                m_lastGeneration = std::max(m_lastGeneration, entry.Generation);
+                if (SyncOutboxEntry* existing = FindLocked(entry.UserId))
+                {
+                    if (existing->Generation < entry.Generation)
+                    {
+                        *existing = std::move(entry);
+                    }
+                    continue;
+                }
+                m_entries.push_back(std::move(entry));
+            }
+        }
+        m_loaded = true;
+    }
+
+    HRESULT SyncOutbox::SaveLocked() const
+    {
+        std::filesystem::path tempPath = m_path;
+        tempPath += ".tmp";
+        {
+            std::ofstream output(tempPath, std::ios::binary | std::ios::trunc);
+            if (!output)
+            {
+                return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
+            }
+            output << kHeader << '\n' << "generation\t" << m_lastGeneration << '\n';
+            for (SyncOutboxEntry const& entry : m_entries)
+            {
+                output << "entry\t" << SanitizeField(entry.UserId) << '\t' << entry.Generation << '\t' << entry.PendingGenerations << '\t'
+                    << SanitizeField(entry.FirstRequestId) << '\t' << SanitizeField(entry.LastRequestId) << '\t'
+                    << entry.FirstQueuedAtUnixMs << '\t' << entry.Attempts << '\t' << static_cast<int64_t>(entry.LastHr) << '\n';
+            }
+            output.flush();
+            if (!output)
+            {
+                return E_FAIL;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(tempPath, m_path, error);
+        return error ? E_FAIL : S_OK;
+    }
+
+    SyncOutboxEntry* SyncOutbox::FindLocked(std::wstring const& userId)
+    {
+        auto it = std::find_if(m_entries.begin(), m_entries.end(), [&](SyncOutboxEntry const& entry) { return entry.UserId == userId; });
+        return it == m_entries.end() ? nullptr : &*it;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "PortableHResult.h"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tsupasswd
+{
+    // 同期サーバーにまだ送っていないローカルの vault の世代。user ごとに 1 件。
+    struct SyncOutboxEntry
+    {
+        std::wstring UserId{};
+        // 送っていない最新の世代。同じ user の古い世代はこの 1 件にまとまる
+        // (同期はローカルの最新の vault を送るので、古い世代を別に送る必要はない)。
+        uint64_t Generation{ 0 };
+        // まとめた世代の数。
+        uint32_t PendingGenerations{ 0 };
+        std::wstring FirstRequestId{};
+        std::wstring LastRequestId{};
+        int64_t FirstQueuedAtUnixMs{ 0 };
+        // 最初に積んでから失敗した同期の回数。
+        uint32_t Attempts{ 0 };
+        HRESULT LastHr{ S_OK };
+    };
+
+    // 送っていない世代をファイルに残し、同期サーバーに届かないまま終了しても次の起動で送り直せるようにする。
+    // 書き込みは一時ファイルへ書いてから置き換えるので、途中で落ちても前の内容が残る。
+    class SyncOutbox final
+    {
+    public:
+        // 失敗した同期をやり直すまでの時間。失敗のたびに倍にし、kMaxBackoff で止める。
+        static constexpr std::chrono::milliseconds kInitialBackoff{ 2000 };
+        static constexpr std::chrono::milliseconds kMaxBackoff{ 5 * 60 * 1000 };
+
+        explicit SyncOutbox(std::filesystem::path path);
+
+        SyncOutbox(SyncOutbox const&) = delete;
+        SyncOutbox& operator=(SyncOutbox const&) = delete;
+
+        // ローカルの vault を書き込んだ世代を積み、outGeneration に返す。
+        HRESULT Enqueue(std::wstring const& userId, std::wstring const& requestId, uint64_t& outGeneration);
+        bool TryGetPending(std::wstring const& userId, SyncOutboxEntry& outEntry);
+        // generation までを送った。送っている間に新しい世代が積まれていればそれは残し、S_FALSE を返す。
+        HRESULT Complete(std::wstring const& userId, uint64_t generation);
+        // 同期の失敗を記録し、やり直すまでの時間を outDelay に返す。jitter は乱数 (同時に落ちた端末が揃って再送しないため)。
+        // 積まれていなければ S_FALSE。
+        HRESULT RecordFailure(std::wstring const& userId, HRESULT hr, uint32_t jitter, std::chrono::milliseconds& outDelay);
+        std::vector<SyncOutboxEntry> Entries();
+
+        // attempts 回失敗した後の待ち時間。倍々の時間の後半 [d/2, d] に jitter で散らす。
+        static std::chrono::milliseconds BackoffDelay(uint32_t attempts, uint32_t jitter) noexcept;
+
+    private:
+        void EnsureLoadedLocked();
+        HRESULT SaveLocked() const;
+        SyncOutboxEntry* FindLocked(std::wstring const& userId);
+
+        std::mutex m_mutex;
+        std::filesystem::path m_path;
+        bool m_loaded{ false };
+        uint64_t m_lastGeneration{ 0 };
+        std::vector<SyncOutboxEntry> m_entries;
+    };
+}
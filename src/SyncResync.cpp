@@ -0,0 +1,21 @@
+#include "SyncResync.h"
+
+namespace tsupasswd
+{
+    HRESULT PersistMergedVaultThenPush(
+        std::function<HRESULT()> const& writeLocal,
+        std::function<bool()> const& cancelled,
+        std::function<HRESULT()> const& push)
+    {
+        HRESULT hr = writeLocal();
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        if (cancelled && cancelled())
+        {
+            return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+        }
+        return push();
+    }
+}
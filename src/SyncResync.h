@@ -0,0 +1,15 @@
+#pragma once
+
+#include "PortableHResult.h"
+
+#include <functional>
+
+namespace tsupasswd
+{
+    // resync の push の段階。pull が手元の vault をサーバーの vault で上書きした後なので、取消を確かめる前に
+    // merge した vault (まだ送っていない手元の変更を含む) を writeLocal で書く。cancelled が true なら送らずに ERROR_CANCELLED。
+    HRESULT PersistMergedVaultThenPush(
+        std::function<HRESULT()> const& writeLocal,
+        std::function<bool()> const& cancelled,
+        std::function<HRESULT()> const& push);
+}
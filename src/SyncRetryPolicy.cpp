@@ -0,0 +1,257 @@
+#include "SyncRetryPolicy.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace tsupasswd
+{
+    namespace
+    {
+        // 取消・期限切れ。待っても結果は変わらない。
+        bool IsCallAborted(HRESULT hr)
+        {
+            return hr == HRESULT_FROM_WIN32(ERROR_CANCELLED) || hr == HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+        }
+
+        // transport が返す接続・名前解決・TLS・タイムアウト・壊れた応答の失敗。
+        bool IsTransportFailure(HRESULT hr)
+        {
+            return hr == HRESULT_FROM_WIN32(ERROR_WINHTTP_TIMEOUT) ||
+                hr == HRESULT_FROM_WIN32(ERROR_WINHTTP_NAME_NOT_RESOLVED) ||
+                hr == HRESULT_FROM_WIN32(ERROR_WINHTTP_CANNOT_CONNECT) ||
+                hr == HRESULT_FROM_WIN32(ERROR_WINHTTP_CONNECTION_ERROR) ||
+                hr == HRESULT_FROM_WIN32(ERROR_WINHTTP_INVALID_SERVER_RESPONSE) ||
+                hr == HRESULT_FROM_WIN32(ERROR_WINHTTP_SECURE_FAILURE);
+        }
+
+        // サーバーが落ちているか混んでいる失敗。breaker と予算の対象。
+        // 応答がない (StatusCode 0) ものは transport の通信の失敗だけを数える。
+        bool IsTransientFailure(HRESULT hr, SyncHttpStatus const& status)
+        {
+            if (status.StatusCode == 0)
+            {
+                return IsTransportFailure(hr);
+            }
+            return status.StatusCode == 408 || status.StatusCode == 429 || status.StatusCode >= 500;
+        }
+    }
+
+    SyncRetryPolicy& SyncRetryPolicy::getInstance()
+    {
+        static SyncRetryPolicy instance;
+        return instance;
+    }
+
+    SyncRetryPolicy::SyncRetryPolicy(SyncRetryOptions options) :
+        m_options(options),
+        m_random(std::random_device{}())
+    {
+        if (m_options.MaxAttempts == 0)
+        {
+            m_options.MaxAttempts = 1;
+        }
+    }
+
+    SyncRetryPolicy::EndpointState& SyncRetryPolicy::StateLocked(std::wstring const& endpoint)
+    {
+        auto [it, inserted] = m_endpoints.try_emplace(endpoint);
+        if (inserted)
+        {
+            it->second.Budget = m_options.RetryBudget;
+        }
+        return it->second;
+    }
+
+    HRESULT SyncRetryPolicy::Admit(std::wstring const& endpoint, std::chrono::milliseconds* outRetryIn)
+    {
+        std::lock_guard lock(m_mutex);
+        EndpointState& state = StateLocked(endpoint);
+        if (!state.Open)
+        {
+            return S_OK;
+        }
+
+        Clock::time_point now = Clock::now();
+        if (now >= state.OpenUntil && !state.ProbeInFlight)
+        {
+            // 開いている時間が過ぎたら 1 回だけ試す。結果は RecordSuccess / OnFailure で受け取る。
+            state.ProbeInFlight = true;
+            return S_OK;
+        }
+        if (outRetryIn)
+        {
+            *outRetryIn = now >= state.OpenUntil ?
+                m_options.BreakerOpenDuration :
+                std::chrono::ceil<std::chrono::milliseconds>(state.OpenUntil - now);
+        }
+        return HRESULT_FROM_WIN32(ERROR_RETRY);
+    }
+
+    void SyncRetryPolicy::RecordSuccess(std::wstring const& endpoint)
+    {
+        std::lock_guard lock(m_mutex);
+        EndpointState& state = StateLocked(endpoint);
+        state.ConsecutiveFailures = 0;
+        state.Open = false;
+        state.ProbeInFlight = false;
+        state.Budget = (std::min)(m_options.RetryBudget, state.Budget + m_options.RetryBudgetRefill);
+    }
+
+    SyncRetryDecision SyncRetryPolicy::OnFailure(
+        std::wstring const& endpoint,
+        uint32_t attempt,
+        HRESULT hr,
+        SyncHttpStatus const& status,
+        std::chrono::milliseconds previousDelay)
+    {
+        std::lock_guard lock(m_mutex);
+        EndpointState& state = StateLocked(endpoint);
+        bool probe = std::exchange(state.ProbeInFlight, false);
+        SyncRetryDecision decision{};
+
+        if (IsCallAborted(hr))
+        {
+            decision.Reason = L"cancelled";
+            return decision;
+        }
+
+        if (status.StatusCode == 0 && !IsTransportFailure(hr))
+        {
+            // token・暗号化・設定など、送る前の手元の失敗。サーバーに届いていないので breaker も予算も動かさない。
+            decision.Reason = L"not_retryable";
+            return decision;
+        }
+
+        if (!IsTransientFailure(hr, status))
+        {
+            // サーバーは応答している。breaker は閉じる。
+            state.ConsecutiveFailures = 0;
+            state.Open = false;
+            if (hr == HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) && status.ServerVersion >= 0 && attempt < m_options.MaxAttempts)
+            {
+                decision.Retry = true;
+                decision.Reason = L"conflict_server_version";
+                return decision;
+            }
+            decision.Reason = attempt < m_options.MaxAttempts ? L"not_retryable" : L"attempts_exhausted";
+            return decision;
+        }
+
+        state.ConsecutiveFailures += 1;
+        if (probe || state.ConsecutiveFailures >= m_options.BreakerFailureThreshold)
+        {
+            state.Open = true;
+            state.OpenUntil = Clock::now() + m_options.BreakerOpenDuration;
+            decision.Delay = m_options.BreakerOpenDuration;
+            decision.Reason = L"circuit_open";
+            return decision;
+        }
+        if (attempt >= m_options.MaxAttempts)
+        {
+            decision.Reason = L"attempts_exhausted";
+            return decision;
+        }
+
+        std::chrono::milliseconds retryAfter{ status.RetryAfterMs };
+        if (status.RetryAfterMs >= 0 && retryAfter > m_options.MaxRetryAfter)
+        {
+            decision.Delay = retryAfter;
+            decision.Reason = L"retry_after_too_long";
+            return decision;
+        }
+        if (state.Budget < 1.0)
+        {
+            decision.Reason = L"budget_exhausted";
+            return decision;
+        }
+
+        state.Budget -= 1.0;
+        decision.Retry = true;
+        decision.Delay = DecorrelatedJitter(m_options.BaseDelay, m_options.MaxDelay, previousDelay, static_cast<uint32_t>(m_random()));
+        decision.Reason = L"backoff";
+        if (status.RetryAfterMs >= 0 && retryAfter >= decision.Delay)
+        {
+            decision.Delay = retryAfter;
+            decision.Reason = L"retry_after";
+        }
+        return decision;
+    }
+
+    std::chrono::milliseconds SyncRetryPolicy::DecorrelatedJitter(
+        std::chrono::milliseconds base,
+        std::chrono::milliseconds cap,
+        std::chrono::milliseconds previous,
+        uint32_t random) noexcept
+    {
+        int64_t low = (std::max<int64_t>)(0, base.count());
+        int64_t high = (std::max)(low, (std::max<int64_t>)(previous.count(), low) * 3);
+        int64_t delay = low + static_cast<int64_t>(random % static_cast<uint64_t>(high - low + 1));
+        return std::chrono::milliseconds((std::min)(delay, (std::max)(cap.count(), low)));
+    }
+
+    SyncTask<SyncRetryOutcome> RunWithRetryAsync(
+        SyncRetryPolicy& policy,
+        std::wstring endpoint,
+        std::function<SyncTask<SyncRetryAttemptResult>(uint32_t attempt)> attempt,
+        std::function<void(uint32_t nextAttempt, SyncRetryDecision const& decision)> onRetry,
+        SyncCancellationToken cancellation)
+    {
+        SyncReactor& reactor = SyncReactor::getInstance();
+        SyncRetryOutcome outcome{};
+        std::chrono::milliseconds previousDelay = policy.Options().BaseDelay;
+        for (uint32_t attemptNumber = 1;; ++attemptNumber)
+        {
+            if (cancellation.IsCancellationRequested())
+            {
+                outcome.Hr = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+                outcome.LastDecision.Reason = L"cancelled";
+                co_return outcome;
+            }
+
+            std::chrono::milliseconds retryIn{ 0 };
+            HRESULT hrAdmit = policy.Admit(endpoint, &retryIn);
+            if (FAILED(hrAdmit))
+            {
+                outcome.Hr = hrAdmit;
+                outcome.Status = {};
+                outcome.Status.ErrorCode = L"CIRCUIT_OPEN";
+                outcome.Status.ErrorMessage = L"SyncRetryPolicy skipped the request after repeated failures.";
+                outcome.LastDecision.Delay = retryIn;
+                outcome.LastDecision.Reason = L"circuit_open";
+                co_return outcome;
+            }
+
+            SyncRetryAttemptResult result = co_await attempt(attemptNumber);
+            outcome.Attempts = attemptNumber;
+            outcome.Hr = result.Hr;
+            outcome.Status = std::move(result.Status);
+            if (SUCCEEDED(outcome.Hr))
+            {
+                policy.RecordSuccess(endpoint);
+                outcome.LastDecision = {};
+                co_return outcome;
+            }
+
+            SyncRetryDecision decision = policy.OnFailure(endpoint, attemptNumber, outcome.Hr, outcome.Status, previousDelay);
+            outcome.LastDecision = decision;
+            if (!decision.Retry)
+            {
+                co_return outcome;
+            }
+            if (onRetry)
+            {
+                onRetry(attemptNumber + 1, decision);
+            }
+            if (decision.Delay.count() > 0)
+            {
+                if (!co_await reactor.Delay(decision.Delay, cancellation))
+                {
+                    outcome.Hr = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+                    outcome.LastDecision.Reason = L"cancelled";
+                    co_return outcome;
+                }
+                previousDelay = decision.Delay;
+            }
+        }
+    }
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "SyncAsync.h"
+#include "SyncCancellation.h"
+#include "SyncClient.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+
+namespace tsupasswd
+{
+    struct SyncRetryOptions
+    {
+        // 1 回の操作で送る最大の回数 (最初の 1 回を含む)。
+        uint32_t MaxAttempts{ 3 };
+        // decorrelated jitter の下限と上限。
+        std::chrono::milliseconds BaseDelay{ 500 };
+        std::chrono::milliseconds MaxDelay{ 10000 };
+        // Retry-After がこれより長ければその場では待たずに失敗を返す (outbox が後で送り直す)。
+        std::chrono::milliseconds MaxRetryAfter{ 30000 };
+        // endpoint ごとの再試行の予算。待って送り直すたびに 1 減り、成功するたびに RetryBudgetRefill 戻る。
+        // 障害の間に全端末が再試行で負荷を倍にしないため。
+        double RetryBudget{ 10.0 };
+        double RetryBudgetRefill{ 0.2 };
+        // 続けてこの回数 (5xx・429・通信失敗) 失敗したら BreakerOpenDuration の間は送らずに失敗を返す。
+        // 過ぎたら 1 回だけ試し、成功すれば戻す。
+        uint32_t BreakerFailureThreshold{ 5 };
+        std::chrono::milliseconds BreakerOpenDuration{ 30000 };
+    };
+
+    struct SyncRetryDecision
+    {
+        bool Retry{ false };
+        std::chrono::milliseconds Delay{ 0 };
+        // ログ用の理由。conflict_server_version・backoff・retry_after・not_retryable・cancelled・
+        // attempts_exhausted・budget_exhausted・retry_after_too_long・circuit_open。
+        wchar_t const* Reason{ L"" };
+    };
+
+    // 同期 API の再試行の判断。endpoint (同期サーバーの base URL) ごとに予算と circuit breaker を持つ。
+    // アプリは getInstance() を使い、プロセス内の全ての同期で状態を共有する。
+    class SyncRetryPolicy final
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static SyncRetryPolicy& getInstance();
+
+        explicit SyncRetryPolicy(SyncRetryOptions options = {});
+
+        SyncRetryPolicy(SyncRetryPolicy const&) = delete;
+        SyncRetryPolicy& operator=(SyncRetryPolicy const&) = delete;
+
+        // 送ってよいか。breaker が開いていれば HRESULT_FROM_WIN32(ERROR_RETRY) を返し、試せるまでの時間を outRetryIn に入れる。
+        HRESULT Admit(std::wstring const& endpoint, std::chrono::milliseconds* outRetryIn = nullptr);
+        void RecordSuccess(std::wstring const& endpoint);
+        // attempt 回目 (1 始まり) の失敗の後に、送り直すかと待つ時間を決める。
+        // previousDelay は前回待った時間 (decorrelated jitter の上限に使う。初回は BaseDelay)。
+        // 409 に server_version があれば待たずに送り直す (予算を使わない)。
+        SyncRetryDecision OnFailure(
+            std::wstring const& endpoint,
+            uint32_t attempt,
+            HRESULT hr,
+            SyncHttpStatus const& status,
+            std::chrono::milliseconds previousDelay);
+
+        SyncRetryOptions const& Options() const noexcept { return m_options; }
+
+        // min(cap, base + random % (previous * 3 - base + 1))。random は乱数。
+        static std::chrono::milliseconds DecorrelatedJitter(
+            std::chrono::milliseconds base,
+            std::chrono::milliseconds cap,
+            std::chrono::milliseconds previous,
+            uint32_t random) noexcept;
+
+    private:
+        struct EndpointState
+        {
+            double Budget{ 0 };
+            uint32_t ConsecutiveFailures{ 0 };
+            Clock::time_point OpenUntil{};
+            bool Open{ false };
+            bool ProbeInFlight{ false };
+        };
+
+        EndpointState& StateLocked(std::wstring const& endpoint);
+
+        SyncRetryOptions m_options;
+        std::mutex m_mutex;
+        std::map<std::wstring, EndpointState> m_endpoints;
+        std::mt19937 m_random;
+    };
+
+    struct SyncRetryAttemptResult
+    {
+        HRESULT Hr{ E_FAIL };
+        SyncHttpStatus Status{};
+    };
+
+    struct SyncRetryOutcome
+    {
+        HRESULT Hr{ E_FAIL };
+        SyncHttpStatus Status{};
+        uint32_t Attempts{ 0 };
+        // 最後の失敗で決めたこと (成功したときは既定値)。
+        SyncRetryDecision LastDecision{};
+    };
+
+    // attempt を送り、送り直すときは reactor のタイマーで待つ (sleep_for と違い、待つ間はどのスレッドも使わない)。
+    // attempt は 1 始まりの回数を受け取り、SyncClient の非同期 API で送る task を返す。呼び出し元は結果を co_await する。
+    // 2 回目からの attempt と onRetry は I/O スレッドで呼ばれる (onRetry はログ用、空でもよい)。取消は待ちを打ち切り ERROR_CANCELLED を返す。
+    SyncTask<SyncRetryOutcome> RunWithRetryAsync(
+        SyncRetryPolicy& policy,
+        std::wstring endpoint,
+        std::function<SyncTask<SyncRetryAttemptResult>(uint32_t attempt)> attempt,
+        std::function<void(uint32_t nextAttempt, SyncRetryDecision const& decision)> onRetry,
+        SyncCancellationToken cancellation = {});
+}
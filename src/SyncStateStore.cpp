@@ -0,0 +1,236 @@
+#include "SyncStateStore.h"
+
+#include "NativeMessagingJson.h"
+
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+#include <fstream>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+namespace
+{
+    constexpr std::string_view kHeader = "# tsupasswd sync state v1";
+
+    std::string SanitizeField(std::wstring const& value)
+    {
+        std::string utf8;
+        tsupasswd::AppendWideToUtf8(value, utf8);
+        std::replace(utf8.begin(), utf8.end(), '\t', ' ');
+        std::replace(utf8.begin(), utf8.end(), '\r', ' ');
+        std::replace(utf8.begin(), utf8.end(), '\n', ' ');
+        return utf8;
+    }
+
+    std::vector<std::string_view> SplitFields(std::string_view line)
+    {
+        std::vector<std::string_view> fields;
+        size_t start = 0;
+        for (;;)
+        {
+            size_t end = line.find('\t', start);
+            if (end == std::string_view::npos)
+            {
+                fields.push_back(line.substr(start));
+                return fields;
+            }
+            fields.push_back(line.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+
+    template <typename T>
+    bool ParseNumber(std::string_view text, T& outValue)
+    {
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), outValue);
+        return error == std::errc{} && end == text.data() + text.size();
+    }
+
+    bool ParseRecord(std::vector<std::string_view> const& fields, tsupasswd::SyncStateRecord& outRecord)
+    {
+        if (fields.size() != 7 || fields[0] != "state")
+        {
+            return false;
+        }
+        tsupasswd::SyncStateRecord record{};
+        if (!tsupasswd::AppendUtf8ToWide(fields[1], record.ServerUrl) || record.ServerUrl.empty() ||
+            !tsupasswd::AppendUtf8ToWide(fields[2], record.UserId) || record.UserId.empty() ||
+            !ParseNumber(fields[3], record.ServerVersion) || record.ServerVersion < 0 ||
+            !tsupasswd::AppendUtf8ToWide(fields[4], record.BlobSha256Base64) ||
+            !ParseNumber(fields[5], record.SyncedGeneration) ||
+            !ParseNumber(fields[6], record.UpdatedAtUnixMs))
+        {
+            return false;
+        }
+        outRecord = std::move(record);
+        return true;
+    }
+
+    int64_t NowUnixMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+}
+
+namespace tsupasswd
+{
+    SyncStateStore::SyncStateStore(std::filesystem::path path) :
+        m_path(std::move(path))
+    {
+    }
+
+    bool SyncStateStore::TryGet(std::wstring const& serverUrl, std::wstring const& userId, SyncStateRecord& outRecord)
+    {
+        std::lock_guard lock(m_mutex);
+        EnsureLoadedLocked();
+        SyncStateRecord* record = FindLocked(serverUrl, userId);
+        if (!record)
+        {
+            return false;
+        }
+        outRecord = *record;
+        return true;
+    }
+
+    HRESULT SyncStateStore::RecordServerVersion(std::wstring const& serverUrl, std::wstring const& userId, int64_t serverVersion, std::wstring const& blobSha256Base64)
+    {
+        if (serverUrl.empty() || userId.empty() || serverVersion < 0)
+        {
+            return E_INVALIDARG;
+        }
+        try
+        {
+            std::lock_guard lock(m_mutex);
+            EnsureLoadedLocked();
+            SyncStateRecord& record = FindOrAddLocked(serverUrl, userId);
+            if (record.ServerVersion == serverVersion && record.BlobSha256Base64 == blobSha256Base64 && record.UpdatedAtUnixMs != 0)
+            {
+                return S_FALSE;
+            }
+            record.ServerVersion = serverVersion;
+            record.BlobSha256Base64 = blobSha256Base64;
+            record.UpdatedAtUnixMs = NowUnixMs();
+            return SaveLocked();
+        }
+        catch (std::bad_alloc const&)
+        {
+            return E_OUTOFMEMORY;
+        }
+    }
+
+    HRESULT SyncStateStore::RecordSyncedGeneration(std::wstring const& serverUrl, std::wstring const& userId, uint64_t generation)
+    {
+        if (serverUrl.empty() || userId.empty())
+        {
+            return E_INVALIDARG;
+        }
+        try
+        {
+            std::lock_guard lock(m_mutex);
+            EnsureLoadedLocked();
+            SyncStateRecord& record = FindOrAddLocked(serverUrl, userId);
+            if (record.SyncedGeneration >= generation)
+            {
+                return S_FALSE;
+            }
+            record.SyncedGeneration = generation;
+            record.UpdatedAtUnixMs = NowUnixMs();
+            return SaveLocked();
+        }
+        catch (std::bad_alloc const&)
+        {
+            return E_OUTOFMEMORY;
+        }
+    }
+
+    std::vector<SyncStateRecord> SyncStateStore::Records()
+    {
+        std::lock_guard lock(m_mutex);
+        EnsureLoadedLocked();
+        return m_records;
+    }
+
+    // 読めない行は捨てる (ほかの組の状態まで失わないため)。ファイルがなければ空。
+    void SyncStateStore::EnsureLoadedLocked()
+    {
+        if (m_loaded)
+        {
+            return;
+        }
+        std::ifstream input(m_path, std::ios::binary);
+        if (input)
+        {
+            std::string line;
+            while (std::getline(input, line))
+            {
+                if (!line.empty() && line.back() == '\r')
+                {
+                    line.pop_back();
+                }
+                SyncStateRecord record{};
+                if (!ParseRecord(SplitFields(line), record))
+                {
+                    continue;
+                }
+                if (SyncStateRecord* existing = FindLocked(record.ServerUrl, record.UserId))
+                {
+                    *existing = std::move(record);
+                    continue;
+                }
+                m_records.push_back(std::move(record));
+            }
+        }
+        m_loaded = true;
+    }
+
+    HRESULT SyncStateStore::SaveLocked() const
+    {
+        std::filesystem::path tempPath = m_path;
+        tempPath += ".tmp";
+        {
+            std::ofstream output(tempPath, std::ios::binary | std::ios::trunc);
+            if (!output)
+            {
+                return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED);
+            }
+            output << kHeader << '\n';
+            for (SyncStateRecord const& record : m_records)
+            {
+                output << "state\t" << SanitizeField(record.ServerUrl) << '\t' << SanitizeField(record.UserId) << '\t'
+                    << record.ServerVersion << '\t' << SanitizeField(record.BlobSha256Base64) << '\t'
+                    << record.SyncedGeneration << '\t' << record.UpdatedAtUnixMs << '\n';
+            }
+            output.flush();
+            if (!output)
+            {
+                return E_FAIL;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(tempPath, m_path, error);
+        return error ? E_FAIL : S_OK;
+    }
+
+    SyncStateRecord* SyncStateStore::FindLocked(std::wstring const& serverUrl, std::wstring const& userId)
+    {
+        auto it = std::find_if(m_records.begin(), m_records.end(), [&](SyncStateRecord const& record)
+        {
+            return record.ServerUrl == serverUrl && record.UserId == userId;
+        });
+        return it == m_records.end() ? nullptr : &*it;
+    }
+
+    SyncStateRecord& SyncStateStore::FindOrAddLocked(std::wstring const& serverUrl, std::wstring const& userId)
+    {
+        if (SyncStateRecord* record = FindLocked(serverUrl, userId))
+        {
+            return *record;
+        }
+        SyncStateRecord& record = m_records.emplace_back();
+        record.ServerUrl = serverUrl;
+        record.UserId = userId;
+        return record;
+    }
+}
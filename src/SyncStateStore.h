@@ -0,0 +1,54 @@
+#pragma once
+
+#include "PortableHResult.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tsupasswd
+{
+    // 同期サーバーと user の組ごとに、最後にサーバーが認めた vault の版。
+    struct SyncStateRecord
+    {
+        std::wstring ServerUrl{};
+        std::wstring UserId{};
+        // PutVault の応答・GetVault・409 の server_version で見た版。サーバーに vault がなければ 0。
+        int64_t ServerVersion{ 0 };
+        std::wstring BlobSha256Base64{};
+        // 送り終えた outbox の世代 (SyncOutboxEntry::Generation)。
+        uint64_t SyncedGeneration{ 0 };
+        int64_t UpdatedAtUnixMs{ 0 };
+    };
+
+    // PutVault を ExpectedVersion=0 から始めないよう、再起動をまたいでサーバーの版を残す。
+    // 版は見たままを上書きする (サーバーを作り直すと版が下がるため)。世代は大きい方だけを残す。
+    // 書き込みは SyncOutbox と同じく一時ファイルへ書いてから置き換える。
+    class SyncStateStore final
+    {
+    public:
+        explicit SyncStateStore(std::filesystem::path path);
+
+        SyncStateStore(SyncStateStore const&) = delete;
+        SyncStateStore& operator=(SyncStateStore const&) = delete;
+
+        bool TryGet(std::wstring const& serverUrl, std::wstring const& userId, SyncStateRecord& outRecord);
+        // 版と blob の hash を記録する。同じ値なら書き込まずに S_FALSE。
+        HRESULT RecordServerVersion(std::wstring const& serverUrl, std::wstring const& userId, int64_t serverVersion, std::wstring const& blobSha256Base64);
+        HRESULT RecordSyncedGeneration(std::wstring const& serverUrl, std::wstring const& userId, uint64_t generation);
+        std::vector<SyncStateRecord> Records();
+
+    private:
+        void EnsureLoadedLocked();
+        HRESULT SaveLocked() const;
+        SyncStateRecord* FindLocked(std::wstring const& serverUrl, std::wstring const& userId);
+        SyncStateRecord& FindOrAddLocked(std::wstring const& serverUrl, std::wstring const& userId);
+
+        std::mutex m_mutex;
+        std::filesystem::path m_path;
+        bool m_loaded{ false };
+        std::vector<SyncStateRecord> m_records;
+    };
+}
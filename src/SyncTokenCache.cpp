@@ -0,0 +1,156 @@
+#include "SyncTokenCache.h"
+
+#include "PortableHResult.h"
+
+#ifdef _WIN32
+#include <wincrypt.h>
+#include <dpapi.h>
+#endif
+
+#include <cstring>
+
+namespace tsupasswd
+{
+    namespace
+    {
+#ifdef _WIN32
+        constexpr size_t kProtectBlockBytes = CRYPTPROTECTMEMORY_BLOCK_SIZE;
+#else
+        constexpr size_t kProtectBlockBytes = 16;
+#endif
+
+        void WipeBytes(std::vector<uint8_t>& bytes) noexcept
+        {
+#ifdef _WIN32
+            SecureZeroMemory(bytes.data(), bytes.size());
+#else
+            volatile uint8_t* p = bytes.data();
+            for (size_t i = 0; i < bytes.size(); ++i)
+            {
+                p[i] = 0;
+            }
+#endif
+            bytes.clear();
+        }
+
+        // Windows 以外には同一プロセス用のメモリ保護がないので、そのまま持つ (負荷試験ツールでしか使わない)。
+        bool ProtectInPlace(std::vector<uint8_t>& bytes) noexcept
+        {
+#ifdef _WIN32
+            return CryptProtectMemory(bytes.data(), static_cast<DWORD>(bytes.size()), CRYPTPROTECTMEMORY_SAME_PROCESS) != FALSE;
+#else
+            (void)bytes;
+            return true;
+#endif
+        }
+
+        bool UnprotectInPlace(std::vector<uint8_t>& bytes) noexcept
+        {
+#ifdef _WIN32
+            return CryptUnprotectMemory(bytes.data(), static_cast<DWORD>(bytes.size()), CRYPTPROTECTMEMORY_SAME_PROCESS) != FALSE;
+#else
+            (void)bytes;
+            return true;
+#endif
+        }
+    }
+
+    SyncTokenCache& SyncTokenCache::getInstance()
+    {
+        static SyncTokenCache instance;
+        return instance;
+    }
+
+    std::wstring SyncTokenCache::BuildKey(std::wstring const& baseUrl, std::wstring const& userId)
+    {
+        return baseUrl + L"\n" + userId;
+    }
+
+    bool SyncTokenCache::TryGet(std::wstring const& baseUrl, std::wstring const& userId, SyncCachedToken& outToken, Clock::time_point now)
+    {
+        outToken = {};
+        std::lock_guard lock(m_mutex);
+        auto it = m_entries.find(BuildKey(baseUrl, userId));
+        if (it == m_entries.end())
+        {
+            return false;
+        }
+        if (now >= it->second.ExpiresAt)
+        {
+            WipeBytes(it->second.Protected);
+            m_entries.erase(it);
+            return false;
+        }
+
+        std::vector<uint8_t> plain = it->second.Protected;
+        if (!UnprotectInPlace(plain))
+        {
+            WipeBytes(plain);
+            return false;
+        }
+        Entry const& entry = it->second;
+        outToken.BearerToken.resize(entry.TokenBytes / sizeof(wchar_t));
+        std::memcpy(outToken.BearerToken.data(), plain.data(), entry.TokenBytes);
+        outToken.SessionKey.assign(plain.begin() + entry.TokenBytes, plain.begin() + entry.TokenBytes + entry.SessionKeyBytes);
+        WipeBytes(plain);
+        return true;
+    }
+
+    void SyncTokenCache::Store(std::wstring const& baseUrl, std::wstring const& userId, SyncCachedToken const& token, int64_t expiresInSeconds, Clock::time_point now)
+    {
+        if (token.BearerToken.empty())
+        {
+            return;
+        }
+        std::chrono::seconds lifetime = expiresInSeconds > 0 ? std::chrono::seconds(expiresInSeconds) : kDefaultLifetime;
+        if (lifetime <= kExpirySkew)
+        {
+            Invalidate(baseUrl, userId);
+            return;
+        }
+
+        Entry entry{};
+        entry.TokenBytes = token.BearerToken.size() * sizeof(wchar_t);
+        entry.SessionKeyBytes = token.SessionKey.size();
+        size_t payloadBytes = entry.TokenBytes + entry.SessionKeyBytes;
+        entry.Protected.resize((payloadBytes + kProtectBlockBytes - 1) / kProtectBlockBytes * kProtectBlockBytes);
+        std::memcpy(entry.Protected.data(), token.BearerToken.data(), entry.TokenBytes);
+        if (entry.SessionKeyBytes > 0)
+        {
+            std::memcpy(entry.Protected.data() + entry.TokenBytes, token.SessionKey.data(), entry.SessionKeyBytes);
+        }
+        if (!ProtectInPlace(entry.Protected))
+        {
+            WipeBytes(entry.Protected);
+            Invalidate(baseUrl, userId);
+            return;
+        }
+        entry.ExpiresAt = now + lifetime - kExpirySkew;
+
+        std::lock_guard lock(m_mutex);
+        Entry& slot = m_entries[BuildKey(baseUrl, userId)];
+        WipeBytes(slot.Protected);
+        slot = std::move(entry);
+    }
+
+    void SyncTokenCache::Invalidate(std::wstring const& baseUrl, std::wstring const& userId)
+    {
+        std::lock_guard lock(m_mutex);
+        auto it = m_entries.find(BuildKey(baseUrl, userId));
+        if (it != m_entries.end())
+        {
+            WipeBytes(it->second.Protected);
+            m_entries.erase(it);
+        }
+    }
+
+    void SyncTokenCache::Clear()
+    {
+        std::lock_guard lock(m_mutex);
+        for (auto& [key, entry] : m_entries)
+        {
+            WipeBytes(entry.Protected);
+        }
+        m_entries.clear();
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tsupasswd
+{
+    struct SyncCachedToken
+    {
+        std::wstring BearerToken{};
+        // OPAQUE login で導いた session key。dev login の token では空。
+        std::vector<uint8_t> SessionKey{};
+    };
+
+    // 同期サーバーの bearer token を期限まで使い回すためのプロセス内キャッシュ。
+    // 保存のたびに OPAQUE login (2 往復 + login_start/finish の計算) をしないで済むようにする。
+    // 中身は Windows では CryptProtectMemory (同一プロセス) で暗号化して持ち、取り出すときだけ復号する。
+    class SyncTokenCache final
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        // 期限のこれだけ前から期限切れとみなし、送信中に切れないようにする。
+        static constexpr std::chrono::seconds kExpirySkew{ 60 };
+        // expires_in を返さないサーバーの token の寿命。
+        static constexpr std::chrono::seconds kDefaultLifetime{ 15 * 60 };
+
+        static SyncTokenCache& getInstance();
+
+        // 期限内の token があれば true。
+        bool TryGet(std::wstring const& baseUrl, std::wstring const& userId, SyncCachedToken& outToken, Clock::time_point now = Clock::now());
+        // expiresInSeconds が 0 以下なら kDefaultLifetime。保護に失敗したときや寿命が kExpirySkew 以下のときは保存しない。
+        void Store(std::wstring const& baseUrl, std::wstring const& userId, SyncCachedToken const& token, int64_t expiresInSeconds, Clock::time_point now = Clock::now());
+        // 401/403 を受けた token を捨てる。
+        void Invalidate(std::wstring const& baseUrl, std::wstring const& userId);
+        void Clear();
+
+    private:
+        struct Entry
+        {
+            // token (UTF-16) と session key を続けて並べ、保護の単位まで 0 で埋めたもの。
+            std::vector<uint8_t> Protected{};
+            size_t TokenBytes{ 0 };
+            size_t SessionKeyBytes{ 0 };
+            Clock::time_point ExpiresAt{};
+        };
+
+        static std::wstring BuildKey(std::wstring const& baseUrl, std::wstring const& userId);
+
+        std::mutex m_mutex;
+        std::map<std::wstring, Entry> m_entries;
+    };
+}
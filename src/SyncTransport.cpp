@@ -0,0 +1,140 @@
+#include "SyncTransport.h"
+
+#include <new>
+#include <utility>
+
+namespace tsupasswd
+{
+    namespace
+    {
+        bool EqualsIgnoreAsciiCase(std::string_view left, std::string_view right) noexcept
+        {
+            if (left.size() != right.size())
+            {
+                return false;
+            }
+            for (size_t i = 0; i < left.size(); ++i)
+            {
+                char a = left[i];
+                char b = right[i];
+                if (a >= 'A' && a <= 'Z')
+                {
+                    a = static_cast<char>(a - 'A' + 'a');
+                }
+                if (b >= 'A' && b <= 'Z')
+                {
+                    b = static_cast<char>(b - 'A' + 'a');
+                }
+                if (a != b)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    std::string const* SyncTransportResponse::FindHeader(std::string_view name) const noexcept
+    {
+        for (auto const& header : Headers)
+        {
+            if (EqualsIgnoreAsciiCase(header.Name, name))
+            {
+                return &header.Value;
+            }
+        }
+        return nullptr;
+    }
+
+    void SyncRequestTiming::Add(SyncRequestTiming const& other) noexcept
+    {
+        DnsMs += other.DnsMs;
+        ConnectMs += other.ConnectMs;
+        TlsMs += other.TlsMs;
+        SendMs += other.SendMs;
+        TimeToFirstByteMs += other.TimeToFirstByteMs;
+        TransferMs += other.TransferMs;
+        BytesSent += other.BytesSent;
+        BytesReceived += other.BytesReceived;
+        RoundTrips += other.RoundTrips;
+        NewConnections += other.NewConnections;
+    }
+
+    InMemorySyncTransport::InMemorySyncTransport(Handler handler) :
+        m_handler(std::move(handler))
+    {
+    }
+
+    void InMemorySyncTransport::FailNextSends(uint32_t count, HRESULT hr)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_failRemaining = count;
+        m_failHr = hr;
+    }
+
+    HRESULT InMemorySyncTransport::Send(SyncTransportRequest const& request, SyncTransportResponse& outResponse) noexcept
+    {
+        outResponse = {};
+        m_sendCount.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_failRemaining > 0)
+            {
+                --m_failRemaining;
+                return m_failHr;
+            }
+        }
+
+        if (request.Cancellation.IsCancellationRequested())
+        {
+            return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+        }
+
+        try
+        {
+            m_handler(request, outResponse);
+            // handler の途中で取消や期限切れになった場合は、実際の transport と同じく応答を捨てる。
+            if (request.Cancellation.IsCancellationRequested())
+            {
+                outResponse = {};
+                return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+            }
+            if (std::chrono::steady_clock::now() >= request.Deadline)
+            {
+                outResponse = {};
+                return HRESULT_FROM_WIN32(ERROR_WINHTTP_TIMEOUT);
+            }
+
+            outResponse.Timing.RoundTrips = 1;
+            if (outResponse.Timing.BytesSent == 0 && outResponse.Timing.BytesReceived == 0)
+            {
+                outResponse.Timing.BytesSent = static_cast<int64_t>(request.Body.size());
+                outResponse.Timing.BytesReceived = static_cast<int64_t>(outResponse.Body.size());
+            }
+
+            bool noBody = outResponse.StatusCode == 204 || outResponse.StatusCode == 304;
+            if (request.BodySink && !noBody && request.BodySink->BeginBody(outResponse, static_cast<int64_t>(outResponse.Body.size())))
+            {
+                std::string body = std::move(outResponse.Body);
+                outResponse.Body.clear();
+                for (size_t offset = 0; offset < body.size(); offset += kBodySinkChunkBytes)
+                {
+                    HRESULT hr = request.BodySink->WriteBody(std::string_view(body).substr(offset, kBodySinkChunkBytes));
+                    if (FAILED(hr))
+                    {
+                        return hr;
+                    }
+                }
+            }
+            return S_OK;
+        }
+        catch (std::bad_alloc const&)
+        {
+            return E_OUTOFMEMORY;
+        }
+        catch (...)
+        {
+            return E_FAIL;
+        }
+    }
+}
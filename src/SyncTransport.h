@@ -0,0 +1,146 @@
+#pragma once
+
+#include "PortableHResult.h"
+#include "SyncCancellation.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tsupasswd
+{
+    struct SyncHttpHeader
+    {
+        std::string Name;
+        std::string Value;
+    };
+
+    struct SyncTransportResponse;
+
+    // 応答本文を 1 つの文字列にためずに受け取る。大きな vault を増分デコーダーへ直接流すために使う。
+    // 1 回の Send では BeginBody の後に WriteBody が 0 回以上呼ばれる。本文のない応答 (304 など) では呼ばれない。
+    class ISyncResponseBodySink
+    {
+    public:
+        virtual ~ISyncResponseBodySink() = default;
+
+        // ヘッダーを読んだ後、本文の前に呼ばれる。contentLength は分からなければ -1。
+        // false を返すと、その応答の本文は SyncTransportResponse::Body に入る (エラー応答など)。
+        virtual bool BeginBody(SyncTransportResponse const& response, int64_t contentLength) = 0;
+        // 失敗を返すと受信を打ち切り、Send がその HRESULT を返す。
+        virtual HRESULT WriteBody(std::string_view chunk) noexcept = 0;
+    };
+
+    // SyncClient が組み立てる 1 往復分の要求。文字列はすべて UTF-8。
+    struct SyncTransportRequest
+    {
+        std::string_view Method{};
+        std::string Host{};
+        uint16_t Port{ 443 };
+        bool Secure{ true };
+        // BasePath を含む。
+        std::string Path{};
+        std::vector<SyncHttpHeader> Headers{};
+        // Send の間だけ参照する。
+        std::string_view Body{};
+        // 名前解決・TCP 接続・TLS handshake の上限。
+        int32_t ConnectTimeoutMs{ 15000 };
+        // 要求を送り終えてから応答の最初のバイトまでの上限 (サーバーの処理時間を含む)。
+        int32_t FirstByteTimeoutMs{ 15000 };
+        // 送信中と、応答を読み始めた後の 1 回の待ちの上限。
+        int32_t TransferTimeoutMs{ 15000 };
+        // 取消されたら送受信を打ち切り ERROR_CANCELLED を返す。
+        SyncCancellationToken Cancellation{};
+        // 要求全体の期限。過ぎたら ERROR_WINHTTP_TIMEOUT を返す。
+        std::chrono::steady_clock::time_point Deadline{ std::chrono::steady_clock::time_point::max() };
+        // 指定すると本文をここへ流す (BeginBody が true を返した応答のみ)。Send の間だけ参照する。
+        ISyncResponseBodySink* BodySink{ nullptr };
+    };
+
+    // 1 往復の段階ごとの時間 (ms) と送受信量。その往復で行わなかった段階 (再利用した接続の名前解決・接続・TLS など) は 0。
+    // 遅い同期がサーバーの処理 (TimeToFirstByteMs) によるものか、回線 (接続・送受信) によるものかを切り分けるために使う。
+    struct SyncRequestTiming
+    {
+        int32_t DnsMs{ 0 };
+        // TCP 接続 (TLS handshake は含まない)。
+        int32_t ConnectMs{ 0 };
+        int32_t TlsMs{ 0 };
+        // 要求ヘッダーと本文を書き終えるまで。
+        int32_t SendMs{ 0 };
+        // 送り終えてから応答の最初のバイトまで (サーバーの処理時間 + 1 往復)。
+        int32_t TimeToFirstByteMs{ 0 };
+        // 応答ヘッダーの後、本文を読み終えるまで。
+        int32_t TransferMs{ 0 };
+        // HTTP の層で送受信したバイト数 (ヘッダーを含み、TLS の分は含まない)。
+        int64_t BytesSent{ 0 };
+        int64_t BytesReceived{ 0 };
+        // 足し合わせた往復の数と、そのうち新しい接続を開いた数。
+        int32_t RoundTrips{ 0 };
+        int32_t NewConnections{ 0 };
+
+        // 複数の往復 (OpaqueLogin の start/finish など) を 1 つにまとめる。
+        void Add(SyncRequestTiming const& other) noexcept;
+    };
+
+    struct SyncTransportResponse
+    {
+        int32_t StatusCode{ 0 };
+        std::vector<SyncHttpHeader> Headers{};
+        // BodySink が受け取った応答では空。
+        std::string Body{};
+        // Send を始めてから応答の最初のバイトを受け取るまで (新しい接続ならその時間を含む)。測れなければ -1。
+        int32_t FirstByteMs{ -1 };
+        // 失敗した Send でも、そこまでに測れた段階は入る。RoundTrips は 1。
+        SyncRequestTiming Timing{};
+
+        // 名前は大文字小文字を区別しない。なければ nullptr。
+        std::string const* FindHeader(std::string_view name) const noexcept;
+    };
+
+    // HTTP の 1 往復を行う。4xx/5xx も応答として S_OK で返し、接続や送受信の失敗だけを HRESULT で返す
+    // (WinHTTP と同じく ERROR_WINHTTP_* を HRESULT_FROM_WIN32 したもの)。
+    // 複数スレッドから同時に呼ばれる。
+    class ISyncTransport
+    {
+    public:
+        virtual ~ISyncTransport() = default;
+
+        virtual HRESULT Send(SyncTransportRequest const& request, SyncTransportResponse& outResponse) noexcept = 0;
+    };
+
+    // Windows では WinHTTP (プロセス共有の接続プール)、それ以外では POSIX ソケットの実装を返す。
+    std::shared_ptr<ISyncTransport> CreateDefaultSyncTransport();
+
+    // ネットワークを使わず handler で応答を作る。SyncClient の要求組み立てと応答処理を単体で試すために使う。
+    // handler は複数スレッドから同時に呼ばれる。handler が FirstByteMs を入れると、その往復時間を観測したことになる。
+    // Timing の送受信量は handler が入れなければ要求と応答の本文の大きさにする。
+    class InMemorySyncTransport final : public ISyncTransport
+    {
+    public:
+        using Handler = std::function<void(SyncTransportRequest const& request, SyncTransportResponse& response)>;
+
+        explicit InMemorySyncTransport(Handler handler);
+
+        HRESULT Send(SyncTransportRequest const& request, SyncTransportResponse& outResponse) noexcept override;
+
+        // BodySink には handler の応答本文を kBodySinkChunkBytes ずつ渡す。
+        static constexpr size_t kBodySinkChunkBytes = 4096;
+
+        // 次の count 回の Send を handler を呼ばずに hr で失敗させる (接続断の再現)。
+        void FailNextSends(uint32_t count, HRESULT hr);
+        uint64_t SendCount() const noexcept { return m_sendCount.load(std::memory_order_relaxed); }
+
+    private:
+        Handler m_handler;
+        std::mutex m_mutex;
+        uint32_t m_failRemaining{ 0 };
+        HRESULT m_failHr{ S_OK };
+        std::atomic<uint64_t> m_sendCount{ 0 };
+    };
+}
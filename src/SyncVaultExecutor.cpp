@@ -0,0 +1,126 @@
+#include "SyncVaultExecutor.h"
+
+#include <algorithm>
+#include <new>
+#include <utility>
+
+namespace tsupasswd
+{
+    SyncVaultExecutor& SyncVaultExecutor::getInstance()
+    {
+        static SyncVaultExecutor instance;
+        return instance;
+    }
+
+    SyncVaultExecutor::SyncVaultExecutor(uint32_t maxParallel) :
+        m_maxParallel((std::max)(maxParallel, 1u))
+    {
+    }
+
+    SyncVaultExecutor::~SyncVaultExecutor()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (std::thread& worker : m_workers)
+        {
+            if (worker.joinable())
+            {
+                worker.join();
+            }
+        }
+    }
+
+    std::wstring SyncVaultExecutor::BuildVaultKey(std::wstring const& serverUrl, std::wstring const& userId, std::wstring const& vaultId)
+    {
+        return serverUrl + L"\n" + userId + L"\n" + vaultId;
+    }
+
+    std::shared_future<HRESULT> SyncVaultExecutor::Submit(std::wstring vaultKey, Job job, SyncCancellationToken cancellation)
+    {
+        std::lock_guard lock(m_mutex);
+        Entry& entry = m_queue.emplace_back();
+        entry.VaultKey = std::move(vaultKey);
+        entry.Work = std::move(job);
+        entry.Cancellation = std::move(cancellation);
+        std::shared_future<HRESULT> future = entry.Promise.get_future().share();
+        // 空いているワーカーがいなければ上限まで足す。
+        if (m_idleWorkers == 0 && m_workers.size() < m_maxParallel)
+        {
+            m_workers.emplace_back([this]() { WorkerLoop(); });
+        }
+        m_wake.notify_all();
+        return future;
+    }
+
+    bool SyncVaultExecutor::WaitIdle(Clock::duration timeout)
+    {
+        std::unique_lock lock(m_mutex);
+        return m_idle.wait_for(lock, timeout, [this]() { return m_queue.empty() && m_running == 0; });
+    }
+
+    void SyncVaultExecutor::WorkerLoop()
+    {
+        std::unique_lock lock(m_mutex);
+        for (;;)
+        {
+            // 先に積まれた順に、同じ vault の仕事が走っていないものを取る。
+            auto next = std::find_if(m_queue.begin(), m_queue.end(), [this](Entry const& entry)
+            {
+                return m_busyVaults.find(entry.VaultKey) == m_busyVaults.end();
+            });
+            if (next == m_queue.end())
+            {
+                if (m_stopping && m_queue.empty())
+                {
+                    return;
+                }
+                ++m_idleWorkers;
+                m_wake.wait(lock);
+                --m_idleWorkers;
+                continue;
+            }
+
+            Entry entry = std::move(*next);
+            m_queue.erase(next);
+            m_busyVaults.insert(entry.VaultKey);
+            ++m_running;
+            uint32_t peak = m_peakRunning.load(std::memory_order_relaxed);
+            if (m_running > peak)
+            {
+                m_peakRunning.store(m_running, std::memory_order_relaxed);
+            }
+            lock.unlock();
+
+            HRESULT hr = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+            if (!entry.Cancellation.IsCancellationRequested())
+            {
+                try
+                {
+                    hr = entry.Work(entry.Cancellation);
+                }
+                catch (std::bad_alloc const&)
+                {
+                    hr = E_OUTOFMEMORY;
+                }
+                catch (...)
+                {
+                    hr = E_FAIL;
+                }
+            }
+            entry.Promise.set_value(hr);
+
+            lock.lock();
+            m_busyVaults.erase(entry.VaultKey);
+            --m_running;
+            // 同じ vault の次の仕事を待っていたワーカーを起こす。
+            m_wake.notify_all();
+            if (m_queue.empty() && m_running == 0)
+            {
+                m_idle.notify_all();
+            }
+        }
+    }
+}
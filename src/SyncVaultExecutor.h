@@ -0,0 +1,80 @@
+#pragma once
+
+#include "PortableHResult.h"
+#include "SyncCancellation.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tsupasswd
+{
+    // 複数の vault (個人用・共有、別の同期 user) の同期を決まった本数のワーカースレッドで並べて行う。
+    // 同じ vault の仕事は積んだ順に 1 つずつ、違う vault の仕事は MaxParallel まで同時に走るので、
+    // N 個の vault の同期は合計ではなく最も遅い 1 つ程度の時間で終わる。
+    // 仕事は SyncClient の同期 API を呼ぶ (ブロッキング) ので、SyncReactor の I/O スレッドではなく専用のワーカーで走らせる。
+    // 接続は CreateDefaultSyncTransport() の共有 transport を、token は SyncTokenCache::getInstance() を全ての仕事で使い回す。
+    class SyncVaultExecutor final
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using Job = std::function<HRESULT(SyncCancellationToken const& cancellation)>;
+
+        static constexpr uint32_t kDefaultMaxParallel = 4;
+
+        static SyncVaultExecutor& getInstance();
+
+        explicit SyncVaultExecutor(uint32_t maxParallel = kDefaultMaxParallel);
+        // 積んだ仕事を全て終えてから止める。
+        ~SyncVaultExecutor();
+
+        SyncVaultExecutor(SyncVaultExecutor const&) = delete;
+        SyncVaultExecutor& operator=(SyncVaultExecutor const&) = delete;
+
+        // 同期サーバー・user・vault の組を 1 つの vault として扱う key。
+        static std::wstring BuildVaultKey(std::wstring const& serverUrl, std::wstring const& userId, std::wstring const& vaultId = {});
+
+        // job を積む。戻り値は job の結果で、待たなくてよい。走る前に取消されていれば job を呼ばずに ERROR_CANCELLED。
+        // job の例外は E_OUTOFMEMORY / E_FAIL にする。ワーカーは必要になった分だけ MaxParallel まで作る。
+        std::shared_future<HRESULT> Submit(std::wstring vaultKey, Job job, SyncCancellationToken cancellation = {});
+        // 積んだ仕事と走っている仕事が終わるまで待つ。timeout までに終わらなければ false。
+        bool WaitIdle(Clock::duration timeout);
+
+        uint32_t MaxParallel() const noexcept { return m_maxParallel; }
+        // 同時に走った仕事の最大数 (負荷試験用)。
+        uint32_t PeakRunning() const noexcept { return m_peakRunning.load(std::memory_order_relaxed); }
+
+    private:
+        struct Entry
+        {
+            std::wstring VaultKey;
+            Job Work;
+            SyncCancellationToken Cancellation;
+            std::promise<HRESULT> Promise;
+        };
+
+        void WorkerLoop();
+
+        uint32_t m_maxParallel;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_idle;
+        std::deque<Entry> m_queue;
+        // 走っている仕事の vault。同じ vault の仕事はこれが外れるまで待つ。
+        std::set<std::wstring> m_busyVaults;
+        uint32_t m_running{ 0 };
+        uint32_t m_idleWorkers{ 0 };
+        bool m_stopping{ false };
+        std::vector<std::thread> m_workers;
+        std::atomic<uint32_t> m_peakRunning{ 0 };
+    };
+}
@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "VaultCrypto.h"
+#include "NativeHostMetrics.h"
 
 #include <bcrypt.h>
 #include <cstring>
@@ -711,6 +712,7 @@ namespace tsupasswd
         std::vector<uint8_t>& outPlaintext,
         VaultCryptoError& outError)
     {
+        ScopedNativeHostPhaseTimer metricsTimer(NativeHostPhaseMetric::Decrypt);
         outPlaintext.clear();
         outError = {};
 
@@ -0,0 +1,565 @@
+#include "VaultMerge.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cwctype>
+#include <optional>
+#include <utility>
+
+namespace tsupasswd
+{
+    namespace
+    {
+        constexpr size_t kNoIndex = SIZE_MAX;
+
+        // 開番地法 (線形探索) の索引。hash と呼び出し側の配列の位置だけを持ち、key の比較は呼び出し側が行う。
+        // key の文字列を持たないので、配列の要素を置き換えても索引を作り直さなくてよい。
+        class FlatIndex
+        {
+        public:
+            explicit FlatIndex(size_t expected)
+            {
+                Rehash(expected);
+            }
+
+            template <typename Equal>
+            size_t Find(size_t hash, Equal const& equal) const
+            {
+                for (size_t slot = hash & m_mask;; slot = (slot + 1) & m_mask)
+                {
+                    Slot const& entry = m_slots[slot];
+                    if (entry.Index == kNoIndex)
+                    {
+                        return kNoIndex;
+                    }
+                    if (entry.Hash == hash && equal(entry.Index))
+                    {
+                        return entry.Index;
+                    }
+                }
+            }
+
+            // 同じ key がないことは呼び出し側が Find で確かめる。
+            void Insert(size_t hash, size_t index)
+            {
+                if ((m_count + 1) * 2 > m_slots.size())
+                {
+                    Rehash(m_slots.size());
+                }
+                Place(hash, index);
+                ++m_count;
+            }
+
+        private:
+            struct Slot
+            {
+                size_t Hash{ 0 };
+                size_t Index{ kNoIndex };
+            };
+
+            void Rehash(size_t expected)
+            {
+                size_t capacity = 16;
+                while (capacity < expected * 2)
+                {
+                    capacity <<= 1;
+                }
+                std::vector<Slot> old = std::exchange(m_slots, std::vector<Slot>(capacity));
+                m_mask = capacity - 1;
+                for (Slot const& entry : old)
+                {
+                    if (entry.Index != kNoIndex)
+                    {
+                        Place(entry.Hash, entry.Index);
+                    }
+                }
+            }
+
+            void Place(size_t hash, size_t index)
+            {
+                size_t slot = hash & m_mask;
+                while (m_slots[slot].Index != kNoIndex)
+                {
+                    slot = (slot + 1) & m_mask;
+                }
+                m_slots[slot] = Slot{ hash, index };
+            }
+
+            std::vector<Slot> m_slots;
+            size_t m_mask{ 0 };
+            size_t m_count{ 0 };
+        };
+
+        size_t HashKey(std::wstring_view key) noexcept
+        {
+            return std::hash<std::wstring_view>{}(key);
+        }
+
+        bool IsVaultIdentitySpace(wchar_t ch)
+        {
+            return ch == L' ' || ch == L'\t' || ch == L'\r' || ch == L'\n';
+        }
+
+        std::wstring_view TrimVaultIdentityPart(std::wstring_view value)
+        {
+            size_t first = 0;
+            size_t last = value.size();
+            while (first < last && IsVaultIdentitySpace(value[first]))
+            {
+                ++first;
+            }
+            while (last > first && IsVaultIdentitySpace(value[last - 1]))
+            {
+                --last;
+            }
+            return value.substr(first, last - first);
+        }
+
+        void AppendNormalizedVaultIdentityPart(std::wstring_view value, std::wstring& out)
+        {
+            value = TrimVaultIdentityPart(value);
+            size_t offset = out.size();
+            out.append(value);
+            std::transform(out.begin() + offset, out.end(), out.begin() + offset, [](wchar_t ch)
+            {
+                return static_cast<wchar_t>(towlower(ch));
+            });
+        }
+
+        // scheme・userinfo・port・path を除いた host の範囲 (小文字にする前)。
+        std::wstring_view FindVaultRpId(std::wstring_view url)
+        {
+            std::wstring_view candidate = TrimVaultIdentityPart(url);
+            auto scheme = candidate.find(L"://");
+            if (scheme != std::wstring_view::npos)
+            {
+                candidate = candidate.substr(scheme + 3);
+            }
+            auto slash = candidate.find_first_of(L"/\t\r\n");
+            if (slash != std::wstring_view::npos)
+            {
+                candidate = candidate.substr(0, slash);
+            }
+            auto at = candidate.rfind(L'@');
+            if (at != std::wstring_view::npos)
+            {
+                candidate = candidate.substr(at + 1);
+            }
+            auto colon = candidate.rfind(L':');
+            if (colon != std::wstring_view::npos)
+            {
+                candidate = candidate.substr(0, colon);
+            }
+            return candidate;
+        }
+
+        std::wstring const& MaxUpdatedAt(std::wstring const& left, std::wstring const& right)
+        {
+            return left >= right ? left : right;
+        }
+
+        // item の版。UpdatedAt と削除状態が同じなら中身も同じとみなす (編集と削除は必ず UpdatedAt を進める)。
+        bool SameVaultItemVersion(VaultItemV1 const& left, VaultItemV1 const& right)
+        {
+            return left.Deleted == right.Deleted && left.UpdatedAt == right.UpdatedAt;
+        }
+
+        // identity の元になる値が同じか。同じなら identity を作らなくても重複の有無は変わらない。
+        bool SameVaultIdentitySource(VaultItemV1 const& left, VaultItemV1 const& right)
+        {
+            return left.ItemType == right.ItemType && left.Login.Url == right.Login.Url && left.Login.Username == right.Login.Username;
+        }
+
+        // ItemId から items の位置を引く。三方向マージの文書はたいてい同じ順なので先に同じ位置 (hint) を見て、
+        // 外れたときに初めて索引を作る。同じ ItemId が 2 つあれば索引は最初の方を返す。
+        class VaultItemIdLookup
+        {
+        public:
+            explicit VaultItemIdLookup(std::vector<VaultItemV1> const& items) :
+                m_items(items)
+            {
+            }
+
+            size_t Find(std::wstring const& itemId, size_t hint)
+            {
+                if (hint < m_items.size() && m_items[hint].ItemId == itemId)
+                {
+                    return hint;
+                }
+                if (!m_index)
+                {
+                    m_index.emplace(m_items.size());
+                    for (size_t index = 0; index < m_items.size(); ++index)
+                    {
+                        Add(index);
+                    }
+                }
+                return m_index->Find(HashKey(itemId), [&](size_t found) { return m_items[found].ItemId == itemId; });
+            }
+
+            // items の末尾に足した item を索引に載せる (索引がまだなければ作るときに載る)。
+            void Appended(size_t index)
+            {
+                if (m_index)
+                {
+                    Add(index);
+                }
+            }
+
+        private:
+            void Add(size_t index)
+            {
+                std::wstring const& itemId = m_items[index].ItemId;
+                if (itemId.empty())
+                {
+                    return;
+                }
+                size_t hash = HashKey(itemId);
+                if (m_index->Find(hash, [&](size_t found) { return m_items[found].ItemId == itemId; }) == kNoIndex)
+                {
+                    m_index->Insert(hash, index);
+                }
+            }
+
+            std::vector<VaultItemV1> const& m_items;
+            std::optional<FlatIndex> m_index;
+        };
+
+        // rp id と username が同じ login を、UpdatedAt が新しい方にまとめる。
+        // identity は item ごとに 1 回だけ作り、hash と一緒に残す。
+        void CollapseDuplicateVaultLogins(std::vector<VaultItemV1>& items, VaultMergeOptions const& options, VaultMergeStats& stats)
+        {
+            auto trace = [&](wchar_t const* stage, VaultItemV1 const& item)
+            {
+                if (options.Trace)
+                {
+                    options.Trace(stage, item);
+                }
+            };
+
+            struct IdentityKey
+            {
+                std::wstring Text;
+                size_t Hash{ 0 };
+            };
+            std::vector<IdentityKey> canonicalKeys;
+            canonicalKeys.reserve(items.size());
+            FlatIndex indexByIdentity(items.size());
+            std::vector<VaultItemV1> dedupedItems;
+            dedupedItems.reserve(items.size());
+            std::vector<size_t> keyIndexByDeduped;
+            keyIndexByDeduped.reserve(items.size());
+            for (auto& item : items)
+            {
+                std::wstring identity = BuildVaultLoginIdentity(item, options.ExtractRpId);
+                if (identity.empty())
+                {
+                    dedupedItems.push_back(std::move(item));
+                    continue;
+                }
+
+                size_t hash = HashKey(identity);
+                size_t found = indexByIdentity.Find(hash, [&](size_t index) { return canonicalKeys[index].Text == identity; });
+                if (found == kNoIndex)
+                {
+                    indexByIdentity.Insert(hash, canonicalKeys.size());
+                    canonicalKeys.push_back(IdentityKey{ std::move(identity), hash });
+                    keyIndexByDeduped.push_back(dedupedItems.size());
+                    dedupedItems.push_back(std::move(item));
+                    continue;
+                }
+
+                auto& canonicalItem = dedupedItems[keyIndexByDeduped[found]];
+                trace(L"dedupe_canonical_before", canonicalItem);
+                trace(L"dedupe_incoming", item);
+                if (item.UpdatedAt >= canonicalItem.UpdatedAt)
+                {
+                    // 新しい方をそのまま取る (CreatedAt などを合わせても item と同じ値になる)。
+                    canonicalItem = std::move(item);
+                }
+                else
+                {
+                    if (canonicalItem.CreatedAt.empty())
+                    {
+                        canonicalItem.CreatedAt = item.CreatedAt;
+                    }
+                    if (canonicalItem.Deleted || item.Deleted)
+                    {
+                        canonicalItem.Deleted = true;
+                        canonicalItem.DeletedAt = MaxUpdatedAt(canonicalItem.DeletedAt, item.DeletedAt);
+                    }
+                }
+                trace(L"dedupe_canonical_after", canonicalItem);
+                stats.DuplicatesCollapsed += 1;
+            }
+
+            items = std::move(dedupedItems);
+        }
+    }
+
+    std::wstring NormalizeVaultIdentityPart(std::wstring_view value)
+    {
+        std::wstring normalized;
+        AppendNormalizedVaultIdentityPart(value, normalized);
+        return normalized;
+    }
+
+    std::wstring ExtractVaultRpIdFromUrl(std::wstring const& url)
+    {
+        return NormalizeVaultIdentityPart(FindVaultRpId(url));
+    }
+
+    std::wstring BuildVaultLoginIdentity(VaultItemV1 const& item, VaultRpIdExtractor extractRpId)
+    {
+        if (item.ItemType != VaultItemType::Login)
+        {
+            return {};
+        }
+
+        // 既定の解釈では host を元の文字列の上で探し、小文字にしながら 1 つの文字列に書き足す。
+        std::wstring identity;
+        identity.reserve(item.Login.Url.size() + item.Login.Username.size() + 1);
+        if (extractRpId)
+        {
+            identity = extractRpId(item.Login.Url);
+        }
+        else
+        {
+            AppendNormalizedVaultIdentityPart(FindVaultRpId(item.Login.Url), identity);
+        }
+        if (identity.empty())
+        {
+            AppendNormalizedVaultIdentityPart(item.Login.Url, identity);
+        }
+        identity.push_back(L'\n');
+        AppendNormalizedVaultIdentityPart(item.Login.Username, identity);
+        return identity;
+    }
+
+    VaultMergeResult MergeVaultDocuments(
+        VaultDocumentV1 localDoc,
+        std::vector<VaultItemV1> serverItems,
+        std::wstring const& fallbackVaultId,
+        VaultMergeOptions const& options)
+    {
+        VaultMergeResult result{};
+        if (localDoc.SchemaVersion <= 0)
+        {
+            localDoc.SchemaVersion = 1;
+        }
+        if (localDoc.VaultId.empty())
+        {
+            localDoc.VaultId = fallbackVaultId;
+        }
+        auto trace = [&](wchar_t const* stage, VaultItemV1 const& item)
+        {
+            if (options.Trace)
+            {
+                options.Trace(stage, item);
+            }
+        };
+
+        std::vector<VaultItemV1>& items = localDoc.Items;
+        items.reserve(items.size() + serverItems.size());
+        FlatIndex indexById(items.size() + serverItems.size());
+        for (size_t index = 0; index < items.size(); ++index)
+        {
+            std::wstring const& itemId = items[index].ItemId;
+            if (itemId.empty())
+            {
+                continue;
+            }
+            size_t hash = HashKey(itemId);
+            // 同じ ItemId が 2 つあれば最初の方に合わせる。
+            if (indexById.Find(hash, [&](size_t found) { return items[found].ItemId == itemId; }) == kNoIndex)
+            {
+                indexById.Insert(hash, index);
+            }
+        }
+
+        for (auto& serverItem : serverItems)
+        {
+            if (serverItem.ItemId.empty())
+            {
+                continue;
+            }
+
+            size_t hash = HashKey(serverItem.ItemId);
+            size_t found = indexById.Find(hash, [&](size_t index) { return items[index].ItemId == serverItem.ItemId; });
+            if (found == kNoIndex)
+            {
+                result.Stats.AddedFromServer += 1;
+                if (serverItem.Deleted)
+                {
+                    result.Stats.TombstonesApplied += 1;
+                }
+                indexById.Insert(hash, items.size());
+                items.push_back(std::move(serverItem));
+                continue;
+            }
+
+            auto& localItem = items[found];
+            trace(L"merge_by_id_local_before", localItem);
+            trace(L"merge_by_id_server_candidate", serverItem);
+            if (serverItem.UpdatedAt > localItem.UpdatedAt)
+            {
+                if (serverItem.Deleted && !localItem.Deleted)
+                {
+                    result.Stats.TombstonesApplied += 1;
+                }
+                localItem = std::move(serverItem);
+                result.Stats.UpdatedFromServer += 1;
+                trace(L"merge_by_id_local_after_replace", localItem);
+            }
+        }
+
+        CollapseDuplicateVaultLogins(items, options, result.Stats);
+        result.DedupeScanned = true;
+        result.Document = std::move(localDoc);
+        return result;
+    }
+
+    VaultMergeResult MergeVaultDocuments(
+        VaultDocumentV1 localDoc,
+        VaultDocumentV1 serverDoc,
+        std::wstring const& fallbackVaultId,
+        VaultMergeOptions const& options)
+    {
+        int64_t serverRevision = serverDoc.Revision;
+        std::wstring const& vaultId = !serverDoc.VaultId.empty() ? serverDoc.VaultId : fallbackVaultId;
+        VaultMergeResult result = MergeVaultDocuments(std::move(localDoc), std::move(serverDoc.Items), vaultId, options);
+        result.Document.Revision = (std::max)(result.Document.Revision, serverRevision);
+        return result;
+    }
+
+    VaultMergeResult MergeVaultDocumentsThreeWay(
+        VaultDocumentV1 const& baseDoc,
+        VaultDocumentV1 localDoc,
+        VaultDocumentV1 serverDoc,
+        std::wstring const& fallbackVaultId,
+        VaultMergeOptions const& options)
+    {
+        VaultMergeResult result{};
+        if (localDoc.SchemaVersion <= 0)
+        {
+            localDoc.SchemaVersion = 1;
+        }
+        if (localDoc.VaultId.empty())
+        {
+            localDoc.VaultId = !serverDoc.VaultId.empty() ? serverDoc.VaultId : fallbackVaultId;
+        }
+        localDoc.Revision = (std::max)(localDoc.Revision, serverDoc.Revision);
+        auto trace = [&](wchar_t const* stage, VaultItemV1 const& item)
+        {
+            if (options.Trace)
+            {
+                options.Trace(stage, item);
+            }
+        };
+        auto isLogin = [](VaultItemV1 const& item)
+        {
+            return item.ItemType == VaultItemType::Login;
+        };
+
+        std::vector<VaultItemV1> const& baseItems = baseDoc.Items;
+        std::vector<VaultItemV1>& items = localDoc.Items;
+        VaultItemIdLookup baseById(baseItems);
+        VaultItemIdLookup localById(items);
+        // 追加された login か url・username が変わった login があるときだけ、新しい重複がありうる。
+        bool identityChanged = false;
+
+        for (size_t index = 0; index < items.size(); ++index)
+        {
+            VaultItemV1 const& item = items[index];
+            size_t baseIndex = kNoIndex;
+            if (!item.ItemId.empty())
+            {
+                baseIndex = baseById.Find(item.ItemId, index);
+            }
+            else if (index < baseItems.size() && baseItems[index].ItemId.empty() && SameVaultIdentitySource(item, baseItems[index]))
+            {
+                // ItemId のない item は同じ位置のものとだけ比べる。
+                baseIndex = index;
+            }
+            if (baseIndex == kNoIndex)
+            {
+                result.LocalChanges += 1;
+                identityChanged = identityChanged || isLogin(item);
+                continue;
+            }
+            VaultItemV1 const& baseItem = baseItems[baseIndex];
+            if (SameVaultItemVersion(item, baseItem))
+            {
+                continue;
+            }
+            result.LocalChanges += 1;
+            identityChanged = identityChanged || !SameVaultIdentitySource(item, baseItem);
+        }
+
+        size_t localCount = items.size();
+        for (size_t index = 0; index < serverDoc.Items.size(); ++index)
+        {
+            VaultItemV1& serverItem = serverDoc.Items[index];
+            if (serverItem.ItemId.empty())
+            {
+                continue;
+            }
+
+            size_t baseIndex = baseById.Find(serverItem.ItemId, index);
+            if (baseIndex != kNoIndex && SameVaultItemVersion(serverItem, baseItems[baseIndex]))
+            {
+                continue;
+            }
+            result.ServerChanges += 1;
+
+            size_t localIndex = localById.Find(serverItem.ItemId, index);
+            if (localIndex == kNoIndex)
+            {
+                result.Stats.AddedFromServer += 1;
+                if (serverItem.Deleted)
+                {
+                    result.Stats.TombstonesApplied += 1;
+                }
+                identityChanged = identityChanged || isLogin(serverItem);
+                items.push_back(std::move(serverItem));
+                localById.Appended(items.size() - 1);
+                continue;
+            }
+
+            auto& localItem = items[localIndex];
+            trace(L"merge_three_way_local_before", localItem);
+            trace(L"merge_three_way_server_candidate", serverItem);
+            bool takeServer = false;
+            if (localIndex < localCount && baseIndex != kNoIndex && SameVaultItemVersion(localItem, baseItems[baseIndex]))
+            {
+                // サーバーだけで変わった。時刻がずれていてもサーバーの編集を取る。
+                takeServer = true;
+            }
+            else
+            {
+                // 両方で変わった (または両方が同じ ItemId を足した) ときだけ二方向の規則で決める。
+                result.Conflicts += 1;
+                takeServer = serverItem.UpdatedAt > localItem.UpdatedAt;
+            }
+            if (takeServer)
+            {
+                if (serverItem.Deleted && !localItem.Deleted)
+                {
+                    result.Stats.TombstonesApplied += 1;
+                }
+                identityChanged = identityChanged || !SameVaultIdentitySource(serverItem, localItem);
+                localItem = std::move(serverItem);
+                result.Stats.UpdatedFromServer += 1;
+                trace(L"merge_three_way_local_after_replace", localItem);
+            }
+        }
+
+        if (identityChanged)
+        {
+            CollapseDuplicateVaultLogins(items, options, result.Stats);
+            result.DedupeScanned = true;
+        }
+        result.Document = std::move(localDoc);
+        return result;
+    }
+}
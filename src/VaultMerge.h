@@ -0,0 +1,71 @@
+#pragma once
+
+#include "VaultModel.h"
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tsupasswd
+{
+    struct VaultMergeResult
+    {
+        VaultDocumentV1 Document{};
+        VaultMergeStats Stats{};
+        // 三方向マージだけが数える。基準からサーバー・手元で変わっていた item と、両方で変わっていた item。
+        size_t ServerChanges{ 0 };
+        size_t LocalChanges{ 0 };
+        size_t Conflicts{ 0 };
+        // 重複した login をまとめる処理を走らせたか (新しい identity が現れたときだけ)。
+        bool DedupeScanned{ false };
+    };
+
+    // URL から rp id (小文字の host) を取る。取れなければ空。
+    using VaultRpIdExtractor = std::wstring (*)(std::wstring const& url);
+
+    struct VaultMergeOptions
+    {
+        // 既定 (nullptr) は ExtractVaultRpIdFromUrl。アプリは WinRT の Uri で解釈するものを渡す。
+        VaultRpIdExtractor ExtractRpId = nullptr;
+        // 設定されていれば item ごとの判断を段階名とともに渡す (詳細ログ用)。
+        std::function<void(wchar_t const* stage, VaultItemV1 const& item)> Trace;
+    };
+
+    // 前後の空白を除いて小文字にする。
+    std::wstring NormalizeVaultIdentityPart(std::wstring_view value);
+    // scheme・userinfo・port・path を除いた host。WinRT の Uri が解釈できない URL と同じ扱い。
+    std::wstring ExtractVaultRpIdFromUrl(std::wstring const& url);
+    // login item の重複判定に使う "<rp id>\n<username>"。login でなければ空。
+    std::wstring BuildVaultLoginIdentity(VaultItemV1 const& item, VaultRpIdExtractor extractRpId = nullptr);
+
+    // serverItems の item を ItemId で localDoc に合わせ (UpdatedAt が新しい方を取る)、その後 rp id と username が
+    // 同じ login をまとめる。serverItems はサーバー側で変わった item だけでよい
+    // (差分同期では GetVaultChanges の item と tombstone をそのまま渡す)。
+    // item の索引は hash 表で、identity は item ごとに 1 回だけ作る。item は写さずに移す。
+    VaultMergeResult MergeVaultDocuments(
+        VaultDocumentV1 localDoc,
+        std::vector<VaultItemV1> serverItems,
+        std::wstring const& fallbackVaultId,
+        VaultMergeOptions const& options = {});
+    // Revision は両者の大きい方。
+    VaultMergeResult MergeVaultDocuments(
+        VaultDocumentV1 localDoc,
+        VaultDocumentV1 serverDoc,
+        std::wstring const& fallbackVaultId,
+        VaultMergeOptions const& options = {});
+
+    // baseDoc (前回サーバーと揃えた文書) を共通の祖先とする三方向マージ。UpdatedAt と削除状態が基準と同じ item は
+    // 変わっていないとみなし、中身を比べずに飛ばす。サーバーだけで変わった item は時刻によらずサーバーの方を取り、
+    // 両方で変わった item だけを二方向と同じ規則 (UpdatedAt が新しい方) で決める。
+    // 3 つの文書が同じ順に並んでいれば ItemId の索引を作らない。重複の検出は、追加された login か
+    // url・username が変わった login があるときだけ行う。
+    // 片方にない item は削除とみなさない (削除は tombstone で伝わる)。
+    // baseDoc が空なら、ItemId が重ならない文書では二方向と同じ結果になる。
+    VaultMergeResult MergeVaultDocumentsThreeWay(
+        VaultDocumentV1 const& baseDoc,
+        VaultDocumentV1 localDoc,
+        VaultDocumentV1 serverDoc,
+        std::wstring const& fallbackVaultId,
+        VaultMergeOptions const& options = {});
+}
@@ -39,4 +39,12 @@ namespace tsupasswd
         int64_t Revision{ 0 };
         std::vector<VaultItemV1> Items;
     };
+
+    struct VaultMergeStats
+    {
+        size_t AddedFromServer = 0;
+        size_t UpdatedFromServer = 0;
+        size_t TombstonesApplied = 0;
+        size_t DuplicatesCollapsed = 0;
+    };
 }
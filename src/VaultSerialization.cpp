@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "VaultSerialization.h"
+#include "NativeHostMetrics.h"
 
 #include <winrt/Windows.Data.Json.h>
 
@@ -197,6 +198,7 @@ namespace tsupasswd
         VaultDocumentV1& outDoc,
         std::wstring& outError)
     {
+        ScopedNativeHostPhaseTimer metricsTimer(NativeHostPhaseMetric::VaultJsonParse);
         outDoc = {};
         outError.clear();
 
@@ -0,0 +1,420 @@
+#include "pch.h"
+#include "WinHttpSyncTransport.h"
+#include "SyncHttpConnectionPool.h"
+
+#include <winhttp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+#pragma comment(lib, "Winhttp.lib")
+
+namespace tsupasswd
+{
+    namespace
+    {
+        // 取消 callback から別スレッドで閉じられる要求ハンドル。
+        // WinHTTP は同期呼び出し中のハンドルを WinHttpCloseHandle すると、その呼び出しを失敗させて戻す。
+        class CancelableRequestHandle
+        {
+        public:
+            explicit CancelableRequestHandle(HINTERNET handle) noexcept :
+                m_handle(handle)
+            {
+            }
+
+            ~CancelableRequestHandle() noexcept
+            {
+                Close();
+            }
+
+            CancelableRequestHandle(CancelableRequestHandle const&) = delete;
+            CancelableRequestHandle& operator=(CancelableRequestHandle const&) = delete;
+
+            // 閉じた後は nullptr。
+            HINTERNET get() const noexcept
+            {
+                std::lock_guard lock(m_mutex);
+                return m_handle;
+            }
+
+            void Close() noexcept
+            {
+                std::lock_guard lock(m_mutex);
+                if (m_handle)
+                {
+                    WinHttpCloseHandle(m_handle);
+                    m_handle = nullptr;
+                }
+            }
+
+        private:
+            mutable std::mutex m_mutex;
+            HINTERNET m_handle{ nullptr };
+        };
+
+        // timeoutMs と要求全体の期限の短い方。期限を過ぎていれば 0。
+        int32_t ClampToDeadline(SyncTransportRequest const& request, int32_t timeoutMs) noexcept
+        {
+            if (request.Deadline == std::chrono::steady_clock::time_point::max())
+            {
+                return timeoutMs;
+            }
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(request.Deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0)
+            {
+                return 0;
+            }
+            return static_cast<int32_t>(std::min<int64_t>(remaining, timeoutMs));
+        }
+
+        std::wstring Utf8ToWide(std::string_view utf8)
+        {
+            if (utf8.empty())
+            {
+                return L"";
+            }
+            int cch = MultiByteToWideChar(CP_UTF8, 0, utf8.data(), static_cast<int>(utf8.size()), nullptr, 0);
+            if (cch <= 0)
+            {
+                return L"";
+            }
+
+            std::wstring wide;
+            wide.resize(static_cast<size_t>(cch));
+            MultiByteToWideChar(CP_UTF8, 0, utf8.data(), static_cast<int>(utf8.size()), wide.data(), cch);
+            return wide;
+        }
+
+        std::string WideToUtf8(std::wstring_view wide)
+        {
+            if (wide.empty())
+            {
+                return {};
+            }
+
+            int cb = WideCharToMultiByte(CP_UTF8, 0, wide.data(), static_cast<int>(wide.size()), nullptr, 0, nullptr, nullptr);
+            if (cb <= 0)
+            {
+                return {};
+            }
+
+            std::string utf8;
+            utf8.resize(static_cast<size_t>(cb));
+            WideCharToMultiByte(CP_UTF8, 0, wide.data(), static_cast<int>(wide.size()), utf8.data(), cb, nullptr, nullptr);
+            return utf8;
+        }
+
+        // Content-Length がなければ -1。
+        int64_t QueryContentLength(HINTERNET hRequest)
+        {
+            ULONGLONG contentLength = 0;
+            DWORD size = sizeof(contentLength);
+            if (!WinHttpQueryHeaders(
+                    hRequest,
+                    WINHTTP_QUERY_CONTENT_LENGTH | WINHTTP_QUERY_FLAG_NUMBER64,
+                    WINHTTP_HEADER_NAME_BY_INDEX,
+                    &contentLength,
+                    &size,
+                    WINHTTP_NO_HEADER_INDEX) ||
+                contentLength > static_cast<ULONGLONG>(INT64_MAX))
+            {
+                return -1;
+            }
+            return static_cast<int64_t>(contentLength);
+        }
+
+        int32_t ElapsedMs(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) noexcept
+        {
+            return static_cast<int32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+        }
+
+#ifdef WINHTTP_OPTION_REQUEST_TIMES
+        // WINHTTP_REQUEST_TIMES の 2 点の差 (100ns 単位)。どちらかが記録されていなければ 0。
+        int32_t RequestTimeSpanMs(WINHTTP_REQUEST_TIMES const& times, WINHTTP_REQUEST_TIME_ENTRY start, WINHTTP_REQUEST_TIME_ENTRY end) noexcept
+        {
+            if (static_cast<ULONG>(end) >= times.cTimes)
+            {
+                return 0;
+            }
+            ULONGLONG startTicks = times.rgullTimes[start];
+            ULONGLONG endTicks = times.rgullTimes[end];
+            if (startTicks == 0 || endTicks < startTicks)
+            {
+                return 0;
+            }
+            return static_cast<int32_t>((endTicks - startTicks) / 10000);
+        }
+#endif
+
+        // WinHttpSendRequest は新しい接続なら名前解決・接続・TLS を含むので、WinHTTP が記録した時間
+        // (Windows 10 2004 以降) があれば段階に分け、SendMs からその分を引く。記録がなければ SendMs に含めたままにする。
+        void SplitConnectionTiming(HINTERNET hRequest, SyncRequestTiming& timing) noexcept
+        {
+#ifdef WINHTTP_OPTION_REQUEST_TIMES
+            WINHTTP_REQUEST_TIMES times{};
+            DWORD size = sizeof(times);
+            if (!WinHttpQueryOption(hRequest, WINHTTP_OPTION_REQUEST_TIMES, &times, &size))
+            {
+                return;
+            }
+            timing.DnsMs = RequestTimeSpanMs(times, WinHttpNameResolutionStart, WinHttpNameResolutionEnd);
+            timing.TlsMs = std::max(
+                RequestTimeSpanMs(times, WinHttpTlsHandshakeClientLeg1Start, WinHttpTlsHandshakeClientLeg3End),
+                RequestTimeSpanMs(times, WinHttpTlsHandshakeClientLeg1Start, WinHttpTlsHandshakeClientLeg2End));
+            int32_t establishMs = RequestTimeSpanMs(times, WinHttpConnectionEstablishmentStart, WinHttpConnectionEstablishmentEnd);
+            if (establishMs > 0 || timing.TlsMs > 0)
+            {
+                timing.NewConnections = 1;
+            }
+            timing.ConnectMs = timing.TlsMs > 0 ?
+                RequestTimeSpanMs(times, WinHttpConnectionEstablishmentStart, WinHttpTlsHandshakeClientLeg1Start) :
+                establishMs;
+            timing.SendMs = std::max(timing.SendMs - timing.DnsMs - timing.ConnectMs - timing.TlsMs, 0);
+#else
+            (void)hRequest;
+            (void)timing;
+#endif
+        }
+
+        // Content-Length があれば 1 回だけ確保して直接読み込み、なければ倍々に伸ばす。
+        // sink があれば固定の作業領域を経由してそちらへ流す。読んだバイト数を返す。
+        uint64_t ReadResponseBody(HINTERNET hRequest, int64_t contentLength, ISyncResponseBodySink* sink, std::string& body)
+        {
+            constexpr size_t kInitialBodyBytes = 64 * 1024;
+            constexpr DWORD kMaxReadBytes = 1024 * 1024;
+
+            if (sink)
+            {
+                std::string scratch(kInitialBodyBytes, '\0');
+                uint64_t total = 0;
+                for (;;)
+                {
+                    DWORD read = 0;
+                    THROW_IF_WIN32_BOOL_FALSE(WinHttpReadData(hRequest, scratch.data(), static_cast<DWORD>(scratch.size()), &read));
+                    if (read == 0)
+                    {
+                        return total;
+                    }
+                    total += read;
+                    THROW_IF_FAILED(sink->WriteBody(std::string_view(scratch.data(), read)));
+                }
+            }
+
+            size_t used = 0;
+            body.resize(contentLength >= 0 ? static_cast<size_t>(contentLength) : kInitialBodyBytes);
+            for (;;)
+            {
+                if (used == body.size())
+                {
+                    if (contentLength >= 0)
+                    {
+                        break;
+                    }
+                    body.resize(body.size() * 2);
+                }
+                DWORD read = 0;
+                DWORD want = static_cast<DWORD>((std::min)(body.size() - used, static_cast<size_t>(kMaxReadBytes)));
+                THROW_IF_WIN32_BOOL_FALSE(WinHttpReadData(hRequest, body.data() + used, want, &read));
+                if (read == 0)
+                {
+                    break;
+                }
+                used += read;
+            }
+            body.resize(used);
+            return used;
+        }
+
+        int32_t QueryStatusCode(HINTERNET hRequest)
+        {
+            DWORD statusCode = 0;
+            DWORD size = sizeof(statusCode);
+            THROW_IF_WIN32_BOOL_FALSE(WinHttpQueryHeaders(
+                hRequest,
+                WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+                WINHTTP_HEADER_NAME_BY_INDEX,
+                &statusCode,
+                &size,
+                WINHTTP_NO_HEADER_INDEX));
+            return static_cast<int32_t>(statusCode);
+        }
+
+        // ステータス行を除いた "Name: value" の行を headers に入れる。ステータス行を含むヘッダーのバイト数 (UTF-8) を返す。
+        uint64_t QueryResponseHeaders(HINTERNET hRequest, std::vector<SyncHttpHeader>& headers)
+        {
+            DWORD size = 0;
+            if (!WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_RAW_HEADERS_CRLF, WINHTTP_HEADER_NAME_BY_INDEX, WINHTTP_NO_OUTPUT_BUFFER, &size, WINHTTP_NO_HEADER_INDEX))
+            {
+                if (GetLastError() != ERROR_INSUFFICIENT_BUFFER || size == 0)
+                {
+                    return 0;
+                }
+            }
+
+            std::wstring raw;
+            raw.resize(size / sizeof(wchar_t));
+            THROW_IF_WIN32_BOOL_FALSE(WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_RAW_HEADERS_CRLF, WINHTTP_HEADER_NAME_BY_INDEX, raw.data(), &size, WINHTTP_NO_HEADER_INDEX));
+            raw.resize(size / sizeof(wchar_t));
+
+            std::string utf8 = WideToUtf8(raw);
+            std::string_view rest = utf8;
+            bool statusLine = true;
+            while (!rest.empty())
+            {
+                size_t lineEnd = rest.find("\r\n");
+                std::string_view line = rest.substr(0, lineEnd);
+                rest = lineEnd == std::string_view::npos ? std::string_view{} : rest.substr(lineEnd + 2);
+                if (statusLine)
+                {
+                    statusLine = false;
+                    continue;
+                }
+
+                size_t colon = line.find(':');
+                if (colon == std::string_view::npos || colon == 0)
+                {
+                    continue;
+                }
+                std::string_view value = line.substr(colon + 1);
+                while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+                {
+                    value.remove_prefix(1);
+                }
+                headers.push_back(SyncHttpHeader{ std::string(line.substr(0, colon)), std::string(value) });
+            }
+            return utf8.size();
+        }
+    }
+
+    std::shared_ptr<ISyncTransport> CreateDefaultSyncTransport()
+    {
+        static std::shared_ptr<ISyncTransport> shared = std::make_shared<WinHttpSyncTransport>(SyncHttpConnectionPool::Shared());
+        return shared;
+    }
+
+    WinHttpSyncTransport::WinHttpSyncTransport(std::shared_ptr<SyncHttpConnectionPool> connectionPool) :
+        m_connectionPool(std::move(connectionPool))
+    {
+    }
+
+    // keep-alive で再利用した接続がサーバー側で閉じられていた場合は、WinHTTP が新しい接続を張るので 1 回だけ送り直す。
+    // 取消時は要求ハンドルを閉じて、ブロック中の WinHTTP 呼び出しを戻す。
+    HRESULT WinHttpSyncTransport::Send(SyncTransportRequest const& request, SyncTransportResponse& outResponse) noexcept try
+    {
+        outResponse = {};
+
+        std::shared_ptr<SyncHttpConnection> connection;
+        RETURN_IF_FAILED(m_connectionPool->AcquireConnection(Utf8ToWide(request.Host), request.Port, request.Secure, connection));
+
+        std::wstring verb = Utf8ToWide(request.Method);
+        std::wstring path = Utf8ToWide(request.Path);
+        std::wstring headers;
+        for (auto const& header : request.Headers)
+        {
+            headers += Utf8ToWide(header.Name);
+            headers += L": ";
+            headers += Utf8ToWide(header.Value);
+            headers += L"\r\n";
+        }
+        // WinHTTP が足すヘッダー (Host など) は含まない。
+        int64_t requestBytes = static_cast<int64_t>(request.Method.size() + request.Path.size() + request.Body.size());
+        for (auto const& header : request.Headers)
+        {
+            requestBytes += static_cast<int64_t>(header.Name.size() + header.Value.size() + 4);
+        }
+
+        DWORD openFlags = request.Secure ? WINHTTP_FLAG_SECURE : 0;
+        for (int attempt = 0;; ++attempt)
+        {
+            if (request.Cancellation.IsCancellationRequested())
+            {
+                return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+            }
+            int32_t connectTimeoutMs = ClampToDeadline(request, request.ConnectTimeoutMs);
+            int32_t firstByteTimeoutMs = ClampToDeadline(request, request.FirstByteTimeoutMs);
+            int32_t transferTimeoutMs = ClampToDeadline(request, request.TransferTimeoutMs);
+            if (connectTimeoutMs <= 0 || firstByteTimeoutMs <= 0 || transferTimeoutMs <= 0)
+            {
+                return HRESULT_FROM_WIN32(ERROR_WINHTTP_TIMEOUT);
+            }
+
+            CancelableRequestHandle requestHandle(WinHttpOpenRequest(connection->get(), verb.c_str(), path.c_str(), nullptr, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, openFlags));
+            RETURN_LAST_ERROR_IF_NULL(requestHandle.get());
+            SyncCancellationRegistration cancelRegistration(request.Cancellation, [&requestHandle]() { requestHandle.Close(); });
+
+            // セッションは共有なので、timeout は要求ごとに設定する。
+            // receive は WinHttpReceiveResponse (最初のバイト) までの値にし、本文を読む前に transfer の値へ変える。
+            RETURN_IF_WIN32_BOOL_FALSE(WinHttpSetTimeouts(requestHandle.get(), connectTimeoutMs, connectTimeoutMs, transferTimeoutMs, firstByteTimeoutMs));
+
+            if (!headers.empty())
+            {
+                RETURN_IF_WIN32_BOOL_FALSE(WinHttpAddRequestHeaders(requestHandle.get(), headers.c_str(), static_cast<DWORD>(headers.size()), WINHTTP_ADDREQ_FLAG_ADD));
+            }
+
+            outResponse.Timing = {};
+            outResponse.Timing.RoundTrips = 1;
+            auto attemptStart = std::chrono::steady_clock::now();
+            BOOL completed = WinHttpSendRequest(
+                requestHandle.get(),
+                WINHTTP_NO_ADDITIONAL_HEADERS,
+                0,
+                request.Body.empty() ? WINHTTP_NO_REQUEST_DATA : const_cast<char*>(request.Body.data()),
+                static_cast<DWORD>(request.Body.size()),
+                static_cast<DWORD>(request.Body.size()),
+                0);
+            auto sendEnd = std::chrono::steady_clock::now();
+            outResponse.Timing.SendMs = ElapsedMs(attemptStart, sendEnd);
+            if (completed)
+            {
+                outResponse.Timing.BytesSent = requestBytes;
+                completed = WinHttpReceiveResponse(requestHandle.get(), nullptr);
+            }
+            auto headersReceived = std::chrono::steady_clock::now();
+            DWORD error = completed ? ERROR_SUCCESS : GetLastError();
+            SplitConnectionTiming(requestHandle.get(), outResponse.Timing);
+            if (!completed)
+            {
+                if (request.Cancellation.IsCancellationRequested())
+                {
+                    return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+                }
+                if (attempt == 0 && error == ERROR_WINHTTP_CONNECTION_ERROR)
+                {
+                    continue;
+                }
+                return HRESULT_FROM_WIN32(error);
+            }
+
+            try
+            {
+                outResponse.FirstByteMs = ElapsedMs(attemptStart, headersReceived);
+                outResponse.Timing.TimeToFirstByteMs = ElapsedMs(sendEnd, headersReceived);
+                DWORD receiveTimeoutMs = static_cast<DWORD>(std::max<int32_t>(ClampToDeadline(request, request.TransferTimeoutMs), 1));
+                THROW_IF_WIN32_BOOL_FALSE(WinHttpSetOption(requestHandle.get(), WINHTTP_OPTION_RECEIVE_TIMEOUT, &receiveTimeoutMs, sizeof(receiveTimeoutMs)));
+                outResponse.StatusCode = QueryStatusCode(requestHandle.get());
+                outResponse.Timing.BytesReceived = static_cast<int64_t>(QueryResponseHeaders(requestHandle.get(), outResponse.Headers));
+                int32_t statusCode = outResponse.StatusCode;
+                if (statusCode != 204 && statusCode != 304 && request.Method != "HEAD")
+                {
+                    int64_t contentLength = QueryContentLength(requestHandle.get());
+                    ISyncResponseBodySink* sink = request.BodySink && request.BodySink->BeginBody(outResponse, contentLength) ? request.BodySink : nullptr;
+                    outResponse.Timing.BytesReceived += static_cast<int64_t>(ReadResponseBody(requestHandle.get(), contentLength, sink, outResponse.Body));
+                }
+                outResponse.Timing.TransferMs = ElapsedMs(headersReceived, std::chrono::steady_clock::now());
+            }
+            catch (...)
+            {
+                if (request.Cancellation.IsCancellationRequested())
+                {
+                    outResponse = {};
+                    return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+                }
+                throw;
+            }
+            return S_OK;
+        }
+    }
+    CATCH_RETURN()
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "SyncTransport.h"
+
+#include <memory>
+
+namespace tsupasswd
+{
+    class SyncHttpConnectionPool;
+
+    // WinHTTP による ISyncTransport。セッションと接続は SyncHttpConnectionPool で共有する。
+    class WinHttpSyncTransport final : public ISyncTransport
+    {
+    public:
+        explicit WinHttpSyncTransport(std::shared_ptr<SyncHttpConnectionPool> connectionPool);
+
+        HRESULT Send(SyncTransportRequest const& request, SyncTransportResponse& outResponse) noexcept override;
+
+    private:
+        std::shared_ptr<SyncHttpConnectionPool> m_connectionPool;
+    };
+}
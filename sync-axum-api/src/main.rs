@@ -1,6 +1,7 @@
 use axum::{
-    extract::{Path, State},
-    http::{HeaderMap, StatusCode},
+    body::Bytes,
+    extract::{Path, Query, State},
+    http::{header, HeaderMap, HeaderName, StatusCode},
     response::IntoResponse,
     routing::get,
     Json, Router,
@@ -505,13 +506,71 @@ struct PutVaultRequest {
 struct GetVaultResponse {
     server_version: i64,
     cipher_blob_base64: String,
+    blob_sha256_base64: String,
     updated_at: String,
 }
 
+#[derive(Debug, Deserialize)]
+struct PutVaultItemRequest {
+    item_id: String,
+    base_item_version: i64,
+    #[serde(default)]
+    deleted: bool,
+    sealed_item_base64: String,
+    #[serde(default)]
+    updated_at: String,
+}
+
+#[derive(Debug, Deserialize)]
+struct PutVaultItemsRequest {
+    #[serde(default)]
+    #[allow(dead_code)]
+    device_id: String,
+    items: Vec<PutVaultItemRequest>,
+}
+
+#[derive(Debug, Serialize)]
+struct VaultItemVersion {
+    item_id: String,
+    item_version: i64,
+}
+
+#[derive(Debug, Serialize)]
+struct PutVaultItemsResponse {
+    ok: bool,
+    base_cursor: i64,
+    cursor: i64,
+    items: Vec<VaultItemVersion>,
+}
+
+#[derive(Debug, Deserialize)]
+struct VaultChangesQuery {
+    since: Option<i64>,
+    limit: Option<i64>,
+}
+
+#[derive(Debug, Serialize)]
+struct VaultItemChange {
+    item_id: String,
+    item_version: i64,
+    deleted: bool,
+    sealed_item_base64: String,
+    updated_at: String,
+    change_seq: i64,
+}
+
+#[derive(Debug, Serialize)]
+struct VaultChangesResponse {
+    cursor: i64,
+    has_more: bool,
+    items: Vec<VaultItemChange>,
+}
+
 #[derive(Debug, Serialize)]
 struct PutVaultResponse {
     ok: bool,
     server_version: i64,
+    blob_sha256_base64: String,
     updated_at: String,
 }
 
@@ -579,6 +638,8 @@ async fn main() -> anyhow::Result<()> {
             axum::routing::post(opaque_login_finish),
         )
         .route("/v1/vaults/:email", get(get_vault).put(put_vault))
+        .route("/v1/vaults/:email/items", axum::routing::put(put_vault_items))
+        .route("/v1/vaults/:email/changes", get(get_vault_changes))
         .with_state(state);
 
     let addr: SocketAddr = bind.parse()?;
@@ -626,15 +687,61 @@ async fn get_vault(
         return resp;
     }
 
-    let row = sqlx::query_as::<_, (i64, String, String)>(
-        r#"SELECT server_version, cipher_blob_base64, updated_at FROM vaults WHERE email = $1;"#,
+    match sqlx::query_as::<_, (i64,)>(r#"SELECT cursor FROM vault_item_cursors WHERE email = $1;"#)
+        .bind(email.clone())
+        .fetch_optional(&state.db)
+        .await
+    {
+        Ok(Some((cursor,))) if cursor > 0 => return item_sync_active_response(),
+        Ok(_) => {}
+        Err(e) => {
+            error!("db error: {}", e);
+            return (
+                StatusCode::INTERNAL_SERVER_ERROR,
+                Json(ErrorResponse {
+                    code: "DB_ERROR",
+                    message: "db error",
+                }),
+            )
+                .into_response();
+        }
+    }
+
+    // If-Version / If-None-Match が手元の版と一致すれば、blob を読まずに 304 を返す。
+    let if_version = headers
+        .get("If-Version")
+        .and_then(|v| v.to_str().ok())
+        .and_then(|v| v.trim().parse::<i64>().ok());
+    let if_none_match = headers
+        .get("If-None-Match")
+        .and_then(|v| v.to_str().ok())
+        .map(|v| v.trim().to_string());
+    if if_version.is_some() || if_none_match.is_some() {
+        let current = sqlx::query_as::<_, (i64, String)>(
+            r#"SELECT server_version, blob_sha256_base64 FROM vaults WHERE email = $1;"#,
+        )
+        .bind(email.clone())
+        .fetch_optional(&state.db)
+        .await;
+        if let Ok(Some((server_version, blob_sha256_base64))) = current {
+            let etag = vault_etag(server_version, &blob_sha256_base64);
+            let version_matches = if_version == Some(server_version);
+            let etag_matches = !blob_sha256_base64.is_empty() && if_none_match.as_deref() == Some(etag.as_str());
+            if version_matches || etag_matches {
+                return (StatusCode::NOT_MODIFIED, [(header::ETAG, etag)]).into_response();
+            }
+        }
+    }
+
+    let row = sqlx::query_as::<_, (i64, String, String, String)>(
+        r#"SELECT server_version, cipher_blob_base64, blob_sha256_base64, updated_at FROM vaults WHERE email = $1;"#,
     )
     .bind(email)
     .fetch_optional(&state.db)
     .await;
 
     let row = match row {
-        Ok(Some((server_version, cipher_blob_base64, updated_at))) => (server_version, cipher_blob_base64, updated_at),
+        Ok(Some(row)) => row,
         Ok(None) => {
             return (
                 StatusCode::NOT_FOUND,
@@ -658,12 +765,49 @@ async fn get_vault(
         }
     };
 
+    // 列を追加する前に書かれた行はハッシュが空なので、ここで計算する。
+    let blob_sha256_base64 = if row.2.is_empty() {
+        sha256_base64(row.1.as_bytes())
+    } else {
+        row.2
+    };
+    let etag = vault_etag(row.0, &blob_sha256_base64);
+    if accepts_octet_stream(&headers, header::ACCEPT) {
+        let cipher = match base64::engine::general_purpose::STANDARD.decode(row.1.as_bytes()) {
+            Ok(cipher) => cipher,
+            Err(e) => {
+                error!("stored blob is not base64: {}", e);
+                return (
+                    StatusCode::INTERNAL_SERVER_ERROR,
+                    Json(ErrorResponse {
+                        code: "INVALID_STORED_BLOB",
+                        message: "stored blob is not base64",
+                    }),
+                )
+                    .into_response();
+            }
+        };
+        return (
+            StatusCode::OK,
+            [
+                (header::CONTENT_TYPE, OCTET_STREAM.to_string()),
+                (header::ETAG, etag),
+                (HeaderName::from_static("x-server-version"), row.0.to_string()),
+                (HeaderName::from_static("x-blob-sha256-base64"), blob_sha256_base64),
+                (HeaderName::from_static("x-updated-at"), row.3),
+            ],
+            cipher,
+        )
+            .into_response();
+    }
     (
         StatusCode::OK,
+        [(header::ETAG, etag)],
         Json(GetVaultResponse {
             server_version: row.0,
             cipher_blob_base64: row.1,
-            updated_at: row.2,
+            blob_sha256_base64,
+            updated_at: row.3,
         }),
     )
         .into_response()
@@ -673,13 +817,49 @@ async fn put_vault(
     State(state): State<AppState>,
     headers: HeaderMap,
     Path(email): Path<String>,
-    Json(req): Json<PutVaultRequest>,
+    body: Bytes,
 ) -> impl IntoResponse {
     let email = normalize_email(&email);
     if let Err(resp) = authorize(&state, &headers, &email) {
         return resp;
     }
 
+    // octet-stream は本文が暗号文そのもので、期待する版はヘッダーで受け取る。保存形式は JSON と同じ base64。
+    let req = if accepts_octet_stream(&headers, header::CONTENT_TYPE) {
+        let Some(expected_server_version) = headers
+            .get("X-Expected-Server-Version")
+            .and_then(|v| v.to_str().ok())
+            .and_then(|v| v.trim().parse::<i64>().ok())
+        else {
+            return (
+                StatusCode::BAD_REQUEST,
+                Json(ErrorResponse {
+                    code: "INVALID_REQUEST",
+                    message: "missing X-Expected-Server-Version",
+                }),
+            )
+                .into_response();
+        };
+        PutVaultRequest {
+            expected_server_version,
+            cipher_blob_base64: base64::engine::general_purpose::STANDARD.encode(&body),
+        }
+    } else {
+        match serde_json::from_slice::<PutVaultRequest>(&body) {
+            Ok(req) => req,
+            Err(_) => {
+                return (
+                    StatusCode::BAD_REQUEST,
+                    Json(ErrorResponse {
+                        code: "INVALID_REQUEST",
+                        message: "invalid request body",
+                    }),
+                )
+                    .into_response();
+            }
+        }
+    };
+
     let now = Utc::now();
     let now_str = now.to_rfc3339();
 
@@ -698,6 +878,22 @@ async fn put_vault(
         }
     };
 
+    match lock_item_cursor(&mut tx, &email).await {
+        Ok(cursor) if cursor > 0 => return item_sync_active_response(),
+        Ok(_) => {}
+        Err(e) => {
+            error!("db error: {}", e);
+            return (
+                StatusCode::INTERNAL_SERVER_ERROR,
+                Json(ErrorResponse {
+                    code: "DB_ERROR",
+                    message: "db error",
+                }),
+            )
+                .into_response();
+        }
+    }
+
     let current = sqlx::query_as::<_, (i64,)>(r#"SELECT server_version FROM vaults WHERE email = $1;"#)
         .bind(email.clone())
         .fetch_optional(&mut *tx)
@@ -720,31 +916,64 @@ async fn put_vault(
     };
 
     if req.expected_server_version != current_version {
-        return (
-            StatusCode::CONFLICT,
-            Json(serde_json::json!({
-                "code": "VERSION_CONFLICT",
-                "server_version": current_version,
-            })),
-        )
-            .into_response();
+        let mut conflict = serde_json::json!({
+            "code": "VERSION_CONFLICT",
+            "server_version": current_version,
+        });
+        // Prefer: return=representation なら現在の vault を付け、クライアントが GET せずに merge して送り直せるようにする。
+        // 読めなければ vault なしの 409 にする (クライアントは GET する経路に戻る)。
+        if current_version > 0 && prefers_representation(&headers) {
+            let row = sqlx::query_as::<_, (i64, String, String, String)>(
+                r#"SELECT server_version, cipher_blob_base64, blob_sha256_base64, updated_at FROM vaults WHERE email = $1;"#,
+            )
+            .bind(email.clone())
+            .fetch_optional(&mut *tx)
+            .await;
+            match row {
+                Ok(Some((server_version, cipher_blob_base64, stored_sha256_base64, updated_at))) => {
+                    let blob_sha256_base64 = if stored_sha256_base64.is_empty() {
+                        sha256_base64(cipher_blob_base64.as_bytes())
+                    } else {
+                        stored_sha256_base64
+                    };
+                    conflict["server_version"] = serde_json::json!(server_version);
+                    conflict["cipher_blob_base64"] = serde_json::json!(cipher_blob_base64);
+                    conflict["blob_sha256_base64"] = serde_json::json!(blob_sha256_base64);
+                    conflict["updated_at"] = serde_json::json!(updated_at);
+                    return (
+                        StatusCode::CONFLICT,
+                        [(HeaderName::from_static("preference-applied"), "return=representation")],
+                        Json(conflict),
+                    )
+                        .into_response();
+                }
+                Ok(None) => {}
+                Err(e) => {
+                    error!("db error: {}", e);
+                }
+            }
+        }
+        return (StatusCode::CONFLICT, Json(conflict)).into_response();
     }
 
     let next_version = current_version + 1;
+    let blob_sha256_base64 = sha256_base64(req.cipher_blob_base64.as_bytes());
 
     if let Err(e) = sqlx::query(
         r#"
-INSERT INTO vaults (email, server_version, cipher_blob_base64, updated_at)
-VALUES ($1, $2, $3, $4)
+INSERT INTO vaults (email, server_version, cipher_blob_base64, blob_sha256_base64, updated_at)
+VALUES ($1, $2, $3, $4, $5)
 ON CONFLICT(email) DO UPDATE SET
   server_version = EXCLUDED.server_version,
   cipher_blob_base64 = EXCLUDED.cipher_blob_base64,
+  blob_sha256_base64 = EXCLUDED.blob_sha256_base64,
   updated_at = EXCLUDED.updated_at;
 "#,
     )
     .bind(email)
     .bind(next_version)
     .bind(req.cipher_blob_base64)
+    .bind(blob_sha256_base64.clone())
     .bind(now_str)
     .execute(&mut *tx)
     .await
@@ -777,12 +1006,260 @@ ON CONFLICT(email) DO UPDATE SET
         Json(PutVaultResponse {
             ok: true,
             server_version: next_version,
+            blob_sha256_base64,
             updated_at: now.to_rfc3339(),
         }),
     )
         .into_response()
 }
 
+// item 単位の差分同期。変わった item だけを受け取り、1 件でも base_item_version が合わなければ何も書かずに 409 を返す。
+// 書き込んだ item には利用者ごとの通し番号 (cursor) を振り、GET changes はそれより後の変更を返す。
+async fn put_vault_items(
+    State(state): State<AppState>,
+    headers: HeaderMap,
+    Path(email): Path<String>,
+    body: Bytes,
+) -> impl IntoResponse {
+    let email = normalize_email(&email);
+    if let Err(resp) = authorize(&state, &headers, &email) {
+        return resp;
+    }
+
+    let req = match serde_json::from_slice::<PutVaultItemsRequest>(&body) {
+        Ok(req) => req,
+        Err(_) => {
+            return (
+                StatusCode::BAD_REQUEST,
+                Json(ErrorResponse {
+                    code: "INVALID_REQUEST",
+                    message: "invalid request body",
+                }),
+            )
+                .into_response();
+        }
+    };
+    let valid = req.items.len() <= MAX_ITEMS_PER_WRITE && {
+        let mut seen = std::collections::HashSet::new();
+        req.items.iter().all(|item| {
+            !item.item_id.is_empty()
+                && seen.insert(item.item_id.as_str())
+                && base64::engine::general_purpose::STANDARD
+                    .decode(item.sealed_item_base64.as_bytes())
+                    .is_ok()
+        })
+    };
+    if !valid {
+        return (
+            StatusCode::BAD_REQUEST,
+            Json(ErrorResponse {
+                code: "INVALID_REQUEST",
+                message: "invalid items",
+            }),
+        )
+            .into_response();
+    }
+
+    let db_error = |e: sqlx::Error| {
+        error!("db error: {}", e);
+        (
+            StatusCode::INTERNAL_SERVER_ERROR,
+            Json(ErrorResponse {
+                code: "DB_ERROR",
+                message: "db error",
+            }),
+        )
+            .into_response()
+    };
+
+    let mut tx = match state.db.begin().await {
+        Ok(tx) => tx,
+        Err(e) => return db_error(e),
+    };
+
+    // cursor の行をロックして、同じ利用者への書き込み (vault 全体の PUT も含む) を直列にする。
+    let base_cursor = match lock_item_cursor(&mut tx, &email).await {
+        Ok(cursor) => cursor,
+        Err(e) => return db_error(e),
+    };
+
+    let item_ids: Vec<String> = req.items.iter().map(|item| item.item_id.clone()).collect();
+    let current: std::collections::HashMap<String, i64> = match sqlx::query_as::<_, (String, i64)>(
+        r#"SELECT item_id, item_version FROM vault_items WHERE email = $1 AND item_id = ANY($2);"#,
+    )
+    .bind(email.clone())
+    .bind(item_ids)
+    .fetch_all(&mut *tx)
+    .await
+    {
+        Ok(rows) => rows.into_iter().collect(),
+        Err(e) => return db_error(e),
+    };
+
+    let conflicts: Vec<VaultItemVersion> = req
+        .items
+        .iter()
+        .filter_map(|item| {
+            let item_version = current.get(&item.item_id).copied().unwrap_or(0);
+            (item.base_item_version != item_version).then(|| VaultItemVersion {
+                item_id: item.item_id.clone(),
+                item_version,
+            })
+        })
+        .collect();
+    if !conflicts.is_empty() {
+        return (
+            StatusCode::CONFLICT,
+            Json(serde_json::json!({
+                "code": "ITEM_VERSION_CONFLICT",
+                "base_cursor": base_cursor,
+                "cursor": base_cursor,
+                "conflicts": conflicts,
+            })),
+        )
+            .into_response();
+    }
+
+    let mut cursor = base_cursor;
+    let mut written = Vec::with_capacity(req.items.len());
+    for item in req.items {
+        cursor += 1;
+        let item_version = item.base_item_version + 1;
+        if let Err(e) = sqlx::query(
+            r#"
+INSERT INTO vault_items (email, item_id, item_version, deleted, sealed_item_base64, updated_at, change_seq)
+VALUES ($1, $2, $3, $4, $5, $6, $7)
+ON CONFLICT(email, item_id) DO UPDATE SET
+  item_version = EXCLUDED.item_version,
+  deleted = EXCLUDED.deleted,
+  sealed_item_base64 = EXCLUDED.sealed_item_base64,
+  updated_at = EXCLUDED.updated_at,
+  change_seq = EXCLUDED.change_seq;
+"#,
+        )
+        .bind(email.clone())
+        .bind(item.item_id.clone())
+        .bind(item_version)
+        .bind(item.deleted)
+        .bind(item.sealed_item_base64)
+        .bind(item.updated_at)
+        .bind(cursor)
+        .execute(&mut *tx)
+        .await
+        {
+            return db_error(e);
+        }
+        written.push(VaultItemVersion {
+            item_id: item.item_id,
+            item_version,
+        });
+    }
+
+    if let Err(e) = sqlx::query(r#"UPDATE vault_item_cursors SET cursor = $2 WHERE email = $1;"#)
+        .bind(email)
+        .bind(cursor)
+        .execute(&mut *tx)
+        .await
+    {
+        return db_error(e);
+    }
+    if let Err(e) = tx.commit().await {
+        return db_error(e);
+    }
+
+    (
+        StatusCode::OK,
+        Json(PutVaultItemsResponse {
+            ok: true,
+            base_cursor,
+            cursor,
+            items: written,
+        }),
+    )
+        .into_response()
+}
+
+async fn get_vault_changes(
+    State(state): State<AppState>,
+    headers: HeaderMap,
+    Path(email): Path<String>,
+    Query(query): Query<VaultChangesQuery>,
+) -> impl IntoResponse {
+    let email = normalize_email(&email);
+    if let Err(resp) = authorize(&state, &headers, &email) {
+        return resp;
+    }
+
+    let since = query.since.unwrap_or(0);
+    let limit = query.limit.unwrap_or(DEFAULT_CHANGES_LIMIT).clamp(1, MAX_CHANGES_LIMIT);
+    let db_error = |e: sqlx::Error| {
+        error!("db error: {}", e);
+        (
+            StatusCode::INTERNAL_SERVER_ERROR,
+            Json(ErrorResponse {
+                code: "DB_ERROR",
+                message: "db error",
+            }),
+        )
+            .into_response()
+    };
+
+    // 1 件多く読んで続きがあるかを判断する。
+    let mut rows = match sqlx::query_as::<_, (String, i64, bool, String, String, i64)>(
+        r#"
+SELECT item_id, item_version, deleted, sealed_item_base64, updated_at, change_seq
+FROM vault_items
+WHERE email = $1 AND change_seq > $2
+ORDER BY change_seq
+LIMIT $3;
+"#,
+    )
+    .bind(email.clone())
+    .bind(since)
+    .bind(limit + 1)
+    .fetch_all(&state.db)
+    .await
+    {
+        Ok(rows) => rows,
+        Err(e) => return db_error(e),
+    };
+
+    let has_more = (rows.len() as i64) > limit;
+    rows.truncate(limit as usize);
+    let cursor = if has_more {
+        rows.last().map(|row| row.5).unwrap_or(since)
+    } else {
+        match sqlx::query_as::<_, (i64,)>(r#"SELECT cursor FROM vault_item_cursors WHERE email = $1;"#)
+            .bind(email)
+            .fetch_optional(&state.db)
+            .await
+        {
+            Ok(row) => row.map(|(cursor,)| cursor).unwrap_or(0).max(since),
+            Err(e) => return db_error(e),
+        }
+    };
+
+    (
+        StatusCode::OK,
+        Json(VaultChangesResponse {
+            cursor,
+            has_more,
+            items: rows
+                .into_iter()
+                .map(|row| VaultItemChange {
+                    item_id: row.0,
+                    item_version: row.1,
+                    deleted: row.2,
+                    sealed_item_base64: row.3,
+                    updated_at: row.4,
+                    change_seq: row.5,
+                })
+                .collect(),
+        }),
+    )
+        .into_response()
+}
+
 fn authorize(state: &AppState, headers: &HeaderMap, expected_email: &str) -> Result<(), axum::response::Response> {
     let Some(value) = headers.get("Authorization").and_then(|v| v.to_str().ok()) else {
         return Err((
@@ -846,7 +1323,6 @@ fn normalize_email(email: &str) -> String {
     email.trim().to_ascii_lowercase()
 }
 
-#[allow(dead_code)]
 fn sha256_base64(input: &[u8]) -> String {
     let mut hasher = Sha256::new();
     hasher.update(input);
@@ -854,6 +1330,62 @@ fn sha256_base64(input: &[u8]) -> String {
     base64::engine::general_purpose::STANDARD.encode(digest)
 }
 
+const MAX_ITEMS_PER_WRITE: usize = 1000;
+const DEFAULT_CHANGES_LIMIT: i64 = 500;
+const MAX_CHANGES_LIMIT: i64 = 1000;
+
+// 暗号文をそのまま送る vault 転送の Content-Type / Accept。
+const OCTET_STREAM: &str = "application/octet-stream";
+
+fn accepts_octet_stream(headers: &HeaderMap, name: header::HeaderName) -> bool {
+    headers
+        .get(name)
+        .and_then(|v| v.to_str().ok())
+        .map(|v| v.trim_start().starts_with(OCTET_STREAM))
+        .unwrap_or(false)
+}
+
+// Prefer ヘッダー (RFC 7240) に return=representation があるか。
+fn prefers_representation(headers: &HeaderMap) -> bool {
+    headers
+        .get_all("Prefer")
+        .iter()
+        .filter_map(|v| v.to_str().ok())
+        .flat_map(|v| v.split(','))
+        .any(|v| v.trim().eq_ignore_ascii_case("return=representation"))
+}
+
+// クライアントの VaultValidator から組み立てる If-None-Match と同じ形式。
+fn vault_etag(server_version: i64, blob_sha256_base64: &str) -> String {
+    format!("\"{}-{}\"", server_version, blob_sha256_base64)
+}
+
+// 利用者の cursor の行を (なければ 0 で作って) ロックし、値を返す。put_vault と put_vault_items はこの行で直列になる。
+async fn lock_item_cursor(tx: &mut sqlx::Transaction<'_, Postgres>, email: &str) -> Result<i64, sqlx::Error> {
+    sqlx::query(r#"INSERT INTO vault_item_cursors (email, cursor) VALUES ($1, 0) ON CONFLICT (email) DO NOTHING;"#)
+        .bind(email)
+        .execute(&mut **tx)
+        .await?;
+    let (cursor,) = sqlx::query_as::<_, (i64,)>(r#"SELECT cursor FROM vault_item_cursors WHERE email = $1 FOR UPDATE;"#)
+        .bind(email)
+        .fetch_one(&mut **tx)
+        .await?;
+    Ok(cursor)
+}
+
+// サーバーは復号しないので、vault 全体と item を互いに作り直せない。item を 1 件でも書いた利用者は
+// vault 全体の GET/PUT を断り、古い vault 全体が item と食い違ったまま読み書きされないようにする。
+fn item_sync_active_response() -> axum::response::Response {
+    (
+        StatusCode::CONFLICT,
+        Json(ErrorResponse {
+            code: "ITEM_SYNC_ACTIVE",
+            message: "vault is synced per item",
+        }),
+    )
+        .into_response()
+}
+
 async fn ensure_schema(db: &Pool<Postgres>) -> anyhow::Result<()> {
     sqlx::query(
         r#"
@@ -868,6 +1400,44 @@ CREATE TABLE IF NOT EXISTS vaults (
     .execute(db)
     .await?;
 
+    // 条件付き GET 用。既存の行は空のまま残り、GET 時に計算する。
+    sqlx::query(r#"ALTER TABLE vaults ADD COLUMN IF NOT EXISTS blob_sha256_base64 TEXT NOT NULL DEFAULT '';"#)
+        .execute(db)
+        .await?;
+
+    // item 単位の差分同期。vaults の blob とは別に持つ。
+    sqlx::query(
+        r#"
+CREATE TABLE IF NOT EXISTS vault_items (
+  email TEXT NOT NULL,
+  item_id TEXT NOT NULL,
+  item_version BIGINT NOT NULL,
+  deleted BOOLEAN NOT NULL,
+  sealed_item_base64 TEXT NOT NULL,
+  updated_at TEXT NOT NULL,
+  change_seq BIGINT NOT NULL,
+  PRIMARY KEY (email, item_id)
+);
+"#,
+    )
+    .execute(db)
+    .await?;
+
+    sqlx::query(r#"CREATE INDEX IF NOT EXISTS vault_items_change_seq ON vault_items (email, change_seq);"#)
+        .execute(db)
+        .await?;
+
+    sqlx::query(
+        r#"
+CREATE TABLE IF NOT EXISTS vault_item_cursors (
+  email TEXT PRIMARY KEY,
+  cursor BIGINT NOT NULL
+);
+"#,
+    )
+    .execute(db)
+    .await?;
+
     sqlx::query(
         r#"
 CREATE TABLE IF NOT EXISTS users (
@@ -0,0 +1,897 @@
+// Native Messaging host の負荷試験ツール。
+// 記録済みの拡張機能セッション (TSUPASSWD_NATIVE_HOST_RECORD_SESSION で出力した JSONL) を、
+// スタブ vault に接続した NativeMessagingHostCore へ指定の並列数/レートでリプレイし、
+// command ごとの p50/p95/p99 レイテンシを出力する。
+
+#include "NativeMessagingCore.h"
+#include "NativeMessagingJson.h"
+#include "NativeMessagingTransport.h"
+#include "StubNativeHostVault.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace
+{
+    using namespace tsupasswd;
+    using Clock = std::chrono::steady_clock;
+
+    constexpr uint32_t kMaxMessageBytes = 16u * 1024u * 1024u;
+
+    struct RecordedRequest
+    {
+        std::string Command;
+        std::string Body;
+        int64_t AtMs{ 0 };
+    };
+
+    struct Session
+    {
+        std::string Name;
+        std::vector<RecordedRequest> Requests;
+    };
+
+    enum class TransportKind
+    {
+        InMemory,
+        Pipe,
+    };
+
+    struct LoadTestOptions
+    {
+        std::vector<std::string> SessionPaths;
+        uint32_t Concurrency{ 4 };
+        double Rate{ 0 };
+        uint32_t Iterations{ 10 };
+        bool RespectTiming{ false };
+        double Speed{ 1.0 };
+        TransportKind Transport{ TransportKind::InMemory };
+        loadtest::StubVaultOptions Stub{};
+    };
+
+    struct CommandSamples
+    {
+        std::vector<uint64_t> LatencyMicros;
+        uint64_t Errors{ 0 };
+    };
+
+    struct ClientResult
+    {
+        std::map<std::string, CommandSamples> Commands;
+        uint64_t Events{ 0 };
+        uint64_t ProtocolFailures{ 0 };
+    };
+
+    // 全クライアント共通の送信レート制御。rate=0 なら制限なし。
+    class RatePacer
+    {
+    public:
+        explicit RatePacer(double rate) :
+            m_interval(rate > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate)) : Clock::duration::zero())
+        {
+        }
+
+        void Acquire()
+        {
+            if (m_interval == Clock::duration::zero())
+            {
+                return;
+            }
+
+            Clock::time_point slot;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                Clock::time_point now = Clock::now();
+                if (m_next < now)
+                {
+                    m_next = now;
+                }
+                slot = m_next;
+                m_next += m_interval;
+            }
+            std::this_thread::sleep_until(slot);
+        }
+
+    private:
+        Clock::duration m_interval;
+        std::mutex m_mutex;
+        Clock::time_point m_next{};
+    };
+
+    bool ParseSessionLine(std::string_view line, Utf8JsonReader& reader, Utf8JsonWriter& writer, RecordedRequest& out)
+    {
+        if (!reader.Parse(line))
+        {
+            return false;
+        }
+
+        // 記録形式 {"atMs":..,"request":{..}} と、request をそのまま並べた JSONL の両方を受け付ける。
+        size_t request = Utf8JsonReader::Root;
+        size_t recorded = 0;
+        if (reader.TryGetObject(Utf8JsonReader::Root, "request", recorded))
+        {
+            request = recorded;
+            int64_t atMs = 0;
+            if (reader.TryGetInt64(Utf8JsonReader::Root, "atMs", atMs))
+            {
+                out.AtMs = atMs;
+            }
+        }
+
+        if (!reader.TryGetStringUtf8(request, "command", out.Command) || out.Command.empty())
+        {
+            return false;
+        }
+
+        writer.Reset();
+        CopyJsonValue(reader, request, writer);
+        out.Body.assign(writer.View());
+        return true;
+    }
+
+    bool LoadSession(std::string const& path, Session& out, std::string& outError)
+    {
+        std::ifstream stream(path, std::ios::binary);
+        if (!stream)
+        {
+            outError = "cannot open " + path;
+            return false;
+        }
+
+        out.Name = path;
+        Utf8JsonReader reader;
+        Utf8JsonWriter writer;
+        std::string line;
+        size_t lineNumber = 0;
+        while (std::getline(stream, line))
+        {
+            ++lineNumber;
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            if (line.find_first_not_of(" \t") == std::string::npos)
+            {
+                continue;
+            }
+
+            RecordedRequest request{};
+            if (!ParseSessionLine(line, reader, writer, request))
+            {
+                outError = path + ":" + std::to_string(lineNumber) + ": not a native host request";
+                return false;
+            }
+            out.Requests.push_back(std::move(request));
+        }
+
+        if (out.Requests.empty())
+        {
+            outError = path + ": no requests";
+            return false;
+        }
+        return true;
+    }
+
+    // セッションが指定されないときに使う、拡張機能の典型的な操作列。
+    Session BuildBuiltinSession()
+    {
+        static constexpr std::string_view kLines[] = {
+            R"({"atMs":0,"request":{"id":"b-1","version":1,"command":"vault.status.get","payload":{}}})",
+            R"({"atMs":5,"request":{"id":"b-2","version":1,"command":"vault.login.list","payload":{"includeDeleted":false}}})",
+            R"({"atMs":40,"request":{"id":"b-3","version":1,"command":"vault.login.get","payload":{"itemId":"stub-item-000001","includeSecret":true}}})",
+            R"({"atMs":900,"request":{"id":"b-4","version":1,"command":"vault.login.save","payload":{"title":"Example","username":"alice","password":"<redacted>","url":"https://example.com","resync":false}}})",
+            R"({"atMs":1500,"request":{"id":"b-5","version":1,"command":"vault.login.update","payload":{"itemId":"stub-item-000002","title":"Example 2","username":"bob","password":"<redacted>","url":"https://example.org","resync":false}}})",
+            R"({"atMs":2100,"request":{"id":"b-6","version":1,"command":"vault.login.list","payload":{"includeDeleted":true}}})",
+            R"({"atMs":2500,"request":{"id":"b-7","version":1,"command":"vault.sync.resync","payload":{}}})",
+            R"({"atMs":2600,"request":{"id":"b-8","version":1,"command":"vault.status.get","payload":{}}})",
+        };
+
+        Session session{};
+        session.Name = "<builtin>";
+        Utf8JsonReader reader;
+        Utf8JsonWriter writer;
+        for (auto line : kLines)
+        {
+            RecordedRequest request{};
+            if (ParseSessionLine(line, reader, writer, request))
+            {
+                session.Requests.push_back(std::move(request));
+            }
+        }
+        return session;
+    }
+
+    // host core をスレッドで動かし、クライアント側 transport を渡す。
+    class HostConnection
+    {
+    public:
+        HostConnection(INativeHostVault& vault, TransportKind kind)
+        {
+#ifndef _WIN32
+            if (kind == TransportKind::Pipe)
+            {
+                int toHost[2]{ -1, -1 };
+                int toClient[2]{ -1, -1 };
+                if (pipe(toHost) == 0 && pipe(toClient) == 0)
+                {
+                    m_fds = { toHost[0], toHost[1], toClient[0], toClient[1] };
+                    m_client = std::make_unique<PosixFdTransport>(toClient[0], toHost[1]);
+                    m_host = std::make_unique<PosixFdTransport>(toHost[0], toClient[1]);
+                }
+            }
+#else
+            (void)kind;
+#endif
+            if (!m_client)
+            {
+                auto pair = CreateInMemoryTransportPair();
+                m_inMemoryClient = pair.first.get();
+                m_inMemoryHost = pair.second.get();
+                m_client = std::move(pair.first);
+                m_host = std::move(pair.second);
+            }
+
+            m_thread = std::thread([this, &vault]()
+            {
+                NativeMessagingHostCore core(vault, *m_host);
+                m_exitCode = core.Run();
+                // host 側の書き込み口を閉じ、クライアントの読み出しに EOF を返す。
+                CloseHostWrite();
+            });
+        }
+
+        ~HostConnection()
+        {
+            CloseClientWrite();
+            if (m_thread.joinable())
+            {
+                m_thread.join();
+            }
+#ifndef _WIN32
+            for (int fd : m_fds)
+            {
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+            }
+#endif
+        }
+
+        INativeMessageTransport& Client() { return *m_client; }
+
+        void CloseClientWrite()
+        {
+            if (m_inMemoryClient)
+            {
+                m_inMemoryClient->CloseWrite();
+            }
+#ifndef _WIN32
+            CloseFd(1);
+#endif
+        }
+
+        int ExitCode() const { return m_exitCode.load(); }
+
+    private:
+        void CloseHostWrite()
+        {
+            if (m_inMemoryHost)
+            {
+                m_inMemoryHost->CloseWrite();
+            }
+#ifndef _WIN32
+            CloseFd(3);
+#endif
+        }
+
+#ifndef _WIN32
+        void CloseFd(size_t index)
+        {
+            std::lock_guard<std::mutex> lock(m_fdMutex);
+            if (m_fds[index] >= 0)
+            {
+                close(m_fds[index]);
+                m_fds[index] = -1;
+            }
+        }
+
+        std::mutex m_fdMutex;
+        std::array<int, 4> m_fds{ -1, -1, -1, -1 };
+#endif
+        std::unique_ptr<INativeMessageTransport> m_client;
+        std::unique_ptr<INativeMessageTransport> m_host;
+        InMemoryTransport* m_inMemoryClient{ nullptr };
+        InMemoryTransport* m_inMemoryHost{ nullptr };
+        std::atomic<int> m_exitCode{ 0 };
+        std::thread m_thread;
+    };
+
+    void RunClient(
+        Session const& session,
+        LoadTestOptions const& options,
+        INativeHostVault& vault,
+        RatePacer& pacer,
+        ClientResult& result)
+    {
+        HostConnection connection(vault, options.Transport);
+        INativeMessageTransport& transport = connection.Client();
+        std::string receive;
+        Utf8JsonReader reader;
+
+        for (uint32_t iteration = 0; iteration < options.Iterations; ++iteration)
+        {
+            Clock::time_point sessionStart = Clock::now();
+            for (auto const& request : session.Requests)
+            {
+                if (options.RespectTiming && options.Speed > 0)
+                {
+                    auto offset = std::chrono::duration<double, std::milli>(static_cast<double>(request.AtMs) / options.Speed);
+                    std::this_thread::sleep_until(sessionStart + std::chrono::duration_cast<Clock::duration>(offset));
+                }
+                pacer.Acquire();
+
+                Clock::time_point sent = Clock::now();
+                if (!WriteNativeMessageFrame(transport, request.Body))
+                {
+                    ++result.ProtocolFailures;
+                    return;
+                }
+
+                // resync の進捗イベントが応答より先に届くことがあるので、id を持つ応答が来るまで読み飛ばす。
+                bool answered = false;
+                while (!answered)
+                {
+                    if (ReadNativeMessageFrame(transport, receive, kMaxMessageBytes) != NativeFrameReadResult::Ok ||
+                        !reader.Parse(receive))
+                    {
+                        ++result.ProtocolFailures;
+                        return;
+                    }
+                    if (reader.FindMember(Utf8JsonReader::Root, "event") != Utf8JsonReader::npos)
+                    {
+                        ++result.Events;
+                        continue;
+                    }
+                    answered = true;
+                }
+
+                auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - sent).count();
+                CommandSamples& samples = result.Commands[request.Command];
+                samples.LatencyMicros.push_back(static_cast<uint64_t>(elapsed));
+                bool ok = false;
+                if (!reader.TryGetBool(Utf8JsonReader::Root, "ok", ok) || !ok)
+                {
+                    ++samples.Errors;
+                }
+            }
+        }
+
+        // 残っているイベントを EOF まで読み切る。
+        connection.CloseClientWrite();
+        while (ReadNativeMessageFrame(transport, receive, kMaxMessageBytes) == NativeFrameReadResult::Ok)
+        {
+            ++result.Events;
+        }
+        if (connection.ExitCode() != NativeHostExitOk)
+        {
+            ++result.ProtocolFailures;
+        }
+    }
+
+    double Percentile(std::vector<uint64_t> const& sorted, double quantile)
+    {
+        if (sorted.empty())
+        {
+            return 0;
+        }
+        // nearest-rank
+        size_t rank = static_cast<size_t>(quantile * static_cast<double>(sorted.size()) + 0.999999);
+        rank = std::clamp<size_t>(rank, 1, sorted.size());
+        return static_cast<double>(sorted[rank - 1]) / 1000.0;
+    }
+
+    int RunLoadTest(LoadTestOptions const& options)
+    {
+        std::vector<Session> sessions;
+        for (auto const& path : options.SessionPaths)
+        {
+            Session session{};
+            std::string error;
+            if (!LoadSession(path, session, error))
+            {
+                fprintf(stderr, "error: %s\n", error.c_str());
+                return 2;
+            }
+            sessions.push_back(std::move(session));
+        }
+        if (sessions.empty())
+        {
+            sessions.push_back(BuildBuiltinSession());
+        }
+
+        loadtest::StubNativeHostVault vault(options.Stub);
+        RatePacer pacer(options.Rate);
+        std::vector<ClientResult> results(options.Concurrency);
+        std::vector<std::thread> clients;
+        clients.reserve(options.Concurrency);
+
+        Clock::time_point start = Clock::now();
+        for (uint32_t i = 0; i < options.Concurrency; ++i)
+        {
+            clients.emplace_back([&, i]()
+            {
+                RunClient(sessions[i % sessions.size()], options, vault, pacer, results[i]);
+            });
+        }
+        for (auto& client : clients)
+        {
+            client.join();
+        }
+        double elapsedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::map<std::string, CommandSamples> merged;
+        uint64_t totalRequests = 0;
+        uint64_t totalEvents = 0;
+        uint64_t protocolFailures = 0;
+        for (auto& result : results)
+        {
+            totalEvents += result.Events;
+            protocolFailures += result.ProtocolFailures;
+            for (auto& [command, samples] : result.Commands)
+            {
+                CommandSamples& target = merged[command];
+                target.Errors += samples.Errors;
+                target.LatencyMicros.insert(target.LatencyMicros.end(), samples.LatencyMicros.begin(), samples.LatencyMicros.end());
+                totalRequests += samples.LatencyMicros.size();
+            }
+        }
+
+        printf("sessions=%zu concurrency=%u iterations=%u rate=%s transport=%s\n",
+            sessions.size(),
+            options.Concurrency,
+            options.Iterations,
+            options.Rate > 0 ? std::to_string(options.Rate).c_str() : "unlimited",
+            options.Transport == TransportKind::Pipe ? "pipe" : "in-memory");
+        printf("%-22s %8s %7s %10s %10s %10s %10s\n", "command", "count", "errors", "p50_ms", "p95_ms", "p99_ms", "max_ms");
+        for (auto& [command, samples] : merged)
+        {
+            std::sort(samples.LatencyMicros.begin(), samples.LatencyMicros.end());
+            printf("%-22s %8zu %7llu %10.3f %10.3f %10.3f %10.3f\n",
+                command.c_str(),
+                samples.LatencyMicros.size(),
+                static_cast<unsigned long long>(samples.Errors),
+                Percentile(samples.LatencyMicros, 0.50),
+                Percentile(samples.LatencyMicros, 0.95),
+                Percentile(samples.LatencyMicros, 0.99),
+                samples.LatencyMicros.empty() ? 0.0 : static_cast<double>(samples.LatencyMicros.back()) / 1000.0);
+        }
+        printf("total_requests=%llu events=%llu resync_jobs=%llu elapsed_s=%.3f throughput_msgs_per_sec=%.1f protocol_failures=%llu\n",
+            static_cast<unsigned long long>(totalRequests),
+            static_cast<unsigned long long>(totalEvents),
+            static_cast<unsigned long long>(vault.ResyncCount()),
+            elapsedSeconds,
+            elapsedSeconds > 0 ? static_cast<double>(totalRequests) / elapsedSeconds : 0.0,
+            static_cast<unsigned long long>(protocolFailures));
+        return protocolFailures == 0 ? 0 : 1;
+    }
+
+    // プロトコルの基本動作を in-memory transport 越しに確認する。
+    bool RunSelfTest(std::string& outError)
+    {
+        std::wstring codecError;
+        if (!RunNativeMessagingJsonRegressionTests(codecError))
+        {
+            outError = "codec regression test failed";
+            return false;
+        }
+
+        loadtest::StubVaultOptions stubOptions{};
+        stubOptions.LenientItemIds = false;
+        stubOptions.SeedItemCount = 1;
+        stubOptions.ResyncStageLatency = std::chrono::milliseconds(20);
+        loadtest::StubNativeHostVault vault(stubOptions);
+        HostConnection connection(vault, TransportKind::InMemory);
+        INativeMessageTransport& transport = connection.Client();
+        std::string receive;
+        Utf8JsonReader reader;
+        uint64_t progressEvents = 0;
+        uint64_t completedEvents = 0;
+        std::vector<std::string> changedItemIds;
+        std::vector<std::string> deletedItemIds;
+        auto collectVaultChanged = [&]()
+        {
+            size_t payload = 0;
+            size_t ids = 0;
+            std::string itemId;
+            if (!reader.TryGetObject(Utf8JsonReader::Root, "payload", payload))
+            {
+                return;
+            }
+            for (auto [key, target] : { std::pair{ "changedItemIds", &changedItemIds }, std::pair{ "deletedItemIds", &deletedItemIds } })
+            {
+                if (!reader.TryGetArray(payload, key, ids))
+                {
+                    continue;
+                }
+                for (size_t child = reader.FirstChild(ids); child != Utf8JsonReader::npos; child = reader.NextSibling(ids, child))
+                {
+                    if (reader.DecodeStringUtf8(child, itemId))
+                    {
+                        target->push_back(itemId);
+                    }
+                }
+            }
+        };
+
+        auto call = [&](std::string_view request) -> bool
+        {
+            if (!WriteNativeMessageFrame(transport, request))
+            {
+                return false;
+            }
+            while (true)
+            {
+                if (ReadNativeMessageFrame(transport, receive, kMaxMessageBytes) != NativeFrameReadResult::Ok || !reader.Parse(receive))
+                {
+                    return false;
+                }
+                std::string eventName;
+                if (reader.TryGetStringUtf8(Utf8JsonReader::Root, "event", eventName))
+                {
+                    progressEvents += eventName == "vault.sync.progress" ? 1 : 0;
+                    completedEvents += eventName == "vault.sync.completed" ? 1 : 0;
+                    if (eventName == "vault.changed")
+                    {
+                        collectVaultChanged();
+                    }
+                    continue;
+                }
+                return true;
+            }
+        };
+        auto expectOk = [&](std::string_view request, bool expected, char const* step) -> bool
+        {
+            bool ok = !expected;
+            if (!call(request) || !reader.TryGetBool(Utf8JsonReader::Root, "ok", ok) || ok != expected)
+            {
+                outError = step;
+                return false;
+            }
+            return true;
+        };
+        auto resultString = [&](std::string_view key) -> std::string
+        {
+            size_t result = 0;
+            std::string value;
+            if (reader.TryGetObject(Utf8JsonReader::Root, "result", result))
+            {
+                (void)reader.TryGetStringUtf8(result, key, value);
+            }
+            return value;
+        };
+        auto errorCode = [&]() -> std::string
+        {
+            size_t error = 0;
+            std::string value;
+            if (reader.TryGetObject(Utf8JsonReader::Root, "error", error))
+            {
+                (void)reader.TryGetStringUtf8(error, "code", value);
+            }
+            return value;
+        };
+
+        if (!expectOk(R"({"id":"t-1","version":1,"command":"vault.status.get","payload":{}})", true, "status"))
+        {
+            return false;
+        }
+        std::string id;
+        if (!reader.TryGetStringUtf8(Utf8JsonReader::Root, "id", id) || id != "t-1")
+        {
+            outError = "id_echo";
+            return false;
+        }
+
+        if (!expectOk(R"({"id":"t-2","version":1,"command":"vault.login.save","payload":{"title":"T","username":"u","password":"p\"w","url":"https://t.example","resync":false}})", true, "save"))
+        {
+            return false;
+        }
+        std::string savedId = resultString("itemId");
+        if (savedId.empty() || resultString("sync") != "none")
+        {
+            outError = "save_item_id";
+            return false;
+        }
+
+        std::string get = R"({"id":"t-3","version":1,"command":"vault.login.get","payload":{"itemId":")" + savedId + R"(","includeSecret":true}})";
+        if (!expectOk(get, true, "get"))
+        {
+            return false;
+        }
+        size_t result = 0;
+        size_t item = 0;
+        std::wstring password;
+        if (!reader.TryGetObject(Utf8JsonReader::Root, "result", result) ||
+            !reader.TryGetObject(result, "item", item) ||
+            !reader.TryGetString(item, "password", password) ||
+            password != L"p\"w")
+        {
+            outError = "get_password_roundtrip";
+            return false;
+        }
+
+        std::string del = R"({"id":"t-4","version":1,"command":"vault.login.delete","payload":{"itemId":")" + savedId + R"(","resync":false}})";
+        if (!expectOk(del, true, "delete"))
+        {
+            return false;
+        }
+        if (resultString("sync") != "none")
+        {
+            outError = "delete_sync_state";
+            return false;
+        }
+        if (!expectOk(get, false, "get_after_delete") || errorCode() != "not_found")
+        {
+            outError = "get_after_delete_code";
+            return false;
+        }
+
+        // save/delete は debounce 後に vault.changed で通知される。
+        auto contains = [](std::vector<std::string> const& ids, std::string const& id)
+        {
+            return std::find(ids.begin(), ids.end(), id) != ids.end();
+        };
+        while (!contains(deletedItemIds, savedId))
+        {
+            std::string eventName;
+            if (ReadNativeMessageFrame(transport, receive, kMaxMessageBytes) != NativeFrameReadResult::Ok ||
+                !reader.Parse(receive) ||
+                !reader.TryGetStringUtf8(Utf8JsonReader::Root, "event", eventName) ||
+                eventName != "vault.changed")
+            {
+                outError = "vault_changed_missing";
+                return false;
+            }
+            collectVaultChanged();
+        }
+        if (contains(changedItemIds, "stub-item-000001"))
+        {
+            outError = "vault_changed_unrelated_item";
+            return false;
+        }
+
+        if (!expectOk(R"({"id":"t-5","version":1,"command":"vault.login.update","payload":{"itemId":"x"}})", false, "update_invalid") ||
+            errorCode() != "invalid_request")
+        {
+            outError = "update_invalid_code";
+            return false;
+        }
+        // resync の同期は予約しただけなので、応答は同期の成功ではなく予約を返す。
+        if (!expectOk(R"({"id":"t-5b","version":1,"command":"vault.login.update","payload":{"itemId":"stub-item-000001","title":"T","username":"u","password":"p","resync":true}})", true, "update_resync") ||
+            resultString("sync") != "queued")
+        {
+            outError = "update_sync_queued";
+            return false;
+        }
+        if (!expectOk(R"({"id":"t-6","version":1,"command":"vault.unknown","payload":{}})", false, "unknown_command"))
+        {
+            return false;
+        }
+        if (!expectOk(R"({"id":"t-7",)", false, "malformed_json"))
+        {
+            return false;
+        }
+
+        if (!expectOk(R"({"id":"t-8","version":1,"command":"vault.sync.resync","payload":{}})", true, "resync"))
+        {
+            return false;
+        }
+        std::string jobId = resultString("jobId");
+        if (!expectOk(R"({"id":"t-9","version":1,"command":"vault.sync.resync","payload":{}})", true, "resync_coalesce"))
+        {
+            return false;
+        }
+        bool coalesced = false;
+        if (jobId.empty() ||
+            resultString("jobId") != jobId ||
+            !reader.TryGetObject(Utf8JsonReader::Root, "result", result) ||
+            !reader.TryGetBool(result, "coalesced", coalesced) ||
+            !coalesced)
+        {
+            outError = "resync_not_coalesced";
+            return false;
+        }
+
+        // get は成功 1 回 + not_found 1 回。reset 付きで読んだ後は 0 に戻る。
+        auto metricsCount = [&](char const* group, char const* name, char const* key) -> int64_t
+        {
+            size_t metricsResult = 0;
+            size_t groupIndex = 0;
+            size_t entry = 0;
+            int64_t value = -1;
+            if (reader.TryGetObject(Utf8JsonReader::Root, "result", metricsResult) &&
+                reader.TryGetObject(metricsResult, group, groupIndex) &&
+                reader.TryGetObject(groupIndex, name, entry))
+            {
+                (void)reader.TryGetInt64(entry, key, value);
+            }
+            return value;
+        };
+        NativeHostMetrics::getInstance().Read(true);
+        (void)call(get);
+        (void)call(get);
+        if (!expectOk(R"({"id":"t-10","version":1,"command":"vault.host.metrics","payload":{"reset":true}})", true, "metrics") ||
+            metricsCount("commands", "vault.login.get", "count") != 2 ||
+            metricsCount("commands", "vault.login.get", "errors") != 2 ||
+            metricsCount("phases", "request_parse", "count") < 3)
+        {
+            outError = "metrics_counts";
+            return false;
+        }
+        if (!expectOk(R"({"id":"t-11","version":1,"command":"vault.host.metrics","payload":{"includeBuckets":true}})", true, "metrics_after_reset") ||
+            metricsCount("commands", "vault.login.get", "count") != 0 ||
+            metricsCount("commands", "vault.host.metrics", "count") != 1)
+        {
+            outError = "metrics_reset";
+            return false;
+        }
+
+        connection.CloseClientWrite();
+        while (ReadNativeMessageFrame(transport, receive, kMaxMessageBytes) == NativeFrameReadResult::Ok && reader.Parse(receive))
+        {
+            std::string eventName;
+            if (reader.TryGetStringUtf8(Utf8JsonReader::Root, "event", eventName))
+            {
+                progressEvents += eventName == "vault.sync.progress" ? 1 : 0;
+                completedEvents += eventName == "vault.sync.completed" ? 1 : 0;
+            }
+        }
+        // started + read_local/pull_server/merge/push
+        if (completedEvents != 1 || progressEvents != 5 || vault.ResyncCount() != 1)
+        {
+            outError = "resync_events progress=" + std::to_string(progressEvents) + " completed=" + std::to_string(completedEvents);
+            return false;
+        }
+        return true;
+    }
+
+    void PrintUsage()
+    {
+        fprintf(stderr,
+            "usage: native_host_loadtest [options] [session.jsonl ...]\n"
+            "  --concurrency N        parallel extension connections (default 4)\n"
+            "  --rate R               total requests per second, 0 = unlimited (default 0)\n"
+            "  --iterations N         times each connection replays its session (default 10)\n"
+            "  --respect-timing       replay with the recorded atMs gaps\n"
+            "  --speed X              time scale for --respect-timing (default 1.0)\n"
+            "  --transport T          in-memory | pipe (default in-memory)\n"
+            "  --stub-read-us N       simulated vault read latency\n"
+            "  --stub-write-us N      simulated vault write latency\n"
+            "  --stub-resync-us N     simulated latency per resync stage\n"
+            "  --stub-items N         items seeded into the stub vault (default 100)\n"
+            "  --strict-stub          unknown itemIds return not_found instead of being created\n"
+            "  --self-test            run protocol self-test and exit\n");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    LoadTestOptions options{};
+    options.Stub.SeedItemCount = 100;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view arg = argv[i];
+        auto next = [&]() -> char const*
+        {
+            if (i + 1 >= argc)
+            {
+                PrintUsage();
+                exit(2);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--self-test")
+        {
+            std::string error;
+            if (!RunSelfTest(error))
+            {
+                fprintf(stderr, "self-test FAILED: %s\n", error.c_str());
+                return 1;
+            }
+            printf("self-test passed\n");
+            return 0;
+        }
+        else if (arg == "--concurrency")
+        {
+            options.Concurrency = static_cast<uint32_t>(std::max(1, atoi(next())));
+        }
+        else if (arg == "--rate")
+        {
+            options.Rate = atof(next());
+        }
+        else if (arg == "--iterations")
+        {
+            options.Iterations = static_cast<uint32_t>(std::max(1, atoi(next())));
+        }
+        else if (arg == "--respect-timing")
+        {
+            options.RespectTiming = true;
+        }
+        else if (arg == "--speed")
+        {
+            options.Speed = atof(next());
+        }
+        else if (arg == "--transport")
+        {
+            std::string_view value = next();
+            if (value == "pipe")
+            {
+                options.Transport = TransportKind::Pipe;
+            }
+            else if (value == "in-memory")
+            {
+                options.Transport = TransportKind::InMemory;
+            }
+            else
+            {
+                PrintUsage();
+                return 2;
+            }
+        }
+        else if (arg == "--stub-read-us")
+        {
+            options.Stub.ReadLatency = std::chrono::microseconds(atoll(next()));
+        }
+        else if (arg == "--stub-write-us")
+        {
+            options.Stub.WriteLatency = std::chrono::microseconds(atoll(next()));
+        }
+        else if (arg == "--stub-resync-us")
+        {
+            options.Stub.ResyncStageLatency = std::chrono::microseconds(atoll(next()));
+        }
+        else if (arg == "--stub-items")
+        {
+            options.Stub.SeedItemCount = static_cast<size_t>(std::max(0, atoi(next())));
+        }
+        else if (arg == "--strict-stub")
+        {
+            options.Stub.LenientItemIds = false;
+        }
+        else if (arg == "--help" || arg == "-h")
+        {
+            PrintUsage();
+            return 0;
+        }
+        else if (!arg.empty() && arg.front() == '-')
+        {
+            PrintUsage();
+            return 2;
+        }
+        else
+        {
+            options.SessionPaths.emplace_back(arg);
+        }
+    }
+
+    return RunLoadTest(options);
+}
@@ -0,0 +1,234 @@
+#include "StubNativeHostVault.h"
+
+#include <cwchar>
+#include <ctime>
+#include <thread>
+
+namespace tsupasswd::loadtest
+{
+    namespace
+    {
+        constexpr int32_t kStubDetailNotFound = static_cast<int32_t>(0x80070490);
+
+        void SimulateLatency(std::chrono::microseconds latency)
+        {
+            if (latency.count() > 0)
+            {
+                std::this_thread::sleep_for(latency);
+            }
+        }
+
+        std::wstring FormatItemId(uint64_t number)
+        {
+            wchar_t buffer[32]{};
+            swprintf(buffer, sizeof(buffer) / sizeof(buffer[0]), L"stub-item-%06llu", static_cast<unsigned long long>(number));
+            return buffer;
+        }
+    }
+
+    StubNativeHostVault::StubNativeHostVault(StubVaultOptions options) :
+        m_options(options)
+    {
+        std::wstring now = NowTimestamp();
+        for (size_t i = 0; i < m_options.SeedItemCount; ++i)
+        {
+            VaultItemV1 item{};
+            item.ItemId = FormatItemId(m_nextItemNumber++);
+            item.ItemType = VaultItemType::Login;
+            item.Title = L"Seed " + std::to_wstring(i);
+            item.Login.Username = L"user" + std::to_wstring(i) + L"@example.com";
+            item.Login.Password = L"seed-password-" + std::to_wstring(i);
+            item.Login.Url = L"https://seed" + std::to_wstring(i) + L".example.com/login";
+            item.CreatedAt = now;
+            item.UpdatedAt = now;
+            m_items.emplace(item.ItemId, item);
+        }
+    }
+
+    std::wstring StubNativeHostVault::NowTimestamp()
+    {
+        std::time_t seconds = std::time(nullptr);
+        std::tm utc{};
+#ifdef _WIN32
+        gmtime_s(&utc, &seconds);
+#else
+        gmtime_r(&seconds, &utc);
+#endif
+        wchar_t buffer[32]{};
+        std::wcsftime(buffer, sizeof(buffer) / sizeof(buffer[0]), L"%Y-%m-%dT%H:%M:%SZ", &utc);
+        return buffer;
+    }
+
+    void StubNativeHostVault::ApplyFields(VaultItemV1& item, NativeHostLoginFields const& fields)
+    {
+        item.Title = fields.Title;
+        item.Login.Username = fields.Username;
+        item.Login.Password = fields.Password;
+        item.Login.Url = fields.Url;
+        item.Notes = fields.Notes;
+        item.UpdatedAt = NowTimestamp();
+    }
+
+    VaultItemV1& StubNativeHostVault::UpsertLocked(std::wstring const& itemId)
+    {
+        auto [it, inserted] = m_items.try_emplace(itemId);
+        if (inserted)
+        {
+            it->second.ItemId = itemId;
+            it->second.ItemType = VaultItemType::Login;
+            it->second.Title = L"Replayed " + itemId;
+            it->second.Login.Username = L"replay@example.com";
+            it->second.Login.Password = L"replay-password";
+            it->second.CreatedAt = NowTimestamp();
+            it->second.UpdatedAt = it->second.CreatedAt;
+        }
+        return it->second;
+    }
+
+    NativeHostResult StubNativeHostVault::GetStatus(NativeHostVaultStatus& outStatus)
+    {
+        outStatus.VaultLocked = false;
+        outStatus.SilentOperation = true;
+        outStatus.RecoveryCodeAvailable = true;
+        outStatus.SyncConfigured = true;
+        return NativeHostResult::Success();
+    }
+
+    NativeHostResult StubNativeHostVault::LoadVaultDocument(std::wstring const&, VaultDocumentV1& outDoc)
+    {
+        SimulateLatency(m_options.ReadLatency);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        outDoc = {};
+        outDoc.VaultId = L"stub-vault";
+        outDoc.Revision = m_revision;
+        outDoc.Items.reserve(m_items.size());
+        for (auto const& [itemId, item] : m_items)
+        {
+            outDoc.Items.push_back(item);
+        }
+        return NativeHostResult::Success();
+    }
+
+    NativeHostResult StubNativeHostVault::GetLoginItem(std::wstring const& itemId, std::wstring const&, VaultItemV1& outItem)
+    {
+        SimulateLatency(m_options.ReadLatency);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_items.find(itemId);
+        if (it == m_items.end() || it->second.Deleted)
+        {
+            if (!m_options.LenientItemIds)
+            {
+                return NativeHostResult::Failure(NativeHostErrorCode::NotFound, kStubDetailNotFound);
+            }
+            VaultItemV1& item = UpsertLocked(itemId);
+            item.Deleted = false;
+            outItem = item;
+            return NativeHostResult::Success();
+        }
+        outItem = it->second;
+        return NativeHostResult::Success();
+    }
+
+    NativeHostResult StubNativeHostVault::SaveLoginItem(NativeHostLoginFields const& fields, bool, std::wstring const&, std::wstring& outItemId)
+    {
+        SimulateLatency(m_options.WriteLatency);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            VaultItemV1& item = UpsertLocked(FormatItemId(m_nextItemNumber++));
+            ApplyFields(item, fields);
+            ++m_revision;
+            outItemId = item.ItemId;
+        }
+        NotifyChanged();
+        return NativeHostResult::Success();
+    }
+
+    NativeHostResult StubNativeHostVault::UpdateLoginItem(std::wstring const& itemId, NativeHostLoginFields const& fields, bool, std::wstring const&)
+    {
+        SimulateLatency(m_options.WriteLatency);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_items.find(itemId);
+            if ((it == m_items.end() || it->second.Deleted) && !m_options.LenientItemIds)
+            {
+                return NativeHostResult::Failure(NativeHostErrorCode::NotFound, kStubDetailNotFound);
+            }
+            VaultItemV1& item = UpsertLocked(itemId);
+            item.Deleted = false;
+            ApplyFields(item, fields);
+            ++m_revision;
+        }
+        NotifyChanged();
+        return NativeHostResult::Success();
+    }
+
+    NativeHostResult StubNativeHostVault::DeleteLoginItem(std::wstring const& itemId, bool, std::wstring const&)
+    {
+        SimulateLatency(m_options.WriteLatency);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_items.find(itemId);
+            if ((it == m_items.end() || it->second.Deleted) && !m_options.LenientItemIds)
+            {
+                return NativeHostResult::Failure(NativeHostErrorCode::NotFound, kStubDetailNotFound);
+            }
+            VaultItemV1& item = UpsertLocked(itemId);
+            item.Deleted = true;
+            item.DeletedAt = NowTimestamp();
+            item.UpdatedAt = item.DeletedAt;
+            ++m_revision;
+        }
+        NotifyChanged();
+        return NativeHostResult::Success();
+    }
+
+    NativeHostResult StubNativeHostVault::Resync(
+        std::wstring const&,
+        VaultMergeStats& outStats,
+        std::function<void(std::wstring const&)> const& progress)
+    {
+        outStats = {};
+        for (wchar_t const* stage : { L"read_local", L"pull_server", L"merge", L"push" })
+        {
+            if (progress)
+            {
+                progress(stage);
+            }
+            SimulateLatency(m_options.ResyncStageLatency);
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_resyncCount;
+        return NativeHostResult::Success();
+    }
+
+    uint64_t StubNativeHostVault::StartChangeWatch(std::function<void()> onChanged)
+    {
+        std::lock_guard<std::mutex> lock(m_watchMutex);
+        uint64_t watchId = m_nextWatchId++;
+        m_watchers.emplace(watchId, std::move(onChanged));
+        return watchId;
+    }
+
+    void StubNativeHostVault::StopChangeWatch(uint64_t watchId)
+    {
+        std::lock_guard<std::mutex> lock(m_watchMutex);
+        m_watchers.erase(watchId);
+    }
+
+    void StubNativeHostVault::NotifyChanged()
+    {
+        // 本番の registry 通知と同じく、書き込んだ接続を含む全 watcher に通知する。
+        std::lock_guard<std::mutex> lock(m_watchMutex);
+        for (auto const& [watchId, onChanged] : m_watchers)
+        {
+            onChanged();
+        }
+    }
+
+    uint64_t StubNativeHostVault::ResyncCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_resyncCount;
+    }
+}
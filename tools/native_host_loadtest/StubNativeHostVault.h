@@ -0,0 +1,65 @@
+#pragma once
+
+#include "NativeMessagingCore.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace tsupasswd::loadtest
+{
+    struct StubVaultOptions
+    {
+        // 各操作で擬似的に待つ時間。registry 読み書き + 復号のコストの代わり。
+        std::chrono::microseconds ReadLatency{ 0 };
+        std::chrono::microseconds WriteLatency{ 0 };
+        std::chrono::microseconds ResyncStageLatency{ 0 };
+        // true のとき、記録済みセッションを空の vault にリプレイできるよう、未知の itemId への
+        // get/update/delete を作成扱いにする。self-test では false。
+        bool LenientItemIds{ true };
+        size_t SeedItemCount{ 0 };
+    };
+
+    // 負荷試験/自己テスト用のインメモリ vault。複数の host core から同時に呼ばれてよい。
+    class StubNativeHostVault final : public INativeHostVault
+    {
+    public:
+        explicit StubNativeHostVault(StubVaultOptions options);
+
+        NativeHostResult GetStatus(NativeHostVaultStatus& outStatus) override;
+        NativeHostResult LoadVaultDocument(std::wstring const& requestId, VaultDocumentV1& outDoc) override;
+        NativeHostResult GetLoginItem(std::wstring const& itemId, std::wstring const& requestId, VaultItemV1& outItem) override;
+        NativeHostResult SaveLoginItem(NativeHostLoginFields const& fields, bool resync, std::wstring const& requestId, std::wstring& outItemId) override;
+        NativeHostResult UpdateLoginItem(std::wstring const& itemId, NativeHostLoginFields const& fields, bool resync, std::wstring const& requestId) override;
+        NativeHostResult DeleteLoginItem(std::wstring const& itemId, bool resync, std::wstring const& requestId) override;
+        NativeHostResult Resync(
+            std::wstring const& requestId,
+            VaultMergeStats& outStats,
+            std::function<void(std::wstring const&)> const& progress) override;
+
+        uint64_t StartChangeWatch(std::function<void()> onChanged) override;
+        void StopChangeWatch(uint64_t watchId) override;
+
+        uint64_t ResyncCount() const;
+
+    private:
+        VaultItemV1& UpsertLocked(std::wstring const& itemId);
+        static void ApplyFields(VaultItemV1& item, NativeHostLoginFields const& fields);
+        static std::wstring NowTimestamp();
+        void NotifyChanged();
+
+        StubVaultOptions m_options;
+        mutable std::mutex m_mutex;
+        std::map<std::wstring, VaultItemV1> m_items;
+        int64_t m_revision{ 0 };
+        uint64_t m_nextItemNumber{ 1 };
+        uint64_t m_resyncCount{ 0 };
+
+        std::mutex m_watchMutex;
+        std::map<uint64_t, std::function<void()>> m_watchers;
+        uint64_t m_nextWatchId{ 1 };
+    };
+}
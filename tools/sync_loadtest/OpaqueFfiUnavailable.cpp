@@ -0,0 +1,101 @@
+// opaque-ffi の Linux 向けライブラリは同梱していない (vendor/opaque-ffi/lib は Windows 版のみ) ため、
+// 負荷試験ツールでは client/server 側の関数を「使えない」として失敗させる。
+// SyncClient の OpaqueLogin/OpaqueRegister は OPAQUE_CLIENT_ERROR を返し、dev login 経路だけが動く。
+// スタンドインサーバーの OPAQUE の route は 503 OPAQUE_UNAVAILABLE を返す。
+// Linux 向けにビルドした opaque-ffi があれば TSUPASSWD_OPAQUE_FFI_LIBRARY で差し替える (CMakeLists.txt)。
+
+#include "tsupasswd_opaque_ffi.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+    constexpr char kUnavailable[] = "opaque-ffi is not available in this build";
+
+    bool Unavailable(ByteBuffer* first, ByteBuffer* second)
+    {
+        if (first)
+        {
+            *first = ByteBuffer{ nullptr, 0 };
+        }
+        if (second)
+        {
+            *second = ByteBuffer{ nullptr, 0 };
+        }
+        return false;
+    }
+}
+
+extern "C"
+{
+    void tsupasswd_opaque_free_bytes(ByteBuffer buf)
+    {
+        std::free(buf.ptr);
+    }
+
+    void tsupasswd_opaque_free_cstring(char* s)
+    {
+        std::free(s);
+    }
+
+    char* tsupasswd_opaque_last_error(void)
+    {
+        char* message = static_cast<char*>(std::malloc(sizeof(kUnavailable)));
+        if (message)
+        {
+            std::memcpy(message, kUnavailable, sizeof(kUnavailable));
+        }
+        return message;
+    }
+
+    const char* tsupasswd_opaque_version(void)
+    {
+        return "unavailable";
+    }
+
+    bool tsupasswd_opaque_client_register_start(const uint8_t*, size_t, ByteBuffer* out_client_state, ByteBuffer* out_registration_request)
+    {
+        return Unavailable(out_client_state, out_registration_request);
+    }
+
+    bool tsupasswd_opaque_client_register_finish(const uint8_t*, size_t, const ByteBuffer*, const ByteBuffer*, ByteBuffer* out_registration_upload, ByteBuffer* out_session_key)
+    {
+        return Unavailable(out_registration_upload, out_session_key);
+    }
+
+    bool tsupasswd_opaque_client_login_start(const uint8_t*, size_t, ByteBuffer* out_client_state, ByteBuffer* out_credential_request)
+    {
+        return Unavailable(out_client_state, out_credential_request);
+    }
+
+    bool tsupasswd_opaque_client_login_finish(const uint8_t*, size_t, const ByteBuffer*, const ByteBuffer*, ByteBuffer* out_credential_finalization, ByteBuffer* out_session_key)
+    {
+        return Unavailable(out_credential_finalization, out_session_key);
+    }
+
+    bool tsupasswd_opaque_server_setup_new(ByteBuffer* out_server_setup)
+    {
+        return Unavailable(out_server_setup, nullptr);
+    }
+
+    bool tsupasswd_opaque_server_register_start(const ByteBuffer*, const ByteBuffer*, const uint8_t*, size_t, ByteBuffer* out_registration_response)
+    {
+        return Unavailable(out_registration_response, nullptr);
+    }
+
+    bool tsupasswd_opaque_server_register_finish(const ByteBuffer*, ByteBuffer* out_password_file)
+    {
+        return Unavailable(out_password_file, nullptr);
+    }
+
+    bool tsupasswd_opaque_server_login_start(const ByteBuffer*, const ByteBuffer*, const ByteBuffer*, const uint8_t*, size_t, ByteBuffer* out_server_state, ByteBuffer* out_credential_response)
+    {
+        return Unavailable(out_server_state, out_credential_response);
+    }
+
+    bool tsupasswd_opaque_server_login_finish(const ByteBuffer*, const ByteBuffer*, ByteBuffer* out_session_key)
+    {
+        return Unavailable(out_session_key, nullptr);
+    }
+}
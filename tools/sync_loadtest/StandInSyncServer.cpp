@@ -0,0 +1,1190 @@
+#include "StandInSyncServer.h"
+
+#include "NativeMessagingJson.h"
+#include "tsupasswd_opaque_raii.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <ctime>
+#include <set>
+#include <string_view>
+
+namespace tsupasswd::loadtest
+{
+    namespace
+    {
+        constexpr int kPollIntervalMs = 100;
+        constexpr size_t kMaxHeaderBytes = 64 * 1024;
+        constexpr size_t kMaxBodyBytes = 64 * 1024 * 1024;
+        constexpr std::string_view kTokenPrefix = "standin.";
+        // sync-axum-api の GET v1/vaults/{email}/changes と同じ既定値と上限。
+        constexpr size_t kMaxItemsPerWrite = 1000;
+        constexpr int64_t kDefaultChangesLimit = 500;
+        constexpr int64_t kMaxChangesLimit = 1000;
+
+        bool EqualsIgnoreCase(std::string_view a, std::string_view b)
+        {
+            if (a.size() != b.size())
+            {
+                return false;
+            }
+            for (size_t i = 0; i < a.size(); ++i)
+            {
+                char x = a[i];
+                char y = b[i];
+                x = (x >= 'A' && x <= 'Z') ? static_cast<char>(x - 'A' + 'a') : x;
+                y = (y >= 'A' && y <= 'Z') ? static_cast<char>(y - 'A' + 'a') : y;
+                if (x != y)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        std::string_view Trim(std::string_view value)
+        {
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            {
+                value.remove_prefix(1);
+            }
+            while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+            {
+                value.remove_suffix(1);
+            }
+            return value;
+        }
+
+        std::string NowRfc3339()
+        {
+            std::time_t now = std::time(nullptr);
+            std::tm utc{};
+            gmtime_r(&now, &utc);
+            char buffer[32]{};
+            std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S+00:00", &utc);
+            return buffer;
+        }
+
+        std::string ErrorBody(std::string_view code, std::string_view message)
+        {
+            Utf8JsonWriter writer;
+            writer.BeginObject();
+            writer.Key("code");
+            writer.StringUtf8(code);
+            writer.Key("message");
+            writer.StringUtf8(message);
+            writer.EndObject();
+            return std::string(writer.View());
+        }
+
+        char const* ReasonPhrase(int32_t statusCode)
+        {
+            switch (statusCode)
+            {
+            case 200: return "OK";
+            case 304: return "Not Modified";
+            case 400: return "Bad Request";
+            case 401: return "Unauthorized";
+            case 403: return "Forbidden";
+            case 404: return "Not Found";
+            case 409: return "Conflict";
+            case 415: return "Unsupported Media Type";
+            case 503: return "Service Unavailable";
+            default: return "Internal Server Error";
+            }
+        }
+
+        constexpr char kBase64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+        // sync-axum-api と同じく DB には base64 で持つので、octet-stream の送受信時だけ変換する。
+        std::string Base64Encode(std::string_view bytes)
+        {
+            std::string out;
+            out.reserve(((bytes.size() + 2) / 3) * 4);
+            for (size_t i = 0; i < bytes.size(); i += 3)
+            {
+                uint32_t triple = static_cast<uint32_t>(static_cast<uint8_t>(bytes[i])) << 16;
+                if (i + 1 < bytes.size())
+                {
+                    triple |= static_cast<uint32_t>(static_cast<uint8_t>(bytes[i + 1])) << 8;
+                }
+                if (i + 2 < bytes.size())
+                {
+                    triple |= static_cast<uint8_t>(bytes[i + 2]);
+                }
+                out.push_back(kBase64Alphabet[(triple >> 18) & 0x3F]);
+                out.push_back(kBase64Alphabet[(triple >> 12) & 0x3F]);
+                out.push_back(i + 1 < bytes.size() ? kBase64Alphabet[(triple >> 6) & 0x3F] : '=');
+                out.push_back(i + 2 < bytes.size() ? kBase64Alphabet[triple & 0x3F] : '=');
+            }
+            return out;
+        }
+
+        bool Base64Decode(std::string_view b64, std::string& out)
+        {
+            out.clear();
+            out.reserve((b64.size() / 4) * 3);
+            uint32_t accumulator = 0;
+            int bits = 0;
+            for (char c : b64)
+            {
+                if (c == '=')
+                {
+                    break;
+                }
+                char const* position = std::strchr(kBase64Alphabet, c);
+                if (c == '\0' || !position)
+                {
+                    return false;
+                }
+                accumulator = (accumulator << 6) | static_cast<uint32_t>(position - kBase64Alphabet);
+                bits += 6;
+                if (bits >= 8)
+                {
+                    bits -= 8;
+                    out.push_back(static_cast<char>((accumulator >> bits) & 0xFF));
+                }
+            }
+            return true;
+        }
+
+        std::string TokenBody(std::string const& email)
+        {
+            Utf8JsonWriter writer;
+            writer.BeginObject();
+            writer.Key("access_token");
+            writer.StringUtf8(std::string(kTokenPrefix) + email);
+            writer.Key("token_type");
+            writer.StringUtf8("Bearer");
+            writer.Property("expires_in", int64_t{ 3600 });
+            writer.EndObject();
+            return std::string(writer.View());
+        }
+
+        // OPAQUE の要求本文から email と base64 のフィールドを読み、フィールドはデコードして返す。
+        // 読めなければ 400 で返す code。
+        char const* ReadOpaqueRequest(std::string const& body, std::string& email, std::initializer_list<std::pair<char const*, std::string*>> fields)
+        {
+            Utf8JsonReader reader;
+            if (!reader.Parse(body) || !reader.TryGetStringUtf8(Utf8JsonReader::Root, "email", email) || email.empty())
+            {
+                return "INVALID_EMAIL";
+            }
+            for (auto const& [name, decoded] : fields)
+            {
+                std::string encoded;
+                if (!reader.TryGetStringUtf8(Utf8JsonReader::Root, name, encoded) || !Base64Decode(encoded, *decoded))
+                {
+                    return "INVALID_REQUEST";
+                }
+            }
+            return nullptr;
+        }
+
+        ByteBuffer AsByteBuffer(std::string& bytes)
+        {
+            return ByteBuffer{ reinterpret_cast<uint8_t*>(bytes.data()), bytes.size() };
+        }
+
+        std::string_view AsStringView(tsupasswd::opaque::ByteBufferOwner const& bytes)
+        {
+            return std::string_view(reinterpret_cast<char const*>(bytes.data()), bytes.size());
+        }
+
+        bool TakeOne(std::atomic<uint32_t>& counter)
+        {
+            uint32_t remaining = counter.load(std::memory_order_relaxed);
+            while (remaining > 0)
+            {
+                if (counter.compare_exchange_weak(remaining, remaining - 1, std::memory_order_relaxed))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool SendAll(int socket, std::string_view data)
+        {
+            while (!data.empty())
+            {
+                ssize_t sent = ::send(socket, data.data(), data.size(), MSG_NOSIGNAL);
+                if (sent < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (sent <= 0)
+                {
+                    return false;
+                }
+                data.remove_prefix(static_cast<size_t>(sent));
+            }
+            return true;
+        }
+    }
+
+    StandInSyncServer::StandInSyncServer(StandInServerOptions options) :
+        m_options(options),
+        m_faultRandom(options.FaultSeed)
+    {
+    }
+
+    StandInSyncServer::~StandInSyncServer()
+    {
+        Stop();
+    }
+
+    bool StandInSyncServer::Start(std::string& outError)
+    {
+        // opaque-ffi がなければ OPAQUE の route だけ使えない。
+        tsupasswd::opaque::ByteBufferOwner serverSetup;
+        if (m_opaqueServerSetup.empty() && tsupasswd_opaque_server_setup_new(serverSetup.out_ptr()))
+        {
+            m_opaqueServerSetup.assign(serverSetup.data(), serverSetup.data() + serverSetup.size());
+        }
+
+        m_listenSocket = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (m_listenSocket < 0)
+        {
+            outError = std::string("socket: ") + std::strerror(errno);
+            return false;
+        }
+
+        int reuse = 1;
+        (void)::setsockopt(m_listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        if (::bind(m_listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            ::listen(m_listenSocket, 128) != 0)
+        {
+            outError = std::string("bind/listen: ") + std::strerror(errno);
+            ::close(m_listenSocket);
+            m_listenSocket = -1;
+            return false;
+        }
+
+        socklen_t length = sizeof(address);
+        (void)::getsockname(m_listenSocket, reinterpret_cast<sockaddr*>(&address), &length);
+        m_port = ntohs(address.sin_port);
+        m_stopping = false;
+        m_acceptThread = std::thread([this]() { AcceptLoop(); });
+        return true;
+    }
+
+    void StandInSyncServer::Stop()
+    {
+        m_stopping = true;
+        if (m_acceptThread.joinable())
+        {
+            m_acceptThread.join();
+        }
+
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard lock(m_connectionsMutex);
+            threads.swap(m_connectionThreads);
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        if (m_listenSocket >= 0)
+        {
+            ::close(m_listenSocket);
+            m_listenSocket = -1;
+        }
+    }
+
+    std::wstring StandInSyncServer::BaseUrl() const
+    {
+        std::string url = "http://127.0.0.1:" + std::to_string(m_port);
+        return std::wstring(url.begin(), url.end());
+    }
+
+    void StandInSyncServer::CloseAfterNextResponses(uint32_t count)
+    {
+        m_closeAfterResponses.store(count, std::memory_order_relaxed);
+    }
+
+    bool StandInSyncServer::TakeCloseAfterResponse()
+    {
+        return TakeOne(m_closeAfterResponses);
+    }
+
+    void StandInSyncServer::InjectFault(StandInFault fault, uint32_t count)
+    {
+        m_pendingFaults[static_cast<size_t>(fault)].fetch_add(count, std::memory_order_relaxed);
+    }
+
+    bool StandInSyncServer::TakeFault(StandInFault fault, double rate)
+    {
+        bool take = TakeOne(m_pendingFaults[static_cast<size_t>(fault)]);
+        if (!take && rate > 0)
+        {
+            std::lock_guard lock(m_faultMutex);
+            take = std::uniform_real_distribution<double>(0.0, 1.0)(m_faultRandom) < rate;
+        }
+        if (take)
+        {
+            m_injectedFaultCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        return take;
+    }
+
+    std::chrono::microseconds StandInSyncServer::NextResponseLatency()
+    {
+        if (m_options.ResponseLatencyJitter.count() <= 0)
+        {
+            return m_options.ResponseLatency;
+        }
+        std::lock_guard lock(m_faultMutex);
+        std::uniform_int_distribution<int64_t> jitter(0, m_options.ResponseLatencyJitter.count());
+        return m_options.ResponseLatency + std::chrono::microseconds(jitter(m_faultRandom));
+    }
+
+    void StandInSyncServer::AcceptLoop()
+    {
+        while (!m_stopping)
+        {
+            pollfd pfd{ m_listenSocket, POLLIN, 0 };
+            int ready = ::poll(&pfd, 1, kPollIntervalMs);
+            if (ready <= 0)
+            {
+                continue;
+            }
+
+            int socket = ::accept4(m_listenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+            if (socket < 0)
+            {
+                continue;
+            }
+            int noDelay = 1;
+            (void)::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+            m_acceptCount.fetch_add(1, std::memory_order_relaxed);
+
+            std::lock_guard lock(m_connectionsMutex);
+            m_connectionThreads.emplace_back([this, socket]() { ServeConnection(socket); });
+        }
+    }
+
+    void StandInSyncServer::ServeConnection(int socket)
+    {
+        std::string buffer;
+        buffer.reserve(16 * 1024);
+        std::string responseText;
+        char chunk[16 * 1024];
+
+        // buffer に min バイト以上たまるまで読む。Stop か切断で false。
+        auto fill = [&](size_t min) -> bool
+        {
+            while (buffer.size() < min)
+            {
+                pollfd pfd{ socket, POLLIN, 0 };
+                int ready = ::poll(&pfd, 1, kPollIntervalMs);
+                if (m_stopping)
+                {
+                    return false;
+                }
+                if (ready <= 0)
+                {
+                    continue;
+                }
+                ssize_t received = ::recv(socket, chunk, sizeof(chunk), 0);
+                if (received < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (received <= 0)
+                {
+                    return false;
+                }
+                buffer.append(chunk, static_cast<size_t>(received));
+            }
+            return true;
+        };
+
+        for (;;)
+        {
+            size_t headerEnd = std::string::npos;
+            while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+            {
+                if (buffer.size() > kMaxHeaderBytes || !fill(buffer.size() + 1))
+                {
+                    ::close(socket);
+                    return;
+                }
+            }
+
+            HttpRequest request{};
+            size_t contentLength = 0;
+            std::string_view head(buffer.data(), headerEnd);
+            size_t lineEnd = head.find("\r\n");
+            std::string_view requestLine = head.substr(0, lineEnd);
+            size_t methodEnd = requestLine.find(' ');
+            size_t pathEnd = requestLine.rfind(' ');
+            if (methodEnd == std::string_view::npos || pathEnd <= methodEnd)
+            {
+                ::close(socket);
+                return;
+            }
+            request.Method.assign(requestLine.substr(0, methodEnd));
+            request.Path.assign(requestLine.substr(methodEnd + 1, pathEnd - methodEnd - 1));
+            request.KeepAlive = requestLine.substr(pathEnd + 1) != "HTTP/1.0";
+
+            std::string_view rest = lineEnd == std::string_view::npos ? std::string_view{} : head.substr(lineEnd + 2);
+            while (!rest.empty())
+            {
+                size_t end = rest.find("\r\n");
+                std::string_view line = rest.substr(0, end);
+                rest = end == std::string_view::npos ? std::string_view{} : rest.substr(end + 2);
+                size_t colon = line.find(':');
+                if (colon == std::string_view::npos)
+                {
+                    continue;
+                }
+                std::string_view name = line.substr(0, colon);
+                std::string_view value = Trim(line.substr(colon + 1));
+                if (EqualsIgnoreCase(name, "content-length"))
+                {
+                    (void)std::from_chars(value.data(), value.data() + value.size(), contentLength);
+                }
+                else if (EqualsIgnoreCase(name, "authorization"))
+                {
+                    request.Authorization.assign(value);
+                }
+                else if (EqualsIgnoreCase(name, "if-version"))
+                {
+                    request.IfVersion.assign(value);
+                }
+                else if (EqualsIgnoreCase(name, "if-none-match"))
+                {
+                    request.IfNoneMatch.assign(value);
+                }
+                else if (EqualsIgnoreCase(name, "accept"))
+                {
+                    request.Accept.assign(value);
+                }
+                else if (EqualsIgnoreCase(name, "content-type"))
+                {
+                    request.ContentType.assign(value);
+                }
+                else if (EqualsIgnoreCase(name, "x-expected-server-version"))
+                {
+                    request.ExpectedServerVersion.assign(value);
+                }
+                else if (EqualsIgnoreCase(name, "prefer"))
+                {
+                    request.Prefer.assign(value);
+                }
+                else if (EqualsIgnoreCase(name, "connection"))
+                {
+                    request.KeepAlive = !EqualsIgnoreCase(value, "close");
+                }
+            }
+
+            size_t bodyStart = headerEnd + 4;
+            if (contentLength > kMaxBodyBytes || !fill(bodyStart + contentLength))
+            {
+                ::close(socket);
+                return;
+            }
+            request.Body.assign(buffer, bodyStart, contentLength);
+            buffer.erase(0, bodyStart + contentLength);
+
+            uint64_t requestNumber = m_requestCount.fetch_add(1, std::memory_order_relaxed) + 1;
+            m_requestBodyBytes.fetch_add(contentLength, std::memory_order_relaxed);
+            HttpResponse response{};
+            Route(request, response);
+            std::chrono::microseconds latency = NextResponseLatency();
+            if (latency.count() > 0)
+            {
+                std::this_thread::sleep_for(latency);
+            }
+
+            responseText.clear();
+            responseText += "HTTP/1.1 ";
+            responseText += std::to_string(response.StatusCode);
+            responseText += ' ';
+            responseText += ReasonPhrase(response.StatusCode);
+            responseText += "\r\nContent-Type: ";
+            responseText += response.ContentType;
+            responseText += "\r\nx-request-id: standin-";
+            responseText += std::to_string(requestNumber);
+            if (!response.ETag.empty())
+            {
+                responseText += "\r\nETag: ";
+                responseText += response.ETag;
+            }
+            for (auto const& [name, value] : response.Headers)
+            {
+                responseText += "\r\n";
+                responseText += name;
+                responseText += ": ";
+                responseText += value;
+            }
+            responseText += "\r\nContent-Length: ";
+            responseText += std::to_string(response.Body.size());
+            responseText += request.KeepAlive ? "\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+            responseText += response.Body;
+            m_responseBodyBytes.fetch_add(response.Body.size(), std::memory_order_relaxed);
+            if (!SendAll(socket, responseText) || !request.KeepAlive || TakeCloseAfterResponse())
+            {
+                ::close(socket);
+                return;
+            }
+        }
+    }
+
+    void StandInSyncServer::Route(HttpRequest const& request, HttpResponse& response)
+    {
+        constexpr std::string_view kVaultPrefix = "/v1/vaults/";
+        if (TakeFault(StandInFault::ServiceUnavailable, m_options.ErrorRate))
+        {
+            response.StatusCode = 503;
+            response.Body = ErrorBody("SERVICE_UNAVAILABLE", "injected fault");
+            if (m_options.RetryAfterSeconds > 0)
+            {
+                response.Headers.emplace_back("Retry-After", std::to_string(m_options.RetryAfterSeconds));
+            }
+            return;
+        }
+        if (request.Path == "/healthz" && request.Method == "GET")
+        {
+            Utf8JsonWriter writer;
+            writer.BeginObject();
+            writer.Property("ok", true);
+            writer.Key("service");
+            writer.StringUtf8("standin");
+            writer.EndObject();
+            response.Body.assign(writer.View());
+            return;
+        }
+        if (request.Method == "POST")
+        {
+            using Handler = void (StandInSyncServer::*)(HttpRequest const&, HttpResponse&);
+            Handler handler =
+                request.Path == "/v1/auth/dev/login" ? &StandInSyncServer::HandleDevLogin :
+                request.Path == "/v1/auth/register/start" ? &StandInSyncServer::HandleOpaqueRegisterStart :
+                request.Path == "/v1/auth/register/finish" ? &StandInSyncServer::HandleOpaqueRegisterFinish :
+                request.Path == "/v1/auth/login/start" ? &StandInSyncServer::HandleOpaqueLoginStart :
+                request.Path == "/v1/auth/login/finish" ? &StandInSyncServer::HandleOpaqueLoginFinish :
+                nullptr;
+            if (handler)
+            {
+                (this->*handler)(request, response);
+                return;
+            }
+        }
+        if (request.Path.size() > kVaultPrefix.size() && std::string_view(request.Path).substr(0, kVaultPrefix.size()) == kVaultPrefix)
+        {
+            std::string_view target = std::string_view(request.Path).substr(kVaultPrefix.size());
+            std::string_view query;
+            size_t question = target.find('?');
+            if (question != std::string_view::npos)
+            {
+                query = target.substr(question + 1);
+                target = target.substr(0, question);
+            }
+            size_t slash = target.find('/');
+            std::string email(target.substr(0, slash));
+            std::string_view resource = slash == std::string_view::npos ? std::string_view{} : target.substr(slash + 1);
+            if (resource == "items" && request.Method == "PUT")
+            {
+                HandlePutVaultItems(email, request, response);
+                return;
+            }
+            if (resource == "changes" && request.Method == "GET")
+            {
+                HandleGetVaultChanges(email, query, request, response);
+                return;
+            }
+            if (!resource.empty())
+            {
+                response.StatusCode = 404;
+                response.Body = ErrorBody("NOT_FOUND", "route not found");
+                return;
+            }
+            if (request.Method == "GET")
+            {
+                HandleGetVault(email, request, response);
+                return;
+            }
+            if (request.Method == "PUT")
+            {
+                HandlePutVault(email, request, response);
+                return;
+            }
+        }
+
+        response.StatusCode = 404;
+        response.Body = ErrorBody("NOT_FOUND", "route not found");
+    }
+
+    void StandInSyncServer::HandleDevLogin(HttpRequest const& request, HttpResponse& response)
+    {
+        Utf8JsonReader reader;
+        std::string email;
+        if (!reader.Parse(request.Body) || !reader.TryGetStringUtf8(Utf8JsonReader::Root, "email", email) || email.empty())
+        {
+            response.StatusCode = 400;
+            response.Body = ErrorBody("INVALID_EMAIL", "invalid email");
+            return;
+        }
+
+        response.Body = TokenBody(email);
+    }
+
+    // 以下の OPAQUE の route は sync-axum-api と同じ要求/応答の形。password file はメモリ上にだけ持つ。
+    void StandInSyncServer::HandleOpaqueRegisterStart(HttpRequest const& request, HttpResponse& response)
+    {
+        std::string email;
+        std::string registrationRequest;
+        if (char const* code = ReadOpaqueRequest(request.Body, email, { { "registration_request_base64", &registrationRequest } }))
+        {
+            response.StatusCode = 400;
+            response.Body = ErrorBody(code, "invalid request body");
+            return;
+        }
+        if (!OpaqueAvailable())
+        {
+            response.StatusCode = 503;
+            response.Body = ErrorBody("OPAQUE_UNAVAILABLE", "opaque-ffi is not linked");
+            return;
+        }
+
+        ByteBuffer setup{ m_opaqueServerSetup.data(), m_opaqueServerSetup.size() };
+        ByteBuffer requestBytes = AsByteBuffer(registrationRequest);
+        tsupasswd::opaque::ByteBufferOwner registrationResponse;
+        if (!tsupasswd_opaque_server_register_start(&setup, &requestBytes, reinterpret_cast<uint8_t const*>(email.data()), email.size(), registrationResponse.out_ptr()))
+        {
+            response.StatusCode = 401;
+            response.Body = ErrorBody("OPAQUE_REGISTER_FAILED", "registration failed");
+            return;
+        }
+
+        Utf8JsonWriter writer;
+        writer.BeginObject();
+        writer.Key("registration_response_base64");
+        writer.StringUtf8(Base64Encode(AsStringView(registrationResponse)));
+        writer.EndObject();
+        response.Body.assign(writer.View());
+    }
+
+    void StandInSyncServer::HandleOpaqueRegisterFinish(HttpRequest const& request, HttpResponse& response)
+    {
+        std::string email;
+        std::string upload;
+        if (char const* code = ReadOpaqueRequest(request.Body, email, { { "registration_upload_base64", &upload } }))
+        {
+            response.StatusCode = 400;
+            response.Body = ErrorBody(code, "invalid request body");
+            return;
+        }
+        if (!OpaqueAvailable())
+        {
+            response.StatusCode = 503;
+            response.Body = ErrorBody("OPAQUE_UNAVAILABLE", "opaque-ffi is not linked");
+            return;
+        }
+
+        ByteBuffer uploadBytes = AsByteBuffer(upload);
+        tsupasswd::opaque::ByteBufferOwner passwordFile;
+        if (!tsupasswd_opaque_server_register_finish(&uploadBytes, passwordFile.out_ptr()))
+        {
+            response.StatusCode = 500;
+            response.Body = ErrorBody("OPAQUE_SERVER_FAILED", "server registration failed");
+            return;
+        }
+        {
+            std::lock_guard lock(m_vaultMutex);
+            m_passwordFiles[email].assign(passwordFile.data(), passwordFile.data() + passwordFile.size());
+        }
+
+        Utf8JsonWriter writer;
+        writer.BeginObject();
+        writer.Property("ok", true);
+        writer.EndObject();
+        response.Body.assign(writer.View());
+    }
+
+    void StandInSyncServer::HandleOpaqueLoginStart(HttpRequest const& request, HttpResponse& response)
+    {
+        std::string email;
+        std::string credentialRequest;
+        if (char const* code = ReadOpaqueRequest(request.Body, email, { { "credential_request_base64", &credentialRequest } }))
+        {
+            response.StatusCode = 400;
+            response.Body = ErrorBody(code, "invalid request body");
+            return;
+        }
+        if (!OpaqueAvailable())
+        {
+            response.StatusCode = 503;
+            response.Body = ErrorBody("OPAQUE_UNAVAILABLE", "opaque-ffi is not linked");
+            return;
+        }
+
+        // 未登録のユーザーも sync-axum-api と同じく password file なしで login_start に渡す (失敗は login_finish で分かる)。
+        std::vector<uint8_t> passwordFile;
+        bool registered = false;
+        {
+            std::lock_guard lock(m_vaultMutex);
+            auto it = m_passwordFiles.find(email);
+            if (it != m_passwordFiles.end())
+            {
+                passwordFile = it->second;
+                registered = true;
+            }
+        }
+
+        ByteBuffer setup{ m_opaqueServerSetup.data(), m_opaqueServerSetup.size() };
+        ByteBuffer fileBytes{ passwordFile.data(), passwordFile.size() };
+        ByteBuffer requestBytes = AsByteBuffer(credentialRequest);
+        tsupasswd::opaque::ByteBufferOwner serverState;
+        tsupasswd::opaque::ByteBufferOwner credentialResponse;
+        if (!tsupasswd_opaque_server_login_start(&setup, registered ? &fileBytes : nullptr, &requestBytes,
+                reinterpret_cast<uint8_t const*>(email.data()), email.size(), serverState.out_ptr(), credentialResponse.out_ptr()))
+        {
+            response.StatusCode = 401;
+            response.Body = ErrorBody("OPAQUE_LOGIN_FAILED", "login failed");
+            return;
+        }
+
+        Utf8JsonWriter writer;
+        writer.BeginObject();
+        writer.Key("server_state_base64");
+        writer.StringUtf8(Base64Encode(AsStringView(serverState)));
+        writer.Key("credential_response_base64");
+        writer.StringUtf8(Base64Encode(AsStringView(credentialResponse)));
+        writer.EndObject();
+        response.Body.assign(writer.View());
+    }
+
+    void StandInSyncServer::HandleOpaqueLoginFinish(HttpRequest const& request, HttpResponse& response)
+    {
+        std::string email;
+        std::string serverState;
+        std::string finalization;
+        if (char const* code = ReadOpaqueRequest(request.Body, email, { { "server_state_base64", &serverState }, { "credential_finalization_base64", &finalization } }))
+        {
+            response.StatusCode = 400;
+            response.Body = ErrorBody(code, "invalid request body");
+            return;
+        }
+        if (!OpaqueAvailable())
+        {
+            response.StatusCode = 503;
+            response.Body = ErrorBody("OPAQUE_UNAVAILABLE", "opaque-ffi is not linked");
+            return;
+        }
+
+        ByteBuffer stateBytes = AsByteBuffer(serverState);
+        ByteBuffer finalizationBytes = AsByteBuffer(finalization);
+        tsupasswd::opaque::ByteBufferOwner sessionKey;
+        if (!tsupasswd_opaque_server_login_finish(&stateBytes, &finalizationBytes, sessionKey.out_ptr()))
+        {
+            response.StatusCode = 401;
+            response.Body = ErrorBody("OPAQUE_LOGIN_FAILED", "login failed");
+            return;
+        }
+        response.Body = TokenBody(email);
+    }
+
+    bool StandInSyncServer::Authorize(std::string const& email, HttpRequest const& request, HttpResponse& response)
+    {
+        constexpr std::string_view kBearer = "Bearer ";
+        if (request.Authorization.empty())
+        {
+            response.StatusCode = 401;
+            response.Body = ErrorBody("AUTH_MISSING", "missing authorization");
+            return false;
+        }
+        std::string_view value = request.Authorization;
+        if (value.substr(0, kBearer.size()) != kBearer || value.substr(kBearer.size(), kTokenPrefix.size()) != kTokenPrefix)
+        {
+            response.StatusCode = 401;
+            response.Body = ErrorBody("AUTH_INVALID", "invalid token");
+            return false;
+        }
+        if (value.substr(kBearer.size() + kTokenPrefix.size()) != email)
+        {
+            response.StatusCode = 403;
+            response.Body = ErrorBody("AUTH_SUB_MISMATCH", "token subject mismatch");
+            return false;
+        }
+        if (TakeFault(StandInFault::Unauthorized, m_options.UnauthorizedRate))
+        {
+            response.StatusCode = 401;
+            response.Body = ErrorBody("AUTH_EXPIRED", "token expired");
+            return false;
+        }
+        return true;
+    }
+
+    void StandInSyncServer::HandleGetVault(std::string const& email, HttpRequest const& request, HttpResponse& response)
+    {
+        if (!Authorize(email, request, response))
+        {
+            return;
+        }
+
+        VaultRow row{};
+        {
+            std::lock_guard lock(m_vaultMutex);
+            if (RejectIfItemSyncActiveLocked(email, response))
+            {
+                return;
+            }
+            auto it = m_vaults.find(email);
+            if (it == m_vaults.end())
+            {
+                response.StatusCode = 404;
+                response.Body = ErrorBody("VAULT_NOT_FOUND", "vault not found");
+                return;
+            }
+            row = it->second;
+        }
+
+        response.ETag = "\"" + std::to_string(row.ServerVersion) + "-" + row.BlobTag + "\"";
+        if (request.IfVersion == std::to_string(row.ServerVersion) || request.IfNoneMatch == response.ETag)
+        {
+            m_notModifiedCount.fetch_add(1, std::memory_order_relaxed);
+            response.StatusCode = 304;
+            return;
+        }
+
+        if (request.Accept == "application/octet-stream")
+        {
+            if (!Base64Decode(row.CipherBlobBase64, response.Body))
+            {
+                response.StatusCode = 500;
+                response.Body = ErrorBody("INVALID_STORED_BLOB", "stored blob is not base64");
+                return;
+            }
+            response.ContentType = "application/octet-stream";
+            response.Headers.emplace_back("X-Server-Version", std::to_string(row.ServerVersion));
+            response.Headers.emplace_back("X-Blob-Sha256-Base64", row.BlobTag);
+            response.Headers.emplace_back("X-Updated-At", row.UpdatedAt);
+            return;
+        }
+
+        Utf8JsonWriter writer;
+        writer.BeginObject();
+        writer.Property("server_version", row.ServerVersion);
+        writer.Key("cipher_blob_base64");
+        writer.StringUtf8(row.CipherBlobBase64);
+        writer.Key("blob_sha256_base64");
+        writer.StringUtf8(row.BlobTag);
+        writer.Key("updated_at");
+        writer.StringUtf8(row.UpdatedAt);
+        writer.EndObject();
+        response.Body.assign(writer.View());
+    }
+
+    void StandInSyncServer::HandlePutVault(std::string const& email, HttpRequest const& request, HttpResponse& response)
+    {
+        if (!Authorize(email, request, response))
+        {
+            return;
+        }
+
+        Utf8JsonReader reader;
+        int64_t expectedVersion = 0;
+        std::string cipherBlob;
+        if (request.ContentType == "application/octet-stream")
+        {
+            std::string_view expected = request.ExpectedServerVersion;
+            auto [ptr, ec] = std::from_chars(expected.data(), expected.data() + expected.size(), expectedVersion);
+            if (expected.empty() || ec != std::errc{} || ptr != expected.data() + expected.size())
+            {
+                response.StatusCode = 400;
+                response.Body = ErrorBody("INVALID_REQUEST", "missing X-Expected-Server-Version");
+                return;
+            }
+            cipherBlob = Base64Encode(request.Body);
+        }
+        else if (!reader.Parse(request.Body) ||
+            !reader.TryGetInt64(Utf8JsonReader::Root, "expected_server_version", expectedVersion) ||
+            !reader.TryGetStringUtf8(Utf8JsonReader::Root, "cipher_blob_base64", cipherBlob))
+        {
+            response.StatusCode = 400;
+            response.Body = ErrorBody("INVALID_REQUEST", "invalid request body");
+            return;
+        }
+
+        int64_t nextVersion = 0;
+        std::string blobTag;
+        std::string updatedAt = NowRfc3339();
+        {
+            std::lock_guard lock(m_vaultMutex);
+            if (RejectIfItemSyncActiveLocked(email, response))
+            {
+                return;
+            }
+            VaultRow& row = m_vaults[email];
+            if (row.ServerVersion > 0 && TakeFault(StandInFault::Conflict, m_options.ConflictRate))
+            {
+                // 別の端末が同じ内容を先に書いたことにする。
+                row.ServerVersion += 1;
+                row.UpdatedAt = updatedAt;
+                row.BlobTag = "blob" + std::to_string(++m_blobWrites);
+            }
+            if (expectedVersion != row.ServerVersion)
+            {
+                Utf8JsonWriter writer;
+                writer.BeginObject();
+                writer.Key("code");
+                writer.StringUtf8("VERSION_CONFLICT");
+                writer.Property("server_version", row.ServerVersion);
+                // 求められれば、手元で merge して送り直せるよう現在の vault を付ける (GET の往復を省く)。
+                bool representation = row.ServerVersion > 0 && request.Prefer.find("return=representation") != std::string::npos;
+                if (representation)
+                {
+                    writer.Key("cipher_blob_base64");
+                    writer.StringUtf8(row.CipherBlobBase64);
+                    writer.Key("blob_sha256_base64");
+                    writer.StringUtf8(row.BlobTag);
+                    writer.Key("updated_at");
+                    writer.StringUtf8(row.UpdatedAt);
+                    response.Headers.emplace_back("Preference-Applied", "return=representation");
+                    m_conflictVaultCount.fetch_add(1, std::memory_order_relaxed);
+                }
+                writer.EndObject();
+                response.StatusCode = 409;
+                response.Body.assign(writer.View());
+                if (row.ServerVersion == 0)
+                {
+                    m_vaults.erase(email);
+                }
+                return;
+            }
+            nextVersion = row.ServerVersion + 1;
+            row.ServerVersion = nextVersion;
+            row.CipherBlobBase64 = std::move(cipherBlob);
+            row.UpdatedAt = updatedAt;
+            row.BlobTag = "blob" + std::to_string(++m_blobWrites);
+            blobTag = row.BlobTag;
+        }
+
+        Utf8JsonWriter writer;
+        writer.BeginObject();
+        writer.Property("ok", true);
+        writer.Property("server_version", nextVersion);
+        writer.Key("blob_sha256_base64");
+        writer.StringUtf8(blobTag);
+        writer.Key("updated_at");
+        writer.StringUtf8(updatedAt);
+        writer.EndObject();
+        response.Body.assign(writer.View());
+    }
+
+    bool StandInSyncServer::RejectIfItemSyncActiveLocked(std::string const& email, HttpResponse& response) const
+    {
+        auto it = m_itemLogs.find(email);
+        if (it == m_itemLogs.end() || it->second.Cursor == 0)
+        {
+            return false;
+        }
+        response.StatusCode = 409;
+        response.Body = ErrorBody("ITEM_SYNC_ACTIVE", "vault is synced per item");
+        return true;
+    }
+
+    void StandInSyncServer::HandlePutVaultItems(std::string const& email, HttpRequest const& request, HttpResponse& response)
+    {
+        if (!Authorize(email, request, response))
+        {
+            return;
+        }
+
+        struct ItemWrite
+        {
+            std::string ItemId;
+            int64_t BaseItemVersion{ 0 };
+            ItemRow Row;
+        };
+
+        Utf8JsonReader reader;
+        size_t items = 0;
+        std::vector<ItemWrite> writes;
+        bool valid = reader.Parse(request.Body) && reader.TryGetArray(Utf8JsonReader::Root, "items", items);
+        for (size_t child = valid ? reader.FirstChild(items) : Utf8JsonReader::npos; child != Utf8JsonReader::npos; child = reader.NextSibling(items, child))
+        {
+            ItemWrite& write = writes.emplace_back();
+            valid = reader.TryGetStringUtf8(child, "item_id", write.ItemId) && !write.ItemId.empty() &&
+                reader.TryGetInt64(child, "base_item_version", write.BaseItemVersion) &&
+                reader.TryGetStringUtf8(child, "sealed_item_base64", write.Row.SealedItemBase64);
+            if (!valid)
+            {
+                break;
+            }
+            (void)reader.TryGetBool(child, "deleted", write.Row.Deleted);
+            (void)reader.TryGetStringUtf8(child, "updated_at", write.Row.UpdatedAt);
+        }
+        std::set<std::string_view> itemIds;
+        for (auto const& write : writes)
+        {
+            valid = valid && itemIds.insert(write.ItemId).second;
+        }
+        if (!valid || writes.size() > kMaxItemsPerWrite)
+        {
+            response.StatusCode = 400;
+            response.Body = ErrorBody("INVALID_REQUEST", "invalid request body");
+            return;
+        }
+
+        Utf8JsonWriter writer;
+        writer.BeginObject();
+        {
+            std::lock_guard lock(m_vaultMutex);
+            ItemLog& log = m_itemLogs[email];
+            auto currentVersion = [&](std::string const& itemId)
+            {
+                auto it = log.Items.find(itemId);
+                return it == log.Items.end() ? int64_t{ 0 } : it->second.ItemVersion;
+            };
+
+            // 1 件でも版が合わなければ何も書かない。
+            bool conflict = std::any_of(writes.begin(), writes.end(), [&](ItemWrite const& write)
+            {
+                return write.BaseItemVersion != currentVersion(write.ItemId);
+            });
+            if (conflict)
+            {
+                response.StatusCode = 409;
+                writer.Key("code");
+                writer.StringUtf8("ITEM_VERSION_CONFLICT");
+                writer.Property("base_cursor", log.Cursor);
+                writer.Property("cursor", log.Cursor);
+                writer.Key("conflicts");
+                writer.BeginArray();
+                for (auto const& write : writes)
+                {
+                    int64_t version = currentVersion(write.ItemId);
+                    if (write.BaseItemVersion != version)
+                    {
+                        writer.BeginObject();
+                        writer.Key("item_id");
+                        writer.StringUtf8(write.ItemId);
+                        writer.Property("item_version", version);
+                        writer.EndObject();
+                    }
+                }
+                writer.EndArray();
+            }
+            else
+            {
+                writer.Property("ok", true);
+                writer.Property("base_cursor", log.Cursor);
+                writer.Key("items");
+                writer.BeginArray();
+                for (auto& write : writes)
+                {
+                    ItemRow& row = log.Items[write.ItemId];
+                    if (row.ChangeSeq != 0)
+                    {
+                        log.BySeq.erase(row.ChangeSeq);
+                    }
+                    write.Row.ItemVersion = row.ItemVersion + 1;
+                    write.Row.ChangeSeq = ++log.Cursor;
+                    row = std::move(write.Row);
+                    log.BySeq.emplace(row.ChangeSeq, write.ItemId);
+
+                    writer.BeginObject();
+                    writer.Key("item_id");
+                    writer.StringUtf8(write.ItemId);
+                    writer.Property("item_version", row.ItemVersion);
+                    writer.EndObject();
+                }
+                writer.EndArray();
+                writer.Property("cursor", log.Cursor);
+            }
+        }
+        writer.EndObject();
+        response.Body.assign(writer.View());
+    }
+
+    void StandInSyncServer::HandleGetVaultChanges(std::string const& email, std::string_view query, HttpRequest const& request, HttpResponse& response)
+    {
+        if (!Authorize(email, request, response))
+        {
+            return;
+        }
+
+        int64_t since = 0;
+        int64_t limit = kDefaultChangesLimit;
+        while (!query.empty())
+        {
+            size_t amp = query.find('&');
+            std::string_view pair = query.substr(0, amp);
+            query = amp == std::string_view::npos ? std::string_view{} : query.substr(amp + 1);
+            size_t equals = pair.find('=');
+            if (equals == std::string_view::npos)
+            {
+                continue;
+            }
+            std::string_view name = pair.substr(0, equals);
+            std::string_view value = pair.substr(equals + 1);
+            int64_t* target = name == "since" ? &since : name == "limit" ? &limit : nullptr;
+            if (target && std::from_chars(value.data(), value.data() + value.size(), *target).ec != std::errc{})
+            {
+                response.StatusCode = 400;
+                response.Body = ErrorBody("INVALID_REQUEST", "invalid query");
+                return;
+            }
+        }
+        limit = std::clamp<int64_t>(limit, 1, kMaxChangesLimit);
+
+        Utf8JsonWriter writer;
+        writer.BeginObject();
+        {
+            std::lock_guard lock(m_vaultMutex);
+            ItemLog const& log = m_itemLogs[email];
+            int64_t cursor = log.Cursor;
+            bool hasMore = false;
+            writer.Key("items");
+            writer.BeginArray();
+            int64_t count = 0;
+            for (auto it = log.BySeq.upper_bound(since); it != log.BySeq.end(); ++it)
+            {
+                if (count == limit)
+                {
+                    hasMore = true;
+                    break;
+                }
+                ItemRow const& row = log.Items.at(it->second);
+                writer.BeginObject();
+                writer.Key("item_id");
+                writer.StringUtf8(it->second);
+                writer.Property("item_version", row.ItemVersion);
+                writer.Property("deleted", row.Deleted);
+                writer.Key("sealed_item_base64");
+                writer.StringUtf8(row.SealedItemBase64);
+                writer.Key("updated_at");
+                writer.StringUtf8(row.UpdatedAt);
+                writer.Property("change_seq", row.ChangeSeq);
+                writer.EndObject();
+                cursor = row.ChangeSeq;
+                ++count;
+            }
+            writer.EndArray();
+            writer.Property("cursor", hasMore ? cursor : log.Cursor);
+            writer.Property("has_more", hasMore);
+        }
+        writer.EndObject();
+        response.Body.assign(writer.View());
+    }
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tsupasswd::loadtest
+{
+    struct StandInServerOptions
+    {
+        // 各応答を返す前に待つ時間。DB とネットワークの往復の代わり。
+        std::chrono::microseconds ResponseLatency{ 0 };
+        // ResponseLatency に足す 0 〜 ResponseLatencyJitter の一様な揺らぎ。
+        std::chrono::microseconds ResponseLatencyJitter{ 0 };
+        // 要求がこの割合 (0-1) で 503 SERVICE_UNAVAILABLE になる。
+        double ErrorRate{ 0.0 };
+        // 0 より大きければ、故障で返す 503 に Retry-After (秒) を付ける。
+        uint32_t RetryAfterSeconds{ 0 };
+        // 既存 vault への PUT v1/vaults/{email} がこの割合で、別の端末が先に書いたことにして 409 になる (server_version が 1 進む)。
+        double ConflictRate{ 0.0 };
+        // 認証の要る要求がこの割合で 401 AUTH_EXPIRED になる (token の失効)。
+        double UnauthorizedRate{ 0.0 };
+        // 故障を選ぶ乱数の種。要求の順序が同じなら同じ要求が失敗する。
+        uint32_t FaultSeed{ 1 };
+    };
+
+    // InjectFault で次の count 件に起こす故障。割合による故障とは別に数える。
+    enum class StandInFault
+    {
+        // 次の要求を 503 にする。
+        ServiceUnavailable,
+        // 次の既存 vault への PUT v1/vaults/{email} を 409 にする (ConflictRate と同じく server_version が 1 進む)。
+        Conflict,
+        // 次の認証の要る要求を 401 にする。
+        Unauthorized,
+    };
+
+    // sync-axum-api の healthz・v1/auth/dev/login・v1/vaults/{email} を真似る loopback の HTTP/1.1 サーバー。
+    // GET は sync-axum-api と同じく If-Version / If-None-Match に一致すれば 304 を返す。
+    // Accept / Content-Type が application/octet-stream なら vault を base64 なしのバイナリで送受信する。
+    // PUT v1/vaults/{email}/items と GET v1/vaults/{email}/changes で item 単位の差分同期も受け付ける。
+    // item を書いた利用者の vault 全体の GET/PUT は sync-axum-api と同じく 409 ITEM_SYNC_ACTIVE にする。
+    // v1/auth/register/* と v1/auth/login/* は opaque-ffi のサーバー関数で OPAQUE を処理する
+    // (opaque-ffi をリンクしていないビルドでは 503 OPAQUE_UNAVAILABLE)。
+    // 遅延・503・409・401 を割合または InjectFault で起こせる。
+    // keep-alive に対応し、接続ごとに 1 スレッドで処理する。token は "standin.<email>" 固定。
+    class StandInSyncServer final
+    {
+    public:
+        explicit StandInSyncServer(StandInServerOptions options = {});
+        ~StandInSyncServer();
+
+        StandInSyncServer(StandInSyncServer const&) = delete;
+        StandInSyncServer& operator=(StandInSyncServer const&) = delete;
+
+        // 127.0.0.1 の空きポートで待ち受けを始める。
+        bool Start(std::string& outError);
+        void Stop();
+
+        uint16_t Port() const noexcept { return m_port; }
+        std::wstring BaseUrl() const;
+
+        uint64_t AcceptCount() const noexcept { return m_acceptCount.load(std::memory_order_relaxed); }
+        uint64_t RequestCount() const noexcept { return m_requestCount.load(std::memory_order_relaxed); }
+        uint64_t NotModifiedCount() const noexcept { return m_notModifiedCount.load(std::memory_order_relaxed); }
+        // Prefer: return=representation の PUT に vault を付けて返した 409 の数。
+        uint64_t ConflictVaultCount() const noexcept { return m_conflictVaultCount.load(std::memory_order_relaxed); }
+        // 要求と応答の本文の合計バイト数 (ヘッダーを除く)。
+        uint64_t RequestBodyBytes() const noexcept { return m_requestBodyBytes.load(std::memory_order_relaxed); }
+        uint64_t ResponseBodyBytes() const noexcept { return m_responseBodyBytes.load(std::memory_order_relaxed); }
+
+        // 次の count 件の応答を返した後、Connection: close を付けずに接続を閉じる
+        // (サーバー側の idle timeout で keep-alive 接続が切れた状態の再現)。
+        void CloseAfterNextResponses(uint32_t count);
+        void InjectFault(StandInFault fault, uint32_t count);
+        // 割合と InjectFault で起こした故障の数。
+        uint64_t InjectedFaultCount() const noexcept { return m_injectedFaultCount.load(std::memory_order_relaxed); }
+        // opaque-ffi のサーバー関数が使え、OPAQUE の register/login を受け付けるか。
+        bool OpaqueAvailable() const noexcept { return !m_opaqueServerSetup.empty(); }
+
+    private:
+        struct VaultRow
+        {
+            int64_t ServerVersion{ 0 };
+            std::string CipherBlobBase64;
+            std::string UpdatedAt;
+            // blob_sha256_base64 の代わり。クライアントは値を比べるだけなので、書き込みごとの通し番号で足りる。
+            std::string BlobTag;
+        };
+
+        // 差分同期の item。ChangeSeq は書き込んだときのユーザーごとの cursor。
+        struct ItemRow
+        {
+            int64_t ItemVersion{ 0 };
+            bool Deleted{ false };
+            std::string SealedItemBase64;
+            std::string UpdatedAt;
+            int64_t ChangeSeq{ 0 };
+        };
+
+        struct ItemLog
+        {
+            int64_t Cursor{ 0 };
+            std::map<std::string, ItemRow> Items;
+            // ChangeSeq -> item_id。changes を変更順に返すための索引。
+            std::map<int64_t, std::string> BySeq;
+        };
+
+        struct HttpRequest
+        {
+            std::string Method;
+            std::string Path;
+            std::string Authorization;
+            std::string IfVersion;
+            std::string IfNoneMatch;
+            std::string Accept;
+            std::string ContentType;
+            std::string ExpectedServerVersion;
+            std::string Prefer;
+            std::string Body;
+            bool KeepAlive{ true };
+        };
+
+        struct HttpResponse
+        {
+            int32_t StatusCode{ 200 };
+            std::string ContentType{ "application/json" };
+            std::string ETag;
+            std::vector<std::pair<std::string, std::string>> Headers;
+            std::string Body;
+        };
+
+        void AcceptLoop();
+        void ServeConnection(int socket);
+        void Route(HttpRequest const& request, HttpResponse& response);
+        void HandleDevLogin(HttpRequest const& request, HttpResponse& response);
+        void HandleGetVault(std::string const& email, HttpRequest const& request, HttpResponse& response);
+        void HandlePutVault(std::string const& email, HttpRequest const& request, HttpResponse& response);
+        void HandlePutVaultItems(std::string const& email, HttpRequest const& request, HttpResponse& response);
+        void HandleGetVaultChanges(std::string const& email, std::string_view query, HttpRequest const& request, HttpResponse& response);
+        void HandleOpaqueRegisterStart(HttpRequest const& request, HttpResponse& response);
+        void HandleOpaqueRegisterFinish(HttpRequest const& request, HttpResponse& response);
+        void HandleOpaqueLoginStart(HttpRequest const& request, HttpResponse& response);
+        void HandleOpaqueLoginFinish(HttpRequest const& request, HttpResponse& response);
+        bool Authorize(std::string const& email, HttpRequest const& request, HttpResponse& response);
+        // item を 1 件でも書いた利用者なら vault 全体の GET/PUT を 409 ITEM_SYNC_ACTIVE にして true を返す。m_vaultMutex を持って呼ぶ。
+        bool RejectIfItemSyncActiveLocked(std::string const& email, HttpResponse& response) const;
+        // 割合 rate か InjectFault で予約した fault を起こすなら true。
+        bool TakeFault(StandInFault fault, double rate);
+        std::chrono::microseconds NextResponseLatency();
+        bool TakeCloseAfterResponse();
+
+        StandInServerOptions m_options;
+        int m_listenSocket{ -1 };
+        uint16_t m_port{ 0 };
+        std::atomic<bool> m_stopping{ false };
+        std::thread m_acceptThread;
+
+        std::mutex m_connectionsMutex;
+        std::vector<std::thread> m_connectionThreads;
+
+        std::mutex m_vaultMutex;
+        std::map<std::string, VaultRow> m_vaults;
+        std::map<std::string, ItemLog> m_itemLogs;
+
+        // server_setup_new の結果。opaque-ffi が使えなければ空。
+        std::vector<uint8_t> m_opaqueServerSetup;
+        // register/finish で受け取った password file。
+        std::map<std::string, std::vector<uint8_t>> m_passwordFiles;
+
+        std::mutex m_faultMutex;
+        std::mt19937 m_faultRandom;
+        std::atomic<uint32_t> m_pendingFaults[3]{};
+        std::atomic<uint64_t> m_injectedFaultCount{ 0 };
+
+        std::atomic<uint32_t> m_closeAfterResponses{ 0 };
+        std::atomic<uint64_t> m_acceptCount{ 0 };
+        std::atomic<uint64_t> m_requestCount{ 0 };
+        uint64_t m_blobWrites{ 0 };
+        std::atomic<uint64_t> m_notModifiedCount{ 0 };
+        std::atomic<uint64_t> m_conflictVaultCount{ 0 };
+        std::atomic<uint64_t> m_requestBodyBytes{ 0 };
+        std::atomic<uint64_t> m_responseBodyBytes{ 0 };
+    };
+}
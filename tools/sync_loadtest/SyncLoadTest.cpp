@@ -0,0 +1,2378 @@
+// SyncClient の負荷試験ツール。
+// loopback のスタンドインサーバー (または --url で指定したサーバー) に対して、
+// 指定の並列数で PutVault (409・401・5xx は SyncEncryptedVaultWithRetryAsync と同じく再試行) と
+// GetVault を繰り返し、操作ごとの p50/p95/p99 レイテンシと接続の再利用状況を出力する。
+
+#include "PosixSyncTransport.h"
+#include "StandInSyncServer.h"
+#include "SyncClient.h"
+#include "SyncCoalescingQueue.h"
+#include "SyncDeltaStateStore.h"
+#include "SyncLatencyTracker.h"
+#include "SyncOutbox.h"
+#include "SyncResync.h"
+#include "SyncRetryPolicy.h"
+#include "SyncStateStore.h"
+#include "SyncTokenCache.h"
+#include "SyncVaultExecutor.h"
+#include "VaultMergeBenchmark.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    using namespace tsupasswd;
+    using Clock = std::chrono::steady_clock;
+
+    // PluginRegistrationManager::SyncEncryptedVaultWithRetryAsync と同じ回数 (SyncRetryOptions::MaxAttempts)。
+    constexpr int kMaxPutAttempts = static_cast<int>(SyncRetryOptions{}.MaxAttempts);
+
+    struct LoadTestOptions
+    {
+        std::wstring BaseUrl;
+        uint32_t Concurrency{ 4 };
+        uint32_t Iterations{ 50 };
+        uint32_t Users{ 0 };
+        // 0 でなければ負荷試験の代わりに、この数の vault を直列と SyncVaultExecutor で同期して時間を比べる。
+        uint32_t Vaults{ 0 };
+        size_t BlobBytes{ 4096 };
+        SyncVaultEncoding Encoding{ SyncVaultEncoding::Base64Json };
+        loadtest::StandInServerOptions Server{};
+    };
+
+    struct OperationSamples
+    {
+        std::vector<uint64_t> LatencyMicros;
+        uint64_t Errors{ 0 };
+    };
+
+    struct WorkerResult
+    {
+        std::map<std::string, OperationSamples> Operations;
+        uint64_t Conflicts{ 0 };
+        // 401 で login し直した回数と、5xx で送り直した回数。
+        uint64_t Reauths{ 0 };
+        uint64_t Retries{ 0 };
+        uint64_t PutsGivenUp{ 0 };
+    };
+
+    std::string Narrow(std::wstring const& value)
+    {
+        std::string out;
+        out.reserve(value.size());
+        for (wchar_t c : value)
+        {
+            out.push_back(c < 0x80 ? static_cast<char>(c) : '?');
+        }
+        return out;
+    }
+
+    std::wstring UserIdFor(uint32_t index)
+    {
+        std::string user = "load-" + std::to_string(index) + "@example.com";
+        return std::wstring(user.begin(), user.end());
+    }
+
+    double Percentile(std::vector<uint64_t> const& sorted, double quantile)
+    {
+        if (sorted.empty())
+        {
+            return 0;
+        }
+        // nearest-rank
+        size_t rank = static_cast<size_t>(quantile * static_cast<double>(sorted.size()) + 0.999999);
+        rank = std::clamp<size_t>(rank, 1, sorted.size());
+        return static_cast<double>(sorted[rank - 1]) / 1000.0;
+    }
+
+    void RunWorker(
+        LoadTestOptions const& options,
+        std::shared_ptr<ISyncTransport> const& transport,
+        uint32_t workerIndex,
+        WorkerResult& result)
+    {
+        std::wstring userId = UserIdFor(workerIndex % options.Users);
+        SyncClient client(options.BaseUrl);
+        client.SetTransport(transport);
+        client.SetApiKind(SyncApiKind::Axum);
+        client.SetAllowInsecureHttp(true);
+        client.SetVaultEncoding(options.Encoding);
+
+        auto timed = [&](char const* name, auto&& call) -> HRESULT
+        {
+            Clock::time_point start = Clock::now();
+            HRESULT hr = call();
+            OperationSamples& samples = result.Operations[name];
+            samples.LatencyMicros.push_back(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count()));
+            if (FAILED(hr))
+            {
+                ++samples.Errors;
+            }
+            return hr;
+        };
+
+        std::wstring token;
+        SyncHttpStatus status{};
+        auto login = [&]() -> HRESULT
+        {
+            HRESULT hr = timed("dev_login", [&]() { return client.DevLogin(userId, token, &status); });
+            if (SUCCEEDED(hr))
+            {
+                client.SetBearerToken(token);
+            }
+            return hr;
+        };
+        if (FAILED(login()))
+        {
+            return;
+        }
+        // 失敗した要求を送り直すなら true を返し、その失敗はエラーとして数えない。
+        // 401 は login し直し、5xx はそのまま送り直す (アプリは 500ms からの backoff を挟むが、ここでは待たない)。
+        auto recover = [&](char const* name, HRESULT hr) -> bool
+        {
+            bool unauthorized = hr == HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED) && status.StatusCode == 401;
+            bool serverError = status.StatusCode >= 500;
+            if (!(unauthorized && SUCCEEDED(login())) && !serverError)
+            {
+                return false;
+            }
+            --result.Operations[name].Errors;
+            ++(unauthorized ? result.Reauths : result.Retries);
+            return true;
+        };
+
+        PutVaultRequest put{};
+        if (options.Encoding == SyncVaultEncoding::OctetStream)
+        {
+            put.Blob.Ciphertext.assign(options.BlobBytes, 0);
+        }
+        else
+        {
+            put.Blob.CiphertextBase64.assign(((options.BlobBytes + 2) / 3) * 4, L'A');
+        }
+        int64_t knownVersion = 0;
+        for (uint32_t i = 0; i < options.Iterations; ++i)
+        {
+            bool stored = false;
+            for (int attempt = 0; attempt < kMaxPutAttempts && !stored; ++attempt)
+            {
+                put.ExpectedVersion = knownVersion;
+                put.NewVersion = knownVersion + 1;
+                PutVaultResponse response{};
+                HRESULT hr = timed("put_vault", [&]() { return client.PutVault(userId, put, response, &status); });
+                if (SUCCEEDED(hr))
+                {
+                    knownVersion = response.VaultVersion;
+                    stored = true;
+                }
+                else if (hr == HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) && status.ServerVersion >= 0)
+                {
+                    // 409 は server_version を採用して送り直す。エラーとしては数えない。
+                    --result.Operations["put_vault"].Errors;
+                    ++result.Conflicts;
+                    knownVersion = status.ServerVersion;
+                }
+                else if (!recover("put_vault", hr))
+                {
+                    break;
+                }
+            }
+            if (!stored)
+            {
+                ++result.PutsGivenUp;
+            }
+
+            VaultRecord record{};
+            auto getVault = [&]() { return client.GetVault(userId, record, &status); };
+            HRESULT hr = timed("get_vault", getVault);
+            if (FAILED(hr) && recover("get_vault", hr))
+            {
+                hr = timed("get_vault", getVault);
+            }
+            if (SUCCEEDED(hr))
+            {
+                knownVersion = std::max(knownVersion, record.VaultVersion);
+            }
+        }
+    }
+
+    int RunLoadTest(LoadTestOptions options)
+    {
+        std::unique_ptr<loadtest::StandInSyncServer> server;
+        if (options.BaseUrl.empty())
+        {
+            server = std::make_unique<loadtest::StandInSyncServer>(options.Server);
+            std::string error;
+            if (!server->Start(error))
+            {
+                fprintf(stderr, "error: %s\n", error.c_str());
+                return 2;
+            }
+            options.BaseUrl = server->BaseUrl();
+        }
+        if (options.Users == 0)
+        {
+            options.Users = options.Concurrency;
+        }
+
+        auto transport = std::make_shared<PosixSyncTransport>();
+        std::vector<WorkerResult> results(options.Concurrency);
+        std::vector<std::thread> workers;
+        workers.reserve(options.Concurrency);
+
+        Clock::time_point start = Clock::now();
+        for (uint32_t i = 0; i < options.Concurrency; ++i)
+        {
+            workers.emplace_back([&, i]()
+            {
+                RunWorker(options, transport, i, results[i]);
+            });
+        }
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+        double elapsedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::map<std::string, OperationSamples> merged;
+        uint64_t totalRequests = 0;
+        uint64_t conflicts = 0;
+        uint64_t reauths = 0;
+        uint64_t retries = 0;
+        uint64_t putsGivenUp = 0;
+        for (auto& result : results)
+        {
+            conflicts += result.Conflicts;
+            reauths += result.Reauths;
+            retries += result.Retries;
+            putsGivenUp += result.PutsGivenUp;
+            for (auto& [name, samples] : result.Operations)
+            {
+                OperationSamples& target = merged[name];
+                target.Errors += samples.Errors;
+                target.LatencyMicros.insert(target.LatencyMicros.end(), samples.LatencyMicros.begin(), samples.LatencyMicros.end());
+                totalRequests += samples.LatencyMicros.size();
+            }
+        }
+
+        printf("url=%s concurrency=%u iterations=%u users=%u blob_bytes=%zu encoding=%s\n",
+            Narrow(options.BaseUrl).c_str(),
+            options.Concurrency,
+            options.Iterations,
+            options.Users,
+            options.BlobBytes,
+            options.Encoding == SyncVaultEncoding::OctetStream ? "octet-stream" : "base64-json");
+        printf("requests=%llu elapsed=%.3fs throughput=%.1f req/s conflicts=%llu reauths=%llu retries=%llu puts_given_up=%llu\n",
+            static_cast<unsigned long long>(totalRequests),
+            elapsedSeconds,
+            elapsedSeconds > 0 ? static_cast<double>(totalRequests) / elapsedSeconds : 0.0,
+            static_cast<unsigned long long>(conflicts),
+            static_cast<unsigned long long>(reauths),
+            static_cast<unsigned long long>(retries),
+            static_cast<unsigned long long>(putsGivenUp));
+        printf("connects=%llu idle_connections=%zu",
+            static_cast<unsigned long long>(transport->ConnectCount()),
+            transport->IdleConnectionCount());
+        if (server)
+        {
+            printf(" server_accepts=%llu injected_faults=%llu request_body_bytes=%llu response_body_bytes=%llu",
+                static_cast<unsigned long long>(server->AcceptCount()),
+                static_cast<unsigned long long>(server->InjectedFaultCount()),
+                static_cast<unsigned long long>(server->RequestBodyBytes()),
+                static_cast<unsigned long long>(server->ResponseBodyBytes()));
+        }
+        printf("\n");
+        printf("%-12s %8s %7s %9s %9s %9s %9s\n", "operation", "count", "errors", "p50_ms", "p95_ms", "p99_ms", "max_ms");
+        uint64_t errors = 0;
+        for (auto& [name, samples] : merged)
+        {
+            std::sort(samples.LatencyMicros.begin(), samples.LatencyMicros.end());
+            errors += samples.Errors;
+            printf("%-12s %8zu %7llu %9.3f %9.3f %9.3f %9.3f\n",
+                name.c_str(),
+                samples.LatencyMicros.size(),
+                static_cast<unsigned long long>(samples.Errors),
+                Percentile(samples.LatencyMicros, 0.50),
+                Percentile(samples.LatencyMicros, 0.95),
+                Percentile(samples.LatencyMicros, 0.99),
+                samples.LatencyMicros.empty() ? 0.0 : static_cast<double>(samples.LatencyMicros.back()) / 1000.0);
+        }
+        return errors == 0 && putsGivenUp == 0 ? 0 : 1;
+    }
+
+    // 応答の遅いスタンドインサーバーで、非同期 API の並行実行・期限・取消を確かめる。
+    bool RunAsyncSelfTest(std::string& outError)
+    {
+        using Clock = std::chrono::steady_clock;
+        constexpr auto kLatency = std::chrono::milliseconds(300);
+
+        loadtest::StandInServerOptions serverOptions{};
+        serverOptions.ResponseLatency = kLatency;
+        loadtest::StandInSyncServer server(serverOptions);
+        if (!server.Start(outError))
+        {
+            return false;
+        }
+
+        auto transport = std::make_shared<PosixSyncTransport>();
+        SyncClient client(server.BaseUrl());
+        client.SetTransport(transport);
+        client.SetApiKind(SyncApiKind::Axum);
+        client.SetAllowInsecureHttp(true);
+
+        std::wstring const userId = L"async@example.com";
+        std::wstring token;
+        SyncHttpStatus status{};
+        if (FAILED(client.DevLogin(userId, token, &status)))
+        {
+            outError = "async_dev_login";
+            return false;
+        }
+        client.SetBearerToken(token);
+
+        PutVaultRequest put{};
+        put.Blob.CiphertextBase64 = L"QUJD";
+        SyncResult<PutVaultResponse> putResult = client.PutVaultAsync(userId, put).Get();
+        if (FAILED(putResult.Hr) || putResult.Value.VaultVersion != 1)
+        {
+            outError = "async_put";
+            return false;
+        }
+
+        // 独立した要求は I/O スレッドで同時に走るので、合計は 1 往復分の遅延程度で終わる。
+        uint32_t const parallel = SyncReactor::getInstance().IoThreadCount();
+        auto started = Clock::now();
+        std::vector<SyncTask<SyncResult<VaultRecord>>> gets;
+        for (uint32_t i = 0; i < parallel; ++i)
+        {
+            gets.push_back(client.GetVaultAsync(userId));
+        }
+        for (auto& get : gets)
+        {
+            SyncResult<VaultRecord> result = get.Get();
+            if (FAILED(result.Hr) || result.Value.VaultVersion != 1)
+            {
+                outError = "async_parallel_get";
+                return false;
+            }
+        }
+        auto elapsed = Clock::now() - started;
+        if (elapsed >= kLatency * 2)
+        {
+            outError = "async_overlap elapsed_ms=" + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+            return false;
+        }
+
+        SyncCallOptions deadlineOptions{};
+        deadlineOptions.Deadline = Clock::now() + std::chrono::milliseconds(100);
+        started = Clock::now();
+        SyncResult<VaultRecord> expired = client.GetVaultAsync(userId, deadlineOptions).Get();
+        elapsed = Clock::now() - started;
+        if (expired.Hr != HRESULT_FROM_WIN32(ERROR_TIMEOUT) || expired.Status.ErrorCode != L"DEADLINE_EXCEEDED" || elapsed >= kLatency)
+        {
+            outError = "async_deadline";
+            return false;
+        }
+
+        // 応答待ちの途中で取消すと、サーバーの応答を待たずに戻る。
+        SyncCancellationSource cancel;
+        SyncCallOptions cancelOptions{};
+        cancelOptions.Cancellation = cancel.Token();
+        auto pending = client.GetVaultAsync(userId, cancelOptions);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        started = Clock::now();
+        cancel.Cancel();
+        SyncResult<VaultRecord> cancelled = pending.Get();
+        elapsed = Clock::now() - started;
+        if (cancelled.Hr != HRESULT_FROM_WIN32(ERROR_CANCELLED) || cancelled.Status.ErrorCode != L"CANCELLED" || elapsed >= std::chrono::milliseconds(100))
+        {
+            outError = "async_cancel";
+            return false;
+        }
+
+        // 取消・期限切れの接続は使い回さないので、次の要求は普通に成功する。
+        SyncResult<VaultRecord> after = client.GetVaultAsync(userId).Get();
+        if (FAILED(after.Hr) || after.Value.VaultVersion != 1)
+        {
+            outError = "async_after_cancel";
+            return false;
+        }
+        return true;
+    }
+
+    // 接続を受け付けない待ち受け (届かないサーバーの代わり)。accept しないまま backlog を埋めるので、
+    // 以降の connect は SYN が捨てられて timeout まで終わらない。
+    class BlackholeListener final
+    {
+    public:
+        BlackholeListener() = default;
+        BlackholeListener(BlackholeListener const&) = delete;
+        BlackholeListener& operator=(BlackholeListener const&) = delete;
+
+        ~BlackholeListener()
+        {
+            for (int socket : m_fillers)
+            {
+                ::close(socket);
+            }
+            if (m_listenSocket >= 0)
+            {
+                ::close(m_listenSocket);
+            }
+        }
+
+        bool Start()
+        {
+            m_listenSocket = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t length = sizeof(address);
+            if (m_listenSocket < 0 ||
+                ::bind(m_listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+                ::listen(m_listenSocket, 0) != 0 ||
+                ::getsockname(m_listenSocket, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+            {
+                return false;
+            }
+            m_port = ntohs(address.sin_port);
+            for (int i = 0; i < 2; ++i)
+            {
+                int filler = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+                if (filler < 0)
+                {
+                    return false;
+                }
+                (void)::connect(filler, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+                m_fillers.push_back(filler);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            return true;
+        }
+
+        std::wstring BaseUrl() const
+        {
+            return L"http://127.0.0.1:" + std::to_wstring(m_port);
+        }
+
+    private:
+        int m_listenSocket{ -1 };
+        uint16_t m_port{ 0 };
+        std::vector<int> m_fillers;
+    };
+
+    // 段階ごとの timeout と操作全体の期限で、既定の timeout いっぱいまで待たずに失敗することを確かめる。
+    // 最初のバイトと期限は遅延を入れたスタンドインサーバー、接続は BlackholeListener で試す。
+    bool RunTimeoutSelfTest(std::string& outError)
+    {
+        constexpr auto kLatency = std::chrono::milliseconds(300);
+        auto elapsedMs = [](Clock::time_point started)
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - started).count();
+        };
+
+        loadtest::StandInServerOptions slowOptions{};
+        slowOptions.ResponseLatency = kLatency;
+        loadtest::StandInSyncServer slowServer(slowOptions);
+        loadtest::StandInSyncServer fastServer;
+        if (!slowServer.Start(outError) || !fastServer.Start(outError))
+        {
+            return false;
+        }
+
+        auto tracker = std::make_shared<SyncLatencyTracker>();
+        auto transport = std::make_shared<PosixSyncTransport>();
+        auto makeClient = [&](std::wstring const& baseUrl)
+        {
+            SyncClient client(baseUrl);
+            client.SetTransport(transport);
+            client.SetLatencyTracker(tracker);
+            client.SetApiKind(SyncApiKind::Axum);
+            client.SetAllowInsecureHttp(true);
+            return client;
+        };
+
+        std::wstring const userId = L"timeout@example.com";
+        std::wstring token;
+        SyncHttpStatus status{};
+        VaultRecord record{};
+        SyncClient slow = makeClient(slowServer.BaseUrl());
+        SyncTimeouts timeouts{};
+        timeouts.FirstByteTimeoutMs = 100;
+        slow.SetTimeouts(timeouts);
+        auto started = Clock::now();
+        HRESULT hr = slow.DevLogin(userId, token, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_WINHTTP_TIMEOUT) || status.ErrorCode != L"CLIENT_ERROR" || elapsedMs(started) >= kLatency.count())
+        {
+            outError = "first_byte_timeout elapsed_ms=" + std::to_string(elapsedMs(started));
+            return false;
+        }
+
+        timeouts = {};
+        timeouts.OperationTimeoutMs = 100;
+        slow.SetTimeouts(timeouts);
+        started = Clock::now();
+        hr = slow.DevLogin(userId, token, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_TIMEOUT) || status.ErrorCode != L"DEADLINE_EXCEEDED" || elapsedMs(started) >= kLatency.count())
+        {
+            outError = "operation_timeout elapsed_ms=" + std::to_string(elapsedMs(started));
+            return false;
+        }
+
+        // 同じ host の往復時間を観測すると、接続 timeout は既定の 5 秒から下限の 1 秒まで縮む。
+        SyncClient fast = makeClient(fastServer.BaseUrl());
+        int32_t configuredConnectMs = fast.Timeouts().ConnectTimeoutMs;
+        if (fast.EffectiveConnectTimeoutMs() != configuredConnectMs)
+        {
+            outError = "adaptive_connect_cold";
+            return false;
+        }
+        for (size_t i = 0; i < SyncLatencyTracker::kMinSamples; ++i)
+        {
+            if (FAILED(fast.DevLogin(userId, token, &status)))
+            {
+                outError = "adaptive_connect_warmup";
+                return false;
+            }
+        }
+        int32_t p95 = -1;
+        if (!tracker->TryGetPercentile("127.0.0.1", 95, p95) || p95 < 0 || p95 >= kLatency.count() ||
+            fast.EffectiveConnectTimeoutMs() != SyncLatencyTracker::kMinConnectTimeoutMs)
+        {
+            outError = "adaptive_connect_timeout p95=" + std::to_string(p95) + " connect_ms=" + std::to_string(fast.EffectiveConnectTimeoutMs());
+            return false;
+        }
+
+        BlackholeListener blackhole;
+        if (!blackhole.Start())
+        {
+            outError = "blackhole_listen";
+            return false;
+        }
+        SyncClient unreachable = makeClient(blackhole.BaseUrl());
+        unreachable.SetBearerToken(token);
+        started = Clock::now();
+        hr = unreachable.GetVault(userId, record, &status);
+        auto connectElapsedMs = elapsedMs(started);
+        if (hr != HRESULT_FROM_WIN32(ERROR_WINHTTP_TIMEOUT) ||
+            connectElapsedMs < SyncLatencyTracker::kMinConnectTimeoutMs - 100 ||
+            connectElapsedMs >= configuredConnectMs / 2)
+        {
+            outError = "adaptive_connect_fast_fail elapsed_ms=" + std::to_string(connectElapsedMs);
+            return false;
+        }
+        // timeout の後は観測を捨て、次の要求は設定どおりの接続 timeout で待つ。
+        if (unreachable.EffectiveConnectTimeoutMs() != configuredConnectMs)
+        {
+            outError = "adaptive_connect_reset";
+            return false;
+        }
+        return true;
+    }
+
+    // Prewarm で開いた接続を、その後の login と最初の PUT がそのまま使う (新しい TCP 接続を開かない) ことを確かめる。
+    bool RunPrewarmSelfTest(std::string& outError)
+    {
+        loadtest::StandInSyncServer server;
+        if (!server.Start(outError))
+        {
+            return false;
+        }
+        auto transport = std::make_shared<PosixSyncTransport>();
+        SyncClient client(server.BaseUrl());
+        client.SetTransport(transport);
+        client.SetLatencyTracker(std::make_shared<SyncLatencyTracker>());
+        client.SetApiKind(SyncApiKind::Axum);
+        client.SetAllowInsecureHttp(true);
+
+        SyncHttpStatus status{};
+        if (FAILED(client.Prewarm(&status)) || status.StatusCode != 200 || transport->ConnectCount() != 1 || server.AcceptCount() != 1)
+        {
+            outError = "prewarm_connect";
+            return false;
+        }
+
+        std::wstring const userId = L"prewarm@example.com";
+        std::wstring token;
+        PutVaultRequest put{};
+        put.Blob.CiphertextBase64 = L"AAAA";
+        PutVaultResponse putResponse{};
+        if (FAILED(client.DevLogin(userId, token, &status)))
+        {
+            outError = "prewarm_login";
+            return false;
+        }
+        client.SetBearerToken(token);
+        if (FAILED(client.PutVault(userId, put, putResponse, &status)) || transport->ConnectCount() != 1 || server.AcceptCount() != 1)
+        {
+            outError = "prewarm_reuse connects=" + std::to_string(transport->ConnectCount());
+            return false;
+        }
+
+        SyncClient unreachable(L"http://127.0.0.1:1");
+        unreachable.SetTransport(transport);
+        unreachable.SetAllowInsecureHttp(true);
+        if (SUCCEEDED(unreachable.Prewarm(&status)) || status.ErrorCode != L"CLIENT_ERROR")
+        {
+            outError = "prewarm_unreachable";
+            return false;
+        }
+        return true;
+    }
+
+    // SyncHttpStatus::Timing: 最初の往復だけが新しい接続を開き、サーバーの遅延は最初のバイトまでの時間に、
+    // 本文の大きさは送受信量に出る。
+    bool RunTimingSelfTest(std::string& outError)
+    {
+        constexpr int32_t kLatencyMs = 50;
+        loadtest::StandInServerOptions options{};
+        options.ResponseLatency = std::chrono::milliseconds(kLatencyMs);
+        loadtest::StandInSyncServer server(options);
+        if (!server.Start(outError))
+        {
+            return false;
+        }
+        SyncClient client(server.BaseUrl());
+        client.SetTransport(std::make_shared<PosixSyncTransport>());
+        client.SetApiKind(SyncApiKind::Axum);
+        client.SetAllowInsecureHttp(true);
+
+        std::wstring const userId = L"timing@example.com";
+        std::wstring token;
+        SyncHttpStatus status{};
+        if (FAILED(client.DevLogin(userId, token, &status)) ||
+            status.Timing.RoundTrips != 1 || status.Timing.NewConnections != 1 || status.Timing.TimeToFirstByteMs < kLatencyMs - 5)
+        {
+            outError = "timing_login ttfb_ms=" + std::to_string(status.Timing.TimeToFirstByteMs);
+            return false;
+        }
+        client.SetBearerToken(token);
+
+        PutVaultRequest put{};
+        put.Blob.Ciphertext.assign(64 * 1024, 0x5A);
+        PutVaultResponse putResponse{};
+        client.SetVaultEncoding(SyncVaultEncoding::OctetStream);
+        if (FAILED(client.PutVault(userId, put, putResponse, &status)) ||
+            status.Timing.RoundTrips != 1 || status.Timing.NewConnections != 0 ||
+            status.Timing.DnsMs != 0 || status.Timing.ConnectMs != 0 ||
+            status.Timing.BytesSent < static_cast<int64_t>(put.Blob.Ciphertext.size()) || status.Timing.BytesReceived <= 0 ||
+            status.Timing.TimeToFirstByteMs < kLatencyMs - 5)
+        {
+            outError = "timing_put bytes_sent=" + std::to_string(status.Timing.BytesSent);
+            return false;
+        }
+
+        VaultRecord record{};
+        if (FAILED(client.GetVault(userId, record, &status)) ||
+            status.Timing.BytesReceived < static_cast<int64_t>(put.Blob.Ciphertext.size()) || status.Timing.BytesSent >= status.Timing.BytesReceived)
+        {
+            outError = "timing_get bytes_received=" + std::to_string(status.Timing.BytesReceived);
+            return false;
+        }
+        return true;
+    }
+
+    // SyncCoalescingQueue: debounce の間の要求は 1 回にまとまり、同期中の要求はその後にもう 1 回、
+    // 止めるときは予約済みの同期を debounce を待たずに行う。
+    bool RunCoalescingQueueSelfTest(std::string& outError)
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::vector<uint32_t> batches;
+        bool holdRun = false;
+        bool running = false;
+        HRESULT nextResult = S_OK;
+        auto sync = [&](uint32_t coalescedRequests) -> HRESULT
+        {
+            std::unique_lock lock(mutex);
+            batches.push_back(coalescedRequests);
+            running = true;
+            changed.notify_all();
+            changed.wait(lock, [&]() { return !holdRun; });
+            running = false;
+            return nextResult;
+        };
+
+        {
+            SyncCoalescingQueue queue(sync, std::chrono::milliseconds(50), std::chrono::seconds(5));
+            std::vector<std::shared_future<HRESULT>> futures;
+            for (int i = 0; i < 10; ++i)
+            {
+                futures.push_back(queue.Request());
+            }
+            for (auto const& future : futures)
+            {
+                if (future.wait_for(std::chrono::seconds(5)) != std::future_status::ready || future.get() != S_OK)
+                {
+                    outError = "coalesce_result";
+                    return false;
+                }
+            }
+            if (queue.RunCount() != 1 || batches != std::vector<uint32_t>{ 10 })
+            {
+                outError = "coalesce_batches runs=" + std::to_string(queue.RunCount());
+                return false;
+            }
+
+            // 同期中の要求は、走っている同期には混ぜずに次の 1 回になる。
+            {
+                std::lock_guard lock(mutex);
+                holdRun = true;
+                nextResult = E_FAIL;
+            }
+            std::shared_future<HRESULT> first = queue.Request();
+            {
+                std::unique_lock lock(mutex);
+                changed.wait(lock, [&]() { return running; });
+            }
+            std::shared_future<HRESULT> second = queue.Request();
+            std::shared_future<HRESULT> third = queue.Request();
+            {
+                std::lock_guard lock(mutex);
+                holdRun = false;
+            }
+            changed.notify_all();
+            if (first.get() != E_FAIL || second.get() != E_FAIL || !queue.WaitIdle(std::chrono::seconds(5)) ||
+                queue.RunCount() != 3 || batches != std::vector<uint32_t>{ 10, 1, 2 })
+            {
+                outError = "coalesce_during_run runs=" + std::to_string(queue.RunCount());
+                return false;
+            }
+        }
+
+        std::shared_future<HRESULT> pending;
+        {
+            SyncCoalescingQueue queue(sync, std::chrono::seconds(60), std::chrono::seconds(60));
+            nextResult = S_OK;
+            auto flushed = queue.Request();
+            queue.Flush();
+            if (flushed.wait_for(std::chrono::seconds(5)) != std::future_status::ready)
+            {
+                outError = "coalesce_flush";
+                return false;
+            }
+            pending = queue.Request();
+        }
+        if (pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready || pending.get() != S_OK)
+        {
+            outError = "coalesce_shutdown";
+            return false;
+        }
+        return true;
+    }
+
+    // 同じ user の世代が 1 件にまとまり、ファイルから読み直しても残ること、送っている間に積まれた世代を消さないこと、
+    // やり直しの待ち時間が倍々に延びて上限で止まること、キューのやり直しが止めるときに待たないことを確かめる。
+    bool RunOutboxSelfTest(std::string& outError)
+    {
+        std::error_code error;
+        std::filesystem::path path = std::filesystem::temp_directory_path(error) / ("sync_loadtest_outbox_" + std::to_string(getpid()) + ".log");
+        std::filesystem::remove(path, error);
+        auto removeFile = [&]() { std::filesystem::remove(path, error); };
+
+        uint64_t generation = 0;
+        {
+            SyncOutbox outbox(path);
+            uint64_t otherGeneration = 0;
+            if (FAILED(outbox.Enqueue(L"outbox-a", L"req-1", generation)) || FAILED(outbox.Enqueue(L"outbox-a", L"req-2", generation)) ||
+                FAILED(outbox.Enqueue(L"outbox-b", L"req-3", otherGeneration)) || generation != 2 || otherGeneration != 3)
+            {
+                removeFile();
+                outError = "outbox_enqueue";
+                return false;
+            }
+        }
+
+        SyncOutbox outbox(path);
+        SyncOutboxEntry entry{};
+        if (outbox.Entries().size() != 2 || !outbox.TryGetPending(L"outbox-a", entry) || entry.Generation != 2 ||
+            entry.PendingGenerations != 2 || entry.FirstRequestId != L"req-1" || entry.LastRequestId != L"req-2")
+        {
+            removeFile();
+            outError = "outbox_reload";
+            return false;
+        }
+        if (outbox.Complete(L"outbox-a", 1) != S_FALSE || !outbox.TryGetPending(L"outbox-a", entry) ||
+            outbox.Complete(L"outbox-a", 2) != S_OK || outbox.TryGetPending(L"outbox-a", entry))
+        {
+            removeFile();
+            outError = "outbox_complete";
+            return false;
+        }
+
+        std::chrono::milliseconds first{};
+        std::chrono::milliseconds second{};
+        if (outbox.RecordFailure(L"outbox-b", E_FAIL, 0xFFFFFFFFu, first) != S_OK ||
+            outbox.RecordFailure(L"outbox-b", E_FAIL, 0xFFFFFFFFu, second) != S_OK ||
+            first < SyncOutbox::kInitialBackoff / 2 || first > SyncOutbox::kInitialBackoff ||
+            second < SyncOutbox::kInitialBackoff || second > SyncOutbox::kInitialBackoff * 2 ||
+            SyncOutbox::BackoffDelay(64, 0) != SyncOutbox::kMaxBackoff / 2 ||
+            SyncOutbox::BackoffDelay(64, 0xFFFFFFFFu) > SyncOutbox::kMaxBackoff)
+        {
+            removeFile();
+            outError = "outbox_backoff";
+            return false;
+        }
+        {
+            SyncOutbox reloaded(path);
+            if (!reloaded.TryGetPending(L"outbox-b", entry) || entry.Attempts != 2 || entry.LastHr != E_FAIL ||
+                FAILED(reloaded.Enqueue(L"outbox-a", L"req-4", generation)) || generation != 4)
+            {
+                removeFile();
+                outError = "outbox_attempts";
+                return false;
+            }
+        }
+        removeFile();
+
+        std::atomic<uint32_t> retries{ 0 };
+        {
+            SyncCoalescingQueue queue([&](uint32_t coalescedRequests) -> HRESULT
+            {
+                if (coalescedRequests == 0)
+                {
+                    retries.fetch_add(1);
+                }
+                return S_OK;
+            }, std::chrono::seconds(60), std::chrono::seconds(60));
+            queue.RetryAfter(std::chrono::milliseconds(20));
+            auto deadline = Clock::now() + std::chrono::seconds(5);
+            while (retries.load() == 0 && Clock::now() < deadline)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            queue.RetryAfter(std::chrono::seconds(60));
+            if (!queue.WaitIdle(std::chrono::seconds(5)) || retries.load() != 1)
+            {
+                outError = "outbox_retry retries=" + std::to_string(retries.load());
+                return false;
+            }
+        }
+        if (retries.load() != 1)
+        {
+            outError = "outbox_retry_shutdown";
+            return false;
+        }
+        return true;
+    }
+
+    // SyncRetryPolicy の判断 (decorrelated jitter・Retry-After・409・手元の失敗・予算・circuit breaker) と、
+    // RunWithRetryAsync が呼び出し元を止めずに reactor のタイマーで待ち、送り直しを I/O スレッドで続けること、resync の push の段階が取消の前に手元へ書くことを確かめる。
+    bool RunRetryPolicySelfTest(std::shared_ptr<PosixSyncTransport> const& transport, std::string& outError)
+    {
+        using std::chrono::milliseconds;
+        if (SyncRetryPolicy::DecorrelatedJitter(milliseconds(100), milliseconds(1000), milliseconds(100), 0) != milliseconds(100) ||
+            SyncRetryPolicy::DecorrelatedJitter(milliseconds(100), milliseconds(1000), milliseconds(100), 200) != milliseconds(300) ||
+            SyncRetryPolicy::DecorrelatedJitter(milliseconds(100), milliseconds(1000), milliseconds(100), 201) != milliseconds(100) ||
+            SyncRetryPolicy::DecorrelatedJitter(milliseconds(100), milliseconds(1000), milliseconds(800), 2000) != milliseconds(1000))
+        {
+            outError = "retry_jitter";
+            return false;
+        }
+
+        SyncRetryOptions options{};
+        options.MaxAttempts = 4;
+        options.BaseDelay = milliseconds(10);
+        options.MaxDelay = milliseconds(40);
+        options.MaxRetryAfter = milliseconds(1000);
+        options.RetryBudget = 2.0;
+        options.RetryBudgetRefill = 1.0;
+        options.BreakerFailureThreshold = 100;
+        SyncRetryPolicy policy(options);
+        std::wstring const endpoint = L"http://policy.example";
+        SyncHttpStatus unavailable{};
+        unavailable.StatusCode = 503;
+        SyncHttpStatus conflict{};
+        conflict.StatusCode = 409;
+        conflict.ServerVersion = 3;
+        SyncHttpStatus notFound{};
+        notFound.StatusCode = 404;
+        SyncRetryDecision decision = policy.OnFailure(endpoint, 1, HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH), conflict, options.BaseDelay);
+        if (!decision.Retry || decision.Delay.count() != 0 || std::wstring(decision.Reason) != L"conflict_server_version" ||
+            policy.OnFailure(endpoint, 1, HRESULT_FROM_WIN32(ERROR_NOT_FOUND), notFound, options.BaseDelay).Retry ||
+            policy.OnFailure(endpoint, 4, E_FAIL, unavailable, options.BaseDelay).Retry)
+        {
+            outError = "retry_classification";
+            return false;
+        }
+        // Retry-After が jitter より長ければそれだけ待ち、上限を超えればその場では送り直さない。
+        unavailable.RetryAfterMs = 500;
+        decision = policy.OnFailure(endpoint, 1, E_FAIL, unavailable, options.BaseDelay);
+        if (!decision.Retry || decision.Delay != milliseconds(500) || std::wstring(decision.Reason) != L"retry_after")
+        {
+            outError = "retry_after";
+            return false;
+        }
+        unavailable.RetryAfterMs = 5000;
+        decision = policy.OnFailure(endpoint, 1, E_FAIL, unavailable, options.BaseDelay);
+        if (decision.Retry || std::wstring(decision.Reason) != L"retry_after_too_long")
+        {
+            outError = "retry_after_too_long";
+            return false;
+        }
+        // 予算 2 のうち 1 は上で使った。もう 1 回で尽き、成功で 1 戻る。
+        unavailable.RetryAfterMs = -1;
+        decision = policy.OnFailure(endpoint, 1, E_FAIL, unavailable, options.BaseDelay);
+        bool secondRetry = decision.Retry && decision.Delay >= options.BaseDelay && decision.Delay <= options.MaxDelay;
+        decision = policy.OnFailure(endpoint, 1, E_FAIL, unavailable, options.BaseDelay);
+        bool exhausted = !decision.Retry && std::wstring(decision.Reason) == L"budget_exhausted";
+        policy.RecordSuccess(endpoint);
+        if (!secondRetry || !exhausted || !policy.OnFailure(endpoint, 1, E_FAIL, unavailable, options.BaseDelay).Retry)
+        {
+            outError = "retry_budget";
+            return false;
+        }
+
+        // 応答のない失敗のうち、送る前の手元の失敗は送り直さず、breaker も開かない。transport の失敗は送り直す。
+        SyncRetryOptions localOptions = options;
+        localOptions.BreakerFailureThreshold = 1;
+        SyncRetryPolicy localPolicy(localOptions);
+        SyncHttpStatus noResponse{};
+        decision = localPolicy.OnFailure(endpoint, 1, E_FAIL, noResponse, options.BaseDelay);
+        bool localNotRetried = !decision.Retry && std::wstring(decision.Reason) == L"not_retryable" && SUCCEEDED(localPolicy.Admit(endpoint));
+        decision = localPolicy.OnFailure(endpoint, 1, HRESULT_FROM_WIN32(ERROR_WINHTTP_CANNOT_CONNECT), noResponse, options.BaseDelay);
+        if (!localNotRetried || std::wstring(decision.Reason) != L"circuit_open" || SUCCEEDED(localPolicy.Admit(endpoint)))
+        {
+            outError = "retry_local_failure";
+            return false;
+        }
+
+        loadtest::StandInServerOptions serverOptions{};
+        serverOptions.RetryAfterSeconds = 1;
+        loadtest::StandInSyncServer server(serverOptions);
+        if (!server.Start(outError))
+        {
+            return false;
+        }
+        SyncClient client(server.BaseUrl());
+        client.SetTransport(transport);
+        client.SetApiKind(SyncApiKind::Axum);
+        client.SetAllowInsecureHttp(true);
+        std::wstring const userId = L"retry@example.com";
+        std::wstring token;
+        SyncHttpStatus status{};
+        if (FAILED(client.DevLogin(userId, token, &status)))
+        {
+            outError = "retry_dev_login";
+            return false;
+        }
+        client.SetBearerToken(token);
+        PutVaultRequest put{};
+        put.Blob.CiphertextBase64 = L"QUJD";
+        // SyncClient の非同期 API で送る。結果は送り終えた I/O スレッドで受け取る。
+        bool retriedOnReactor = true;
+        auto putOnce = [&](uint32_t attempt) -> SyncTask<SyncRetryAttemptResult>
+        {
+            if (attempt > 1)
+            {
+                retriedOnReactor = retriedOnReactor && detail::IsSyncReactorThread();
+            }
+            SyncResult<PutVaultResponse> sent = co_await client.PutVaultAsync(userId, put);
+            SyncRetryAttemptResult result{ sent.Hr, std::move(sent.Status) };
+            PutVaultResponse const& response = sent.Value;
+            if (result.Hr == HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) && result.Status.ServerVersion >= 0)
+            {
+                put.ExpectedVersion = result.Status.ServerVersion;
+                put.NewVersion = result.Status.ServerVersion + 1;
+            }
+            else if (SUCCEEDED(result.Hr))
+            {
+                put.ExpectedVersion = response.VaultVersion;
+                put.NewVersion = response.VaultVersion + 1;
+            }
+            co_return result;
+        };
+
+        // 503 の Retry-After: 1 を待って送り直す。待つ間も呼び出し元は止まらない。
+        SyncRetryPolicy e2ePolicy(options);
+        std::wstring const serverEndpoint = server.BaseUrl();
+        server.InjectFault(loadtest::StandInFault::ServiceUnavailable, 1);
+        uint32_t retries = 0;
+        auto started = Clock::now();
+        auto task = RunWithRetryAsync(e2ePolicy, serverEndpoint, putOnce, [&](uint32_t, SyncRetryDecision const&) { ++retries; });
+        auto returnedAfter = Clock::now() - started;
+        SyncRetryOutcome outcome = task.Get();
+        auto elapsed = Clock::now() - started;
+        if (FAILED(outcome.Hr) || outcome.Attempts != 2 || retries != 1 || returnedAfter >= milliseconds(200) || elapsed < milliseconds(1000) ||
+            !retriedOnReactor)
+        {
+            outError = "retry_async_retry_after hr=" + std::to_string(outcome.Hr) + " attempts=" + std::to_string(outcome.Attempts);
+            return false;
+        }
+
+        // 409 は server_version を採って待たずに送り直す。
+        server.InjectFault(loadtest::StandInFault::Conflict, 1);
+        outcome = RunWithRetryAsync(e2ePolicy, serverEndpoint, putOnce, {}).Get();
+        if (FAILED(outcome.Hr) || outcome.Attempts != 2)
+        {
+            outError = "retry_async_conflict";
+            return false;
+        }
+
+        // 待っている間に取消すと、タイマーを待たずに戻る。
+        SyncRetryOptions slowOptions = options;
+        slowOptions.BaseDelay = milliseconds(5000);
+        slowOptions.MaxDelay = milliseconds(5000);
+        SyncRetryPolicy slowPolicy(slowOptions);
+        SyncCancellationSource cancel;
+        loadtest::StandInSyncServer plainServer;
+        if (!plainServer.Start(outError))
+        {
+            return false;
+        }
+        client = SyncClient(plainServer.BaseUrl());
+        client.SetTransport(transport);
+        client.SetApiKind(SyncApiKind::Axum);
+        client.SetAllowInsecureHttp(true);
+        if (FAILED(client.DevLogin(userId, token, &status)))
+        {
+            outError = "retry_dev_login_plain";
+            return false;
+        }
+        client.SetBearerToken(token);
+        put.ExpectedVersion = 0;
+        put.NewVersion = 1;
+        plainServer.InjectFault(loadtest::StandInFault::ServiceUnavailable, 1);
+        auto pending = RunWithRetryAsync(slowPolicy, plainServer.BaseUrl(), putOnce, {}, cancel.Token());
+        std::this_thread::sleep_for(milliseconds(100));
+        started = Clock::now();
+        cancel.Cancel();
+        outcome = pending.Get();
+        if (outcome.Hr != HRESULT_FROM_WIN32(ERROR_CANCELLED) || Clock::now() - started >= milliseconds(500))
+        {
+            outError = "retry_async_cancel";
+            return false;
+        }
+
+        // 続けて失敗すると breaker が開き、送らずに失敗を返す。時間が過ぎたら 1 回試し、成功すれば閉じる。
+        SyncRetryOptions breakerOptions = options;
+        breakerOptions.BaseDelay = milliseconds(1);
+        breakerOptions.MaxDelay = milliseconds(2);
+        breakerOptions.BreakerFailureThreshold = 2;
+        breakerOptions.BreakerOpenDuration = milliseconds(150);
+        SyncRetryPolicy breakerPolicy(breakerOptions);
+        std::wstring const plainEndpoint = plainServer.BaseUrl();
+        plainServer.InjectFault(loadtest::StandInFault::ServiceUnavailable, 3);
+        outcome = RunWithRetryAsync(breakerPolicy, plainEndpoint, putOnce, {}).Get();
+        uint64_t requestsBefore = plainServer.RequestCount();
+        SyncRetryOutcome rejected = RunWithRetryAsync(breakerPolicy, plainEndpoint, putOnce, {}).Get();
+        if (outcome.Attempts != 2 || std::wstring(outcome.LastDecision.Reason) != L"circuit_open" ||
+            rejected.Hr != HRESULT_FROM_WIN32(ERROR_RETRY) || rejected.Attempts != 0 || rejected.LastDecision.Delay.count() <= 0 ||
+            plainServer.RequestCount() != requestsBefore)
+        {
+            outError = "retry_breaker_open";
+            return false;
+        }
+        std::this_thread::sleep_for(milliseconds(200));
+        // 試しの 1 回が失敗すると、また開く。
+        outcome = RunWithRetryAsync(breakerPolicy, plainEndpoint, putOnce, {}).Get();
+        rejected = RunWithRetryAsync(breakerPolicy, plainEndpoint, putOnce, {}).Get();
+        if (outcome.Attempts != 1 || std::wstring(outcome.LastDecision.Reason) != L"circuit_open" || rejected.Hr != HRESULT_FROM_WIN32(ERROR_RETRY))
+        {
+            outError = "retry_breaker_probe_failed";
+            return false;
+        }
+        std::this_thread::sleep_for(milliseconds(200));
+        outcome = RunWithRetryAsync(breakerPolicy, plainEndpoint, putOnce, {}).Get();
+        SyncRetryOutcome after = RunWithRetryAsync(breakerPolicy, plainEndpoint, putOnce, {}).Get();
+        if (FAILED(outcome.Hr) || FAILED(after.Hr))
+        {
+            outError = "retry_breaker_closed";
+            return false;
+        }
+
+        // resync の pull_server の後に取り消しても、手元の変更を含む merge 結果は書いてから止まり、送らない。
+        std::string localVault = "local-edits";
+        SyncCancellationSource resyncCancel;
+        int pushes = 0;
+        auto pullServer = [&]()
+        {
+            localVault = "server";
+            resyncCancel.Cancel();
+        };
+        pullServer();
+        HRESULT hrPush = PersistMergedVaultThenPush(
+            [&]() { localVault = "merged"; return S_OK; },
+            [&]() { return resyncCancel.IsCancellationRequested(); },
+            [&]() { ++pushes; return S_OK; });
+        if (hrPush != HRESULT_FROM_WIN32(ERROR_CANCELLED) || localVault != "merged" || pushes != 0)
+        {
+            outError = "resync_cancel_after_pull local=" + localVault;
+            return false;
+        }
+        hrPush = PersistMergedVaultThenPush(
+            []() { return HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED); },
+            []() { return false; },
+            [&]() { ++pushes; return S_OK; });
+        if (hrPush != HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED) || pushes != 0 ||
+            PersistMergedVaultThenPush([]() { return S_OK; }, []() { return false; }, [&]() { ++pushes; return S_OK; }) != S_OK || pushes != 1)
+        {
+            outError = "resync_persist_then_push";
+            return false;
+        }
+        return true;
+    }
+
+    // 同期の状態が server と user の組ごとにファイルから読み直せること、読めない行を飛ばすこと、世代が戻らないこと、
+    // 残した版から始めた PutVault が 409 を受けずに 1 回で通ることを確かめる。
+    bool RunSyncStateStoreSelfTest(std::shared_ptr<PosixSyncTransport> const& transport, std::string& outError)
+    {
+        std::error_code error;
+        std::filesystem::path path = std::filesystem::temp_directory_path(error) / ("sync_loadtest_state_" + std::to_string(getpid()) + ".log");
+        std::filesystem::remove(path, error);
+        auto removeFile = [&]() { std::filesystem::remove(path, error); };
+
+        {
+            SyncStateStore store(path);
+            SyncStateRecord record{};
+            if (store.TryGet(L"http://a.example", L"state-a", record) ||
+                store.RecordServerVersion(L"http://a.example", L"state-a", 5, L"h5") != S_OK ||
+                store.RecordServerVersion(L"http://a.example", L"state-a", 5, L"h5") != S_FALSE ||
+                store.RecordServerVersion(L"http://a.example", L"state-b", 2, L"") != S_OK ||
+                store.RecordServerVersion(L"http://b.example", L"state-a", 9, L"h9") != S_OK ||
+                store.RecordSyncedGeneration(L"http://a.example", L"state-a", 7) != S_OK ||
+                store.RecordSyncedGeneration(L"http://a.example", L"state-a", 3) != S_FALSE ||
+                store.RecordServerVersion(L"", L"state-a", 1, L"") != E_INVALIDARG ||
+                store.RecordServerVersion(L"http://a.example", L"state-a", -1, L"") != E_INVALIDARG)
+            {
+                removeFile();
+                outError = "sync_state_record";
+                return false;
+            }
+        }
+        {
+            std::ofstream append(path, std::ios::binary | std::ios::app);
+            append << "state\tbroken\n" << "state\thttp://c.example\tstate-a\tx\t\t0\t0\n";
+        }
+
+        SyncStateStore reloaded(path);
+        SyncStateRecord record{};
+        if (reloaded.Records().size() != 3 || !reloaded.TryGet(L"http://a.example", L"state-a", record) ||
+            record.ServerVersion != 5 || record.BlobSha256Base64 != L"h5" || record.SyncedGeneration != 7 || record.UpdatedAtUnixMs <= 0 ||
+            !reloaded.TryGet(L"http://b.example", L"state-a", record) || record.ServerVersion != 9 || record.SyncedGeneration != 0)
+        {
+            removeFile();
+            outError = "sync_state_reload";
+            return false;
+        }
+        // サーバーを作り直して版が下がっても、見たままを残す。
+        if (reloaded.RecordServerVersion(L"http://b.example", L"state-a", 1, L"") != S_OK ||
+            !reloaded.TryGet(L"http://b.example", L"state-a", record) || record.ServerVersion != 1)
+        {
+            removeFile();
+            outError = "sync_state_rollback";
+            return false;
+        }
+        removeFile();
+
+        loadtest::StandInSyncServer server;
+        if (!server.Start(outError))
+        {
+            return false;
+        }
+        SyncClient client(server.BaseUrl());
+        client.SetTransport(transport);
+        client.SetApiKind(SyncApiKind::Axum);
+        client.SetAllowInsecureHttp(true);
+        std::wstring const userId = L"state@example.com";
+        std::wstring token;
+        SyncHttpStatus status{};
+        if (FAILED(client.DevLogin(userId, token, &status)))
+        {
+            outError = "sync_state_dev_login";
+            return false;
+        }
+        client.SetBearerToken(token);
+
+        // 1 回目のプロセス: 0 から 2 回送り、応答の版を残す。
+        PutVaultRequest put{};
+        put.Blob.CiphertextBase64 = L"QUJD";
+        PutVaultResponse response{};
+        {
+            SyncStateStore store(path);
+            for (int i = 0; i < 2; ++i)
+            {
+                SyncStateRecord state{};
+                put.ExpectedVersion = store.TryGet(server.BaseUrl(), userId, state) ? state.ServerVersion : 0;
+                put.NewVersion = put.ExpectedVersion + 1;
+                status = {};
+                if (FAILED(client.PutVault(userId, put, response, &status)) ||
+                    FAILED(store.RecordServerVersion(server.BaseUrl(), userId, response.VaultVersion, response.BlobSha256Base64)))
+                {
+                    removeFile();
+                    outError = "sync_state_put_seed status=" + std::to_string(status.StatusCode);
+                    return false;
+                }
+            }
+        }
+
+        // 次のプロセス: 残した版から始めれば 1 回で通る。0 から始めると 409 になる。
+        SyncStateStore store(path);
+        SyncStateRecord state{};
+        if (!store.TryGet(server.BaseUrl(), userId, state) || state.ServerVersion != 2)
+        {
+            removeFile();
+            outError = "sync_state_put_reload";
+            return false;
+        }
+        put.ExpectedVersion = 0;
+        put.NewVersion = 1;
+        status = {};
+        HRESULT hrStale = client.PutVault(userId, put, response, &status);
+        put.ExpectedVersion = state.ServerVersion;
+        put.NewVersion = state.ServerVersion + 1;
+        SyncHttpStatus seededStatus{};
+        HRESULT hrSeeded = client.PutVault(userId, put, response, &seededStatus);
+        removeFile();
+        if (hrStale != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) || FAILED(hrSeeded) || response.VaultVersion != 3)
+        {
+            outError = "sync_state_put_first_attempt hr=" + std::to_string(hrSeeded) + " status=" + std::to_string(seededStatus.StatusCode);
+            return false;
+        }
+        return true;
+    }
+
+    // 409 の本文でサーバーの vault を受け取り、merge して送り直す PUT が、競合しても 2 往復で済むこと、
+    // 求めなければ vault が付かないこと、merge の失敗で送り直さないことを JSON と octet-stream の両方で確かめる。
+    bool RunDeltaStateStoreSelfTest(std::string& outError)
+    {
+        std::error_code error;
+        std::filesystem::path path = std::filesystem::temp_directory_path(error) / ("sync_loadtest_delta_state_" + std::to_string(getpid()) + ".log");
+        std::filesystem::remove(path, error);
+        auto removeFile = [&]() { std::filesystem::remove(path, error); };
+
+        {
+            SyncDeltaStateStore store(path);
+            SyncDeltaState state{ L"delta-a", 12 };
+            state.Items[L"item-1"] = SyncDeltaItemState{ 3, L"2026-01-01T00:00:00Z", false };
+            state.Items[L"item-2"] = SyncDeltaItemState{ 5, L"2026-01-02T00:00:00Z", true };
+            SyncDeltaState other{ L"delta-a", 4 };
+            SyncDeltaState loaded{};
+            if (store.TryGet(L"http://a.example", L"delta-a", loaded) ||
+                store.Record(L"http://a.example", state) != S_OK ||
+                store.Record(L"http://b.example", other) != S_OK ||
+                store.Record(L"", state) != E_INVALIDARG ||
+                store.Record(L"http://a.example", SyncDeltaState{ L"delta-a", -1 }) != E_INVALIDARG)
+            {
+                removeFile();
+                outError = "delta_state_record";
+                return false;
+            }
+        }
+        {
+            std::ofstream append(path, std::ios::binary | std::ios::app);
+            append << "cursor\tbroken\n"
+                   << "item\thttp://a.example\tdelta-a\titem-3\tx\t\t0\n"
+                   << "item\thttp://c.example\tdelta-a\titem-1\t1\t\t0\n";
+        }
+
+        // 壊れた行と cursor のない組は読まない。
+        SyncDeltaStateStore reloaded(path);
+        SyncDeltaState state{};
+        if (!reloaded.TryGet(L"http://a.example", L"delta-a", state) || state.UserId != L"delta-a" || state.Cursor != 12 ||
+            state.Items.size() != 2 || state.Items[L"item-1"].ItemVersion != 3 || state.Items[L"item-1"].Deleted ||
+            state.Items[L"item-2"].UpdatedAt != L"2026-01-02T00:00:00Z" || !state.Items[L"item-2"].Deleted ||
+            !reloaded.TryGet(L"http://b.example", L"delta-a", state) || state.Cursor != 4 || !state.Items.empty() ||
+            reloaded.TryGet(L"http://c.example", L"delta-a", state))
+        {
+            removeFile();
+            outError = "delta_state_reload";
+            return false;
+        }
+        // 組ごとに丸ごと置き換える。
+        SyncDeltaState replaced{ L"delta-a", 13 };
+        if (reloaded.Record(L"http://a.example", replaced) != S_OK ||
+            !SyncDeltaStateStore(path).TryGet(L"http://a.example", L"delta-a", state) || state.Cursor != 13 || !state.Items.empty())
+        {
+            removeFile();
+            outError = "delta_state_replace";
+            return false;
+        }
+        removeFile();
+        return true;
+    }
+
+    bool RunConflictVaultSelfTest(std::shared_ptr<PosixSyncTransport> const& transport, std::string& outError)
+    {
+        loadtest::StandInSyncServer server;
+        if (!server.Start(outError))
+        {
+            return false;
+        }
+        for (SyncVaultEncoding encoding : { SyncVaultEncoding::Base64Json, SyncVaultEncoding::OctetStream })
+        {
+            std::string label = encoding == SyncVaultEncoding::OctetStream ? "octet" : "json";
+            std::wstring const userId = encoding == SyncVaultEncoding::OctetStream ? L"conflict-octet@example.com" : L"conflict-json@example.com";
+            SyncClient client(server.BaseUrl());
+            client.SetTransport(transport);
+            client.SetApiKind(SyncApiKind::Axum);
+            client.SetVaultEncoding(encoding);
+            client.SetAllowInsecureHttp(true);
+            std::wstring token;
+            SyncHttpStatus status{};
+            if (FAILED(client.DevLogin(userId, token, &status)))
+            {
+                outError = "conflict_vault_dev_login_" + label;
+                return false;
+            }
+            client.SetBearerToken(token);
+
+            // この端末が版 1 を書いた後、別の端末が版 2 を書く。
+            PutVaultRequest put{};
+            put.Blob.CiphertextBase64 = L"QUJD";
+            put.ExpectedVersion = 0;
+            put.NewVersion = 1;
+            PutVaultResponse response{};
+            PutVaultRequest other = put;
+            other.Blob.CiphertextBase64 = L"REVG";
+            other.ExpectedVersion = 1;
+            other.NewVersion = 2;
+            if (FAILED(client.PutVault(userId, put, response, &status)) || FAILED(client.PutVault(userId, other, response, &status)))
+            {
+                outError = "conflict_vault_seed_" + label;
+                return false;
+            }
+
+            // 求めなければ 409 に vault は付かない。
+            put.ExpectedVersion = 1;
+            put.NewVersion = 2;
+            put.Blob.CiphertextBase64 = L"R0hJ";
+            if (client.PutVault(userId, put, response, &status) != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) ||
+                response.ConflictVault || status.ServerVersion != 2)
+            {
+                outError = "conflict_vault_not_requested_" + label;
+                return false;
+            }
+
+            // merge が失敗すれば送り直さない。
+            uint64_t requestsBefore = server.RequestCount();
+            HRESULT hr = client.PutVaultWithConflictMerge(userId, put, [](VaultRecord const&, PutVaultRequest&) { return E_ABORT; }, response, &status);
+            if (hr != E_ABORT || server.RequestCount() - requestsBefore != 1 || put.ExpectedVersion != 1)
+            {
+                outError = "conflict_vault_merge_failed_" + label;
+                return false;
+            }
+
+            // 受け取ったサーバーの vault と merge して送り直す。PUT 2 回 (GET なし) で通る。
+            std::wstring seenBlob;
+            int64_t seenVersion = 0;
+            requestsBefore = server.RequestCount();
+            hr = client.PutVaultWithConflictMerge(userId, put, [&](VaultRecord const& serverVault, PutVaultRequest& request)
+            {
+                seenBlob = serverVault.Blob.CiphertextBase64;
+                seenVersion = serverVault.VaultVersion;
+                request.Blob.CiphertextBase64 = L"REVGR0hJ";
+                request.Blob.Ciphertext.clear();
+                return S_OK;
+            }, response, &status);
+            uint64_t roundTrips = server.RequestCount() - requestsBefore;
+            VaultRecord record{};
+            if (FAILED(hr) || response.ConflictMerges != 1 || response.VaultVersion != 3 || roundTrips != 2 ||
+                seenBlob != L"REVG" || seenVersion != 2 || put.ExpectedVersion != 2 || put.NewVersion != 3 ||
+                FAILED(client.GetVault(userId, record, &status)) || record.VaultVersion != 3)
+            {
+                outError = "conflict_vault_merge_" + label + " hr=" + std::to_string(hr) + " round_trips=" + std::to_string(roundTrips);
+                return false;
+            }
+            bool storedMerged = encoding == SyncVaultEncoding::OctetStream ?
+                std::string(record.Blob.Ciphertext.begin(), record.Blob.Ciphertext.end()) == "DEFGHI" :
+                record.Blob.CiphertextBase64 == L"REVGR0hJ";
+            if (!storedMerged)
+            {
+                outError = "conflict_vault_stored_" + label;
+                return false;
+            }
+        }
+        if (server.ConflictVaultCount() != 4)
+        {
+            outError = "conflict_vault_count=" + std::to_string(server.ConflictVaultCount());
+            return false;
+        }
+        return true;
+    }
+
+    // アプリの 1 回の vault 同期 (token の取得・PUT・GET) をまねる。token は SyncTokenCache::getInstance() から使い回す。
+    HRESULT SyncOneVault(std::wstring const& baseUrl, std::shared_ptr<ISyncTransport> const& transport, std::wstring const& userId, size_t blobBytes)
+    {
+        SyncClient client(baseUrl);
+        client.SetTransport(transport);
+        client.SetApiKind(SyncApiKind::Axum);
+        client.SetAllowInsecureHttp(true);
+        SyncHttpStatus status{};
+        SyncCachedToken cached{};
+        if (!SyncTokenCache::getInstance().TryGet(baseUrl, userId, cached))
+        {
+            HRESULT hr = client.DevLogin(userId, cached.BearerToken, &status);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+            SyncTokenCache::getInstance().Store(baseUrl, userId, cached, 0);
+        }
+        client.SetBearerToken(cached.BearerToken);
+
+        VaultRecord record{};
+        HRESULT hr = client.GetVault(userId, record, &status);
+        if (FAILED(hr) && status.StatusCode != 404)
+        {
+            return hr;
+        }
+        PutVaultRequest put{};
+        put.Blob.CiphertextBase64.assign(((blobBytes + 2) / 3) * 4, L'A');
+        put.ExpectedVersion = SUCCEEDED(hr) ? record.VaultVersion : 0;
+        put.NewVersion = put.ExpectedVersion + 1;
+        PutVaultResponse response{};
+        return client.PutVault(userId, put, response, &status);
+    }
+
+    // N 個の vault を 1 つずつ同期した時間と、SyncVaultExecutor で並べて同期した時間を比べる。
+    // どちらも初めての user で始める (token の取得も含めて測る)。
+    int RunVaultSyncBenchmark(LoadTestOptions options)
+    {
+        std::unique_ptr<loadtest::StandInSyncServer> server;
+        if (options.BaseUrl.empty())
+        {
+            server = std::make_unique<loadtest::StandInSyncServer>(options.Server);
+            std::string error;
+            if (!server->Start(error))
+            {
+                fprintf(stderr, "error: %s\n", error.c_str());
+                return 2;
+            }
+            options.BaseUrl = server->BaseUrl();
+        }
+
+        auto transport = std::make_shared<PosixSyncTransport>();
+        auto vaultUser = [](char const* pass, uint32_t index)
+        {
+            std::string user = std::string("vault-") + pass + "-" + std::to_string(index) + "@example.com";
+            return std::wstring(user.begin(), user.end());
+        };
+        auto millisSince = [](Clock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        };
+
+        uint32_t failures = 0;
+        Clock::time_point start = Clock::now();
+        for (uint32_t i = 0; i < options.Vaults; ++i)
+        {
+            failures += FAILED(SyncOneVault(options.BaseUrl, transport, vaultUser("serial", i), options.BlobBytes)) ? 1 : 0;
+        }
+        double serialMs = millisSince(start);
+
+        SyncVaultExecutor executor(options.Concurrency);
+        std::vector<std::shared_future<HRESULT>> futures;
+        futures.reserve(options.Vaults);
+        start = Clock::now();
+        for (uint32_t i = 0; i < options.Vaults; ++i)
+        {
+            std::wstring userId = vaultUser("parallel", i);
+            futures.push_back(executor.Submit(SyncVaultExecutor::BuildVaultKey(options.BaseUrl, userId), [&, userId](SyncCancellationToken const&)
+            {
+                return SyncOneVault(options.BaseUrl, transport, userId, options.BlobBytes);
+            }));
+        }
+        for (auto const& future : futures)
+        {
+            failures += FAILED(future.get()) ? 1 : 0;
+        }
+        double parallelMs = millisSince(start);
+
+        printf("url=%s vaults=%u max_parallel=%u blob_bytes=%zu\n",
+            Narrow(options.BaseUrl).c_str(),
+            options.Vaults,
+            executor.MaxParallel(),
+            options.BlobBytes);
+        printf("serial_ms=%.3f parallel_ms=%.3f speedup=%.2f peak_running=%u failures=%u connects=%llu\n",
+            serialMs,
+            parallelMs,
+            parallelMs > 0 ? serialMs / parallelMs : 0.0,
+            executor.PeakRunning(),
+            failures,
+            static_cast<unsigned long long>(transport->ConnectCount()));
+        return failures == 0 ? 0 : 1;
+    }
+
+    // 違う vault の仕事が上限まで並んで走り、同じ vault の仕事は積んだ順に 1 つずつ走ること、
+    // 同じ vault の仕事が待っている間も違う vault の仕事は先に進むこと、取消と例外を確かめる。
+    // 最後に応答の遅いスタンドインサーバーで、4 つの vault の同期が 1 つ分程度の時間で終わることを確かめる。
+    bool RunVaultExecutorSelfTest(std::shared_ptr<PosixSyncTransport> const& transport, std::string& outError)
+    {
+        constexpr auto kJobTime = std::chrono::milliseconds(100);
+        {
+            SyncVaultExecutor executor(3);
+            std::vector<std::shared_future<HRESULT>> futures;
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < 6; ++i)
+            {
+                futures.push_back(executor.Submit(SyncVaultExecutor::BuildVaultKey(L"http://sync", L"user-" + std::to_wstring(i)), [&](SyncCancellationToken const&)
+                {
+                    std::this_thread::sleep_for(kJobTime);
+                    return S_OK;
+                }));
+            }
+            for (auto const& future : futures)
+            {
+                if (future.get() != S_OK)
+                {
+                    outError = "vault_executor_result";
+                    return false;
+                }
+            }
+            auto elapsed = Clock::now() - start;
+            // 3 本ずつ 2 回分。直列なら 6 回分かかる。
+            if (elapsed < 2 * kJobTime || elapsed > 4 * kJobTime || executor.PeakRunning() != 3)
+            {
+                outError = "vault_executor_parallel elapsed_ms=" +
+                    std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()) +
+                    " peak=" + std::to_string(executor.PeakRunning());
+                return false;
+            }
+        }
+
+        {
+            SyncVaultExecutor executor(2);
+            std::mutex mutex;
+            std::vector<std::string> finished;
+            std::atomic<int> sameVaultRunning{ 0 };
+            bool overlapped = false;
+            std::wstring const sameKey = SyncVaultExecutor::BuildVaultKey(L"http://sync", L"shared", L"team");
+            std::vector<std::shared_future<HRESULT>> futures;
+            for (int i = 0; i < 3; ++i)
+            {
+                futures.push_back(executor.Submit(sameKey, [&, i](SyncCancellationToken const&)
+                {
+                    if (sameVaultRunning.fetch_add(1) != 0)
+                    {
+                        overlapped = true;
+                    }
+                    std::this_thread::sleep_for(kJobTime / 2);
+                    sameVaultRunning.fetch_sub(1);
+                    std::lock_guard lock(mutex);
+                    finished.push_back("same-" + std::to_string(i));
+                    return S_OK;
+                }));
+            }
+            futures.push_back(executor.Submit(SyncVaultExecutor::BuildVaultKey(L"http://sync", L"personal"), [&](SyncCancellationToken const&)
+            {
+                std::lock_guard lock(mutex);
+                finished.push_back("other");
+                return S_OK;
+            }));
+            for (auto const& future : futures)
+            {
+                future.wait();
+            }
+            // 同じ vault の 2 つ目は 1 つ目が終わるまで待つが、違う vault の仕事はその間に終わる。
+            std::vector<std::string> const expected{ "same-0", "same-1", "same-2" };
+            std::vector<std::string> sameOrder;
+            std::copy_if(finished.begin(), finished.end(), std::back_inserter(sameOrder), [](std::string const& name) { return name != "other"; });
+            if (overlapped || finished.size() != 4 || sameOrder != expected ||
+                std::find(finished.begin(), finished.end(), "other") > std::find(finished.begin(), finished.end(), "same-1"))
+            {
+                outError = "vault_executor_same_vault";
+                return false;
+            }
+
+            SyncCancellationSource cancellation;
+            cancellation.Cancel();
+            bool called = false;
+            HRESULT cancelled = executor.Submit(sameKey, [&](SyncCancellationToken const&) { called = true; return S_OK; }, cancellation.Token()).get();
+            HRESULT thrown = executor.Submit(sameKey, [](SyncCancellationToken const&) -> HRESULT { throw std::runtime_error("job"); }).get();
+            if (cancelled != HRESULT_FROM_WIN32(ERROR_CANCELLED) || called || thrown != E_FAIL ||
+                !executor.WaitIdle(std::chrono::seconds(5)) || executor.PeakRunning() != 2)
+            {
+                outError = "vault_executor_cancel_or_throw";
+                return false;
+            }
+        }
+
+        loadtest::StandInServerOptions serverOptions{};
+        serverOptions.ResponseLatency = kJobTime;
+        loadtest::StandInSyncServer server(serverOptions);
+        if (!server.Start(outError))
+        {
+            return false;
+        }
+        SyncVaultExecutor executor;
+        std::vector<std::shared_future<HRESULT>> futures;
+        Clock::time_point start = Clock::now();
+        for (uint32_t i = 0; i < SyncVaultExecutor::kDefaultMaxParallel; ++i)
+        {
+            std::wstring userId = L"executor-" + std::to_wstring(i) + L"@example.com";
+            futures.push_back(executor.Submit(SyncVaultExecutor::BuildVaultKey(server.BaseUrl(), userId), [&, userId](SyncCancellationToken const&)
+            {
+                return SyncOneVault(server.BaseUrl(), transport, userId, 256);
+            }));
+        }
+        for (auto const& future : futures)
+        {
+            if (FAILED(future.get()))
+            {
+                outError = "vault_executor_sync";
+                return false;
+            }
+        }
+        // 1 つの同期は 3 往復 (login・GET・PUT)。直列なら 4 倍かかる。
+        auto elapsed = Clock::now() - start;
+        if (elapsed > 6 * kJobTime)
+        {
+            outError = "vault_executor_sync_elapsed_ms=" + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+            return false;
+        }
+        return true;
+    }
+
+    // opaque-ffi をリンクしたビルドでは OPAQUE の register/login で得た token で vault を読み書きできることを、
+    // していないビルドではクライアントとスタンドインサーバーの両方が使えないと答えることを確かめる。
+    bool RunOpaqueSelfTest(loadtest::StandInSyncServer& server, std::shared_ptr<PosixSyncTransport> const& transport, std::string& outError)
+    {
+        SyncClient client(server.BaseUrl());
+        client.SetTransport(transport);
+        client.SetApiKind(SyncApiKind::Axum);
+        client.SetAllowInsecureHttp(true);
+
+        std::wstring const userId = L"opaque@example.com";
+        std::wstring token;
+        std::vector<uint8_t> sessionKey;
+        SyncHttpStatus status{};
+#if TSUPASSWD_SYNC_LOADTEST_OPAQUE
+        std::vector<uint8_t> exportKey;
+        if (!server.OpaqueAvailable() ||
+            FAILED(client.OpaqueRegister(userId, L"recovery", &exportKey, &status)) ||
+            FAILED(client.OpaqueLogin(userId, L"recovery", token, &sessionKey, &status)) || token.empty() || sessionKey.empty())
+        {
+            outError = "opaque_login";
+            return false;
+        }
+        std::wstring rejectedToken;
+        if (SUCCEEDED(client.OpaqueLogin(userId, L"wrong", rejectedToken, nullptr, &status)))
+        {
+            outError = "opaque_wrong_password";
+            return false;
+        }
+
+        client.SetBearerToken(token);
+        PutVaultRequest put{};
+        put.Blob.CiphertextBase64 = L"AAAA";
+        PutVaultResponse putResponse{};
+        if (FAILED(client.PutVault(userId, put, putResponse, &status)) || putResponse.VaultVersion != 1)
+        {
+            outError = "opaque_token";
+            return false;
+        }
+        return true;
+#else
+        HRESULT hr = client.OpaqueLogin(userId, L"recovery", token, &sessionKey, &status);
+        if (server.OpaqueAvailable() || SUCCEEDED(hr) || status.ErrorCode != L"OPAQUE_CLIENT_ERROR")
+        {
+            outError = "opaque_unavailable";
+            return false;
+        }
+
+        // クライアントを通さずに送っても、サーバーは 503 で断る。
+        std::string const body = "{\"email\":\"opaque@example.com\",\"credential_request_base64\":\"AA==\"}";
+        SyncTransportRequest request{};
+        request.Method = "POST";
+        request.Host = "127.0.0.1";
+        request.Port = server.Port();
+        request.Secure = false;
+        request.Path = "/v1/auth/login/start";
+        request.Headers.push_back(SyncHttpHeader{ "Content-Type", "application/json" });
+        request.Body = body;
+        SyncTransportResponse response{};
+        if (FAILED(transport->Send(request, response)) || response.StatusCode != 503 || response.Body.find("OPAQUE_UNAVAILABLE") == std::string::npos)
+        {
+            outError = "opaque_server_unavailable";
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    // スタンドインサーバーの故障注入を確かめる。InjectFault は次の要求に、割合は種で決まる要求に故障を起こす。
+    bool RunFaultInjectionSelfTest(std::shared_ptr<PosixSyncTransport> const& transport, std::string& outError)
+    {
+        loadtest::StandInSyncServer server;
+        if (!server.Start(outError))
+        {
+            return false;
+        }
+        auto makeClient = [&](std::wstring const& baseUrl)
+        {
+            SyncClient client(baseUrl);
+            client.SetTransport(transport);
+            client.SetApiKind(SyncApiKind::Axum);
+            client.SetAllowInsecureHttp(true);
+            return client;
+        };
+
+        std::wstring const userId = L"faults@example.com";
+        std::wstring token;
+        SyncHttpStatus status{};
+        SyncClient client = makeClient(server.BaseUrl());
+        server.InjectFault(loadtest::StandInFault::ServiceUnavailable, 1);
+        HRESULT hr = client.DevLogin(userId, token, &status);
+        if (SUCCEEDED(hr) || status.StatusCode != 503 || status.ErrorCode != L"SERVICE_UNAVAILABLE" ||
+            FAILED(client.DevLogin(userId, token, &status)))
+        {
+            outError = "inject_service_unavailable";
+            return false;
+        }
+        client.SetBearerToken(token);
+
+        // vault がまだなければ 409 は起こさず、次の既存 vault への PUT で起こす。
+        server.InjectFault(loadtest::StandInFault::Conflict, 1);
+        PutVaultRequest put{};
+        put.Blob.CiphertextBase64 = L"AAAA";
+        PutVaultResponse putResponse{};
+        if (FAILED(client.PutVault(userId, put, putResponse, &status)) || putResponse.VaultVersion != 1)
+        {
+            outError = "inject_conflict_new_vault";
+            return false;
+        }
+        put.ExpectedVersion = 1;
+        put.NewVersion = 2;
+        hr = client.PutVault(userId, put, putResponse, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) || status.ServerVersion != 2)
+        {
+            outError = "inject_conflict";
+            return false;
+        }
+        put.ExpectedVersion = 2;
+        put.NewVersion = 3;
+        if (FAILED(client.PutVault(userId, put, putResponse, &status)) || putResponse.VaultVersion != 3)
+        {
+            outError = "inject_conflict_retry";
+            return false;
+        }
+
+        server.InjectFault(loadtest::StandInFault::Unauthorized, 1);
+        VaultRecord record{};
+        hr = client.GetVault(userId, record, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED) || status.StatusCode != 401 || status.ErrorCode != L"AUTH_EXPIRED" ||
+            FAILED(client.GetVault(userId, record, &status)) || record.VaultVersion != 3 || server.InjectedFaultCount() != 3)
+        {
+            outError = "inject_unauthorized";
+            return false;
+        }
+
+        // 同じ種なら同じ要求が失敗する。
+        auto sampleFailures = [&](std::vector<bool>& outFailed) -> bool
+        {
+            loadtest::StandInServerOptions options{};
+            options.ErrorRate = 0.25;
+            options.FaultSeed = 7;
+            loadtest::StandInSyncServer faulty(options);
+            if (!faulty.Start(outError))
+            {
+                return false;
+            }
+            SyncClient sampled = makeClient(faulty.BaseUrl());
+            for (int i = 0; i < 200; ++i)
+            {
+                outFailed.push_back(FAILED(sampled.DevLogin(userId, token, &status)) && status.StatusCode == 503);
+            }
+            return faulty.InjectedFaultCount() == static_cast<uint64_t>(std::count(outFailed.begin(), outFailed.end(), true));
+        };
+        std::vector<bool> first;
+        std::vector<bool> second;
+        if (!sampleFailures(first) || !sampleFailures(second) || first != second)
+        {
+            outError = "fault_rate_seed";
+            return false;
+        }
+        auto failures = std::count(first.begin(), first.end(), true);
+        if (failures < 25 || failures > 75)
+        {
+            outError = "fault_rate failures=" + std::to_string(failures);
+            return false;
+        }
+        return true;
+    }
+
+    // 実ソケットでスタンドインサーバーと往復し、状態コードの対応付けと keep-alive の再利用を確かめる。
+    // 2 台の端末が item 単位の差分同期で 1000 件の vault を共有する。
+    // 1 件の変更と 1 件の削除で送受信する本文が、vault の大きさではなく変更の件数に比例することを確かめる。
+    bool RunDeltaSelfTest(loadtest::StandInSyncServer& server, std::shared_ptr<PosixSyncTransport> const& transport, std::string& outError)
+    {
+        constexpr size_t kItemCount = 1000;
+        constexpr size_t kSealedItemBytes = 256;
+        std::wstring const userId = L"delta@example.com";
+
+        auto makeDevice = [&](SyncClient& device) -> bool
+        {
+            device.SetTransport(transport);
+            device.SetApiKind(SyncApiKind::Axum);
+            device.SetAllowInsecureHttp(true);
+            std::wstring token;
+            SyncHttpStatus status{};
+            if (FAILED(device.DevLogin(userId, token, &status)))
+            {
+                return false;
+            }
+            device.SetBearerToken(token);
+            return true;
+        };
+        SyncClient deviceA(server.BaseUrl());
+        SyncClient deviceB(server.BaseUrl());
+        if (!makeDevice(deviceA) || !makeDevice(deviceB))
+        {
+            outError = "delta_dev_login";
+            return false;
+        }
+
+        auto sealedItem = [&](size_t index, uint8_t revision)
+        {
+            std::vector<uint8_t> sealed(kSealedItemBytes);
+            for (size_t i = 0; i < sealed.size(); ++i)
+            {
+                sealed[i] = static_cast<uint8_t>(index * 31 + i + revision);
+            }
+            return sealed;
+        };
+        auto itemId = [](size_t index)
+        {
+            return L"item-" + std::to_wstring(index);
+        };
+
+        // 端末 A が全件を作る。
+        PutVaultDeltaRequest initial{};
+        initial.DeviceId = L"device-a";
+        for (size_t i = 0; i < kItemCount; ++i)
+        {
+            initial.Items.push_back(VaultItemRecord{ itemId(i), 0, false, sealedItem(i, 0), L"2026-01-01T00:00:00Z" });
+        }
+        SyncHttpStatus status{};
+        PutVaultDeltaResponse putResponse{};
+        uint64_t before = server.RequestBodyBytes() + server.ResponseBodyBytes();
+        if (FAILED(deviceA.PutVaultDelta(userId, initial, putResponse, &status)) || putResponse.BaseCursor != 0 ||
+            putResponse.Cursor != static_cast<int64_t>(kItemCount) || putResponse.Items.size() != kItemCount)
+        {
+            outError = "delta_initial_put";
+            return false;
+        }
+        uint64_t fullBytes = server.RequestBodyBytes() + server.ResponseBodyBytes() - before;
+        int64_t cursorA = putResponse.Cursor;
+
+        // 端末 B は cursor 0 からページ単位で全件を引く。
+        std::map<std::wstring, VaultItemRecord> itemsB;
+        int64_t cursorB = 0;
+        auto pullB = [&](size_t& outCount) -> bool
+        {
+            outCount = 0;
+            VaultChanges changes{};
+            do
+            {
+                if (FAILED(deviceB.GetVaultChanges(userId, cursorB, changes, &status, 300)) || changes.Cursor < cursorB)
+                {
+                    return false;
+                }
+                for (auto& item : changes.Items)
+                {
+                    std::wstring id = item.ItemId;
+                    itemsB[id] = std::move(item);
+                    ++outCount;
+                }
+                cursorB = changes.Cursor;
+            } while (changes.HasMore);
+            return true;
+        };
+        size_t pulled = 0;
+        if (!pullB(pulled) || pulled != kItemCount || itemsB.size() != kItemCount || cursorB != cursorA ||
+            itemsB[itemId(7)].SealedItem != sealedItem(7, 0) || itemsB[itemId(7)].ItemVersion != 1)
+        {
+            outError = "delta_initial_pull pulled=" + std::to_string(pulled);
+            return false;
+        }
+
+        // 端末 B は cursor と item の版を残して終わる。
+        std::error_code error;
+        std::filesystem::path statePath = std::filesystem::temp_directory_path(error) / ("sync_loadtest_delta_resume_" + std::to_string(getpid()) + ".log");
+        std::filesystem::remove(statePath, error);
+        auto removeStateFile = [&]() { std::filesystem::remove(statePath, error); };
+        {
+            SyncDeltaState stateB{ userId, cursorB };
+            for (auto const& [id, item] : itemsB)
+            {
+                stateB.Items[id] = SyncDeltaItemState{ item.ItemVersion, item.UpdatedAt, item.Deleted };
+            }
+            if (SyncDeltaStateStore(statePath).Record(server.BaseUrl(), stateB) != S_OK)
+            {
+                removeStateFile();
+                outError = "delta_state_save";
+                return false;
+            }
+        }
+
+        // 端末 A が 1 件を変更し、1 件を削除する。
+        PutVaultDeltaRequest churn{};
+        churn.DeviceId = L"device-a";
+        churn.Items.push_back(VaultItemRecord{ itemId(7), 1, false, sealedItem(7, 1), L"2026-01-02T00:00:00Z" });
+        churn.Items.push_back(VaultItemRecord{ itemId(8), 1, true, sealedItem(8, 1), L"2026-01-02T00:00:00Z" });
+        before = server.RequestBodyBytes() + server.ResponseBodyBytes();
+        if (FAILED(deviceA.PutVaultDelta(userId, churn, putResponse, &status)) || putResponse.BaseCursor != cursorA ||
+            putResponse.Cursor != cursorA + 2 || putResponse.Items.size() != 2 || putResponse.Items[0].ItemVersion != 2)
+        {
+            outError = "delta_churn_put";
+            return false;
+        }
+        // 起動し直した端末 B は残した cursor から読み、変わった 2 件だけを受け取る。
+        SyncDeltaState resumedB{};
+        if (!SyncDeltaStateStore(statePath).TryGet(server.BaseUrl(), userId, resumedB) || resumedB.Cursor != cursorA ||
+            resumedB.Items.size() != kItemCount || resumedB.Items[itemId(7)].ItemVersion != 1)
+        {
+            removeStateFile();
+            outError = "delta_state_resume";
+            return false;
+        }
+        removeStateFile();
+        cursorB = resumedB.Cursor;
+        if (!pullB(pulled) || pulled != 2 || cursorB != cursorA + 2 || itemsB[itemId(7)].SealedItem != sealedItem(7, 1) ||
+            !itemsB[itemId(8)].Deleted || itemsB[itemId(8)].ItemVersion != 2)
+        {
+            outError = "delta_churn_pull pulled=" + std::to_string(pulled);
+            return false;
+        }
+        uint64_t churnBytes = server.RequestBodyBytes() + server.ResponseBodyBytes() - before;
+        if (churnBytes * 100 > fullBytes)
+        {
+            outError = "delta_bytes full=" + std::to_string(fullBytes) + " churn=" + std::to_string(churnBytes);
+            return false;
+        }
+
+        // 古い版からの書き込みは 409 で、サーバーの版を返して何も書かない。
+        PutVaultDeltaRequest stale{};
+        stale.DeviceId = L"device-b";
+        stale.Items.push_back(VaultItemRecord{ itemId(9), 1, false, sealedItem(9, 2), L"2026-01-03T00:00:00Z" });
+        stale.Items.push_back(VaultItemRecord{ itemId(7), 1, false, sealedItem(7, 2), L"2026-01-03T00:00:00Z" });
+        HRESULT hr = deviceB.PutVaultDelta(userId, stale, putResponse, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) || status.StatusCode != 409 || status.ErrorCode != L"ITEM_VERSION_CONFLICT" ||
+            putResponse.Items.size() != 1 || putResponse.Items[0].ItemId != itemId(7) || putResponse.Items[0].ItemVersion != 2 ||
+            !pullB(pulled) || pulled != 0)
+        {
+            outError = "delta_conflict";
+            return false;
+        }
+        return true;
+    }
+
+    // vault 全体と item を混ぜて使う。item を書く前の vault 全体の同期はそのまま使え、
+    // item を書いた後は vault 全体の GET/PUT が 409 ITEM_SYNC_ACTIVE になり、item の変更だけが残る。
+    bool RunDeltaMixedModeSelfTest(loadtest::StandInSyncServer& server, std::shared_ptr<PosixSyncTransport> const& transport, std::string& outError)
+    {
+        std::wstring const userId = L"mixed@example.com";
+        auto makeDevice = [&](SyncClient& device) -> bool
+        {
+            device.SetTransport(transport);
+            device.SetApiKind(SyncApiKind::Axum);
+            device.SetAllowInsecureHttp(true);
+            std::wstring token;
+            SyncHttpStatus status{};
+            if (FAILED(device.DevLogin(userId, token, &status)))
+            {
+                return false;
+            }
+            device.SetBearerToken(token);
+            return true;
+        };
+        SyncClient blobDevice(server.BaseUrl());
+        SyncClient itemDevice(server.BaseUrl());
+        if (!makeDevice(blobDevice) || !makeDevice(itemDevice))
+        {
+            outError = "mixed_dev_login";
+            return false;
+        }
+
+        PutVaultRequest put{};
+        put.Blob.CiphertextBase64 = L"QUJD";
+        put.NewVersion = 1;
+        PutVaultResponse putResponse{};
+        SyncHttpStatus status{};
+        VaultRecord record{};
+        if (FAILED(blobDevice.PutVault(userId, put, putResponse, &status)) || putResponse.VaultVersion != 1 ||
+            blobDevice.GetVault(userId, record, &status) != S_OK || record.VaultVersion != 1)
+        {
+            outError = "mixed_blob_before_items status=" + std::to_string(status.StatusCode);
+            return false;
+        }
+
+        // 差分同期に移った端末が item を書く。
+        PutVaultDeltaRequest items{};
+        items.DeviceId = L"device-items";
+        items.Items.push_back(VaultItemRecord{ L"mixed-1", 0, false, std::vector<uint8_t>(32, 1), L"2026-01-01T00:00:00Z" });
+        items.Items.push_back(VaultItemRecord{ L"mixed-2", 0, false, std::vector<uint8_t>(32, 2), L"2026-01-01T00:00:00Z" });
+        PutVaultDeltaResponse itemsResponse{};
+        if (FAILED(itemDevice.PutVaultDelta(userId, items, itemsResponse, &status)) || itemsResponse.Cursor != 2)
+        {
+            outError = "mixed_items_put";
+            return false;
+        }
+
+        // vault 全体の端末は読むことも書くこともできず、送り直しもしない。
+        put.ExpectedVersion = 1;
+        put.NewVersion = 2;
+        status = {};
+        HRESULT hr = blobDevice.PutVault(userId, put, putResponse, &status);
+        SyncRetryPolicy policy;
+        SyncRetryDecision decision = policy.OnFailure(server.BaseUrl(), 1, hr, status, std::chrono::milliseconds(0));
+        if (hr != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) || status.StatusCode != 409 || status.ErrorCode != L"ITEM_SYNC_ACTIVE" ||
+            status.ServerVersion >= 0 || decision.Retry)
+        {
+            outError = "mixed_blob_put_rejected status=" + std::to_string(status.StatusCode);
+            return false;
+        }
+        status = {};
+        hr = blobDevice.GetVault(userId, record, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) || status.StatusCode != 409 || status.ErrorCode != L"ITEM_SYNC_ACTIVE")
+        {
+            outError = "mixed_blob_get_rejected status=" + std::to_string(status.StatusCode);
+            return false;
+        }
+
+        // item の変更は vault 全体の PUT に影響されない。
+        VaultChanges changes{};
+        if (FAILED(blobDevice.GetVaultChanges(userId, 0, changes, &status)) || changes.Items.size() != 2 || changes.Cursor != 2 ||
+            changes.Items[0].ItemId != L"mixed-1" || changes.Items[1].SealedItem != std::vector<uint8_t>(32, 2))
+        {
+            outError = "mixed_changes";
+            return false;
+        }
+        return true;
+    }
+
+    bool RunSelfTest(std::string& outError)
+    {
+        std::wstring clientError;
+        if (!RunSyncClientRegressionTests(clientError))
+        {
+            outError = "sync_client_" + Narrow(clientError);
+            return false;
+        }
+
+        loadtest::StandInSyncServer server;
+        if (!server.Start(outError))
+        {
+            return false;
+        }
+
+        auto transport = std::make_shared<PosixSyncTransport>();
+        SyncClient client(server.BaseUrl());
+        client.SetTransport(transport);
+        client.SetApiKind(SyncApiKind::Axum);
+        client.SetAllowInsecureHttp(true);
+
+        std::wstring const userId = L"self-test@example.com";
+        SyncHttpStatus status{};
+        VaultRecord record{};
+        HRESULT hr = client.GetVault(userId, record, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED) || status.StatusCode != 401 || status.ErrorCode != L"AUTH_MISSING")
+        {
+            outError = "unauthorized_mapping";
+            return false;
+        }
+
+        std::wstring token;
+        if (FAILED(client.DevLogin(userId, token, &status)) || token.empty() || status.RequestId.empty())
+        {
+            outError = "dev_login";
+            return false;
+        }
+        client.SetBearerToken(token);
+
+        hr = client.GetVault(userId, record, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_NOT_FOUND) || status.ErrorCode != L"VAULT_NOT_FOUND")
+        {
+            outError = "not_found_mapping";
+            return false;
+        }
+
+        PutVaultRequest put{};
+        put.ExpectedVersion = 0;
+        put.Blob.CiphertextBase64.assign(96 * 1024, L'Q');
+        PutVaultResponse putResponse{};
+        if (FAILED(client.PutVault(userId, put, putResponse, &status)) || !putResponse.Ok || putResponse.VaultVersion != 1 || putResponse.BlobSha256Base64.empty())
+        {
+            outError = "put_initial";
+            return false;
+        }
+
+        hr = client.PutVault(userId, put, putResponse, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH) || status.StatusCode != 409 || status.ServerVersion != 1 || status.ErrorCode != L"VERSION_CONFLICT")
+        {
+            outError = "conflict_mapping";
+            return false;
+        }
+
+        if (FAILED(client.GetVault(userId, record, &status)) || record.VaultVersion != 1 || record.Blob.CiphertextBase64 != put.Blob.CiphertextBase64)
+        {
+            outError = "get_roundtrip";
+            return false;
+        }
+
+        // 変わっていない vault は 304 で本文なしに返る。
+        VaultValidator known{ record.VaultVersion, record.Meta.BlobSha256Base64 };
+        VaultRecord unchanged{};
+        hr = client.GetVault(userId, known, unchanged, &status);
+        if (hr != S_FALSE || status.StatusCode != 304 || server.NotModifiedCount() != 1 || known.BlobSha256Base64.empty())
+        {
+            outError = "conditional_get_not_modified";
+            return false;
+        }
+
+        // ここまで 1 本の keep-alive 接続で足りている。
+        if (transport->ConnectCount() != 1 || server.AcceptCount() != 1)
+        {
+            outError = "keep_alive_reuse connects=" + std::to_string(transport->ConnectCount());
+            return false;
+        }
+
+        // サーバーが黙って閉じた keep-alive 接続は、新しい接続で 1 回だけ送り直す。
+        server.CloseAfterNextResponses(1);
+        if (FAILED(client.GetVault(userId, record, &status)))
+        {
+            outError = "get_before_server_close";
+            return false;
+        }
+        if (FAILED(client.GetVault(userId, record, &status)) || transport->ConnectCount() != 2)
+        {
+            outError = "stale_connection_retry connects=" + std::to_string(transport->ConnectCount());
+            return false;
+        }
+
+        SyncClient other(server.BaseUrl());
+        other.SetTransport(transport);
+        other.SetApiKind(SyncApiKind::Axum);
+        other.SetAllowInsecureHttp(true);
+        other.SetBearerToken(token);
+        hr = other.GetVault(L"someone-else@example.com", record, &status);
+        if (hr != HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED) || status.StatusCode != 403)
+        {
+            outError = "forbidden_mapping";
+            return false;
+        }
+
+        // 同じ暗号文を octet-stream で往復すると、base64+JSON より本文が 25% 近く小さい。
+        std::vector<uint8_t> cipher(96 * 1024);
+        for (size_t i = 0; i < cipher.size(); ++i)
+        {
+            cipher[i] = static_cast<uint8_t>(i * 131);
+        }
+        auto measureRoundtrip = [&](SyncVaultEncoding encoding, std::wstring const& user, uint64_t& outBytes) -> bool
+        {
+            SyncClient measured(server.BaseUrl());
+            measured.SetTransport(transport);
+            measured.SetApiKind(SyncApiKind::Axum);
+            measured.SetAllowInsecureHttp(true);
+            measured.SetVaultEncoding(encoding);
+            std::wstring userToken;
+            if (FAILED(measured.DevLogin(user, userToken, &status)))
+            {
+                return false;
+            }
+            measured.SetBearerToken(userToken);
+
+            PutVaultRequest binaryPut{};
+            binaryPut.Blob.Ciphertext = cipher;
+            uint64_t before = server.RequestBodyBytes() + server.ResponseBodyBytes();
+            VaultRecord fetched{};
+            if (FAILED(measured.PutVault(user, binaryPut, putResponse, &status)) || FAILED(measured.GetVault(user, fetched, &status)))
+            {
+                return false;
+            }
+            outBytes = server.RequestBodyBytes() + server.ResponseBodyBytes() - before;
+            if (encoding == SyncVaultEncoding::OctetStream)
+            {
+                return fetched.Blob.Ciphertext == cipher && fetched.VaultVersion == 1 && fetched.Meta.BlobSha256Base64 == putResponse.BlobSha256Base64;
+            }
+            return !fetched.Blob.CiphertextBase64.empty() && fetched.VaultVersion == 1;
+        };
+        uint64_t jsonBytes = 0;
+        uint64_t binaryBytes = 0;
+        if (!measureRoundtrip(SyncVaultEncoding::Base64Json, L"json@example.com", jsonBytes) ||
+            !measureRoundtrip(SyncVaultEncoding::OctetStream, L"binary@example.com", binaryBytes))
+        {
+            outError = "octet_stream_roundtrip";
+            return false;
+        }
+        if (binaryBytes * 4 > jsonBytes * 3 + jsonBytes / 10)
+        {
+            outError = "octet_stream_bytes json=" + std::to_string(jsonBytes) + " binary=" + std::to_string(binaryBytes);
+            return false;
+        }
+
+        if (!RunDeltaSelfTest(server, transport, outError) || !RunDeltaMixedModeSelfTest(server, transport, outError))
+        {
+            return false;
+        }
+
+        if (!RunOpaqueSelfTest(server, transport, outError))
+        {
+            return false;
+        }
+
+        server.Stop();
+        hr = client.GetVault(userId, record, &status);
+        if (SUCCEEDED(hr) || status.StatusCode != 0 || status.ErrorCode != L"CLIENT_ERROR")
+        {
+            outError = "server_down";
+            return false;
+        }
+        return RunAsyncSelfTest(outError) && RunTimeoutSelfTest(outError) && RunFaultInjectionSelfTest(transport, outError) &&
+            RunPrewarmSelfTest(outError) && RunTimingSelfTest(outError) && RunCoalescingQueueSelfTest(outError) &&
+            RunOutboxSelfTest(outError) && RunRetryPolicySelfTest(transport, outError) &&
+            RunSyncStateStoreSelfTest(transport, outError) && RunDeltaStateStoreSelfTest(outError) && RunConflictVaultSelfTest(transport, outError) &&
+            RunVaultExecutorSelfTest(transport, outError) && loadtest::RunVaultMergeSelfTest(outError);
+    }
+
+    void PrintUsage()
+    {
+        fprintf(stderr,
+            "usage: sync_loadtest [options]\n"
+            "  --url URL              sync server base URL (default: built-in stand-in server)\n"
+            "  --concurrency N        parallel SyncClient workers (default 4)\n"
+            "  --iterations N         put+get rounds per worker (default 50)\n"
+            "  --users N              distinct vault users; fewer than workers causes 409s (default = concurrency)\n"
+            "  --vaults N             sync N vaults serially and through SyncVaultExecutor (max parallel = concurrency) and exit\n"
+            "  --blob-bytes N         vault cipher size before base64 (default 4096)\n"
+            "  --binary               send and receive vaults as application/octet-stream\n"
+            "  --server-latency-us N  stand-in server delay per response\n"
+            "  --server-jitter-us N   extra random stand-in delay, 0..N\n"
+            "  --error-rate R         stand-in answers 503 to this fraction of requests (0-1)\n"
+            "  --conflict-rate R      stand-in answers 409 to this fraction of vault PUTs (0-1)\n"
+            "  --unauthorized-rate R  stand-in answers 401 to this fraction of authorized requests (0-1)\n"
+            "  --fault-seed N         random seed for the injected faults (default 1)\n"
+            "  --self-test            run SyncClient self-test and exit\n"
+            "  --merge-benchmark N    merge two N-item vault documents (old, hashed and three-way merge) and exit\n");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // 相手が閉じたソケットへの書き込みで終了しないようにする (エラーは send の戻り値で扱う)。
+    std::signal(SIGPIPE, SIG_IGN);
+
+    LoadTestOptions options{};
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view arg = argv[i];
+        auto next = [&]() -> char const*
+        {
+            if (i + 1 >= argc)
+            {
+                PrintUsage();
+                exit(2);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--self-test")
+        {
+            std::string error;
+            if (!RunSelfTest(error))
+            {
+                fprintf(stderr, "self-test FAILED: %s\n", error.c_str());
+                return 1;
+            }
+            printf("self-test passed\n");
+            return 0;
+        }
+        else if (arg == "--merge-benchmark")
+        {
+            return loadtest::RunVaultMergeBenchmark(static_cast<size_t>(std::max(0, atoi(next()))));
+        }
+        else if (arg == "--url")
+        {
+            std::string_view value = next();
+            options.BaseUrl.assign(value.begin(), value.end());
+        }
+        else if (arg == "--concurrency")
+        {
+            options.Concurrency = static_cast<uint32_t>(std::max(1, atoi(next())));
+        }
+        else if (arg == "--iterations")
+        {
+            options.Iterations = static_cast<uint32_t>(std::max(1, atoi(next())));
+        }
+        else if (arg == "--users")
+        {
+            options.Users = static_cast<uint32_t>(std::max(1, atoi(next())));
+        }
+        else if (arg == "--vaults")
+        {
+            options.Vaults = static_cast<uint32_t>(std::max(1, atoi(next())));
+        }
+        else if (arg == "--blob-bytes")
+        {
+            options.BlobBytes = static_cast<size_t>(std::max(0, atoi(next())));
+        }
+        else if (arg == "--binary")
+        {
+            options.Encoding = SyncVaultEncoding::OctetStream;
+        }
+        else if (arg == "--server-latency-us")
+        {
+            options.Server.ResponseLatency = std::chrono::microseconds(atoll(next()));
+        }
+        else if (arg == "--server-jitter-us")
+        {
+            options.Server.ResponseLatencyJitter = std::chrono::microseconds(atoll(next()));
+        }
+        else if (arg == "--error-rate")
+        {
+            options.Server.ErrorRate = atof(next());
+        }
+        else if (arg == "--conflict-rate")
+        {
+            options.Server.ConflictRate = atof(next());
+        }
+        else if (arg == "--unauthorized-rate")
+        {
+            options.Server.UnauthorizedRate = atof(next());
+        }
+        else if (arg == "--fault-seed")
+        {
+            options.Server.FaultSeed = static_cast<uint32_t>(strtoul(next(), nullptr, 10));
+        }
+        else if (arg == "--help" || arg == "-h")
+        {
+            PrintUsage();
+            return 0;
+        }
+        else
+        {
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    if (options.Vaults != 0)
+    {
+        return RunVaultSyncBenchmark(std::move(options));
+    }
+    return RunLoadTest(std::move(options));
+}
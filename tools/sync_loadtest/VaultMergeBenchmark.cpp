@@ -0,0 +1,518 @@
+#include "VaultMergeBenchmark.h"
+
+#include "VaultMerge.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cwchar>
+#include <cwctype>
+#include <map>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace tsupasswd::loadtest
+{
+    namespace
+    {
+        using Clock = std::chrono::steady_clock;
+
+        // 以前の PluginRegistrationManager の identity (WinRT の Uri が解釈できない URL の扱い)。
+        std::wstring ReferenceNormalizeVaultIdentityPart(std::wstring value)
+        {
+            auto first = value.find_first_not_of(L" \t\r\n");
+            if (first == std::wstring::npos)
+            {
+                return {};
+            }
+            auto last = value.find_last_not_of(L" \t\r\n");
+            value = value.substr(first, last - first + 1);
+            std::transform(value.begin(), value.end(), value.begin(), [](wchar_t ch)
+            {
+                return static_cast<wchar_t>(towlower(ch));
+            });
+            return value;
+        }
+
+        std::wstring ReferenceExtractRpIdFromUrl(std::wstring const& url)
+        {
+            std::wstring trimmed = url;
+            auto first = trimmed.find_first_not_of(L" \t\r\n");
+            if (first == std::wstring::npos)
+            {
+                return {};
+            }
+            auto last = trimmed.find_last_not_of(L" \t\r\n");
+            trimmed = trimmed.substr(first, last - first + 1);
+
+            std::wstring candidate = trimmed;
+            auto scheme = candidate.find(L"://");
+            if (scheme != std::wstring::npos)
+            {
+                candidate = candidate.substr(scheme + 3);
+            }
+            auto slash = candidate.find_first_of(L"/\t\r\n");
+            if (slash != std::wstring::npos)
+            {
+                candidate = candidate.substr(0, slash);
+            }
+            auto at = candidate.rfind(L"@");
+            if (at != std::wstring::npos)
+            {
+                candidate = candidate.substr(at + 1);
+            }
+            auto colon = candidate.rfind(L":");
+            if (colon != std::wstring::npos)
+            {
+                candidate = candidate.substr(0, colon);
+            }
+            return ReferenceNormalizeVaultIdentityPart(std::move(candidate));
+        }
+
+        std::wstring ReferenceBuildVaultLoginIdentity(VaultItemV1 const& item)
+        {
+            if (item.ItemType != VaultItemType::Login)
+            {
+                return {};
+            }
+
+            std::wstring rpId = ReferenceExtractRpIdFromUrl(item.Login.Url);
+            if (rpId.empty())
+            {
+                rpId = ReferenceNormalizeVaultIdentityPart(item.Login.Url);
+            }
+            return rpId +
+                L"\n" + ReferenceNormalizeVaultIdentityPart(item.Login.Username);
+        }
+
+        // 以前の PluginRegistrationManager の MergeVaultDocuments (詳細ログを除く)。結果を比べる基準。
+        VaultMergeResult ReferenceMergeVaultDocuments(
+            VaultDocumentV1 localDoc,
+            std::vector<VaultItemV1> const& serverItems,
+            std::wstring const& fallbackVaultId)
+        {
+            VaultMergeResult result{};
+            if (localDoc.SchemaVersion <= 0)
+            {
+                localDoc.SchemaVersion = 1;
+            }
+            if (localDoc.VaultId.empty())
+            {
+                localDoc.VaultId = fallbackVaultId;
+            }
+
+            std::map<std::wstring, size_t> localIndexById;
+            for (size_t index = 0; index < localDoc.Items.size(); ++index)
+            {
+                if (!localDoc.Items[index].ItemId.empty())
+                {
+                    localIndexById.emplace(localDoc.Items[index].ItemId, index);
+                }
+            }
+
+            for (auto const& serverItem : serverItems)
+            {
+                if (serverItem.ItemId.empty())
+                {
+                    continue;
+                }
+
+                auto found = localIndexById.find(serverItem.ItemId);
+                if (found == localIndexById.end())
+                {
+                    localIndexById.emplace(serverItem.ItemId, localDoc.Items.size());
+                    localDoc.Items.push_back(serverItem);
+                    result.Stats.AddedFromServer += 1;
+                    if (serverItem.Deleted)
+                    {
+                        result.Stats.TombstonesApplied += 1;
+                    }
+                    continue;
+                }
+
+                auto& localItem = localDoc.Items[found->second];
+                if (serverItem.UpdatedAt > localItem.UpdatedAt)
+                {
+                    if (serverItem.Deleted && !localItem.Deleted)
+                    {
+                        result.Stats.TombstonesApplied += 1;
+                    }
+                    localItem = serverItem;
+                    result.Stats.UpdatedFromServer += 1;
+                }
+            }
+
+            auto maxUpdatedAt = [](std::wstring const& left, std::wstring const& right)
+            {
+                return left >= right ? left : right;
+            };
+            std::map<std::wstring, size_t> canonicalIndexByIdentity;
+            std::vector<VaultItemV1> dedupedItems;
+            dedupedItems.reserve(localDoc.Items.size());
+            for (auto const& item : localDoc.Items)
+            {
+                std::wstring identity = ReferenceBuildVaultLoginIdentity(item);
+                if (identity.empty())
+                {
+                    dedupedItems.push_back(item);
+                    continue;
+                }
+
+                auto foundIdentity = canonicalIndexByIdentity.find(identity);
+                if (foundIdentity == canonicalIndexByIdentity.end())
+                {
+                    canonicalIndexByIdentity.emplace(identity, dedupedItems.size());
+                    dedupedItems.push_back(item);
+                    continue;
+                }
+
+                auto& canonicalItem = dedupedItems[foundIdentity->second];
+                bool preferIncoming = item.UpdatedAt >= canonicalItem.UpdatedAt;
+                if (preferIncoming)
+                {
+                    canonicalItem = item;
+                }
+                canonicalItem.CreatedAt = canonicalItem.CreatedAt.empty() ? item.CreatedAt : canonicalItem.CreatedAt;
+                canonicalItem.UpdatedAt = maxUpdatedAt(canonicalItem.UpdatedAt, item.UpdatedAt);
+                if (canonicalItem.Deleted || item.Deleted)
+                {
+                    canonicalItem.Deleted = canonicalItem.Deleted || item.Deleted;
+                    canonicalItem.DeletedAt = maxUpdatedAt(canonicalItem.DeletedAt, item.DeletedAt);
+                }
+                result.Stats.DuplicatesCollapsed += 1;
+            }
+
+            localDoc.Items = std::move(dedupedItems);
+            result.Document = std::move(localDoc);
+            return result;
+        }
+
+        std::wstring Timestamp(uint32_t value)
+        {
+            wchar_t buffer[32]{};
+            swprintf(buffer, sizeof(buffer) / sizeof(buffer[0]), L"2025-01-01T%08u", value);
+            return buffer;
+        }
+
+        // siteCount を items より十分小さくすると、別の ItemId の同じ login (重複) が多くなる。
+        VaultItemV1 MakeItem(std::mt19937& random, size_t itemNumber, size_t siteCount)
+        {
+            VaultItemV1 item{};
+            item.ItemId = random() % 97 == 0 ? std::wstring{} : L"item-" + std::to_wstring(itemNumber);
+            std::wstring site = std::to_wstring(random() % siteCount);
+            std::wstring user = std::to_wstring(random() % 4);
+            switch (random() % 5)
+            {
+            case 0: item.Login.Url = L"https://site" + site + L".example.com/login"; break;
+            case 1: item.Login.Url = L"  HTTPS://Site" + site + L".Example.com:443/path?q=1 "; break;
+            case 2: item.Login.Url = L"site" + site + L".example.com"; break;
+            case 3: item.Login.Url = L"https://name@site" + site + L".example.com/"; break;
+            default: item.Login.Url = L"android://site" + site; break;
+            }
+            item.Login.Username = random() % 2 == 0 ? L"user" + user : L" User" + user + L"\t";
+            item.Login.Password = L"password-" + std::to_wstring(random());
+            item.Title = L"Site " + site;
+            item.UpdatedAt = Timestamp(random() % 1000000);
+            item.CreatedAt = random() % 3 == 0 ? std::wstring{} : Timestamp(random() % 1000);
+            item.Deleted = random() % 8 == 0;
+            item.DeletedAt = item.Deleted ? item.UpdatedAt : std::wstring{};
+            return item;
+        }
+
+        // ローカルは item-0 から、サーバーは item-(n/2) から n 件 (半分が同じ ItemId)。ローカルには同じ ItemId も少し混ぜる。
+        void MakeDocuments(size_t itemsPerDocument, uint32_t seed, VaultDocumentV1& outLocal, VaultDocumentV1& outServer)
+        {
+            std::mt19937 random(seed);
+            size_t siteCount = std::max<size_t>(1, itemsPerDocument / 3);
+            outLocal = {};
+            outLocal.Revision = 7;
+            outServer = {};
+            outServer.VaultId = L"vault-server";
+            outServer.Revision = 9;
+            for (size_t i = 0; i < itemsPerDocument; ++i)
+            {
+                outLocal.Items.push_back(MakeItem(random, random() % 50 == 0 ? i / 2 : i, siteCount));
+                outServer.Items.push_back(MakeItem(random, itemsPerDocument / 2 + i, siteCount));
+            }
+        }
+
+        bool SameItem(VaultItemV1 const& left, VaultItemV1 const& right)
+        {
+            return left.ItemId == right.ItemId && left.ItemType == right.ItemType && left.Title == right.Title &&
+                left.Notes == right.Notes && left.CreatedAt == right.CreatedAt && left.UpdatedAt == right.UpdatedAt &&
+                left.Deleted == right.Deleted && left.DeletedAt == right.DeletedAt &&
+                left.Login.Username == right.Login.Username && left.Login.Password == right.Login.Password &&
+                left.Login.Url == right.Login.Url && left.Login.TotpSecret == right.Login.TotpSecret;
+        }
+
+        bool SameResult(VaultMergeResult const& expected, VaultMergeResult const& actual, std::string& outDetail)
+        {
+            VaultDocumentV1 const& left = expected.Document;
+            VaultDocumentV1 const& right = actual.Document;
+            if (left.SchemaVersion != right.SchemaVersion || left.VaultId != right.VaultId || left.Revision != right.Revision)
+            {
+                outDetail = "document_header";
+                return false;
+            }
+            if (expected.Stats.AddedFromServer != actual.Stats.AddedFromServer ||
+                expected.Stats.UpdatedFromServer != actual.Stats.UpdatedFromServer ||
+                expected.Stats.TombstonesApplied != actual.Stats.TombstonesApplied ||
+                expected.Stats.DuplicatesCollapsed != actual.Stats.DuplicatesCollapsed)
+            {
+                outDetail = "stats";
+                return false;
+            }
+            if (left.Items.size() != right.Items.size())
+            {
+                outDetail = "item_count expected=" + std::to_string(left.Items.size()) + " actual=" + std::to_string(right.Items.size());
+                return false;
+            }
+            for (size_t i = 0; i < left.Items.size(); ++i)
+            {
+                if (!SameItem(left.Items[i], right.Items[i]))
+                {
+                    outDetail = "item index=" + std::to_string(i);
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        VaultMergeResult ReferenceMerge(VaultDocumentV1 local, VaultDocumentV1 const& server)
+        {
+            VaultMergeResult result = ReferenceMergeVaultDocuments(std::move(local), server.Items, server.VaultId);
+            result.Document.Revision = (std::max)(result.Document.Revision, server.Revision);
+            return result;
+        }
+
+        // 同じ ItemId の 2 件目以降を除く (どちらを先に見るかで二方向と三方向の結果が変わるため)。
+        void RemoveDuplicateItemIds(VaultDocumentV1& doc)
+        {
+            std::set<std::wstring> seen;
+            std::vector<VaultItemV1> items;
+            for (auto& item : doc.Items)
+            {
+                if (item.ItemId.empty() || seen.insert(item.ItemId).second)
+                {
+                    items.push_back(std::move(item));
+                }
+            }
+            doc.Items = std::move(items);
+        }
+
+        // 前回の同期の結果を基準にし、手元とサーバーでそれぞれ changesPerSide 件ずつ password を変える
+        // (重ならない範囲で、サーバーの変更は基準より古い時刻にする)。
+        void MakeThreeWayDocuments(size_t itemsPerDocument, size_t changesPerSide, VaultDocumentV1& outBase, VaultDocumentV1& outLocal, VaultDocumentV1& outServer)
+        {
+            VaultDocumentV1 local{};
+            VaultDocumentV1 server{};
+            MakeDocuments(itemsPerDocument, 42, local, server);
+            outBase = MergeVaultDocuments(std::move(local), std::move(server), L"fallback").Document;
+            outLocal = outBase;
+            outServer = outBase;
+            size_t count = outBase.Items.size();
+            for (size_t i = 0; i < changesPerSide && 2 * i + 1 < count; ++i)
+            {
+                VaultItemV1& localItem = outLocal.Items[count - 1 - 2 * i];
+                localItem.Login.Password += L"-local";
+                localItem.UpdatedAt = Timestamp(2000000 + static_cast<uint32_t>(i));
+                VaultItemV1& serverItem = outServer.Items[count - 2 - 2 * i];
+                serverItem.Login.Password += L"-server";
+                serverItem.UpdatedAt = Timestamp(static_cast<uint32_t>(i));
+            }
+        }
+
+        VaultItemV1 const* FindItem(VaultDocumentV1 const& doc, std::wstring const& itemId)
+        {
+            for (auto const& item : doc.Items)
+            {
+                if (item.ItemId == itemId)
+                {
+                    return &item;
+                }
+            }
+            return nullptr;
+        }
+
+        bool RunThreeWayMergeSelfTest(std::string& outError)
+        {
+            // 基準がなければ二方向と同じ。
+            for (uint32_t seed = 1; seed <= 3; ++seed)
+            {
+                VaultDocumentV1 local{};
+                VaultDocumentV1 server{};
+                MakeDocuments(seed == 1 ? 0 : 400 * seed, seed + 20, local, server);
+                RemoveDuplicateItemIds(local);
+                VaultMergeResult expected = MergeVaultDocuments(local, server, L"fallback");
+                VaultMergeResult actual = MergeVaultDocumentsThreeWay(VaultDocumentV1{}, std::move(local), std::move(server), L"fallback");
+                std::string detail;
+                if (!SameResult(expected, actual, detail))
+                {
+                    outError = "three_way_without_base seed=" + std::to_string(seed) + " " + detail;
+                    return false;
+                }
+            }
+
+            // どちらも変わっていなければ何もしない。
+            VaultDocumentV1 base{};
+            VaultDocumentV1 local{};
+            VaultDocumentV1 server{};
+            MakeThreeWayDocuments(600, 0, base, local, server);
+            VaultMergeResult unchanged = MergeVaultDocumentsThreeWay(base, local, server, L"fallback");
+            std::string detail;
+            if (!SameResult(VaultMergeResult{ local, {} }, unchanged, detail) || unchanged.ServerChanges != 0 ||
+                unchanged.LocalChanges != 0 || unchanged.DedupeScanned)
+            {
+                outError = "three_way_unchanged " + detail;
+                return false;
+            }
+
+            // サーバーの変更は時刻が古くても取り、手元の変更も残す。password だけの変更では重複を探さない。
+            MakeThreeWayDocuments(600, 5, base, local, server);
+            size_t count = base.Items.size();
+            std::wstring localChangedId = local.Items[count - 1].ItemId;
+            std::wstring serverChangedId = server.Items[count - 2].ItemId;
+            VaultMergeResult merged = MergeVaultDocumentsThreeWay(base, local, server, L"fallback");
+            VaultItemV1 const* serverChanged = FindItem(merged.Document, serverChangedId);
+            VaultItemV1 const* localChanged = FindItem(merged.Document, localChangedId);
+            if (serverChanged == nullptr || serverChanged->Login.Password.find(L"-server") == std::wstring::npos ||
+                localChanged == nullptr || localChanged->Login.Password.find(L"-local") == std::wstring::npos ||
+                merged.ServerChanges != 5 || merged.LocalChanges != 5 || merged.Conflicts != 0 ||
+                merged.Stats.UpdatedFromServer != 5 || merged.DedupeScanned || merged.Document.Items.size() != count)
+            {
+                outError = "three_way_disjoint_changes";
+                return false;
+            }
+
+            // 両方で変わった item だけ UpdatedAt の新しい方。サーバーが足した同じ login はまとめる。
+            server.Items[count - 1] = local.Items[count - 1];
+            server.Items[count - 1].Login.Password = L"password-server-newer";
+            server.Items[count - 1].UpdatedAt = Timestamp(3000000);
+            VaultItemV1 duplicate = base.Items[0];
+            duplicate.ItemId = L"item-server-duplicate";
+            duplicate.Login.Username = L" " + duplicate.Login.Username + L" ";
+            duplicate.Deleted = false;
+            duplicate.UpdatedAt = Timestamp(3000001);
+            bool duplicateIsLogin = duplicate.ItemType == VaultItemType::Login;
+            server.Items.push_back(duplicate);
+            merged = MergeVaultDocumentsThreeWay(base, local, server, L"fallback");
+            VaultItemV1 const* conflicted = FindItem(merged.Document, localChangedId);
+            if (conflicted == nullptr || conflicted->Login.Password != L"password-server-newer" || merged.Conflicts != 1 ||
+                merged.Stats.AddedFromServer != 1 || !merged.DedupeScanned ||
+                (duplicateIsLogin && (merged.Stats.DuplicatesCollapsed != 1 || merged.Document.Items.size() != count)))
+            {
+                outError = "three_way_conflict_and_duplicate";
+                return false;
+            }
+            return true;
+        }
+    }
+
+    bool RunVaultMergeSelfTest(std::string& outError)
+    {
+        for (uint32_t seed = 1; seed <= 4; ++seed)
+        {
+            VaultDocumentV1 local{};
+            VaultDocumentV1 server{};
+            MakeDocuments(seed == 1 ? 0 : 500 * seed, seed, local, server);
+            VaultMergeResult expected = ReferenceMerge(local, server);
+            VaultMergeResult actual = MergeVaultDocuments(std::move(local), std::move(server), L"fallback");
+            std::string detail;
+            if (!SameResult(expected, actual, detail))
+            {
+                outError = "vault_merge seed=" + std::to_string(seed) + " " + detail;
+                return false;
+            }
+            if (seed > 1 && (actual.Stats.DuplicatesCollapsed == 0 || actual.Stats.UpdatedFromServer == 0 || actual.Stats.TombstonesApplied == 0))
+            {
+                outError = "vault_merge_coverage seed=" + std::to_string(seed);
+                return false;
+            }
+        }
+
+        // 差分同期と同じく、変わった item だけを渡す形。
+        VaultDocumentV1 local{};
+        VaultDocumentV1 server{};
+        MakeDocuments(300, 11, local, server);
+        std::vector<VaultItemV1> changes(server.Items.begin(), server.Items.begin() + 40);
+        VaultMergeResult expected = ReferenceMergeVaultDocuments(local, changes, L"fallback");
+        VaultMergeResult actual = MergeVaultDocuments(std::move(local), std::move(changes), L"fallback");
+        std::string detail;
+        if (!SameResult(expected, actual, detail))
+        {
+            outError = "vault_merge_items " + detail;
+            return false;
+        }
+        return RunThreeWayMergeSelfTest(outError);
+    }
+
+    int RunVaultMergeBenchmark(size_t itemsPerDocument)
+    {
+        constexpr int kRounds = 3;
+        VaultDocumentV1 local{};
+        VaultDocumentV1 server{};
+        MakeDocuments(itemsPerDocument, 42, local, server);
+
+        double referenceMs = 0;
+        double hashedMs = 0;
+        VaultMergeResult expected{};
+        VaultMergeResult actual{};
+        // 前の回の結果を捨てる時間を測らないよう、結果は計り終えてから置き換える。
+        for (int round = 0; round < kRounds; ++round)
+        {
+            VaultDocumentV1 localCopy = local;
+            auto start = Clock::now();
+            VaultMergeResult merged = ReferenceMerge(std::move(localCopy), server);
+            double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            referenceMs = round == 0 ? elapsed : std::min(referenceMs, elapsed);
+            expected = std::move(merged);
+
+            localCopy = local;
+            VaultDocumentV1 serverCopy = server;
+            start = Clock::now();
+            merged = MergeVaultDocuments(std::move(localCopy), std::move(serverCopy), L"fallback");
+            elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            hashedMs = round == 0 ? elapsed : std::min(hashedMs, elapsed);
+            actual = std::move(merged);
+        }
+
+        std::string detail;
+        bool identical = SameResult(expected, actual, detail);
+        printf("vault merge: local_items=%zu server_items=%zu output_items=%zu duplicates_collapsed=%zu best_of=%d\n",
+            local.Items.size(), server.Items.size(), actual.Document.Items.size(), actual.Stats.DuplicatesCollapsed, kRounds);
+        printf("  reference(std::map)  %10.1f ms\n", referenceMs);
+        printf("  hashed               %10.1f ms  speedup=%.2fx\n", hashedMs, hashedMs > 0 ? referenceMs / hashedMs : 0.0);
+        printf("  identical=%s%s%s\n", identical ? "yes" : "no", identical ? "" : " ", detail.c_str());
+
+        // 前回の同期から両側で 0.5% ずつ変わった文書を、二方向と三方向でマージする。
+        VaultDocumentV1 base{};
+        MakeThreeWayDocuments(itemsPerDocument, std::max<size_t>(1, itemsPerDocument / 200), base, local, server);
+        double twoWayMs = 0;
+        double threeWayMs = 0;
+        VaultMergeResult threeWay{};
+        for (int round = 0; round < kRounds; ++round)
+        {
+            VaultDocumentV1 localCopy = local;
+            VaultDocumentV1 serverCopy = server;
+            auto start = Clock::now();
+            VaultMergeResult merged = MergeVaultDocuments(std::move(localCopy), std::move(serverCopy), L"fallback");
+            double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            twoWayMs = round == 0 ? elapsed : std::min(twoWayMs, elapsed);
+
+            localCopy = local;
+            serverCopy = server;
+            start = Clock::now();
+            VaultMergeResult mergedFromBase = MergeVaultDocumentsThreeWay(base, std::move(localCopy), std::move(serverCopy), L"fallback");
+            elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            threeWayMs = round == 0 ? elapsed : std::min(threeWayMs, elapsed);
+            threeWay = std::move(mergedFromBase);
+        }
+        printf("vault merge from base: items=%zu server_changes=%zu local_changes=%zu conflicts=%zu dedupe_scanned=%s\n",
+            base.Items.size(), threeWay.ServerChanges, threeWay.LocalChanges, threeWay.Conflicts, threeWay.DedupeScanned ? "true" : "false");
+        printf("  two_way              %10.1f ms\n", twoWayMs);
+        printf("  three_way            %10.1f ms  speedup=%.2fx\n", threeWayMs, threeWayMs > 0 ? twoWayMs / threeWayMs : 0.0);
+        return identical ? 0 : 1;
+    }
+}
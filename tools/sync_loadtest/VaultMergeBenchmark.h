@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace tsupasswd::loadtest
+{
+    // MergeVaultDocuments (src/VaultMerge.cpp) が以前の std::map による実装と同じ文書と集計を返すことを、
+    // ItemId の重なり・大小文字や空白だけが違う login の重複・tombstone を含む文書で確かめる。
+    // MergeVaultDocumentsThreeWay が基準の有無・時刻の古いサーバーの変更・両側の変更・重複を正しく扱うことも確かめる。
+    bool RunVaultMergeSelfTest(std::string& outError);
+
+    // itemsPerDocument 件ずつのローカルとサーバーの文書を以前の実装と MergeVaultDocuments でマージし、
+    // それぞれの時間と結果が一致したかを出力する。一致しなければ 1。
+    // 続けて前回の結果を基準に両側で少しずつ変えた文書を、二方向と三方向でマージした時間を出力する。
+    int RunVaultMergeBenchmark(size_t itemsPerDocument);
+}